@@ -1,5 +1,7 @@
 #include "llamafu.h"
 #include "llama.h"
+#include "gguf.h"
+#include "ggml-cpu.h"
 #include <stdexcept>
 #include <cstring>
 #include <vector>
@@ -13,9 +15,54 @@
 #include <algorithm>
 #include <cctype>
 #include <filesystem>
-
-// Include CLIP for multimodal support (C++ header, no extern "C")
-#include "../../llama.cpp/tools/mtmd/clip.h"
+#include <deque>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <bitset>
+#include <functional>
+#include <random>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#if defined(LLAMAFU_ENABLE_TRACING)
+#include <os/signpost.h>
+#endif
+#include <CoreGraphics/CoreGraphics.h>
+#include <ImageIO/ImageIO.h>
+#endif
+#if defined(__ANDROID__)
+#include <dlfcn.h>
+#include <sys/system_properties.h>
+#endif
+
+// Multimodal support: mtmd owns the projector and splits prompts into text
+// and media chunks
+#include "mtmd.h"
+#include "mtmd-helper.h"
+
+// Image decoding. The implementation is compiled in with internal linkage so
+// it cannot clash with the copy linked into mtmd.
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_STATIC
+#define STBI_NO_STDIO
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_PNG
+#define STBI_ONLY_BMP
+#include "stb/stb_image.h"
 
 // Base64 encoding/decoding utilities
 #include <array>
@@ -26,6 +73,103 @@ typedef llama_memory_t LlamafuMemory;
 typedef llama_seq_id LlamafuSeqId;
 typedef llama_pos LlamafuPos;
 
+// =============================================================================
+// Timing and Trace Spans
+// =============================================================================
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since, std::chrono::steady_clock::time_point until) {
+    return std::chrono::duration<double, std::milli>(until - since).count();
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return elapsed_ms(since, std::chrono::steady_clock::now());
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// LLAMAFU_TRACE_SCOPE("name") marks the rest of the enclosing block as a span
+// in system traces when built with LLAMAFU_ENABLE_TRACING: ATrace sections
+// on Android (Perfetto, systrace) and os_signpost intervals on Apple
+// (Instruments). Names must be string literals. Without the flag the macro
+// compiles to nothing.
+#define LLAMAFU_TRACE_CONCAT_(a, b) a##b
+#define LLAMAFU_TRACE_CONCAT(a, b) LLAMAFU_TRACE_CONCAT_(a, b)
+
+#if defined(LLAMAFU_ENABLE_TRACING) && defined(__ANDROID__)
+// ATrace is API 23+; it is resolved at runtime so older devices skip spans
+struct AndroidTrace {
+    bool (*is_enabled)() = nullptr;
+    void (*begin_section)(const char*) = nullptr;
+    void (*end_section)() = nullptr;
+
+    AndroidTrace() {
+        is_enabled = reinterpret_cast<bool (*)()>(dlsym(RTLD_DEFAULT, "ATrace_isEnabled"));
+        begin_section = reinterpret_cast<void (*)(const char*)>(dlsym(RTLD_DEFAULT, "ATrace_beginSection"));
+        end_section = reinterpret_cast<void (*)()>(dlsym(RTLD_DEFAULT, "ATrace_endSection"));
+        if (!begin_section || !end_section) {
+            is_enabled = nullptr;
+        }
+    }
+};
+
+static const AndroidTrace& android_trace() {
+    static const AndroidTrace trace;
+    return trace;
+}
+
+struct TraceSpan {
+    bool active;
+
+    explicit TraceSpan(const char* name) : active(android_trace().is_enabled && android_trace().is_enabled()) {
+        if (active) {
+            android_trace().begin_section(name);
+        }
+    }
+    ~TraceSpan() {
+        if (active) {
+            android_trace().end_section();
+        }
+    }
+};
+
+#define LLAMAFU_TRACE_SCOPE(name) TraceSpan LLAMAFU_TRACE_CONCAT(llamafu_trace_, __LINE__)(name)
+#elif defined(LLAMAFU_ENABLE_TRACING) && defined(__APPLE__)
+static os_log_t trace_log() {
+    static os_log_t log = os_log_create("com.skelf.llamafu", "generation");
+    return log;
+}
+
+template <typename End>
+struct TraceSpanEnd {
+    End end;
+    ~TraceSpanEnd() { end(); }
+};
+
+template <typename End>
+static TraceSpanEnd<End> trace_span_end(End end) {
+    return TraceSpanEnd<End>{end};
+}
+
+// os_signpost needs the literal at both ends, so the end call is expanded here
+#define LLAMAFU_TRACE_SCOPE(name)                                                                       \
+    const os_signpost_id_t LLAMAFU_TRACE_CONCAT(llamafu_trace_id_, __LINE__) =                         \
+        os_signpost_id_generate(trace_log());                                                           \
+    os_signpost_interval_begin(trace_log(), LLAMAFU_TRACE_CONCAT(llamafu_trace_id_, __LINE__), name);   \
+    const auto LLAMAFU_TRACE_CONCAT(llamafu_trace_, __LINE__) =                                         \
+        trace_span_end([id = LLAMAFU_TRACE_CONCAT(llamafu_trace_id_, __LINE__)] {                       \
+            os_signpost_interval_end(trace_log(), id, name);                                            \
+        })
+#else
+#define LLAMAFU_TRACE_SCOPE(name) ((void)0)
+#endif
+
 struct LlamafuSampler_s {
     llama_sampler* sampler;
     LlamafuSamplerType type;
@@ -36,23 +180,198 @@ struct LlamafuBatch_s {
     llama_batch batch;
 };
 
+struct LlamafuGrammarSampler_s {
+    llama_sampler* sampler;
+};
+
+// Parsed grammar kept in a handle's grammar cache. The sampler is never
+// used for sampling itself, only cloned.
+struct GrammarCacheEntry {
+    size_t key;                            // Hash of grammar and root
+    std::string grammar;
+    std::string root;
+    llama_sampler* sampler;
+};
+
+// Parsed grammars kept per handle (least recently used evicted first)
+static const size_t GRAMMAR_CACHE_CAPACITY = 16;
+
+// Encoded image kept in a handle's image cache
+struct ImageCacheEntry {
+    uint64_t key;                          // Hash of the source bytes
+    size_t source_size;
+    std::vector<float> embeddings;         // n_tokens * n_embd floats
+    int32_t n_tokens;
+    int32_t source_width;
+    int32_t source_height;
+    int32_t processed_width;
+    int32_t processed_height;
+};
+
+// Default byte budget of a handle's image cache, enough for a few images at
+// the usual 576-1024 tokens per image
+static const uint64_t DEFAULT_IMAGE_CACHE_BYTES = 64ULL << 20;
+
+// A backend buffer llama.cpp allocated for a handle
+struct BufferRecord {
+    std::string buffer_type;               // e.g. "CPU", "CPU_Mapped", "Metal", "Vulkan0"
+    LlamafuBufferKind kind;
+    uint64_t size_bytes;
+};
+
+// Adapters set on a context with their scales, ordered by adapter
+using LoraSet = std::vector<std::pair<llama_adapter_lora*, float>>;
+
+// A loaded LoRA adapter. It stays resident until unloaded; whether it applies
+// is decided per request (active = part of the handle's default set).
+struct LlamafuLoraAdapter_s {
+    struct Llamafu_s* owner;
+    llama_adapter_lora* adapter;
+    std::string path;
+    std::string name;
+    std::string description;
+    std::string target_modules;            // Comma-separated, e.g. "attn_k,attn_q,attn_v"
+    float scale = 1.0f;                    // Used while active and by requests that give none
+    bool active = false;
+    size_t parameter_count = 0;
+    int64_t created_timestamp = 0;         // Load time, Unix seconds
+    std::vector<BufferRecord> buffers;     // Backend buffers holding the tensors
+
+    // Created by llamafu_lora_adapter_init: freeing the handle first only
+    // releases the weights (owner and adapter become null) and leaves the
+    // struct to llamafu_lora_adapter_free
+    bool owned_by_caller = false;
+    std::atomic<bool> free_requested{false};  // Freed while a request held the handle
+};
+
 struct Llamafu_s {
     llama_model* model;
     llama_context* ctx;
     bool is_multimodal;
-    std::map<LlamafuLoraAdapter, llama_adapter_lora*> lora_adapters;
+    std::vector<LlamafuLoraAdapter> lora_adapters;  // Loaded adapters, load order
     std::vector<LlamafuSampler> samplers;
     llama_sampler* default_sampler;
+    // Set from any thread while queued or streamed requests poll it, so the
+    // pair is replaced and read together under abort_mutex
     LlamafuAbortCallback abort_callback;
     void* abort_callback_data;
 
     // Multimodal support
-    struct clip_ctx* clip_ctx_vision;      // CLIP vision context
-    struct clip_ctx* clip_ctx_audio;       // CLIP audio context (future)
-    bool vision_initialized;               // Whether vision context is ready
-
-    // Image processing cache
-    std::map<std::string, std::vector<float>> image_embeddings_cache;
+    mtmd_context* mtmd_ctx;                // Projector for image (and audio) inputs
+    int32_t vision_image_size;             // Projector input size, from the mmproj file
+    bool vision_initialized;               // Whether mtmd_ctx is ready
+
+    // Image embeddings by source content (least recently used evicted first
+    // once over image_cache_max_bytes)
+    std::list<ImageCacheEntry> image_embeddings_cache;
+    uint64_t image_cache_bytes = 0;
+    uint64_t image_cache_max_bytes = DEFAULT_IMAGE_CACHE_BYTES;
+    int32_t image_cache_hits = 0;
+    int32_t image_cache_misses = 0;
+    std::mutex image_cache_mutex;          // Batch processing prepares images on workers
+
+    // Prompt prefix reuse: tokens currently resident in the KV cache for
+    // sequence 0, in position order. Cleared whenever the cache is modified
+    // outside of the completion paths.
+    std::vector<llama_token> cached_tokens;
+    int32_t n_reused_last = 0;             // Prompt tokens reused on the last completion
+
+    // Adapters currently set on the context, and those cached_tokens were
+    // evaluated with
+    LoraSet lora_applied;
+    LoraSet cached_lora;
+
+    // Bumped whenever the whole KV cache is cleared, so that chat sessions
+    // holding their own sequence know their tokens are gone
+    uint64_t kv_epoch = 0;
+
+    // Sequence ids currently owned by chat sessions or scheduled requests
+    std::vector<bool> seq_in_use;
+
+    // Sessions created on this handle, detached by llamafu_free so they can
+    // still be freed afterwards
+    std::vector<struct LlamafuChatSession_s*> chat_sessions;
+
+    LlamafuContextMode context_mode = LLAMAFU_CONTEXT_MODE_BOTH;
+
+    // KV cache layout and what generation does when it fills up
+    ggml_type type_k = GGML_TYPE_F16;
+    ggml_type type_v = GGML_TYPE_F16;
+    bool context_shift = false;
+    int32_t n_keep = 0;
+
+    // Continuous-batching scheduler, created on first submit
+    struct LlamafuScheduler_s* scheduler = nullptr;
+
+    // Background generation started by llamafu_stream_start, if any
+    struct LlamafuTokenStream_s* active_stream = nullptr;
+
+    // Parsed grammar samplers, most recently used first
+    std::list<GrammarCacheEntry> grammar_cache;
+
+    // Draft source for speculative decoding (nullptr = disabled)
+    struct SpeculativeState* speculative = nullptr;
+
+    // Sampler of the completion paths, kept between requests
+    struct SamplerPipeline* sampler = nullptr;
+
+    // On-disk prompt states for sequence 0 (nullptr = disabled)
+    struct PromptDiskCache* prompt_disk_cache = nullptr;
+    int32_t n_restored_last = 0;           // Prompt tokens restored from disk on the last completion
+    int32_t n_prefilled_last = 0;          // Prompt tokens decoded on the last completion
+
+    // Weights this handle runs on (holds one reference) and the settings its
+    // context was created with, reused by llamafu_swap_model
+    struct LlamafuModel_s* shared_model = nullptr;
+    llama_context_params llama_ctx_params = {};
+
+    // Buffers allocated while creating the context; the weight buffers are
+    // recorded on shared_model
+    std::vector<BufferRecord> buffers;
+    uint64_t clip_size_bytes = 0;
+
+    // Generation statistics of the last completion
+    int32_t n_generated_last = 0;
+    int32_t n_drafted_last = 0;
+    int32_t n_draft_accepted_last = 0;
+    double t_generate_ms_last = 0.0;
+
+    // Calls that run the context hold generation_mutex, so callers on other
+    // threads wait instead of decoding into it concurrently. active_cancel
+    // is the running request's cancellation token; the ggml abort callback
+    // checks it inside llama_decode.
+    std::mutex generation_mutex;
+    std::atomic<const std::atomic<bool>*> active_cancel{nullptr};
+
+    // Worker and pending jobs of llamafu_queue_submit, created on first submit
+    std::shared_ptr<struct RequestQueue> request_queue;
+    std::once_flag request_queue_once;
+    std::atomic<int32_t> queue_capacity{LLAMAFU_DEFAULT_QUEUE_CAPACITY};
+
+    // Pools attached by llamafu_set_threadpools (nullptr = llama.cpp starts
+    // threads per call); a null prefill pool shares the decode pool
+    ggml_threadpool* threadpool_decode = nullptr;
+    ggml_threadpool* threadpool_prefill = nullptr;
+
+    std::mutex abort_mutex;                // Guards abort_callback and its data
+
+    // Timings of the request in progress (generating thread only) and the
+    // published ones, read by llamafu_get_request_metrics from any thread
+    struct RequestMetrics* active_metrics = nullptr;
+    std::mutex metrics_mutex;
+    LlamafuRequestMetrics metrics = {};
+    double t_request_start_ms = 0.0;       // Steady clock
+    double t_request_end_ms = 0.0;
+
+    // What llamafu_release_memory gave back (LlamafuReleaseLevel; read
+    // without the lock to skip resuming) and what resuming restores
+    std::atomic<int32_t> release_level{LLAMAFU_RELEASE_NONE};
+    std::string mmproj_path;               // Projector reloaded on first use after a release
+    std::vector<std::pair<llama_seq_id, std::string>> spilled_seqs;  // Sequence, state file
+
+    // Some adapter has free_requested set; the next holder of the
+    // generation lock unloads it
+    std::atomic<bool> lora_free_pending{false};
 };
 
 static bool validate_string_param(const char* param, const char* param_name) {
@@ -74,4585 +393,12193 @@ static bool validate_float_param(float value, float min_val, float max_val) {
 }
 
 // Forward declarations
-static LlamafuError initialize_clip_context(Llamafu llamafu, const char* mmproj_path);
-
-// Helper to build a sampler chain from inference parameters
-static llama_sampler* build_sampler_chain(float temperature, int32_t top_k, float top_p,
-                                          float repeat_penalty, uint32_t seed) {
-    auto sparams = llama_sampler_chain_default_params();
-    sparams.no_perf = true;
-    llama_sampler* smpl = llama_sampler_chain_init(sparams);
-
-    // Add filtering samplers (applied in order)
-    if (top_k > 0 && top_k < 100) {
-        llama_sampler_chain_add(smpl, llama_sampler_init_top_k(top_k));
-    }
-    if (top_p > 0.0f && top_p < 1.0f) {
-        llama_sampler_chain_add(smpl, llama_sampler_init_top_p(top_p, 1));
-    }
-
-    // Temperature scaling
-    if (temperature > 0.0f) {
-        llama_sampler_chain_add(smpl, llama_sampler_init_temp(temperature));
+static LlamafuError initialize_mtmd_context(Llamafu llamafu, const char* mmproj_path);
+static void scheduler_destroy(Llamafu llamafu);
+static void scheduler_drop_lora(Llamafu llamafu, const llama_adapter_lora* adapter);
+static void token_stream_detach(Llamafu llamafu);
+static bool token_stream_running(Llamafu llamafu);
+static void request_queue_destroy(Llamafu llamafu);
+static void discard_spilled_sequences(Llamafu llamafu);
+static void attach_threadpools(Llamafu llamafu, llama_context* ctx);
+static void release_threadpools(Llamafu llamafu);
+static bool request_queue_busy(Llamafu llamafu);
+static void drop_freed_lora(Llamafu llamafu);
+static void detect_cpu_topology(LlamafuCpuTopology& topo);
+static bool resume_locked(Llamafu llamafu);
+
+// True once the running request is cancelled or the handle's abort
+// callback asks to stop
+static bool generation_aborted(Llamafu llamafu) {
+    const std::atomic<bool>* cancel = llamafu->active_cancel.load(std::memory_order_acquire);
+    if (cancel && cancel->load(std::memory_order_relaxed)) {
+        return true;
+    }
+    LlamafuAbortCallback callback;
+    void* data;
+    {
+        std::lock_guard<std::mutex> lock(llamafu->abort_mutex);
+        callback = llamafu->abort_callback;
+        data = llamafu->abort_callback_data;
+    }
+    return callback && callback(data);
+}
+
+// ggml abort callback of every context: a cancelled request stops the
+// decode in progress (llama_decode then returns 2). The handle's own abort
+// callback is only polled between decodes, on the calling thread.
+static bool decode_abort_trampoline(void* data) {
+    const std::atomic<bool>* cancel = static_cast<Llamafu>(data)->active_cancel.load(std::memory_order_acquire);
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+// Exclusive use of the handle's context for one call, with cancel (optional)
+// as the token the decode abort callback watches
+struct GenerationScope {
+    Llamafu llamafu;
+    std::lock_guard<std::mutex> lock;
+
+    // Brings a released handle back first; throws std::bad_alloc if its
+    // context cannot be recreated
+    explicit GenerationScope(Llamafu handle, const std::atomic<bool>* cancel = nullptr)
+        : llamafu(handle), lock(handle->generation_mutex) {
+        if (llamafu->release_level.load(std::memory_order_acquire) != LLAMAFU_RELEASE_NONE &&
+            !resume_locked(llamafu)) {
+            throw std::bad_alloc();
+        }
+        drop_freed_lora(llamafu);
+        llamafu->active_cancel.store(cancel, std::memory_order_release);
     }
-
-    // Final sampler - greedy for temp=0, otherwise distribution sampling
-    if (temperature <= 0.0f) {
-        llama_sampler_chain_add(smpl, llama_sampler_init_greedy());
-    } else {
-        llama_sampler_chain_add(smpl, llama_sampler_init_dist(seed));
+    ~GenerationScope() {
+        llamafu->active_cancel.store(nullptr, std::memory_order_release);
+        drop_freed_lora(llamafu);
     }
+};
 
-    return smpl;
-}
-
-extern "C" {
+// Exclusive use of the handle without waiting, for calls that change what
+// requests run with (adapters, threads) or inspect it between requests;
+// busy() while a request holds the context. Does not resume a released
+// handle.
+struct HandleLock {
+    std::unique_lock<std::mutex> lock;
+    explicit HandleLock(Llamafu llamafu) : lock(llamafu->generation_mutex, std::try_to_lock) {}
+    bool busy() const { return !lock.owns_lock(); }
+};
 
-LlamafuError llamafu_init(LlamafuModelParams* params, Llamafu* out_llamafu) {
-    if (!params || !out_llamafu) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// For calls that use the context without a GenerationScope: recreates it if
+// llamafu_release_memory freed it. Inside a scope the handle is resident
+// already, so this returns without locking.
+static LlamafuError ensure_resident(Llamafu llamafu) {
+    if (llamafu->release_level.load(std::memory_order_acquire) < LLAMAFU_RELEASE_CONTEXT) {
+        return LLAMAFU_SUCCESS;
     }
-
-    if (!validate_string_param(params->model_path, "model_path")) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    std::lock_guard<std::mutex> lock(llamafu->generation_mutex);
+    return resume_locked(llamafu) ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_OUT_OF_MEMORY;
+}
+
+static LlamafuError decode_error(int32_t ret) {
+    return ret == 2 ? LLAMAFU_ERROR_ABORTED : LLAMAFU_ERROR_DECODE_FAILED;
+}
+
+// Sampling settings of a request with defaults applied. Requests with equal
+// settings reuse the handle's pipeline, which is reset instead of rebuilt.
+struct SamplerConfig {
+    float temperature = 0.8f;              // <= 0 = greedy
+    int32_t top_k = 40;                    // <= 0 = disabled
+    float top_p = 0.95f;
+    float min_p = 0.0f;
+    float typical_p = 1.0f;
+    float repeat_penalty = 1.1f;
+    int32_t repeat_last_n = 64;
+    float frequency_penalty = 0.0f;
+    float presence_penalty = 0.0f;
+    bool penalize_nl = false;
+    bool ignore_eos = false;
+    int32_t mirostat = 0;
+    float mirostat_tau = 5.0f;
+    float mirostat_eta = 0.1f;
+    uint32_t seed = 42;
+
+    bool operator==(const SamplerConfig& o) const {
+        return temperature == o.temperature && top_k == o.top_k && top_p == o.top_p && min_p == o.min_p &&
+               typical_p == o.typical_p && repeat_penalty == o.repeat_penalty &&
+               repeat_last_n == o.repeat_last_n && frequency_penalty == o.frequency_penalty &&
+               presence_penalty == o.presence_penalty && penalize_nl == o.penalize_nl &&
+               ignore_eos == o.ignore_eos && mirostat == o.mirostat && mirostat_tau == o.mirostat_tau &&
+               mirostat_eta == o.mirostat_eta && seed == o.seed;
     }
+};
 
-    try {
-        // Initialize llama backend
-        llama_backend_init();
-
-        // Load model with modern API
-        llama_model_params model_params = llama_model_default_params();
-        model_params.n_gpu_layers = params->use_gpu ? -1 : 0;  // All layers or none
-
-        llama_model* model = llama_model_load_from_file(params->model_path, model_params);
-        if (!model) {
-            llama_backend_free();
-            return LLAMAFU_ERROR_MODEL_LOAD_FAILED;
-        }
+// Zero fields of LlamafuInferParams (as left by the Dart bindings) take the
+// defaults above, except temperature, where zero selects greedy decoding
+static SamplerConfig sampler_config_from(const LlamafuInferParams* params) {
+    SamplerConfig config;
+    config.temperature = params->temperature;
+    if (params->top_k > 0) config.top_k = params->top_k;
+    if (params->top_p > 0.0f) config.top_p = params->top_p;
+    if (params->min_p > 0.0f) config.min_p = params->min_p;
+    if (params->typical_p > 0.0f) config.typical_p = params->typical_p;
+    if (params->repeat_penalty > 0.0f) config.repeat_penalty = params->repeat_penalty;
+    if (params->repeat_last_n != 0) config.repeat_last_n = params->repeat_last_n;
+    config.frequency_penalty = params->frequency_penalty;
+    config.presence_penalty = params->presence_penalty;
+    config.penalize_nl = params->penalize_nl;
+    config.ignore_eos = params->ignore_eos;
+    config.mirostat = params->mirostat;
+    if (params->mirostat_tau > 0.0f) config.mirostat_tau = params->mirostat_tau;
+    if (params->mirostat_eta > 0.0f) config.mirostat_eta = params->mirostat_eta;
+    if (params->seed > 0) config.seed = params->seed;
+    return config;
+}
+
+// First stage of every pipeline: grammar, repetition penalties, EOS ban and
+// top-k in one pass. Candidates arrive in token id order, so penalties and
+// bans index them directly instead of looking up every vocabulary entry, and
+// the top-k partial sort leaves the later stages with K candidates.
+struct SamplerFrontStage {
+    int32_t n_vocab = 0;
+    int32_t top_k = 0;
+    float repeat_penalty = 1.0f;
+    int32_t repeat_last_n = 0;             // < 0 = all generated tokens
+    float frequency_penalty = 0.0f;
+    float presence_penalty = 0.0f;
+    bool penalize_nl = false;
+    bool ignore_eos = false;
+    llama_token nl_token = -1;
+    llama_token eos_token = -1;
+    llama_token eot_token = -1;
+
+    std::deque<llama_token> history;      // Last repeat_last_n accepted tokens
+    std::unordered_map<llama_token, int32_t> counts;
+
+    llama_sampler* grammar = nullptr;      // Owned, set per request
+};
 
-        // Create context with modern API
-        llama_context_params ctx_params = llama_context_default_params();
-        ctx_params.n_ctx = params->n_ctx > 0 ? params->n_ctx : 2048;  // Use provided or default
-        ctx_params.n_threads = params->n_threads > 0 ? params->n_threads : -1;  // Use provided or auto
-        ctx_params.n_threads_batch = params->n_threads > 0 ? params->n_threads : -1;
-        ctx_params.embeddings = true;  // Enable embeddings extraction
+static llama_sampler* sampler_front_stage_init(SamplerFrontStage* stage);
 
-        llama_context* ctx = llama_init_from_model(model, ctx_params);
-        if (!ctx) {
-            llama_model_free(model);
-            llama_backend_free();
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+static llama_token_data* find_candidate(llama_token_data_array* cur_p, bool by_id, llama_token token) {
+    if (by_id) {
+        return token >= 0 && static_cast<size_t>(token) < cur_p->size ? &cur_p->data[token] : nullptr;
+    }
+    for (size_t i = 0; i < cur_p->size; i++) {
+        if (cur_p->data[i].id == token) {
+            return &cur_p->data[i];
         }
+    }
+    return nullptr;
+}
 
-        // Check if model supports multimodal (simplified check)
-        bool is_multimodal = params->mmproj_path && strlen(params->mmproj_path) > 0;
+static void sampler_front_stage_apply(llama_sampler* smpl, llama_token_data_array* cur_p) {
+    auto* stage = static_cast<SamplerFrontStage*>(smpl->ctx);
+    if (stage->grammar) {
+        llama_sampler_apply(stage->grammar, cur_p);
+    }
 
-        Llamafu llamafu = new Llamafu_s{
-            model, ctx, is_multimodal,
-            std::map<LlamafuLoraAdapter, llama_adapter_lora*>{},
-            std::vector<LlamafuSampler>{},
-            nullptr, nullptr, nullptr,
-            nullptr, nullptr, false,
-            std::map<std::string, std::vector<float>>{}
-        };
+    const bool by_id = !cur_p->sorted && cur_p->size == static_cast<size_t>(stage->n_vocab) &&
+                       cur_p->data[0].id == 0 && cur_p->data[cur_p->size - 1].id == stage->n_vocab - 1;
 
-        // Initialize CLIP context if multimodal is enabled
-        if (is_multimodal) {
-            LlamafuError clip_init_result = initialize_clip_context(llamafu, params->mmproj_path);
-            if (clip_init_result != LLAMAFU_SUCCESS) {
-                // Cleanup and return error
-                if (llamafu->ctx) {
-                    llama_free(llamafu->ctx);
+    const bool penalize = stage->repeat_penalty != 1.0f || stage->frequency_penalty != 0.0f ||
+                          stage->presence_penalty != 0.0f;
+    if (penalize && !stage->counts.empty()) {
+        if (!by_id) {
+            // Already filtered: scan the few candidates left
+            for (size_t i = 0; i < cur_p->size; i++) {
+                auto it = stage->counts.find(cur_p->data[i].id);
+                if (it == stage->counts.end() || (!stage->penalize_nl && it->first == stage->nl_token)) {
+                    continue;
+                }
+                float& logit = cur_p->data[i].logit;
+                logit = logit <= 0.0f ? logit * stage->repeat_penalty : logit / stage->repeat_penalty;
+                logit -= it->second * stage->frequency_penalty + stage->presence_penalty;
+            }
+        } else {
+            for (const auto& entry : stage->counts) {
+                if (!stage->penalize_nl && entry.first == stage->nl_token) {
+                    continue;
                 }
-                if (llamafu->model) {
-                    llama_model_free(llamafu->model);
+                llama_token_data* candidate = find_candidate(cur_p, true, entry.first);
+                if (!candidate) {
+                    continue;
                 }
-                delete llamafu;
-                llama_backend_free();
-                return clip_init_result;
+                float& logit = candidate->logit;
+                logit = logit <= 0.0f ? logit * stage->repeat_penalty : logit / stage->repeat_penalty;
+                logit -= entry.second * stage->frequency_penalty + stage->presence_penalty;
             }
         }
+    }
 
-        *out_llamafu = llamafu;
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    if (stage->ignore_eos) {
+        for (llama_token token : {stage->eos_token, stage->eot_token}) {
+            if (llama_token_data* candidate = token >= 0 ? find_candidate(cur_p, by_id, token) : nullptr) {
+                candidate->logit = -INFINITY;
+            }
+        }
     }
-}
 
-LlamafuError llamafu_complete(Llamafu llamafu, LlamafuInferParams* params, char** out_result) {
-    if (!llamafu || !params || !out_result) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    if (stage->top_k > 0 && static_cast<size_t>(stage->top_k) < cur_p->size) {
+        auto by_logit = [](const llama_token_data& a, const llama_token_data& b) { return a.logit > b.logit; };
+        std::nth_element(cur_p->data, cur_p->data + stage->top_k - 1, cur_p->data + cur_p->size, by_logit);
+        std::sort(cur_p->data, cur_p->data + stage->top_k, by_logit);
+        cur_p->size = static_cast<size_t>(stage->top_k);
+        cur_p->sorted = true;
     }
+}
 
-    if (!validate_string_param(params->prompt, "prompt")) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static void sampler_front_stage_accept(llama_sampler* smpl, llama_token token) {
+    auto* stage = static_cast<SamplerFrontStage*>(smpl->ctx);
+    if (stage->grammar) {
+        llama_sampler_accept(stage->grammar, token);
+    }
+    if (stage->repeat_last_n == 0) {
+        return;
+    }
+    stage->history.push_back(token);
+    stage->counts[token]++;
+    if (stage->repeat_last_n > 0 && stage->history.size() > static_cast<size_t>(stage->repeat_last_n)) {
+        auto it = stage->counts.find(stage->history.front());
+        if (--it->second == 0) {
+            stage->counts.erase(it);
+        }
+        stage->history.pop_front();
     }
+}
 
-    // Only validate the basic fields that are always set
-    if (!validate_numeric_param(params->max_tokens, 1, 32768) ||
-        !validate_float_param(params->temperature, 0.0f, 2.0f)) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static void sampler_front_stage_reset(llama_sampler* smpl) {
+    auto* stage = static_cast<SamplerFrontStage*>(smpl->ctx);
+    stage->history.clear();
+    stage->counts.clear();
+    if (stage->grammar) {
+        llama_sampler_reset(stage->grammar);
     }
+}
 
-    // Use sensible defaults for optional fields (the Dart bindings don't set these)
-    (void)params->top_p;       // Suppress unused warning
-    (void)params->top_k;       // Suppress unused warning
-    (void)params->repeat_penalty; // Suppress unused warning
+static llama_sampler* sampler_front_stage_clone(const llama_sampler* smpl) {
+    const auto* stage = static_cast<const SamplerFrontStage*>(smpl->ctx);
+    auto* copy = new SamplerFrontStage(*stage);
+    copy->grammar = stage->grammar ? llama_sampler_clone(stage->grammar) : nullptr;
+    return sampler_front_stage_init(copy);
+}
 
-    try {
-        // Tokenize prompt using modern API
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        const int32_t text_len = static_cast<int32_t>(strlen(params->prompt));
+static void sampler_front_stage_free(llama_sampler* smpl) {
+    auto* stage = static_cast<SamplerFrontStage*>(smpl->ctx);
+    if (stage->grammar) {
+        llama_sampler_free(stage->grammar);
+    }
+    delete stage;
+}
 
-        // First pass to get the number of tokens
-        const int32_t n_tokens_max = text_len + 16; // Conservative estimate
-        std::vector<llama_token> tokens(n_tokens_max);
+static const char* sampler_front_stage_name(const llama_sampler*) {
+    return "llamafu-front";
+}
 
-        const int32_t n_tokens = llama_tokenize(vocab, params->prompt, text_len, tokens.data(), n_tokens_max, true, true);
-        if (n_tokens < 0) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
+static llama_sampler* sampler_front_stage_init(SamplerFrontStage* stage) {
+    static llama_sampler_i iface = {
+        sampler_front_stage_name,
+        sampler_front_stage_accept,
+        sampler_front_stage_apply,
+        sampler_front_stage_reset,
+        sampler_front_stage_clone,
+        sampler_front_stage_free,
+    };
+    return llama_sampler_init(&iface, stage);
+}
+
+// A configured sampler chain plus the candidate buffer it samples from,
+// reused for every token instead of allocating a vocabulary-sized array
+struct SamplerPipeline {
+    SamplerConfig config;
+    llama_sampler* chain = nullptr;
+    SamplerFrontStage* front = nullptr;    // First stage of chain, owned by it
+    std::vector<llama_token_data> candidates;
+
+    SamplerPipeline() = default;
+    SamplerPipeline(const SamplerPipeline&) = delete;
+    SamplerPipeline& operator=(const SamplerPipeline&) = delete;
+    ~SamplerPipeline() {
+        if (chain) {
+            llama_sampler_free(chain);
         }
+    }
+};
 
-        tokens.resize(n_tokens);
-
-        if (tokens.empty()) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
-        }
+// Pipeline for config: the front stage, then typical/top-p/min-p and
+// temperature ahead of the final draw, or temperature and mirostat (which
+// replaces the truncation stages). Returns nullptr on allocation failure.
+static SamplerPipeline* build_sampler_pipeline(const llama_vocab* vocab, const SamplerConfig& config) {
+    auto pipeline = std::make_unique<SamplerPipeline>();
+    pipeline->config = config;
 
-        // Clear the KV cache
-        llama_memory_clear(llama_get_memory(llamafu->ctx), false);
+    auto sparams = llama_sampler_chain_default_params();
+    sparams.no_perf = true;
+    pipeline->chain = llama_sampler_chain_init(sparams);
+    if (!pipeline->chain) {
+        return nullptr;
+    }
 
-        // Evaluate the prompt tokens
-        if (llama_decode(llamafu->ctx, llama_batch_get_one(tokens.data(), tokens.size())) != 0) {
-            return LLAMAFU_ERROR_UNKNOWN;
+    auto* front = new SamplerFrontStage();
+    front->n_vocab = llama_vocab_n_tokens(vocab);
+    front->top_k = config.mirostat == 0 ? config.top_k : 0;
+    front->repeat_penalty = config.repeat_penalty;
+    front->repeat_last_n = config.repeat_last_n;
+    front->frequency_penalty = config.frequency_penalty;
+    front->presence_penalty = config.presence_penalty;
+    front->penalize_nl = config.penalize_nl;
+    front->ignore_eos = config.ignore_eos;
+    front->nl_token = llama_vocab_nl(vocab);
+    front->eos_token = llama_vocab_eos(vocab);
+    front->eot_token = llama_vocab_eot(vocab);
+    llama_sampler* front_sampler = sampler_front_stage_init(front);
+    if (!front_sampler) {
+        delete front;
+        return nullptr;
+    }
+    llama_sampler_chain_add(pipeline->chain, front_sampler);
+    pipeline->front = front;
+
+    if (config.temperature <= 0.0f) {
+        llama_sampler_chain_add(pipeline->chain, llama_sampler_init_greedy());
+    } else if (config.mirostat == 1) {
+        llama_sampler_chain_add(pipeline->chain, llama_sampler_init_temp(config.temperature));
+        llama_sampler_chain_add(pipeline->chain, llama_sampler_init_mirostat(
+            front->n_vocab, config.seed, config.mirostat_tau, config.mirostat_eta, 100));
+    } else if (config.mirostat == 2) {
+        llama_sampler_chain_add(pipeline->chain, llama_sampler_init_temp(config.temperature));
+        llama_sampler_chain_add(pipeline->chain, llama_sampler_init_mirostat_v2(
+            config.seed, config.mirostat_tau, config.mirostat_eta));
+    } else {
+        if (config.typical_p > 0.0f && config.typical_p < 1.0f) {
+            llama_sampler_chain_add(pipeline->chain, llama_sampler_init_typical(config.typical_p, 1));
         }
-
-        // Build sampler chain from params (use defaults for unset fields)
-        float temperature = params->temperature > 0.0f ? params->temperature : 0.8f;
-        int32_t top_k = params->top_k > 0 ? params->top_k : 40;
-        float top_p = params->top_p > 0.0f ? params->top_p : 0.95f;
-        float repeat_penalty = params->repeat_penalty > 0.0f ? params->repeat_penalty : 1.1f;
-        uint32_t seed = params->seed > 0 ? params->seed : 42;
-
-        llama_sampler* smpl = build_sampler_chain(temperature, top_k, top_p, repeat_penalty, seed);
-        if (!smpl) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        if (config.top_p > 0.0f && config.top_p < 1.0f) {
+            llama_sampler_chain_add(pipeline->chain, llama_sampler_init_top_p(config.top_p, 1));
         }
+        if (config.min_p > 0.0f) {
+            llama_sampler_chain_add(pipeline->chain, llama_sampler_init_min_p(config.min_p, 1));
+        }
+        llama_sampler_chain_add(pipeline->chain, llama_sampler_init_temp(config.temperature));
+        llama_sampler_chain_add(pipeline->chain, llama_sampler_init_dist(config.seed));
+    }
 
-        // Generate tokens
-        std::string result;
-        int32_t n_cur = static_cast<int32_t>(tokens.size());
-        const int32_t n_ctx = llama_n_ctx(llamafu->ctx);
-
-        for (int32_t i = 0; i < params->max_tokens; i++) {
-            // Check abort callback
-            if (llamafu->abort_callback && llamafu->abort_callback(llamafu->abort_callback_data)) {
-                llama_sampler_free(smpl);
-                return LLAMAFU_ERROR_ABORTED;
-            }
-
-            // Sample next token
-            llama_token new_token = llama_sampler_sample(smpl, llamafu->ctx, -1);
-
-            // Check for end of generation
-            if (llama_vocab_is_eog(vocab, new_token)) {
-                break;
-            }
+    return pipeline.release();
+}
 
-            // Convert token to text
-            char buf[256];
-            int32_t n_chars = llama_token_to_piece(vocab, new_token, buf, sizeof(buf), 0, true);
-            if (n_chars > 0) {
-                result.append(buf, n_chars);
-            }
+// Replace the pipeline's grammar (nullptr = unconstrained); takes ownership
+static void sampler_pipeline_set_grammar(SamplerPipeline* pipeline, llama_sampler* grammar) {
+    if (pipeline->front->grammar) {
+        llama_sampler_free(pipeline->front->grammar);
+    }
+    pipeline->front->grammar = grammar;
+}
 
-            // Accept the token to update sampler state
-            llama_sampler_accept(smpl, new_token);
+// Sample from the logits at output idx (-1 = last) and accept the token,
+// as llama_sampler_sample does
+static llama_token sampler_pipeline_sample(SamplerPipeline* pipeline, llama_context* ctx, int32_t idx) {
+    const float* logits = llama_get_logits_ith(ctx, idx);
+    const int32_t n_vocab = pipeline->front->n_vocab;
+    pipeline->candidates.resize(n_vocab);
+    for (llama_token id = 0; id < n_vocab; id++) {
+        pipeline->candidates[id] = llama_token_data{id, logits[id], 0.0f};
+    }
 
-            // Check context overflow
-            if (n_cur >= n_ctx - 1) {
-                break;
-            }
+    llama_token_data_array cur_p = {pipeline->candidates.data(), static_cast<size_t>(n_vocab), -1, false};
+    llama_sampler_apply(pipeline->chain, &cur_p);
+    if (cur_p.selected < 0 || static_cast<size_t>(cur_p.selected) >= cur_p.size) {
+        cur_p.selected = 0;
+    }
 
-            // Decode the new token
-            if (llama_decode(llamafu->ctx, llama_batch_get_one(&new_token, 1)) != 0) {
-                llama_sampler_free(smpl);
-                return LLAMAFU_ERROR_UNKNOWN;
-            }
+    const llama_token token = cur_p.data[cur_p.selected].id;
+    llama_sampler_accept(pipeline->chain, token);
+    return token;
+}
 
-            n_cur++;
-        }
+static ggml_type kv_cache_ggml_type(int32_t type) {
+    switch (type) {
+        case LLAMAFU_KV_CACHE_F32:    return GGML_TYPE_F32;
+        case LLAMAFU_KV_CACHE_BF16:   return GGML_TYPE_BF16;
+        case LLAMAFU_KV_CACHE_Q8_0:   return GGML_TYPE_Q8_0;
+        case LLAMAFU_KV_CACHE_Q5_1:   return GGML_TYPE_Q5_1;
+        case LLAMAFU_KV_CACHE_Q5_0:   return GGML_TYPE_Q5_0;
+        case LLAMAFU_KV_CACHE_Q4_1:   return GGML_TYPE_Q4_1;
+        case LLAMAFU_KV_CACHE_Q4_0:   return GGML_TYPE_Q4_0;
+        case LLAMAFU_KV_CACHE_IQ4_NL: return GGML_TYPE_IQ4_NL;
+        default:                      return GGML_TYPE_F16;
+    }
+}
 
-        llama_sampler_free(smpl);
+static const enum llama_split_mode SPLIT_MODES[] = {
+    LLAMA_SPLIT_MODE_LAYER, LLAMA_SPLIT_MODE_NONE, LLAMA_SPLIT_MODE_LAYER, LLAMA_SPLIT_MODE_ROW,
+};
 
-        // Allocate result string
-        *out_result = static_cast<char*>(malloc(result.length() + 1));
-        if (!*out_result) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+// Layers offloaded for the given model parameters (-1 = all)
+static int32_t requested_gpu_layers(const LlamafuModelParams* params) {
+    if (params->n_gpu_layers != 0) {
+        return params->n_gpu_layers;
+    }
+    return params->use_gpu ? -1 : 0;
+}
 
-        strcpy(*out_result, result.c_str());
-        return LLAMAFU_SUCCESS;
+// Reports load progress and remembers whether the caller cancelled, which
+// llama_model_load_from_file otherwise reports as a plain failure. Background
+// loads publish progress and poll cancel instead of calling back.
+struct LoadProgress {
+    LlamafuLoadProgressCallback callback;
+    void* user_data;
+    const std::atomic<bool>* cancel;
+    std::atomic<float>* progress;
+    bool cancelled;
+};
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+static bool load_progress_trampoline(float progress, void* user_data) {
+    LoadProgress* state = static_cast<LoadProgress*>(user_data);
+    if (state->progress) {
+        state->progress->store(progress);
+    }
+    if ((state->cancel && state->cancel->load()) ||
+        (state->callback && !state->callback(progress, state->user_data))) {
+        state->cancelled = true;
+        return false;
     }
+    return true;
 }
 
-LlamafuError llamafu_complete_with_grammar(Llamafu llamafu, LlamafuInferParams* params,
-                                     void* grammar_params, char** out_result) {
-    if (!llamafu || !params || !grammar_params || !out_result) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+static bool is_quantized_kv_type(ggml_type type) {
+    return type != GGML_TYPE_F32 && type != GGML_TYPE_F16 && type != GGML_TYPE_BF16;
+}
 
-    // For now, fall back to regular completion (grammar support can be added later)
-    return llamafu_complete(llamafu, params, out_result);
+// Embedding-only contexts have no use for the sampling paths
+static bool can_generate(Llamafu llamafu) {
+    return llamafu->context_mode != LLAMAFU_CONTEXT_MODE_EMBEDDING;
 }
 
-LlamafuError llamafu_multimodal_complete(Llamafu llamafu, LlamafuMultimodalInferParams* params, char** out_result) {
-    if (!llamafu || !params || !out_result) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+// Forget which tokens are resident in the KV cache. Must be called by any
+// path that clears or rewrites the cache behind the completion functions.
+static void invalidate_prompt_cache(Llamafu llamafu) {
+    llamafu->cached_tokens.clear();
+    llamafu->n_reused_last = 0;
+    llamafu->kv_epoch++;
+}
 
-    if (!llamafu->is_multimodal) {
-        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+// The llamafu_memory_* calls edit the cache without a handle to invalidate,
+// so the prefix is only trusted as far as sequence 0 still reaches
+static void clamp_prompt_cache(Llamafu llamafu) {
+    const llama_pos pos_max = llama_memory_seq_pos_max(llama_get_memory(llamafu->ctx), 0);
+    const size_t n_resident = pos_max < 0 ? 0 : static_cast<size_t>(pos_max) + 1;
+    if (llamafu->cached_tokens.size() > n_resident) {
+        llamafu->cached_tokens.resize(n_resident);
     }
+}
 
-    // For now, fall back to text-only completion
-    LlamafuInferParams text_params = {};
-    text_params.prompt = params->prompt;
-    text_params.max_tokens = params->max_tokens;
-    text_params.temperature = params->temperature;
-    text_params.top_p = 0.9f;
-    text_params.top_k = 40;
-    text_params.repeat_penalty = 1.1f;
-    text_params.seed = 42;
-
-    return llamafu_complete(llamafu, &text_params, out_result);
+// Drops every sequence; the caller holds the generation lock
+static void clear_kv_cache(Llamafu llamafu) {
+    llama_memory_clear(llama_get_memory(llamafu->ctx), false);
+    invalidate_prompt_cache(llamafu);
 }
 
-LlamafuError llamafu_load_lora_adapter_from_file(Llamafu llamafu, const char* lora_path,
-                                           float scale, LlamafuLoraAdapter* out_adapter) {
-    if (!llamafu || !validate_string_param(lora_path, "lora_path") || !out_adapter) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Sequence 0 plus every sequence not owned by a chat session or scheduled
+// request, for calls that pack several inputs into one batch
+static std::vector<llama_seq_id> free_sequences(Llamafu llamafu) {
+    std::vector<llama_seq_id> seq_ids;
+    for (size_t i = 0; i < llamafu->seq_in_use.size(); i++) {
+        if (i == 0 || !llamafu->seq_in_use[i]) {
+            seq_ids.push_back(static_cast<llama_seq_id>(i));
+        }
     }
+    return seq_ids;
+}
 
-    if (!validate_float_param(scale, 0.0f, 2.0f)) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+// =============================================================================
+// Mapped State Files
+// =============================================================================
 
-    try {
-        llama_adapter_lora* adapter = llama_adapter_lora_init(llamafu->model, lora_path);
-        if (!adapter) {
-            return LLAMAFU_ERROR_LORA_LOAD_FAILED;
-        }
+#if defined(_WIN32)
+// CRT descriptors: not inherited by child processes, and never in text mode
+#ifndef O_CLOEXEC
+#define O_CLOEXEC (_O_NOINHERIT | _O_BINARY)
+#endif
 
-        LlamafuLoraAdapter handle = reinterpret_cast<LlamafuLoraAdapter>(adapter);
-        llamafu->lora_adapters[handle] = adapter;
-        *out_adapter = handle;
+// Without mmap the mapping is a heap copy of the file: reads load all of it
+// and writes reach the file in finish_mapped_write
+struct FileMapping {
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t size = 0;
 
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_LORA_LOAD_FAILED;
+    uint8_t* data() const { return buffer.get(); }
+};
+
+static bool map_fd_for_write(int fd, size_t size, FileMapping& map) {
+    if (size == 0) {
+        return false;
     }
+    map.buffer.reset(new (std::nothrow) uint8_t[size]);
+    map.size = size;
+    return map.buffer != nullptr;
 }
 
-LlamafuError llamafu_set_lora_adapter(Llamafu llamafu, LlamafuLoraAdapter adapter, float scale) {
-    if (!llamafu || !adapter) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static bool map_fd_for_read(int fd, FileMapping& map) {
+    struct _stat64 st;
+    if (_fstat64(fd, &st) != 0 || st.st_size <= 0 || _lseeki64(fd, 0, SEEK_SET) != 0) {
+        return false;
     }
-
-    if (!validate_float_param(scale, 0.0f, 2.0f)) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    map.size = static_cast<size_t>(st.st_size);
+    map.buffer.reset(new (std::nothrow) uint8_t[map.size]);
+    if (!map.buffer) {
+        return false;
     }
-
-    auto it = llamafu->lora_adapters.find(adapter);
-    if (it == llamafu->lora_adapters.end()) {
-        return LLAMAFU_ERROR_LORA_NOT_FOUND;
+    for (size_t done = 0; done < map.size;) {
+        const unsigned chunk = static_cast<unsigned>(std::min<size_t>(map.size - done, 1u << 30));
+        const int n = _read(fd, map.data() + done, chunk);
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
     }
+    return true;
+}
 
-    try {
-        if (llama_set_adapter_lora(llamafu->ctx, it->second, scale) != 0) {
-            return LLAMAFU_ERROR_UNKNOWN;
+// Stores the first n bytes of a write mapping as the whole file
+static bool finish_mapped_write(int fd, const FileMapping& map, size_t n) {
+    if (_lseeki64(fd, 0, SEEK_SET) != 0) {
+        return false;
+    }
+    for (size_t done = 0; done < n;) {
+        const unsigned chunk = static_cast<unsigned>(std::min<size_t>(n - done, 1u << 30));
+        const int written = _write(fd, map.data() + done, chunk);
+        if (written <= 0) {
+            return false;
         }
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        done += static_cast<size_t>(written);
     }
+    return _chsize_s(fd, static_cast<__int64>(n)) == 0;
 }
 
-LlamafuError llamafu_unload_lora_adapter(Llamafu llamafu, LlamafuLoraAdapter adapter) {
-    if (!llamafu || !adapter) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Closes a file descriptor on scope exit
+struct ScopedFd {
+    int fd;
+    explicit ScopedFd(int fd) : fd(fd) {}
+    ScopedFd(const ScopedFd&) = delete;
+    ScopedFd& operator=(const ScopedFd&) = delete;
+    ~ScopedFd() {
+        if (fd >= 0) {
+            _close(fd);
+        }
+    }
+};
+#else
+// Whole-file mapping, unmapped on destruction. State is serialized straight
+// into (or read straight out of) file-backed pages, so snapshots never need a
+// heap buffer the size of the state; the kernel writes dirty pages back even
+// if the process is killed after unmapping.
+struct FileMapping {
+    void* addr = MAP_FAILED;
+    size_t size = 0;
+
+    FileMapping() = default;
+    FileMapping(const FileMapping&) = delete;
+    FileMapping& operator=(const FileMapping&) = delete;
+    ~FileMapping() {
+        if (addr != MAP_FAILED) {
+            munmap(addr, size);
+        }
     }
+    uint8_t* data() const { return static_cast<uint8_t*>(addr); }
+};
 
-    auto it = llamafu->lora_adapters.find(adapter);
-    if (it == llamafu->lora_adapters.end()) {
-        return LLAMAFU_ERROR_LORA_NOT_FOUND;
+// Resize fd to size bytes and map it shared for writing
+static bool map_fd_for_write(int fd, size_t size, FileMapping& map) {
+    if (size == 0 || ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        return false;
     }
+    map.addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    map.size = size;
+    return map.addr != MAP_FAILED;
+}
 
-    try {
-        llama_adapter_lora_free(it->second);
-        llamafu->lora_adapters.erase(it);
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+// Map all of fd read-only; pages are faulted in as they are consumed
+static bool map_fd_for_read(int fd, FileMapping& map) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        return false;
     }
+    map.size = static_cast<size_t>(st.st_size);
+    map.addr = mmap(nullptr, map.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map.addr == MAP_FAILED) {
+        return false;
+    }
+    madvise(map.addr, map.size, MADV_SEQUENTIAL);
+    return true;
 }
 
-LlamafuError llamafu_tokenize(Llamafu llamafu, const char* text, int32_t text_len, LlamafuToken** out_tokens, int32_t* out_n_tokens, bool add_special, bool parse_special) {
-    if (!llamafu || !text || text_len <= 0 || !out_tokens || !out_n_tokens) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+// Stores the first n bytes of a write mapping as the whole file
+static bool finish_mapped_write(int fd, const FileMapping& map, size_t n) {
+    return n == map.size || ftruncate(fd, static_cast<off_t>(n)) == 0;
+}
 
-    try {
-        // Use modern tokenization API
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+// Closes a file descriptor on scope exit
+struct ScopedFd {
+    int fd;
+    explicit ScopedFd(int fd) : fd(fd) {}
+    ScopedFd(const ScopedFd&) = delete;
+    ScopedFd& operator=(const ScopedFd&) = delete;
+    ~ScopedFd() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+};
+#endif
 
-        // First pass to get the number of tokens
-        const int32_t n_tokens_max = text_len + 16; // Conservative estimate
-        std::vector<llama_token> tokens(n_tokens_max);
+// =============================================================================
+// Memory Accounting
+// =============================================================================
 
-        const int32_t n_tokens = llama_tokenize(vocab, text, text_len, tokens.data(), n_tokens_max, add_special, parse_special);
-        if (n_tokens < 0) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
-        }
+// llama.cpp reports the backend buffers it allocates only through its log
+// ("<buffer type> <role> buffer size = <n> MiB"). Every log line goes through
+// llamafu_log_dispatch, which records those lines on a thread that has a
+// capture open before forwarding the line to the user's callback.
+static thread_local std::vector<BufferRecord>* t_buffer_capture = nullptr;
 
-        *out_n_tokens = n_tokens;
-        *out_tokens = static_cast<LlamafuToken*>(malloc(n_tokens * sizeof(LlamafuToken)));
+static std::mutex g_log_mutex;
+static LlamafuLogCallback g_log_callback = nullptr;
+static void* g_log_callback_data = nullptr;
 
-        if (!*out_tokens) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+static void capture_buffer_line(const char* text) {
+    static const char marker[] = " buffer size =";
+    const char* at = strstr(text, marker);
+    if (!at) {
+        return;
+    }
 
-        for (int32_t i = 0; i < n_tokens; ++i) {
-            (*out_tokens)[i] = tokens[i];
-        }
+    // The last two words before the marker are the buffer type and its role
+    std::istringstream words(std::string(text, at));
+    std::vector<std::string> parts;
+    std::string word;
+    while (words >> word) {
+        parts.push_back(word);
+    }
+    if (parts.size() < 2) {
+        return;
+    }
+    const std::string& role = parts[parts.size() - 1];
+    LlamafuBufferKind kind;
+    if (role == "model") {
+        kind = LLAMAFU_BUFFER_WEIGHTS;
+    } else if (role == "KV") {
+        kind = LLAMAFU_BUFFER_KV_CACHE;
+    } else if (role == "RS") {
+        kind = LLAMAFU_BUFFER_RECURRENT_STATE;
+    } else if (role == "output") {
+        kind = LLAMAFU_BUFFER_OUTPUT;
+    } else if (role == "compute") {
+        kind = LLAMAFU_BUFFER_COMPUTE;
+    } else if (role == "LoRA") {
+        kind = LLAMAFU_BUFFER_LORA;
+    } else {
+        return;
+    }
 
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    char* end = nullptr;
+    const double mib = strtod(at + sizeof(marker) - 1, &end);
+    if (end == at + sizeof(marker) - 1 || mib < 0 || !strstr(end, "MiB")) {
+        return;
     }
+    t_buffer_capture->push_back({parts[parts.size() - 2], kind, static_cast<uint64_t>(mib * 1024.0 * 1024.0 + 0.5)});
 }
 
-LlamafuError llamafu_detokenize(Llamafu llamafu, const LlamafuToken* tokens, int32_t n_tokens, char** out_text, bool remove_special, bool unparse_special) {
-    if (!llamafu || !tokens || n_tokens <= 0 || !out_text) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static void llamafu_log_dispatch(ggml_log_level level, const char* text, void* /*user_data*/) {
+    if (!text) {
+        return;
+    }
+    if (t_buffer_capture) {
+        capture_buffer_line(text);
     }
 
-    if (!validate_numeric_param(n_tokens, 1, 32768)) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    LlamafuLogCallback callback;
+    void* callback_data;
+    {
+        std::lock_guard<std::mutex> lock(g_log_mutex);
+        callback = g_log_callback;
+        callback_data = g_log_callback_data;
+    }
+    if (!callback) {
+        // Same as llama.cpp's default logger
+        fputs(text, stderr);
+        fflush(stderr);
+        return;
     }
 
-    try {
-        // Use modern detokenization API
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+    LlamafuLogLevel llamafu_level;
+    switch (level) {
+        case GGML_LOG_LEVEL_DEBUG: llamafu_level = LLAMAFU_LOG_DEBUG; break;
+        case GGML_LOG_LEVEL_INFO:  llamafu_level = LLAMAFU_LOG_INFO; break;
+        case GGML_LOG_LEVEL_WARN:  llamafu_level = LLAMAFU_LOG_WARN; break;
+        case GGML_LOG_LEVEL_ERROR: llamafu_level = LLAMAFU_LOG_ERROR; break;
+        default: llamafu_level = LLAMAFU_LOG_INFO; break;
+    }
+    callback(llamafu_level, text, callback_data);
+}
 
-        // First pass to get required buffer size
-        const int32_t text_len_max = n_tokens * 8; // Conservative estimate
-        std::vector<char> text_buf(text_len_max);
+static void install_log_dispatch() {
+    static std::once_flag once;
+    std::call_once(once, [] { llama_log_set(llamafu_log_dispatch, nullptr); });
+}
 
-        const int32_t text_len = llama_detokenize(vocab, tokens, n_tokens, text_buf.data(), text_len_max, remove_special, unparse_special);
-        if (text_len < 0) {
-            return LLAMAFU_ERROR_UNKNOWN;
-        }
+// Records the buffers allocated on this thread while in scope
+struct BufferCapture {
+    std::vector<BufferRecord> records;
+    std::vector<BufferRecord>* previous;
 
-        *out_text = static_cast<char*>(malloc(text_len + 1));
-        if (!*out_text) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+    BufferCapture() : previous(t_buffer_capture) {
+        install_log_dispatch();
+        t_buffer_capture = &records;
+    }
+    BufferCapture(const BufferCapture&) = delete;
+    BufferCapture& operator=(const BufferCapture&) = delete;
+    ~BufferCapture() { t_buffer_capture = previous; }
+};
 
-        memcpy(*out_text, text_buf.data(), text_len);
-        (*out_text)[text_len] = '\0';
+// Host buffers live in ordinary process memory; the rest belong to an
+// accelerator (on Apple GPUs that is still unified memory)
+static bool is_host_buffer(const std::string& buffer_type) {
+    return buffer_type.compare(0, 3, "CPU") == 0 ||
+           (buffer_type.size() > 5 && buffer_type.compare(buffer_type.size() - 5, 5, "_Host") == 0);
+}
+
+// Current footprint (what jetsam enforces on iOS, resident set elsewhere)
+// and peak resident set of the process; both stay 0 on Windows
+static void process_memory(uint64_t* rss_bytes, uint64_t* peak_rss_bytes) {
+    *rss_bytes = 0;
+    *peak_rss_bytes = 0;
+#if !defined(_WIN32)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+        *peak_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss);  // Bytes on Darwin
+#else
+        *peak_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;  // KiB on Linux
+#endif
+    }
+
+#if defined(__APPLE__)
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS) {
+        *rss_bytes = info.phys_footprint;
+    }
+#else
+    std::ifstream statm("/proc/self/statm");
+    uint64_t pages_total = 0;
+    uint64_t pages_resident = 0;
+    if (statm >> pages_total >> pages_resident) {
+        *rss_bytes = pages_resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+#endif
+}
+
+// Dimensions that decide how much memory a context needs
+struct ModelShape {
+    uint64_t n_layer = 0;
+    uint64_t n_embd = 0;
+    uint64_t n_head = 0;
+    uint64_t n_ff = 0;
+    uint64_t n_vocab = 0;
+    uint64_t n_embd_k_total = 0;           // K width summed over layers (n_head_kv * head size, GQA aware)
+    uint64_t n_embd_v_total = 0;           // V width summed over layers
+};
 
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
-    }
+static ModelShape model_shape(const llama_model* model) {
+    ModelShape shape;
+    shape.n_layer = llama_model_n_layer(model);
+    shape.n_embd = llama_model_n_embd(model);
+    shape.n_head = std::max<int32_t>(1, llama_model_n_head(model));
+    shape.n_ff = 4 * shape.n_embd;  // Not exposed by llama.h
+    shape.n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+    const uint64_t head_dim = shape.n_embd / shape.n_head;
+    shape.n_embd_k_total = shape.n_layer * llama_model_n_head_kv(model) * head_dim;
+    shape.n_embd_v_total = shape.n_embd_k_total;
+    return shape;
 }
 
-LlamafuError llamafu_get_model_info(Llamafu llamafu, LlamafuModelInfo* out_info) {
-    if (!llamafu || !out_info) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
-
-    try {
-        // Initialize all fields to avoid reading uninitialized memory
-        memset(out_info, 0, sizeof(LlamafuModelInfo));
+// Every layer keeps n_ctx cells of K and V. Sliding-window layers really
+// need fewer, so this is an upper bound for SWA models.
+static uint64_t estimate_kv_bytes(const ModelShape& shape, uint64_t n_ctx, ggml_type type_k, ggml_type type_v) {
+    return n_ctx * (ggml_row_size(type_k, shape.n_embd_k_total) + ggml_row_size(type_v, shape.n_embd_v_total));
+}
 
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        out_info->n_vocab = llama_vocab_n_tokens(vocab);
-        out_info->n_ctx_train = llama_model_n_ctx_train(llamafu->model);
-        out_info->n_embd = llama_model_n_embd(llamafu->model);
-        out_info->n_layer = llama_model_n_layer(llamafu->model);
-        out_info->n_head = llama_model_n_head(llamafu->model);
-        out_info->n_head_kv = llama_model_n_head_kv(llamafu->model);
+// llama.cpp reserves its compute buffers for the worst-case n_ubatch graph
+// and reuses memory between nodes, so the peak is about the largest
+// intermediate (attention scores without flash attention, or the FFN
+// activations) plus the logits and a few embedding-wide tensors.
+static uint64_t estimate_compute_bytes(const ModelShape& shape, uint64_t n_ctx, uint64_t n_ubatch, bool flash_attn) {
+    const uint64_t kq = flash_attn ? 0 : n_ctx * n_ubatch * shape.n_head * sizeof(float);
+    const uint64_t ffn = n_ubatch * shape.n_ff * sizeof(float) * 3;
+    const uint64_t logits = n_ubatch * shape.n_vocab * sizeof(float);
+    const uint64_t embd = n_ubatch * shape.n_embd * sizeof(float) * 4;
+    return std::max(kq, ffn) + logits + embd;
+}
 
-        // Get model description from metadata
-        static std::string model_name;
-        char name_buf[256] = {0};
-        int32_t name_len = llama_model_meta_val_str(llamafu->model, "general.name", name_buf, sizeof(name_buf));
-        if (name_len > 0) {
-            model_name = name_buf;
-            out_info->name = model_name.c_str();
-        } else {
-            out_info->name = "";
-        }
+static uint64_t estimate_output_bytes(const ModelShape& shape, uint64_t n_seq_max) {
+    return n_seq_max * shape.n_vocab * sizeof(float);
+}
 
-        static std::string model_arch;
-        char arch_buf[256] = {0};
-        int32_t arch_len = llama_model_meta_val_str(llamafu->model, "general.architecture", arch_buf, sizeof(arch_buf));
-        if (arch_len > 0) {
-            model_arch = arch_buf;
-            out_info->architecture = model_arch.c_str();
-        } else {
-            out_info->architecture = "";
+static bool gguf_uint(const gguf_context* gguf, const std::string& key, uint64_t& out) {
+    const int64_t id = gguf_find_key(gguf, key.c_str());
+    if (id < 0) {
+        return false;
+    }
+    switch (gguf_get_kv_type(gguf, id)) {
+        case GGUF_TYPE_UINT32: out = gguf_get_val_u32(gguf, id); return true;
+        case GGUF_TYPE_INT32:  out = static_cast<uint64_t>(std::max<int32_t>(0, gguf_get_val_i32(gguf, id))); return true;
+        case GGUF_TYPE_UINT64: out = gguf_get_val_u64(gguf, id); return true;
+        default: return false;
+    }
+}
+
+// Sum of a per-layer value stored either once for all layers or as an array
+static uint64_t gguf_layer_sum(const gguf_context* gguf, const std::string& key, uint64_t n_layer, uint64_t fallback) {
+    const int64_t id = gguf_find_key(gguf, key.c_str());
+    if (id >= 0 && gguf_get_kv_type(gguf, id) == GGUF_TYPE_ARRAY) {
+        const gguf_type type = gguf_get_arr_type(gguf, id);
+        const size_t n = gguf_get_arr_n(gguf, id);
+        uint64_t sum = 0;
+        if (type == GGUF_TYPE_INT32 || type == GGUF_TYPE_UINT32) {
+            const uint32_t* values = static_cast<const uint32_t*>(gguf_get_arr_data(gguf, id));
+            for (size_t i = 0; i < n; i++) {
+                sum += values[i];
+            }
+            return sum;
         }
-
-        out_info->description = "";
-        out_info->n_params = llama_model_n_params(llamafu->model);
-        out_info->size_bytes = llama_model_size(llamafu->model);
-        out_info->has_encoder = false;
-        out_info->has_decoder = true;
-        out_info->is_recurrent = false;
-        out_info->supports_embeddings = true;
-        out_info->supports_multimodal = llamafu->is_multimodal;
-        out_info->rope_freq_base_train = 0.0f;
-        out_info->rope_freq_scale_train = 1.0f;
-
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
     }
+    uint64_t value;
+    return (gguf_uint(gguf, key, value) ? value : fallback) * n_layer;
 }
 
-LlamafuError llamafu_get_embeddings(Llamafu llamafu, const char* text, float** out_embeddings, int32_t* out_n_embd) {
-    if (!llamafu || !validate_string_param(text, "text") || !out_embeddings || !out_n_embd) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Reads the shape and weight size from a GGUF header without loading tensors
+static bool gguf_model_shape(const char* path, ModelShape& shape, uint64_t& weight_bytes) {
+    gguf_init_params params = {true, nullptr};
+    gguf_context* gguf = gguf_init_from_file(path, params);
+    if (!gguf) {
+        return false;
     }
 
-    try {
-        // Tokenize input using modern API
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        const int32_t text_len = static_cast<int32_t>(strlen(text));
-
-        // First pass to get the number of tokens
-        const int32_t n_tokens_max = text_len + 16; // Conservative estimate
-        std::vector<llama_token> tokens(n_tokens_max);
-
-        const int32_t n_tokens = llama_tokenize(vocab, text, text_len, tokens.data(), n_tokens_max, true, true);
-        if (n_tokens < 0) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
+    bool ok = false;
+    const int64_t arch_id = gguf_find_key(gguf, "general.architecture");
+    if (arch_id >= 0 && gguf_get_kv_type(gguf, arch_id) == GGUF_TYPE_STRING) {
+        const std::string arch = gguf_get_val_str(gguf, arch_id);
+        ok = gguf_uint(gguf, arch + ".block_count", shape.n_layer) &&
+             gguf_uint(gguf, arch + ".embedding_length", shape.n_embd);
+        if (ok) {
+            if (!gguf_uint(gguf, arch + ".attention.head_count", shape.n_head) || shape.n_head == 0) {
+                shape.n_head = 1;
+            }
+            if (!gguf_uint(gguf, arch + ".feed_forward_length", shape.n_ff)) {
+                shape.n_ff = 4 * shape.n_embd;
+            }
+            uint64_t key_length = shape.n_embd / shape.n_head;
+            uint64_t value_length = key_length;
+            gguf_uint(gguf, arch + ".attention.key_length", key_length);
+            gguf_uint(gguf, arch + ".attention.value_length", value_length);
+            const uint64_t n_head_kv_total =
+                gguf_layer_sum(gguf, arch + ".attention.head_count_kv", shape.n_layer, shape.n_head);
+            shape.n_embd_k_total = n_head_kv_total * key_length;
+            shape.n_embd_v_total = n_head_kv_total * value_length;
+
+            const int64_t tokens_id = gguf_find_key(gguf, "tokenizer.ggml.tokens");
+            shape.n_vocab = tokens_id >= 0 ? gguf_get_arr_n(gguf, tokens_id) : 0;
+
+            weight_bytes = 0;
+            for (int64_t i = 0; i < gguf_get_n_tensors(gguf); i++) {
+                weight_bytes += gguf_get_tensor_size(gguf, i);
+            }
         }
+    }
+    gguf_free(gguf);
+    return ok;
+}
 
-        tokens.resize(n_tokens);
+// =============================================================================
+// Shared Models
+// =============================================================================
 
-        if (tokens.empty()) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
-        }
+// Weights shared by every handle created from them. Loads naming the same
+// file and placement return the registered model instead of reading the GGUF
+// again; the weights are freed with the last reference.
+struct LlamafuModel_s {
+    llama_model* model = nullptr;
+    std::string key;                       // Registry key
+    int32_t refs = 1;                      // Guarded by g_model_registry_mutex
+    std::vector<BufferRecord> buffers;     // Weight buffers allocated by the load
+
+    // Every token's piece (special tokens rendered) in one arena; token i
+    // spans piece_offsets[i] .. piece_offsets[i + 1]
+    std::vector<char> piece_arena;
+    std::vector<uint32_t> piece_offsets;
+
+    // Load phases, in milliseconds
+    double t_load_weights_ms = 0.0;
+    double t_load_vocab_ms = 0.0;
+
+    // Resolved file path, and whether the weights are a mapping of it the
+    // kernel may page out (mmap without mlock)
+    std::string path;
+    bool pageable = false;
+};
 
-        // Clear the KV cache
-        llama_memory_clear(llama_get_memory(llamafu->ctx), false);
+static std::mutex g_model_registry_mutex;
+static std::map<std::string, LlamafuModel_s*> g_model_registry;
 
-        // Evaluate tokens
-        if (llama_decode(llamafu->ctx, llama_batch_get_one(tokens.data(), tokens.size())) != 0) {
-            return LLAMAFU_ERROR_UNKNOWN;
-        }
+// Everything that changes what llama_model_load_from_file produces
+static std::string model_registry_key(const LlamafuModelParams* params) {
+    std::error_code ec;
+    std::string path = std::filesystem::weakly_canonical(params->model_path, ec).string();
+    if (ec) {
+        path = params->model_path;
+    }
+    return path + '\n' + std::to_string(requested_gpu_layers(params)) + '/' +
+           std::to_string(params->split_mode) + '/' + std::to_string(params->main_gpu) + '/' +
+           std::to_string(params->no_mmap != 0) + '/' + std::to_string(params->use_mlock != 0);
+}
 
-        // Get embeddings for the last token (most common use case)
-        int32_t n_embd = llama_model_n_embd(llamafu->model);
-        const float* embeddings = llama_get_embeddings_ith(llamafu->ctx, -1);
+static bool validate_model_params(const LlamafuModelParams* params) {
+    return validate_string_param(params->model_path, "model_path") &&
+           params->n_gpu_layers >= -1 && params->main_gpu >= 0 &&
+           validate_numeric_param(params->split_mode, LLAMAFU_SPLIT_MODE_DEFAULT, LLAMAFU_SPLIT_MODE_ROW);
+}
 
-        if (!embeddings) {
-            // Embeddings might not be available for all models
-            return LLAMAFU_ERROR_UNKNOWN;
+static void model_retain(LlamafuModel_s* model) {
+    std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+    model->refs++;
+}
+
+static void model_release(LlamafuModel_s* model) {
+    {
+        std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+        if (--model->refs > 0) {
+            return;
         }
+        auto it = g_model_registry.find(model->key);
+        if (it != g_model_registry.end() && it->second == model) {
+            g_model_registry.erase(it);
+        }
+    }
+    llama_model_free(model->model);
+    delete model;
+}
+
+// Detokenizes the whole vocabulary once so generation looks pieces up
+// instead of calling llama_token_to_piece for every token
+static void build_piece_table(LlamafuModel_s* model) {
+    const llama_vocab* vocab = llama_model_get_vocab(model->model);
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    model->piece_offsets.resize(static_cast<size_t>(n_vocab) + 1);
+    model->piece_arena.reserve(static_cast<size_t>(n_vocab) * 8);
+
+    std::vector<char> buf(256);
+    for (int32_t i = 0; i < n_vocab; i++) {
+        model->piece_offsets[i] = static_cast<uint32_t>(model->piece_arena.size());
+        int32_t n = llama_token_to_piece(vocab, i, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        if (n < 0) {
+            buf.resize(static_cast<size_t>(-n));
+            n = llama_token_to_piece(vocab, i, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        }
+        if (n > 0) {
+            model->piece_arena.insert(model->piece_arena.end(), buf.data(), buf.data() + n);
+        }
+    }
+    model->piece_offsets[n_vocab] = static_cast<uint32_t>(model->piece_arena.size());
+    model->piece_arena.shrink_to_fit();
+}
 
-        *out_n_embd = n_embd;
-        *out_embeddings = static_cast<float*>(malloc(n_embd * sizeof(float)));
+// Piece of token from the model's table; empty for ids outside the vocabulary
+static std::string_view token_piece(const LlamafuModel_s* model, llama_token token) {
+    if (token < 0 || static_cast<size_t>(token) + 1 >= model->piece_offsets.size()) {
+        return {};
+    }
+    const uint32_t begin = model->piece_offsets[token];
+    return std::string_view(model->piece_arena.data() + begin, model->piece_offsets[token + 1] - begin);
+}
 
-        if (!*out_embeddings) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+// Tokenizes text into tokens, growing it when llama_tokenize reports that
+// more room is needed. Returns the token count or -1.
+static int32_t tokenize_text(const llama_vocab* vocab, const char* text, int32_t text_len, bool add_special,
+                             bool parse_special, std::vector<llama_token>& tokens) {
+    if (tokens.size() < static_cast<size_t>(text_len) + 2) {
+        tokens.resize(static_cast<size_t>(text_len) + 2);
+    }
+    int32_t n = llama_tokenize(vocab, text, text_len, tokens.data(), static_cast<int32_t>(tokens.size()),
+                               add_special, parse_special);
+    if (n < 0 && n != INT32_MIN) {
+        tokens.resize(static_cast<size_t>(-n));
+        n = llama_tokenize(vocab, text, text_len, tokens.data(), static_cast<int32_t>(tokens.size()),
+                           add_special, parse_special);
+    }
+    if (n < 0) {
+        return -1;
+    }
+    tokens.resize(n);
+    return n;
+}
+
+// Returns a registered model matching params, or loads and registers one.
+// cancel and progress (both optional) let a background load be observed and
+// stopped; the caller's progress callback is used when they are not given.
+static LlamafuError load_shared_model(const LlamafuModelParams* params, const std::atomic<bool>* cancel,
+                                      std::atomic<float>* progress, LlamafuModel_s** out_model) {
+    const std::string key = model_registry_key(params);
+    {
+        std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+        auto it = g_model_registry.find(key);
+        if (it != g_model_registry.end()) {
+            it->second->refs++;
+            if (progress) {
+                progress->store(1.0f);
+            }
+            *out_model = it->second;
+            return LLAMAFU_SUCCESS;
         }
+    }
 
-        memcpy(*out_embeddings, embeddings, n_embd * sizeof(float));
+    // Collect the weight buffers of this load only
+    BufferCapture capture;
+
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = requested_gpu_layers(params);
+    model_params.split_mode = SPLIT_MODES[params->split_mode];
+    model_params.main_gpu = params->main_gpu;
+    model_params.use_mmap = !params->no_mmap;
+    model_params.use_mlock = params->use_mlock != 0;
+
+    LoadProgress load_progress = {cancel || progress ? nullptr : params->progress_callback,
+                                  params->progress_callback_data, cancel, progress, false};
+    if (load_progress.callback || cancel || progress) {
+        model_params.progress_callback = load_progress_trampoline;
+        model_params.progress_callback_user_data = &load_progress;
+    }
+
+    const auto t_load_start = std::chrono::steady_clock::now();
+    llama_model* loaded = nullptr;
+    {
+        LLAMAFU_TRACE_SCOPE("llamafu.load_weights");
+        loaded = llama_model_load_from_file(params->model_path, model_params);
+    }
+    if (!loaded) {
+        return load_progress.cancelled ? LLAMAFU_ERROR_ABORTED : LLAMAFU_ERROR_MODEL_LOAD_FAILED;
+    }
+    const auto t_vocab_start = std::chrono::steady_clock::now();
+
+    auto model = std::make_unique<LlamafuModel_s>();
+    model->model = loaded;
+    model->key = key;
+    model->buffers = std::move(capture.records);
+    build_piece_table(model.get());
+    model->t_load_weights_ms = elapsed_ms(t_load_start, t_vocab_start);
+    model->t_load_vocab_ms = elapsed_ms(t_vocab_start);
+    std::error_code path_ec;
+    model->path = std::filesystem::canonical(params->model_path, path_ec).string();
+    model->pageable = !path_ec && model_params.use_mmap && !model_params.use_mlock;
+
+    std::unique_lock<std::mutex> lock(g_model_registry_mutex);
+    auto it = g_model_registry.find(key);
+    if (it != g_model_registry.end()) {
+        // Another thread loaded the same model meanwhile; keep theirs
+        it->second->refs++;
+        *out_model = it->second;
+        lock.unlock();
+        llama_model_free(model->model);
         return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
     }
+    g_model_registry[key] = model.get();
+    *out_model = model.release();
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuGrammarSampler llamafu_grammar_sampler_init(Llamafu llamafu, const char* grammar_str, const char* grammar_root) {
-    if (!llamafu || !validate_string_param(grammar_str, "grammar_str") || !validate_string_param(grammar_root, "grammar_root")) {
-        return nullptr;
+static bool validate_context_params(const LlamafuContextParams* context_params) {
+    return validate_numeric_param(context_params->context_mode, LLAMAFU_CONTEXT_MODE_GENERATION, LLAMAFU_CONTEXT_MODE_BOTH) &&
+           validate_numeric_param(context_params->pooling_type, LLAMAFU_POOLING_UNSPECIFIED, LLAMAFU_POOLING_RANK) &&
+           validate_numeric_param(context_params->type_k, LLAMAFU_KV_CACHE_DEFAULT, LLAMAFU_KV_CACHE_IQ4_NL) &&
+           validate_numeric_param(context_params->type_v, LLAMAFU_KV_CACHE_DEFAULT, LLAMAFU_KV_CACHE_IQ4_NL) &&
+           context_params->n_keep >= -1;
+}
+
+static llama_context_params to_llama_context_params(const LlamafuContextParams* context_params,
+                                                    LlamafuContextMode context_mode) {
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = context_params->n_ctx > 0 ? context_params->n_ctx : 2048;  // Use provided or default
+    ctx_params.n_threads = context_params->n_threads > 0 ? context_params->n_threads : -1;  // Use provided or auto
+    ctx_params.n_threads_batch = context_params->n_threads_batch > 0 ? context_params->n_threads_batch : ctx_params.n_threads;
+    // Only embedding-only contexts produce embeddings on every decode;
+    // BOTH switches them on just for llamafu_get_embeddings
+    ctx_params.embeddings = context_mode == LLAMAFU_CONTEXT_MODE_EMBEDDING;
+    ctx_params.pooling_type = static_cast<enum llama_pooling_type>(context_params->pooling_type);
+    ctx_params.n_seq_max = context_params->n_seq_max > 0 ? context_params->n_seq_max : 1;
+    ctx_params.kv_unified = true;  // Sequences share one pool of n_ctx cells
+
+    // Prompts are prefilled in n_batch chunks, each split into n_ubatch
+    // sized compute graphs by llama.cpp
+    if (context_params->n_batch > 0) {
+        ctx_params.n_batch = context_params->n_batch;
+    }
+    if (context_params->n_ubatch > 0) {
+        ctx_params.n_ubatch = std::min(context_params->n_ubatch, ctx_params.n_batch);
+    }
+    ctx_params.offload_kqv = context_params->offload_kqv;
+    ctx_params.type_k = kv_cache_ggml_type(context_params->type_k);
+    ctx_params.type_v = kv_cache_ggml_type(context_params->type_v);
+    if (context_params->flash_attn || is_quantized_kv_type(ctx_params.type_v)) {
+        ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    }
+    if (!context_params->causal_attn) {
+        ctx_params.attention_type = LLAMA_ATTENTION_TYPE_NON_CAUSAL;
+    }
+
+    // RoPE / YaRN overrides (0 keeps the model's values)
+    ctx_params.rope_freq_base = context_params->rope_freq_base;
+    ctx_params.rope_freq_scale = context_params->rope_freq_scale;
+    ctx_params.yarn_ext_factor = context_params->yarn_ext_factor;
+    ctx_params.yarn_attn_factor = context_params->yarn_attn_factor;
+    ctx_params.yarn_beta_fast = context_params->yarn_beta_fast;
+    ctx_params.yarn_beta_slow = context_params->yarn_beta_slow;
+    ctx_params.yarn_orig_ctx = context_params->yarn_orig_ctx;
+    return ctx_params;
+}
+
+// Creates a handle with its own context on top of model, taking a reference
+// to it. context_params must already be validated.
+static LlamafuError create_handle(LlamafuModel_s* model, const LlamafuContextParams* context_params,
+                                  Llamafu* out_llamafu) {
+    LlamafuContextMode context_mode = static_cast<LlamafuContextMode>(context_params->context_mode);
+    if (context_mode == LLAMAFU_CONTEXT_MODE_GENERATION && context_params->embeddings) {
+        context_mode = LLAMAFU_CONTEXT_MODE_BOTH;
+    }
+
+    // KV cache, output and compute buffers of this context
+    BufferCapture capture;
+
+    const llama_context_params ctx_params = to_llama_context_params(context_params, context_mode);
+    const auto t_context_start = std::chrono::steady_clock::now();
+    llama_context* ctx = nullptr;
+    {
+        LLAMAFU_TRACE_SCOPE("llamafu.load_context");
+        ctx = llama_init_from_model(model->model, ctx_params);
+    }
+    if (!ctx) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     }
+    const double t_load_context_ms = elapsed_ms(t_context_start);
 
-    // Grammar sampling would need to be implemented with current llama.cpp API
-    // Return null for now as placeholder
-    return nullptr;
+    Llamafu llamafu = new Llamafu_s{
+        model->model, ctx, false,
+        std::vector<LlamafuLoraAdapter>{},
+        std::vector<LlamafuSampler>{},
+        nullptr, nullptr, nullptr,
+        nullptr, 0, false,
+        std::list<ImageCacheEntry>{}
+    };
+
+    llamafu->abort_callback = context_params->abort_callback;
+    llamafu->abort_callback_data = context_params->abort_callback_data;
+    llama_set_abort_callback(ctx, decode_abort_trampoline, llamafu);
+    llamafu->context_mode = context_mode;
+    llamafu->type_k = ctx_params.type_k;
+    llamafu->type_v = ctx_params.type_v;
+    llamafu->context_shift = context_params->context_shift;
+    llamafu->n_keep = context_params->n_keep;
+    llamafu->shared_model = model;
+    llamafu->llama_ctx_params = ctx_params;
+    llamafu->buffers = std::move(capture.records);
+    llamafu->metrics.t_load_weights_ms = model->t_load_weights_ms;
+    llamafu->metrics.t_load_vocab_ms = model->t_load_vocab_ms;
+    llamafu->metrics.t_load_context_ms = t_load_context_ms;
+    model_retain(model);
+
+    // Sequence 0 is reserved for llamafu_complete's prompt cache
+    llamafu->seq_in_use.assign(llama_n_seq_max(ctx), false);
+    llamafu->seq_in_use[0] = true;
+
+    *out_llamafu = llamafu;
+    return LLAMAFU_SUCCESS;
 }
 
-void llamafu_grammar_sampler_free(LlamafuGrammarSampler sampler) {
-    if (sampler) {
-        // Free grammar sampler resources
+// Weight buffers of the shared model, the handle's own, then its adapters'
+static std::vector<BufferRecord> handle_buffers(Llamafu llamafu) {
+    std::vector<BufferRecord> buffers;
+    if (llamafu->shared_model) {
+        buffers = llamafu->shared_model->buffers;
+    }
+    buffers.insert(buffers.end(), llamafu->buffers.begin(), llamafu->buffers.end());
+    for (LlamafuLoraAdapter adapter : llamafu->lora_adapters) {
+        buffers.insert(buffers.end(), adapter->buffers.begin(), adapter->buffers.end());
     }
+    return buffers;
 }
 
-// Sampler chain implementation
-LlamafuSampler llamafu_sampler_chain_init(void) {
-    try {
-        llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
-        if (!chain) {
-            return nullptr;
-        }
+// =============================================================================
+// LoRA Adapters
+// =============================================================================
 
-        LlamafuSampler sampler = new LlamafuSampler_s{chain, LLAMAFU_SAMPLER_CHAIN};
-        return sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
-    }
+static std::vector<LlamafuLoraAdapter>::iterator find_lora(Llamafu llamafu, LlamafuLoraAdapter adapter) {
+    return std::find(llamafu->lora_adapters.begin(), llamafu->lora_adapters.end(), adapter);
 }
 
-LlamafuSampler llamafu_sampler_init_top_k(int32_t k) {
-    if (k <= 0) {
-        return nullptr;
-    }
+static bool validate_lora_scale(float scale) {
+    return validate_float_param(scale, 0.0f, 2.0f);
+}
 
-    try {
-        llama_sampler* sampler = llama_sampler_init_top_k(k);
-        if (!sampler) {
-            return nullptr;
+// The handle's active adapters, used by requests that name none
+static LoraSet default_lora_set(Llamafu llamafu) {
+    LoraSet set;
+    for (LlamafuLoraAdapter adapter : llamafu->lora_adapters) {
+        if (adapter->active) {
+            set.emplace_back(adapter->adapter, adapter->scale);
         }
-
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TOP_K};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
     }
+    std::sort(set.begin(), set.end());
+    return set;
 }
 
-LlamafuSampler llamafu_sampler_init_top_p(float p, size_t min_keep) {
-    if (p < 0.0f || p > 1.0f) {
-        return nullptr;
+// Make set the adapters the context decodes with; a no-op if it already is.
+// llama.cpp only records the adapters here, nothing is reallocated.
+static bool apply_lora_set(Llamafu llamafu, const LoraSet& set) {
+    if (set == llamafu->lora_applied) {
+        return true;
     }
-
-    try {
-        llama_sampler* sampler = llama_sampler_init_top_p(p, min_keep);
-        if (!sampler) {
-            return nullptr;
+    if (!llamafu->ctx) {
+        return true;  // Released; the set is applied again by the next request
+    }
+    llama_clear_adapter_lora(llamafu->ctx);
+    llamafu->lora_applied.clear();
+    for (const auto& entry : set) {
+        if (llama_set_adapter_lora(llamafu->ctx, entry.first, entry.second) != 0) {
+            return false;
         }
-
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TOP_P};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
+        llamafu->lora_applied.push_back(entry);
     }
+    return true;
 }
 
-LlamafuSampler llamafu_sampler_init_min_p(float p, size_t min_keep) {
-    if (p < 0.0f || p > 1.0f) {
-        return nullptr;
+// Adapters requested by batch (NULL = the handle's active set)
+static LlamafuError resolve_lora_set(Llamafu llamafu, const LlamafuLoraBatch* batch, LoraSet& out) {
+    if (!batch) {
+        out = default_lora_set(llamafu);
+        return LLAMAFU_SUCCESS;
     }
-
-    try {
-        llama_sampler* sampler = llama_sampler_init_min_p(p, min_keep);
-        if (!sampler) {
-            return nullptr;
+    if (batch->n_adapters > 0 && !batch->adapters) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    out.clear();
+    for (size_t i = 0; i < batch->n_adapters; i++) {
+        LlamafuLoraAdapter adapter = batch->adapters[i];
+        if (!adapter || find_lora(llamafu, adapter) == llamafu->lora_adapters.end()) {
+            return LLAMAFU_ERROR_LORA_NOT_FOUND;
         }
-
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_MIN_P};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
+        const float scale = batch->scales ? batch->scales[i] : adapter->scale;
+        if (!validate_lora_scale(scale)) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        out.emplace_back(adapter->adapter, scale);
     }
+    std::sort(out.begin(), out.end());
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuSampler llamafu_sampler_init_tail_free(float z, size_t min_keep) {
-    // Tail free sampling has been removed from llama.cpp
-    // Return nullptr to indicate unsupported
-    (void)z;
-    (void)min_keep;
-    return nullptr;
-}
-
-LlamafuSampler llamafu_sampler_init_typical(float p, size_t min_keep) {
-    if (p < 0.0f || p > 1.0f) {
-        return nullptr;
-    }
+// Puts the handle's active set back when a request that used its own
+// adapters ends
+struct ScopedLoraSet {
+    Llamafu llamafu;
+    bool applied = false;
 
-    try {
-        llama_sampler* sampler = llama_sampler_init_typical(p, min_keep);
-        if (!sampler) {
-            return nullptr;
+    ~ScopedLoraSet() {
+        if (applied) {
+            apply_lora_set(llamafu, default_lora_set(llamafu));
         }
-
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TYPICAL};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
     }
-}
+};
 
-LlamafuSampler llamafu_sampler_init_temp(float temp) {
-    if (temp < 0.0f) {
-        return nullptr;
+// Parameter count and target modules, which llama.cpp does not expose, read
+// from the adapter's GGUF header
+static void read_lora_metadata(LlamafuLoraAdapter_s* entry) {
+    gguf_init_params params = {true, nullptr};
+    gguf_context* gguf = gguf_init_from_file(entry->path.c_str(), params);
+    if (!gguf) {
+        return;
     }
 
-    try {
-        llama_sampler* sampler = llama_sampler_init_temp(temp);
-        if (!sampler) {
-            return nullptr;
+    std::set<std::string> modules;
+    for (int64_t i = 0; i < gguf_get_n_tensors(gguf); i++) {
+        const ggml_type type = gguf_get_tensor_type(gguf, i);
+        const size_t type_size = ggml_type_size(type);
+        if (type_size > 0) {
+            entry->parameter_count += gguf_get_tensor_size(gguf, i) / type_size * ggml_blck_size(type);
         }
 
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TEMP};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
+        // "blk.7.attn_q.weight.lora_a" -> "attn_q", "output.weight.lora_b" -> "output"
+        std::string name = gguf_get_tensor_name(gguf, i);
+        size_t start = 0;
+        if (name.compare(0, 4, "blk.") == 0) {
+            start = name.find('.', 4);
+            start = start == std::string::npos ? name.size() : start + 1;
+        }
+        const std::string module = name.substr(start, name.find('.', start) - start);
+        if (!module.empty()) {
+            modules.insert(module);
+        }
+    }
+    for (const std::string& module : modules) {
+        if (!entry->target_modules.empty()) {
+            entry->target_modules += ',';
+        }
+        entry->target_modules += module;
     }
-}
 
-LlamafuSampler llamafu_sampler_init_temp_ext(float temp, float delta, float exponent) {
-    if (temp < 0.0f) {
-        return nullptr;
+    const int64_t name_id = gguf_find_key(gguf, "general.name");
+    if (entry->name.empty() && name_id >= 0 && gguf_get_kv_type(gguf, name_id) == GGUF_TYPE_STRING) {
+        entry->name = gguf_get_val_str(gguf, name_id);
     }
+    gguf_free(gguf);
+}
 
-    try {
-        llama_sampler* sampler = llama_sampler_init_temp_ext(temp, delta, exponent);
-        if (!sampler) {
-            return nullptr;
-        }
+static LlamafuError load_lora(Llamafu llamafu, const char* path, float scale, const char* name,
+                              const char* description, LlamafuLoraAdapter* out_adapter) {
+    // Backend buffers the adapter's tensors are uploaded to
+    BufferCapture capture;
+    llama_adapter_lora* adapter = llama_adapter_lora_init(llamafu->model, path);
+    if (!adapter) {
+        return LLAMAFU_ERROR_LORA_LOAD_FAILED;
+    }
 
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TEMP};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
+    auto entry = std::make_unique<LlamafuLoraAdapter_s>();
+    entry->owner = llamafu;
+    entry->adapter = adapter;
+    entry->path = path;
+    entry->name = name ? name : "";
+    entry->description = description ? description : "";
+    entry->scale = scale;
+    entry->buffers = std::move(capture.records);
+    entry->created_timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    read_lora_metadata(entry.get());
+    if (entry->name.empty()) {
+        entry->name = std::filesystem::path(path).stem().string();
     }
+
+    llamafu->lora_adapters.push_back(entry.get());
+    *out_adapter = entry.release();
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuSampler llamafu_sampler_init_mirostat(int32_t n_vocab, uint32_t seed, float tau, float eta, int32_t m) {
-    if (n_vocab <= 0 || tau <= 0.0f || eta <= 0.0f || m <= 0) {
-        return nullptr;
+static void unload_lora(Llamafu llamafu, std::vector<LlamafuLoraAdapter>::iterator it) {
+    LlamafuLoraAdapter adapter = *it;
+    llamafu->lora_adapters.erase(it);
+    scheduler_drop_lora(llamafu, adapter->adapter);
+
+    // Take it off the context before freeing; the prompt prefix evaluated
+    // with it (if any) is no longer reproducible
+    LoraSet applied = llamafu->lora_applied;
+    applied.erase(std::remove_if(applied.begin(), applied.end(),
+                                 [&](const auto& entry) { return entry.first == adapter->adapter; }),
+                  applied.end());
+    apply_lora_set(llamafu, applied);
+    for (const auto& entry : llamafu->cached_lora) {
+        if (entry.first == adapter->adapter) {
+            llamafu->cached_lora.clear();
+            llamafu->cached_tokens.clear();
+            break;
+        }
     }
 
-    try {
-        llama_sampler* sampler = llama_sampler_init_mirostat(n_vocab, seed, tau, eta, m);
-        if (!sampler) {
-            return nullptr;
-        }
+    llama_adapter_lora_free(adapter->adapter);
+    delete adapter;
+}
 
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_MIROSTAT};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
+static void free_all_lora(Llamafu llamafu) {
+    if (llamafu->ctx) {
+        llama_clear_adapter_lora(llamafu->ctx);
     }
+    for (LlamafuLoraAdapter adapter : llamafu->lora_adapters) {
+        llama_adapter_lora_free(adapter->adapter);
+        if (adapter->owned_by_caller && !adapter->free_requested.load(std::memory_order_acquire)) {
+            adapter->owner = nullptr;
+            adapter->adapter = nullptr;
+            adapter->buffers.clear();
+        } else {
+            delete adapter;
+        }
+    }
+    llamafu->lora_adapters.clear();
+    llamafu->lora_applied.clear();
+    llamafu->lora_free_pending.store(false, std::memory_order_relaxed);
 }
 
-LlamafuSampler llamafu_sampler_init_mirostat_v2(uint32_t seed, float tau, float eta) {
-    if (tau <= 0.0f || eta <= 0.0f) {
-        return nullptr;
+// Unloads the adapters llamafu_lora_adapter_free could not take off a busy
+// handle; the caller holds the generation lock
+static void drop_freed_lora(Llamafu llamafu) {
+    if (!llamafu->lora_free_pending.exchange(false, std::memory_order_acq_rel)) {
+        return;
     }
-
     try {
-        llama_sampler* sampler = llama_sampler_init_mirostat_v2(seed, tau, eta);
-        if (!sampler) {
-            return nullptr;
+        for (size_t i = llamafu->lora_adapters.size(); i-- > 0;) {
+            if (llamafu->lora_adapters[i]->free_requested.load(std::memory_order_acquire)) {
+                unload_lora(llamafu, llamafu->lora_adapters.begin() + i);
+            }
         }
-
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_MIROSTAT_V2};
-        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return nullptr;
+        llamafu->lora_free_pending.store(true, std::memory_order_release);  // Retried by the next holder
     }
 }
 
-LlamafuSampler llamafu_sampler_init_grammar(const char* grammar_str, const char* root) {
-    // Grammar sampler requires a vocab reference which we don't have in this simplified API
-    // Return nullptr to indicate unsupported
-    (void)grammar_str;
-    (void)root;
-    return nullptr;
+// Bytes the loaded adapters occupy; the file size when llama.cpp logged no
+// buffer sizes
+static uint64_t lora_resident_bytes(Llamafu llamafu) {
+    uint64_t total = 0;
+    for (LlamafuLoraAdapter adapter : llamafu->lora_adapters) {
+        uint64_t bytes = 0;
+        for (const BufferRecord& buffer : adapter->buffers) {
+            bytes += buffer.size_bytes;
+        }
+        if (adapter->buffers.empty()) {
+            std::error_code ec;
+            const auto file_size = std::filesystem::file_size(adapter->path, ec);
+            bytes = ec ? 0 : static_cast<uint64_t>(file_size);
+        }
+        total += bytes;
+    }
+    return total;
 }
 
-LlamafuSampler llamafu_sampler_init_penalties(int32_t n_vocab, LlamafuToken eos_token, LlamafuToken nl_token,
-                                             int32_t repeat_last_n, float repeat_penalty, float freq_penalty,
-                                             float presence_penalty, bool penalize_nl, bool ignore_eos) {
-    if (repeat_last_n < 0) {
-        return nullptr;
-    }
+// =============================================================================
+// Persistent Prompt Cache
+// =============================================================================
 
-    // Note: n_vocab, eos_token, nl_token, penalize_nl, ignore_eos are no longer used in the new API
-    (void)n_vocab;
-    (void)eos_token;
-    (void)nl_token;
-    (void)penalize_nl;
-    (void)ignore_eos;
+// One saved sequence-0 state. The file holds a header, the resident tokens
+// and the llama_state_seq_get_data blob; the index keeps everything but the
+// blob in memory.
+struct PromptCacheEntry {
+    std::string path;
+    std::vector<llama_token> tokens;
+    std::vector<uint64_t> block_hashes;    // Chained hash at the end of each full block
+    uint64_t n_bytes;                      // File size
+};
 
-    try {
-        llama_sampler* sampler = llama_sampler_init_penalties(repeat_last_n, repeat_penalty, freq_penalty, presence_penalty);
-        if (!sampler) {
-            return nullptr;
-        }
+struct PromptDiskCache {
+    std::string dir;
+    uint64_t max_bytes;
+    int32_t block_size;
+    uint64_t fingerprint;                  // Identifies the model the states belong to
+    std::list<PromptCacheEntry> entries;   // Most recently used first
+    uint64_t n_bytes = 0;
+    int32_t n_hits = 0;
+    int32_t n_misses = 0;
+};
 
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_PENALTIES};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
+static const uint32_t PROMPT_CACHE_MAGIC = 0x4350464c;  // "LFPC"
+static const uint32_t PROMPT_CACHE_VERSION = 1;
+static const char* const PROMPT_CACHE_EXT = ".lpc";
+
+struct PromptCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fingerprint;
+    uint64_t n_tokens;
+    uint64_t state_size;
+};
+
+static uint64_t fnv1a_mix(uint64_t h, uint64_t v) {
+    return (h ^ v) * 1099511628211ULL;
+}
+
+// Hash of every block_size-token prefix, each chained onto the previous one,
+// so two prompts share their first n hashes exactly when (barring
+// collisions) they share their first n blocks.
+static std::vector<uint64_t> prompt_block_hashes(const std::vector<llama_token>& tokens, int32_t block_size) {
+    std::vector<uint64_t> hashes;
+    hashes.reserve(tokens.size() / block_size);
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        h = fnv1a_mix(h, static_cast<uint32_t>(tokens[i]));
+        if ((i + 1) % block_size == 0) {
+            hashes.push_back(h);
+        }
     }
+    return hashes;
 }
 
-int32_t llamafu_sampler_chain_add(LlamafuSampler chain, LlamafuSampler sampler) {
-    if (!chain || !sampler || chain->type != LLAMAFU_SAMPLER_CHAIN) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static size_t matching_blocks(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+    size_t n = 0;
+    const size_t n_max = std::min(a.size(), b.size());
+    while (n < n_max && a[n] == b[n]) {
+        n++;
     }
+    return n;
+}
 
-    try {
-        llama_sampler_chain_add(chain->sampler, sampler->sampler);
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+// States only restore into the model (and KV layout) that produced them
+static uint64_t prompt_cache_fingerprint(Llamafu llamafu) {
+    char desc[256] = {0};
+    llama_model_desc(llamafu->model, desc, sizeof(desc));
+    uint64_t h = 1469598103934665603ULL;
+    for (const char* c = desc; *c; c++) {
+        h = fnv1a_mix(h, static_cast<unsigned char>(*c));
     }
+    h = fnv1a_mix(h, llama_model_n_params(llamafu->model));
+    h = fnv1a_mix(h, llama_model_size(llamafu->model));
+    return h;
 }
 
-int32_t llamafu_sampler_chain_remove(LlamafuSampler chain, int32_t i) {
-    if (!chain || chain->type != LLAMAFU_SAMPLER_CHAIN || i < 0) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static bool read_prompt_cache_entry(const std::string& path, uint64_t fingerprint, PromptCacheEntry& entry,
+                                    PromptCacheHeader& header) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != PROMPT_CACHE_MAGIC || header.version != PROMPT_CACHE_VERSION ||
+        header.fingerprint != fingerprint || header.n_tokens == 0 || header.n_tokens > (1u << 24)) {
+        return false;
     }
+    entry.tokens.resize(header.n_tokens);
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(entry.tokens.data()),
+                                     header.n_tokens * sizeof(llama_token)));
+}
 
-    try {
-        llama_sampler* removed = llama_sampler_chain_remove(chain->sampler, i);
-        if (removed) {
-            llama_sampler_free(removed);
-        }
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
-    }
+static void prompt_cache_remove(PromptDiskCache* cache, std::list<PromptCacheEntry>::iterator it) {
+    std::error_code ec;
+    std::filesystem::remove(it->path, ec);
+    cache->n_bytes -= std::min(cache->n_bytes, it->n_bytes);
+    cache->entries.erase(it);
 }
 
-int32_t llamafu_sampler_chain_n(LlamafuSampler chain) {
-    if (!chain || chain->type != LLAMAFU_SAMPLER_CHAIN) {
-        return -1;
+static void prompt_cache_evict(PromptDiskCache* cache) {
+    while (cache->n_bytes > cache->max_bytes && !cache->entries.empty()) {
+        prompt_cache_remove(cache, std::prev(cache->entries.end()));
     }
+}
 
-    try {
-        return llama_sampler_chain_n(chain->sampler);
-    } catch (const std::exception& e) {
-        return -1;
-    }
+// Mark an entry most recently used, in the index and on disk (file mtimes
+// order the entries when the directory is reopened)
+static void prompt_cache_touch(PromptDiskCache* cache, std::list<PromptCacheEntry>::iterator it) {
+    cache->entries.splice(cache->entries.begin(), cache->entries, it);
+    std::error_code ec;
+    std::filesystem::last_write_time(it->path, std::filesystem::file_time_type::clock::now(), ec);
 }
 
-LlamafuSampler llamafu_sampler_chain_get(LlamafuSampler chain, int32_t i) {
-    if (!chain || chain->type != LLAMAFU_SAMPLER_CHAIN || i < 0) {
-        return nullptr;
-    }
+// Load the saved state sharing the most leading blocks with tokens into
+// sequence 0, if that beats the n_resident tokens already there. Returns
+// false when nothing was touched; otherwise cached_tokens holds the loaded
+// tokens (or is empty if the state could not be applied, with sequence 0
+// cleared).
+static bool prompt_cache_restore(Llamafu llamafu, const std::vector<llama_token>& tokens, size_t n_resident) {
+    PromptDiskCache* cache = llamafu->prompt_disk_cache;
+    const std::vector<uint64_t> hashes = prompt_block_hashes(tokens, cache->block_size);
 
-    try {
-        llama_sampler* sampler = llama_sampler_chain_get(chain->sampler, i);
-        if (!sampler) {
-            return nullptr;
+    auto best = cache->entries.end();
+    size_t n_best = 0;
+    for (auto it = cache->entries.begin(); it != cache->entries.end(); ++it) {
+        const size_t n = matching_blocks(it->block_hashes, hashes);
+        if (n > n_best) {
+            n_best = n;
+            best = it;
         }
-
-        // Note: This returns a reference to the internal sampler, not owned by caller
-        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_CHAIN};
-        return llamafu_sampler;
-    } catch (const std::exception& e) {
-        return nullptr;
     }
+    if (best == cache->entries.end()) {
+        cache->n_misses++;
+        return false;
+    }
+    if (n_best * cache->block_size <= n_resident) {
+        return false;
+    }
+
+    llama_memory_t mem = llama_get_memory(llamafu->ctx);
+    llama_memory_seq_rm(mem, 0, -1, -1);
+    llamafu->cached_tokens.clear();
+
+    // The state is applied straight from the mapped file
+    ScopedFd file(open(best->path.c_str(), O_RDONLY | O_CLOEXEC));
+    FileMapping map;
+    bool ok = file.fd >= 0 && map_fd_for_read(file.fd, map) && map.size >= sizeof(PromptCacheHeader);
+    if (ok) {
+        PromptCacheHeader header;
+        memcpy(&header, map.data(), sizeof(header));
+        const size_t state_offset = sizeof(header) + best->tokens.size() * sizeof(llama_token);
+        ok = header.magic == PROMPT_CACHE_MAGIC && header.fingerprint == cache->fingerprint &&
+             header.n_tokens == best->tokens.size() && state_offset + header.state_size <= map.size &&
+             llama_state_seq_set_data(llamafu->ctx, map.data() + state_offset, header.state_size, 0) != 0;
+    }
+    if (!ok) {
+        // Unreadable or incompatible: drop it so later prompts do not retry
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        prompt_cache_remove(cache, best);
+        return true;
+    }
+
+    llamafu->cached_tokens = best->tokens;
+    cache->n_hits++;
+    prompt_cache_touch(cache, best);
+    return true;
 }
 
-llama_token llamafu_sampler_sample(LlamafuSampler sampler, Llamafu llamafu, int32_t idx) {
-    if (!sampler || !llamafu || idx < 0) {
-        return -1;
+// Save sequence 0 (starting with tokens; cells past them are dropped again
+// on restore) unless a saved state already covers all of its full blocks.
+// Entries the new one extends are replaced. Failures only cost the cache
+// entry.
+static void prompt_cache_store(Llamafu llamafu, const std::vector<llama_token>& tokens) {
+    PromptDiskCache* cache = llamafu->prompt_disk_cache;
+    const std::vector<uint64_t> hashes = prompt_block_hashes(tokens, cache->block_size);
+    if (hashes.empty()) {
+        return;
     }
 
-    try {
-        return llama_sampler_sample(sampler->sampler, llamafu->ctx, idx);
-    } catch (const std::exception& e) {
-        return -1;
+    for (auto it = cache->entries.begin(); it != cache->entries.end();) {
+        const size_t n = matching_blocks(it->block_hashes, hashes);
+        if (n == hashes.size()) {
+            prompt_cache_touch(cache, it);
+            return;
+        }
+        if (n == it->block_hashes.size()) {
+            auto superseded = it++;
+            prompt_cache_remove(cache, superseded);
+        } else {
+            ++it;
+        }
     }
-}
 
-void llamafu_sampler_accept(LlamafuSampler sampler, llama_token token) {
-    if (!sampler) {
+    const size_t state_size = llama_state_seq_get_size(llamafu->ctx, 0);
+    const size_t state_offset = sizeof(PromptCacheHeader) + tokens.size() * sizeof(llama_token);
+    const uint64_t file_size = state_offset + state_size;
+    if (state_size == 0 || file_size > cache->max_bytes) {
         return;
     }
 
-    try {
-        llama_sampler_accept(sampler->sampler, token);
-    } catch (const std::exception& e) {
-        // Ignore errors in accept
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx%s", static_cast<unsigned long long>(hashes.back()), PROMPT_CACHE_EXT);
+    PromptCacheEntry entry;
+    entry.path = (std::filesystem::path(cache->dir) / name).string();
+    const std::string tmp_path = entry.path + ".tmp";
+
+    // Write to a temporary name first so a crash never leaves a torn entry;
+    // the state is serialized directly into the mapped file
+    {
+        ScopedFd file(open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        FileMapping map;
+        bool ok = file.fd >= 0 && map_fd_for_write(file.fd, file_size, map);
+        if (ok) {
+            PromptCacheHeader header = {PROMPT_CACHE_MAGIC, PROMPT_CACHE_VERSION, cache->fingerprint,
+                                        tokens.size(), state_size};
+            memcpy(map.data(), &header, sizeof(header));
+            memcpy(map.data() + sizeof(header), tokens.data(), tokens.size() * sizeof(llama_token));
+            ok = llama_state_seq_get_data(llamafu->ctx, map.data() + state_offset, state_size, 0) == state_size &&
+                 finish_mapped_write(file.fd, map, file_size);
+        }
+        if (!ok) {
+            std::error_code ec;
+            std::filesystem::remove(tmp_path, ec);
+            return;
+        }
     }
-}
-
-void llamafu_sampler_reset(LlamafuSampler sampler) {
-    if (!sampler) {
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, entry.path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
         return;
     }
 
-    try {
-        llama_sampler_reset(sampler->sampler);
-    } catch (const std::exception& e) {
-        // Ignore errors in reset
+    entry.tokens = tokens;
+    entry.block_hashes = hashes;
+    entry.n_bytes = file_size;
+    cache->entries.push_front(std::move(entry));
+    cache->n_bytes += file_size;
+    prompt_cache_evict(cache);
+}
+
+// Save the block-aligned part of a request's prompt once the request is
+// done, so serializing sequence 0 never delays its first token. Skipped when
+// sequence 0 no longer starts with it (failed decode, context shift into it).
+static void prompt_cache_commit(Llamafu llamafu, const std::vector<llama_token>& prompt) {
+    PromptDiskCache* cache = llamafu->prompt_disk_cache;
+    if (!cache || !llamafu->lora_applied.empty()) {
+        return;  // Saved states are keyed by the base model only
     }
+    const size_t n_aligned = prompt.size() / cache->block_size * cache->block_size;
+    const std::vector<llama_token>& cached = llamafu->cached_tokens;
+    if (n_aligned == 0 || cached.size() < n_aligned ||
+        !std::equal(prompt.begin(), prompt.begin() + n_aligned, cached.begin())) {
+        return;
+    }
+    LLAMAFU_TRACE_SCOPE("llamafu.prompt_cache_store");
+    prompt_cache_store(llamafu, std::vector<llama_token>(prompt.begin(), prompt.begin() + n_aligned));
 }
 
-void llamafu_sampler_free(LlamafuSampler sampler) {
-    if (sampler) {
-        if (sampler->sampler) {
-            llama_sampler_free(sampler->sampler);
-        }
-        delete sampler;
+static size_t common_prefix_length(const std::vector<llama_token>& a, const std::vector<llama_token>& b) {
+    size_t n = 0;
+    const size_t n_max = std::min(a.size(), b.size());
+    while (n < n_max && a[n] == b[n]) {
+        n++;
     }
+    return n;
 }
 
-// Modern tokenization helper functions
-int32_t llamafu_tokenize_modern(Llamafu llamafu, const char* text, LlamafuToken** out_tokens, int32_t* out_n_tokens, bool add_special, bool parse_special) {
-    if (!llamafu || !validate_string_param(text, "text") || !out_tokens || !out_n_tokens) {
+// Evaluate a prompt, reusing the longest prefix already in the KV cache or,
+// with a prompt cache directory, a longer one saved on disk. Only the tokens
+// after the common prefix are decoded, in chunks of n_batch with the abort
+// callback checked between chunks; at least one token is always decoded so
+// that logits are available for sampling. An aborted prefill keeps the
+// chunks that completed, so a retry resumes from there. Callers save the
+// prompt to disk afterwards with prompt_cache_commit.
+static LlamafuError prefill_with_prefix_reuse(Llamafu llamafu, const std::vector<llama_token>& tokens) {
+    if (tokens.empty()) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        const int32_t text_len = static_cast<int32_t>(strlen(text));
+    llama_memory_t mem = llama_get_memory(llamafu->ctx);
+    std::vector<llama_token>& cached = llamafu->cached_tokens;
 
-        // Conservative estimate for token buffer size
-        const int32_t n_tokens_max = text_len + 16;
-        std::vector<llama_token> tokens(n_tokens_max);
+    // A prefix evaluated with other adapters cannot be reused
+    if (llamafu->cached_lora != llamafu->lora_applied) {
+        cached.clear();
+        llamafu->cached_lora = llamafu->lora_applied;
+    }
+    clamp_prompt_cache(llamafu);
 
-        const int32_t n_tokens = llama_tokenize(vocab, text, text_len, tokens.data(), n_tokens_max, add_special, parse_special);
-        if (n_tokens < 0) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
-        }
+    // Saved states are keyed by the base model only
+    const bool use_disk_cache = llamafu->prompt_disk_cache && llamafu->lora_applied.empty();
 
-        *out_n_tokens = n_tokens;
-        *out_tokens = static_cast<LlamafuToken*>(malloc(n_tokens * sizeof(LlamafuToken)));
+    size_t n_keep = common_prefix_length(cached, tokens);
+    bool restored = false;
+    if (use_disk_cache && prompt_cache_restore(llamafu, tokens, n_keep)) {
+        n_keep = common_prefix_length(cached, tokens);
+        restored = n_keep > 0;
+    }
+    if (n_keep == tokens.size()) {
+        n_keep--;  // Re-decode the last prompt token to refresh its logits
+    }
 
-        if (!*out_tokens) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+    // Drop the diverging tail; fall back to dropping the whole sequence if the
+    // memory type cannot remove a partial one (e.g. recurrent models). Other
+    // sequences (chat sessions) are left untouched.
+    if (n_keep == 0 || !llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(n_keep), -1)) {
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        n_keep = 0;
+    }
+    cached.resize(n_keep);
+    llamafu->n_reused_last = restored ? 0 : static_cast<int32_t>(n_keep);
+    llamafu->n_restored_last = restored ? static_cast<int32_t>(n_keep) : 0;
 
-        for (int32_t i = 0; i < n_tokens; ++i) {
-            (*out_tokens)[i] = tokens[i];
+    std::vector<llama_token> delta(tokens.begin() + n_keep, tokens.end());
+    llamafu->n_prefilled_last = static_cast<int32_t>(delta.size());
+    const size_t n_batch = llama_n_batch(llamafu->ctx);
+    for (size_t start = 0; start < delta.size(); start += n_batch) {
+        if (start > 0 && generation_aborted(llamafu)) {
+            return LLAMAFU_ERROR_ABORTED;
         }
 
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        const size_t n = std::min(n_batch, delta.size() - start);
+        const int32_t ret = llama_decode(llamafu->ctx, llama_batch_get_one(delta.data() + start, n));
+        if (ret != 0) {
+            llama_memory_seq_rm(mem, 0, -1, -1);
+            cached.clear();
+            return decode_error(ret);
+        }
+        cached.insert(cached.end(), delta.begin() + start, delta.begin() + start + n);
     }
+    return LLAMAFU_SUCCESS;
 }
 
-int32_t llamafu_detokenize_modern(Llamafu llamafu, const LlamafuToken* tokens, int32_t n_tokens, char** out_text, bool remove_special, bool unparse_special) {
-    if (!llamafu || !tokens || n_tokens <= 0 || !out_text) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+// Decode tokens into an arbitrary sequence starting at position pos0, split
+// into chunks of at most batch_capacity tokens with the abort callback checked
+// between chunks. Logits are requested for the final token only, so
+// llama_sampler_sample(..., -1) samples after it.
+static LlamafuError decode_seq_tokens(Llamafu llamafu, llama_batch& batch, int32_t batch_capacity,
+                                      const llama_token* tokens, int32_t n_tokens,
+                                      llama_pos pos0, llama_seq_id seq_id) {
+    for (int32_t start = 0; start < n_tokens; start += batch_capacity) {
+        if (start > 0 && generation_aborted(llamafu)) {
+            return LLAMAFU_ERROR_ABORTED;
+        }
 
-    if (!validate_numeric_param(n_tokens, 1, 32768)) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+        const int32_t n = std::min(batch_capacity, n_tokens - start);
+        batch.n_tokens = n;
+        for (int32_t i = 0; i < n; i++) {
+            batch.token[i] = tokens[start + i];
+            batch.pos[i] = pos0 + start + i;
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = seq_id;
+            batch.logits[i] = (start + i == n_tokens - 1);
+        }
+        const int32_t ret = llama_decode(llamafu->ctx, batch);
+        if (ret != 0) {
+            return decode_error(ret);
+        }
     }
+    return LLAMAFU_SUCCESS;
+}
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-
-        // Conservative estimate for text buffer size
-        const int32_t text_len_max = n_tokens * 8;
-        std::vector<char> text_buf(text_len_max);
-
-        const int32_t text_len = llama_detokenize(vocab, tokens, n_tokens, text_buf.data(), text_len_max, remove_special, unparse_special);
-        if (text_len < 0) {
-            return LLAMAFU_ERROR_UNKNOWN;
-        }
+// Fresh grammar sampler for grammar/root. Grammars are parsed once per
+// handle and cloned from the cache afterwards; returns nullptr if the
+// grammar does not parse.
+static llama_sampler* acquire_grammar_sampler(Llamafu llamafu, const char* grammar, const char* root) {
+    const char* root_name = (root && *root) ? root : "root";
+    const size_t key = std::hash<std::string>{}(std::string(grammar) + '\n' + root_name);
 
-        *out_text = static_cast<char*>(malloc(text_len + 1));
-        if (!*out_text) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    auto& cache = llamafu->grammar_cache;
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->key == key && it->grammar == grammar && it->root == root_name) {
+            cache.splice(cache.begin(), cache, it);
+            return llama_sampler_clone(cache.front().sampler);
         }
+    }
 
-        memcpy(*out_text, text_buf.data(), text_len);
-        (*out_text)[text_len] = '\0';
+    llama_sampler* parsed = llama_sampler_init_grammar(llama_model_get_vocab(llamafu->model), grammar, root_name);
+    if (!parsed) {
+        return nullptr;
+    }
 
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    cache.push_front(GrammarCacheEntry{key, grammar, root_name, parsed});
+    if (cache.size() > GRAMMAR_CACHE_CAPACITY) {
+        llama_sampler_free(cache.back().sampler);
+        cache.pop_back();
     }
+    return llama_sampler_clone(parsed);
 }
 
-LlamafuError llamafu_token_to_piece(Llamafu llamafu, LlamafuToken token, char** out_piece) {
-    if (!llamafu || !out_piece) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static void clear_grammar_cache(Llamafu llamafu) {
+    for (auto& entry : llamafu->grammar_cache) {
+        llama_sampler_free(entry.sampler);
     }
+    llamafu->grammar_cache.clear();
+}
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+static uint64_t image_cache_entry_bytes(const ImageCacheEntry& entry) {
+    return entry.embeddings.size() * sizeof(float);
+}
 
-        // First call to get required size
-        char buf[256];
-        int32_t n_chars = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, true);
-        if (n_chars < 0) {
-            return LLAMAFU_ERROR_UNKNOWN;
-        }
+static uint64_t hash_image_source(const unsigned char* data, size_t size, int32_t width, int32_t height) {
+    uint64_t h = std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(data), size));
+    h = fnv1a_mix(h, size);
+    h = fnv1a_mix(h, static_cast<uint32_t>(width));
+    return fnv1a_mix(h, static_cast<uint32_t>(height));
+}
 
-        *out_piece = static_cast<char*>(malloc(n_chars + 1));
-        if (!*out_piece) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+// Cached embeddings for the source, moved to the front; nullptr on a miss
+static const ImageCacheEntry* image_cache_lookup(Llamafu llamafu, uint64_t key, size_t source_size) {
+    auto& cache = llamafu->image_embeddings_cache;
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->key == key && it->source_size == source_size) {
+            cache.splice(cache.begin(), cache, it);
+            llamafu->image_cache_hits++;
+            return &cache.front();
         }
-
-        memcpy(*out_piece, buf, n_chars);
-        (*out_piece)[n_chars] = '\0';
-
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
     }
+    llamafu->image_cache_misses++;
+    return nullptr;
 }
 
-// Token information functions
-float llamafu_token_get_score(Llamafu llamafu, LlamafuToken token) {
-    if (!llamafu) {
-        return 0.0f;
+static void image_cache_trim(Llamafu llamafu, uint64_t max_bytes) {
+    auto& cache = llamafu->image_embeddings_cache;
+    while (!cache.empty() && llamafu->image_cache_bytes > max_bytes) {
+        llamafu->image_cache_bytes -= image_cache_entry_bytes(cache.back());
+        cache.pop_back();
     }
+}
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_get_score(vocab, token);
-    } catch (const std::exception& e) {
-        return 0.0f;
+// Entries larger than the whole budget are not kept
+static void image_cache_insert(Llamafu llamafu, ImageCacheEntry entry) {
+    const uint64_t bytes = image_cache_entry_bytes(entry);
+    if (bytes > llamafu->image_cache_max_bytes) {
+        return;
     }
+    image_cache_trim(llamafu, llamafu->image_cache_max_bytes - bytes);
+    llamafu->image_embeddings_cache.push_front(std::move(entry));
+    llamafu->image_cache_bytes += bytes;
 }
 
-int32_t llamafu_token_get_attr(Llamafu llamafu, LlamafuToken token) {
-    if (!llamafu) {
-        return 0;
-    }
+static void clear_image_cache(Llamafu llamafu) {
+    llamafu->image_embeddings_cache.clear();
+    llamafu->image_cache_bytes = 0;
+}
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return static_cast<int32_t>(llama_vocab_get_attr(vocab, token));
-    } catch (const std::exception& e) {
-        return 0;
+static LlamafuError grammar_for(Llamafu llamafu, const LlamafuInferParams* params, llama_sampler** out_grammar) {
+    *out_grammar = nullptr;
+    if (params->grammar_str && *params->grammar_str) {
+        *out_grammar = acquire_grammar_sampler(llamafu, params->grammar_str, params->grammar_root);
+        if (!*out_grammar) {
+            return LLAMAFU_ERROR_GRAMMAR_INIT_FAILED;
+        }
     }
+    return LLAMAFU_SUCCESS;
 }
 
-bool llamafu_token_is_eog(Llamafu llamafu, LlamafuToken token) {
-    if (!llamafu) {
-        return false;
+// The handle's sampler configured for an inference request. It is rebuilt
+// only when the sampling settings change and reset otherwise; a set
+// grammar_str constrains the output. Owned by the handle.
+static LlamafuError acquire_sampler_for(Llamafu llamafu, const LlamafuInferParams* params,
+                                        SamplerPipeline** out_sampler) {
+    llama_sampler* grammar = nullptr;
+    LlamafuError grammar_result = grammar_for(llamafu, params, &grammar);
+    if (grammar_result != LLAMAFU_SUCCESS) {
+        return grammar_result;
     }
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_is_eog(vocab, token);
-    } catch (const std::exception& e) {
-        return false;
+    const SamplerConfig config = sampler_config_from(params);
+    if (llamafu->sampler && llamafu->sampler->config == config) {
+        llama_sampler_reset(llamafu->sampler->chain);
+    } else {
+        delete llamafu->sampler;
+        llamafu->sampler = build_sampler_pipeline(llama_model_get_vocab(llamafu->model), config);
+        if (!llamafu->sampler) {
+            if (grammar) {
+                llama_sampler_free(grammar);
+            }
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
     }
+    sampler_pipeline_set_grammar(llamafu->sampler, grammar);
+    *out_sampler = llamafu->sampler;
+    return LLAMAFU_SUCCESS;
 }
 
-bool llamafu_token_is_control(Llamafu llamafu, LlamafuToken token) {
-    if (!llamafu) {
-        return false;
+// A separate sampler for a request that runs alongside others (scheduled
+// requests); the caller deletes it
+static LlamafuError build_sampler_for(Llamafu llamafu, const LlamafuInferParams* params,
+                                      SamplerPipeline** out_sampler) {
+    llama_sampler* grammar = nullptr;
+    LlamafuError grammar_result = grammar_for(llamafu, params, &grammar);
+    if (grammar_result != LLAMAFU_SUCCESS) {
+        return grammar_result;
     }
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_is_control(vocab, token);
-    } catch (const std::exception& e) {
-        return false;
+    *out_sampler = build_sampler_pipeline(llama_model_get_vocab(llamafu->model), sampler_config_from(params));
+    if (!*out_sampler) {
+        if (grammar) {
+            llama_sampler_free(grammar);
+        }
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     }
+    sampler_pipeline_set_grammar(*out_sampler, grammar);
+    return LLAMAFU_SUCCESS;
 }
 
-// Special token functions
-LlamafuToken llamafu_token_bos(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
-    }
-
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_bos(vocab);
-    } catch (const std::exception& e) {
-        return -1;
-    }
+static void release_sampler(Llamafu llamafu) {
+    delete llamafu->sampler;
+    llamafu->sampler = nullptr;
 }
 
-LlamafuToken llamafu_token_eos(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
-    }
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_eos(vocab);
-    } catch (const std::exception& e) {
-        return -1;
-    }
+static void batch_add(llama_batch& batch, llama_token token, llama_pos pos,
+                      llama_seq_id seq_id, bool logits) {
+    const int32_t i = batch.n_tokens++;
+    batch.token[i] = token;
+    batch.pos[i] = pos;
+    batch.n_seq_id[i] = 1;
+    batch.seq_id[i][0] = seq_id;
+    batch.logits[i] = logits;
 }
 
-LlamafuToken llamafu_token_eot(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
-    }
+// Drafter for speculative decoding, configured by llamafu_set_speculative
+struct SpeculativeState {
+    LlamafuDraftType type = LLAMAFU_DRAFT_NONE;
+    int32_t n_draft = 0;
+    int32_t ngram_min = 0;
+    int32_t ngram_max = 0;
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_eot(vocab);
-    } catch (const std::exception& e) {
-        return -1;
-    }
-}
+    // LLAMAFU_DRAFT_MODEL only
+    llama_model* draft_model = nullptr;
+    llama_context* draft_ctx = nullptr;
+    llama_sampler* draft_sampler = nullptr;    // Greedy
+    std::vector<llama_token> draft_cached;      // Tokens in the draft KV cache
+};
 
-LlamafuToken llamafu_token_sep(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+static void speculative_free(Llamafu llamafu) {
+    SpeculativeState* spec = llamafu->speculative;
+    if (!spec) {
+        return;
     }
-
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_sep(vocab);
-    } catch (const std::exception& e) {
-        return -1;
+    if (spec->draft_sampler) {
+        llama_sampler_free(spec->draft_sampler);
     }
+    if (spec->draft_ctx) {
+        llama_free(spec->draft_ctx);
+    }
+    if (spec->draft_model) {
+        llama_model_free(spec->draft_model);
+    }
+    delete spec;
+    llamafu->speculative = nullptr;
 }
 
-LlamafuToken llamafu_token_nl(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+// Prompt lookup: find the most recent earlier occurrence of the history's
+// trailing n-gram (longest first) and propose the tokens that followed it
+static void ngram_draft(const SpeculativeState* spec, const std::vector<llama_token>& history,
+                        int32_t n_draft, std::vector<llama_token>& out) {
+    const int32_t n_hist = static_cast<int32_t>(history.size());
+    for (int32_t n = std::min(spec->ngram_max, n_hist - 1); n >= spec->ngram_min; n--) {
+        const llama_token* tail = history.data() + n_hist - n;
+        for (int32_t j = n_hist - n - 1; j >= 0; j--) {
+            if (std::equal(tail, tail + n, history.data() + j)) {
+                const int32_t from = j + n;
+                const int32_t count = std::min(n_draft, n_hist - from);
+                out.assign(history.begin() + from, history.begin() + from + count);
+                return;
+            }
+        }
     }
+}
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_nl(vocab);
-    } catch (const std::exception& e) {
-        return -1;
+// Greedy continuation from the draft model, after syncing its KV cache to
+// the history (common prefix kept, the rest re-decoded)
+static void model_draft(SpeculativeState* spec, const std::vector<llama_token>& history,
+                        int32_t n_draft, std::vector<llama_token>& out) {
+    llama_memory_t mem = llama_get_memory(spec->draft_ctx);
+    auto& cached = spec->draft_cached;
+
+    size_t n_keep = 0;
+    while (n_keep < cached.size() && n_keep < history.size() && cached[n_keep] == history[n_keep]) {
+        n_keep++;
     }
-}
+    // The last history token is re-decoded so that its logits are current
+    if (n_keep == history.size()) {
+        n_keep--;
+    }
+    llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(n_keep), -1);
+    cached.resize(n_keep);
 
-LlamafuToken llamafu_token_pad(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+    const int32_t n_batch = static_cast<int32_t>(llama_n_batch(spec->draft_ctx));
+    for (size_t start = n_keep; start < history.size(); start += n_batch) {
+        const int32_t n = static_cast<int32_t>(std::min<size_t>(n_batch, history.size() - start));
+        if (llama_decode(spec->draft_ctx, llama_batch_get_one(const_cast<llama_token*>(history.data()) + start, n)) != 0) {
+            llama_memory_clear(mem, false);
+            cached.clear();
+            return;
+        }
+        cached.insert(cached.end(), history.begin() + start, history.begin() + start + n);
     }
 
-    try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        return llama_vocab_pad(vocab);
-    } catch (const std::exception& e) {
-        return -1;
+    const llama_vocab* vocab = llama_model_get_vocab(spec->draft_model);
+    for (int32_t k = 0; k < n_draft; k++) {
+        llama_token id = llama_sampler_sample(spec->draft_sampler, spec->draft_ctx, -1);
+        if (llama_vocab_is_eog(vocab, id)) {
+            return;
+        }
+        out.push_back(id);
+        if (k + 1 == n_draft || llama_decode(spec->draft_ctx, llama_batch_get_one(&id, 1)) != 0) {
+            return;
+        }
+        cached.push_back(id);
     }
 }
 
-void llamafu_free_string(char* str) {
-    if (str) {
-        free(str);
+// Receives each generated token and its UTF-8 piece (not NUL-terminated).
+// Returning false stops generation.
+typedef std::function<bool(llama_token token, const char* piece, int32_t len)> PieceSink;
+
+// Number of bytes at the end of text that start a UTF-8 sequence the text
+// does not complete
+static size_t incomplete_utf8_tail(const char* text, size_t len) {
+    for (size_t k = 1; k <= std::min<size_t>(len, 4); k++) {
+        const unsigned char c = static_cast<unsigned char>(text[len - k]);
+        if ((c & 0xC0) == 0x80) {
+            continue;  // Continuation byte; the lead is further back
+        }
+        const size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return need > k ? k : 0;
     }
+    return 0;
 }
 
-void llamafu_free_tokens(LlamafuToken* tokens) {
-    if (tokens) {
-        free(tokens);
+// Aho-Corasick automaton over the bytes of the stop strings. Each state has
+// a transition for every byte, so matching costs one lookup per byte
+// however many stop strings there are.
+struct StopMatcher {
+    struct Node {
+        std::array<int32_t, 256> next;
+        int32_t fail = 0;
+        int32_t depth = 0;   // Length of the stop-string prefix this state spells
+        int32_t match = 0;   // Longest stop string ending here (0 = none)
+    };
+    std::vector<Node> nodes;
+
+    bool empty() const { return nodes.size() <= 1; }
+};
+
+// Builds the automaton for params' stop strings; false if they are malformed
+static bool build_stop_matcher(const LlamafuInferParams* params, StopMatcher& matcher) {
+    if (params->n_stop_sequences < 0 || (params->n_stop_sequences > 0 && !params->stop_sequences)) {
+        return false;
     }
-}
 
-void llamafu_free_embeddings(float* embeddings) {
-    if (embeddings) {
-        free(embeddings);
+    matcher.nodes.assign(1, StopMatcher::Node{});
+    matcher.nodes[0].next.fill(-1);
+    for (int32_t i = 0; i < params->n_stop_sequences; i++) {
+        const char* stop = params->stop_sequences[i];
+        if (!stop || !*stop) {
+            return false;
+        }
+        int32_t state = 0;
+        for (const char* c = stop; *c; c++) {
+            const unsigned char byte = static_cast<unsigned char>(*c);
+            if (matcher.nodes[state].next[byte] < 0) {
+                StopMatcher::Node node;
+                node.next.fill(-1);
+                node.depth = matcher.nodes[state].depth + 1;
+                matcher.nodes[state].next[byte] = static_cast<int32_t>(matcher.nodes.size());
+                matcher.nodes.push_back(node);
+            }
+            state = matcher.nodes[state].next[byte];
+        }
+        matcher.nodes[state].match = matcher.nodes[state].depth;
     }
-}
 
-void llamafu_free(Llamafu llamafu) {
-    if (llamafu) {
-        // Free all loaded LoRA adapters
-        for (auto& pair : llamafu->lora_adapters) {
-            llama_adapter_lora_free(pair.second);
+    // Breadth-first, so a state's failure target is complete before it is:
+    // missing transitions follow the failure link and matches are inherited
+    // through it
+    std::deque<int32_t> queue;
+    for (int32_t& next : matcher.nodes[0].next) {
+        if (next < 0) {
+            next = 0;
+        } else {
+            queue.push_back(next);
+        }
+    }
+    while (!queue.empty()) {
+        const int32_t state = queue.front();
+        queue.pop_front();
+        StopMatcher::Node& node = matcher.nodes[state];
+        node.match = std::max(node.match, matcher.nodes[node.fail].match);
+        for (int byte = 0; byte < 256; byte++) {
+            const int32_t fail_next = matcher.nodes[node.fail].next[byte];
+            if (node.next[byte] < 0) {
+                node.next[byte] = fail_next;
+            } else {
+                matcher.nodes[node.next[byte]].fail = fail_next;
+                queue.push_back(node.next[byte]);
+            }
         }
-        llamafu->lora_adapters.clear();
+    }
+    return true;
+}
 
-        // Free all samplers
-        for (auto& sampler : llamafu->samplers) {
-            llamafu_sampler_free(sampler);
+// Turns generated pieces into text that can be handed out span by span.
+// Bytes of a character split across tokens, and a tail that could still
+// grow into a stop string, stay pending until a later piece completes them
+// or rules them out. Once a stop string completes, the text before it is
+// released and everything else is dropped.
+struct StreamDetokenizer {
+    const StopMatcher* stops = nullptr;   // Optional; must outlive this
+    std::string pending;
+    int32_t state = 0;                    // Stop matcher state after pending
+    bool stopped = false;
+
+    explicit StreamDetokenizer(const StopMatcher* matcher = nullptr)
+        : stops(matcher && !matcher->empty() ? matcher : nullptr) {}
+
+    // Bytes at the end of pending that must wait for the next piece
+    size_t holdback() const {
+        size_t hold = incomplete_utf8_tail(pending.data(), pending.size());
+        if (stops) {
+            hold = std::max(hold, static_cast<size_t>(stops->nodes[state].depth));
         }
-        llamafu->samplers.clear();
+        return std::min(hold, pending.size());
+    }
 
-        // Free CLIP contexts
-        if (llamafu->clip_ctx_vision) {
-            clip_free(llamafu->clip_ctx_vision);
+    // Appends piece and calls emit(text, len) with the span it completes,
+    // if any; text is NUL-terminated
+    template <typename Emit>
+    void push(const char* piece, size_t len, Emit&& emit) {
+        if (stopped) {
+            return;
         }
-        if (llamafu->clip_ctx_audio) {
-            clip_free(llamafu->clip_ctx_audio);
+        for (size_t i = 0; stops && i < len; i++) {
+            state = stops->nodes[state].next[static_cast<unsigned char>(piece[i])];
+            const int32_t match = stops->nodes[state].match;
+            if (match > 0) {
+                // The stop string is still pending, so it can be cut off
+                pending.append(piece, i + 1);
+                pending.resize(pending.size() - static_cast<size_t>(match));
+                stopped = true;
+                release(pending.size(), emit);
+                return;
+            }
         }
+        pending.append(piece, len);
+        release(pending.size() - holdback(), emit);
+    }
 
-        // Clear image embeddings cache
-        llamafu->image_embeddings_cache.clear();
+    // Hands out whatever is still pending once generation has ended
+    template <typename Emit>
+    void flush(Emit&& emit) {
+        release(pending.size(), emit);
+    }
 
-        if (llamafu->ctx) {
-            llama_free(llamafu->ctx);
+private:
+    template <typename Emit>
+    void release(size_t n, Emit& emit) {
+        if (n == 0) {
+            return;
         }
-        if (llamafu->model) {
-            llama_model_free(llamafu->model);
+        const char saved = pending[n];
+        pending[n] = '\0';
+        emit(pending.c_str(), n);
+        pending[n] = saved;
+        pending.erase(0, n);
+    }
+};
+
+// =============================================================================
+// Request Metrics
+// =============================================================================
+
+// Timings of the request in progress, published to the handle when its
+// outermost RequestMetricsScope ends
+struct RequestMetrics {
+    std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point t_last_token;
+    double t_tokenize_ms = 0.0;
+    double t_prefill_ms = 0.0;
+    double t_first_token_ms = 0.0;
+    double t_sample_ms = 0.0;
+    double t_decode_ms = 0.0;
+    double t_sink_ms = 0.0;                // Inside the piece sink
+    double t_emit_ms = 0.0;                // Inside text emits, once emit_timed
+    bool emit_timed = false;
+    int32_t n_prompt_tokens = 0;
+    int32_t n_generated = 0;
+    int32_t n_sample = 0;
+    std::vector<double> itl_ms;
+};
+
+// Adds the time from construction to destruction to *total (nullptr = off)
+struct PhaseTimer {
+    double* total;
+    std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+
+    explicit PhaseTimer(double* field) : total(field) {}
+    ~PhaseTimer() {
+        if (total) {
+            *total += elapsed_ms(t_start);
         }
+    }
+};
 
-        delete llamafu;
-        llama_backend_free();
+static double* metrics_field(Llamafu llamafu, double RequestMetrics::*field) {
+    return llamafu->active_metrics ? &(llamafu->active_metrics->*field) : nullptr;
+}
+
+static void histogram_add(LlamafuLatencyHistogram& histogram, double ms) {
+    int32_t bucket = 0;
+    while (bucket < LLAMAFU_LATENCY_BUCKETS - 1 && ms >= static_cast<double>(1ull << bucket)) {
+        bucket++;
     }
+    histogram.counts[bucket]++;
+    histogram.n_samples++;
+    histogram.sum_ms += ms;
+    histogram.max_ms = std::max(histogram.max_ms, ms);
 }
 
-} // extern "C"
+static double steady_ms(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(t.time_since_epoch()).count();
+}
 
-// Context and memory management functions
-LlamafuMemory llamafu_get_memory(Llamafu llamafu) {
-    if (!llamafu) {
-        return nullptr;
+static void publish_request_metrics(Llamafu llamafu, RequestMetrics& data) {
+    const auto t_end = std::chrono::steady_clock::now();
+    std::sort(data.itl_ms.begin(), data.itl_ms.end());
+
+    std::lock_guard<std::mutex> lock(llamafu->metrics_mutex);
+    LlamafuRequestMetrics& m = llamafu->metrics;
+    m.t_tokenize_ms = data.t_tokenize_ms;
+    m.t_prefill_ms = data.t_prefill_ms;
+    m.t_first_token_ms = data.t_first_token_ms;
+    m.t_sample_ms = data.t_sample_ms;
+    m.t_decode_ms = data.t_decode_ms;
+    // With timed emits the rest of the sink is the detokenizer's; otherwise
+    // the sink is the caller's callback
+    m.t_detokenize_ms = data.emit_timed ? std::max(data.t_sink_ms - data.t_emit_ms, 0.0) : 0.0;
+    m.t_callback_ms = data.emit_timed ? data.t_emit_ms : data.t_sink_ms;
+    m.t_total_ms = elapsed_ms(data.t_start, t_end);
+    m.n_prompt_tokens = data.n_prompt_tokens;
+    m.n_generated = data.n_generated;
+    m.n_sample = data.n_sample;
+    m.itl_p50_ms = percentile(data.itl_ms, 0.50);
+    m.itl_p99_ms = percentile(data.itl_ms, 0.99);
+    m.itl_max_ms = data.itl_ms.empty() ? 0.0 : data.itl_ms.back();
+
+    m.n_requests++;
+    if (data.n_generated > 0) {
+        histogram_add(m.ttft, data.t_first_token_ms);
     }
-    
-    try {
-        return llama_get_memory(llamafu->ctx);
-    } catch (const std::exception& e) {
-        return nullptr;
+    for (double ms : data.itl_ms) {
+        histogram_add(m.itl, ms);
     }
+    llamafu->t_request_start_ms = steady_ms(data.t_start);
+    llamafu->t_request_end_ms = steady_ms(t_end);
 }
 
-void llamafu_memory_clear(LlamafuMemory memory, bool clear_data) {
-    if (memory) {
-        try {
-            llama_memory_clear(memory, clear_data);
-        } catch (const std::exception& e) {
-            // Ignore errors in memory clear
+// Records one request into the handle's metrics; scopes nested inside an
+// active one add to the outer request
+struct RequestMetricsScope {
+    Llamafu llamafu;
+    RequestMetrics data;
+    bool owner;
+
+    explicit RequestMetricsScope(Llamafu handle) : llamafu(handle), owner(!handle->active_metrics) {
+        if (owner) {
+            llamafu->active_metrics = &data;
         }
     }
-}
+    ~RequestMetricsScope() {
+        if (owner) {
+            llamafu->active_metrics = nullptr;
+            publish_request_metrics(llamafu, data);
+        }
+    }
+    RequestMetricsScope(const RequestMetricsScope&) = delete;
+    RequestMetricsScope& operator=(const RequestMetricsScope&) = delete;
+};
 
-bool llamafu_memory_seq_rm(LlamafuMemory memory, LlamafuSeqId seq_id, LlamafuPos p0, LlamafuPos p1) {
-    if (!memory) {
-        return false;
+// Wraps a text emit so its time counts as callback time rather than
+// detokenization
+template <typename Emit>
+static auto timed_emit(Llamafu llamafu, Emit& emit) {
+    RequestMetrics* metrics = llamafu->active_metrics;
+    if (metrics) {
+        metrics->emit_timed = true;
+    }
+    return [metrics, &emit](const char* text, size_t len) {
+        PhaseTimer timer(metrics ? &metrics->t_emit_ms : nullptr);
+        emit(text, len);
+    };
+}
+
+// Generation loop shared by the completion paths, run after the prompt is
+// prefilled into sequence 0. Each step decodes the last sampled token plus
+// up to n_draft speculated ones in one batch and keeps drafts while the
+// target's own samples agree, so the output matches non-speculative
+// sampling exactly.
+static LlamafuError run_generation(Llamafu llamafu, SamplerPipeline* smpl, int32_t max_tokens, bool stop_on_eog,
+                                   const std::atomic<bool>* cancel, const PieceSink& sink) {
+    const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+    const int32_t n_ctx = static_cast<int32_t>(llama_n_ctx(llamafu->ctx));
+    llama_memory_t mem = llama_get_memory(llamafu->ctx);
+
+    // Media positions (negative placeholders in cached_tokens) can neither be
+    // drafted from nor shifted
+    const bool has_media = std::any_of(llamafu->cached_tokens.begin(), llamafu->cached_tokens.end(),
+                                       [](llama_token token) { return token < 0; });
+    SpeculativeState* spec = has_media ? nullptr : llamafu->speculative;
+    const int32_t n_draft_max = spec ? spec->n_draft : 0;
+    const bool can_shift = llamafu->context_shift && !has_media && llama_memory_can_shift(mem);
+    const int32_t n_prompt = static_cast<int32_t>(llamafu->cached_tokens.size());
+    RequestMetrics* metrics = llamafu->active_metrics;
+
+    llama_batch batch = llama_batch_init(n_draft_max + 1, 0, 1);
+    std::vector<llama_token> draft;
+    int32_t n_emitted = 0;
+    int32_t n_drafted = 0;
+    int32_t n_accepted = 0;
+    const auto t_start = std::chrono::steady_clock::now();
+
+    enum EmitResult { EMIT_CONTINUE, EMIT_DONE, EMIT_ABORTED };
+    auto emit = [&](llama_token token) {
+        if (stop_on_eog && llama_vocab_is_eog(vocab, token)) {
+            return EMIT_DONE;
+        }
+        if (metrics) {
+            const auto now = std::chrono::steady_clock::now();
+            if (metrics->n_generated++ == 0) {
+                metrics->t_first_token_ms = elapsed_ms(metrics->t_start, now);
+            } else {
+                metrics->itl_ms.push_back(elapsed_ms(metrics->t_last_token, now));
+            }
+            metrics->t_last_token = now;
+        }
+        const std::string_view piece = token_piece(llamafu->shared_model, token);
+        {
+            PhaseTimer timer(metrics ? &metrics->t_sink_ms : nullptr);
+            if (!sink(token, piece.data(), static_cast<int32_t>(piece.size()))) {
+                return EMIT_ABORTED;
+            }
+        }
+        return ++n_emitted >= max_tokens ? EMIT_DONE : EMIT_CONTINUE;
+    };
+    auto sample = [&](int32_t idx) {
+        PhaseTimer timer(metrics ? &metrics->t_sample_ms : nullptr);
+        if (metrics) {
+            metrics->n_sample++;
+        }
+        return sampler_pipeline_sample(smpl, llamafu->ctx, idx);
+    };
+    auto aborted = [&]() {
+        return (cancel && cancel->load(std::memory_order_relaxed)) || generation_aborted(llamafu);
+    };
+
+    LlamafuError result = LLAMAFU_SUCCESS;
+    EmitResult state = EMIT_ABORTED;
+    llama_token id_last = 0;
+    if (!aborted()) {
+        // Sample from the prompt's logits (sampling also accepts the token,
+        // which advances grammar and penalty state)
+        id_last = sample(-1);
+        state = emit(id_last);
     }
-    
-    try {
-        return llama_memory_seq_rm(memory, seq_id, p0, p1);
-    } catch (const std::exception& e) {
-        return false;
+
+    while (state == EMIT_CONTINUE) {
+        if (aborted()) {
+            state = EMIT_ABORTED;
+            break;
+        }
+
+        int32_t n_past = static_cast<int32_t>(llamafu->cached_tokens.size());
+        if (n_past >= n_ctx - 1) {
+            if (!can_shift) {
+                break;
+            }
+
+            // Context shift: keep the first n_keep tokens, drop half of the
+            // rest and move the remainder down to close the gap
+            const int32_t n_keep = std::min(llamafu->n_keep < 0 ? n_prompt : llamafu->n_keep, n_past - 1);
+            const int32_t n_discard = (n_past - n_keep) / 2;
+            if (n_discard <= 0) {
+                break;
+            }
+            llama_memory_seq_rm(mem, 0, n_keep, n_keep + n_discard);
+            llama_memory_seq_add(mem, 0, n_keep + n_discard, n_past, -n_discard);
+            llamafu->cached_tokens.erase(llamafu->cached_tokens.begin() + n_keep,
+                                         llamafu->cached_tokens.begin() + n_keep + n_discard);
+            n_past -= n_discard;
+        }
+
+        // Pending token joins the history the drafters look at
+        llamafu->cached_tokens.push_back(id_last);
+
+        draft.clear();
+        const int32_t n_draft = std::min({n_draft_max, max_tokens - n_emitted - 1, n_ctx - n_past - 2});
+        if (spec && n_draft > 0) {
+            if (spec->type == LLAMAFU_DRAFT_NGRAM) {
+                ngram_draft(spec, llamafu->cached_tokens, n_draft, draft);
+            } else if (spec->type == LLAMAFU_DRAFT_MODEL) {
+                model_draft(spec, llamafu->cached_tokens, n_draft, draft);
+            }
+        }
+
+        batch.n_tokens = 0;
+        batch_add(batch, id_last, n_past, 0, true);
+        for (size_t i = 0; i < draft.size(); i++) {
+            batch_add(batch, draft[i], n_past + 1 + static_cast<llama_pos>(i), 0, true);
+        }
+        int32_t ret = 0;
+        {
+            LLAMAFU_TRACE_SCOPE("llamafu.decode");
+            PhaseTimer timer(metrics ? &metrics->t_decode_ms : nullptr);
+            ret = llama_decode(llamafu->ctx, batch);
+        }
+        if (ret != 0) {
+            // Only this request's sequence: chat sessions, scheduled requests
+            // and scoring copies keep theirs
+            llama_memory_seq_rm(mem, 0, -1, -1);
+            llamafu->cached_tokens.clear();
+            llamafu->n_reused_last = 0;
+            result = ret == 2 ? LLAMAFU_ERROR_ABORTED : LLAMAFU_ERROR_UNKNOWN;
+            break;
+        }
+        n_drafted += static_cast<int32_t>(draft.size());
+
+        // Sample after each position; a draft token is kept only if the
+        // target samples it too. The first disagreeing (or bonus) sample
+        // becomes the next pending token.
+        for (size_t i = 0;; i++) {
+            const llama_token id = sample(static_cast<int32_t>(i));
+            const bool matches = i < draft.size() && id == draft[i];
+            state = emit(id);
+            if (!matches || state != EMIT_CONTINUE) {
+                id_last = id;
+                break;
+            }
+            n_accepted++;
+            llamafu->cached_tokens.push_back(id);
+        }
+
+        // Drop rejected drafts from the KV cache
+        if (!draft.empty()) {
+            llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(llamafu->cached_tokens.size()), -1);
+        }
+    }
+
+    if (state == EMIT_ABORTED && result == LLAMAFU_SUCCESS) {
+        result = LLAMAFU_ERROR_ABORTED;
     }
+
+    llama_batch_free(batch);
+    llamafu->n_generated_last = n_emitted;
+    llamafu->n_drafted_last = n_drafted;
+    llamafu->n_draft_accepted_last = n_accepted;
+    llamafu->t_generate_ms_last = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t_start).count();
+    return result;
 }
 
-void llamafu_memory_seq_cp(LlamafuMemory memory, LlamafuSeqId seq_id_src, LlamafuSeqId seq_id_dst, LlamafuPos p0, LlamafuPos p1) {
-    if (!memory) {
-        return;
+// Prefill the prompt and generate until EOG, max_tokens or the context end,
+// handing every piece to the sink. Shared by the blocking, callback and
+// worker paths.
+static LlamafuError generate_stream_pieces(Llamafu llamafu, const LlamafuInferParams* params,
+                                           const std::atomic<bool>* cancel, const PieceSink& sink) {
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
     }
-    
-    try {
-        llama_memory_seq_cp(memory, seq_id_src, seq_id_dst, p0, p1);
-    } catch (const std::exception& e) {
-        // Ignore errors in memory copy
+    RequestMetricsScope request_metrics(llamafu);
+
+    // Tokenize prompt
+    const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+    std::vector<llama_token> tokens;
+    int32_t n_tokens = 0;
+    {
+        LLAMAFU_TRACE_SCOPE("llamafu.tokenize");
+        PhaseTimer timer(metrics_field(llamafu, &RequestMetrics::t_tokenize_ms));
+        n_tokens = tokenize_text(vocab, params->prompt, static_cast<int32_t>(strlen(params->prompt)),
+                                 true, true, tokens);
     }
-}
+    if (n_tokens <= 0) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    llamafu->active_metrics->n_prompt_tokens = n_tokens;
 
-void llamafu_memory_seq_keep(LlamafuMemory memory, LlamafuSeqId seq_id) {
-    if (!memory) {
-        return;
+    // Request-specific adapters, restored when this returns
+    ScopedLoraSet lora_scope{llamafu};
+    if (params->lora_batch) {
+        LoraSet lora;
+        LlamafuError lora_result = resolve_lora_set(llamafu, params->lora_batch, lora);
+        if (lora_result != LLAMAFU_SUCCESS) {
+            return lora_result;
+        }
+        lora_scope.applied = true;
+        if (!apply_lora_set(llamafu, lora)) {
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
     }
-    
-    try {
-        llama_memory_seq_keep(memory, seq_id);
-    } catch (const std::exception& e) {
-        // Ignore errors in memory keep
+
+    // Evaluate the prompt, reusing any prefix already in the KV cache
+    LlamafuError prefill_result = LLAMAFU_SUCCESS;
+    {
+        LLAMAFU_TRACE_SCOPE("llamafu.prefill");
+        PhaseTimer timer(metrics_field(llamafu, &RequestMetrics::t_prefill_ms));
+        prefill_result = prefill_with_prefix_reuse(llamafu, tokens);
+    }
+    if (prefill_result != LLAMAFU_SUCCESS) {
+        return prefill_result;
+    }
+
+    // The handle's sampler, configured from params (defaults for unset fields)
+    SamplerPipeline* smpl = nullptr;
+    LlamafuError sampler_result = acquire_sampler_for(llamafu, params, &smpl);
+    if (sampler_result != LLAMAFU_SUCCESS) {
+        return sampler_result;
     }
+
+    const int32_t max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
+    const LlamafuError result = run_generation(llamafu, smpl, max_tokens, !params->ignore_eos, cancel, sink);
+    prompt_cache_commit(llamafu, tokens);
+    return result;
 }
 
-void llamafu_memory_seq_add(LlamafuMemory memory, LlamafuSeqId seq_id, LlamafuPos p0, LlamafuPos p1, LlamafuPos delta) {
-    if (!memory) {
-        return;
+// generate_stream_pieces with the pieces passed through detok, so emit only
+// receives whole characters. A completed stop string ends generation in
+// that step and counts as success.
+template <typename Emit>
+static LlamafuError generate_text_spans(Llamafu llamafu, const LlamafuInferParams* params,
+                                        const std::atomic<bool>* cancel, StreamDetokenizer& detok, Emit&& emit) {
+    RequestMetricsScope request_metrics(llamafu);
+    auto text_emit = timed_emit(llamafu, emit);
+    LlamafuError err = generate_stream_pieces(llamafu, params, cancel,
+        [&](llama_token, const char* piece, int32_t len) {
+            detok.push(piece, len, text_emit);
+            return !detok.stopped;
+        });
+    if (detok.stopped) {
+        return err == LLAMAFU_ERROR_ABORTED ? LLAMAFU_SUCCESS : err;
+    }
+    PhaseTimer flush_timer(metrics_field(llamafu, &RequestMetrics::t_sink_ms));
+    detok.flush(text_emit);
+    return err;
+}
+
+// Generates params->prompt's completion into out, ending at stop strings
+static LlamafuError complete_text(Llamafu llamafu, const LlamafuInferParams* params, std::string& out) {
+    StopMatcher stops;
+    if (!build_stop_matcher(params, stops)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
-    try {
-        llama_memory_seq_add(memory, seq_id, p0, p1, delta);
-    } catch (const std::exception& e) {
-        // Ignore errors in memory add
+    StreamDetokenizer detok(&stops);
+    return generate_text_spans(llamafu, params, nullptr, detok,
+                               [&](const char* text, size_t len) { out.append(text, len); });
+}
+
+extern "C" {
+
+LlamafuContextParams llamafu_context_default_params(void) {
+    LlamafuContextParams params = {};
+    params.n_ctx = 2048;
+    params.n_batch = 512;
+    params.n_ubatch = 512;
+    params.n_seq_max = LLAMAFU_DEFAULT_N_SEQ_MAX;
+    params.n_threads = -1;
+    params.n_threads_batch = -1;
+    params.rope_freq_base = 0.0f;
+    params.rope_freq_scale = 0.0f;
+    params.yarn_ext_factor = -1.0f;
+    params.yarn_attn_factor = 1.0f;
+    params.yarn_beta_fast = 32.0f;
+    params.yarn_beta_slow = 1.0f;
+    params.yarn_orig_ctx = 0;
+    params.embeddings = false;
+    params.causal_attn = true;
+    params.offload_kqv = true;
+    params.flash_attn = false;
+    params.abort_callback = nullptr;
+    params.abort_callback_data = nullptr;
+    params.context_mode = LLAMAFU_CONTEXT_MODE_BOTH;
+    params.pooling_type = LLAMAFU_POOLING_UNSPECIFIED;
+    params.type_k = LLAMAFU_KV_CACHE_DEFAULT;
+    params.type_v = LLAMAFU_KV_CACHE_DEFAULT;
+    params.context_shift = false;
+    params.n_keep = 0;
+    return params;
+}
+
+LlamafuError llamafu_init(LlamafuModelParams* params, Llamafu* out_llamafu) {
+    if (!params) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
+
+    // Context settings derived from the simplified model parameters
+    LlamafuContextParams ctx_params = llamafu_context_default_params();
+    ctx_params.n_ctx = params->n_ctx > 0 ? params->n_ctx : 2048;
+    ctx_params.n_threads = params->n_threads > 0 ? params->n_threads : -1;
+    // Decode is memory-bound and n_threads limits it; prompt batches are
+    // compute-bound and use every performance core (efficiency cores would
+    // make the threads wait on the slowest one)
+    LlamafuCpuTopology topo;
+    detect_cpu_topology(topo);
+    ctx_params.n_threads_batch = std::max<int32_t>(ctx_params.n_threads, std::clamp(topo.n_performance, 1, 128));
+
+    return llamafu_init_with_context(params, &ctx_params, out_llamafu);
 }
 
-void llamafu_memory_seq_div(LlamafuMemory memory, LlamafuSeqId seq_id, LlamafuPos p0, LlamafuPos p1, int32_t d) {
-    if (!memory || d <= 0) {
-        return;
+LlamafuError llamafu_init_with_context(LlamafuModelParams* params, const LlamafuContextParams* context_params,
+                                       Llamafu* out_llamafu) {
+    if (!params || !context_params || !out_llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
+    if (!validate_model_params(params) || !validate_context_params(context_params)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
     try {
-        llama_memory_seq_div(memory, seq_id, p0, p1, d);
+        // Initialize llama backend
+        llama_backend_init();
+
+        // Reuses the weights if another handle already loaded this model
+        LlamafuModel_s* model = nullptr;
+        LlamafuError err = load_shared_model(params, nullptr, nullptr, &model);
+        if (err != LLAMAFU_SUCCESS) {
+            llama_backend_free();
+            return err;
+        }
+
+        Llamafu llamafu = nullptr;
+        err = create_handle(model, context_params, &llamafu);
+        model_release(model);  // The handle holds its own reference
+        if (err != LLAMAFU_SUCCESS) {
+            llama_backend_free();
+            return err;
+        }
+
+        // Initialize the projector if multimodal is enabled
+        if (params->mmproj_path && strlen(params->mmproj_path) > 0) {
+            llamafu->is_multimodal = true;
+            llamafu->mmproj_path = params->mmproj_path;
+            LlamafuError clip_init_result = initialize_mtmd_context(llamafu, params->mmproj_path);
+            if (clip_init_result != LLAMAFU_SUCCESS) {
+                llamafu_free(llamafu);
+                return clip_init_result;
+            }
+            std::error_code ec;
+            const auto mmproj_size = std::filesystem::file_size(params->mmproj_path, ec);
+            llamafu->clip_size_bytes = ec ? 0 : static_cast<uint64_t>(mmproj_size);
+        }
+
+        *out_llamafu = llamafu;
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        // Ignore errors in memory div
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-LlamafuPos llamafu_memory_seq_pos_min(LlamafuMemory memory, LlamafuSeqId seq_id) {
-    if (!memory) {
-        return -1;
+LlamafuError llamafu_complete(Llamafu llamafu, LlamafuInferParams* params, char** out_result) {
+    if (!llamafu || !params || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
-    try {
-        return llama_memory_seq_pos_min(memory, seq_id);
-    } catch (const std::exception& e) {
-        return -1;
+
+    if (!validate_string_param(params->prompt, "prompt")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-}
 
-LlamafuPos llamafu_memory_seq_pos_max(LlamafuMemory memory, LlamafuSeqId seq_id) {
-    if (!memory) {
-        return -1;
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
     }
-    
-    try {
-        return llama_memory_seq_pos_max(memory, seq_id);
-    } catch (const std::exception& e) {
-        return -1;
+
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
     }
-}
 
-bool llamafu_memory_can_shift(LlamafuMemory memory) {
-    if (!memory) {
-        return false;
+    // Only validate the basic fields that are always set
+    if (!validate_numeric_param(params->max_tokens, 1, 32768) ||
+        !validate_float_param(params->temperature, 0.0f, 2.0f)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
     try {
-        return llama_memory_can_shift(memory);
+        GenerationScope generation(llamafu);
+        std::string result;
+        LlamafuError err = complete_text(llamafu, params, result);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+
+        // Allocate result string
+        *out_result = static_cast<char*>(malloc(result.length() + 1));
+        if (!*out_result) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+
+        strcpy(*out_result, result.c_str());
+        return LLAMAFU_SUCCESS;
+
     } catch (const std::exception& e) {
-        return false;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-void llamafu_set_warmup(Llamafu llamafu, bool warmup) {
-    if (!llamafu) {
-        return;
+LlamafuError llamafu_complete_with_grammar(Llamafu llamafu, LlamafuInferParams* params,
+                                     const LlamafuGrammarParams* grammar_params, char** out_result) {
+    if (!llamafu || !params || !grammar_params || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
-    try {
-        llama_set_warmup(llamafu->ctx, warmup);
-    } catch (const std::exception& e) {
-        // Ignore errors in warmup setting
+
+    if (!validate_string_param(grammar_params->grammar_str, "grammar_str")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
+
+    LlamafuInferParams grammar_infer = *params;
+    grammar_infer.grammar_str = grammar_params->grammar_str;
+    grammar_infer.grammar_root = grammar_params->grammar_root;
+    return llamafu_complete(llamafu, &grammar_infer, out_result);
 }
 
-size_t llamafu_get_state_size(Llamafu llamafu) {
-    if (!llamafu) {
-        return 0;
+LlamafuError llamafu_multimodal_complete(Llamafu llamafu, LlamafuMultimodalInferParams* params, char** out_result) {
+    if (!llamafu || !params || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        return llama_state_get_size(llamafu->ctx);
-    } catch (const std::exception& e) {
-        return 0;
-    }
+    return llamafu_multimodal_complete_enhanced(llamafu, params, out_result);
 }
 
-size_t llamafu_copy_state_data(Llamafu llamafu, uint8_t* dest) {
-    if (!llamafu || !dest) {
-        return 0;
+LlamafuError llamafu_load_lora_adapter_from_file(Llamafu llamafu, const char* lora_path,
+                                           float scale, LlamafuLoraAdapter* out_adapter) {
+    return llamafu_load_lora_adapter_with_info(llamafu, lora_path, nullptr, nullptr, scale, out_adapter);
+}
+
+LlamafuError llamafu_load_lora_adapter_with_info(Llamafu llamafu, const char* lora_path, const char* name,
+                                                 const char* description, float scale,
+                                                 LlamafuLoraAdapter* out_adapter) {
+    if (!llamafu || !validate_string_param(lora_path, "lora_path") || !out_adapter) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        return llama_state_get_data(llamafu->ctx, dest, llama_state_get_size(llamafu->ctx));
-    } catch (const std::exception& e) {
-        return 0;
+    if (!validate_lora_scale(scale)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-}
 
-size_t llamafu_set_state_data(Llamafu llamafu, const uint8_t* src) {
-    if (!llamafu || !src) {
-        return 0;
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
     }
 
     try {
-        return llama_state_set_data(llamafu->ctx, src, llama_state_get_size(llamafu->ctx));
+        return load_lora(llamafu, lora_path, scale, name, description, out_adapter);
     } catch (const std::exception& e) {
-        return 0;
+        return LLAMAFU_ERROR_LORA_LOAD_FAILED;
     }
 }
 
-bool llamafu_load_session_file(Llamafu llamafu, const char* path_session, LlamafuToken* tokens_out, size_t n_token_capacity, size_t* n_token_count_out) {
-    if (!llamafu || !validate_string_param(path_session, "path_session") || !tokens_out || !n_token_count_out) {
-        return false;
+LlamafuError llamafu_set_lora_adapter(Llamafu llamafu, LlamafuLoraAdapter adapter, float scale) {
+    if (!llamafu || !adapter) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        return llama_state_load_file(llamafu->ctx, path_session, tokens_out, n_token_capacity, n_token_count_out);
-    } catch (const std::exception& e) {
-        return false;
+    if (!validate_lora_scale(scale)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-}
 
-bool llamafu_save_session_file(Llamafu llamafu, const char* path_session, const LlamafuToken* tokens, size_t n_token_count) {
-    if (!llamafu || !validate_string_param(path_session, "path_session") || !tokens) {
-        return false;
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    if (find_lora(llamafu, adapter) == llamafu->lora_adapters.end()) {
+        return LLAMAFU_ERROR_LORA_NOT_FOUND;
     }
 
     try {
-        return llama_state_save_file(llamafu->ctx, path_session, tokens, n_token_count);
+        adapter->active = true;
+        adapter->scale = scale;
+        if (!apply_lora_set(llamafu, default_lora_set(llamafu))) {
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return false;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-
-// Model introspection functions
-int32_t llamafu_model_n_ctx_train(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+LlamafuError llamafu_unload_lora_adapter(Llamafu llamafu, LlamafuLoraAdapter adapter) {
+    if (!llamafu || !adapter) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
-    try {
-        return llama_model_n_ctx_train(llamafu->model);
-    } catch (const std::exception& e) {
-        return -1;
+
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
     }
-}
 
-int32_t llamafu_model_n_embd(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+    auto it = find_lora(llamafu, adapter);
+    if (it == llamafu->lora_adapters.end()) {
+        return LLAMAFU_ERROR_LORA_NOT_FOUND;
     }
-    
+
     try {
-        return llama_model_n_embd(llamafu->model);
+        unload_lora(llamafu, it);
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return -1;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-int32_t llamafu_model_n_layer(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
-    }
-    
-    try {
-        return llama_model_n_layer(llamafu->model);
-    } catch (const std::exception& e) {
-        return -1;
-    }
+void llamafu_clear_lora_adapters(Llamafu llamafu) {
+    llamafu_lora_adapter_clear_all(llamafu);
 }
 
-int32_t llamafu_model_n_head(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+LlamafuError llamafu_tokenize(Llamafu llamafu, const char* text, int32_t text_len, LlamafuToken** out_tokens, int32_t* out_n_tokens, bool add_special, bool parse_special) {
+    if (!llamafu || !text || text_len <= 0 || !out_tokens || !out_n_tokens) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
     try {
-        return llama_model_n_head(llamafu->model);
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+
+        // Tokenize straight into the returned array; a text never has more
+        // tokens than bytes except for the added BOS/EOS, and llama_tokenize
+        // reports the exact count if it does
+        int32_t capacity = text_len + 2;
+        LlamafuToken* tokens = static_cast<LlamafuToken*>(malloc(capacity * sizeof(LlamafuToken)));
+        if (!tokens) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+        int32_t n_tokens = llama_tokenize(vocab, text, text_len, tokens, capacity, add_special, parse_special);
+        if (n_tokens < 0 && n_tokens != INT32_MIN) {
+            capacity = -n_tokens;
+            LlamafuToken* grown = static_cast<LlamafuToken*>(realloc(tokens, capacity * sizeof(LlamafuToken)));
+            if (!grown) {
+                free(tokens);
+                return LLAMAFU_ERROR_OUT_OF_MEMORY;
+            }
+            tokens = grown;
+            n_tokens = llama_tokenize(vocab, text, text_len, tokens, capacity, add_special, parse_special);
+        }
+        if (n_tokens < 0) {
+            free(tokens);
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        *out_n_tokens = n_tokens;
+        *out_tokens = tokens;
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return -1;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-int32_t llamafu_model_n_head_kv(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+LlamafuError llamafu_tokenize_batch(Llamafu llamafu, const char* const* texts, int32_t n_texts, LlamafuToken* out_tokens,
+                                    int32_t capacity, int32_t* out_offsets, int32_t* out_n_tokens, bool add_special,
+                                    bool parse_special) {
+    if (!llamafu || !texts || n_texts <= 0 || capacity < 0 || (capacity > 0 && !out_tokens) ||
+        !out_offsets || !out_n_tokens) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
     try {
-        return llama_model_n_head_kv(llamafu->model);
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+
+        // Texts are tokenized in place while they fit; past that only their
+        // counts are needed, so the caller can size the next call
+        std::vector<llama_token> overflow;
+        int64_t total = 0;
+        for (int32_t i = 0; i < n_texts; i++) {
+            if (!texts[i]) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            const int32_t text_len = static_cast<int32_t>(strlen(texts[i]));
+            out_offsets[i] = static_cast<int32_t>(total);
+
+            int32_t n = INT32_MIN;
+            if (total < capacity) {
+                n = llama_tokenize(vocab, texts[i], text_len, out_tokens + total,
+                                   capacity - static_cast<int32_t>(total), add_special, parse_special);
+                n = n == INT32_MIN ? -1 : std::abs(n);
+            } else {
+                n = tokenize_text(vocab, texts[i], text_len, add_special, parse_special, overflow);
+            }
+            if (n < 0 || total + n > INT32_MAX) {
+                return LLAMAFU_ERROR_TOKENIZATION_FAILED;
+            }
+            total += n;
+        }
+        out_offsets[n_texts] = static_cast<int32_t>(total);
+        *out_n_tokens = static_cast<int32_t>(total);
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return -1;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-int32_t llamafu_model_n_swa(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
-    }
-    
-    try {
-        return llama_model_n_swa(llamafu->model);
-    } catch (const std::exception& e) {
-        return -1;
+LlamafuError llamafu_detokenize(Llamafu llamafu, const LlamafuToken* tokens, int32_t n_tokens, char** out_text, bool remove_special, bool unparse_special) {
+    if (!llamafu || !tokens || n_tokens <= 0 || !out_text) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-}
 
-float llamafu_model_rope_freq_scale_train(Llamafu llamafu) {
-    if (!llamafu) {
-        return 0.0f;
+    if (!validate_numeric_param(n_tokens, 1, 32768)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
     try {
-        return llama_model_rope_freq_scale_train(llamafu->model);
+        // Use modern detokenization API
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+
+        // First pass to get required buffer size
+        const int32_t text_len_max = n_tokens * 8; // Conservative estimate
+        std::vector<char> text_buf(text_len_max);
+
+        const int32_t text_len = llama_detokenize(vocab, tokens, n_tokens, text_buf.data(), text_len_max, remove_special, unparse_special);
+        if (text_len < 0) {
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
+
+        *out_text = static_cast<char*>(malloc(text_len + 1));
+        if (!*out_text) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+
+        memcpy(*out_text, text_buf.data(), text_len);
+        (*out_text)[text_len] = '\0';
+
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return 0.0f;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-int32_t llamafu_model_rope_type(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+LlamafuError llamafu_get_model_info(Llamafu llamafu, LlamafuModelInfo* out_info) {
+    if (!llamafu || !out_info) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
     try {
-        return static_cast<int32_t>(llama_model_rope_type(llamafu->model));
+        // Initialize all fields to avoid reading uninitialized memory
+        memset(out_info, 0, sizeof(LlamafuModelInfo));
+
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        out_info->n_vocab = llama_vocab_n_tokens(vocab);
+        out_info->n_ctx_train = llama_model_n_ctx_train(llamafu->model);
+        out_info->n_embd = llama_model_n_embd(llamafu->model);
+        out_info->n_layer = llama_model_n_layer(llamafu->model);
+        out_info->n_head = llama_model_n_head(llamafu->model);
+        out_info->n_head_kv = llama_model_n_head_kv(llamafu->model);
+
+        // Get model description from metadata
+        static std::string model_name;
+        char name_buf[256] = {0};
+        int32_t name_len = llama_model_meta_val_str(llamafu->model, "general.name", name_buf, sizeof(name_buf));
+        if (name_len > 0) {
+            model_name = name_buf;
+            out_info->name = model_name.c_str();
+        } else {
+            out_info->name = "";
+        }
+
+        static std::string model_arch;
+        char arch_buf[256] = {0};
+        int32_t arch_len = llama_model_meta_val_str(llamafu->model, "general.architecture", arch_buf, sizeof(arch_buf));
+        if (arch_len > 0) {
+            model_arch = arch_buf;
+            out_info->architecture = model_arch.c_str();
+        } else {
+            out_info->architecture = "";
+        }
+
+        out_info->description = "";
+        out_info->n_params = llama_model_n_params(llamafu->model);
+        out_info->size_bytes = llama_model_size(llamafu->model);
+        out_info->has_encoder = false;
+        out_info->has_decoder = true;
+        out_info->is_recurrent = false;
+        out_info->supports_embeddings = true;
+        out_info->supports_multimodal = llamafu->is_multimodal;
+        out_info->rope_freq_base_train = 0.0f;
+        out_info->rope_freq_scale_train = 1.0f;
+
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return -1;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-uint64_t llamafu_model_size(Llamafu llamafu) {
-    if (!llamafu) {
-        return 0;
-    }
-    
-    try {
-        return llama_model_size(llamafu->model);
-    } catch (const std::exception& e) {
-        return 0;
+LlamafuError llamafu_get_embeddings(Llamafu llamafu, const char* text, float** out_embeddings, int32_t* out_n_embd) {
+    if (!llamafu || !validate_string_param(text, "text") || !out_embeddings || !out_n_embd) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-}
 
-uint64_t llamafu_model_n_params(Llamafu llamafu) {
-    if (!llamafu) {
-        return 0;
+    if (llamafu->context_mode == LLAMAFU_CONTEXT_MODE_GENERATION) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
     }
-    
+
     try {
-        return llama_model_n_params(llamafu->model);
+        GenerationScope generation(llamafu);
+        // Tokenize input using modern API
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        const int32_t text_len = static_cast<int32_t>(strlen(text));
+
+        // First pass to get the number of tokens
+        const int32_t n_tokens_max = text_len + 16; // Conservative estimate
+        std::vector<llama_token> tokens(n_tokens_max);
+
+        const int32_t n_tokens = llama_tokenize(vocab, text, text_len, tokens.data(), n_tokens_max, true, true);
+        if (n_tokens < 0) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        tokens.resize(n_tokens);
+
+        if (tokens.empty()) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        // Embeddings run in sequence 0; its prompt-cache contents are lost
+        llama_memory_t mem = llama_get_memory(llamafu->ctx);
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        llamafu->cached_tokens.clear();
+        llamafu->n_reused_last = 0;
+
+        // Mixed-mode contexts only produce embeddings for this call
+        const bool toggle_embeddings = llamafu->context_mode == LLAMAFU_CONTEXT_MODE_BOTH;
+        if (toggle_embeddings) {
+            llama_set_embeddings(llamafu->ctx, true);
+        }
+
+        // Evaluate tokens
+        const int32_t decode_result = llama_decode(llamafu->ctx, llama_batch_get_one(tokens.data(), tokens.size()));
+        if (toggle_embeddings) {
+            llama_set_embeddings(llamafu->ctx, false);
+        }
+        if (decode_result != 0) {
+            llama_memory_seq_rm(mem, 0, -1, -1);
+            return LLAMAFU_ERROR_DECODE_FAILED;
+        }
+
+        // Pooled contexts expose one vector per sequence, otherwise take the
+        // last token's embedding (most common use case for decoder models)
+        int32_t n_embd = llama_model_n_embd(llamafu->model);
+        const float* embeddings = llama_pooling_type(llamafu->ctx) != LLAMA_POOLING_TYPE_NONE
+            ? llama_get_embeddings_seq(llamafu->ctx, 0)
+            : llama_get_embeddings_ith(llamafu->ctx, -1);
+        llama_memory_seq_rm(mem, 0, -1, -1);
+
+        if (!embeddings) {
+            // Embeddings might not be available for all models
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
+
+        *out_n_embd = n_embd;
+        *out_embeddings = static_cast<float*>(malloc(n_embd * sizeof(float)));
+
+        if (!*out_embeddings) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+
+        memcpy(*out_embeddings, embeddings, n_embd * sizeof(float));
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return 0;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-bool llamafu_model_has_encoder(Llamafu llamafu) {
-    if (!llamafu) {
-        return false;
+LlamafuError llamafu_get_embeddings_batch(
+    Llamafu llamafu,
+    const char* const* texts,
+    int32_t n_texts,
+    int32_t pooling,
+    bool normalize,
+    float* out_embeddings,
+    size_t out_capacity,
+    int32_t* out_n_embd
+) {
+    if (!llamafu || !texts || n_texts <= 0 || !out_embeddings || !out_n_embd ||
+        !validate_numeric_param(pooling, LLAMAFU_POOLING_UNSPECIFIED, LLAMAFU_POOLING_LAST)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
     try {
-        return llama_model_has_encoder(llamafu->model);
-    } catch (const std::exception& e) {
-        return false;
-    }
-}
+        GenerationScope generation(llamafu);
+        if (llamafu->context_mode == LLAMAFU_CONTEXT_MODE_GENERATION) {
+            return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+        }
 
-bool llamafu_model_has_decoder(Llamafu llamafu) {
-    if (!llamafu) {
-        return false;
-    }
-    
-    try {
-        return llama_model_has_decoder(llamafu->model);
+        const int32_t n_embd = llama_model_n_embd(llamafu->model);
+        if (out_capacity < static_cast<size_t>(n_texts) * n_embd) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        // Pooled contexts pool natively; on unpooled ones the requested pooling is
+        // computed here from per-token outputs
+        const enum llama_pooling_type ctx_pooling = llama_pooling_type(llamafu->ctx);
+        const bool native_pooling = ctx_pooling != LLAMA_POOLING_TYPE_NONE;
+        if (ctx_pooling == LLAMA_POOLING_TYPE_RANK ||
+            (native_pooling && pooling != LLAMAFU_POOLING_UNSPECIFIED && pooling != ctx_pooling)) {
+            return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+        }
+        const int32_t manual_pooling = pooling == LLAMAFU_POOLING_UNSPECIFIED ? LLAMAFU_POOLING_LAST : pooling;
+        if (!native_pooling && manual_pooling == LLAMAFU_POOLING_NONE) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        llama_memory_t mem = llama_get_memory(llamafu->ctx);
+        const int32_t n_batch = static_cast<int32_t>(llama_n_batch(llamafu->ctx));
+
+        // Sequence 0's prompt cache is dropped
+        const std::vector<llama_seq_id> seq_ids = free_sequences(llamafu);
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        llamafu->cached_tokens.clear();
+        llamafu->n_reused_last = 0;
+
+        struct PackedText {
+            int32_t text_index;
+            llama_seq_id seq_id;
+            int32_t first;                // Batch index of the first token
+            int32_t n_tokens;
+        };
+        std::vector<PackedText> packed;
+        std::vector<llama_token> tokens;
+        llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+        const bool toggle_embeddings = llamafu->context_mode == LLAMAFU_CONTEXT_MODE_BOTH;
+        if (toggle_embeddings) {
+            llama_set_embeddings(llamafu->ctx, true);
+        }
+
+        LlamafuError err = LLAMAFU_SUCCESS;
+        int32_t next = 0;
+        while (next < n_texts && err == LLAMAFU_SUCCESS) {
+            batch.n_tokens = 0;
+            packed.clear();
+
+            // Pack whole texts until the batch or the free sequences run out
+            while (next < n_texts && packed.size() < seq_ids.size()) {
+                if (!texts[next]) {
+                    err = LLAMAFU_ERROR_INVALID_PARAM;
+                    break;
+                }
+                const int32_t text_len = static_cast<int32_t>(strlen(texts[next]));
+                tokens.resize(text_len + 16);
+                int32_t n_tokens = llama_tokenize(vocab, texts[next], text_len, tokens.data(),
+                                                  tokens.size(), true, true);
+                if (n_tokens <= 0) {
+                    err = LLAMAFU_ERROR_TOKENIZATION_FAILED;
+                    break;
+                }
+                n_tokens = std::min(n_tokens, n_batch);
+                if (batch.n_tokens + n_tokens > n_batch) {
+                    break;  // Goes into the next batch
+                }
+
+                const llama_seq_id seq_id = seq_ids[packed.size()];
+                packed.push_back({next, seq_id, batch.n_tokens, n_tokens});
+                for (int32_t i = 0; i < n_tokens; i++) {
+                    const int32_t j = batch.n_tokens++;
+                    batch.token[j] = tokens[i];
+                    batch.pos[j] = i;
+                    batch.n_seq_id[j] = 1;
+                    batch.seq_id[j][0] = seq_id;
+                    batch.logits[j] = native_pooling || manual_pooling == LLAMAFU_POOLING_MEAN ||
+                                      (manual_pooling == LLAMAFU_POOLING_CLS && i == 0) ||
+                                      (manual_pooling == LLAMAFU_POOLING_LAST && i == n_tokens - 1);
+                }
+                next++;
+            }
+            if (err != LLAMAFU_SUCCESS || packed.empty()) {
+                break;
+            }
+
+            if (llama_decode(llamafu->ctx, batch) != 0) {
+                err = LLAMAFU_ERROR_DECODE_FAILED;
+            }
+
+            for (const PackedText& p : packed) {
+                if (err != LLAMAFU_SUCCESS) {
+                    break;
+                }
+                float* row = out_embeddings + static_cast<size_t>(p.text_index) * n_embd;
+
+                if (native_pooling) {
+                    const float* embd = llama_get_embeddings_seq(llamafu->ctx, p.seq_id);
+                    if (!embd) {
+                        err = LLAMAFU_ERROR_UNKNOWN;
+                        break;
+                    }
+                    memcpy(row, embd, n_embd * sizeof(float));
+                } else if (manual_pooling == LLAMAFU_POOLING_MEAN) {
+                    std::fill(row, row + n_embd, 0.0f);
+                    for (int32_t i = 0; i < p.n_tokens; i++) {
+                        const float* embd = llama_get_embeddings_ith(llamafu->ctx, p.first + i);
+                        if (!embd) {
+                            err = LLAMAFU_ERROR_UNKNOWN;
+                            break;
+                        }
+                        for (int32_t k = 0; k < n_embd; k++) {
+                            row[k] += embd[k];
+                        }
+                    }
+                    for (int32_t k = 0; k < n_embd; k++) {
+                        row[k] /= static_cast<float>(p.n_tokens);
+                    }
+                } else {
+                    const int32_t i = manual_pooling == LLAMAFU_POOLING_CLS ? p.first : p.first + p.n_tokens - 1;
+                    const float* embd = llama_get_embeddings_ith(llamafu->ctx, i);
+                    if (!embd) {
+                        err = LLAMAFU_ERROR_UNKNOWN;
+                        break;
+                    }
+                    memcpy(row, embd, n_embd * sizeof(float));
+                }
+
+                if (normalize) {
+                    double sum = 0.0;
+                    for (int32_t k = 0; k < n_embd; k++) {
+                        sum += static_cast<double>(row[k]) * row[k];
+                    }
+                    const float inv = sum > 0.0 ? static_cast<float>(1.0 / std::sqrt(sum)) : 0.0f;
+                    for (int32_t k = 0; k < n_embd; k++) {
+                        row[k] *= inv;
+                    }
+                }
+            }
+
+            for (const PackedText& p : packed) {
+                llama_memory_seq_rm(mem, p.seq_id, -1, -1);
+            }
+        }
+
+        if (toggle_embeddings) {
+            llama_set_embeddings(llamafu->ctx, false);
+        }
+        llama_batch_free(batch);
+
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+        *out_n_embd = n_embd;
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return false;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-LlamafuToken llamafu_model_decoder_start_token(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
-    }
-    
-    try {
-        return llama_model_decoder_start_token(llamafu->model);
-    } catch (const std::exception& e) {
-        return -1;
+LlamafuError llamafu_grammar_sampler_init(Llamafu llamafu, const char* grammar_str, const char* grammar_root,
+                                          LlamafuGrammarSampler* out_sampler) {
+    if (!llamafu || !out_sampler || !validate_string_param(grammar_str, "grammar_str") ||
+        !validate_string_param(grammar_root, "grammar_root")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-}
 
-bool llamafu_model_is_recurrent(Llamafu llamafu) {
-    if (!llamafu) {
-        return false;
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
     }
-    
+
     try {
-        return llama_model_is_recurrent(llamafu->model);
+        llama_sampler* grammar = acquire_grammar_sampler(llamafu, grammar_str, grammar_root);
+        if (!grammar) {
+            return LLAMAFU_ERROR_GRAMMAR_INIT_FAILED;
+        }
+        *out_sampler = new LlamafuGrammarSampler_s{grammar};
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return false;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-bool llamafu_model_is_diffusion(Llamafu llamafu) {
-    if (!llamafu) {
-        return false;
-    }
-    
-    try {
-        return llama_model_is_diffusion(llamafu->model);
-    } catch (const std::exception& e) {
-        return false;
+void llamafu_grammar_sampler_free(LlamafuGrammarSampler sampler) {
+    if (sampler) {
+        llama_sampler_free(sampler->sampler);
+        delete sampler;
     }
 }
 
-int32_t llamafu_model_desc(Llamafu llamafu, char* buf, size_t buf_size) {
-    if (!llamafu || !buf || buf_size == 0) {
-        return -1;
-    }
-    
+// Sampler chain implementation
+LlamafuSampler llamafu_sampler_chain_init(void) {
     try {
-        return llama_model_desc(llamafu->model, buf, buf_size);
+        llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+        if (!chain) {
+            return nullptr;
+        }
+
+        LlamafuSampler sampler = new LlamafuSampler_s{chain, LLAMAFU_SAMPLER_CHAIN};
+        return sampler;
     } catch (const std::exception& e) {
-        return -1;
+        return nullptr;
     }
 }
 
-const char* llamafu_model_chat_template(Llamafu llamafu, const char* name) {
-    if (!llamafu) {
+LlamafuSampler llamafu_sampler_init_top_k(int32_t k) {
+    if (k <= 0) {
         return nullptr;
     }
-    
+
     try {
-        return llama_model_chat_template(llamafu->model, name);
+        llama_sampler* sampler = llama_sampler_init_top_k(k);
+        if (!sampler) {
+            return nullptr;
+        }
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TOP_K};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
         return nullptr;
     }
 }
 
-// Model metadata functions
-int32_t llamafu_model_meta_count(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+LlamafuSampler llamafu_sampler_init_top_p(float p, size_t min_keep) {
+    if (p < 0.0f || p > 1.0f) {
+        return nullptr;
     }
-    
+
     try {
-        return llama_model_meta_count(llamafu->model);
+        llama_sampler* sampler = llama_sampler_init_top_p(p, min_keep);
+        if (!sampler) {
+            return nullptr;
+        }
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TOP_P};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return -1;
+        return nullptr;
     }
 }
 
-int32_t llamafu_model_meta_key_by_index(Llamafu llamafu, int32_t i, char* buf, size_t buf_size) {
-    if (!llamafu || !buf || buf_size == 0 || i < 0) {
-        return -1;
+LlamafuSampler llamafu_sampler_init_min_p(float p, size_t min_keep) {
+    if (p < 0.0f || p > 1.0f) {
+        return nullptr;
     }
-    
+
     try {
-        return llama_model_meta_key_by_index(llamafu->model, i, buf, buf_size);
+        llama_sampler* sampler = llama_sampler_init_min_p(p, min_keep);
+        if (!sampler) {
+            return nullptr;
+        }
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_MIN_P};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return -1;
+        return nullptr;
     }
 }
 
-int32_t llamafu_model_meta_val_str_by_index(Llamafu llamafu, int32_t i, char* buf, size_t buf_size) {
-    if (!llamafu || !buf || buf_size == 0 || i < 0) {
-        return -1;
+LlamafuSampler llamafu_sampler_init_tail_free(float z, size_t min_keep) {
+    // Tail free sampling has been removed from llama.cpp
+    // Return nullptr to indicate unsupported
+    (void)z;
+    (void)min_keep;
+    return nullptr;
+}
+
+LlamafuSampler llamafu_sampler_init_typical(float p, size_t min_keep) {
+    if (p < 0.0f || p > 1.0f) {
+        return nullptr;
     }
-    
+
     try {
-        return llama_model_meta_val_str_by_index(llamafu->model, i, buf, buf_size);
+        llama_sampler* sampler = llama_sampler_init_typical(p, min_keep);
+        if (!sampler) {
+            return nullptr;
+        }
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TYPICAL};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return -1;
+        return nullptr;
     }
 }
 
-int32_t llamafu_model_meta_val_str(Llamafu llamafu, const char* key, char* buf, size_t buf_size) {
-    if (!llamafu || !validate_string_param(key, "key") || !buf || buf_size == 0) {
-        return -1;
+LlamafuSampler llamafu_sampler_init_temp(float temp) {
+    if (temp < 0.0f) {
+        return nullptr;
     }
-    
+
     try {
-        return llama_model_meta_val_str(llamafu->model, key, buf, buf_size);
+        llama_sampler* sampler = llama_sampler_init_temp(temp);
+        if (!sampler) {
+            return nullptr;
+        }
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TEMP};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return -1;
+        return nullptr;
     }
 }
 
-// Vocabulary introspection
-int32_t llamafu_vocab_type(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+LlamafuSampler llamafu_sampler_init_temp_ext(float temp, float delta, float exponent) {
+    if (temp < 0.0f) {
+        return nullptr;
     }
-    
+
     try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        if (!vocab) {
-            return -1;
+        llama_sampler* sampler = llama_sampler_init_temp_ext(temp, delta, exponent);
+        if (!sampler) {
+            return nullptr;
         }
-        return static_cast<int32_t>(llama_vocab_type(vocab));
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_TEMP};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return -1;
+        return nullptr;
     }
 }
 
-int32_t llamafu_vocab_n_tokens(Llamafu llamafu) {
-    if (!llamafu) {
-        return -1;
+LlamafuSampler llamafu_sampler_init_mirostat(int32_t n_vocab, uint32_t seed, float tau, float eta, int32_t m) {
+    if (n_vocab <= 0 || tau <= 0.0f || eta <= 0.0f || m <= 0) {
+        return nullptr;
     }
-    
+
     try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        if (!vocab) {
-            return -1;
+        llama_sampler* sampler = llama_sampler_init_mirostat(n_vocab, seed, tau, eta, m);
+        if (!sampler) {
+            return nullptr;
         }
-        return llama_vocab_n_tokens(vocab);
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_MIROSTAT};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return -1;
+        return nullptr;
     }
 }
 
-const char* llamafu_vocab_get_text(Llamafu llamafu, LlamafuToken token) {
-    if (!llamafu) {
+LlamafuSampler llamafu_sampler_init_mirostat_v2(uint32_t seed, float tau, float eta) {
+    if (tau <= 0.0f || eta <= 0.0f) {
         return nullptr;
     }
-    
+
     try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        if (!vocab) {
+        llama_sampler* sampler = llama_sampler_init_mirostat_v2(seed, tau, eta);
+        if (!sampler) {
             return nullptr;
         }
-        return llama_vocab_get_text(vocab, token);
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_MIROSTAT_V2};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
         return nullptr;
     }
 }
 
-bool llamafu_vocab_get_add_bos(Llamafu llamafu) {
-    if (!llamafu) {
-        return false;
+LlamafuSampler llamafu_sampler_init_grammar(const char* grammar_str, const char* root) {
+    // Grammar sampler requires a vocab reference which we don't have in this simplified API
+    // Return nullptr to indicate unsupported
+    (void)grammar_str;
+    (void)root;
+    return nullptr;
+}
+
+LlamafuSampler llamafu_sampler_init_penalties(int32_t n_vocab, LlamafuToken eos_token, LlamafuToken nl_token,
+                                             int32_t repeat_last_n, float repeat_penalty, float freq_penalty,
+                                             float presence_penalty, bool penalize_nl, bool ignore_eos) {
+    if (repeat_last_n < 0) {
+        return nullptr;
     }
-    
+
+    // Note: n_vocab, eos_token, nl_token, penalize_nl, ignore_eos are no longer used in the new API
+    (void)n_vocab;
+    (void)eos_token;
+    (void)nl_token;
+    (void)penalize_nl;
+    (void)ignore_eos;
+
     try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        if (!vocab) {
-            return false;
+        llama_sampler* sampler = llama_sampler_init_penalties(repeat_last_n, repeat_penalty, freq_penalty, presence_penalty);
+        if (!sampler) {
+            return nullptr;
         }
-        return llama_vocab_get_add_bos(vocab);
+
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_PENALTIES};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
-        return false;
+        return nullptr;
     }
 }
 
-bool llamafu_vocab_get_add_eos(Llamafu llamafu) {
-    if (!llamafu) {
-        return false;
+int32_t llamafu_sampler_chain_add(LlamafuSampler chain, LlamafuSampler sampler) {
+    if (!chain || !sampler || chain->type != LLAMAFU_SAMPLER_CHAIN) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    
+
     try {
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        if (!vocab) {
-            return false;
+        llama_sampler_chain_add(chain->sampler, sampler->sampler);
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+int32_t llamafu_sampler_chain_remove(LlamafuSampler chain, int32_t i) {
+    if (!chain || chain->type != LLAMAFU_SAMPLER_CHAIN || i < 0) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        llama_sampler* removed = llama_sampler_chain_remove(chain->sampler, i);
+        if (removed) {
+            llama_sampler_free(removed);
         }
-        return llama_vocab_get_add_eos(vocab);
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
-        return false;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-// Advanced model introspection
-uint32_t llamafu_model_n_cls_out(Llamafu llamafu) {
-    if (!llamafu) {
-        return 0;
+int32_t llamafu_sampler_chain_n(LlamafuSampler chain) {
+    if (!chain || chain->type != LLAMAFU_SAMPLER_CHAIN) {
+        return -1;
     }
-    
+
     try {
-        return llama_model_n_cls_out(llamafu->model);
+        return llama_sampler_chain_n(chain->sampler);
     } catch (const std::exception& e) {
-        return 0;
+        return -1;
     }
 }
 
-const char* llamafu_model_cls_label(Llamafu llamafu, uint32_t i) {
-    if (!llamafu) {
+LlamafuSampler llamafu_sampler_chain_get(LlamafuSampler chain, int32_t i) {
+    if (!chain || chain->type != LLAMAFU_SAMPLER_CHAIN || i < 0) {
         return nullptr;
     }
-    
+
     try {
-        return llama_model_cls_label(llamafu->model, i);
+        llama_sampler* sampler = llama_sampler_chain_get(chain->sampler, i);
+        if (!sampler) {
+            return nullptr;
+        }
+
+        // Note: This returns a reference to the internal sampler, not owned by caller
+        LlamafuSampler llamafu_sampler = new LlamafuSampler_s{sampler, LLAMAFU_SAMPLER_CHAIN};
+        return llamafu_sampler;
     } catch (const std::exception& e) {
         return nullptr;
     }
 }
 
+llama_token llamafu_sampler_sample(LlamafuSampler sampler, Llamafu llamafu, int32_t idx) {
+    if (!sampler || !llamafu || idx < 0) {
+        return -1;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        return llama_sampler_sample(sampler->sampler, llamafu->ctx, idx);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
 
-// Text generation functions
-float* llamafu_get_logits(Llamafu llamafu) {
-    if (!llamafu) {
-        return nullptr;
+void llamafu_sampler_accept(LlamafuSampler sampler, llama_token token) {
+    if (!sampler) {
+        return;
     }
-    
+
     try {
-        return llama_get_logits(llamafu->ctx);
+        llama_sampler_accept(sampler->sampler, token);
     } catch (const std::exception& e) {
-        return nullptr;
+        // Ignore errors in accept
     }
 }
 
-float* llamafu_get_logits_ith(Llamafu llamafu, int32_t i) {
-    if (!llamafu || i < 0) {
-        return nullptr;
+void llamafu_sampler_reset(LlamafuSampler sampler) {
+    if (!sampler) {
+        return;
     }
-    
+
     try {
-        return llama_get_logits_ith(llamafu->ctx, i);
+        llama_sampler_reset(sampler->sampler);
     } catch (const std::exception& e) {
-        return nullptr;
+        // Ignore errors in reset
     }
 }
 
-// Advanced text generation with sampling
-LlamafuError llamafu_generate_text(Llamafu llamafu, const char* prompt, LlamafuInferParams* params, char** out_result) {
-    if (!llamafu || !validate_string_param(prompt, "prompt") || !params || !out_result) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+void llamafu_sampler_free(LlamafuSampler sampler) {
+    if (sampler) {
+        if (sampler->sampler) {
+            llama_sampler_free(sampler->sampler);
+        }
+        delete sampler;
     }
+}
 
-    if (!validate_numeric_param(params->max_tokens, 1, 32768) ||
-        !validate_float_param(params->temperature, 0.0f, 2.0f) ||
-        !validate_float_param(params->top_p, 0.0f, 1.0f) ||
-        !validate_numeric_param(params->top_k, 1, 200)) {
+// Modern tokenization helper functions
+int32_t llamafu_tokenize_modern(Llamafu llamafu, const char* text, LlamafuToken** out_tokens, int32_t* out_n_tokens, bool add_special, bool parse_special) {
+    if (!llamafu || !validate_string_param(text, "text") || !out_tokens || !out_n_tokens) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
     try {
-        // Tokenize prompt
         const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        const int32_t text_len = static_cast<int32_t>(strlen(prompt));
+        const int32_t text_len = static_cast<int32_t>(strlen(text));
+
+        // Conservative estimate for token buffer size
         const int32_t n_tokens_max = text_len + 16;
-        std::vector<llama_token> prompt_tokens(n_tokens_max);
+        std::vector<llama_token> tokens(n_tokens_max);
 
-        const int32_t n_prompt = llama_tokenize(vocab, prompt, text_len, prompt_tokens.data(), n_tokens_max, true, true);
-        if (n_prompt < 0) {
+        const int32_t n_tokens = llama_tokenize(vocab, text, text_len, tokens.data(), n_tokens_max, add_special, parse_special);
+        if (n_tokens < 0) {
             return LLAMAFU_ERROR_INVALID_PARAM;
         }
-        prompt_tokens.resize(n_prompt);
-
-        // Create sampler chain
-        LlamafuSampler sampler_chain = llamafu_sampler_chain_init();
-        if (!sampler_chain) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
-
-        // Add samplers based on parameters
-        if (params->top_k > 0) {
-            LlamafuSampler top_k_sampler = llamafu_sampler_init_top_k(params->top_k);
-            if (top_k_sampler) {
-                llamafu_sampler_chain_add(sampler_chain, top_k_sampler);
-            }
-        }
 
-        if (params->top_p < 1.0f) {
-            LlamafuSampler top_p_sampler = llamafu_sampler_init_top_p(params->top_p, 1);
-            if (top_p_sampler) {
-                llamafu_sampler_chain_add(sampler_chain, top_p_sampler);
-            }
-        }
-
-        if (params->temperature > 0.0f) {
-            LlamafuSampler temp_sampler = llamafu_sampler_init_temp(params->temperature);
-            if (temp_sampler) {
-                llamafu_sampler_chain_add(sampler_chain, temp_sampler);
-            }
-        }
-
-        // Add penalties if specified
-        if (params->repeat_penalty != 1.0f || params->frequency_penalty != 0.0f || params->presence_penalty != 0.0f) {
-            const int32_t vocab_size = llamafu_vocab_n_tokens(llamafu);
-            const LlamafuToken eos_token = llamafu_token_eos(llamafu);
-            const LlamafuToken nl_token = llamafu_token_nl(llamafu);
-            
-            LlamafuSampler penalty_sampler = llamafu_sampler_init_penalties(
-                vocab_size, eos_token, nl_token, 64, // penalty_last_n
-                params->repeat_penalty, params->frequency_penalty, params->presence_penalty,
-                params->penalize_nl, params->ignore_eos
-            );
-            if (penalty_sampler) {
-                llamafu_sampler_chain_add(sampler_chain, penalty_sampler);
-            }
-        }
+        *out_n_tokens = n_tokens;
+        *out_tokens = static_cast<LlamafuToken*>(malloc(n_tokens * sizeof(LlamafuToken)));
 
-        // Clear KV cache and process prompt
-        LlamafuMemory memory = llamafu_get_memory(llamafu);
-        if (memory) {
-            llamafu_memory_clear(memory, false);
+        if (!*out_tokens) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
         }
 
-        // Process prompt
-        if (llama_decode(llamafu->ctx, llama_batch_get_one(prompt_tokens.data(), n_prompt)) != 0) {
-            llamafu_sampler_free(sampler_chain);
-            return LLAMAFU_ERROR_DECODE_FAILED;
+        for (int32_t i = 0; i < n_tokens; ++i) {
+            (*out_tokens)[i] = tokens[i];
         }
 
-        // Generate tokens
-        std::vector<llama_token> generated_tokens;
-        generated_tokens.reserve(params->max_tokens);
-
-        for (int32_t i = 0; i < params->max_tokens; ++i) {
-            // Sample next token
-            llama_token next_token = llamafu_sampler_sample(sampler_chain, llamafu, -1);
-            if (next_token < 0) {
-                break;
-            }
-
-            generated_tokens.push_back(next_token);
-
-            // Check for stop tokens
-            if (!params->ignore_eos && next_token == llamafu_token_eos(llamafu)) {
-                break;
-            }
-
-            // Accept the token for sampling state
-            llamafu_sampler_accept(sampler_chain, next_token);
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
 
-            // Process the token for next iteration
-            if (llama_decode(llamafu->ctx, llama_batch_get_one(&next_token, 1)) != 0) {
-                break;
-            }
-        }
+int32_t llamafu_detokenize_modern(Llamafu llamafu, const LlamafuToken* tokens, int32_t n_tokens, char** out_text, bool remove_special, bool unparse_special) {
+    if (!llamafu || !tokens || n_tokens <= 0 || !out_text) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-        llamafu_sampler_free(sampler_chain);
+    if (!validate_numeric_param(n_tokens, 1, 32768)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-        // Convert generated tokens to text
-        if (generated_tokens.empty()) {
-            *out_result = static_cast<char*>(malloc(1));
-            if (*out_result) {
-                (*out_result)[0] = '\0';
-            }
-            return LLAMAFU_SUCCESS;
-        }
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
 
-        // Detokenize generated tokens
-        const int32_t text_len_max = static_cast<int32_t>(generated_tokens.size()) * 8;
+        // Conservative estimate for text buffer size
+        const int32_t text_len_max = n_tokens * 8;
         std::vector<char> text_buf(text_len_max);
 
-        const int32_t generated_text_len = llama_detokenize(vocab, generated_tokens.data(), 
-                                                           static_cast<int32_t>(generated_tokens.size()), 
-                                                           text_buf.data(), text_len_max, false, false);
-        
-        if (generated_text_len < 0) {
+        const int32_t text_len = llama_detokenize(vocab, tokens, n_tokens, text_buf.data(), text_len_max, remove_special, unparse_special);
+        if (text_len < 0) {
             return LLAMAFU_ERROR_UNKNOWN;
         }
 
-        // Return generated text
-        std::string result(text_buf.data(), generated_text_len);
-
-        *out_result = static_cast<char*>(malloc(result.length() + 1));
-        if (!*out_result) {
+        *out_text = static_cast<char*>(malloc(text_len + 1));
+        if (!*out_text) {
             return LLAMAFU_ERROR_OUT_OF_MEMORY;
         }
 
-        strcpy(*out_result, result.c_str());
-        return LLAMAFU_SUCCESS;
+        memcpy(*out_text, text_buf.data(), text_len);
+        (*out_text)[text_len] = '\0';
 
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
         return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-// Streaming text generation - stub implementation
-LlamafuError llamafu_generate_text_streaming(Llamafu llamafu, const char* prompt, LlamafuInferParams* params,
-                                       void* callback, void* user_data) {
-    // Streaming not fully implemented yet
-    (void)llamafu;
-    (void)prompt;
-    (void)params;
-    (void)callback;
-    (void)user_data;
-    return LLAMAFU_ERROR_UNKNOWN;
-}
-
-// Simple completion with default parameters
-LlamafuError llamafu_complete_simple(Llamafu llamafu, const char* prompt, int32_t max_tokens, char** out_result) {
-    if (!llamafu || !validate_string_param(prompt, "prompt") || !out_result) {
+LlamafuError llamafu_token_to_piece(Llamafu llamafu, LlamafuToken token, char** out_piece) {
+    if (!llamafu || !out_piece) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    LlamafuInferParams params = {};
-    params.prompt = prompt;
-    params.max_tokens = max_tokens > 0 ? max_tokens : 128;
-    params.temperature = 0.7f;
-    params.top_p = 0.9f;
-    params.top_k = 40;
-    params.repeat_penalty = 1.1f;
-    params.frequency_penalty = 0.0f;
-    params.presence_penalty = 0.0f;
-    // params.stop_on_eos = true;  // Field doesn't exist in struct
-    // params.include_prompt = false;  // Field doesn't exist in struct
+    try {
+        if (token < 0 || token >= llama_vocab_n_tokens(llama_model_get_vocab(llamafu->model))) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        const std::string_view piece = token_piece(llamafu->shared_model, token);
 
-    return llamafu_complete(llamafu, &params, out_result);
-}
+        *out_piece = static_cast<char*>(malloc(piece.size() + 1));
+        if (!*out_piece) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
 
+        memcpy(*out_piece, piece.data(), piece.size());
+        (*out_piece)[piece.size()] = '\0';
 
-// =============================================================================
-// Performance and Threading Controls
-// =============================================================================
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
 
-LlamafuError llamafu_set_n_threads(Llamafu llamafu, int32_t n_threads, int32_t n_threads_batch) {
+// Token information functions
+float llamafu_token_get_score(Llamafu llamafu, LlamafuToken token) {
     if (!llamafu) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+        return 0.0f;
     }
-    
-    if (!validate_numeric_param(n_threads, 1, 128) || !validate_numeric_param(n_threads_batch, 1, 128)) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_get_score(vocab, token);
+    } catch (const std::exception& e) {
+        return 0.0f;
     }
-    
+}
+
+int32_t llamafu_token_get_attr(Llamafu llamafu, LlamafuToken token) {
+    if (!llamafu) {
+        return 0;
+    }
+
     try {
-        llama_set_n_threads(llamafu->ctx, n_threads, n_threads_batch);
-        return LLAMAFU_SUCCESS;
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return static_cast<int32_t>(llama_vocab_get_attr(vocab, token));
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        return 0;
     }
 }
 
-LlamafuError llamafu_get_n_threads(Llamafu llamafu, int32_t* out_n_threads, int32_t* out_n_threads_batch) {
-    if (!llamafu || !out_n_threads || !out_n_threads_batch) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+bool llamafu_token_is_eog(Llamafu llamafu, LlamafuToken token) {
+    if (!llamafu) {
+        return false;
     }
-    
+
     try {
-        *out_n_threads = llama_n_threads(llamafu->ctx);
-        *out_n_threads_batch = llama_n_threads_batch(llamafu->ctx);
-        return LLAMAFU_SUCCESS;
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_is_eog(vocab, token);
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        return false;
     }
 }
 
-LlamafuError llamafu_warmup(Llamafu llamafu) {
+bool llamafu_token_is_control(Llamafu llamafu, LlamafuToken token) {
     if (!llamafu) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+        return false;
     }
-    
+
     try {
-        // Create a small batch for warmup
-        std::vector<llama_token> tokens = {0, 1, 2, 3}; // Simple token sequence
-        llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
-        
-        // Save current KV cache state
-        llamafu_kv_cache_clear(llamafu);
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_is_control(vocab, token);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
 
-        // Perform warmup decode
-        llama_decode(llamafu->ctx, batch);
+// Special token functions
+LlamafuToken llamafu_token_bos(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
 
-        // Clear cache after warmup
-        llamafu_kv_cache_clear(llamafu);
-        
-        return LLAMAFU_SUCCESS;
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_bos(vocab);
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        return -1;
     }
 }
 
-LlamafuError llamafu_get_timings(Llamafu llamafu, LlamafuTimings* out_timings) {
-    if (!llamafu || !out_timings) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+LlamafuToken llamafu_token_eos(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
     }
 
     try {
-        // Simplified implementation - timing API not available in current llama.cpp
-        memset(out_timings, 0, sizeof(LlamafuTimings));
-        out_timings->t_start_ms = 0.0;
-        out_timings->t_end_ms = 0.0;
-        out_timings->t_load_ms = 0.0;
-        out_timings->t_sample_ms = 0.0;
-        out_timings->t_p_eval_ms = 0.0;
-        out_timings->t_eval_ms = 0.0;
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_eos(vocab);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
 
-        return LLAMAFU_SUCCESS;
+LlamafuToken llamafu_token_eot(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_eot(vocab);
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        return -1;
     }
 }
 
-void llamafu_reset_timings(Llamafu llamafu) {
-    if (llamafu) {
-        // Simplified implementation - timing API not available in current llama.cpp
-        // No-op for now
+LlamafuToken llamafu_token_sep(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_sep(vocab);
+    } catch (const std::exception& e) {
+        return -1;
     }
 }
 
-void llamafu_print_timings(Llamafu llamafu) {
-    if (llamafu) {
-        // Simplified implementation - timing API not available in current llama.cpp
-        // No-op for now
+LlamafuToken llamafu_token_nl(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_nl(vocab);
+    } catch (const std::exception& e) {
+        return -1;
     }
 }
 
-LlamafuError llamafu_get_system_info(LlamafuSystemInfo* out_info) {
-    if (!out_info) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+LlamafuToken llamafu_token_pad(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
     }
-    
+
     try {
-        const char* sys_info = llama_print_system_info();
-        if (sys_info) {
-            strncpy(out_info->system_info, sys_info, sizeof(out_info->system_info) - 1);
-            out_info->system_info[sizeof(out_info->system_info) - 1] = '\0';
-        } else {
-            strcpy(out_info->system_info, "System info not available");
-        }
-        
-        // Get CPU info
-        out_info->n_cpu_physical = std::thread::hardware_concurrency();
-        out_info->n_cpu_logical = std::thread::hardware_concurrency();
-        
-        return LLAMAFU_SUCCESS;
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        return llama_vocab_pad(vocab);
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        return -1;
     }
 }
 
-LlamafuError llamafu_bench_model(Llamafu llamafu, int32_t n_threads, int32_t n_predict, LlamafuBenchResult* out_result) {
-    if (!llamafu || !out_result) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+void llamafu_free_string(char* str) {
+    if (str) {
+        free(str);
     }
-    
-    if (!validate_numeric_param(n_threads, 1, 128) || !validate_numeric_param(n_predict, 1, 1024)) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+}
+
+void llamafu_free_tokens(LlamafuToken* tokens) {
+    if (tokens) {
+        free(tokens);
     }
-    
-    try {
-        // Save original thread count
-        int32_t orig_threads = llama_n_threads(llamafu->ctx);
-        int32_t orig_threads_batch = llama_n_threads_batch(llamafu->ctx);
-        
-        // Set benchmark thread count
-        llama_set_n_threads(llamafu->ctx, n_threads, n_threads);
-        
-        // Reset timings (simplified)
-        llamafu_reset_timings(llamafu);
+}
 
-        // Clear cache
-        llamafu_kv_cache_clear(llamafu);
-        
-        // Create benchmark prompt
-        const char* bench_prompt = "The quick brown fox jumps over the lazy dog. ";
+void llamafu_free_embeddings(float* embeddings) {
+    if (embeddings) {
+        free(embeddings);
+    }
+}
 
-        // Use modern tokenization API
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        std::vector<llama_token> tokens(256);  // Reserve space for tokens
-        int32_t n_tokens = llama_tokenize(vocab, bench_prompt, strlen(bench_prompt), tokens.data(), tokens.size(), true, true);
-        tokens.resize(n_tokens);
-        
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        // Prompt processing benchmark
-        if (llama_decode(llamafu->ctx, llama_batch_get_one(tokens.data(), tokens.size())) != 0) {
-            // Restore original settings
-            llama_set_n_threads(llamafu->ctx, orig_threads, orig_threads_batch);
-            return LLAMAFU_ERROR_UNKNOWN;
+static void detach_chat_sessions(Llamafu llamafu);
+static void reclaim_session_sequences(Llamafu llamafu);
+
+void llamafu_free(Llamafu llamafu) {
+    if (llamafu) {
+        // Stop the workers and finish outstanding queued and scheduled
+        // requests before the context goes away
+        request_queue_destroy(llamafu);
+        token_stream_detach(llamafu);
+        scheduler_destroy(llamafu);
+        detach_chat_sessions(llamafu);
+        speculative_free(llamafu);
+        delete llamafu->prompt_disk_cache;
+
+        // Free all loaded LoRA adapters
+        free_all_lora(llamafu);
+
+        // Free all samplers
+        for (auto& sampler : llamafu->samplers) {
+            llamafu_sampler_free(sampler);
         }
-        
-        auto prompt_time = std::chrono::high_resolution_clock::now();
+        llamafu->samplers.clear();
+        clear_grammar_cache(llamafu);
+        release_sampler(llamafu);
 
-        // Build sampler for generation benchmark
-        llama_sampler* smpl = build_sampler_chain(0.0f, 40, 0.95f, 1.1f, 42); // Greedy for deterministic benchmark
-        if (!smpl) {
-            llama_set_n_threads(llamafu->ctx, orig_threads, orig_threads_batch);
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        // Free the projector
+        if (llamafu->mtmd_ctx) {
+            mtmd_free(llamafu->mtmd_ctx);
         }
 
-        // Generation benchmark
-        for (int32_t i = 0; i < n_predict; ++i) {
-            llama_token new_token = llama_sampler_sample(smpl, llamafu->ctx, -1);
-            llama_sampler_accept(smpl, new_token);
+        // Clear image embeddings cache
+        clear_image_cache(llamafu);
 
-            if (llama_decode(llamafu->ctx, llama_batch_get_one(&new_token, 1)) != 0) {
-                break;
-            }
+        if (llamafu->ctx) {
+            llama_free(llamafu->ctx);
+        }
+        release_threadpools(llamafu);
+        discard_spilled_sequences(llamafu);
+        if (llamafu->shared_model) {
+            model_release(llamafu->shared_model);
         }
 
-        llama_sampler_free(smpl);
-        auto end_time = std::chrono::high_resolution_clock::now();
-        
-        // Calculate results
-        auto prompt_duration = std::chrono::duration_cast<std::chrono::milliseconds>(prompt_time - start_time).count();
-        auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-        auto generation_duration = total_duration - prompt_duration;
-        
-        out_result->prompt_tokens = static_cast<int32_t>(tokens.size());
-        out_result->prompt_time_ms = static_cast<float>(prompt_duration);
-        out_result->generation_tokens = n_predict;
-        out_result->generation_time_ms = static_cast<float>(generation_duration);
-        out_result->total_time_ms = static_cast<float>(total_duration);
-        
-        // Calculate speeds
-        out_result->prompt_speed_tps = out_result->prompt_time_ms > 0 ? 
-            (out_result->prompt_tokens * 1000.0f) / out_result->prompt_time_ms : 0.0f;
-        out_result->generation_speed_tps = out_result->generation_time_ms > 0 ? 
-            (out_result->generation_tokens * 1000.0f) / out_result->generation_time_ms : 0.0f;
-        
-        // Restore original thread settings
-        llama_set_n_threads(llamafu->ctx, orig_threads, orig_threads_batch);
-        
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        // Restore original settings on error
-        llama_set_n_threads(llamafu->ctx, llama_n_threads(llamafu->ctx), llama_n_threads_batch(llamafu->ctx));
-        return LLAMAFU_ERROR_UNKNOWN;
+        delete llamafu;
+        llama_backend_free();
     }
 }
 
-LlamafuError llamafu_set_abort_callback(Llamafu llamafu, LlamafuAbortCallback callback, void* user_data) {
+} // extern "C"
+
+// Context and memory management functions
+LlamafuMemory llamafu_get_memory(Llamafu llamafu) {
     if (!llamafu) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+        return nullptr;
     }
     
     try {
-        llamafu->abort_callback = callback;
-        llamafu->abort_callback_data = user_data;
-        return LLAMAFU_SUCCESS;
+        GenerationScope generation(llamafu);
+        return llama_get_memory(llamafu->ctx);
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        return nullptr;
     }
 }
 
-LlamafuError llamafu_set_log_callback(LlamafuLogCallback callback, void* user_data) {
-    try {
-        // Note: llama.cpp's log callback is global, not per-context
-        if (callback) {
-            llama_log_set([](ggml_log_level level, const char* text, void* user_data) {
-                LlamafuLogCallback cb = reinterpret_cast<LlamafuLogCallback>(user_data);
-                LlamafuLogLevel llamafu_level;
-                
-                switch (level) {
-                    case GGML_LOG_LEVEL_DEBUG: llamafu_level = LLAMAFU_LOG_DEBUG; break;
-                    case GGML_LOG_LEVEL_INFO:  llamafu_level = LLAMAFU_LOG_INFO; break;
-                    case GGML_LOG_LEVEL_WARN:  llamafu_level = LLAMAFU_LOG_WARN; break;
-                    case GGML_LOG_LEVEL_ERROR: llamafu_level = LLAMAFU_LOG_ERROR; break;
-                    default: llamafu_level = LLAMAFU_LOG_INFO; break;
-                }
-                
-                cb(llamafu_level, text, user_data);
-            }, reinterpret_cast<void*>(callback));
-        } else {
-            llama_log_set(nullptr, nullptr);
+void llamafu_memory_clear(LlamafuMemory memory, bool clear_data) {
+    if (memory) {
+        try {
+            llama_memory_clear(memory, clear_data);
+        } catch (const std::exception& e) {
+            // Ignore errors in memory clear
         }
-        
-        return LLAMAFU_SUCCESS;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-LlamafuError llamafu_get_memory_usage(Llamafu llamafu, LlamafuMemoryUsage* out_usage) {
-    if (!llamafu || !out_usage) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+bool llamafu_memory_seq_rm(LlamafuMemory memory, LlamafuSeqId seq_id, LlamafuPos p0, LlamafuPos p1) {
+    if (!memory) {
+        return false;
     }
     
     try {
-        // Get model memory usage
-        out_usage->model_size_bytes = llama_model_size(llamafu->model);
-        
-        // Get context memory usage (approximation)
-        int32_t n_ctx = llama_n_ctx(llamafu->ctx);
-        int32_t n_embd = llama_model_n_embd(llamafu->model);
-        int32_t n_layer = llama_model_n_layer(llamafu->model);
-        
-        // Estimate KV cache size (simplified calculation)
-        out_usage->kv_cache_size_bytes = static_cast<uint64_t>(n_ctx) * n_embd * n_layer * 2 * sizeof(float);
-        
-        // Estimate compute buffer size
-        out_usage->compute_buffer_size_bytes = static_cast<uint64_t>(n_ctx) * n_embd * sizeof(float) * 4;
-        
-        out_usage->total_size_bytes = out_usage->model_size_bytes + 
-                                     out_usage->kv_cache_size_bytes + 
-                                     out_usage->compute_buffer_size_bytes;
-        
-        return LLAMAFU_SUCCESS;
+        return llama_memory_seq_rm(memory, seq_id, p0, p1);
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+        return false;
     }
 }
 
-
-// =============================================================================
-// Base64 Encoding/Decoding Utilities
-// =============================================================================
-
-static const std::string base64_chars = 
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789+/";
-
-static inline bool is_base64(unsigned char c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
+void llamafu_memory_seq_cp(LlamafuMemory memory, LlamafuSeqId seq_id_src, LlamafuSeqId seq_id_dst, LlamafuPos p0, LlamafuPos p1) {
+    if (!memory) {
+        return;
+    }
+    
+    try {
+        llama_memory_seq_cp(memory, seq_id_src, seq_id_dst, p0, p1);
+    } catch (const std::exception& e) {
+        // Ignore errors in memory copy
+    }
 }
 
-static std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for (i = 0; (i < 4) ; i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
+void llamafu_memory_seq_keep(LlamafuMemory memory, LlamafuSeqId seq_id) {
+    if (!memory) {
+        return;
     }
-
-    if (i) {
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
-
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
-
-        for (j = 0; (j < i + 1); j++)
-            ret += base64_chars[char_array_4[j]];
-
-        while ((i++ < 3))
-            ret += '=';
+    
+    try {
+        llama_memory_seq_keep(memory, seq_id);
+    } catch (const std::exception& e) {
+        // Ignore errors in memory keep
     }
-
-    return ret;
 }
 
-static std::vector<unsigned char> base64_decode(std::string const& encoded_string) {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::vector<unsigned char> ret;
-
-    while (in_len-- && (encoded_string[in] != '=') && is_base64(encoded_string[in])) {
-        char_array_4[i++] = encoded_string[in]; in++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-                ret.push_back(char_array_3[i]);
-            i = 0;
-        }
+void llamafu_memory_seq_add(LlamafuMemory memory, LlamafuSeqId seq_id, LlamafuPos p0, LlamafuPos p1, LlamafuPos delta) {
+    if (!memory) {
+        return;
     }
-
-    if (i) {
-        for (j = i; j < 4; j++)
-            char_array_4[j] = 0;
-
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
-
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-        for (j = 0; (j < i - 1); j++) ret.push_back(char_array_3[j]);
+    
+    try {
+        llama_memory_seq_add(memory, seq_id, p0, p1, delta);
+    } catch (const std::exception& e) {
+        // Ignore errors in memory add
     }
-
-    return ret;
 }
 
-// =============================================================================
-// Image Format Detection and Validation
-// =============================================================================
+void llamafu_memory_seq_div(LlamafuMemory memory, LlamafuSeqId seq_id, LlamafuPos p0, LlamafuPos p1, int32_t d) {
+    if (!memory || d <= 0) {
+        return;
+    }
+    
+    try {
+        llama_memory_seq_div(memory, seq_id, p0, p1, d);
+    } catch (const std::exception& e) {
+        // Ignore errors in memory div
+    }
+}
 
-static LlamafuImageFormat detect_image_format_from_header(const unsigned char* data, size_t size) {
-    if (size < 4) return LLAMAFU_IMAGE_FORMAT_AUTO;
+LlamafuPos llamafu_memory_seq_pos_min(LlamafuMemory memory, LlamafuSeqId seq_id) {
+    if (!memory) {
+        return -1;
+    }
+    
+    try {
+        return llama_memory_seq_pos_min(memory, seq_id);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
 
-    // JPEG magic numbers
-    if (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
-        return LLAMAFU_IMAGE_FORMAT_JPEG;
+LlamafuPos llamafu_memory_seq_pos_max(LlamafuMemory memory, LlamafuSeqId seq_id) {
+    if (!memory) {
+        return -1;
+    }
+    
+    try {
+        return llama_memory_seq_pos_max(memory, seq_id);
+    } catch (const std::exception& e) {
+        return -1;
     }
+}
 
-    // PNG magic number
-    if (size >= 8 && data[0] == 0x89 && data[1] == 0x50 && data[2] == 0x4E && data[3] == 0x47 &&
-        data[4] == 0x0D && data[5] == 0x0A && data[6] == 0x1A && data[7] == 0x0A) {
-        return LLAMAFU_IMAGE_FORMAT_PNG;
+bool llamafu_memory_can_shift(LlamafuMemory memory) {
+    if (!memory) {
+        return false;
+    }
+    
+    try {
+        return llama_memory_can_shift(memory);
+    } catch (const std::exception& e) {
+        return false;
     }
+}
 
-    // BMP magic number
-    if (data[0] == 0x42 && data[1] == 0x4D) {
-        return LLAMAFU_IMAGE_FORMAT_BMP;
+void llamafu_set_warmup(Llamafu llamafu, bool warmup) {
+    if (!llamafu) {
+        return;
+    }
+    
+    try {
+        GenerationScope generation(llamafu);
+        llama_set_warmup(llamafu->ctx, warmup);
+    } catch (const std::exception& e) {
+        // Ignore errors in warmup setting
     }
+}
 
-    // WebP magic number
-    if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0) {
-        return LLAMAFU_IMAGE_FORMAT_WEBP;
+size_t llamafu_get_state_size(Llamafu llamafu) {
+    if (!llamafu) {
+        return 0;
     }
 
-    return LLAMAFU_IMAGE_FORMAT_AUTO;
+    try {
+        GenerationScope generation(llamafu);
+        return llama_state_get_size(llamafu->ctx);
+    } catch (const std::exception& e) {
+        return 0;
+    }
 }
 
-static LlamafuImageFormat detect_format_from_extension(const char* file_path) {
-    if (!file_path) return LLAMAFU_IMAGE_FORMAT_AUTO;
-
-    std::string path(file_path);
-    std::string ext;
+size_t llamafu_copy_state_data(Llamafu llamafu, uint8_t* dest) {
+    if (!llamafu || !dest) {
+        return 0;
+    }
 
-    // Extract extension
-    size_t dot_pos = path.find_last_of('.');
-    if (dot_pos != std::string::npos) {
-        ext = path.substr(dot_pos + 1);
-        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    try {
+        GenerationScope generation(llamafu);
+        return llama_state_get_data(llamafu->ctx, dest, llama_state_get_size(llamafu->ctx));
+    } catch (const std::exception& e) {
+        return 0;
     }
+}
 
-    if (ext == "jpg" || ext == "jpeg") return LLAMAFU_IMAGE_FORMAT_JPEG;
-    if (ext == "png") return LLAMAFU_IMAGE_FORMAT_PNG;
-    if (ext == "bmp") return LLAMAFU_IMAGE_FORMAT_BMP;
-    if (ext == "webp") return LLAMAFU_IMAGE_FORMAT_WEBP;
+size_t llamafu_set_state_data(Llamafu llamafu, const uint8_t* src) {
+    if (!llamafu || !src) {
+        return 0;
+    }
 
-    return LLAMAFU_IMAGE_FORMAT_AUTO;
+    try {
+        GenerationScope generation(llamafu);
+        invalidate_prompt_cache(llamafu);
+        return llama_state_set_data(llamafu->ctx, src, llama_state_get_size(llamafu->ctx));
+    } catch (const std::exception& e) {
+        return 0;
+    }
 }
 
-// =============================================================================
-// Image Loading and Conversion Utilities
-// =============================================================================
-
-static LlamafuError load_file_to_memory(const char* file_path, std::vector<unsigned char>& buffer) {
-    std::ifstream file(file_path, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        return LLAMAFU_ERROR_FILE_NOT_FOUND;
+bool llamafu_load_session_file(Llamafu llamafu, const char* path_session, LlamafuToken* tokens_out, size_t n_token_capacity, size_t* n_token_count_out) {
+    if (!llamafu || !validate_string_param(path_session, "path_session") || !tokens_out || !n_token_count_out) {
+        return false;
     }
 
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    try {
+        GenerationScope generation(llamafu);
+        invalidate_prompt_cache(llamafu);
+        return llama_state_load_file(llamafu->ctx, path_session, tokens_out, n_token_capacity, n_token_count_out);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
 
-    buffer.resize(size);
-    if (!file.read(reinterpret_cast<char*>(buffer.data()), size)) {
-        return LLAMAFU_ERROR_FILE_READ_FAILED;
+bool llamafu_save_session_file(Llamafu llamafu, const char* path_session, const LlamafuToken* tokens, size_t n_token_count) {
+    if (!llamafu || !validate_string_param(path_session, "path_session") || !tokens) {
+        return false;
     }
 
-    return LLAMAFU_SUCCESS;
+    try {
+        GenerationScope generation(llamafu);
+        return llama_state_save_file(llamafu->ctx, path_session, tokens, n_token_count);
+    } catch (const std::exception& e) {
+        return false;
+    }
 }
 
 
-// =============================================================================
-// Enhanced Multimodal API Implementation
-// =============================================================================
-
-LlamafuError llamafu_image_validate(const LlamafuMediaInput* input, LlamafuImageValidation* out_validation) {
-    if (!input || !out_validation) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Model introspection functions
+int32_t llamafu_model_n_ctx_train(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
     }
+    
+    try {
+        return llama_model_n_ctx_train(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
 
-    memset(out_validation, 0, sizeof(LlamafuImageValidation));
-
+int32_t llamafu_model_n_embd(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
     try {
-        std::vector<unsigned char> image_data;
-        
-        // Load image data based on source type
+        return llama_model_n_embd(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_model_n_layer(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_n_layer(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_model_n_head(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_n_head(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_model_n_head_kv(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_n_head_kv(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_model_n_swa(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_n_swa(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+float llamafu_model_rope_freq_scale_train(Llamafu llamafu) {
+    if (!llamafu) {
+        return 0.0f;
+    }
+    
+    try {
+        return llama_model_rope_freq_scale_train(llamafu->model);
+    } catch (const std::exception& e) {
+        return 0.0f;
+    }
+}
+
+int32_t llamafu_model_rope_type(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        return static_cast<int32_t>(llama_model_rope_type(llamafu->model));
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+uint64_t llamafu_model_size(Llamafu llamafu) {
+    if (!llamafu) {
+        return 0;
+    }
+    
+    try {
+        return llama_model_size(llamafu->model);
+    } catch (const std::exception& e) {
+        return 0;
+    }
+}
+
+uint64_t llamafu_model_n_params(Llamafu llamafu) {
+    if (!llamafu) {
+        return 0;
+    }
+    
+    try {
+        return llama_model_n_params(llamafu->model);
+    } catch (const std::exception& e) {
+        return 0;
+    }
+}
+
+bool llamafu_model_has_encoder(Llamafu llamafu) {
+    if (!llamafu) {
+        return false;
+    }
+    
+    try {
+        return llama_model_has_encoder(llamafu->model);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+bool llamafu_model_has_decoder(Llamafu llamafu) {
+    if (!llamafu) {
+        return false;
+    }
+    
+    try {
+        return llama_model_has_decoder(llamafu->model);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+LlamafuToken llamafu_model_decoder_start_token(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_decoder_start_token(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+bool llamafu_model_is_recurrent(Llamafu llamafu) {
+    if (!llamafu) {
+        return false;
+    }
+    
+    try {
+        return llama_model_is_recurrent(llamafu->model);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+bool llamafu_model_is_diffusion(Llamafu llamafu) {
+    if (!llamafu) {
+        return false;
+    }
+    
+    try {
+        return llama_model_is_diffusion(llamafu->model);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+int32_t llamafu_model_desc(Llamafu llamafu, char* buf, size_t buf_size) {
+    if (!llamafu || !buf || buf_size == 0) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_desc(llamafu->model, buf, buf_size);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+const char* llamafu_model_chat_template(Llamafu llamafu, const char* name) {
+    if (!llamafu) {
+        return nullptr;
+    }
+    
+    try {
+        return llama_model_chat_template(llamafu->model, name);
+    } catch (const std::exception& e) {
+        return nullptr;
+    }
+}
+
+// Model metadata functions
+int32_t llamafu_model_meta_count(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_meta_count(llamafu->model);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_model_meta_key_by_index(Llamafu llamafu, int32_t i, char* buf, size_t buf_size) {
+    if (!llamafu || !buf || buf_size == 0 || i < 0) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_meta_key_by_index(llamafu->model, i, buf, buf_size);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_model_meta_val_str_by_index(Llamafu llamafu, int32_t i, char* buf, size_t buf_size) {
+    if (!llamafu || !buf || buf_size == 0 || i < 0) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_meta_val_str_by_index(llamafu->model, i, buf, buf_size);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_model_meta_val_str(Llamafu llamafu, const char* key, char* buf, size_t buf_size) {
+    if (!llamafu || !validate_string_param(key, "key") || !buf || buf_size == 0) {
+        return -1;
+    }
+    
+    try {
+        return llama_model_meta_val_str(llamafu->model, key, buf, buf_size);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+// Vocabulary introspection
+int32_t llamafu_vocab_type(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        if (!vocab) {
+            return -1;
+        }
+        return static_cast<int32_t>(llama_vocab_type(vocab));
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+int32_t llamafu_vocab_n_tokens(Llamafu llamafu) {
+    if (!llamafu) {
+        return -1;
+    }
+    
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        if (!vocab) {
+            return -1;
+        }
+        return llama_vocab_n_tokens(vocab);
+    } catch (const std::exception& e) {
+        return -1;
+    }
+}
+
+const char* llamafu_vocab_get_text(Llamafu llamafu, LlamafuToken token) {
+    if (!llamafu) {
+        return nullptr;
+    }
+    
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        if (!vocab) {
+            return nullptr;
+        }
+        return llama_vocab_get_text(vocab, token);
+    } catch (const std::exception& e) {
+        return nullptr;
+    }
+}
+
+bool llamafu_vocab_get_add_bos(Llamafu llamafu) {
+    if (!llamafu) {
+        return false;
+    }
+    
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        if (!vocab) {
+            return false;
+        }
+        return llama_vocab_get_add_bos(vocab);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+bool llamafu_vocab_get_add_eos(Llamafu llamafu) {
+    if (!llamafu) {
+        return false;
+    }
+    
+    try {
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        if (!vocab) {
+            return false;
+        }
+        return llama_vocab_get_add_eos(vocab);
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+// Advanced model introspection
+uint32_t llamafu_model_n_cls_out(Llamafu llamafu) {
+    if (!llamafu) {
+        return 0;
+    }
+    
+    try {
+        return llama_model_n_cls_out(llamafu->model);
+    } catch (const std::exception& e) {
+        return 0;
+    }
+}
+
+const char* llamafu_model_cls_label(Llamafu llamafu, uint32_t i) {
+    if (!llamafu) {
+        return nullptr;
+    }
+    
+    try {
+        return llama_model_cls_label(llamafu->model, i);
+    } catch (const std::exception& e) {
+        return nullptr;
+    }
+}
+
+
+// Text generation functions
+float* llamafu_get_logits(Llamafu llamafu) {
+    if (!llamafu) {
+        return nullptr;
+    }
+    
+    try {
+        GenerationScope generation(llamafu);
+        return llama_get_logits(llamafu->ctx);
+    } catch (const std::exception& e) {
+        return nullptr;
+    }
+}
+
+float* llamafu_get_logits_ith(Llamafu llamafu, int32_t i) {
+    if (!llamafu || i < 0) {
+        return nullptr;
+    }
+    
+    try {
+        GenerationScope generation(llamafu);
+        return llama_get_logits_ith(llamafu->ctx, i);
+    } catch (const std::exception& e) {
+        return nullptr;
+    }
+}
+
+// Advanced text generation with sampling
+LlamafuError llamafu_generate_text(Llamafu llamafu, const char* prompt, LlamafuInferParams* params, char** out_result) {
+    if (!llamafu || !validate_string_param(prompt, "prompt") || !params || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!validate_numeric_param(params->max_tokens, 1, 32768) ||
+        !validate_float_param(params->temperature, 0.0f, 2.0f) ||
+        !validate_float_param(params->top_p, 0.0f, 1.0f) ||
+        !validate_numeric_param(params->top_k, 1, 200)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+    }
+
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        // Same path as llamafu_complete, with the prompt given separately
+        LlamafuInferParams generate_params = *params;
+        generate_params.prompt = prompt;
+
+        std::string result;
+        LlamafuError err = complete_text(llamafu, &generate_params, result);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+
+        *out_result = static_cast<char*>(malloc(result.length() + 1));
+        if (!*out_result) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+
+        strcpy(*out_result, result.c_str());
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// Streaming text generation - stub implementation
+LlamafuError llamafu_generate_text_streaming(Llamafu llamafu, const char* prompt, LlamafuInferParams* params,
+                                       void* callback, void* user_data) {
+    // Streaming not fully implemented yet
+    (void)llamafu;
+    (void)prompt;
+    (void)params;
+    (void)callback;
+    (void)user_data;
+    return LLAMAFU_ERROR_UNKNOWN;
+}
+
+// Simple completion with default parameters
+LlamafuError llamafu_complete_simple(Llamafu llamafu, const char* prompt, int32_t max_tokens, char** out_result) {
+    if (!llamafu || !validate_string_param(prompt, "prompt") || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    LlamafuInferParams params = {};
+    params.prompt = prompt;
+    params.max_tokens = max_tokens > 0 ? max_tokens : 128;
+    params.temperature = 0.7f;
+    params.top_p = 0.9f;
+    params.top_k = 40;
+    params.repeat_penalty = 1.1f;
+    params.frequency_penalty = 0.0f;
+    params.presence_penalty = 0.0f;
+    // params.stop_on_eos = true;  // Field doesn't exist in struct
+    // params.include_prompt = false;  // Field doesn't exist in struct
+
+    return llamafu_complete(llamafu, &params, out_result);
+}
+
+
+// =============================================================================
+// Performance and Threading Controls
+// =============================================================================
+
+LlamafuError llamafu_set_n_threads(Llamafu llamafu, int32_t n_threads, int32_t n_threads_batch) {
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    
+    if (!validate_numeric_param(n_threads, 1, 128) || !validate_numeric_param(n_threads_batch, 1, 128)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    
+    try {
+        if (llamafu->ctx) {
+            llama_set_n_threads(llamafu->ctx, n_threads, n_threads_batch);
+        }
+        llamafu->llama_ctx_params.n_threads = n_threads;  // Kept across llamafu_swap_model and releases
+        llamafu->llama_ctx_params.n_threads_batch = n_threads_batch;
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_get_n_threads(Llamafu llamafu, int32_t* out_n_threads, int32_t* out_n_threads_batch) {
+    if (!llamafu || !out_n_threads || !out_n_threads_batch) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        GenerationScope generation(llamafu);
+        *out_n_threads = llama_n_threads(llamafu->ctx);
+        *out_n_threads_batch = llama_n_threads_batch(llamafu->ctx);
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_warmup(Llamafu llamafu) {
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        GenerationScope generation(llamafu);
+        // Create a small batch for warmup
+        std::vector<llama_token> tokens = {0, 1, 2, 3}; // Simple token sequence
+        llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
+        
+        // Save current KV cache state
+        clear_kv_cache(llamafu);
+
+        // Perform warmup decode
+        llama_decode(llamafu->ctx, batch);
+
+        // Clear cache after warmup
+        clear_kv_cache(llamafu);
+        
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_get_timings(Llamafu llamafu, LlamafuTimings* out_timings) {
+    if (!llamafu || !out_timings) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        // Decode times are the context's totals since the last reset; the
+        // rest describes the last request
+        const llama_perf_context_data perf = llamafu->ctx ? llama_perf_context(llamafu->ctx) : llama_perf_context_data{};
+        memset(out_timings, 0, sizeof(LlamafuTimings));
+        std::lock_guard<std::mutex> metrics_lock(llamafu->metrics_mutex);
+        out_timings->t_start_ms = llamafu->t_request_start_ms;
+        out_timings->t_end_ms = llamafu->t_request_end_ms;
+        out_timings->t_load_ms = llamafu->metrics.t_load_weights_ms + llamafu->metrics.t_load_vocab_ms +
+                                 llamafu->metrics.t_load_context_ms;
+        out_timings->t_sample_ms = llamafu->metrics.t_sample_ms;
+        out_timings->t_p_eval_ms = perf.t_p_eval_ms;
+        out_timings->t_eval_ms = perf.t_eval_ms;
+        out_timings->n_sample = llamafu->metrics.n_sample;
+        out_timings->n_p_eval = perf.n_p_eval;
+        out_timings->n_eval = perf.n_eval;
+
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// Load phases stay: they describe the handle, not its requests. Waits for
+// a running request rather than dropping the reset.
+void llamafu_reset_timings(Llamafu llamafu) {
+    if (!llamafu) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(llamafu->generation_mutex);
+    if (llamafu->ctx) {
+        llama_perf_context_reset(llamafu->ctx);
+    }
+    std::lock_guard<std::mutex> metrics_lock(llamafu->metrics_mutex);
+    LlamafuRequestMetrics& m = llamafu->metrics;
+    LlamafuRequestMetrics reset = {};
+    reset.t_load_weights_ms = m.t_load_weights_ms;
+    reset.t_load_vocab_ms = m.t_load_vocab_ms;
+    reset.t_load_context_ms = m.t_load_context_ms;
+    reset.t_load_mmproj_ms = m.t_load_mmproj_ms;
+    m = reset;
+}
+
+void llamafu_print_timings(Llamafu llamafu) {
+    if (!llamafu) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(llamafu->generation_mutex);
+    if (llamafu->ctx) {
+        llama_perf_context_print(llamafu->ctx);
+    }
+}
+
+LlamafuError llamafu_get_system_info(LlamafuSystemInfo* out_info) {
+    if (!out_info) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        const char* sys_info = llama_print_system_info();
+        if (sys_info) {
+            strncpy(out_info->system_info, sys_info, sizeof(out_info->system_info) - 1);
+            out_info->system_info[sizeof(out_info->system_info) - 1] = '\0';
+        } else {
+            strcpy(out_info->system_info, "System info not available");
+        }
+        
+        // Get CPU info
+        out_info->n_cpu_physical = std::thread::hardware_concurrency();
+        out_info->n_cpu_logical = std::thread::hardware_concurrency();
+        
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// Sets the context up for a benchmark: thread counts are overridden and
+// sequence 0 is saved and emptied. Both are put back on destruction, so a
+// benchmark leaves the cached prompt where it was.
+struct BenchContextGuard {
+    Llamafu llamafu;
+    int32_t n_threads;
+    int32_t n_threads_batch;
+    std::vector<uint8_t> seq_state;
+
+    BenchContextGuard(Llamafu handle, int32_t bench_threads)
+        : llamafu(handle),
+          n_threads(llama_n_threads(handle->ctx)),
+          n_threads_batch(llama_n_threads_batch(handle->ctx)) {
+        if (bench_threads > 0) {
+            llama_set_n_threads(llamafu->ctx, bench_threads, bench_threads);
+        }
+        if (!llamafu->cached_tokens.empty()) {
+            seq_state.resize(llama_state_seq_get_size(llamafu->ctx, 0));
+            if (llama_state_seq_get_data(llamafu->ctx, seq_state.data(), seq_state.size(), 0) != seq_state.size()) {
+                seq_state.clear();
+            }
+        }
+        clear();
+    }
+
+    ~BenchContextGuard() {
+        clear();
+        llama_set_n_threads(llamafu->ctx, n_threads, n_threads_batch);
+        if (seq_state.empty() ||
+            llama_state_seq_set_data(llamafu->ctx, seq_state.data(), seq_state.size(), 0) != seq_state.size()) {
+            clear();
+            llamafu->cached_tokens.clear();
+            llamafu->n_reused_last = 0;
+        }
+    }
+
+    void clear() {
+        llama_memory_seq_rm(llama_get_memory(llamafu->ctx), 0, -1, -1);
+    }
+};
+
+static void fill_bench_stats(const std::vector<double>& run_ms, std::vector<double> token_ms, int32_t n_tokens,
+                             LlamafuBenchStats& out) {
+    out = {};
+    out.n_tokens = n_tokens;
+    out.n_samples = static_cast<int32_t>(run_ms.size());
+    if (run_ms.empty()) {
+        return;
+    }
+
+    double sum_ms = 0.0, sum_tps = 0.0;
+    for (double ms : run_ms) {
+        sum_ms += ms;
+        sum_tps += ms > 0.0 ? n_tokens * 1000.0 / ms : 0.0;
+    }
+    out.mean_ms = sum_ms / run_ms.size();
+    out.mean_tps = sum_tps / run_ms.size();
+
+    // Sample standard deviation, as llama-bench reports
+    if (run_ms.size() > 1) {
+        double var_ms = 0.0, var_tps = 0.0;
+        for (double ms : run_ms) {
+            const double tps = ms > 0.0 ? n_tokens * 1000.0 / ms : 0.0;
+            var_ms += (ms - out.mean_ms) * (ms - out.mean_ms);
+            var_tps += (tps - out.mean_tps) * (tps - out.mean_tps);
+        }
+        out.stddev_ms = std::sqrt(var_ms / (run_ms.size() - 1));
+        out.stddev_tps = std::sqrt(var_tps / (run_ms.size() - 1));
+    }
+
+    std::sort(token_ms.begin(), token_ms.end());
+    out.p50_ms = percentile(token_ms, 0.50);
+    out.p99_ms = percentile(token_ms, 0.99);
+}
+
+LlamafuError llamafu_bench_model(Llamafu llamafu, int32_t n_threads, int32_t n_predict, LlamafuBenchResult* out_result) {
+    if (!llamafu || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    
+    if (!validate_numeric_param(n_threads, 1, 128) || !validate_numeric_param(n_predict, 1, 1024)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        GenerationScope generation(llamafu);
+        BenchContextGuard guard(llamafu, n_threads);
+
+        // Create benchmark prompt
+        const char* bench_prompt = "The quick brown fox jumps over the lazy dog. ";
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        std::vector<llama_token> tokens;
+        if (tokenize_text(vocab, bench_prompt, static_cast<int32_t>(strlen(bench_prompt)), true, true, tokens) <= 0) {
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
+        const int32_t n_predict_max =
+            std::min<int32_t>(n_predict, static_cast<int32_t>(llama_n_ctx(llamafu->ctx)) - tokens.size());
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        // Prompt processing benchmark
+        int32_t ret = llama_decode(llamafu->ctx, llama_batch_get_one(tokens.data(), tokens.size()));
+        if (ret != 0) {
+            return decode_error(ret);
+        }
+        llama_synchronize(llamafu->ctx);
+
+        auto prompt_time = std::chrono::steady_clock::now();
+
+        // Greedy for a deterministic benchmark
+        SamplerConfig bench_config;
+        bench_config.temperature = 0.0f;
+        std::unique_ptr<SamplerPipeline> smpl(build_sampler_pipeline(vocab, bench_config));
+        if (!smpl) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+
+        // Generation benchmark; only tokens that were decoded count
+        int32_t n_generated = 0;
+        for (; n_generated < n_predict_max; ++n_generated) {
+            llama_token new_token = sampler_pipeline_sample(smpl.get(), llamafu->ctx, -1);
+
+            ret = llama_decode(llamafu->ctx, llama_batch_get_one(&new_token, 1));
+            if (ret == 2) {
+                return LLAMAFU_ERROR_ABORTED;
+            }
+            if (ret != 0) {
+                break;
+            }
+        }
+        llama_synchronize(llamafu->ctx);
+
+        smpl.reset();
+        auto end_time = std::chrono::steady_clock::now();
+
+        out_result->prompt_tokens = static_cast<int32_t>(tokens.size());
+        out_result->prompt_time_ms = static_cast<float>(elapsed_ms(start_time, prompt_time));
+        out_result->generation_tokens = n_generated;
+        out_result->generation_time_ms = static_cast<float>(elapsed_ms(prompt_time, end_time));
+        out_result->total_time_ms = static_cast<float>(elapsed_ms(start_time, end_time));
+        
+        // Calculate speeds
+        out_result->prompt_speed_tps = out_result->prompt_time_ms > 0 ? 
+            (out_result->prompt_tokens * 1000.0f) / out_result->prompt_time_ms : 0.0f;
+        out_result->generation_speed_tps = out_result->generation_time_ms > 0 ? 
+            (out_result->generation_tokens * 1000.0f) / out_result->generation_time_ms : 0.0f;
+
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_bench_run(Llamafu llamafu, const LlamafuBenchParams* params, LlamafuBenchStats* out_prompt,
+                               LlamafuBenchStats* out_generation) {
+    if (!llamafu || !params || !out_prompt || !out_generation) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        const int32_t n_ctx = static_cast<int32_t>(llama_n_ctx(llamafu->ctx));
+        const int32_t n_batch_max = static_cast<int32_t>(llama_n_batch(llamafu->ctx));
+        const int32_t n_batch = params->n_batch > 0 ? params->n_batch : n_batch_max;
+        if (!validate_numeric_param(params->n_prompt, 0, n_ctx) || !validate_numeric_param(params->n_gen, 0, n_ctx) ||
+            params->n_prompt + params->n_gen < 1 || params->n_prompt + params->n_gen > n_ctx ||
+            !validate_numeric_param(n_batch, 1, n_batch_max) ||
+            (params->n_threads > 0 && !validate_numeric_param(params->n_threads, 1, 128)) ||
+            !validate_numeric_param(params->repetitions, 1, 1000) || !validate_numeric_param(params->warmup, 0, 100)) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        BenchContextGuard guard(llamafu, params->n_threads);
+
+        // Random tokens after BOS, as llama-bench does: the tokenizer and
+        // sampler stay out of the measurement
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+        const llama_token bos = llama_vocab_bos(vocab) != LLAMA_TOKEN_NULL ? llama_vocab_bos(vocab) : 0;
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<llama_token> random_token(0, n_vocab - 1);
+
+        std::vector<llama_token> batch(n_batch);
+        std::vector<double> pp_runs, tg_runs, pp_token_ms, tg_token_ms;
+        for (int32_t rep = -params->warmup; rep < params->repetitions; ++rep) {
+            guard.clear();
+
+            const auto pp_start = std::chrono::steady_clock::now();
+            for (int32_t pos = 0; pos < params->n_prompt; pos += n_batch) {
+                const int32_t n = std::min(n_batch, params->n_prompt - pos);
+                for (int32_t i = 0; i < n; ++i) {
+                    batch[i] = pos + i == 0 ? bos : random_token(rng);
+                }
+                const int32_t ret = llama_decode(llamafu->ctx, llama_batch_get_one(batch.data(), n));
+                if (ret != 0) {
+                    return decode_error(ret);
+                }
+            }
+            llama_synchronize(llamafu->ctx);
+            const auto pp_end = std::chrono::steady_clock::now();
+
+            llama_token token = params->n_prompt > 0 ? random_token(rng) : bos;
+            auto step_start = pp_end;
+            for (int32_t i = 0; i < params->n_gen; ++i) {
+                const int32_t ret = llama_decode(llamafu->ctx, llama_batch_get_one(&token, 1));
+                if (ret != 0) {
+                    return decode_error(ret);
+                }
+                llama_synchronize(llamafu->ctx);
+                const auto step_end = std::chrono::steady_clock::now();
+                if (rep >= 0) {
+                    tg_token_ms.push_back(elapsed_ms(step_start, step_end));
+                }
+                step_start = step_end;
+                token = random_token(rng);
+            }
+
+            if (rep < 0) {
+                continue;
+            }
+            if (params->n_prompt > 0) {
+                pp_runs.push_back(elapsed_ms(pp_start, pp_end));
+                pp_token_ms.push_back(pp_runs.back() / params->n_prompt);
+            }
+            if (params->n_gen > 0) {
+                tg_runs.push_back(elapsed_ms(pp_end, step_start));
+            }
+        }
+
+        fill_bench_stats(pp_runs, std::move(pp_token_ms), params->n_prompt, *out_prompt);
+        fill_bench_stats(tg_runs, std::move(tg_token_ms), params->n_gen, *out_generation);
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_set_abort_callback(Llamafu llamafu, LlamafuAbortCallback callback, void* user_data) {
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        std::lock_guard<std::mutex> lock(llamafu->abort_mutex);
+        llamafu->abort_callback = callback;
+        llamafu->abort_callback_data = user_data;
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_set_log_callback(LlamafuLogCallback callback, void* user_data) {
+    try {
+        // Note: llama.cpp's log callback is global, not per-context; lines are
+        // routed through llamafu_log_dispatch, which falls back to stderr
+        {
+            std::lock_guard<std::mutex> lock(g_log_mutex);
+            g_log_callback = callback;
+            g_log_callback_data = user_data;
+        }
+        install_log_dispatch();
+
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_get_memory_usage(Llamafu llamafu, LlamafuMemoryUsage* out_usage) {
+    if (!llamafu || !out_usage) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        memset(out_usage, 0, sizeof(*out_usage));
+
+        const std::vector<BufferRecord> buffers = handle_buffers(llamafu);
+        if (!buffers.empty()) {
+            for (const BufferRecord& buffer : buffers) {
+                switch (buffer.kind) {
+                    case LLAMAFU_BUFFER_WEIGHTS:
+                        (is_host_buffer(buffer.buffer_type) ? out_usage->model_host_bytes
+                                                            : out_usage->model_device_bytes) += buffer.size_bytes;
+                        break;
+                    case LLAMAFU_BUFFER_KV_CACHE:
+                    case LLAMAFU_BUFFER_RECURRENT_STATE:
+                        out_usage->kv_cache_size_bytes += buffer.size_bytes;
+                        break;
+                    case LLAMAFU_BUFFER_OUTPUT:
+                        out_usage->output_buffer_bytes += buffer.size_bytes;
+                        break;
+                    case LLAMAFU_BUFFER_COMPUTE:
+                        out_usage->compute_buffer_size_bytes += buffer.size_bytes;
+                        break;
+                    case LLAMAFU_BUFFER_LORA:
+                        break;  // Counted per adapter below
+                }
+            }
+            out_usage->model_size_bytes = out_usage->model_host_bytes + out_usage->model_device_bytes;
+            out_usage->measured = 1;
+        } else {
+            // llama.cpp logged nothing we could read (e.g. its log level
+            // filters the lines); estimate from the model's dimensions
+            const ModelShape shape = model_shape(llamafu->model);
+            out_usage->model_size_bytes = llama_model_size(llamafu->model);
+            out_usage->model_host_bytes = out_usage->model_size_bytes;
+            if (llamafu->ctx) {  // Nothing while released
+                const uint32_t n_ctx = llama_n_ctx(llamafu->ctx);
+                out_usage->kv_cache_size_bytes = estimate_kv_bytes(shape, n_ctx, llamafu->type_k, llamafu->type_v);
+                out_usage->compute_buffer_size_bytes =
+                    estimate_compute_bytes(shape, n_ctx, llama_n_ubatch(llamafu->ctx), false);
+                out_usage->output_buffer_bytes = estimate_output_bytes(shape, llama_n_seq_max(llamafu->ctx));
+            }
+        }
+
+        out_usage->clip_size_bytes = llamafu->clip_size_bytes;
+        out_usage->lora_bytes = lora_resident_bytes(llamafu);
+        out_usage->total_size_bytes = out_usage->model_size_bytes +
+                                      out_usage->kv_cache_size_bytes +
+                                      out_usage->compute_buffer_size_bytes +
+                                      out_usage->output_buffer_bytes +
+                                      out_usage->clip_size_bytes +
+                                      out_usage->lora_bytes;
+        process_memory(&out_usage->rss_bytes, &out_usage->peak_rss_bytes);
+
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_get_buffer_info(Llamafu llamafu, LlamafuBufferInfo* out_buffers, int32_t capacity,
+                                     int32_t* out_count) {
+    if (!llamafu || !out_count || capacity < 0 || (capacity > 0 && !out_buffers)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    const std::vector<BufferRecord> buffers = handle_buffers(llamafu);
+    const int32_t n = static_cast<int32_t>(buffers.size());
+    for (int32_t i = 0; i < std::min(n, capacity); i++) {
+        const BufferRecord& buffer = buffers[i];
+        LlamafuBufferInfo& info = out_buffers[i];
+        memset(&info, 0, sizeof(info));
+        strncpy(info.buffer_type, buffer.buffer_type.c_str(), sizeof(info.buffer_type) - 1);
+        info.kind = buffer.kind;
+        info.is_host = is_host_buffer(buffer.buffer_type);
+        info.size_bytes = buffer.size_bytes;
+    }
+    *out_count = n;
+    return LLAMAFU_SUCCESS;
+}
+
+LlamafuError llamafu_estimate_memory(const LlamafuModelParams* params, const LlamafuContextParams* context_params,
+                                     uint64_t budget_bytes, LlamafuMemoryUsage* out_estimate, bool* out_fits) {
+    if (!params || !out_estimate || !validate_string_param(params->model_path, "model_path")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        ModelShape shape;
+        uint64_t weight_bytes = 0;
+        if (!gguf_model_shape(params->model_path, shape, weight_bytes)) {
+            std::error_code ec;
+            return std::filesystem::exists(params->model_path, ec) ? LLAMAFU_ERROR_MODEL_LOAD_FAILED
+                                                                   : LLAMAFU_ERROR_FILE_NOT_FOUND;
+        }
+
+        // Resolve context sizes the way llamafu_init and llama.cpp do
+        LlamafuContextParams ctx = context_params ? *context_params : llamafu_context_default_params();
+        if (!context_params) {
+            ctx.n_ctx = params->n_ctx > 0 ? params->n_ctx : 2048;
+        }
+        const uint64_t n_ctx = ctx.n_ctx > 0 ? ctx.n_ctx : 2048;
+        const uint64_t n_batch = ctx.n_batch > 0 ? ctx.n_batch : 2048;
+        const uint64_t n_ubatch = std::min<uint64_t>(ctx.n_ubatch > 0 ? ctx.n_ubatch : 512, n_batch);
+        const uint64_t n_seq_max = ctx.n_seq_max > 0 ? ctx.n_seq_max : 1;
+
+        memset(out_estimate, 0, sizeof(*out_estimate));
+        // Offloaded layers move their share of the weights to the device
+        const int32_t n_gpu_layers = requested_gpu_layers(params);
+        const uint64_t n_offloaded = n_gpu_layers < 0 ? shape.n_layer
+                                                      : std::min<uint64_t>(n_gpu_layers, shape.n_layer);
+        out_estimate->model_size_bytes = weight_bytes;
+        out_estimate->model_device_bytes = shape.n_layer > 0 ? weight_bytes / shape.n_layer * n_offloaded : 0;
+        out_estimate->model_host_bytes = weight_bytes - out_estimate->model_device_bytes;
+        const ggml_type type_v = kv_cache_ggml_type(ctx.type_v);
+        out_estimate->kv_cache_size_bytes = estimate_kv_bytes(shape, n_ctx, kv_cache_ggml_type(ctx.type_k), type_v);
+        out_estimate->compute_buffer_size_bytes =
+            estimate_compute_bytes(shape, n_ctx, n_ubatch, ctx.flash_attn || is_quantized_kv_type(type_v));
+        out_estimate->output_buffer_bytes = estimate_output_bytes(shape, n_seq_max);
+        if (params->mmproj_path && params->mmproj_path[0]) {
+            std::error_code ec;
+            const auto mmproj_size = std::filesystem::file_size(params->mmproj_path, ec);
+            out_estimate->clip_size_bytes = ec ? 0 : static_cast<uint64_t>(mmproj_size);
+        }
+        out_estimate->total_size_bytes = out_estimate->model_size_bytes +
+                                         out_estimate->kv_cache_size_bytes +
+                                         out_estimate->compute_buffer_size_bytes +
+                                         out_estimate->output_buffer_bytes +
+                                         out_estimate->clip_size_bytes;
+        process_memory(&out_estimate->rss_bytes, &out_estimate->peak_rss_bytes);
+
+        if (out_fits) {
+            *out_fits = out_estimate->total_size_bytes <= budget_bytes;
+        }
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// Base64 Encoding/Decoding Utilities
+// =============================================================================
+
+static const std::string base64_chars = 
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+static std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+    std::string ret;
+    int i = 0;
+    int j = 0;
+    unsigned char char_array_3[3];
+    unsigned char char_array_4[4];
+
+    while (in_len--) {
+        char_array_3[i++] = *(bytes_to_encode++);
+        if (i == 3) {
+            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+            char_array_4[3] = char_array_3[2] & 0x3f;
+
+            for (i = 0; (i < 4) ; i++)
+                ret += base64_chars[char_array_4[i]];
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j < 3; j++)
+            char_array_3[j] = '\0';
+
+        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+        char_array_4[3] = char_array_3[2] & 0x3f;
+
+        for (j = 0; (j < i + 1); j++)
+            ret += base64_chars[char_array_4[j]];
+
+        while ((i++ < 3))
+            ret += '=';
+    }
+
+    return ret;
+}
+
+// Sextet of each base64 character; 0x80 marks characters outside the alphabet
+static const std::array<uint8_t, 256> BASE64_SEXTETS = [] {
+    std::array<uint8_t, 256> table;
+    table.fill(0x80);
+    for (size_t i = 0; i < base64_chars.size(); ++i) {
+        table[static_cast<unsigned char>(base64_chars[i])] = static_cast<uint8_t>(i);
+    }
+    return table;
+}();
+
+// Decodes base64 text into out, reusing its capacity. Decoding stops at the
+// padding or the first character outside the alphabet.
+static void base64_decode_into(const char* text, size_t len, std::vector<unsigned char>& out) {
+    const auto* in = reinterpret_cast<const unsigned char*>(text);
+    out.resize(len / 4 * 3 + 3);
+    unsigned char* dst = out.data();
+
+    // Whole groups of four: one lookup per character and one validity check
+    // per group
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        const uint32_t a = BASE64_SEXTETS[in[i]];
+        const uint32_t b = BASE64_SEXTETS[in[i + 1]];
+        const uint32_t c = BASE64_SEXTETS[in[i + 2]];
+        const uint32_t d = BASE64_SEXTETS[in[i + 3]];
+        if ((a | b | c | d) & 0x80) {
+            break;
+        }
+        const uint32_t bits = a << 18 | b << 12 | c << 6 | d;
+        dst[0] = static_cast<unsigned char>(bits >> 16);
+        dst[1] = static_cast<unsigned char>(bits >> 8);
+        dst[2] = static_cast<unsigned char>(bits);
+        dst += 3;
+    }
+
+    // The last, partial group (fewer than four valid characters)
+    uint32_t bits = 0;
+    int32_t n = 0;
+    for (; i < len && n < 4; ++i) {
+        const uint32_t sextet = BASE64_SEXTETS[in[i]];
+        if (sextet & 0x80) {
+            break;
+        }
+        bits = bits << 6 | sextet;
+        n++;
+    }
+    if (n >= 2) {
+        bits <<= 6 * (4 - n);
+        dst[0] = static_cast<unsigned char>(bits >> 16);
+        dst[1] = static_cast<unsigned char>(bits >> 8);
+        dst += n - 1;
+    }
+    out.resize(dst - out.data());
+}
+
+// =============================================================================
+// Image Format Detection and Validation
+// =============================================================================
+
+static LlamafuImageFormat detect_image_format_from_header(const unsigned char* data, size_t size) {
+    if (size < 4) return LLAMAFU_IMAGE_FORMAT_AUTO;
+
+    // JPEG magic numbers
+    if (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        return LLAMAFU_IMAGE_FORMAT_JPEG;
+    }
+
+    // PNG magic number
+    if (size >= 8 && data[0] == 0x89 && data[1] == 0x50 && data[2] == 0x4E && data[3] == 0x47 &&
+        data[4] == 0x0D && data[5] == 0x0A && data[6] == 0x1A && data[7] == 0x0A) {
+        return LLAMAFU_IMAGE_FORMAT_PNG;
+    }
+
+    // BMP magic number
+    if (data[0] == 0x42 && data[1] == 0x4D) {
+        return LLAMAFU_IMAGE_FORMAT_BMP;
+    }
+
+    // WebP magic number
+    if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0) {
+        return LLAMAFU_IMAGE_FORMAT_WEBP;
+    }
+
+    return LLAMAFU_IMAGE_FORMAT_AUTO;
+}
+
+static LlamafuImageFormat detect_format_from_extension(const char* file_path) {
+    if (!file_path) return LLAMAFU_IMAGE_FORMAT_AUTO;
+
+    std::string path(file_path);
+    std::string ext;
+
+    // Extract extension
+    size_t dot_pos = path.find_last_of('.');
+    if (dot_pos != std::string::npos) {
+        ext = path.substr(dot_pos + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    }
+
+    if (ext == "jpg" || ext == "jpeg") return LLAMAFU_IMAGE_FORMAT_JPEG;
+    if (ext == "png") return LLAMAFU_IMAGE_FORMAT_PNG;
+    if (ext == "bmp") return LLAMAFU_IMAGE_FORMAT_BMP;
+    if (ext == "webp") return LLAMAFU_IMAGE_FORMAT_WEBP;
+
+    return LLAMAFU_IMAGE_FORMAT_AUTO;
+}
+
+// =============================================================================
+// Image Loading and Conversion Utilities
+// =============================================================================
+
+// Maps a media file read-only instead of reading it into the heap; decoders
+// and the hash read the pages straight from the page cache. Windows has no
+// mmap, so there the file is read into the mapping's buffer; u8path keeps
+// UTF-8 paths working with the wide-character file API.
+static LlamafuError map_media_file(const char* file_path, FileMapping& map) {
+#if defined(_WIN32)
+    std::ifstream in(std::filesystem::u8path(file_path), std::ios::binary | std::ios::ate);
+    if (!in) {
+        return LLAMAFU_ERROR_FILE_NOT_FOUND;
+    }
+    const std::streamoff size = in.tellg();
+    if (size <= 0) {
+        return LLAMAFU_ERROR_FILE_READ_FAILED;
+    }
+    map.size = static_cast<size_t>(size);
+    map.buffer.reset(new (std::nothrow) uint8_t[map.size]);
+    in.seekg(0);
+    return map.buffer && in.read(reinterpret_cast<char*>(map.data()), size) ? LLAMAFU_SUCCESS
+                                                                             : LLAMAFU_ERROR_FILE_READ_FAILED;
+#else
+    ScopedFd file(open(file_path, O_RDONLY | O_CLOEXEC));
+    if (file.fd < 0) {
+        return LLAMAFU_ERROR_FILE_NOT_FOUND;
+    }
+    return map_fd_for_read(file.fd, map) ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_FILE_READ_FAILED;
+#endif
+}
+
+// Decode buffer of the calling thread, lent to one input at a time so base64
+// sources reuse its capacity instead of allocating per image. Capacity beyond
+// MEDIA_BUFFER_RETAIN_BYTES is given back when the lease ends.
+static const size_t MEDIA_BUFFER_RETAIN_BYTES = 16u << 20;
+static thread_local std::vector<unsigned char> t_media_buffer;
+
+struct MediaBufferLease {
+    std::vector<unsigned char>& buffer;
+    explicit MediaBufferLease(std::vector<unsigned char>& target) : buffer(target) { buffer.swap(t_media_buffer); }
+    MediaBufferLease(const MediaBufferLease&) = delete;
+    MediaBufferLease& operator=(const MediaBufferLease&) = delete;
+    ~MediaBufferLease() {
+        buffer.swap(t_media_buffer);
+        if (t_media_buffer.capacity() > MEDIA_BUFFER_RETAIN_BYTES) {
+            std::vector<unsigned char>().swap(t_media_buffer);
+        }
+    }
+};
+
+
+// =============================================================================
+// Enhanced Multimodal API Implementation
+// =============================================================================
+
+LlamafuError llamafu_image_validate(const LlamafuMediaInput* input, LlamafuImageValidation* out_validation) {
+    if (!input || !out_validation) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    memset(out_validation, 0, sizeof(LlamafuImageValidation));
+
+    try {
+        // Files are mapped and binary inputs read in place; only base64 is
+        // decoded, into the thread's reusable buffer
+        FileMapping mapping;
+        std::vector<unsigned char> decoded;
+        MediaBufferLease lease(decoded);
+        const unsigned char* bytes = nullptr;
+        size_t n_bytes = 0;
+
+        // Load image data based on source type
+        switch (input->source_type) {
+            case LLAMAFU_DATA_SOURCE_FILE_PATH: {
+                const char* file_path = static_cast<const char*>(input->data);
+                if (!validate_string_param(file_path, "file_path")) {
+                    out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
+                    strcpy(out_validation->error_message, "Invalid file path");
+                    return LLAMAFU_ERROR_INVALID_PARAM;
+                }
+
+                LlamafuError load_result = map_media_file(file_path, mapping);
+                if (load_result != LLAMAFU_SUCCESS) {
+                    out_validation->error_code = load_result;
+                    strcpy(out_validation->error_message, "Failed to load image file");
+                    return load_result;
+                }
+                bytes = mapping.data();
+                n_bytes = mapping.size;
+
+                out_validation->detected_format = detect_format_from_extension(file_path);
+                break;
+            }
+
+            case LLAMAFU_DATA_SOURCE_BASE64: {
+                const char* base64_str = static_cast<const char*>(input->data);
+                if (!validate_string_param(base64_str, "base64_data")) {
+                    out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
+                    strcpy(out_validation->error_message, "Invalid base64 data");
+                    return LLAMAFU_ERROR_INVALID_PARAM;
+                }
+
+                try {
+                    base64_decode_into(base64_str, strlen(base64_str), decoded);
+                    bytes = decoded.data();
+                    n_bytes = decoded.size();
+                } catch (const std::exception& e) {
+                    out_validation->error_code = LLAMAFU_ERROR_BASE64_DECODE_FAILED;
+                    strcpy(out_validation->error_message, "Failed to decode base64 data");
+                    return LLAMAFU_ERROR_BASE64_DECODE_FAILED;
+                }
+                break;
+            }
+
+            case LLAMAFU_DATA_SOURCE_BINARY: {
+                if (!input->data || input->data_size == 0) {
+                    out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
+                    strcpy(out_validation->error_message, "Invalid binary data");
+                    return LLAMAFU_ERROR_INVALID_PARAM;
+                }
+
+                bytes = static_cast<const unsigned char*>(input->data);
+                n_bytes = input->data_size;
+                break;
+            }
+
+            default:
+                out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
+                strcpy(out_validation->error_message, "Unsupported data source type");
+                return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        // Detect format from data if not specified
+        if (out_validation->detected_format == LLAMAFU_IMAGE_FORMAT_AUTO) {
+            out_validation->detected_format = detect_image_format_from_header(bytes, n_bytes);
+        }
+
+        // Basic validation
+        out_validation->file_size_bytes = n_bytes;
+        out_validation->is_valid = (out_validation->detected_format != LLAMAFU_IMAGE_FORMAT_AUTO) && 
+                                  (n_bytes > 0);
+
+        // Set basic compatibility info (simplified for now)
+        out_validation->supported_by_model = (out_validation->detected_format == LLAMAFU_IMAGE_FORMAT_JPEG ||
+                                            out_validation->detected_format == LLAMAFU_IMAGE_FORMAT_PNG);
+        out_validation->requires_preprocessing = true;
+        out_validation->estimated_processing_time_ms = n_bytes / 1000.0f; // Rough estimate
+
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        out_validation->error_code = LLAMAFU_ERROR_IMAGE_VALIDATION_FAILED;
+        snprintf(out_validation->error_message, sizeof(out_validation->error_message), 
+                "Validation failed: %s", e.what());
+        return LLAMAFU_ERROR_IMAGE_VALIDATION_FAILED;
+    }
+}
+
+LlamafuError llamafu_image_load_from_file(const char* file_path, LlamafuImageFormat format, LlamafuMediaInput* out_input) {
+    if (!validate_string_param(file_path, "file_path") || !out_input) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Initialize media input structure
+        memset(out_input, 0, sizeof(LlamafuMediaInput));
+        
+        out_input->type = LLAMAFU_MEDIA_TYPE_IMAGE;
+        out_input->source_type = LLAMAFU_DATA_SOURCE_FILE_PATH;
+        out_input->image_format = (format == LLAMAFU_IMAGE_FORMAT_AUTO) ? 
+                                 detect_format_from_extension(file_path) : format;
+        
+        // Store file path (caller is responsible for keeping it valid)
+        out_input->data = file_path;
+        out_input->data_size = 0; // Not needed for file paths
+
+        // Set default processing options
+        out_input->resize_to_model = true;
+        out_input->maintain_aspect_ratio = true;
+        out_input->pad_to_square = false;
+        out_input->quality_hint = 1.0f;
+
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_IMAGE_LOAD_FAILED;
+    }
+}
+
+LlamafuError llamafu_image_load_from_base64(const char* base64_data, LlamafuImageFormat format, LlamafuMediaInput* out_input) {
+    if (!validate_string_param(base64_data, "base64_data") || !out_input) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Initialize media input structure
+        memset(out_input, 0, sizeof(LlamafuMediaInput));
+        
+        out_input->type = LLAMAFU_MEDIA_TYPE_IMAGE;
+        out_input->source_type = LLAMAFU_DATA_SOURCE_BASE64;
+        out_input->image_format = format;
+        
+        // Store base64 string (caller is responsible for keeping it valid)
+        out_input->data = base64_data;
+        out_input->data_size = strlen(base64_data);
+
+        // Set default processing options
+        out_input->resize_to_model = true;
+        out_input->maintain_aspect_ratio = true;
+        out_input->pad_to_square = false;
+        out_input->quality_hint = 1.0f;
+
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_IMAGE_LOAD_FAILED;
+    }
+}
+
+LlamafuError llamafu_image_load_from_pixels(const unsigned char* rgb_pixels, int32_t width, int32_t height, 
+                                           LlamafuImageFormat format, LlamafuMediaInput* out_input) {
+    if (!rgb_pixels || width <= 0 || height <= 0 || !out_input) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Initialize media input structure
+        memset(out_input, 0, sizeof(LlamafuMediaInput));
+        
+        out_input->type = LLAMAFU_MEDIA_TYPE_IMAGE;
+        out_input->source_type = LLAMAFU_DATA_SOURCE_RGB_PIXELS;
+        out_input->image_format = format;
+        out_input->width = width;
+        out_input->height = height;
+        
+        // Store pixel data (caller is responsible for keeping it valid)
+        out_input->data = rgb_pixels;
+        out_input->data_size = width * height * 3; // RGB = 3 bytes per pixel
+
+        // Set default processing options
+        out_input->resize_to_model = true;
+        out_input->maintain_aspect_ratio = true;
+        out_input->pad_to_square = false;
+        out_input->quality_hint = 1.0f;
+
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_IMAGE_LOAD_FAILED;
+    }
+}
+
+// Convenience functions for common formats
+LlamafuError llamafu_image_from_jpeg_file(const char* path, LlamafuMediaInput* out_input) {
+    return llamafu_image_load_from_file(path, LLAMAFU_IMAGE_FORMAT_JPEG, out_input);
+}
+
+LlamafuError llamafu_image_from_png_file(const char* path, LlamafuMediaInput* out_input) {
+    return llamafu_image_load_from_file(path, LLAMAFU_IMAGE_FORMAT_PNG, out_input);
+}
+
+LlamafuError llamafu_image_from_base64_jpeg(const char* base64, LlamafuMediaInput* out_input) {
+    return llamafu_image_load_from_base64(base64, LLAMAFU_IMAGE_FORMAT_JPEG, out_input);
+}
+
+LlamafuError llamafu_image_from_base64_png(const char* base64, LlamafuMediaInput* out_input) {
+    return llamafu_image_load_from_base64(base64, LLAMAFU_IMAGE_FORMAT_PNG, out_input);
+}
+
+
+// =============================================================================
+// Image Processing and CLIP Integration
+// =============================================================================
+
+static LlamafuError initialize_mtmd_context(Llamafu llamafu, const char* mmproj_path) {
+    if (!llamafu || llamafu->vision_initialized) {
+        return LLAMAFU_SUCCESS; // Already initialized
+    }
+
+    if (!mmproj_path || strlen(mmproj_path) == 0) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        mtmd_context_params mtmd_params = mtmd_context_params_default();
+        mtmd_params.use_gpu = true;
+        mtmd_params.print_timings = false;
+        mtmd_params.n_threads = llamafu->llama_ctx_params.n_threads_batch;
+        mtmd_params.warmup = false;
+
+        const auto t_load_start = std::chrono::steady_clock::now();
+        mtmd_context* ctx = nullptr;
+        {
+            LLAMAFU_TRACE_SCOPE("llamafu.load_mmproj");
+            ctx = mtmd_init_from_file(mmproj_path, llamafu->model, mtmd_params);
+        }
+        if (!ctx) {
+            return LLAMAFU_ERROR_VISION_INIT_FAILED;
+        }
+        {
+            std::lock_guard<std::mutex> lock(llamafu->metrics_mutex);
+            llamafu->metrics.t_load_mmproj_ms = elapsed_ms(t_load_start);
+        }
+
+        // mtmd does not expose the projector's hyperparameters
+        int32_t image_size = 0;
+        gguf_init_params gguf_params = {};
+        gguf_params.no_alloc = true;
+        gguf_params.ctx = nullptr;
+        if (gguf_context* gguf = gguf_init_from_file(mmproj_path, gguf_params)) {
+            const int64_t key = gguf_find_key(gguf, "clip.vision.image_size");
+            if (key >= 0) {
+                image_size = static_cast<int32_t>(gguf_get_val_u32(gguf, key));
+            }
+            gguf_free(gguf);
+        }
+
+        llamafu->mtmd_ctx = ctx;
+        llamafu->vision_image_size = image_size;
+        llamafu->vision_initialized = true;
+
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_VISION_INIT_FAILED;
+    }
+}
+
+// Whether the projector is ready; reloads it on first use after
+// llamafu_release_memory freed it
+static bool vision_ready(Llamafu llamafu) {
+    if (!llamafu->vision_initialized && llamafu->is_multimodal && !llamafu->mmproj_path.empty() &&
+        initialize_mtmd_context(llamafu, llamafu->mmproj_path.c_str()) == LLAMAFU_SUCCESS) {
+        std::error_code ec;
+        const auto mmproj_size = std::filesystem::file_size(llamafu->mmproj_path, ec);
+        llamafu->clip_size_bytes = ec ? 0 : static_cast<uint64_t>(mmproj_size);
+    }
+    return llamafu->vision_initialized;
+}
+
+using MtmdBitmap = std::unique_ptr<mtmd_bitmap, decltype(&mtmd_bitmap_free)>;
+using MtmdChunks = std::unique_ptr<mtmd_input_chunks, decltype(&mtmd_input_chunks_free)>;
+
+#if defined(__APPLE__)
+// WebP, which stb_image lacks, through ImageIO
+static bool decode_image_platform(const unsigned char* data, size_t size, std::vector<unsigned char>& rgb,
+                                  int32_t& width, int32_t& height) {
+    CFDataRef cf_data = CFDataCreateWithBytesNoCopy(nullptr, data, static_cast<CFIndex>(size), kCFAllocatorNull);
+    if (!cf_data) {
+        return false;
+    }
+    CGImageSourceRef source = CGImageSourceCreateWithData(cf_data, nullptr);
+    CGImageRef image = source ? CGImageSourceCreateImageAtIndex(source, 0, nullptr) : nullptr;
+    bool ok = false;
+    if (image) {
+        const size_t w = CGImageGetWidth(image);
+        const size_t h = CGImageGetHeight(image);
+        std::vector<unsigned char> rgbx(w * h * 4);
+        CGColorSpaceRef color_space = CGColorSpaceCreateDeviceRGB();
+        CGContextRef bitmap = CGBitmapContextCreate(rgbx.data(), w, h, 8, w * 4, color_space,
+                                                    kCGImageAlphaNoneSkipLast | kCGBitmapByteOrder32Big);
+        if (bitmap) {
+            CGContextDrawImage(bitmap, CGRectMake(0, 0, w, h), image);
+            CGContextRelease(bitmap);
+            rgb.resize(w * h * 3);
+            for (size_t i = 0; i < w * h; ++i) {
+                memcpy(&rgb[i * 3], &rgbx[i * 4], 3);
+            }
+            width = static_cast<int32_t>(w);
+            height = static_cast<int32_t>(h);
+            ok = true;
+        }
+        CGColorSpaceRelease(color_space);
+        CGImageRelease(image);
+    }
+    if (source) {
+        CFRelease(source);
+    }
+    CFRelease(cf_data);
+    return ok;
+}
+#elif defined(__ANDROID__)
+// WebP, which stb_image lacks, through AImageDecoder. It is resolved at run
+// time since it needs API 30 and the plugin supports older devices.
+struct AImageDecoder;
+struct AImageDecoderHeaderInfo;
+
+static bool decode_image_platform(const unsigned char* data, size_t size, std::vector<unsigned char>& rgb,
+                                  int32_t& width, int32_t& height) {
+    struct DecoderApi {
+        int (*create_from_buffer)(const void*, size_t, AImageDecoder**);
+        const AImageDecoderHeaderInfo* (*get_header_info)(const AImageDecoder*);
+        int32_t (*get_width)(const AImageDecoderHeaderInfo*);
+        int32_t (*get_height)(const AImageDecoderHeaderInfo*);
+        int (*set_format)(AImageDecoder*, int32_t);
+        int (*set_unpremultiplied)(AImageDecoder*, bool);
+        size_t (*get_min_stride)(AImageDecoder*);
+        int (*decode)(AImageDecoder*, void*, size_t, size_t);
+        void (*destroy)(AImageDecoder*);
+        bool loaded;
+    };
+    static const DecoderApi api = [] {
+        DecoderApi a = {};
+        void* lib = dlopen("libjnigraphics.so", RTLD_NOW);
+        if (!lib) {
+            return a;
+        }
+        a.create_from_buffer = reinterpret_cast<decltype(a.create_from_buffer)>(dlsym(lib, "AImageDecoder_createFromBuffer"));
+        a.get_header_info = reinterpret_cast<decltype(a.get_header_info)>(dlsym(lib, "AImageDecoder_getHeaderInfo"));
+        a.get_width = reinterpret_cast<decltype(a.get_width)>(dlsym(lib, "AImageDecoderHeaderInfo_getWidth"));
+        a.get_height = reinterpret_cast<decltype(a.get_height)>(dlsym(lib, "AImageDecoderHeaderInfo_getHeight"));
+        a.set_format = reinterpret_cast<decltype(a.set_format)>(dlsym(lib, "AImageDecoder_setAndroidBitmapFormat"));
+        a.set_unpremultiplied = reinterpret_cast<decltype(a.set_unpremultiplied)>(dlsym(lib, "AImageDecoder_setUnpremultipliedRequired"));
+        a.get_min_stride = reinterpret_cast<decltype(a.get_min_stride)>(dlsym(lib, "AImageDecoder_getMinimumStride"));
+        a.decode = reinterpret_cast<decltype(a.decode)>(dlsym(lib, "AImageDecoder_decodeImage"));
+        a.destroy = reinterpret_cast<decltype(a.destroy)>(dlsym(lib, "AImageDecoder_delete"));
+        a.loaded = a.create_from_buffer && a.get_header_info && a.get_width && a.get_height && a.set_format &&
+                   a.set_unpremultiplied && a.get_min_stride && a.decode && a.destroy;
+        return a;
+    }();
+    if (!api.loaded) {
+        return false;
+    }
+
+    const int32_t ANDROID_BITMAP_FORMAT_RGBA_8888 = 1;
+    AImageDecoder* decoder = nullptr;
+    if (api.create_from_buffer(data, size, &decoder) != 0 || !decoder) {
+        return false;
+    }
+    bool ok = false;
+    const AImageDecoderHeaderInfo* info = api.get_header_info(decoder);
+    const int32_t w = api.get_width(info);
+    const int32_t h = api.get_height(info);
+    if (w > 0 && h > 0 && api.set_format(decoder, ANDROID_BITMAP_FORMAT_RGBA_8888) == 0) {
+        api.set_unpremultiplied(decoder, true);
+        const size_t stride = api.get_min_stride(decoder);
+        std::vector<unsigned char> rgba(stride * h);
+        if (api.decode(decoder, rgba.data(), stride, rgba.size()) == 0) {
+            rgb.resize(static_cast<size_t>(w) * h * 3);
+            for (int32_t y = 0; y < h; ++y) {
+                const unsigned char* row = rgba.data() + y * stride;
+                for (int32_t x = 0; x < w; ++x) {
+                    memcpy(&rgb[(static_cast<size_t>(y) * w + x) * 3], row + x * 4, 3);
+                }
+            }
+            width = w;
+            height = h;
+            ok = true;
+        }
+    }
+    api.destroy(decoder);
+    return ok;
+}
+#else
+static bool decode_image_platform(const unsigned char*, size_t, std::vector<unsigned char>&, int32_t&, int32_t&) {
+    return false;
+}
+#endif
+
+// Decodes an encoded image into an RGB bitmap: JPEG, PNG and BMP through
+// stb_image, WebP through the platform decoder
+static LlamafuError decode_image(const unsigned char* data, size_t size, MtmdBitmap& out,
+                                 int32_t& width, int32_t& height) {
+    if (detect_image_format_from_header(data, size) == LLAMAFU_IMAGE_FORMAT_WEBP) {
+        std::vector<unsigned char> rgb;
+        if (!decode_image_platform(data, size, rgb, width, height)) {
+            return LLAMAFU_ERROR_IMAGE_FORMAT_UNSUPPORTED;
+        }
+        out.reset(mtmd_bitmap_init(width, height, rgb.data()));
+        return out ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_OUT_OF_MEMORY;
+    }
+
+    int w = 0, h = 0, channels = 0;
+    unsigned char* rgb = stbi_load_from_memory(data, static_cast<int>(size), &w, &h, &channels, 3);
+    if (!rgb) {
+        return detect_image_format_from_header(data, size) == LLAMAFU_IMAGE_FORMAT_AUTO
+            ? LLAMAFU_ERROR_IMAGE_FORMAT_UNSUPPORTED
+            : LLAMAFU_ERROR_IMAGE_LOAD_FAILED;
+    }
+    out.reset(mtmd_bitmap_init(w, h, rgb));
+    stbi_image_free(rgb);
+    width = w;
+    height = h;
+    return out ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_OUT_OF_MEMORY;
+}
+
+// Raw pixels, RGB or (with LLAMAFU_IMAGE_FORMAT_RGBA32) RGBA
+static MtmdBitmap load_image_pixels(const LlamafuMediaInput* input) {
+    const unsigned char* pixels = static_cast<const unsigned char*>(input->data);
+    const size_t n_pixels = static_cast<size_t>(input->width) * input->height;
+    if (input->image_format != LLAMAFU_IMAGE_FORMAT_RGBA32) {
+        return MtmdBitmap(mtmd_bitmap_init(input->width, input->height, pixels), mtmd_bitmap_free);
+    }
+    std::vector<unsigned char> rgb(n_pixels * 3);
+    for (size_t i = 0; i < n_pixels; ++i) {
+        memcpy(&rgb[i * 3], pixels + i * 4, 3);
+    }
+    return MtmdBitmap(mtmd_bitmap_init(input->width, input->height, rgb.data()), mtmd_bitmap_free);
+}
+
+// Source bytes of an image input: files are mapped, binary and pixel inputs
+// are read in place (borrowed from the caller until processing returns) and
+// only base64 is decoded into owned
+struct ImageSource {
+    FileMapping mapping;
+    std::vector<unsigned char> owned;
+    const unsigned char* bytes = nullptr;
+    size_t n_bytes = 0;
+    uint64_t key = 0;
+};
+
+static LlamafuError read_image_source(const LlamafuMediaInput* input, ImageSource& source) {
+    switch (input->source_type) {
+        case LLAMAFU_DATA_SOURCE_FILE_PATH: {
+            const char* file_path = static_cast<const char*>(input->data);
+            LlamafuError load_result = map_media_file(file_path, source.mapping);
+            if (load_result != LLAMAFU_SUCCESS) {
+                return load_result;
+            }
+            source.bytes = source.mapping.data();
+            source.n_bytes = source.mapping.size;
+            break;
+        }
+
+        case LLAMAFU_DATA_SOURCE_BASE64: {
+            const char* base64_str = static_cast<const char*>(input->data);
+            try {
+                base64_decode_into(base64_str, strlen(base64_str), source.owned);
+            } catch (const std::exception& e) {
+                return LLAMAFU_ERROR_BASE64_DECODE_FAILED;
+            }
+            source.bytes = source.owned.data();
+            source.n_bytes = source.owned.size();
+            break;
+        }
+
+        case LLAMAFU_DATA_SOURCE_BINARY: {
+            source.bytes = static_cast<const unsigned char*>(input->data);
+            source.n_bytes = input->data_size;
+            break;
+        }
+
+        case LLAMAFU_DATA_SOURCE_RGB_PIXELS: {
+            if (input->width <= 0 || input->height <= 0) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            const size_t channels = input->image_format == LLAMAFU_IMAGE_FORMAT_RGBA32 ? 4 : 3;
+            source.bytes = static_cast<const unsigned char*>(input->data);
+            source.n_bytes = static_cast<size_t>(input->width) * input->height * channels;
+            if (input->data_size < source.n_bytes) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            break;
+        }
+
+        default:
+            return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!source.bytes || source.n_bytes == 0) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    const bool raw_pixels = input->source_type == LLAMAFU_DATA_SOURCE_RGB_PIXELS;
+    source.key = hash_image_source(source.bytes, source.n_bytes,
+                                   raw_pixels ? input->width : 0, raw_pixels ? input->height : 0);
+    return LLAMAFU_SUCCESS;
+}
+
+// Copies the cached embeddings for source into out; false on a miss
+static bool image_cache_fetch(Llamafu llamafu, const ImageSource& source, ImageCacheEntry& out) {
+    std::lock_guard<std::mutex> lock(llamafu->image_cache_mutex);
+    if (llamafu->image_cache_max_bytes == 0) {
+        return false;
+    }
+    const ImageCacheEntry* cached = image_cache_lookup(llamafu, source.key, source.n_bytes);
+    if (!cached) {
+        return false;
+    }
+    out = *cached;
+    return true;
+}
+
+static void image_cache_store(Llamafu llamafu, ImageCacheEntry entry) {
+    std::lock_guard<std::mutex> lock(llamafu->image_cache_mutex);
+    if (llamafu->image_cache_max_bytes > 0) {
+        image_cache_insert(llamafu, std::move(entry));
+    }
+}
+
+// Bitmap for a media input, named after the hash of its source so that
+// mtmd chunks can be matched with the image cache. Images are decoded here;
+// audio is left to mtmd's helper.
+static LlamafuError load_media_bitmap(Llamafu llamafu, const LlamafuMediaInput* input, const ImageSource& source,
+                                      MtmdBitmap& out, int32_t& width, int32_t& height) {
+    LlamafuError result = LLAMAFU_SUCCESS;
+    if (input->type == LLAMAFU_MEDIA_TYPE_AUDIO) {
+        if (!mtmd_support_audio(llamafu->mtmd_ctx) || input->source_type == LLAMAFU_DATA_SOURCE_RGB_PIXELS) {
+            return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+        }
+        out.reset(mtmd_helper_bitmap_init_from_buf(llamafu->mtmd_ctx, source.bytes, source.n_bytes));
+        result = out ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+    } else if (input->source_type == LLAMAFU_DATA_SOURCE_RGB_PIXELS) {
+        out = load_image_pixels(input);
+        width = input->width;
+        height = input->height;
+        result = out ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } else {
+        result = decode_image(source.bytes, source.n_bytes, out, width, height);
+    }
+    if (result == LLAMAFU_SUCCESS) {
+        char id[24];
+        snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(source.key));
+        mtmd_bitmap_set_id(out.get(), id);
+    }
+    return result;
+}
+
+// The one media chunk mtmd made of a prompt holding a single marker
+static const mtmd_input_chunk* find_media_chunk(const mtmd_input_chunks* chunks) {
+    for (size_t i = 0; i < mtmd_input_chunks_size(chunks); ++i) {
+        const mtmd_input_chunk* chunk = mtmd_input_chunks_get(chunks, i);
+        if (mtmd_input_chunk_get_type(chunk) != MTMD_INPUT_CHUNK_TYPE_TEXT) {
+            return chunk;
+        }
+    }
+    return nullptr;
+}
+
+// Encodes a media chunk and copies the embeddings out of mtmd's buffer,
+// which the next encode overwrites
+static bool encode_media_chunk(Llamafu llamafu, const mtmd_input_chunk* chunk, std::vector<float>& out) {
+    if (mtmd_encode_chunk(llamafu->mtmd_ctx, chunk) != 0) {
+        return false;
+    }
+    const float* embd = mtmd_get_output_embd(llamafu->mtmd_ctx);
+    const size_t n_floats = mtmd_input_chunk_get_n_tokens(chunk) * static_cast<size_t>(llama_model_n_embd(llamafu->model));
+    out.assign(embd, embd + n_floats);
+    return true;
+}
+
+// An image decoded and preprocessed, ready for the encoder
+struct PreparedImage {
+    size_t index = 0;
+    LlamafuError error = LLAMAFU_SUCCESS;
+    bool from_cache = false;
+    MtmdChunks chunks{nullptr, mtmd_input_chunks_free};
+    const mtmd_input_chunk* chunk = nullptr;
+    ImageCacheEntry entry = {};
+    double decode_ms = 0.0;
+    double preprocess_ms = 0.0;
+    double encode_ms = 0.0;
+};
+
+// Reads and decodes one input and lets mtmd resize, normalize and tile it,
+// unless its embeddings are cached. This only reads the projector, so
+// several images can be prepared at once while another is being encoded.
+static void prepare_image(Llamafu llamafu, const LlamafuMediaInput* input, PreparedImage& prepared) {
+    auto start = std::chrono::steady_clock::now();
+
+    ImageSource source;
+    MediaBufferLease lease(source.owned);
+    prepared.error = read_image_source(input, source);
+    if (prepared.error != LLAMAFU_SUCCESS) {
+        return;
+    }
+    if (image_cache_fetch(llamafu, source, prepared.entry)) {
+        prepared.from_cache = true;
+        return;
+    }
+
+    ImageCacheEntry& entry = prepared.entry;
+    entry.key = source.key;
+    entry.source_size = source.n_bytes;
+    MtmdBitmap bitmap(nullptr, mtmd_bitmap_free);
+    prepared.error = load_media_bitmap(llamafu, input, source, bitmap, entry.source_width, entry.source_height);
+    if (prepared.error != LLAMAFU_SUCCESS) {
+        return;
+    }
+    prepared.decode_ms = elapsed_ms(start);
+
+    start = std::chrono::steady_clock::now();
+    prepared.chunks.reset(mtmd_input_chunks_init());
+    if (!prepared.chunks) {
+        prepared.error = LLAMAFU_ERROR_OUT_OF_MEMORY;
+        return;
+    }
+    const mtmd_input_text text = {mtmd_default_marker(), false, true};
+    const mtmd_bitmap* bitmaps[] = {bitmap.get()};
+    if (mtmd_tokenize(llamafu->mtmd_ctx, prepared.chunks.get(), &text, bitmaps, 1) != 0 ||
+        !(prepared.chunk = find_media_chunk(prepared.chunks.get()))) {
+        prepared.error = LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+        return;
+    }
+    entry.n_tokens = static_cast<int32_t>(mtmd_input_chunk_get_n_tokens(prepared.chunk));
+    entry.processed_width = llamafu->vision_image_size;
+    entry.processed_height = llamafu->vision_image_size;
+    prepared.preprocess_ms = elapsed_ms(start);
+}
+
+// Runs the projector over a prepared image, all of its tiles at once. The
+// projector encodes one image at a time and cannot run concurrently, so the
+// batch path keeps it fed from workers instead of batching images.
+static void encode_image(Llamafu llamafu, PreparedImage& prepared) {
+    if (prepared.error != LLAMAFU_SUCCESS || prepared.from_cache) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (!encode_media_chunk(llamafu, prepared.chunk, prepared.entry.embeddings)) {
+        prepared.error = LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+        return;
+    }
+    prepared.chunks.reset();
+    prepared.chunk = nullptr;
+    prepared.encode_ms = elapsed_ms(start);
+}
+
+// Metadata of a result; embeddings are filled in by the caller
+static void fill_image_result(const PreparedImage& prepared, const LlamafuMediaInput* input,
+                              LlamafuImageProcessResult* out_result) {
+    const ImageCacheEntry& entry = prepared.entry;
+    out_result->n_embeddings = entry.embeddings.size();
+    out_result->n_tokens = entry.n_tokens;
+    out_result->processed_width = entry.processed_width;
+    out_result->processed_height = entry.processed_height;
+    out_result->was_resized = entry.source_width != entry.processed_width || entry.source_height != entry.processed_height;
+    out_result->was_padded = input->pad_to_square;
+    out_result->memory_used_bytes = image_cache_entry_bytes(entry);
+    out_result->decode_time_ms = prepared.decode_ms;
+    out_result->preprocess_time_ms = prepared.preprocess_ms;
+    out_result->encode_time_ms = prepared.encode_ms;
+    out_result->from_cache = prepared.from_cache;
+}
+
+LlamafuError llamafu_image_process(Llamafu llamafu, const LlamafuMediaInput* input, LlamafuImageProcessResult* out_result) {
+    if (!llamafu || !input || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!llamafu->is_multimodal) {
+        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    }
+
+    memset(out_result, 0, sizeof(LlamafuImageProcessResult));
+    auto start_time = std::chrono::steady_clock::now();
+
+    try {
+        GenerationScope generation(llamafu);
+        if (!vision_ready(llamafu)) {
+            return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+        }
+
+        PreparedImage prepared;
+        prepare_image(llamafu, input, prepared);
+        encode_image(llamafu, prepared);
+        if (prepared.error != LLAMAFU_SUCCESS) {
+            return prepared.error;
+        }
+
+        const std::vector<float>& embeddings = prepared.entry.embeddings;
+        out_result->embeddings = static_cast<float*>(malloc(embeddings.size() * sizeof(float)));
+        if (!out_result->embeddings) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+        memcpy(out_result->embeddings, embeddings.data(), embeddings.size() * sizeof(float));
+        fill_image_result(prepared, input, out_result);
+        out_result->processing_time_ms = elapsed_ms(start_time);
+
+        if (!prepared.from_cache) {
+            image_cache_store(llamafu, std::move(prepared.entry));
+        }
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        if (out_result->embeddings) {
+            free(out_result->embeddings);
+            out_result->embeddings = nullptr;
+        }
+        return LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+    }
+}
+
+LlamafuError llamafu_image_cache_set_budget(Llamafu llamafu, uint64_t max_bytes) {
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    std::lock_guard<std::mutex> lock(llamafu->image_cache_mutex);
+    llamafu->image_cache_max_bytes = max_bytes;
+    image_cache_trim(llamafu, max_bytes);
+    return LLAMAFU_SUCCESS;
+}
+
+void llamafu_image_cache_clear(Llamafu llamafu) {
+    if (llamafu) {
+        std::lock_guard<std::mutex> lock(llamafu->image_cache_mutex);
+        clear_image_cache(llamafu);
+    }
+}
+
+LlamafuError llamafu_image_cache_get_stats(Llamafu llamafu, LlamafuImageCacheStats* out_stats) {
+    if (!llamafu || !out_stats) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    std::lock_guard<std::mutex> lock(llamafu->image_cache_mutex);
+    out_stats->n_entries = static_cast<int32_t>(llamafu->image_embeddings_cache.size());
+    out_stats->n_hits = llamafu->image_cache_hits;
+    out_stats->n_misses = llamafu->image_cache_misses;
+    out_stats->n_bytes = llamafu->image_cache_bytes;
+    out_stats->max_bytes = llamafu->image_cache_max_bytes;
+    return LLAMAFU_SUCCESS;
+}
+
+// Images prepared ahead of the encoder when the batch sets no limit
+static const int32_t DEFAULT_IMAGE_PIPELINE_DEPTH = 4;
+
+LlamafuError llamafu_image_batch_process(Llamafu llamafu, const LlamafuMediaBatch* batch,
+                                        LlamafuImageProcessResult** out_results, size_t* out_n_results) {
+    if (!llamafu || !batch || !out_results || !out_n_results) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (batch->n_inputs > 0 && !batch->inputs) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    *out_results = nullptr;
+    *out_n_results = 0;
+    if (batch->n_inputs == 0) {
+        return LLAMAFU_SUCCESS;
+    }
+
+    if (!llamafu->is_multimodal) {
+        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        if (!vision_ready(llamafu)) {
+            return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+        }
+
+        const size_t n_inputs = batch->n_inputs;
+        std::vector<PreparedImage> prepared(n_inputs);
+
+        // Decoding and preprocessing run on workers, at most depth images
+        // ahead of the encoder, which consumes them on this thread in the
+        // order they become ready
+        const size_t depth = batch->max_batch_size > 0 ? batch->max_batch_size : DEFAULT_IMAGE_PIPELINE_DEPTH;
+        size_t n_workers = 0;
+        if (batch->process_parallel) {
+            const size_t n_cpu = std::max(1u, std::thread::hardware_concurrency());
+            n_workers = std::min({n_inputs, depth, std::max<size_t>(1, n_cpu - 1)});
+        }
+
+        auto process_serially = [&]() {
+            for (size_t i = 0; i < n_inputs; ++i) {
+                prepared[i].index = i;
+                prepare_image(llamafu, &batch->inputs[i], prepared[i]);
+                encode_image(llamafu, prepared[i]);
+            }
+        };
+
+        if (n_workers == 0) {
+            process_serially();
+        } else {
+            std::mutex mutex;
+            std::condition_variable ready_cv;
+            std::condition_variable slot_cv;
+            std::deque<size_t> ready;
+            size_t next = 0;
+            size_t in_flight = 0;                 // Claimed by a worker or waiting to be encoded
+
+            auto worker = [&]() {
+                for (;;) {
+                    size_t index;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        slot_cv.wait(lock, [&] { return next >= n_inputs || in_flight < depth; });
+                        if (next >= n_inputs) {
+                            return;
+                        }
+                        index = next++;
+                        in_flight++;
+                    }
+                    prepared[index].index = index;
+                    try {
+                        prepare_image(llamafu, &batch->inputs[index], prepared[index]);
+                    } catch (const std::exception& e) {
+                        prepared[index].error = LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ready.push_back(index);
+                    }
+                    ready_cv.notify_one();
+                }
+            };
+
+            // Workers that did start take every input between them; when
+            // none could be created the batch runs on this thread
+            std::vector<std::thread> workers;
+            workers.reserve(n_workers);
+            for (size_t i = 0; i < n_workers; ++i) {
+                try {
+                    workers.emplace_back(worker);
+                } catch (const std::system_error&) {
+                    break;
+                }
+            }
+            if (workers.empty()) {
+                process_serially();
+            }
+
+            for (size_t n_encoded = 0; !workers.empty() && n_encoded < n_inputs; ++n_encoded) {
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready_cv.wait(lock, [&] { return !ready.empty(); });
+                    index = ready.front();
+                    ready.pop_front();
+                }
+                try {
+                    encode_image(llamafu, prepared[index]);
+                } catch (const std::exception& e) {
+                    prepared[index].error = LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    in_flight--;
+                }
+                slot_cv.notify_one();
+            }
+
+            for (auto& thread : workers) {
+                thread.join();
+            }
+        }
+
+        // One allocation holds the results followed by all embeddings, back
+        // to back in input order
+        size_t n_floats = 0;
+        for (const auto& image : prepared) {
+            if (image.error == LLAMAFU_SUCCESS) {
+                n_floats += image.entry.embeddings.size();
+            }
+        }
+        const size_t results_bytes = n_inputs * sizeof(LlamafuImageProcessResult);
+        void* block = malloc(results_bytes + n_floats * sizeof(float));
+        if (!block) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+        memset(block, 0, results_bytes);
+        LlamafuImageProcessResult* results = static_cast<LlamafuImageProcessResult*>(block);
+        float* embeddings = reinterpret_cast<float*>(static_cast<char*>(block) + results_bytes);
+
+        size_t n_failed = 0;
+        for (size_t i = 0; i < n_inputs; ++i) {
+            PreparedImage& image = prepared[i];
+            if (image.error != LLAMAFU_SUCCESS) {
+                n_failed++;
+                continue;
+            }
+            const std::vector<float>& values = image.entry.embeddings;
+            memcpy(embeddings, values.data(), values.size() * sizeof(float));
+            results[i].embeddings = embeddings;
+            embeddings += values.size();
+            fill_image_result(image, &batch->inputs[i], &results[i]);
+            results[i].processing_time_ms = image.decode_ms + image.preprocess_ms + image.encode_ms;
+            if (!image.from_cache) {
+                image_cache_store(llamafu, std::move(image.entry));
+            }
+        }
+
+        *out_results = results;
+        *out_n_results = n_inputs;
+        return n_failed == 0 ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_BATCH_PROCESS_FAILED;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_BATCH_PROCESS_FAILED;
+    }
+}
+
+void llamafu_image_batch_result_free(LlamafuImageProcessResult* results) {
+    free(results);
+}
+
+// =============================================================================
+// Format Conversion and Utility Functions
+// =============================================================================
+
+LlamafuError llamafu_image_to_base64(const LlamafuMediaInput* input, LlamafuImageFormat format, char** out_base64) {
+    if (!input || !out_base64) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        FileMapping mapping;
+        const unsigned char* bytes = nullptr;
+        size_t n_bytes = 0;
+
+        // Load image data
         switch (input->source_type) {
             case LLAMAFU_DATA_SOURCE_FILE_PATH: {
                 const char* file_path = static_cast<const char*>(input->data);
-                if (!validate_string_param(file_path, "file_path")) {
-                    out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
-                    strcpy(out_validation->error_message, "Invalid file path");
-                    return LLAMAFU_ERROR_INVALID_PARAM;
+                LlamafuError load_result = map_media_file(file_path, mapping);
+                if (load_result != LLAMAFU_SUCCESS) {
+                    return load_result;
+                }
+                bytes = mapping.data();
+                n_bytes = mapping.size;
+                break;
+            }
+
+            case LLAMAFU_DATA_SOURCE_BINARY: {
+                bytes = static_cast<const unsigned char*>(input->data);
+                n_bytes = input->data_size;
+                break;
+            }
+
+            case LLAMAFU_DATA_SOURCE_BASE64: {
+                // Already base64, just copy if format matches
+                const char* existing_base64 = static_cast<const char*>(input->data);
+                size_t len = strlen(existing_base64);
+                *out_base64 = static_cast<char*>(malloc(len + 1));
+                if (!*out_base64) {
+                    return LLAMAFU_ERROR_OUT_OF_MEMORY;
+                }
+                strcpy(*out_base64, existing_base64);
+                return LLAMAFU_SUCCESS;
+            }
+
+            default:
+                return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        // Encode to base64
+        std::string base64_result = base64_encode(bytes, n_bytes);
+        
+        *out_base64 = static_cast<char*>(malloc(base64_result.length() + 1));
+        if (!*out_base64) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+
+        strcpy(*out_base64, base64_result.c_str());
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_BASE64_ENCODE_FAILED;
+    }
+}
+
+const char* llamafu_image_format_to_string(LlamafuImageFormat format) {
+    switch (format) {
+        case LLAMAFU_IMAGE_FORMAT_AUTO: return "auto";
+        case LLAMAFU_IMAGE_FORMAT_JPEG: return "jpeg";
+        case LLAMAFU_IMAGE_FORMAT_PNG: return "png";
+        case LLAMAFU_IMAGE_FORMAT_BMP: return "bmp";
+        case LLAMAFU_IMAGE_FORMAT_WEBP: return "webp";
+        case LLAMAFU_IMAGE_FORMAT_RGB24: return "rgb24";
+        case LLAMAFU_IMAGE_FORMAT_RGBA32: return "rgba32";
+        default: return "unknown";
+    }
+}
+
+LlamafuImageFormat llamafu_image_format_from_string(const char* format_str) {
+    if (!format_str) return LLAMAFU_IMAGE_FORMAT_AUTO;
+    
+    std::string fmt(format_str);
+    std::transform(fmt.begin(), fmt.end(), fmt.begin(), ::tolower);
+    
+    if (fmt == "auto") return LLAMAFU_IMAGE_FORMAT_AUTO;
+    if (fmt == "jpeg" || fmt == "jpg") return LLAMAFU_IMAGE_FORMAT_JPEG;
+    if (fmt == "png") return LLAMAFU_IMAGE_FORMAT_PNG;
+    if (fmt == "bmp") return LLAMAFU_IMAGE_FORMAT_BMP;
+    if (fmt == "webp") return LLAMAFU_IMAGE_FORMAT_WEBP;
+    if (fmt == "rgb24" || fmt == "rgb") return LLAMAFU_IMAGE_FORMAT_RGB24;
+    if (fmt == "rgba32" || fmt == "rgba") return LLAMAFU_IMAGE_FORMAT_RGBA32;
+    
+    return LLAMAFU_IMAGE_FORMAT_AUTO;
+}
+
+LlamafuImageFormat llamafu_image_detect_format_from_data(const void* data, size_t size) {
+    if (!data || size < 4) return LLAMAFU_IMAGE_FORMAT_AUTO;
+    return detect_image_format_from_header(static_cast<const unsigned char*>(data), size);
+}
+
+LlamafuImageFormat llamafu_image_detect_format_from_path(const char* file_path) {
+    return detect_format_from_extension(file_path);
+}
+
+
+// =============================================================================
+// Multimodal Generation
+// =============================================================================
+
+// Placeholder recorded in cached_tokens for every position of a media chunk.
+// The sign bit keeps it apart from vocabulary ids, and the source hash makes
+// a repeated image match the KV cache prefix it left behind.
+static llama_token media_placeholder_token(uint64_t key) {
+    return static_cast<llama_token>(static_cast<uint32_t>(key) | 0x80000000u);
+}
+
+// Evaluate an mtmd-tokenized prompt: text chunks as token batches, media
+// chunks as embedding batches. sources holds one entry per media chunk, in
+// order. Like prefill_with_prefix_reuse, the longest prefix already in the
+// KV cache is kept, cut back to a chunk boundary if it ends inside a media
+// chunk, and the abort callback is checked between chunks. Media embeddings
+// come from the image cache when present, so an image is encoded once per
+// conversation rather than once per turn. Prompt states are not saved to
+// disk, as they are keyed by text tokens only.
+static LlamafuError prefill_multimodal(Llamafu llamafu, const mtmd_input_chunks* chunks,
+                                       const std::vector<ImageSource>& sources, bool use_cache) {
+    const size_t n_chunks = mtmd_input_chunks_size(chunks);
+    if (n_chunks == 0 ||
+        mtmd_input_chunk_get_type(mtmd_input_chunks_get(chunks, n_chunks - 1)) != MTMD_INPUT_CHUNK_TYPE_TEXT) {
+        return LLAMAFU_ERROR_INVALID_PARAM;  // Nothing to sample after
+    }
+
+    // Positions the prompt occupies, and where each chunk starts
+    std::vector<llama_token> layout;
+    std::vector<size_t> chunk_start(n_chunks);
+    size_t n_media = 0;
+    for (size_t i = 0; i < n_chunks; ++i) {
+        const mtmd_input_chunk* chunk = mtmd_input_chunks_get(chunks, i);
+        chunk_start[i] = layout.size();
+        if (mtmd_input_chunk_get_type(chunk) == MTMD_INPUT_CHUNK_TYPE_TEXT) {
+            size_t n_tokens = 0;
+            const llama_token* tokens = mtmd_input_chunk_get_tokens_text(chunk, &n_tokens);
+            layout.insert(layout.end(), tokens, tokens + n_tokens);
+        } else {
+            if (n_media >= sources.size()) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            layout.insert(layout.end(), static_cast<size_t>(mtmd_input_chunk_get_n_pos(chunk)),
+                          media_placeholder_token(sources[n_media++].key));
+        }
+    }
+
+    llama_memory_t mem = llama_get_memory(llamafu->ctx);
+    std::vector<llama_token>& cached = llamafu->cached_tokens;
+
+    // A prefix evaluated with other adapters cannot be reused
+    if (llamafu->cached_lora != llamafu->lora_applied) {
+        cached.clear();
+        llamafu->cached_lora = llamafu->lora_applied;
+    }
+    clamp_prompt_cache(llamafu);
+
+    size_t n_keep = common_prefix_length(cached, layout);
+    if (n_keep == layout.size()) {
+        n_keep--;  // Re-decode the last prompt token to refresh its logits
+    }
+    size_t first_chunk = n_chunks - 1;
+    while (chunk_start[first_chunk] > n_keep) {
+        first_chunk--;
+    }
+    n_media = 0;
+    for (size_t i = 0; i < first_chunk; ++i) {
+        n_media += mtmd_input_chunk_get_type(mtmd_input_chunks_get(chunks, i)) != MTMD_INPUT_CHUNK_TYPE_TEXT;
+    }
+    if (mtmd_input_chunk_get_type(mtmd_input_chunks_get(chunks, first_chunk)) != MTMD_INPUT_CHUNK_TYPE_TEXT) {
+        n_keep = chunk_start[first_chunk];  // Media chunks are decoded whole
+    }
+
+    if (n_keep == 0 || !llama_memory_seq_rm(mem, 0, static_cast<llama_pos>(n_keep), -1)) {
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        n_keep = 0;
+        first_chunk = 0;
+        n_media = 0;
+    }
+    cached.resize(n_keep);
+    llamafu->n_reused_last = static_cast<int32_t>(n_keep);
+    llamafu->n_restored_last = 0;
+    llamafu->n_prefilled_last = static_cast<int32_t>(layout.size() - n_keep);
+
+    auto fail = [&](LlamafuError error) {
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        cached.clear();
+        return error;
+    };
+
+    const int32_t n_batch = static_cast<int32_t>(llama_n_batch(llamafu->ctx));
+    const size_t n_embd_floats = static_cast<size_t>(llama_model_n_embd(llamafu->model));
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    LlamafuError result = LLAMAFU_SUCCESS;
+    for (size_t i = first_chunk; i < n_chunks && result == LLAMAFU_SUCCESS; ++i) {
+        if (i > first_chunk && generation_aborted(llamafu)) {
+            result = LLAMAFU_ERROR_ABORTED;
+            break;
+        }
+
+        const mtmd_input_chunk* chunk = mtmd_input_chunks_get(chunks, i);
+        const size_t chunk_end = i + 1 < n_chunks ? chunk_start[i + 1] : layout.size();
+        const llama_pos n_past = static_cast<llama_pos>(cached.size());
+
+        if (mtmd_input_chunk_get_type(chunk) == MTMD_INPUT_CHUNK_TYPE_TEXT) {
+            result = decode_seq_tokens(llamafu, batch, n_batch, layout.data() + cached.size(),
+                                       static_cast<int32_t>(chunk_end - cached.size()), n_past, 0);
+            if (result == LLAMAFU_ERROR_DECODE_FAILED) {
+                result = fail(result);
+            }
+        } else {
+            const ImageSource& source = sources[n_media++];
+            const size_t n_floats = mtmd_input_chunk_get_n_tokens(chunk) * n_embd_floats;
+            ImageCacheEntry entry;
+            if (!use_cache || !image_cache_fetch(llamafu, source, entry) || entry.embeddings.size() != n_floats) {
+                entry = ImageCacheEntry{};
+                entry.key = source.key;
+                entry.source_size = source.n_bytes;
+                entry.n_tokens = static_cast<int32_t>(mtmd_input_chunk_get_n_tokens(chunk));
+                entry.processed_width = llamafu->vision_image_size;
+                entry.processed_height = llamafu->vision_image_size;
+                if (!encode_media_chunk(llamafu, chunk, entry.embeddings)) {
+                    result = fail(LLAMAFU_ERROR_VISION_PROCESS_FAILED);
+                    break;
+                }
+                if (use_cache) {
+                    image_cache_store(llamafu, entry);
+                }
+            }
+            llama_pos new_n_past = n_past;
+            if (mtmd_helper_decode_image_chunk(llamafu->mtmd_ctx, llamafu->ctx, chunk, entry.embeddings.data(),
+                                               n_past, 0, n_batch, &new_n_past) != 0) {
+                result = fail(LLAMAFU_ERROR_DECODE_FAILED);
+                break;
+            }
+        }
+        if (result == LLAMAFU_SUCCESS) {
+            cached.insert(cached.end(), layout.begin() + cached.size(), layout.begin() + chunk_end);
+        }
+    }
+    llama_batch_free(batch);
+    return result;
+}
+
+// Count of non-overlapping occurrences of needle in text
+static size_t count_occurrences(const std::string& text, const std::string& needle) {
+    size_t n = 0;
+    for (size_t pos = text.find(needle); !needle.empty() && pos != std::string::npos;
+         pos = text.find(needle, pos + needle.size())) {
+        n++;
+    }
+    return n;
+}
+
+// Prompt with one mtmd marker per media input. A custom image_token_format
+// in the prompt is rewritten to the marker; without any markers, they are
+// placed before the text (preserve_image_order) or after it. A text chunk
+// must follow the last media chunk, so a trailing marker gets a newline.
+static std::string build_multimodal_prompt(const LlamafuMultimodalInferParams* params) {
+    const std::string marker = mtmd_default_marker();
+    std::string prompt = params->prompt;
+
+    if (params->image_token_format && *params->image_token_format && marker != params->image_token_format) {
+        const std::string custom = params->image_token_format;
+        for (size_t pos = prompt.find(custom); pos != std::string::npos; pos = prompt.find(custom, pos + marker.size())) {
+            prompt.replace(pos, custom.size(), marker);
+        }
+    }
+
+    if (params->n_media_inputs > 0 && count_occurrences(prompt, marker) == 0) {
+        std::string markers;
+        for (size_t i = 0; i < params->n_media_inputs; ++i) {
+            markers += marker;
+        }
+        prompt = params->preserve_image_order ? markers + "\n" + prompt : prompt + "\n" + markers;
+    }
+
+    if (prompt.size() >= marker.size() && prompt.compare(prompt.size() - marker.size(), marker.size(), marker) == 0) {
+        prompt += "\n";
+    }
+    return prompt;
+}
+
+// Tokenize a prompt with its media through mtmd, prefill it and generate,
+// handing every piece to the sink. Shared by the blocking and streaming
+// multimodal entry points.
+static LlamafuError generate_multimodal_pieces(Llamafu llamafu, const LlamafuMultimodalInferParams* params,
+                                               const std::atomic<bool>* cancel, const PieceSink& sink) {
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+    }
+    if (!vision_ready(llamafu)) {
+        return params->n_media_inputs > 0 ? LLAMAFU_ERROR_VISION_INIT_FAILED : LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    }
+    if (params->n_media_inputs > 0 && !params->media_inputs) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    RequestMetricsScope request_metrics(llamafu);
+
+    // Sources are kept for the cache lookups during prefill; bitmaps only
+    // until tokenization
+    std::vector<ImageSource> sources(params->n_media_inputs);
+    std::vector<MtmdBitmap> bitmaps;
+    std::vector<const mtmd_bitmap*> bitmap_ptrs;
+    bitmaps.reserve(params->n_media_inputs);
+    for (size_t i = 0; i < params->n_media_inputs; ++i) {
+        const LlamafuMediaInput* input = &params->media_inputs[i];
+        if (input->type != LLAMAFU_MEDIA_TYPE_IMAGE && input->type != LLAMAFU_MEDIA_TYPE_AUDIO) {
+            return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+        }
+        LlamafuError result = read_image_source(input, sources[i]);
+        if (result != LLAMAFU_SUCCESS) {
+            return result;
+        }
+        bitmaps.emplace_back(nullptr, mtmd_bitmap_free);
+        int32_t width = 0, height = 0;
+        result = load_media_bitmap(llamafu, input, sources[i], bitmaps.back(), width, height);
+        if (result != LLAMAFU_SUCCESS) {
+            return result;
+        }
+        bitmap_ptrs.push_back(bitmaps.back().get());
+    }
+
+    const std::string prompt = build_multimodal_prompt(params);
+    MtmdChunks chunks(mtmd_input_chunks_init(), mtmd_input_chunks_free);
+    if (!chunks) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    }
+    const mtmd_input_text text = {prompt.c_str(), true, true};
+    int32_t tokenize_result = 0;
+    {
+        LLAMAFU_TRACE_SCOPE("llamafu.tokenize");
+        PhaseTimer timer(metrics_field(llamafu, &RequestMetrics::t_tokenize_ms));
+        tokenize_result = mtmd_tokenize(llamafu->mtmd_ctx, chunks.get(), &text,
+                                        bitmap_ptrs.data(), bitmap_ptrs.size());
+    }
+    if (tokenize_result != 0) {
+        // 1: marker count does not match the inputs; 2: preprocessing failed
+        return tokenize_result == 1 ? LLAMAFU_ERROR_INVALID_PARAM : LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+    }
+    bitmaps.clear();
+
+    // Request-specific adapters, restored when this returns
+    ScopedLoraSet lora_scope{llamafu};
+    if (params->lora_batch) {
+        LoraSet lora;
+        LlamafuError lora_result = resolve_lora_set(llamafu, params->lora_batch, lora);
+        if (lora_result != LLAMAFU_SUCCESS) {
+            return lora_result;
+        }
+        lora_scope.applied = true;
+        if (!apply_lora_set(llamafu, lora)) {
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
+    }
+
+    llamafu->active_metrics->n_prompt_tokens = static_cast<int32_t>(mtmd_helper_get_n_tokens(chunks.get()));
+    LlamafuError prefill_result = LLAMAFU_SUCCESS;
+    {
+        LLAMAFU_TRACE_SCOPE("llamafu.prefill");
+        PhaseTimer timer(metrics_field(llamafu, &RequestMetrics::t_prefill_ms));
+        prefill_result = prefill_multimodal(llamafu, chunks.get(), sources, params->use_vision_cache);
+    }
+    if (prefill_result != LLAMAFU_SUCCESS) {
+        return prefill_result;
+    }
+
+    LlamafuInferParams sampling = {};
+    sampling.prompt = params->prompt;
+    sampling.max_tokens = params->max_tokens;
+    sampling.temperature = params->temperature;
+    sampling.top_k = params->top_k;
+    sampling.top_p = params->top_p;
+    sampling.min_p = params->min_p;
+    sampling.repeat_penalty = params->repeat_penalty;
+    SamplerPipeline* smpl = nullptr;
+    LlamafuError sampler_result = acquire_sampler_for(llamafu, &sampling, &smpl);
+    if (sampler_result != LLAMAFU_SUCCESS) {
+        return sampler_result;
+    }
+
+    const int32_t max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
+    return run_generation(llamafu, smpl, max_tokens, true, cancel, sink);
+}
+
+// =============================================================================
+// Enhanced Multimodal Completion API
+// =============================================================================
+
+LlamafuError llamafu_multimodal_complete_enhanced(Llamafu llamafu, LlamafuMultimodalInferParams* params, char** out_result) {
+    if (!llamafu || !params || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!llamafu->is_multimodal) {
+        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    }
+
+    if (!validate_string_param(params->prompt, "prompt")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        std::string result;
+        LlamafuError err = generate_multimodal_pieces(llamafu, params, nullptr,
+            [&](llama_token, const char* piece, int32_t len) {
+                result.append(piece, len);
+                return true;
+            });
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+
+        *out_result = static_cast<char*>(malloc(result.length() + 1));
+        if (!*out_result) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+        strcpy(*out_result, result.c_str());
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_multimodal_complete_streaming(Llamafu llamafu, LlamafuMultimodalInferParams* params, 
+                                                  LlamafuStreamCallback callback, void* user_data) {
+    if (!llamafu || !params || !callback) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!llamafu->is_multimodal) {
+        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    }
+
+    if (!validate_string_param(params->prompt, "prompt")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        RequestMetricsScope request_metrics(llamafu);
+        // Only whole characters reach the callback
+        StreamDetokenizer detok;
+        auto callback_emit = [&](const char* text, size_t) { callback(text, user_data); };
+        auto emit = timed_emit(llamafu, callback_emit);
+        LlamafuError err = generate_multimodal_pieces(llamafu, params, nullptr,
+            [&](llama_token, const char* piece, int32_t len) {
+                detok.push(piece, len, emit);
+                return true;
+            });
+        PhaseTimer flush_timer(metrics_field(llamafu, &RequestMetrics::t_sink_ms));
+        detok.flush(emit);
+        return err;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// Convenience Functions for Common Use Cases
+// =============================================================================
+
+LlamafuError llamafu_chat_with_image_file(Llamafu llamafu, const char* prompt, const char* image_path, 
+                                          int32_t max_tokens, char** out_result) {
+    if (!llamafu || !validate_string_param(prompt, "prompt") || 
+        !validate_string_param(image_path, "image_path") || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Create image input
+        LlamafuMediaInput image_input;
+        LlamafuError load_result = llamafu_image_load_from_file(image_path, LLAMAFU_IMAGE_FORMAT_AUTO, &image_input);
+        if (load_result != LLAMAFU_SUCCESS) {
+            return load_result;
+        }
+
+        // Create multimodal parameters
+        LlamafuMultimodalInferParams mm_params = {};
+        mm_params.prompt = prompt;
+        mm_params.media_inputs = &image_input;
+        mm_params.n_media_inputs = 1;
+        mm_params.max_tokens = max_tokens > 0 ? max_tokens : 512;
+        mm_params.temperature = 0.7f;
+        mm_params.top_k = 40;
+        mm_params.top_p = 0.9f;
+        mm_params.include_image_tokens = true;
+        mm_params.preserve_image_order = true;
+        mm_params.use_vision_cache = true;
+
+        return llamafu_multimodal_complete_enhanced(llamafu, &mm_params, out_result);
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_chat_with_image_base64(Llamafu llamafu, const char* prompt, const char* image_base64, 
+                                           int32_t max_tokens, char** out_result) {
+    if (!llamafu || !validate_string_param(prompt, "prompt") || 
+        !validate_string_param(image_base64, "image_base64") || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Create image input
+        LlamafuMediaInput image_input;
+        LlamafuError load_result = llamafu_image_load_from_base64(image_base64, LLAMAFU_IMAGE_FORMAT_AUTO, &image_input);
+        if (load_result != LLAMAFU_SUCCESS) {
+            return load_result;
+        }
+
+        // Create multimodal parameters
+        LlamafuMultimodalInferParams mm_params = {};
+        mm_params.prompt = prompt;
+        mm_params.media_inputs = &image_input;
+        mm_params.n_media_inputs = 1;
+        mm_params.max_tokens = max_tokens > 0 ? max_tokens : 512;
+        mm_params.temperature = 0.7f;
+        mm_params.top_k = 40;
+        mm_params.top_p = 0.9f;
+        mm_params.include_image_tokens = true;
+        mm_params.preserve_image_order = true;
+        mm_params.use_vision_cache = true;
+
+        return llamafu_multimodal_complete_enhanced(llamafu, &mm_params, out_result);
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_chat_with_multiple_images(Llamafu llamafu, const char* prompt, const char** image_paths, 
+                                              size_t n_images, int32_t max_tokens, char** out_result) {
+    if (!llamafu || !validate_string_param(prompt, "prompt") || !image_paths || n_images == 0 || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Create image inputs array
+        std::vector<LlamafuMediaInput> image_inputs(n_images);
+        
+        for (size_t i = 0; i < n_images; ++i) {
+            if (!validate_string_param(image_paths[i], "image_path")) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            
+            LlamafuError load_result = llamafu_image_load_from_file(image_paths[i], LLAMAFU_IMAGE_FORMAT_AUTO, &image_inputs[i]);
+            if (load_result != LLAMAFU_SUCCESS) {
+                return load_result;
+            }
+        }
+
+        // Create multimodal parameters
+        LlamafuMultimodalInferParams mm_params = {};
+        mm_params.prompt = prompt;
+        mm_params.media_inputs = image_inputs.data();
+        mm_params.n_media_inputs = n_images;
+        mm_params.max_tokens = max_tokens > 0 ? max_tokens : 512;
+        mm_params.temperature = 0.7f;
+        mm_params.top_k = 40;
+        mm_params.top_p = 0.9f;
+        mm_params.include_image_tokens = true;
+        mm_params.preserve_image_order = true;
+        mm_params.use_vision_cache = true;
+
+        return llamafu_multimodal_complete_enhanced(llamafu, &mm_params, out_result);
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// Model Information and Utility Functions
+// =============================================================================
+
+LlamafuError llamafu_get_image_requirements(Llamafu llamafu, int32_t* out_max_width, int32_t* out_max_height, 
+                                           int32_t* out_preferred_size, bool* out_requires_square) {
+    if (!llamafu || !out_max_width || !out_max_height || !out_preferred_size || !out_requires_square) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!llamafu->is_multimodal) {
+        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        if (!vision_ready(llamafu)) {
+            return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+        }
+
+        // Input size the projector was trained at
+        int32_t image_size = llamafu->vision_image_size;
+        
+        *out_max_width = image_size;
+        *out_max_height = image_size;
+        *out_preferred_size = image_size;
+        *out_requires_square = true; // Most vision models expect square images
+        
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_get_supported_formats(LlamafuImageFormat** out_formats, size_t* out_n_formats) {
+    if (!out_formats || !out_n_formats) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    static LlamafuImageFormat supported_formats[] = {
+        LLAMAFU_IMAGE_FORMAT_JPEG,
+        LLAMAFU_IMAGE_FORMAT_PNG,
+        LLAMAFU_IMAGE_FORMAT_BMP,
+        LLAMAFU_IMAGE_FORMAT_WEBP
+    };
+
+    *out_n_formats = sizeof(supported_formats) / sizeof(supported_formats[0]);
+    *out_formats = static_cast<LlamafuImageFormat*>(malloc(*out_n_formats * sizeof(LlamafuImageFormat)));
+    
+    if (!*out_formats) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    }
+
+    memcpy(*out_formats, supported_formats, *out_n_formats * sizeof(LlamafuImageFormat));
+    return LLAMAFU_SUCCESS;
+}
+
+// =============================================================================
+// Memory Management Functions
+// =============================================================================
+
+void llamafu_media_input_free(LlamafuMediaInput* input) {
+    if (input) {
+        // Note: We don't free input->data as it's owned by the caller
+        memset(input, 0, sizeof(LlamafuMediaInput));
+    }
+}
+
+void llamafu_media_batch_free(LlamafuMediaBatch* batch) {
+    if (batch) {
+        if (batch->inputs) {
+            for (size_t i = 0; i < batch->n_inputs; ++i) {
+                llamafu_media_input_free(&batch->inputs[i]);
+            }
+            free(batch->inputs);
+        }
+        memset(batch, 0, sizeof(LlamafuMediaBatch));
+    }
+}
+
+void llamafu_image_process_result_free(LlamafuImageProcessResult* result) {
+    if (result) {
+        if (result->embeddings) {
+            free(result->embeddings);
+        }
+        memset(result, 0, sizeof(LlamafuImageProcessResult));
+    }
+}
+
+void llamafu_image_validation_free(LlamafuImageValidation* validation) {
+    if (validation) {
+        memset(validation, 0, sizeof(LlamafuImageValidation));
+    }
+}
+
+
+// =============================================================================
+// JSON Schema to GBNF Grammar Conversion
+// =============================================================================
+
+// Minimal JSON document tree; object members keep their declaration order
+struct JsonNode {
+    enum Kind { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+    Kind kind = NUL;
+    bool boolean = false;
+    std::string text;                      // String value, or the raw number literal
+    std::vector<JsonNode> items;
+    std::vector<std::pair<std::string, JsonNode>> members;
+
+    const JsonNode* get(const std::string& key) const {
+        for (const auto& member : members) {
+            if (member.first == key) {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Recursive-descent JSON parser; throws std::invalid_argument on bad input
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& input) : input_(input) {}
+
+    JsonNode parse() {
+        JsonNode node = parse_value(0);
+        skip_ws();
+        if (pos_ != input_.size()) {
+            fail("trailing characters");
+        }
+        return node;
+    }
+
+private:
+    static const int MAX_DEPTH = 64;
+
+    const std::string& input_;
+    size_t pos_ = 0;
+
+    [[noreturn]] void fail(const char* what) {
+        throw std::invalid_argument(std::string("invalid JSON: ") + what);
+    }
+
+    void skip_ws() {
+        while (pos_ < input_.size() && std::isspace(static_cast<unsigned char>(input_[pos_]))) {
+            pos_++;
+        }
+    }
+
+    bool consume(char c) {
+        skip_ws();
+        if (pos_ < input_.size() && input_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c)) {
+            fail("unexpected character");
+        }
+    }
+
+    bool consume_word(const char* word) {
+        const size_t n = strlen(word);
+        if (input_.compare(pos_, n, word) == 0) {
+            pos_ += n;
+            return true;
+        }
+        return false;
+    }
+
+    static void append_utf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    uint32_t parse_hex4() {
+        if (pos_ + 4 > input_.size()) {
+            fail("truncated escape");
+        }
+        uint32_t cp = 0;
+        for (int i = 0; i < 4; i++) {
+            const char c = input_[pos_++];
+            cp <<= 4;
+            if (c >= '0' && c <= '9') cp |= c - '0';
+            else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+            else fail("bad unicode escape");
+        }
+        return cp;
+    }
+
+    std::string parse_string() {
+        expect('"');
+        std::string out;
+        while (true) {
+            if (pos_ >= input_.size()) {
+                fail("unterminated string");
+            }
+            const char c = input_[pos_++];
+            if (c == '"') {
+                return out;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= input_.size()) {
+                fail("unterminated escape");
+            }
+            const char e = input_[pos_++];
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t cp = parse_hex4();
+                    if (cp >= 0xD800 && cp <= 0xDBFF && consume_word("\\u")) {
+                        const uint32_t low = parse_hex4();
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(out, cp);
+                    break;
+                }
+                default: fail("bad escape");
+            }
+        }
+    }
+
+    JsonNode parse_value(int depth) {
+        if (depth > MAX_DEPTH) {
+            fail("nesting too deep");
+        }
+        skip_ws();
+        if (pos_ >= input_.size()) {
+            fail("unexpected end");
+        }
+
+        JsonNode node;
+        const char c = input_[pos_];
+        if (c == '{') {
+            pos_++;
+            node.kind = JsonNode::OBJECT;
+            if (consume('}')) {
+                return node;
+            }
+            do {
+                skip_ws();
+                std::string key = parse_string();
+                expect(':');
+                node.members.emplace_back(std::move(key), parse_value(depth + 1));
+            } while (consume(','));
+            expect('}');
+        } else if (c == '[') {
+            pos_++;
+            node.kind = JsonNode::ARRAY;
+            if (consume(']')) {
+                return node;
+            }
+            do {
+                node.items.push_back(parse_value(depth + 1));
+            } while (consume(','));
+            expect(']');
+        } else if (c == '"') {
+            node.kind = JsonNode::STRING;
+            node.text = parse_string();
+        } else if (consume_word("true")) {
+            node.kind = JsonNode::BOOLEAN;
+            node.boolean = true;
+        } else if (consume_word("false")) {
+            node.kind = JsonNode::BOOLEAN;
+        } else if (consume_word("null")) {
+            node.kind = JsonNode::NUL;
+        } else if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+            const size_t start = pos_++;
+            while (pos_ < input_.size() && strchr("0123456789.eE+-", input_[pos_])) {
+                pos_++;
+            }
+            node.kind = JsonNode::NUMBER;
+            node.text = input_.substr(start, pos_ - start);
+        } else {
+            fail("unexpected character");
+        }
+        return node;
+    }
+};
+
+static std::string json_quote(const std::string& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out + "\"";
+}
+
+// Compact serialization, used for enum and const literals
+static std::string json_dump(const JsonNode& node) {
+    switch (node.kind) {
+        case JsonNode::NUL: return "null";
+        case JsonNode::BOOLEAN: return node.boolean ? "true" : "false";
+        case JsonNode::NUMBER: return node.text;
+        case JsonNode::STRING: return json_quote(node.text);
+        case JsonNode::ARRAY: {
+            std::string out = "[";
+            for (size_t i = 0; i < node.items.size(); i++) {
+                if (i > 0) out += ",";
+                out += json_dump(node.items[i]);
+            }
+            return out + "]";
+        }
+        case JsonNode::OBJECT: {
+            std::string out = "{";
+            for (size_t i = 0; i < node.members.size(); i++) {
+                if (i > 0) out += ",";
+                out += json_quote(node.members[i].first) + ":" + json_dump(node.members[i].second);
+            }
+            return out + "}";
+        }
+    }
+    return "null";
+}
+
+// Quoted GBNF literal matching text exactly
+static std::string gbnf_literal(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// Shared rules, emitted only when referenced. Whitespace is capped so the
+// model cannot pad the output indefinitely.
+static const std::vector<std::pair<std::string, std::string>>& gbnf_primitives() {
+    static const std::vector<std::pair<std::string, std::string>> primitives = {
+        {"ws", R"(| " " | "\n" [ \t]{0,20})"},
+        {"char", R"([^"\\\x7F\x00-\x1F] | [\\] (["\\/bfnrt] | "u" [0-9a-fA-F]{4}))"},
+        {"string", R"("\"" char* "\"")"},
+        {"integer", R"("-"? ("0" | [1-9] [0-9]{0,15}))"},
+        {"number", R"(integer ("." [0-9]+)? ([eE] [-+]? [0-9]+)?)"},
+        {"boolean", R"("true" | "false")"},
+        {"null", R"("null")"},
+        {"value", R"(object | array | string | number | boolean | null)"},
+        {"object", R"("{" ws (string ws ":" ws value (ws "," ws string ws ":" ws value)*)? ws "}")"},
+        {"array", R"("[" ws (value (ws "," ws value)*)? ws "]")"},
+    };
+    return primitives;
+}
+
+// Compiles JSON Schema nodes into GBNF rules. Objects get a fixed key order
+// with required/optional properties, enums and consts become literal
+// alternations and arrays honour minItems/maxItems. Supported keywords:
+// type (single or list), properties, required, items, minItems, maxItems,
+// minLength, maxLength, enum, const, anyOf, oneOf, allOf and local $ref.
+class GbnfSchemaCompiler {
+public:
+    GbnfSchemaCompiler() {
+        for (const auto& primitive : gbnf_primitives()) {
+            taken_.insert(primitive.first);
+        }
+        use("ws");
+    }
+
+    // Emit rules for schema under the given rule name; $refs resolve
+    // against document
+    std::string compile(const JsonNode& schema, const JsonNode& document, const std::string& name) {
+        document_ = &document;
+        const std::string rule = reserve(name);
+        define(rule, expression(schema, rule));
+        return rule;
+    }
+
+    // Mark a shared rule (ws, string, object, ...) as referenced
+    std::string require(const std::string& primitive) {
+        return use(primitive);
+    }
+
+    std::string grammar() {
+        std::string out;
+        for (const auto& rule : rules_) {
+            out += rule.first + " ::= " + rule.second + "\n";
+        }
+        for (const auto& primitive : gbnf_primitives()) {
+            if (used_.count(primitive.first)) {
+                out += primitive.first + " ::= " + primitive.second + "\n";
+            }
+        }
+        return out;
+    }
+
+private:
+    const JsonNode* document_ = nullptr;
+    std::vector<std::pair<std::string, std::string>> rules_;
+    std::set<std::string> taken_;
+    std::set<std::string> used_;
+    std::map<std::string, std::string> ref_rules_;
+
+    std::string use(const std::string& primitive) {
+        if (used_.insert(primitive).second) {
+            if (primitive == "string") {
+                use("char");
+            } else if (primitive == "number") {
+                use("integer");
+            } else if (primitive == "value") {
+                for (const char* dep : {"object", "array", "string", "number", "boolean", "null"}) {
+                    use(dep);
+                }
+            } else if (primitive == "object") {
+                use("string");
+                use("value");
+            } else if (primitive == "array") {
+                use("value");
+            }
+        }
+        return primitive;
+    }
+
+    std::string reserve(const std::string& hint) {
+        std::string base;
+        for (char c : hint) {
+            base += std::isalnum(static_cast<unsigned char>(c)) ? c : '-';
+        }
+        if (base.empty()) {
+            base = "rule";
+        }
+        std::string name = base;
+        for (int i = 1; taken_.count(name); i++) {
+            name = base + "-" + std::to_string(i);
+        }
+        taken_.insert(name);
+        return name;
+    }
+
+    void define(const std::string& name, const std::string& body) {
+        rules_.emplace_back(name, body);
+    }
+
+    // Rule name for a sub-schema, creating a rule unless the expression is
+    // already a single symbol
+    std::string rule_for(const JsonNode& schema, const std::string& hint) {
+        const std::string expr = expression(schema, hint);
+        if (expr.find_first_of(" |()") == std::string::npos) {
+            return expr;
+        }
+        const std::string name = reserve(hint);
+        define(name, expr);
+        return name;
+    }
+
+    std::string alternatives(const std::vector<std::string>& options) {
+        if (options.size() == 1) {
+            return options[0];
+        }
+        std::string out = "(";
+        for (size_t i = 0; i < options.size(); i++) {
+            if (i > 0) out += " | ";
+            out += options[i];
+        }
+        return out + ")";
+    }
+
+    static int64_t int_field(const JsonNode& schema, const char* key, int64_t fallback) {
+        const JsonNode* node = schema.get(key);
+        if (node && node->kind == JsonNode::NUMBER) {
+            return std::max<int64_t>(0, static_cast<int64_t>(std::strtod(node->text.c_str(), nullptr)));
+        }
+        return fallback;
+    }
+
+    // "{m,n}", "{m,}" or "*" for a repetition count range
+    static std::string repetition(int64_t min_count, int64_t max_count) {
+        if (min_count == 0 && max_count < 0) {
+            return "*";
+        }
+        return "{" + std::to_string(min_count) + "," + (max_count >= 0 ? std::to_string(max_count) : "") + "}";
+    }
+
+    const JsonNode& resolve(const std::string& ref) {
+        if (ref.empty() || ref[0] != '#') {
+            throw std::invalid_argument("only local $ref is supported: " + ref);
+        }
+        const JsonNode* node = document_;
+        size_t pos = 1;
+        while (pos < ref.size()) {
+            if (ref[pos] != '/') {
+                throw std::invalid_argument("bad $ref: " + ref);
+            }
+            size_t next = ref.find('/', pos + 1);
+            if (next == std::string::npos) next = ref.size();
+            std::string segment = ref.substr(pos + 1, next - pos - 1);
+            for (size_t i; (i = segment.find("~1")) != std::string::npos;) segment.replace(i, 2, "/");
+            for (size_t i; (i = segment.find("~0")) != std::string::npos;) segment.replace(i, 2, "~");
+            node = node->get(segment);
+            if (!node) {
+                throw std::invalid_argument("unresolved $ref: " + ref);
+            }
+            pos = next;
+        }
+        return *node;
+    }
+
+    std::string expression(const JsonNode& schema, const std::string& hint) {
+        if (schema.kind != JsonNode::OBJECT) {
+            return use("value");             // true / {} accept anything
+        }
+
+        if (const JsonNode* ref = schema.get("$ref")) {
+            if (ref->kind != JsonNode::STRING) {
+                throw std::invalid_argument("$ref must be a string");
+            }
+            auto it = ref_rules_.find(ref->text);
+            if (it != ref_rules_.end()) {
+                return it->second;
+            }
+            const std::string name = reserve(ref->text.substr(ref->text.rfind('/') + 1));
+            ref_rules_[ref->text] = name;
+            define(name, expression(resolve(ref->text), name));
+            return name;
+        }
+
+        if (const JsonNode* constant = schema.get("const")) {
+            return gbnf_literal(json_dump(*constant));
+        }
+
+        if (const JsonNode* values = schema.get("enum")) {
+            if (values->kind != JsonNode::ARRAY || values->items.empty()) {
+                throw std::invalid_argument("enum must be a non-empty array");
+            }
+            std::vector<std::string> options;
+            for (const auto& value : values->items) {
+                options.push_back(gbnf_literal(json_dump(value)));
+            }
+            return alternatives(options);
+        }
+
+        for (const char* key : {"anyOf", "oneOf"}) {
+            if (const JsonNode* variants = schema.get(key)) {
+                if (variants->kind != JsonNode::ARRAY || variants->items.empty()) {
+                    throw std::invalid_argument(std::string(key) + " must be a non-empty array");
+                }
+                std::vector<std::string> options;
+                for (size_t i = 0; i < variants->items.size(); i++) {
+                    options.push_back(rule_for(variants->items[i], hint + "-" + std::to_string(i)));
+                }
+                return alternatives(options);
+            }
+        }
+
+        if (const JsonNode* parts = schema.get("allOf")) {
+            return expression(merge_all_of(schema, *parts), hint);
+        }
+
+        const JsonNode* type = schema.get("type");
+        if (type && type->kind == JsonNode::ARRAY) {
+            std::vector<std::string> options;
+            for (const auto& t : type->items) {
+                if (t.kind == JsonNode::STRING) {
+                    options.push_back(typed_expression(schema, t.text, hint + "-" + t.text));
+                }
+            }
+            if (options.empty()) {
+                return use("value");
+            }
+            return alternatives(options);
+        }
+
+        std::string type_name;
+        if (type && type->kind == JsonNode::STRING) {
+            type_name = type->text;
+        } else if (schema.get("properties")) {
+            type_name = "object";
+        } else if (schema.get("items")) {
+            type_name = "array";
+        }
+        return typed_expression(schema, type_name, hint);
+    }
+
+    std::string typed_expression(const JsonNode& schema, const std::string& type, const std::string& hint) {
+        if (type == "string") {
+            const int64_t min_length = int_field(schema, "minLength", 0);
+            const int64_t max_length = int_field(schema, "maxLength", -1);
+            if (min_length == 0 && max_length < 0) {
+                return use("string");
+            }
+            use("char");
+            return "\"\\\"\" char" + repetition(min_length, max_length) + " \"\\\"\"";
+        }
+        if (type == "integer" || type == "number" || type == "boolean" || type == "null") {
+            return use(type);
+        }
+        if (type == "array") {
+            return array_expression(schema, hint);
+        }
+        if (type == "object") {
+            return object_expression(schema, hint);
+        }
+        return use("value");
+    }
+
+    std::string array_expression(const JsonNode& schema, const std::string& hint) {
+        const JsonNode* items = schema.get("items");
+        const std::string item = items ? rule_for(*items, hint + "-item") : use("value");
+        const int64_t min_items = int_field(schema, "minItems", 0);
+        const int64_t max_items = int_field(schema, "maxItems", -1);
+
+        if (max_items == 0) {
+            return "\"[\" ws \"]\"";
+        }
+        const std::string tail = "(ws \",\" ws " + item + ")" +
+            repetition(std::max<int64_t>(0, min_items - 1), max_items >= 0 ? max_items - 1 : -1);
+        const std::string list = item + " " + tail;
+        if (min_items == 0) {
+            return "\"[\" ws (" + list + ")? ws \"]\"";
+        }
+        return "\"[\" ws " + list + " ws \"]\"";
+    }
+
+    std::string object_expression(const JsonNode& schema, const std::string& hint) {
+        const JsonNode* properties = schema.get("properties");
+        if (!properties || properties->kind != JsonNode::OBJECT || properties->members.empty()) {
+            return use("object");
+        }
+
+        std::set<std::string> required;
+        if (const JsonNode* req = schema.get("required")) {
+            for (const auto& name : req->items) {
+                if (name.kind == JsonNode::STRING) {
+                    required.insert(name.text);
+                }
+            }
+        }
+
+        // "key": value pairs in declaration order
+        std::vector<std::string> pairs;
+        std::vector<bool> is_required;
+        for (const auto& member : properties->members) {
+            const std::string value = rule_for(member.second, hint + "-" + member.first);
+            pairs.push_back(gbnf_literal(json_quote(member.first)) + " ws \":\" ws " + value);
+            is_required.push_back(required.count(member.first) > 0);
+        }
+
+        // Whichever property is emitted first has no leading comma; it can
+        // only be preceded by skipped optional ones
+        std::vector<std::string> starts;
+        bool any_required = false;
+        for (size_t first = 0; first < pairs.size(); first++) {
+            std::string seq = pairs[first];
+            for (size_t j = first + 1; j < pairs.size(); j++) {
+                const std::string item = "ws \",\" ws " + pairs[j];
+                seq += is_required[j] ? " " + item : " (" + item + ")?";
+            }
+            starts.push_back(seq);
+            if (is_required[first]) {
+                any_required = true;
+                break;
+            }
+        }
+
+        std::string body = starts.size() == 1 ? starts[0] : alternatives(starts);
+        if (!any_required) {
+            body = "(" + body + ")?";
+        }
+        return "\"{\" ws " + body + " ws \"}\"";
+    }
+
+    // Combine allOf object parts into one schema; other keywords come from
+    // the first part that has them
+    static JsonNode merge_all_of(const JsonNode& schema, const JsonNode& parts) {
+        JsonNode merged;
+        merged.kind = JsonNode::OBJECT;
+        JsonNode properties;
+        properties.kind = JsonNode::OBJECT;
+        JsonNode required;
+        required.kind = JsonNode::ARRAY;
+
+        auto absorb = [&](const JsonNode& part) {
+            for (const auto& member : part.members) {
+                if (member.first == "properties") {
+                    for (const auto& prop : member.second.members) {
+                        properties.members.push_back(prop);
+                    }
+                } else if (member.first == "required") {
+                    for (const auto& item : member.second.items) {
+                        required.items.push_back(item);
+                    }
+                } else if (member.first != "allOf" && !merged.get(member.first)) {
+                    merged.members.push_back(member);
+                }
+            }
+        };
+        absorb(schema);
+        for (const auto& part : parts.items) {
+            absorb(part);
+        }
+        if (!properties.members.empty()) {
+            merged.members.emplace_back("properties", properties);
+            if (!merged.get("type")) {
+                JsonNode type;
+                type.kind = JsonNode::STRING;
+                type.text = "object";
+                merged.members.emplace_back("type", type);
+            }
+        }
+        if (!required.items.empty()) {
+            merged.members.emplace_back("required", required);
+        }
+        return merged;
+    }
+};
+
+// Compiled grammars keyed by their source text (schema, or tool list), so a
+// schema reused across requests is parsed and compiled once
+static const size_t SCHEMA_GRAMMAR_CACHE_CAPACITY = 32;
+
+static std::string memoized_grammar(const std::string& source, const std::function<std::string()>& build) {
+    struct Entry {
+        size_t key;
+        std::string source;
+        std::string grammar;
+    };
+    static std::mutex mutex;
+    static std::list<Entry> cache;
+
+    const size_t key = std::hash<std::string>{}(source);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->key == key && it->source == source) {
+                cache.splice(cache.begin(), cache, it);
+                return cache.front().grammar;
+            }
+        }
+    }
+
+    std::string grammar = build();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.push_front(Entry{key, source, grammar});
+    if (cache.size() > SCHEMA_GRAMMAR_CACHE_CAPACITY) {
+        cache.pop_back();
+    }
+    return grammar;
+}
+
+// Parse simple JSON to extract field
+static std::string extract_json_field(const std::string& json, const std::string& field) {
+    std::string search = "\"" + field + "\"";
+    size_t pos = json.find(search);
+    if (pos == std::string::npos) return "";
+    
+    pos = json.find(':', pos);
+    if (pos == std::string::npos) return "";
+    pos++;
+    
+    // Skip whitespace
+    while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\n' || json[pos] == '\t')) pos++;
+    
+    if (pos >= json.size()) return "";
+    
+    // Extract value
+    if (json[pos] == '"') {
+        // String value
+        size_t end = json.find('"', pos + 1);
+        if (end != std::string::npos) {
+            return json.substr(pos + 1, end - pos - 1);
+        }
+    } else if (json[pos] == '{' || json[pos] == '[') {
+        // Object or array - find matching bracket
+        char open = json[pos];
+        char close = (open == '{') ? '}' : ']';
+        int depth = 1;
+        size_t end = pos + 1;
+        while (end < json.size() && depth > 0) {
+            if (json[end] == open) depth++;
+            else if (json[end] == close) depth--;
+            end++;
+        }
+        return json.substr(pos, end - pos);
+    } else {
+        // Primitive value
+        size_t end = pos;
+        while (end < json.size() && json[end] != ',' && json[end] != '}' && json[end] != ']') end++;
+        std::string val = json.substr(pos, end - pos);
+        // Trim
+        while (!val.empty() && (val.back() == ' ' || val.back() == '\n')) val.pop_back();
+        return val;
+    }
+    return "";
+}
+
+LlamafuError llamafu_schema_to_grammar(const char* json_schema, char** out_grammar) {
+    if (!json_schema || !out_grammar) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        const std::string grammar = memoized_grammar(json_schema, [&]() {
+            const JsonNode schema = JsonParser(json_schema).parse();
+            GbnfSchemaCompiler compiler;
+            compiler.compile(schema, schema, "root");
+            return compiler.grammar();
+        });
+
+        *out_grammar = strdup(grammar.c_str());
+        if (!*out_grammar) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::invalid_argument& e) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// Tool Calling Implementation
+// =============================================================================
+
+LlamafuError llamafu_build_tool_grammar(const LlamafuTool* tools, size_t n_tools, 
+                                        bool allow_multiple, char** out_grammar) {
+    if (!tools || n_tools == 0 || !out_grammar) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Memoized on the tool list, so repeated calls reuse the compiled grammar
+        std::string source = allow_multiple ? "multi\n" : "single\n";
+        for (size_t i = 0; i < n_tools; i++) {
+            if (!tools[i].name) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            source += std::string(tools[i].name) + '\n' +
+                      (tools[i].parameters_schema ? tools[i].parameters_schema : "") + '\n';
+        }
+
+        const std::string grammar = memoized_grammar(source, [&]() {
+            GbnfSchemaCompiler compiler;
+            std::string rules;
+
+            if (allow_multiple) {
+                rules = "root ::= \"{\" ws \"\\\"tool_calls\\\"\" ws \":\" ws \"[\" ws tool-call (ws \",\" ws tool-call)* ws \"]\" ws \"}\"\n";
+            } else {
+                rules = "root ::= tool-call\n";
+            }
+
+            // One alternative per tool, binding its name to its argument schema
+            std::vector<std::string> calls;
+            for (size_t i = 0; i < n_tools; i++) {
+                std::string args = compiler.require("object");
+                if (tools[i].parameters_schema && *tools[i].parameters_schema) {
+                    const JsonNode schema = JsonParser(tools[i].parameters_schema).parse();
+                    args = compiler.compile(schema, schema, "tool-" + std::to_string(i) + "-args");
                 }
+                calls.push_back("\"{\" ws "
+                    "\"\\\"id\\\"\" ws \":\" ws string ws \",\" ws "
+                    "\"\\\"name\\\"\" ws \":\" ws " + gbnf_literal(json_quote(tools[i].name)) + " ws \",\" ws "
+                    "\"\\\"arguments\\\"\" ws \":\" ws " + args + " ws \"}\"");
+            }
+
+            compiler.require("string");
+            rules += "tool-call ::= ";
+            for (size_t i = 0; i < calls.size(); i++) {
+                if (i > 0) rules += " | ";
+                rules += calls[i];
+            }
+            rules += "\n";
+            return rules + compiler.grammar();
+        });
+
+        *out_grammar = strdup(grammar.c_str());
+        if (!*out_grammar) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+        
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::invalid_argument& e) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// Generate unique ID for tool call
+static std::string generate_call_id() {
+    static int call_counter = 0;
+    return "call_" + std::to_string(++call_counter);
+}
+
+// Parse tool call from generated JSON
+static bool parse_tool_call(const std::string& json, LlamafuToolCall* call) {
+    call->id = strdup(extract_json_field(json, "id").c_str());
+    if (!call->id || strlen(call->id) == 0) {
+        free(call->id);
+        call->id = strdup(generate_call_id().c_str());
+    }
+    
+    std::string name = extract_json_field(json, "name");
+    call->name = strdup(name.c_str());
+    
+    std::string args = extract_json_field(json, "arguments");
+    call->arguments_json = strdup(args.c_str());
+    
+    return call->name && strlen(call->name) > 0;
+}
+
+LlamafuError llamafu_generate_tool_call(Llamafu llamafu, const LlamafuToolCallParams* params,
+                                        LlamafuToolCall** out_calls, size_t* out_n_calls) {
+    if (!llamafu || !params || !out_calls || !out_n_calls) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Build grammar for tool calling
+        char* grammar = nullptr;
+        LlamafuError err = llamafu_build_tool_grammar(params->tools, params->n_tools, 
+                                                      params->allow_multiple_calls, &grammar);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+        
+        // Build prompt with tool definitions
+        std::string full_prompt = "You have access to the following tools:\n\n";
+        for (size_t i = 0; i < params->n_tools; i++) {
+            full_prompt += "- " + std::string(params->tools[i].name) + ": ";
+            full_prompt += std::string(params->tools[i].description) + "\n";
+            if (params->tools[i].parameters_schema) {
+                full_prompt += "  Parameters: " + std::string(params->tools[i].parameters_schema) + "\n";
+            }
+        }
+        full_prompt += "\nUser: " + std::string(params->prompt) + "\n";
+        full_prompt += "\nRespond with a tool call in JSON format:\n";
+        
+        // Set up inference parameters
+        LlamafuInferParams infer_params = {};
+        infer_params.prompt = full_prompt.c_str();
+        infer_params.max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
+        infer_params.temperature = params->temperature > 0 ? params->temperature : 0.1f;
+        infer_params.seed = params->seed;
+        infer_params.grammar_str = grammar;
+        infer_params.grammar_root = "root";
+        
+        // Generate
+        char* result = nullptr;
+        err = llamafu_complete(llamafu, &infer_params, &result);
+        free(grammar);
+        
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+        
+        // Parse result
+        std::string result_str(result);
+        free(result);
+        
+        if (params->allow_multiple_calls) {
+            // Parse array of tool calls
+            std::string calls_json = extract_json_field(result_str, "tool_calls");
+            // Simplified: assume single call for now
+            *out_n_calls = 1;
+            *out_calls = (LlamafuToolCall*)calloc(1, sizeof(LlamafuToolCall));
+            if (!*out_calls) {
+                return LLAMAFU_ERROR_OUT_OF_MEMORY;
+            }
+            // Parse from array - simplified
+            size_t start = calls_json.find('{');
+            size_t end = calls_json.rfind('}');
+            if (start != std::string::npos && end != std::string::npos) {
+                std::string call_json = calls_json.substr(start, end - start + 1);
+                parse_tool_call(call_json, &(*out_calls)[0]);
+            }
+        } else {
+            // Single tool call
+            *out_n_calls = 1;
+            *out_calls = (LlamafuToolCall*)calloc(1, sizeof(LlamafuToolCall));
+            if (!*out_calls) {
+                return LLAMAFU_ERROR_OUT_OF_MEMORY;
+            }
+            parse_tool_call(result_str, &(*out_calls)[0]);
+        }
+        
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_generate_tool_call_streaming(Llamafu llamafu, const LlamafuToolCallParams* params,
+                                                  LlamafuStreamCallback callback, void* user_data,
+                                                  LlamafuToolCall** out_calls, size_t* out_n_calls) {
+    // For now, use non-streaming and return result
+    // Streaming will call back with tokens as they're generated
+    return llamafu_generate_tool_call(llamafu, params, out_calls, out_n_calls);
+}
+
+void llamafu_free_tool_calls(LlamafuToolCall* calls, size_t n_calls) {
+    if (calls) {
+        for (size_t i = 0; i < n_calls; i++) {
+            free(calls[i].id);
+            free(calls[i].name);
+            free(calls[i].arguments_json);
+        }
+        free(calls);
+    }
+}
+
+// =============================================================================
+// JSON Output Implementation
+// =============================================================================
+
+LlamafuError llamafu_generate_json(Llamafu llamafu, const LlamafuJsonParams* params, char** out_json) {
+    if (!llamafu || !params || !out_json) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Convert schema to grammar
+        char* grammar = nullptr;
+        LlamafuError err = llamafu_schema_to_grammar(params->schema, &grammar);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+        
+        // Set up inference parameters
+        LlamafuInferParams infer_params = {};
+        infer_params.prompt = params->prompt;
+        infer_params.max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
+        infer_params.temperature = params->temperature > 0 ? params->temperature : 0.1f;
+        infer_params.seed = params->seed;
+        infer_params.grammar_str = grammar;
+        infer_params.grammar_root = "root";
+        
+        // Generate
+        err = llamafu_complete(llamafu, &infer_params, out_json);
+        free(grammar);
+        
+        return err;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_generate_json_streaming(Llamafu llamafu, const LlamafuJsonParams* params,
+                                             LlamafuStreamCallback callback, void* user_data) {
+    if (!llamafu || !params || !callback) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Convert schema to grammar
+        char* grammar = nullptr;
+        LlamafuError err = llamafu_schema_to_grammar(params->schema, &grammar);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+        
+        // Set up inference parameters
+        LlamafuInferParams infer_params = {};
+        infer_params.prompt = params->prompt;
+        infer_params.max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
+        infer_params.temperature = params->temperature > 0 ? params->temperature : 0.1f;
+        infer_params.seed = params->seed;
+        infer_params.grammar_str = grammar;
+        infer_params.grammar_root = "root";
+        
+        // Generate with streaming
+        err = llamafu_complete_stream(llamafu, &infer_params, callback, user_data);
+        free(grammar);
+        
+        return err;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_json_validate(const char* json_string, const char* schema, 
+                                   bool* out_valid, char** out_error) {
+    if (!json_string || !schema || !out_valid) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Basic JSON validation - check for balanced braces
+        int brace_count = 0;
+        int bracket_count = 0;
+        bool in_string = false;
+        bool escape_next = false;
+        
+        for (const char* p = json_string; *p; p++) {
+            if (escape_next) {
+                escape_next = false;
+                continue;
+            }
+            
+            if (*p == '\\') {
+                escape_next = true;
+                continue;
+            }
+            
+            if (*p == '"') {
+                in_string = !in_string;
+                continue;
+            }
+            
+            if (!in_string) {
+                if (*p == '{') brace_count++;
+                else if (*p == '}') brace_count--;
+                else if (*p == '[') bracket_count++;
+                else if (*p == ']') bracket_count--;
+            }
+        }
+        
+        *out_valid = (brace_count == 0 && bracket_count == 0 && !in_string);
+
+        if (!*out_valid && out_error) {
+            if (brace_count != 0) {
+                *out_error = strdup("Unbalanced braces in JSON");
+            } else if (bracket_count != 0) {
+                *out_error = strdup("Unbalanced brackets in JSON");
+            } else {
+                *out_error = strdup("Unterminated string in JSON");
+            }
+        }
+
+        return LLAMAFU_SUCCESS;
+
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// KV Cache Management and Streaming - extern "C" to prevent name mangling
+// =============================================================================
+
+extern "C" {
+
+void llamafu_kv_cache_clear(Llamafu llamafu) {
+    if (!llamafu) {
+        return;
+    }
+    try {
+        GenerationScope generation(llamafu);
+        clear_kv_cache(llamafu);
+    } catch (const std::exception& e) {
+        // Released and could not be recreated; nothing cached to clear
+    }
+}
+
+void llamafu_kv_cache_seq_rm(Llamafu llamafu, int32_t seq_id, int32_t p0, int32_t p1) {
+    if (!llamafu) {
+        return;
+    }
+    // TODO: Implement seq_rm when needed
+}
+
+void llamafu_kv_cache_seq_cp(Llamafu llamafu, int32_t seq_id_src, int32_t seq_id_dst, int32_t p0, int32_t p1) {
+    if (!llamafu) {
+        return;
+    }
+    // TODO: Implement seq_cp when needed
+}
+
+void llamafu_kv_cache_seq_keep(Llamafu llamafu, int32_t seq_id) {
+    if (!llamafu) {
+        return;
+    }
+    // TODO: Implement seq_keep when needed
+}
+
+// =============================================================================
+// Streaming Completion
+// =============================================================================
+
+LlamafuError llamafu_complete_stream(
+    Llamafu llamafu,
+    LlamafuInferParams* params,
+    LlamafuStreamCallback callback,
+    void* user_data
+) {
+    if (!llamafu || !params || !callback) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!validate_string_param(params->prompt, "prompt")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        StopMatcher stops;
+        if (!build_stop_matcher(params, stops)) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+
+        // Only whole characters before any stop string reach the callback
+        StreamDetokenizer detok(&stops);
+        return generate_text_spans(llamafu, params, nullptr, detok,
+                                   [&](const char* text, size_t) { callback(text, user_data); });
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_complete_with_grammar_stream(
+    Llamafu llamafu,
+    LlamafuInferParams* params,
+    const LlamafuGrammarParams* grammar_params,
+    LlamafuStreamCallback callback,
+    void* user_data
+) {
+    if (!llamafu || !params || !grammar_params || !callback) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!validate_string_param(grammar_params->grammar_str, "grammar_str")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    LlamafuInferParams grammar_infer = *params;
+    grammar_infer.grammar_str = grammar_params->grammar_str;
+    grammar_infer.grammar_root = grammar_params->grammar_root;
+    return llamafu_complete_stream(llamafu, &grammar_infer, callback, user_data);
+}
+
+LlamafuError llamafu_multimodal_complete_stream(
+    Llamafu llamafu,
+    LlamafuMultimodalInferParams* params,
+    LlamafuStreamCallback callback,
+    void* user_data
+) {
+    return llamafu_multimodal_complete_streaming(llamafu, params, callback, user_data);
+}
+
+// =============================================================================
+// Missing FFI Function Stubs - LoRA Adapter Functions
+// =============================================================================
+
+LlamafuError llamafu_lora_adapter_init(Llamafu llamafu, const char* lora_path, LlamafuLoraAdapter* out_adapter) {
+    if (!llamafu || !validate_string_param(lora_path, "lora_path") || !out_adapter) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        const LlamafuError result = load_lora(llamafu, lora_path, 1.0f, nullptr, nullptr, out_adapter);
+        if (result == LLAMAFU_SUCCESS) {
+            (*out_adapter)->owned_by_caller = true;
+        }
+        return result;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_LORA_LOAD_FAILED;
+    }
+}
+
+LlamafuError llamafu_lora_adapter_apply(Llamafu llamafu, LlamafuLoraAdapter adapter, float scale) {
+    return llamafu_set_lora_adapter(llamafu, adapter, scale);
+}
+
+LlamafuError llamafu_lora_adapter_remove(Llamafu llamafu, LlamafuLoraAdapter adapter) {
+    if (!llamafu || !adapter) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    if (find_lora(llamafu, adapter) == llamafu->lora_adapters.end()) {
+        return LLAMAFU_ERROR_LORA_NOT_FOUND;
+    }
+
+    // Deactivate only; the adapter stays loaded for later requests
+    adapter->active = false;
+    return apply_lora_set(llamafu, default_lora_set(llamafu)) ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_UNKNOWN;
+}
+
+LlamafuError llamafu_lora_adapter_clear_all(Llamafu llamafu) {
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    for (LlamafuLoraAdapter adapter : llamafu->lora_adapters) {
+        adapter->active = false;
+    }
+    return apply_lora_set(llamafu, LoraSet{}) ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_UNKNOWN;
+}
+
+void llamafu_lora_adapter_free(LlamafuLoraAdapter adapter) {
+    if (!adapter) {
+        return;
+    }
+    Llamafu llamafu = adapter->owner;
+    if (!llamafu) {
+        delete adapter;  // The handle went first and released the weights
+        return;
+    }
+
+    // A busy handle is not waited for (a stream may run until its reader
+    // drains it); its next lock holder unloads the adapter
+    adapter->free_requested.store(true, std::memory_order_release);
+    llamafu->lora_free_pending.store(true, std::memory_order_release);
+    HandleLock lock(llamafu);
+    if (!lock.busy()) {
+        drop_freed_lora(llamafu);
+    }
+}
+
+// =============================================================================
+// Missing FFI Function Stubs - Batch Processing
+// =============================================================================
+
+LlamafuBatch llamafu_batch_init(int32_t n_tokens_max, int32_t embd, int32_t n_seq_max) {
+    // Create a batch wrapper
+    auto* batch = new LlamafuBatch_s();
+    batch->batch = llama_batch_init(n_tokens_max, embd, n_seq_max);
+    return batch;
+}
+
+void llamafu_batch_free(LlamafuBatch batch) {
+    if (batch) {
+        llama_batch_free(batch->batch);
+        delete batch;
+    }
+}
+
+void llamafu_batch_clear(LlamafuBatch batch) {
+    if (batch) {
+        batch->batch.n_tokens = 0;
+    }
+}
+
+LlamafuError llamafu_decode(Llamafu llamafu, LlamafuBatch batch) {
+    if (!llamafu || !batch) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        invalidate_prompt_cache(llamafu);
+        int result = llama_decode(llamafu->ctx, batch->batch);
+        return result == 0 ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_DECODE_FAILED;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// Missing FFI Function Stubs - State Management
+// =============================================================================
+
+size_t llamafu_state_get_size(Llamafu llamafu) {
+    if (!llamafu) {
+        return 0;
+    }
+    try {
+        GenerationScope generation(llamafu);
+        return llama_state_get_size(llamafu->ctx);
+    } catch (const std::exception& e) {
+        return 0;
+    }
+}
+
+LlamafuError llamafu_state_save_file(Llamafu llamafu, const char* path) {
+    if (!llamafu || !path) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    try {
+        GenerationScope generation(llamafu);
+        // llama_state_save_file returns bool
+        bool success = llama_state_save_file(llamafu->ctx, path, nullptr, 0);
+        return success ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_UNKNOWN;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_state_load_file(Llamafu llamafu, const char* path) {
+    if (!llamafu || !path) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        // Clear memory before loading state to prevent inconsistent state
+        llama_memory_clear(llama_get_memory(llamafu->ctx), false);
+        invalidate_prompt_cache(llamafu);
+
+        // Allocate buffer for tokens in case the saved state contains them
+        std::vector<llama_token> tokens(2048); // Reasonable max tokens
+        size_t n_tokens_loaded = 0;
+
+        // llama_state_load_file returns bool
+        bool success = llama_state_load_file(
+            llamafu->ctx, path,
+            tokens.data(), tokens.size(),
+            &n_tokens_loaded);
+
+        return success ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_UNKNOWN;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// Streaming State Snapshots
+// =============================================================================
+
+LlamafuError llamafu_state_save_fd(Llamafu llamafu, int fd, int32_t seq_id, uint64_t* out_size) {
+    if (!llamafu || fd < 0 || seq_id < -1) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        if (seq_id >= static_cast<int32_t>(llama_n_seq_max(llamafu->ctx))) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        const size_t size = seq_id < 0 ? llama_state_get_size(llamafu->ctx)
+                                       : llama_state_seq_get_size(llamafu->ctx, seq_id);
+        FileMapping map;
+        if (!map_fd_for_write(fd, size, map)) {
+            return LLAMAFU_ERROR_FILE_WRITE_FAILED;
+        }
+        const size_t written = seq_id < 0 ? llama_state_get_data(llamafu->ctx, map.data(), size)
+                                          : llama_state_seq_get_data(llamafu->ctx, map.data(), size, seq_id);
+        if (written == 0 || written > size) {
+            return LLAMAFU_ERROR_FILE_WRITE_FAILED;
+        }
+        if (!finish_mapped_write(fd, map, written)) {
+            return LLAMAFU_ERROR_FILE_WRITE_FAILED;
+        }
+        if (out_size) {
+            *out_size = written;
+        }
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_state_load_fd(Llamafu llamafu, int fd, int32_t seq_id) {
+    if (!llamafu || fd < 0 || seq_id < -1) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        if (seq_id >= static_cast<int32_t>(llama_n_seq_max(llamafu->ctx))) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        FileMapping map;
+        if (!map_fd_for_read(fd, map)) {
+            return LLAMAFU_ERROR_FILE_READ_FAILED;
+        }
+
+        size_t read;
+        if (seq_id < 0) {
+            invalidate_prompt_cache(llamafu);
+            read = llama_state_set_data(llamafu->ctx, map.data(), map.size);
+        } else {
+            if (seq_id == 0) {
+                llamafu->cached_tokens.clear();
+                llamafu->n_reused_last = 0;
+            }
+            llama_memory_seq_rm(llama_get_memory(llamafu->ctx), seq_id, -1, -1);
+            read = llama_state_seq_set_data(llamafu->ctx, map.data(), map.size, seq_id);
+        }
+        return read != 0 ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_FILE_READ_FAILED;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_state_save_mapped(Llamafu llamafu, const char* path, int32_t seq_id, uint64_t* out_size) {
+    if (!llamafu || !validate_string_param(path, "path")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    ScopedFd file(open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+    if (file.fd < 0) {
+        return LLAMAFU_ERROR_FILE_WRITE_FAILED;
+    }
+    return llamafu_state_save_fd(llamafu, file.fd, seq_id, out_size);
+}
+
+LlamafuError llamafu_state_load_mapped(Llamafu llamafu, const char* path, int32_t seq_id) {
+    if (!llamafu || !validate_string_param(path, "path")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    ScopedFd file(open(path, O_RDONLY | O_CLOEXEC));
+    if (file.fd < 0) {
+        return LLAMAFU_ERROR_FILE_NOT_FOUND;
+    }
+    return llamafu_state_load_fd(llamafu, file.fd, seq_id);
+}
+
+// =============================================================================
+// Shared Model API
+// =============================================================================
+
+// Background load started by llamafu_model_load_async. The worker owns the
+// copied parameters; result and model are published by done.
+struct LlamafuModelLoad_s {
+    std::string model_path;
+    LlamafuModelParams params;
+    std::thread worker;
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> done{false};
+    std::atomic<float> progress{0.0f};
+    LlamafuError result = LLAMAFU_SUCCESS;
+    LlamafuModel_s* model = nullptr;       // Until claimed by poll or wait
+    bool claimed = false;
+};
+
+// Hand the finished load's model reference to the caller, once
+static LlamafuError model_load_claim(LlamafuModelLoad load, LlamafuModel* out_model) {
+    if (load->result != LLAMAFU_SUCCESS) {
+        return load->result;
+    }
+    if (load->claimed) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    load->claimed = true;
+    *out_model = load->model;
+    load->model = nullptr;
+    return LLAMAFU_SUCCESS;
+}
+
+LlamafuError llamafu_model_load(const LlamafuModelParams* params, LlamafuModel* out_model) {
+    if (!params || !out_model || !validate_model_params(params)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        llama_backend_init();
+        return load_shared_model(params, nullptr, nullptr, out_model);
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+void llamafu_model_retain(LlamafuModel model) {
+    if (model) {
+        model_retain(model);
+    }
+}
+
+void llamafu_model_release(LlamafuModel model) {
+    if (model) {
+        model_release(model);
+    }
+}
+
+int32_t llamafu_model_ref_count(LlamafuModel model) {
+    if (!model) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(g_model_registry_mutex);
+    return model->refs;
+}
 
-                LlamafuError load_result = load_file_to_memory(file_path, image_data);
-                if (load_result != LLAMAFU_SUCCESS) {
-                    out_validation->error_code = load_result;
-                    strcpy(out_validation->error_message, "Failed to load image file");
-                    return load_result;
-                }
+LlamafuModel llamafu_get_model(Llamafu llamafu) {
+    return llamafu ? llamafu->shared_model : nullptr;
+}
+
+LlamafuError llamafu_init_from_model(LlamafuModel model, const LlamafuContextParams* context_params,
+                                     Llamafu* out_llamafu) {
+    if (!model || !context_params || !out_llamafu || !validate_context_params(context_params)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        // Balanced by the llama_backend_free in llamafu_free
+        llama_backend_init();
+        LlamafuError err = create_handle(model, context_params, out_llamafu);
+        if (err != LLAMAFU_SUCCESS) {
+            llama_backend_free();
+        }
+        return err;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_model_load_async(const LlamafuModelParams* params, LlamafuModelLoad* out_load) {
+    if (!params || !out_load || !validate_model_params(params)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        llama_backend_init();
+
+        auto load = std::make_unique<LlamafuModelLoad_s>();
+        load->model_path = params->model_path;
+        load->params = *params;
+        load->params.model_path = load->model_path.c_str();
+        load->params.mmproj_path = nullptr;
+        load->params.progress_callback = nullptr;
+        load->params.progress_callback_data = nullptr;
+
+        LlamafuModelLoad_s* state = load.get();
+        state->worker = std::thread([state]() {
+            LlamafuError result;
+            try {
+                result = load_shared_model(&state->params, &state->cancel, &state->progress, &state->model);
+            } catch (const std::bad_alloc&) {
+                result = LLAMAFU_ERROR_OUT_OF_MEMORY;
+            } catch (...) {
+                result = LLAMAFU_ERROR_UNKNOWN;
+            }
+            state->result = result;
+            state->done.store(true, std::memory_order_release);
+        });
+
+        *out_load = load.release();
+        return LLAMAFU_SUCCESS;
+    } catch (const std::system_error&) {
+        return LLAMAFU_ERROR_UNKNOWN;  // Could not start the thread
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+LlamafuError llamafu_model_load_poll(LlamafuModelLoad load, float* out_progress, LlamafuModel* out_model) {
+    if (!load) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    const bool done = load->done.load(std::memory_order_acquire);
+    if (out_progress) {
+        *out_progress = done ? 1.0f : load->progress.load();
+    }
+    if (!done) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    return out_model ? model_load_claim(load, out_model) : load->result;
+}
+
+LlamafuError llamafu_model_load_wait(LlamafuModelLoad load, LlamafuModel* out_model) {
+    if (!load || !out_model) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (load->worker.joinable()) {
+        load->worker.join();
+    }
+    return model_load_claim(load, out_model);
+}
+
+void llamafu_model_load_cancel(LlamafuModelLoad load) {
+    if (load) {
+        load->cancel.store(true);
+    }
+}
+
+void llamafu_model_load_free(LlamafuModelLoad load) {
+    if (!load) {
+        return;
+    }
+    load->cancel.store(true);
+    if (load->worker.joinable()) {
+        load->worker.join();
+    }
+    if (load->model) {
+        model_release(load->model);  // Never claimed
+    }
+    delete load;
+}
+
+static LlamafuError open_prompt_cache(Llamafu llamafu, const std::string& dir, uint64_t max_bytes,
+                                      int32_t block_size);
+
+LlamafuError llamafu_swap_model(Llamafu llamafu, LlamafuModel model) {
+    if (!llamafu || !model) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (token_stream_running(llamafu) || request_queue_busy(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    // Everything below frees what a running request would be using
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    if (model == llamafu->shared_model) {
+        return LLAMAFU_SUCCESS;
+    }
+
+    try {
+        // Build the replacement context first: if that fails the handle
+        // keeps serving the old model untouched
+        BufferCapture capture;
+        const auto t_context_start = std::chrono::steady_clock::now();
+        llama_context* ctx = llama_init_from_model(model->model, llamafu->llama_ctx_params);
+        if (!ctx) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+        const double t_load_context_ms = elapsed_ms(t_context_start);
+        llama_set_abort_callback(ctx, decode_abort_trampoline, llamafu);
+        attach_threadpools(llamafu, ctx);
+
+        // Drop everything tied to the old model or its context
+        scheduler_destroy(llamafu);
+        speculative_free(llamafu);
+        clear_grammar_cache(llamafu);
+        release_sampler(llamafu);
+        free_all_lora(llamafu);
+        llamafu->cached_lora.clear();
+        if (llamafu->mtmd_ctx) {
+            mtmd_free(llamafu->mtmd_ctx);
+            llamafu->mtmd_ctx = nullptr;
+        }
+        llamafu->vision_initialized = false;
+        llamafu->is_multimodal = false;
+        llamafu->mmproj_path.clear();
+        llamafu->clip_size_bytes = 0;
+        clear_image_cache(llamafu);
+
+        llama_context* old_ctx = llamafu->ctx;
+        LlamafuModel_s* old_model = llamafu->shared_model;
+
+        model_retain(model);
+        llamafu->ctx = ctx;
+        llamafu->model = model->model;
+        llamafu->shared_model = model;
+        llamafu->buffers = std::move(capture.records);
+        llamafu->seq_in_use.assign(llama_n_seq_max(ctx), false);
+        llamafu->seq_in_use[0] = true;
+        reclaim_session_sequences(llamafu);
+        invalidate_prompt_cache(llamafu);
+        {
+            std::lock_guard<std::mutex> lock(llamafu->metrics_mutex);
+            llamafu->metrics.t_load_weights_ms = model->t_load_weights_ms;
+            llamafu->metrics.t_load_vocab_ms = model->t_load_vocab_ms;
+            llamafu->metrics.t_load_context_ms = t_load_context_ms;
+            llamafu->metrics.t_load_mmproj_ms = 0.0;
+        }
+
+        llama_free(old_ctx);
+        if (old_model) {
+            model_release(old_model);
+        }
+        discard_spilled_sequences(llamafu);  // State of a released old context
+        llamafu->release_level.store(LLAMAFU_RELEASE_NONE, std::memory_order_release);
+
+        // Saved prompt states belong to the model that wrote them; re-index
+        // the directory for the new one
+        if (PromptDiskCache* cache = llamafu->prompt_disk_cache) {
+            const std::string dir = cache->dir;
+            if (open_prompt_cache(llamafu, dir, cache->max_bytes, cache->block_size) != LLAMAFU_SUCCESS) {
+                delete llamafu->prompt_disk_cache;
+                llamafu->prompt_disk_cache = nullptr;
+            }
+        }
+        return LLAMAFU_SUCCESS;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+// =============================================================================
+// Persistent Prompt Cache API
+// =============================================================================
+
+// Indexes dir for the handle's model and installs it as the prompt cache; the
+// caller holds the generation lock
+static LlamafuError open_prompt_cache(Llamafu llamafu, const std::string& dir, uint64_t max_bytes,
+                                      int32_t block_size) {
+    try {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (!std::filesystem::is_directory(dir, ec)) {
+            return LLAMAFU_ERROR_FILE_NOT_FOUND;
+        }
+
+        auto cache = std::make_unique<PromptDiskCache>();
+        cache->dir = dir;
+        cache->max_bytes = max_bytes;
+        cache->block_size = block_size;
+        cache->fingerprint = prompt_cache_fingerprint(llamafu);
+
+        // Rebuild the index from the files of this model, newest first;
+        // other models' entries are left alone
+        std::vector<std::pair<std::filesystem::file_time_type, PromptCacheEntry>> found;
+        for (const auto& file : std::filesystem::directory_iterator(dir, ec)) {
+            const std::filesystem::path& path = file.path();
+            if (path.extension() == ".tmp") {
+                std::filesystem::remove(path, ec);  // Interrupted store
+                continue;
+            }
+            if (path.extension() != PROMPT_CACHE_EXT || !file.is_regular_file(ec)) {
+                continue;
+            }
+            PromptCacheEntry entry;
+            PromptCacheHeader header;
+            if (!read_prompt_cache_entry(path.string(), cache->fingerprint, entry, header)) {
+                continue;
+            }
+            entry.path = path.string();
+            entry.block_hashes = prompt_block_hashes(entry.tokens, block_size);
+            entry.n_bytes = file.file_size(ec);
+            if (entry.block_hashes.empty()) {
+                continue;
+            }
+            found.emplace_back(file.last_write_time(ec), std::move(entry));
+        }
+        std::sort(found.begin(), found.end(),
+                  [](const auto& a, const auto& b) { return a.first > b.first; });
+        for (auto& item : found) {
+            cache->n_bytes += item.second.n_bytes;
+            cache->entries.push_back(std::move(item.second));
+        }
+        prompt_cache_evict(cache.get());
+
+        delete llamafu->prompt_disk_cache;
+        llamafu->prompt_disk_cache = cache.release();
+        return LLAMAFU_SUCCESS;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+LlamafuError llamafu_prompt_cache_enable(Llamafu llamafu, const char* dir, uint64_t max_bytes, int32_t block_size) {
+    if (!llamafu || !validate_string_param(dir, "dir") || max_bytes == 0 ||
+        !validate_numeric_param(block_size, 16, 4096)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    return open_prompt_cache(llamafu, dir, max_bytes, block_size);
+}
+
+void llamafu_prompt_cache_disable(Llamafu llamafu) {
+    if (!llamafu) {
+        return;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return;
+    }
+    delete llamafu->prompt_disk_cache;
+    llamafu->prompt_disk_cache = nullptr;
+}
+
+LlamafuError llamafu_prompt_cache_clear(Llamafu llamafu) {
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    if (!llamafu->prompt_disk_cache) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    PromptDiskCache* cache = llamafu->prompt_disk_cache;
+    while (!cache->entries.empty()) {
+        prompt_cache_remove(cache, cache->entries.begin());
+    }
+    cache->n_bytes = 0;
+    return LLAMAFU_SUCCESS;
+}
+
+LlamafuError llamafu_prompt_cache_get_stats(Llamafu llamafu, LlamafuPromptCacheStats* out_stats) {
+    if (!llamafu || !out_stats) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    if (!llamafu->prompt_disk_cache) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    const PromptDiskCache* cache = llamafu->prompt_disk_cache;
+    out_stats->n_entries = static_cast<int32_t>(cache->entries.size());
+    out_stats->n_hits = cache->n_hits;
+    out_stats->n_misses = cache->n_misses;
+    out_stats->n_bytes = cache->n_bytes;
+    out_stats->max_bytes = cache->max_bytes;
+    return LLAMAFU_SUCCESS;
+}
+
+// =============================================================================
+// Missing FFI Function Stubs - Samplers
+// =============================================================================
+
+LlamafuSampler llamafu_sampler_init_greedy(void) {
+    auto* wrapper = new LlamafuSampler_s();
+    wrapper->sampler = llama_sampler_init_greedy();
+    wrapper->is_chain = false;
+    return wrapper;
+}
+
+LlamafuSampler llamafu_sampler_init_dist(uint32_t seed) {
+    auto* wrapper = new LlamafuSampler_s();
+    wrapper->sampler = llama_sampler_init_dist(seed);
+    wrapper->is_chain = false;
+    return wrapper;
+}
+
+// =============================================================================
+// Missing FFI Function Stubs - Chat Sessions
+// =============================================================================
+
+LlamafuError llamafu_chat_apply_template(
+    Llamafu llamafu,
+    const char* tmpl,
+    const char** messages,
+    size_t n_messages,
+    bool add_ass,
+    char** out_formatted
+) {
+    if (!llamafu || !out_formatted) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    // Build chat messages array
+    // Messages are in "role: content" format (e.g., "user: Hello!")
+    std::vector<llama_chat_message> chat_msgs;
+    std::vector<std::string> roles;    // Keep strings alive
+    std::vector<std::string> contents; // Keep strings alive
+
+    for (size_t i = 0; i < n_messages; i++) {
+        std::string msg_str(messages[i]);
+
+        // Parse "role: content" format
+        size_t colon_pos = msg_str.find(": ");
+        if (colon_pos == std::string::npos) {
+            // If no "role: " pattern, treat as user message
+            roles.push_back("user");
+            contents.push_back(msg_str);
+        } else {
+            roles.push_back(msg_str.substr(0, colon_pos));
+            contents.push_back(msg_str.substr(colon_pos + 2));
+        }
+    }
+
+    // Build llama_chat_message array with pointers to stored strings
+    for (size_t i = 0; i < n_messages; i++) {
+        llama_chat_message msg;
+        msg.role = roles[i].c_str();
+        msg.content = contents[i].c_str();
+        chat_msgs.push_back(msg);
+    }
+
+    // Apply template - first call to get required size
+    int32_t len = llama_chat_apply_template(
+        tmpl && strlen(tmpl) > 0 ? tmpl : nullptr,  // nullptr = model default
+        chat_msgs.data(), chat_msgs.size(),
+        add_ass, nullptr, 0
+    );
+
+    if (len < 0) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+
+    // Allocate result buffer and format
+    std::string result;
+    result.resize(len + 1);
+    llama_chat_apply_template(
+        tmpl && strlen(tmpl) > 0 ? tmpl : nullptr,
+        chat_msgs.data(), chat_msgs.size(),
+        add_ass, result.data(), result.size()
+    );
+
+    *out_formatted = strdup(result.c_str());
+    return LLAMAFU_SUCCESS;
+}
+
+// Chat session state
+struct LlamafuChatSession_s {
+    Llamafu llamafu;
+    std::string system_prompt;
+    std::vector<std::pair<std::string, std::string>> history; // role, content pairs
+
+    // KV-backed mode: the conversation lives in its own sequence
+    bool kv_backed = false;
+    llama_seq_id seq_id = 0;
+    int32_t n_past = 0;               // Tokens committed to seq_id
+    std::string committed_text;       // Templated text represented by those tokens
+    uint64_t kv_epoch = 0;            // llamafu->kv_epoch when the tokens were committed
+
+    LlamafuInferParams params = {};   // Sampling of each turn; pointer fields unused
+};
+
+// Sampling a session uses until llamafu_chat_session_set_params
+static LlamafuInferParams chat_session_default_params() {
+    LlamafuInferParams params = {};
+    params.max_tokens = 256;
+    params.temperature = 0.7f;
+    params.top_k = 40;
+    params.top_p = 0.9f;
+    return params;
+}
+
+// Registers a new session on the handle; the caller holds the generation lock
+static LlamafuChatSession_s* new_chat_session(Llamafu llamafu, const char* system_prompt) {
+    auto session = std::make_unique<LlamafuChatSession_s>();
+    session->llamafu = llamafu;
+    session->system_prompt = system_prompt ? system_prompt : "";
+    session->params = chat_session_default_params();
+
+    // Add system message to history if provided
+    if (!session->system_prompt.empty()) {
+        session->history.push_back({"system", session->system_prompt});
+    }
+
+    llamafu->chat_sessions.push_back(session.get());
+    return session.release();
+}
+
+static void detach_chat_sessions(Llamafu llamafu) {
+    std::lock_guard<std::mutex> lock(llamafu->generation_mutex);
+    for (LlamafuChatSession_s* session : llamafu->chat_sessions) {
+        session->llamafu = nullptr;
+    }
+    llamafu->chat_sessions.clear();
+}
+
+// Marks the sequences of KV-backed sessions taken again after seq_in_use
+// was rebuilt for a new context
+static void reclaim_session_sequences(Llamafu llamafu) {
+    for (const LlamafuChatSession_s* session : llamafu->chat_sessions) {
+        if (session->kv_backed && static_cast<size_t>(session->seq_id) < llamafu->seq_in_use.size()) {
+            llamafu->seq_in_use[session->seq_id] = true;
+        }
+    }
+}
+
+// Render the history with the model's default chat template
+static bool render_chat_history(
+    const std::vector<std::pair<std::string, std::string>>& history,
+    bool add_ass,
+    std::string& out
+) {
+    std::vector<llama_chat_message> chat_msgs;
+    chat_msgs.reserve(history.size());
+    for (const auto& msg : history) {
+        chat_msgs.push_back({msg.first.c_str(), msg.second.c_str()});
+    }
 
-                out_validation->detected_format = detect_format_from_extension(file_path);
-                break;
-            }
+    int32_t len = llama_chat_apply_template(
+        nullptr, chat_msgs.data(), chat_msgs.size(),
+        add_ass, nullptr, 0);
 
-            case LLAMAFU_DATA_SOURCE_BASE64: {
-                const char* base64_str = static_cast<const char*>(input->data);
-                if (!validate_string_param(base64_str, "base64_data")) {
-                    out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
-                    strcpy(out_validation->error_message, "Invalid base64 data");
-                    return LLAMAFU_ERROR_INVALID_PARAM;
-                }
+    if (len < 0) {
+        return false;
+    }
 
-                try {
-                    image_data = base64_decode(base64_str);
-                } catch (const std::exception& e) {
-                    out_validation->error_code = LLAMAFU_ERROR_BASE64_DECODE_FAILED;
-                    strcpy(out_validation->error_message, "Failed to decode base64 data");
-                    return LLAMAFU_ERROR_BASE64_DECODE_FAILED;
-                }
-                break;
-            }
+    out.resize(len + 1);
+    llama_chat_apply_template(
+        nullptr, chat_msgs.data(), chat_msgs.size(),
+        add_ass, out.data(), out.size());
+    out.resize(len);
+    return true;
+}
 
-            case LLAMAFU_DATA_SOURCE_BINARY: {
-                if (!input->data || input->data_size == 0) {
-                    out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
-                    strcpy(out_validation->error_message, "Invalid binary data");
-                    return LLAMAFU_ERROR_INVALID_PARAM;
-                }
+// Drop everything the session has committed to its sequence
+static void chat_session_reset_kv(LlamafuChatSession_s* session) {
+    llama_memory_seq_rm(llama_get_memory(session->llamafu->ctx), session->seq_id, -1, -1);
+    session->n_past = 0;
+    session->committed_text.clear();
+    session->kv_epoch = session->llamafu->kv_epoch;
+}
 
-                const unsigned char* binary_data = static_cast<const unsigned char*>(input->data);
-                image_data.assign(binary_data, binary_data + input->data_size);
-                break;
-            }
+// One turn of a KV-backed session: only the text after what is already
+// committed (the previous reply's end-of-turn, the new messages and the
+// assistant header) is tokenized and decoded.
+static LlamafuError chat_session_complete_kv(LlamafuChatSession_s* session, std::string& response) {
+    Llamafu llamafu = session->llamafu;
+    GenerationScope generation(llamafu);
+    const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+    const int32_t n_ctx = llama_n_ctx(llamafu->ctx);
+    if (session->seq_id >= static_cast<llama_seq_id>(llama_n_seq_max(llamafu->ctx))) {
+        return LLAMAFU_ERROR_INVALID_PARAM;  // Swapped onto a context with fewer sequences
+    }
 
-            default:
-                out_validation->error_code = LLAMAFU_ERROR_INVALID_PARAM;
-                strcpy(out_validation->error_message, "Unsupported data source type");
-                return LLAMAFU_ERROR_INVALID_PARAM;
-        }
+    std::string prompt;
+    if (!render_chat_history(session->history, true, prompt)) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
 
-        // Detect format from data if not specified
-        if (out_validation->detected_format == LLAMAFU_IMAGE_FORMAT_AUTO) {
-            out_validation->detected_format = detect_image_format_from_header(image_data.data(), image_data.size());
-        }
+    // Start over if the cache was cleared underneath us (also through the
+    // llamafu_memory_* calls, which leave kv_epoch alone), or if the template
+    // rendered earlier turns differently from what was committed
+    if (session->kv_epoch != llamafu->kv_epoch ||
+        llama_memory_seq_pos_max(llama_get_memory(llamafu->ctx), session->seq_id) + 1 < session->n_past ||
+        prompt.compare(0, session->committed_text.size(), session->committed_text) != 0) {
+        chat_session_reset_kv(session);
+    }
 
-        // Basic validation
-        out_validation->file_size_bytes = image_data.size();
-        out_validation->is_valid = (out_validation->detected_format != LLAMAFU_IMAGE_FORMAT_AUTO) && 
-                                  (image_data.size() > 0);
+    const std::string delta = prompt.substr(session->committed_text.size());
+    const int32_t delta_len = static_cast<int32_t>(delta.size());
+    std::vector<llama_token> tokens(delta_len + 16);
+    const int32_t n_tokens = llama_tokenize(vocab, delta.c_str(), delta_len,
+                                            tokens.data(), tokens.size(),
+                                            session->n_past == 0, true);
+    if (n_tokens <= 0) {
+        return LLAMAFU_ERROR_TOKENIZATION_FAILED;
+    }
+    tokens.resize(n_tokens);
 
-        // Set basic compatibility info (simplified for now)
-        out_validation->supported_by_model = (out_validation->detected_format == LLAMAFU_IMAGE_FORMAT_JPEG ||
-                                            out_validation->detected_format == LLAMAFU_IMAGE_FORMAT_PNG);
-        out_validation->requires_preprocessing = true;
-        out_validation->estimated_processing_time_ms = image_data.size() / 1000.0f; // Rough estimate
+    if (session->n_past + n_tokens >= n_ctx) {
+        return LLAMAFU_ERROR_CONTEXT_FULL;
+    }
 
-        return LLAMAFU_SUCCESS;
+    const int32_t batch_capacity = static_cast<int32_t>(llama_n_batch(llamafu->ctx));
+    llama_batch batch = llama_batch_init(batch_capacity, 0, 1);
 
-    } catch (const std::exception& e) {
-        out_validation->error_code = LLAMAFU_ERROR_IMAGE_VALIDATION_FAILED;
-        snprintf(out_validation->error_message, sizeof(out_validation->error_message), 
-                "Validation failed: %s", e.what());
-        return LLAMAFU_ERROR_IMAGE_VALIDATION_FAILED;
+    LlamafuError err = decode_seq_tokens(llamafu, batch, batch_capacity,
+                                         tokens.data(), n_tokens, session->n_past, session->seq_id);
+    if (err != LLAMAFU_SUCCESS) {
+        llama_batch_free(batch);
+        chat_session_reset_kv(session);
+        return err;
     }
-}
+    session->n_past += n_tokens;
+    session->committed_text = prompt;
 
-LlamafuError llamafu_image_load_from_file(const char* file_path, LlamafuImageFormat format, LlamafuMediaInput* out_input) {
-    if (!validate_string_param(file_path, "file_path") || !out_input) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    SamplerPipeline* smpl = build_sampler_pipeline(vocab, sampler_config_from(&session->params));
+    if (!smpl) {
+        llama_batch_free(batch);
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     }
 
-    try {
-        // Initialize media input structure
-        memset(out_input, 0, sizeof(LlamafuMediaInput));
-        
-        out_input->type = LLAMAFU_MEDIA_TYPE_IMAGE;
-        out_input->source_type = LLAMAFU_DATA_SOURCE_FILE_PATH;
-        out_input->image_format = (format == LLAMAFU_IMAGE_FORMAT_AUTO) ? 
-                                 detect_format_from_extension(file_path) : format;
-        
-        // Store file path (caller is responsible for keeping it valid)
-        out_input->data = file_path;
-        out_input->data_size = 0; // Not needed for file paths
+    for (int32_t i = 0; i < session->params.max_tokens; i++) {
+        if (generation_aborted(llamafu)) {
+            err = LLAMAFU_ERROR_ABORTED;
+            break;
+        }
 
-        // Set default processing options
-        out_input->resize_to_model = true;
-        out_input->maintain_aspect_ratio = true;
-        out_input->pad_to_square = false;
-        out_input->quality_hint = 1.0f;
+        llama_token new_token = sampler_pipeline_sample(smpl, llamafu->ctx, -1);
+        if (llama_vocab_is_eog(vocab, new_token)) {
+            break;
+        }
 
-        return LLAMAFU_SUCCESS;
+        const std::string_view piece = token_piece(llamafu->shared_model, new_token);
+        response.append(piece.data(), piece.size());
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_IMAGE_LOAD_FAILED;
+        if (session->n_past >= n_ctx - 1) {
+            break;
+        }
+
+        err = decode_seq_tokens(llamafu, batch, batch_capacity, &new_token, 1,
+                                session->n_past, session->seq_id);
+        if (err != LLAMAFU_SUCCESS) {
+            break;
+        }
+        session->n_past++;
+    }
+
+    delete smpl;
+    llama_batch_free(batch);
+
+    if (err != LLAMAFU_SUCCESS) {
+        // The sequence no longer matches the history; rebuild it next turn
+        chat_session_reset_kv(session);
+        return err;
     }
+
+    // Generated tokens are already in the cache; the template's end-of-turn
+    // markers are picked up as part of the next turn's delta
+    session->committed_text += response;
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_image_load_from_base64(const char* base64_data, LlamafuImageFormat format, LlamafuMediaInput* out_input) {
-    if (!validate_string_param(base64_data, "base64_data") || !out_input) {
+LlamafuError llamafu_chat_session_create(
+    Llamafu llamafu,
+    const char* system_prompt,
+    void** out_session
+) {
+    if (!llamafu || !out_session) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
     try {
-        // Initialize media input structure
-        memset(out_input, 0, sizeof(LlamafuMediaInput));
-        
-        out_input->type = LLAMAFU_MEDIA_TYPE_IMAGE;
-        out_input->source_type = LLAMAFU_DATA_SOURCE_BASE64;
-        out_input->image_format = format;
-        
-        // Store base64 string (caller is responsible for keeping it valid)
-        out_input->data = base64_data;
-        out_input->data_size = strlen(base64_data);
-
-        // Set default processing options
-        out_input->resize_to_model = true;
-        out_input->maintain_aspect_ratio = true;
-        out_input->pad_to_square = false;
-        out_input->quality_hint = 1.0f;
-
+        std::lock_guard<std::mutex> lock(llamafu->generation_mutex);
+        *out_session = new_chat_session(llamafu, system_prompt);
         return LLAMAFU_SUCCESS;
-
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_IMAGE_LOAD_FAILED;
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     }
 }
 
-LlamafuError llamafu_image_load_from_pixels(const unsigned char* rgb_pixels, int32_t width, int32_t height, 
-                                           LlamafuImageFormat format, LlamafuMediaInput* out_input) {
-    if (!rgb_pixels || width <= 0 || height <= 0 || !out_input) {
+LlamafuError llamafu_chat_session_create_kv(
+    Llamafu llamafu,
+    const char* system_prompt,
+    int32_t seq_id,
+    void** out_session
+) {
+    if (!llamafu || !out_session) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
     try {
-        // Initialize media input structure
-        memset(out_input, 0, sizeof(LlamafuMediaInput));
-        
-        out_input->type = LLAMAFU_MEDIA_TYPE_IMAGE;
-        out_input->source_type = LLAMAFU_DATA_SOURCE_RGB_PIXELS;
-        out_input->image_format = format;
-        out_input->width = width;
-        out_input->height = height;
-        
-        // Store pixel data (caller is responsible for keeping it valid)
-        out_input->data = rgb_pixels;
-        out_input->data_size = width * height * 3; // RGB = 3 bytes per pixel
+        GenerationScope generation(llamafu);
 
-        // Set default processing options
-        out_input->resize_to_model = true;
-        out_input->maintain_aspect_ratio = true;
-        out_input->pad_to_square = false;
-        out_input->quality_hint = 1.0f;
+        // Sequence 0 belongs to llamafu_complete's prompt cache
+        if (!validate_numeric_param(seq_id, 1, static_cast<int32_t>(llamafu->seq_in_use.size()) - 1) ||
+            llamafu->seq_in_use[seq_id]) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
 
+        LlamafuChatSession_s* session = new_chat_session(llamafu, system_prompt);
+        session->kv_backed = true;
+        session->seq_id = seq_id;
+        llamafu->seq_in_use[seq_id] = true;
+        chat_session_reset_kv(session);
+        *out_session = session;
         return LLAMAFU_SUCCESS;
-
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_IMAGE_LOAD_FAILED;
+        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-// Convenience functions for common formats
-LlamafuError llamafu_image_from_jpeg_file(const char* path, LlamafuMediaInput* out_input) {
-    return llamafu_image_load_from_file(path, LLAMAFU_IMAGE_FORMAT_JPEG, out_input);
-}
+LlamafuError llamafu_chat_session_set_params(void* session, const LlamafuInferParams* params) {
+    if (!session || !params || !validate_numeric_param(params->max_tokens, 1, 32768)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-LlamafuError llamafu_image_from_png_file(const char* path, LlamafuMediaInput* out_input) {
-    return llamafu_image_load_from_file(path, LLAMAFU_IMAGE_FORMAT_PNG, out_input);
+    // Only the sampling settings are kept; the prompt is the history
+    LlamafuInferParams& kept = static_cast<LlamafuChatSession_s*>(session)->params;
+    kept = *params;
+    kept.prompt = nullptr;
+    kept.grammar_str = nullptr;
+    kept.grammar_root = nullptr;
+    kept.lora_batch = nullptr;
+    kept.stop_sequences = nullptr;
+    kept.n_stop_sequences = 0;
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_image_from_base64_jpeg(const char* base64, LlamafuMediaInput* out_input) {
-    return llamafu_image_load_from_base64(base64, LLAMAFU_IMAGE_FORMAT_JPEG, out_input);
-}
+LlamafuError llamafu_chat_session_add_message(
+    void* session,
+    const char* role,
+    const char* content,
+    const LlamafuMediaInput* media_inputs,
+    size_t n_media_inputs
+) {
+    if (!session || !validate_string_param(role, "role") || !content) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-LlamafuError llamafu_image_from_base64_png(const char* base64, LlamafuMediaInput* out_input) {
-    return llamafu_image_load_from_base64(base64, LLAMAFU_IMAGE_FORMAT_PNG, out_input);
+    // Messages are only recorded here; KV-backed sessions decode them as part
+    // of the next llamafu_chat_session_complete delta
+    auto* chat_session = static_cast<LlamafuChatSession_s*>(session);
+    chat_session->history.push_back({role, content});
+    return LLAMAFU_SUCCESS;
 }
 
-
-// =============================================================================
-// Image Processing and CLIP Integration
-// =============================================================================
-
-static LlamafuError initialize_clip_context(Llamafu llamafu, const char* mmproj_path) {
-    if (!llamafu || llamafu->vision_initialized) {
-        return LLAMAFU_SUCCESS; // Already initialized
-    }
-
-    if (!mmproj_path || strlen(mmproj_path) == 0) {
+LlamafuError llamafu_chat_session_get_n_past(void* session, int32_t* out_n_past) {
+    if (!session || !out_n_past) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        struct clip_context_params clip_params = {};
-        clip_params.use_gpu = true;
-        clip_params.flash_attn_type = CLIP_FLASH_ATTN_TYPE_AUTO;
-        clip_params.image_min_tokens = 0;  // Use default
-        clip_params.image_max_tokens = 0;  // Use default
-        clip_params.warmup = false;
+    *out_n_past = static_cast<LlamafuChatSession_s*>(session)->n_past;
+    return LLAMAFU_SUCCESS;
+}
 
-        struct clip_init_result clip_result = clip_init(mmproj_path, clip_params);
-        
-        if (!clip_result.ctx_v) {
-            return LLAMAFU_ERROR_VISION_INIT_FAILED;
+void llamafu_chat_session_free(void* session) {
+    if (!session) {
+        return;
+    }
+    auto* chat_session = static_cast<LlamafuChatSession_s*>(session);
+    if (Llamafu llamafu = chat_session->llamafu) {  // Null once the handle was freed
+        std::lock_guard<std::mutex> lock(llamafu->generation_mutex);
+        auto& sessions = llamafu->chat_sessions;
+        sessions.erase(std::remove(sessions.begin(), sessions.end(), chat_session), sessions.end());
+
+        const llama_seq_id seq_id = chat_session->seq_id;
+        if (chat_session->kv_backed && static_cast<size_t>(seq_id) < llamafu->seq_in_use.size()) {
+            // Release the session's cells and sequence id for other users
+            // (a spilled copy is dropped when the handle resumes)
+            if (llamafu->ctx) {
+                llama_memory_seq_rm(llama_get_memory(llamafu->ctx), seq_id, -1, -1);
+            }
+            llamafu->seq_in_use[seq_id] = false;
         }
-
-        llamafu->clip_ctx_vision = clip_result.ctx_v;
-        llamafu->clip_ctx_audio = clip_result.ctx_a; // May be null
-        llamafu->vision_initialized = true;
-
-        return LLAMAFU_SUCCESS;
-
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_VISION_INIT_FAILED;
     }
+    delete chat_session;
 }
 
-LlamafuError llamafu_image_process(Llamafu llamafu, const LlamafuMediaInput* input, LlamafuImageProcessResult* out_result) {
-    if (!llamafu || !input || !out_result) {
+LlamafuError llamafu_chat_session_complete(
+    void* session,
+    const char* user_message,
+    const LlamafuMediaInput* media_inputs,
+    size_t n_media_inputs,
+    char** out_response
+) {
+    if (!session || !user_message || !out_response) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    if (!llamafu->is_multimodal || !llamafu->vision_initialized) {
-        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    auto* chat_session = static_cast<LlamafuChatSession_s*>(session);
+    Llamafu llamafu = chat_session->llamafu;
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;  // Its handle was freed
     }
 
-    memset(out_result, 0, sizeof(LlamafuImageProcessResult));
-    auto start_time = std::chrono::high_resolution_clock::now();
-
-    try {
-        // Load image data based on source type
-        std::vector<unsigned char> image_data;
-        
-        switch (input->source_type) {
-            case LLAMAFU_DATA_SOURCE_FILE_PATH: {
-                const char* file_path = static_cast<const char*>(input->data);
-                LlamafuError load_result = load_file_to_memory(file_path, image_data);
-                if (load_result != LLAMAFU_SUCCESS) {
-                    return load_result;
-                }
-                break;
-            }
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+    }
 
-            case LLAMAFU_DATA_SOURCE_BASE64: {
-                const char* base64_str = static_cast<const char*>(input->data);
-                try {
-                    image_data = base64_decode(base64_str);
-                } catch (const std::exception& e) {
-                    return LLAMAFU_ERROR_BASE64_DECODE_FAILED;
-                }
-                break;
-            }
+    // The message stays in the history only if the turn succeeds
+    chat_session->history.push_back({"user", user_message});
 
-            case LLAMAFU_DATA_SOURCE_BINARY: {
-                const unsigned char* binary_data = static_cast<const unsigned char*>(input->data);
-                image_data.assign(binary_data, binary_data + input->data_size);
-                break;
+    char* response = nullptr;
+    LlamafuError err = LLAMAFU_SUCCESS;
+    if (chat_session->kv_backed) {
+        try {
+            std::string text;
+            err = chat_session_complete_kv(chat_session, text);
+            if (err == LLAMAFU_SUCCESS) {
+                response = strdup(text.c_str());
+                err = response ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_OUT_OF_MEMORY;
             }
-
-            case LLAMAFU_DATA_SOURCE_RGB_PIXELS: {
-                // For raw pixels, we need to create a format that CLIP can understand
-                // This would require integration with stb_image or similar
-                return LLAMAFU_ERROR_IMAGE_FORMAT_UNSUPPORTED; // TODO: Implement raw pixel processing
+        } catch (const std::exception& e) {
+            err = LLAMAFU_ERROR_UNKNOWN;
+        }
+    } else {
+        // Apply chat template (use model's default template)
+        std::string formatted_prompt;
+        if (!render_chat_history(chat_session->history, true, formatted_prompt)) {
+            err = LLAMAFU_ERROR_UNKNOWN;
+        } else {
+            LlamafuInferParams params = chat_session->params;
+            params.prompt = formatted_prompt.c_str();
+            err = llamafu_complete(llamafu, &params, &response);
+            if (err == LLAMAFU_SUCCESS && !response) {
+                err = LLAMAFU_ERROR_UNKNOWN;
             }
-
-            default:
-                return LLAMAFU_ERROR_INVALID_PARAM;
         }
+    }
 
-        // Initialize CLIP image structures
-        struct clip_image_u8* img_u8 = clip_image_u8_init();
-        if (!img_u8) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+    if (err != LLAMAFU_SUCCESS) {
+        free(response);
+        chat_session->history.pop_back();
+        return err;
+    }
 
-        struct clip_image_f32_batch* img_batch = clip_image_f32_batch_init();
-        if (!img_batch) {
-            clip_image_u8_free(img_u8);
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+    // Add assistant response to history
+    chat_session->history.push_back({"assistant", response});
 
-        // Load image from binary data (this requires stb_image integration)
-        // For now, we'll use a simplified approach
-        // TODO: Integrate with stb_image for proper image decoding
-        
-        // Get image requirements from model
-        int32_t required_size = clip_get_image_size(llamafu->clip_ctx_vision);
-        out_result->processed_width = required_size;
-        out_result->processed_height = required_size;
-
-        // Process the image through CLIP
-        bool preprocess_success = clip_image_preprocess(llamafu->clip_ctx_vision, img_u8, img_batch);
-        if (!preprocess_success) {
-            clip_image_u8_free(img_u8);
-            clip_image_f32_batch_free(img_batch);
-            return LLAMAFU_ERROR_VISION_PROCESS_FAILED;
-        }
-
-        // Get embedding dimensions
-        int32_t n_embd = clip_n_mmproj_embd(llamafu->clip_ctx_vision);
-        out_result->n_embeddings = n_embd;
-        out_result->embeddings = static_cast<float*>(malloc(n_embd * sizeof(float)));
-        
-        if (!out_result->embeddings) {
-            clip_image_u8_free(img_u8);
-            clip_image_f32_batch_free(img_batch);
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+    *out_response = response;
+    return LLAMAFU_SUCCESS;
+}
 
-        // Encode image to embeddings
-        bool encode_success = clip_image_batch_encode(llamafu->clip_ctx_vision, -1, img_batch, out_result->embeddings);
-        if (!encode_success) {
-            free(out_result->embeddings);
-            out_result->embeddings = nullptr;
-            clip_image_u8_free(img_u8);
-            clip_image_f32_batch_free(img_batch);
-            return LLAMAFU_ERROR_VISION_PROCESS_FAILED;
-        }
+LlamafuError llamafu_chat_session_get_history(
+    void* session,
+    char** out_history_json
+) {
+    if (!session || !out_history_json) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-        // Calculate number of output tokens
-        if (clip_image_f32_batch_n_images(img_batch) > 0) {
-            struct clip_image_f32* first_img = clip_image_f32_get_img(img_batch, 0);
-            out_result->n_tokens = clip_n_output_tokens(llamafu->clip_ctx_vision, first_img);
-        }
+    auto* chat_session = static_cast<LlamafuChatSession_s*>(session);
 
-        // Set processing metadata
-        out_result->was_resized = (input->width != required_size || input->height != required_size);
-        out_result->was_padded = input->pad_to_square;
-        out_result->memory_used_bytes = n_embd * sizeof(float);
+    // Build simple JSON array
+    std::string json = "[";
+    for (size_t i = 0; i < chat_session->history.size(); i++) {
+        const auto& msg = chat_session->history[i];
+        if (i > 0) json += ",";
+        json += "{\"role\":\"" + msg.first + "\",\"content\":\"";
+        // Escape special characters in content
+        for (char c : msg.second) {
+            if (c == '"') json += "\\\"";
+            else if (c == '\\') json += "\\\\";
+            else if (c == '\n') json += "\\n";
+            else if (c == '\r') json += "\\r";
+            else if (c == '\t') json += "\\t";
+            else json += c;
+        }
+        json += "\"}";
+    }
+    json += "]";
 
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-        out_result->processing_time_ms = duration.count() / 1000.0;
+    *out_history_json = strdup(json.c_str());
+    return LLAMAFU_SUCCESS;
+}
 
-        // Cleanup
-        clip_image_u8_free(img_u8);
-        clip_image_f32_batch_free(img_batch);
+// =============================================================================
+// Missing FFI Function Stubs - LoRA Extended
+// =============================================================================
 
-        return LLAMAFU_SUCCESS;
+static void fill_lora_adapter_info(LlamafuLoraAdapter adapter, LlamafuLoraAdapterInfo* out_info) {
+    out_info->name = adapter->name.c_str();
+    out_info->file_path = adapter->path.c_str();
+    out_info->scale = adapter->scale;
+    out_info->is_active = adapter->active;
+    out_info->parameter_count = adapter->parameter_count;
+    out_info->target_modules = adapter->target_modules.c_str();
+    out_info->description = adapter->description.c_str();
+    out_info->created_timestamp = adapter->created_timestamp;
+}
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_VISION_PROCESS_FAILED;
+LlamafuError llamafu_get_lora_adapter_info(
+    Llamafu llamafu,
+    LlamafuLoraAdapter adapter,
+    LlamafuLoraAdapterInfo* out_info
+) {
+    if (!llamafu || !adapter || !out_info) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (find_lora(llamafu, adapter) == llamafu->lora_adapters.end()) {
+        return LLAMAFU_ERROR_LORA_NOT_FOUND;
     }
+    fill_lora_adapter_info(adapter, out_info);
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_image_batch_process(Llamafu llamafu, const LlamafuMediaBatch* batch, 
-                                        LlamafuImageProcessResult** out_results, size_t* out_n_results) {
-    if (!llamafu || !batch || !out_results || !out_n_results) {
+LlamafuError llamafu_list_lora_adapters(
+    Llamafu llamafu,
+    LlamafuLoraAdapterInfo** out_adapters,
+    size_t* out_n_adapters
+) {
+    if (!llamafu || !out_adapters || !out_n_adapters) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    *out_adapters = nullptr;
+    *out_n_adapters = 0;
 
-    if (batch->n_inputs == 0) {
-        *out_results = nullptr;
-        *out_n_results = 0;
+    const size_t n = llamafu->lora_adapters.size();
+    if (n == 0) {
         return LLAMAFU_SUCCESS;
     }
-
-    try {
-        // Allocate results array
-        *out_results = static_cast<LlamafuImageProcessResult*>(
-            malloc(batch->n_inputs * sizeof(LlamafuImageProcessResult)));
-        
-        if (!*out_results) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
-
-        *out_n_results = batch->n_inputs;
-        size_t successful_processed = 0;
-
-        // Process each image
-        for (size_t i = 0; i < batch->n_inputs; ++i) {
-            LlamafuError result = llamafu_image_process(llamafu, &batch->inputs[i], &(*out_results)[i]);
-            if (result == LLAMAFU_SUCCESS) {
-                successful_processed++;
-            } else {
-                // Initialize failed result
-                memset(&(*out_results)[i], 0, sizeof(LlamafuImageProcessResult));
-            }
-        }
-
-        return (successful_processed == batch->n_inputs) ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_BATCH_PROCESS_FAILED;
-
-    } catch (const std::exception& e) {
-        if (*out_results) {
-            free(*out_results);
-            *out_results = nullptr;
-        }
-        *out_n_results = 0;
-        return LLAMAFU_ERROR_BATCH_PROCESS_FAILED;
+    auto* infos = static_cast<LlamafuLoraAdapterInfo*>(calloc(n, sizeof(LlamafuLoraAdapterInfo)));
+    if (!infos) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     }
+    for (size_t i = 0; i < n; i++) {
+        fill_lora_adapter_info(llamafu->lora_adapters[i], &infos[i]);
+    }
+    *out_adapters = infos;
+    *out_n_adapters = n;
+    return LLAMAFU_SUCCESS;
 }
 
-// =============================================================================
-// Format Conversion and Utility Functions
-// =============================================================================
+void llamafu_free_lora_adapter_list(LlamafuLoraAdapterInfo* adapters) {
+    free(adapters);
+}
 
-LlamafuError llamafu_image_to_base64(const LlamafuMediaInput* input, LlamafuImageFormat format, char** out_base64) {
-    if (!input || !out_base64) {
+LlamafuError llamafu_apply_lora_batch(Llamafu llamafu, const LlamafuLoraBatch* batch) {
+    if (!llamafu || !batch) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
 
     try {
-        std::vector<unsigned char> image_data;
-        
-        // Load image data
-        switch (input->source_type) {
-            case LLAMAFU_DATA_SOURCE_FILE_PATH: {
-                const char* file_path = static_cast<const char*>(input->data);
-                LlamafuError load_result = load_file_to_memory(file_path, image_data);
-                if (load_result != LLAMAFU_SUCCESS) {
-                    return load_result;
-                }
-                break;
-            }
-
-            case LLAMAFU_DATA_SOURCE_BINARY: {
-                const unsigned char* binary_data = static_cast<const unsigned char*>(input->data);
-                image_data.assign(binary_data, binary_data + input->data_size);
-                break;
-            }
-
-            case LLAMAFU_DATA_SOURCE_BASE64: {
-                // Already base64, just copy if format matches
-                const char* existing_base64 = static_cast<const char*>(input->data);
-                size_t len = strlen(existing_base64);
-                *out_base64 = static_cast<char*>(malloc(len + 1));
-                if (!*out_base64) {
-                    return LLAMAFU_ERROR_OUT_OF_MEMORY;
-                }
-                strcpy(*out_base64, existing_base64);
-                return LLAMAFU_SUCCESS;
+        LoraSet set;
+        LlamafuError err = resolve_lora_set(llamafu, batch, set);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+        for (LlamafuLoraAdapter adapter : llamafu->lora_adapters) {
+            adapter->active = false;
+        }
+        for (size_t i = 0; i < batch->n_adapters; i++) {
+            batch->adapters[i]->active = true;
+            if (batch->scales) {
+                batch->adapters[i]->scale = batch->scales[i];
             }
-
-            default:
-                return LLAMAFU_ERROR_INVALID_PARAM;
         }
+        return apply_lora_set(llamafu, set) ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_UNKNOWN;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
 
-        // Encode to base64
-        std::string base64_result = base64_encode(image_data.data(), image_data.size());
-        
-        *out_base64 = static_cast<char*>(malloc(base64_result.length() + 1));
-        if (!*out_base64) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+LlamafuError llamafu_validate_lora_compatibility(
+    Llamafu llamafu,
+    const char* lora_path,
+    bool* out_is_compatible,
+    char** out_error_message
+) {
+    if (!llamafu || !lora_path || !out_is_compatible) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    *out_is_compatible = false;
+    if (out_error_message) {
+        *out_error_message = nullptr;
+    }
+    auto reject = [&](const char* reason) {
+        if (out_error_message) {
+            *out_error_message = strdup(reason);
         }
-
-        strcpy(*out_base64, base64_result.c_str());
         return LLAMAFU_SUCCESS;
+    };
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_BASE64_ENCODE_FAILED;
+    // Same checks llama_adapter_lora_init makes, without loading tensors
+    gguf_init_params params = {true, nullptr};
+    gguf_context* gguf = gguf_init_from_file(lora_path, params);
+    if (!gguf) {
+        return reject("File not found or not a GGUF file");
     }
-}
+    auto read_string = [gguf](const char* key) {
+        const int64_t id = gguf_find_key(gguf, key);
+        return id >= 0 && gguf_get_kv_type(gguf, id) == GGUF_TYPE_STRING ? std::string(gguf_get_val_str(gguf, id))
+                                                                         : std::string();
+    };
+    const std::string type = read_string("adapter.type");
+    const std::string arch = read_string("general.architecture");
+    gguf_free(gguf);
 
-const char* llamafu_image_format_to_string(LlamafuImageFormat format) {
-    switch (format) {
-        case LLAMAFU_IMAGE_FORMAT_AUTO: return "auto";
-        case LLAMAFU_IMAGE_FORMAT_JPEG: return "jpeg";
-        case LLAMAFU_IMAGE_FORMAT_PNG: return "png";
-        case LLAMAFU_IMAGE_FORMAT_BMP: return "bmp";
-        case LLAMAFU_IMAGE_FORMAT_WEBP: return "webp";
-        case LLAMAFU_IMAGE_FORMAT_RGB24: return "rgb24";
-        case LLAMAFU_IMAGE_FORMAT_RGBA32: return "rgba32";
-        default: return "unknown";
+    char model_arch[128] = {0};
+    llama_model_meta_val_str(llamafu->model, "general.architecture", model_arch, sizeof(model_arch));
+    if (type != "lora") {
+        return reject("Not a LoRA adapter");
+    }
+    if (!arch.empty() && model_arch[0] && arch != model_arch) {
+        return reject("Adapter was trained for a different architecture");
     }
+    *out_is_compatible = true;
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuImageFormat llamafu_image_format_from_string(const char* format_str) {
-    if (!format_str) return LLAMAFU_IMAGE_FORMAT_AUTO;
-    
-    std::string fmt(format_str);
-    std::transform(fmt.begin(), fmt.end(), fmt.begin(), ::tolower);
-    
-    if (fmt == "auto") return LLAMAFU_IMAGE_FORMAT_AUTO;
-    if (fmt == "jpeg" || fmt == "jpg") return LLAMAFU_IMAGE_FORMAT_JPEG;
-    if (fmt == "png") return LLAMAFU_IMAGE_FORMAT_PNG;
-    if (fmt == "bmp") return LLAMAFU_IMAGE_FORMAT_BMP;
-    if (fmt == "webp") return LLAMAFU_IMAGE_FORMAT_WEBP;
-    if (fmt == "rgb24" || fmt == "rgb") return LLAMAFU_IMAGE_FORMAT_RGB24;
-    if (fmt == "rgba32" || fmt == "rgba") return LLAMAFU_IMAGE_FORMAT_RGBA32;
-    
-    return LLAMAFU_IMAGE_FORMAT_AUTO;
-}
+// =============================================================================
+// Missing FFI Function Stubs - Utility/Info
+// =============================================================================
 
-LlamafuImageFormat llamafu_image_detect_format_from_data(const void* data, size_t size) {
-    if (!data || size < 4) return LLAMAFU_IMAGE_FORMAT_AUTO;
-    return detect_image_format_from_header(static_cast<const unsigned char*>(data), size);
+LlamafuError llamafu_get_perf_stats(Llamafu llamafu, LlamafuPerfStats* out_stats) {
+    if (!llamafu || !out_stats) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    HandleLock lock(llamafu);
+    if (lock.busy()) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    // Get timings from context (none while it is released)
+    auto perf = llamafu->ctx ? llama_perf_context(llamafu->ctx) : llama_perf_context_data{};
+    {
+        std::lock_guard<std::mutex> metrics_lock(llamafu->metrics_mutex);
+        out_stats->t_start_ms = llamafu->t_request_start_ms;
+        out_stats->t_end_ms = llamafu->t_request_end_ms;
+        out_stats->t_load_ms = llamafu->metrics.t_load_weights_ms + llamafu->metrics.t_load_vocab_ms +
+                               llamafu->metrics.t_load_context_ms;
+    }
+    out_stats->t_p_eval_ms = perf.t_p_eval_ms;
+    out_stats->t_eval_ms = perf.t_eval_ms;
+    out_stats->n_p_eval = perf.n_p_eval;
+    out_stats->n_eval = perf.n_eval;
+    out_stats->t_p_eval_per_token_ms = perf.n_p_eval > 0 ? perf.t_p_eval_ms / perf.n_p_eval : 0;
+    out_stats->t_eval_per_token_ms = perf.n_eval > 0 ? perf.t_eval_ms / perf.n_eval : 0;
+    out_stats->n_reused = llamafu->n_reused_last;
+    out_stats->n_restored = llamafu->n_restored_last;
+    out_stats->n_prefilled = llamafu->n_prefilled_last;
+    out_stats->n_drafted = llamafu->n_drafted_last;
+    out_stats->n_draft_accepted = llamafu->n_draft_accepted_last;
+    out_stats->draft_acceptance_rate = llamafu->n_drafted_last > 0
+        ? static_cast<float>(llamafu->n_draft_accepted_last) / llamafu->n_drafted_last : 0.0f;
+    out_stats->tokens_per_second = llamafu->t_generate_ms_last > 0
+        ? llamafu->n_generated_last * 1000.0 / llamafu->t_generate_ms_last : 0.0;
+
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuImageFormat llamafu_image_detect_format_from_path(const char* file_path) {
-    return detect_format_from_extension(file_path);
+// Takes the handle lock once, inside llamafu_reset_timings
+void llamafu_reset_perf_stats(Llamafu llamafu) {
+    llamafu_reset_timings(llamafu);
 }
 
+LlamafuError llamafu_get_request_metrics(Llamafu llamafu, LlamafuRequestMetrics* out_metrics) {
+    if (!llamafu || !out_metrics) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    std::lock_guard<std::mutex> lock(llamafu->metrics_mutex);
+    *out_metrics = llamafu->metrics;
+    return LLAMAFU_SUCCESS;
+}
 
 // =============================================================================
-// Enhanced Multimodal Completion API
+// Speculative Decoding
 // =============================================================================
 
-LlamafuError llamafu_multimodal_complete_enhanced(Llamafu llamafu, LlamafuMultimodalInferParams* params, char** out_result) {
-    if (!llamafu || !params || !out_result) {
+LlamafuSpeculativeParams llamafu_speculative_default_params(void) {
+    LlamafuSpeculativeParams params = {};
+    params.draft_type = LLAMAFU_DRAFT_NONE;
+    params.n_draft = 8;
+    params.ngram_min = 2;
+    params.ngram_max = 4;
+    params.draft_model_path = nullptr;
+    return params;
+}
+
+LlamafuError llamafu_set_speculative(Llamafu llamafu, const LlamafuSpeculativeParams* params) {
+    if (!llamafu || !params) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    if (!llamafu->is_multimodal) {
-        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
+    if (params->draft_type < LLAMAFU_DRAFT_NONE || params->draft_type > LLAMAFU_DRAFT_MODEL) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    if (!validate_string_param(params->prompt, "prompt")) {
+    if (params->draft_type != LLAMAFU_DRAFT_NONE && !validate_numeric_param(params->n_draft, 1, 32)) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        // Initialize vision context if needed
-        if (!llamafu->vision_initialized && params->n_media_inputs > 0) {
-            return LLAMAFU_ERROR_VISION_INIT_FAILED;
-        }
-
-        // Process all image inputs
-        std::vector<LlamafuImageProcessResult> image_results;
-        image_results.reserve(params->n_media_inputs);
+    if (params->draft_type == LLAMAFU_DRAFT_NGRAM &&
+        (params->ngram_min < 1 || params->ngram_max < params->ngram_min)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-        for (size_t i = 0; i < params->n_media_inputs; ++i) {
-            if (params->media_inputs[i].type == LLAMAFU_MEDIA_TYPE_IMAGE) {
-                LlamafuImageProcessResult result;
-                LlamafuError process_result = llamafu_image_process(llamafu, &params->media_inputs[i], &result);
-                
-                if (process_result != LLAMAFU_SUCCESS) {
-                    // Cleanup previously processed images
-                    for (auto& prev_result : image_results) {
-                        if (prev_result.embeddings) {
-                            free(prev_result.embeddings);
-                        }
-                    }
-                    return process_result;
-                }
-                
-                image_results.push_back(result);
-            }
-        }
+    if (params->draft_type == LLAMAFU_DRAFT_MODEL && !validate_string_param(params->draft_model_path, "draft_model_path")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-        // Create enhanced prompt with image tokens
-        std::string enhanced_prompt = params->prompt;
-        
-        if (!image_results.empty() && params->include_image_tokens) {
-            std::string image_tokens;
-            const char* token_format = params->image_token_format ? params->image_token_format : "<image>";
-            
-            for (size_t i = 0; i < image_results.size(); ++i) {
-                if (i > 0) image_tokens += " ";
-                image_tokens += token_format;
-            }
-            
-            if (params->preserve_image_order) {
-                enhanced_prompt = image_tokens + " " + enhanced_prompt;
-            } else {
-                enhanced_prompt = enhanced_prompt + " " + image_tokens;
-            }
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        GenerationScope generation(llamafu);
+        speculative_free(llamafu);
+        if (params->draft_type == LLAMAFU_DRAFT_NONE) {
+            return LLAMAFU_SUCCESS;
         }
 
-        // Convert to standard inference parameters
-        LlamafuInferParams text_params = {};
-        text_params.prompt = enhanced_prompt.c_str();
-        text_params.max_tokens = params->max_tokens;
-        text_params.temperature = params->temperature;
-        text_params.top_k = params->top_k;
-        text_params.top_p = params->top_p;
-        text_params.min_p = params->min_p;
-        text_params.repeat_penalty = params->repeat_penalty;
+        auto spec = std::make_unique<SpeculativeState>();
+        spec->type = static_cast<LlamafuDraftType>(params->draft_type);
+        spec->n_draft = params->n_draft;
+        spec->ngram_min = params->ngram_min;
+        spec->ngram_max = params->ngram_max;
+
+        if (spec->type == LLAMAFU_DRAFT_MODEL) {
+            spec->draft_model = llama_model_load_from_file(params->draft_model_path, llama_model_default_params());
+            if (!spec->draft_model) {
+                return LLAMAFU_ERROR_MODEL_LOAD_FAILED;
+            }
 
-        // Perform text completion
-        LlamafuError completion_result = llamafu_complete(llamafu, &text_params, out_result);
+            // Drafted ids are fed to the main model as-is
+            const llama_vocab* main_vocab = llama_model_get_vocab(llamafu->model);
+            const llama_vocab* draft_vocab = llama_model_get_vocab(spec->draft_model);
+            if (llama_vocab_n_tokens(main_vocab) != llama_vocab_n_tokens(draft_vocab) ||
+                llama_vocab_bos(main_vocab) != llama_vocab_bos(draft_vocab) ||
+                llama_vocab_eos(main_vocab) != llama_vocab_eos(draft_vocab)) {
+                llama_model_free(spec->draft_model);
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
 
-        // Cleanup image processing results
-        for (auto& result : image_results) {
-            if (result.embeddings) {
-                free(result.embeddings);
+            llama_context_params ctx_params = llama_context_default_params();
+            ctx_params.n_ctx = llama_n_ctx(llamafu->ctx);
+            ctx_params.n_batch = llama_n_batch(llamafu->ctx);
+            ctx_params.n_ubatch = llama_n_ubatch(llamafu->ctx);
+            ctx_params.n_seq_max = 1;
+            ctx_params.n_threads = llama_n_threads(llamafu->ctx);
+            ctx_params.n_threads_batch = llama_n_threads_batch(llamafu->ctx);
+            spec->draft_ctx = llama_init_from_model(spec->draft_model, ctx_params);
+            if (!spec->draft_ctx) {
+                llama_model_free(spec->draft_model);
+                return LLAMAFU_ERROR_CONTEXT_INIT_FAILED;
             }
+            spec->draft_sampler = llama_sampler_init_greedy();
         }
 
-        return completion_result;
-
+        llamafu->speculative = spec.release();
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
         return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-LlamafuError llamafu_multimodal_complete_streaming(Llamafu llamafu, LlamafuMultimodalInferParams* params, 
-                                                  LlamafuStreamCallback callback, void* user_data) {
-    if (!llamafu || !params || !callback) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
-
-    // For now, fall back to non-streaming and call callback with complete result
-    char* result = nullptr;
-    LlamafuError error = llamafu_multimodal_complete_enhanced(llamafu, params, &result);
-    
-    if (error == LLAMAFU_SUCCESS && result) {
-        callback(result, user_data);
-        llamafu_free_string(result);
-    }
-    
-    return error;
+const char* llamafu_print_system_info(void) {
+    static std::string info;
+    info = llama_print_system_info();
+    return info.c_str();
 }
 
 // =============================================================================
-// Convenience Functions for Common Use Cases
+// Missing FFI Function Stubs - Text Processing
 // =============================================================================
 
-LlamafuError llamafu_chat_with_image_file(Llamafu llamafu, const char* prompt, const char* image_path, 
-                                          int32_t max_tokens, char** out_result) {
-    if (!llamafu || !validate_string_param(prompt, "prompt") || 
-        !validate_string_param(image_path, "image_path") || !out_result) {
+LlamafuError llamafu_analyze_sentiment(
+    Llamafu llamafu,
+    const char* text,
+    float* out_positive_score,
+    float* out_negative_score,
+    float* out_neutral_score
+) {
+    if (!llamafu || !text || !out_positive_score || !out_negative_score || !out_neutral_score) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        // Create image input
-        LlamafuMediaInput image_input;
-        LlamafuError load_result = llamafu_image_load_from_file(image_path, LLAMAFU_IMAGE_FORMAT_AUTO, &image_input);
-        if (load_result != LLAMAFU_SUCCESS) {
-            return load_result;
-        }
+    // Use completion to analyze sentiment
+    std::string prompt = "Analyze the sentiment of this text and respond with only one word: POSITIVE, NEGATIVE, or NEUTRAL.\nText: \"";
+    prompt += text;
+    prompt += "\"\nSentiment:";
 
-        // Create multimodal parameters
-        LlamafuMultimodalInferParams mm_params = {};
-        mm_params.prompt = prompt;
-        mm_params.media_inputs = &image_input;
-        mm_params.n_media_inputs = 1;
-        mm_params.max_tokens = max_tokens > 0 ? max_tokens : 512;
-        mm_params.temperature = 0.7f;
-        mm_params.top_k = 40;
-        mm_params.top_p = 0.9f;
-        mm_params.include_image_tokens = true;
-        mm_params.preserve_image_order = true;
+    LlamafuInferParams params = {};
+    params.prompt = prompt.c_str();
+    params.max_tokens = 10;
+    params.temperature = 0.1f;
+    params.top_k = 3;
+    params.top_p = 0.9f;
+    params.seed = 42;
 
-        return llamafu_multimodal_complete_enhanced(llamafu, &mm_params, out_result);
+    char* response = nullptr;
+    LlamafuError err = llamafu_complete(llamafu, &params, &response);
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    if (err != LLAMAFU_SUCCESS || !response) {
+        // Fallback to neutral if detection fails
+        *out_positive_score = 0.33f;
+        *out_negative_score = 0.33f;
+        *out_neutral_score = 0.34f;
+        return LLAMAFU_SUCCESS;
+    }
+
+    // Parse response
+    std::string resp(response);
+    llamafu_free_string(response);
+
+    // Convert to lowercase for matching
+    for (auto& c : resp) c = tolower(c);
+
+    if (resp.find("positive") != std::string::npos) {
+        *out_positive_score = 0.8f;
+        *out_negative_score = 0.1f;
+        *out_neutral_score = 0.1f;
+    } else if (resp.find("negative") != std::string::npos) {
+        *out_positive_score = 0.1f;
+        *out_negative_score = 0.8f;
+        *out_neutral_score = 0.1f;
+    } else {
+        *out_positive_score = 0.2f;
+        *out_negative_score = 0.2f;
+        *out_neutral_score = 0.6f;
     }
+
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_chat_with_image_base64(Llamafu llamafu, const char* prompt, const char* image_base64, 
-                                           int32_t max_tokens, char** out_result) {
-    if (!llamafu || !validate_string_param(prompt, "prompt") || 
-        !validate_string_param(image_base64, "image_base64") || !out_result) {
+LlamafuError llamafu_detect_language(
+    Llamafu llamafu,
+    const char* text,
+    char** out_language_code,
+    float* out_confidence
+) {
+    if (!llamafu || !text || !out_language_code) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        // Create image input
-        LlamafuMediaInput image_input;
-        LlamafuError load_result = llamafu_image_load_from_base64(image_base64, LLAMAFU_IMAGE_FORMAT_AUTO, &image_input);
-        if (load_result != LLAMAFU_SUCCESS) {
-            return load_result;
-        }
+    // Use completion to detect language
+    std::string prompt = "Identify the language of this text and respond with only the ISO 639-1 code (e.g., en, es, fr, de, zh, ja, ko, ar, ru). Text: \"";
+    prompt += text;
+    prompt += "\"\nLanguage code:";
 
-        // Create multimodal parameters
-        LlamafuMultimodalInferParams mm_params = {};
-        mm_params.prompt = prompt;
-        mm_params.media_inputs = &image_input;
-        mm_params.n_media_inputs = 1;
-        mm_params.max_tokens = max_tokens > 0 ? max_tokens : 512;
-        mm_params.temperature = 0.7f;
-        mm_params.top_k = 40;
-        mm_params.top_p = 0.9f;
-        mm_params.include_image_tokens = true;
-        mm_params.preserve_image_order = true;
+    LlamafuInferParams params = {};
+    params.prompt = prompt.c_str();
+    params.max_tokens = 10;
+    params.temperature = 0.1f;
+    params.top_k = 5;
+    params.top_p = 0.9f;
+    params.seed = 42;
 
-        return llamafu_multimodal_complete_enhanced(llamafu, &mm_params, out_result);
+    char* response = nullptr;
+    LlamafuError err = llamafu_complete(llamafu, &params, &response);
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    if (err != LLAMAFU_SUCCESS || !response) {
+        // Fallback to English if detection fails
+        *out_language_code = strdup("en");
+        if (out_confidence) *out_confidence = 0.5f;
+        return LLAMAFU_SUCCESS;
+    }
+
+    // Parse the response to extract language code
+    std::string resp(response);
+    llamafu_free_string(response);
+
+    // Trim whitespace and take first word
+    size_t start = resp.find_first_not_of(" \t\n");
+    if (start == std::string::npos) {
+        *out_language_code = strdup("en");
+        if (out_confidence) *out_confidence = 0.5f;
+        return LLAMAFU_SUCCESS;
+    }
+
+    size_t end = resp.find_first_of(" \t\n.,", start);
+    std::string code = resp.substr(start, end == std::string::npos ? 2 : std::min(end - start, size_t(2)));
+
+    // Validate it looks like a language code (2 lowercase letters)
+    if (code.length() >= 2) {
+        code = code.substr(0, 2);
+        for (auto& c : code) c = tolower(c);
+    } else {
+        code = "en"; // Default
+    }
+
+    *out_language_code = strdup(code.c_str());
+    if (out_confidence) {
+        *out_confidence = 0.8f; // Moderate confidence for model-based detection
     }
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_chat_with_multiple_images(Llamafu llamafu, const char* prompt, const char** image_paths, 
-                                              size_t n_images, int32_t max_tokens, char** out_result) {
-    if (!llamafu || !validate_string_param(prompt, "prompt") || !image_paths || n_images == 0 || !out_result) {
+LlamafuError llamafu_extract_keywords(
+    Llamafu llamafu,
+    const char* text,
+    int32_t max_keywords,
+    char** out_keywords_json
+) {
+    if (!llamafu || !text || !out_keywords_json) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    try {
-        // Create image inputs array
-        std::vector<LlamafuMediaInput> image_inputs(n_images);
-        
-        for (size_t i = 0; i < n_images; ++i) {
-            if (!validate_string_param(image_paths[i], "image_path")) {
-                return LLAMAFU_ERROR_INVALID_PARAM;
-            }
-            
-            LlamafuError load_result = llamafu_image_load_from_file(image_paths[i], LLAMAFU_IMAGE_FORMAT_AUTO, &image_inputs[i]);
-            if (load_result != LLAMAFU_SUCCESS) {
-                return load_result;
-            }
-        }
+    if (max_keywords <= 0) max_keywords = 5;
 
-        // Create multimodal parameters
-        LlamafuMultimodalInferParams mm_params = {};
-        mm_params.prompt = prompt;
-        mm_params.media_inputs = image_inputs.data();
-        mm_params.n_media_inputs = n_images;
-        mm_params.max_tokens = max_tokens > 0 ? max_tokens : 512;
-        mm_params.temperature = 0.7f;
-        mm_params.top_k = 40;
-        mm_params.top_p = 0.9f;
-        mm_params.include_image_tokens = true;
-        mm_params.preserve_image_order = true;
+    // Use completion to extract keywords
+    std::string prompt = "Extract " + std::to_string(max_keywords) + " key words or phrases from this text. List them one per line, no numbering.\nText: \"";
+    prompt += text;
+    prompt += "\"\nKeywords:\n";
 
-        return llamafu_multimodal_complete_enhanced(llamafu, &mm_params, out_result);
+    LlamafuInferParams params = {};
+    params.prompt = prompt.c_str();
+    params.max_tokens = 100;
+    params.temperature = 0.3f;
+    params.top_k = 20;
+    params.top_p = 0.9f;
+    params.seed = 42;
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    char* response = nullptr;
+    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+
+    if (err != LLAMAFU_SUCCESS || !response) {
+        *out_keywords_json = strdup("[]");
+        return LLAMAFU_SUCCESS;
+    }
+
+    // Parse response into JSON array
+    std::string resp(response);
+    llamafu_free_string(response);
+
+    std::vector<std::string> keywords;
+    std::istringstream iss(resp);
+    std::string line;
+    while (std::getline(iss, line) && keywords.size() < static_cast<size_t>(max_keywords)) {
+        // Trim whitespace
+        size_t start = line.find_first_not_of(" \t-•*");
+        size_t end = line.find_last_not_of(" \t\r\n");
+        if (start != std::string::npos && end != std::string::npos && end >= start) {
+            std::string keyword = line.substr(start, end - start + 1);
+            if (!keyword.empty() && keyword.length() > 1) {
+                keywords.push_back(keyword);
+            }
+        }
+    }
+
+    // Build JSON array
+    std::string json = "[";
+    for (size_t i = 0; i < keywords.size(); i++) {
+        if (i > 0) json += ",";
+        json += "\"";
+        // Escape special characters
+        for (char c : keywords[i]) {
+            if (c == '"') json += "\\\"";
+            else if (c == '\\') json += "\\\\";
+            else json += c;
+        }
+        json += "\"";
     }
-}
+    json += "]";
 
-// =============================================================================
-// Model Information and Utility Functions
-// =============================================================================
+    *out_keywords_json = strdup(json.c_str());
+    return LLAMAFU_SUCCESS;
+}
 
-LlamafuError llamafu_get_image_requirements(Llamafu llamafu, int32_t* out_max_width, int32_t* out_max_height, 
-                                           int32_t* out_preferred_size, bool* out_requires_square) {
-    if (!llamafu || !out_max_width || !out_max_height || !out_preferred_size || !out_requires_square) {
+LlamafuError llamafu_text_summarize(
+    Llamafu llamafu,
+    const char* text,
+    int32_t max_summary_length,
+    const char* style,
+    char** out_summary
+) {
+    if (!llamafu || !text || !out_summary) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    if (!llamafu->is_multimodal || !llamafu->vision_initialized) {
-        return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED;
-    }
-
-    try {
-        // Get requirements from CLIP context
-        int32_t image_size = clip_get_image_size(llamafu->clip_ctx_vision);
-        
-        *out_max_width = image_size;
-        *out_max_height = image_size;
-        *out_preferred_size = image_size;
-        *out_requires_square = true; // Most vision models expect square images
-        
-        return LLAMAFU_SUCCESS;
+    if (max_summary_length <= 0) max_summary_length = 100;
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    std::string style_instruction = "";
+    if (style && strlen(style) > 0) {
+        style_instruction = std::string(" in a ") + style + " style";
     }
-}
 
-LlamafuError llamafu_get_supported_formats(LlamafuImageFormat** out_formats, size_t* out_n_formats) {
-    if (!out_formats || !out_n_formats) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+    std::string prompt = "Summarize the following text" + style_instruction + " in about " +
+        std::to_string(max_summary_length / 5) + " words:\n\n\"" + text + "\"\n\nSummary:";
 
-    static LlamafuImageFormat supported_formats[] = {
-        LLAMAFU_IMAGE_FORMAT_JPEG,
-        LLAMAFU_IMAGE_FORMAT_PNG,
-        LLAMAFU_IMAGE_FORMAT_BMP,
-        LLAMAFU_IMAGE_FORMAT_WEBP
-    };
+    LlamafuInferParams params = {};
+    params.prompt = prompt.c_str();
+    params.max_tokens = max_summary_length;
+    params.temperature = 0.5f;
+    params.top_k = 40;
+    params.top_p = 0.9f;
+    params.seed = 42;
 
-    *out_n_formats = sizeof(supported_formats) / sizeof(supported_formats[0]);
-    *out_formats = static_cast<LlamafuImageFormat*>(malloc(*out_n_formats * sizeof(LlamafuImageFormat)));
-    
-    if (!*out_formats) {
-        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    char* response = nullptr;
+    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+
+    if (err != LLAMAFU_SUCCESS || !response) {
+        *out_summary = strdup("Failed to generate summary.");
+        return LLAMAFU_SUCCESS;
     }
 
-    memcpy(*out_formats, supported_formats, *out_n_formats * sizeof(LlamafuImageFormat));
+    *out_summary = response;
     return LLAMAFU_SUCCESS;
 }
 
 // =============================================================================
-// Memory Management Functions
+// Missing FFI Function Stubs - Media Processing
 // =============================================================================
 
-void llamafu_media_input_free(LlamafuMediaInput* input) {
-    if (input) {
-        // Note: We don't free input->data as it's owned by the caller
-        memset(input, 0, sizeof(LlamafuMediaInput));
-    }
-}
-
-void llamafu_media_batch_free(LlamafuMediaBatch* batch) {
-    if (batch) {
-        if (batch->inputs) {
-            for (size_t i = 0; i < batch->n_inputs; ++i) {
-                llamafu_media_input_free(&batch->inputs[i]);
-            }
-            free(batch->inputs);
-        }
-        memset(batch, 0, sizeof(LlamafuMediaBatch));
+LlamafuError llamafu_audio_process(
+    Llamafu llamafu,
+    const LlamafuMediaInput* input,
+    LlamafuAudioProcessResult* out_result
+) {
+    if (!llamafu || !input || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED; // Audio not supported
 }
 
-void llamafu_image_process_result_free(LlamafuImageProcessResult* result) {
-    if (result) {
-        if (result->embeddings) {
-            free(result->embeddings);
-        }
-        memset(result, 0, sizeof(LlamafuImageProcessResult));
+LlamafuError llamafu_audio_resample(
+    const float* input_samples,
+    size_t n_input_samples,
+    int32_t input_rate,
+    int32_t target_rate,
+    float** out_samples,
+    size_t* out_n_samples
+) {
+    if (!input_samples || !out_samples || !out_n_samples) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED; // Audio not supported
 }
 
-void llamafu_image_validation_free(LlamafuImageValidation* validation) {
-    if (validation) {
-        memset(validation, 0, sizeof(LlamafuImageValidation));
+LlamafuError llamafu_image_resize(
+    const LlamafuMediaInput* input,
+    int32_t target_width,
+    int32_t target_height,
+    bool maintain_aspect_ratio,
+    LlamafuMediaInput* out_resized
+) {
+    if (!input || !out_resized) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    return LLAMAFU_ERROR_UNKNOWN; // Not implemented
 }
 
-
 // =============================================================================
-// JSON Schema to GBNF Grammar Conversion
+// Missing FFI Function Stubs - Validation
 // =============================================================================
 
-// Helper to escape string for GBNF
-static std::string gbnf_escape(const std::string& s) {
-    std::string result;
-    for (char c : s) {
-        if (c == '"' || c == '\\') {
-            result += '\\';
-        }
-        result += c;
+LlamafuError llamafu_validate_json_schema(
+    const char* json_string,
+    const char* schema,
+    bool* out_is_valid,
+    char** out_error_message
+) {
+    if (!json_string || !schema || !out_is_valid) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    return result;
+    // Basic JSON validation - just check if it parses
+    *out_is_valid = true; // Stub - assume valid
+    return LLAMAFU_SUCCESS;
 }
 
-// Generate unique rule name
-static std::string generate_rule_name(const std::string& base, int& counter) {
-    return base + "_" + std::to_string(counter++);
-}
+LlamafuError llamafu_generate_structured(
+    Llamafu llamafu,
+    const char* prompt,
+    const LlamafuStructuredOutput* output_config,
+    char** out_result
+) {
+    if (!llamafu || !prompt || !out_result) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-// Forward declaration
-static std::string schema_to_gbnf_rule(const std::string& json_schema, const std::string& rule_name, 
-                                       std::string& rules, int& counter);
+    LlamafuOutputFormat format = output_config ? output_config->format : LLAMAFU_OUTPUT_FORMAT_JSON;
+    bool pretty_print = output_config ? output_config->pretty_print : false;
 
-// Convert JSON Schema type to GBNF
-static std::string json_type_to_gbnf(const std::string& type_str, const std::string& schema_json,
-                                     std::string& rules, int& counter) {
-    if (type_str == "string") {
-        return "\"\\\"\" [^\"]* \"\\\"\"";
-    } else if (type_str == "integer") {
-        return "\"-\"? [0-9]+";
-    } else if (type_str == "number") {
-        return "\"-\"? [0-9]+ (\".\" [0-9]+)?";
-    } else if (type_str == "boolean") {
-        return "(\"true\" | \"false\")";
-    } else if (type_str == "null") {
-        return "\"null\"";
-    } else if (type_str == "array") {
-        return "\"[\" ws (value (ws \",\" ws value)*)? ws \"]\"";
-    } else if (type_str == "object") {
-        return "\"{\" ws (string ws \":\" ws value (ws \",\" ws string ws \":\" ws value)*)? ws \"}\"";
+    std::string format_instruction;
+    switch (format) {
+        case LLAMAFU_OUTPUT_FORMAT_JSON:
+            format_instruction = pretty_print ?
+                "Respond with valid, formatted JSON only." :
+                "Respond with valid JSON only on a single line.";
+            break;
+        case LLAMAFU_OUTPUT_FORMAT_YAML:
+            format_instruction = "Respond with valid YAML only.";
+            break;
+        case LLAMAFU_OUTPUT_FORMAT_XML:
+            format_instruction = "Respond with valid XML only.";
+            break;
+        case LLAMAFU_OUTPUT_FORMAT_MARKDOWN:
+            format_instruction = "Respond in Markdown format.";
+            break;
+        default:
+            format_instruction = "Respond with valid JSON only.";
     }
-    return "value";
-}
 
-// Parse simple JSON to extract field
-static std::string extract_json_field(const std::string& json, const std::string& field) {
-    std::string search = "\"" + field + "\"";
-    size_t pos = json.find(search);
-    if (pos == std::string::npos) return "";
-    
-    pos = json.find(':', pos);
-    if (pos == std::string::npos) return "";
-    pos++;
-    
-    // Skip whitespace
-    while (pos < json.size() && (json[pos] == ' ' || json[pos] == '\n' || json[pos] == '\t')) pos++;
-    
-    if (pos >= json.size()) return "";
-    
-    // Extract value
-    if (json[pos] == '"') {
-        // String value
-        size_t end = json.find('"', pos + 1);
-        if (end != std::string::npos) {
-            return json.substr(pos + 1, end - pos - 1);
-        }
-    } else if (json[pos] == '{' || json[pos] == '[') {
-        // Object or array - find matching bracket
-        char open = json[pos];
-        char close = (open == '{') ? '}' : ']';
-        int depth = 1;
-        size_t end = pos + 1;
-        while (end < json.size() && depth > 0) {
-            if (json[end] == open) depth++;
-            else if (json[end] == close) depth--;
-            end++;
-        }
-        return json.substr(pos, end - pos);
-    } else {
-        // Primitive value
-        size_t end = pos;
-        while (end < json.size() && json[end] != ',' && json[end] != '}' && json[end] != ']') end++;
-        std::string val = json.substr(pos, end - pos);
-        // Trim
-        while (!val.empty() && (val.back() == ' ' || val.back() == '\n')) val.pop_back();
-        return val;
-    }
-    return "";
-}
+    std::string full_prompt = std::string(prompt) + "\n\n" + format_instruction;
 
-LlamafuError llamafu_schema_to_grammar(const char* json_schema, char** out_grammar) {
-    if (!json_schema || !out_grammar) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+    LlamafuInferParams params = {};
+    params.prompt = full_prompt.c_str();
+    params.max_tokens = 512;
+    params.temperature = 0.3f;
+    params.top_k = 40;
+    params.top_p = 0.9f;
+    params.seed = 42;
 
-    try {
-        std::string schema(json_schema);
-        std::string rules;
-        int counter = 0;
-        
-        // Basic GBNF structure
-        std::string grammar = R"(
-root ::= json
-json ::= object | array | string | number | "true" | "false" | "null"
-object ::= "{" ws (pair (ws "," ws pair)*)? ws "}"
-pair ::= string ws ":" ws json
-array ::= "[" ws (json (ws "," ws json)*)? ws "]"
-string ::= "\"" ([^"\\] | "\\" .)* "\""
-number ::= "-"? [0-9]+ ("." [0-9]+)? ([eE] [+-]? [0-9]+)?
-ws ::= [ \t\n\r]*
-)";
-        
-        // If schema specifies type, we can be more specific
-        std::string type_str = extract_json_field(schema, "type");
-        if (type_str == "object") {
-            std::string properties = extract_json_field(schema, "properties");
-            if (!properties.empty()) {
-                // Build specific object grammar
-                grammar = "root ::= specific-object\n";
-                grammar += "specific-object ::= \"{\" ws ";
-                
-                // Parse properties (simplified)
-                // In production, use proper JSON parser
-                grammar += "pair (ws \",\" ws pair)* ";
-                grammar += "ws \"}\"\n";
-                grammar += R"(
-pair ::= string ws ":" ws value
-string ::= "\"" ([^"\\] | "\\" .)* "\""
-value ::= string | number | "true" | "false" | "null" | object | array
-object ::= "{" ws (pair (ws "," ws pair)*)? ws "}"
-array ::= "[" ws (value (ws "," ws value)*)? ws "]"
-number ::= "-"? [0-9]+ ("." [0-9]+)?
-ws ::= [ \t\n\r]*
-)";
-            }
-        }
-        
-        *out_grammar = strdup(grammar.c_str());
-        if (!*out_grammar) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
-        
+    char* response = nullptr;
+    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+
+    if (err != LLAMAFU_SUCCESS || !response) {
+        *out_result = strdup("{}");
         return LLAMAFU_SUCCESS;
-
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
     }
+
+    *out_result = response;
+    return LLAMAFU_SUCCESS;
 }
 
+} // extern "C"
+
 // =============================================================================
-// Tool Calling Implementation
+// Continuous Batching Scheduler
 // =============================================================================
 
-LlamafuError llamafu_build_tool_grammar(const LlamafuTool* tools, size_t n_tools, 
-                                        bool allow_multiple, char** out_grammar) {
-    if (!tools || n_tools == 0 || !out_grammar) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+struct ScheduledRequest {
+    std::vector<llama_token> prompt_tokens;
+    int32_t max_tokens = 0;
+    SamplerPipeline* sampler = nullptr;
+    LlamafuStreamCallback callback = nullptr;
+    void* user_data = nullptr;
+
+    // Guards text, n_polled, state, error and callback, which poll, cancel
+    // and free reach from any thread. Writers also hold the handle lock, so
+    // the scheduler reads them without this one. Recursive so that the
+    // callback, run under it, may poll or free its own request.
+    std::recursive_mutex mutex;
+    LlamafuRequestState state = LLAMAFU_REQUEST_QUEUED;
+    LlamafuError error = LLAMAFU_SUCCESS;
+    std::atomic<bool> cancel_requested{false};
+
+    llama_seq_id seq_id = -1;
+    int32_t n_prefilled = 0;          // Prompt tokens already decoded
+    int32_t n_generated = 0;
+    llama_token pending_token = 0;    // Sampled, to be decoded in the next step
+    int32_t i_batch = -1;             // Logits index in the current batch
+
+    std::string text;                 // Generated text, whole characters only
+    size_t n_polled = 0;              // Bytes of text already returned by poll
+    StopMatcher stops;
+    StreamDetokenizer detok;          // Bytes not yet appended to text
+
+    LoraSet lora;                     // Adapters this request decodes with
+    int64_t last_step = -1;           // Scheduler step that last included it
+};
 
-    try {
-        std::string grammar;
-        
-        if (allow_multiple) {
-            grammar = "root ::= \"{\" ws \"\\\"tool_calls\\\"\" ws \":\" ws \"[\" ws tool-call (ws \",\" ws tool-call)* ws \"]\" ws \"}\"\n";
-        } else {
-            grammar = "root ::= tool-call\n";
-        }
-        
-        // Build tool-call rule with all possible tools
-        grammar += "tool-call ::= \"{\" ws ";
-        grammar += "\"\\\"id\\\"\" ws \":\" ws string ws \",\" ws ";
-        grammar += "\"\\\"name\\\"\" ws \":\" ws tool-name ws \",\" ws ";
-        grammar += "\"\\\"arguments\\\"\" ws \":\" ws tool-args ws ";
-        grammar += "\"}\"\n";
-        
-        // Tool names
-        grammar += "tool-name ::= ";
-        for (size_t i = 0; i < n_tools; i++) {
-            if (i > 0) grammar += " | ";
-            grammar += "\"\\\"" + std::string(tools[i].name) + "\\\"\"";
-        }
-        grammar += "\n";
-        
-        // Tool arguments (JSON object)
-        grammar += "tool-args ::= \"{\" ws (pair (ws \",\" ws pair)*)? ws \"}\"\n";
-        
-        // Common rules
-        grammar += R"(
-pair ::= string ws ":" ws value
-string ::= "\"" ([^"\\] | "\\" .)* "\""
-value ::= string | number | "true" | "false" | "null" | object | array
-object ::= "{" ws (pair (ws "," ws pair)*)? ws "}"
-array ::= "[" ws (value (ws "," ws value)*)? ws "]"
-number ::= "-"? [0-9]+ ("." [0-9]+)?
-ws ::= [ \t\n\r]*
-)";
-        
-        *out_grammar = strdup(grammar.c_str());
-        if (!*out_grammar) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
-        
-        return LLAMAFU_SUCCESS;
+struct LlamafuRequest_s {
+    std::shared_ptr<ScheduledRequest> request;
+};
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
+struct LlamafuScheduler_s {
+    std::deque<std::shared_ptr<ScheduledRequest>> queue;
+    std::vector<std::shared_ptr<ScheduledRequest>> active;
+    llama_batch batch;
+    int32_t batch_capacity;
+    int64_t n_steps = 0;
+};
+
+// Appends a completed span to the request's text and streams it
+static void scheduler_emit(ScheduledRequest& req, const char* text, size_t len) {
+    std::lock_guard<std::recursive_mutex> lock(req.mutex);
+    req.text.append(text, len);
+    if (req.callback) {
+        req.callback(text, req.user_data);
     }
 }
 
-// Generate unique ID for tool call
-static std::string generate_call_id() {
-    static int call_counter = 0;
-    return "call_" + std::to_string(++call_counter);
+static void scheduler_finish(Llamafu llamafu, ScheduledRequest& req, LlamafuRequestState state,
+                             LlamafuError error) {
+    if (state == LLAMAFU_REQUEST_DONE) {
+        req.detok.flush([&](const char* text, size_t len) { scheduler_emit(req, text, len); });
+    }
+    if (req.seq_id >= 0) {
+        llama_memory_seq_rm(llama_get_memory(llamafu->ctx), req.seq_id, -1, -1);
+        llamafu->seq_in_use[req.seq_id] = false;
+        req.seq_id = -1;
+    }
+    delete req.sampler;
+    req.sampler = nullptr;
+    std::lock_guard<std::recursive_mutex> lock(req.mutex);
+    req.state = state;
+    req.error = error;
 }
 
-// Parse tool call from generated JSON
-static bool parse_tool_call(const std::string& json, LlamafuToolCall* call) {
-    call->id = strdup(extract_json_field(json, "id").c_str());
-    if (!call->id || strlen(call->id) == 0) {
-        free(call->id);
-        call->id = strdup(generate_call_id().c_str());
+static void scheduler_destroy(Llamafu llamafu) {
+    LlamafuScheduler_s* sched = llamafu->scheduler;
+    if (!sched) {
+        return;
     }
-    
-    std::string name = extract_json_field(json, "name");
-    call->name = strdup(name.c_str());
-    
-    std::string args = extract_json_field(json, "arguments");
-    call->arguments_json = strdup(args.c_str());
-    
-    return call->name && strlen(call->name) > 0;
+    for (auto& req : sched->active) {
+        scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_CANCELLED, LLAMAFU_SUCCESS);
+    }
+    for (auto& req : sched->queue) {
+        scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_CANCELLED, LLAMAFU_SUCCESS);
+    }
+    llama_batch_free(sched->batch);
+    delete sched;
+    llamafu->scheduler = nullptr;
 }
 
-LlamafuError llamafu_generate_tool_call(Llamafu llamafu, const LlamafuToolCallParams* params,
-                                        LlamafuToolCall** out_calls, size_t* out_n_calls) {
-    if (!llamafu || !params || !out_calls || !out_n_calls) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Fail scheduled requests that decode with an adapter about to be unloaded
+static void scheduler_drop_lora(Llamafu llamafu, const llama_adapter_lora* adapter) {
+    LlamafuScheduler_s* sched = llamafu->scheduler;
+    if (!sched) {
+        return;
     }
-
-    try {
-        // Build grammar for tool calling
-        char* grammar = nullptr;
-        LlamafuError err = llamafu_build_tool_grammar(params->tools, params->n_tools, 
-                                                      params->allow_multiple_calls, &grammar);
-        if (err != LLAMAFU_SUCCESS) {
-            return err;
-        }
-        
-        // Build prompt with tool definitions
-        std::string full_prompt = "You have access to the following tools:\n\n";
-        for (size_t i = 0; i < params->n_tools; i++) {
-            full_prompt += "- " + std::string(params->tools[i].name) + ": ";
-            full_prompt += std::string(params->tools[i].description) + "\n";
-            if (params->tools[i].parameters_schema) {
-                full_prompt += "  Parameters: " + std::string(params->tools[i].parameters_schema) + "\n";
-            }
-        }
-        full_prompt += "\nUser: " + std::string(params->prompt) + "\n";
-        full_prompt += "\nRespond with a tool call in JSON format:\n";
-        
-        // Set up inference parameters
-        LlamafuInferParams infer_params = {};
-        infer_params.prompt = full_prompt.c_str();
-        infer_params.max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
-        infer_params.temperature = params->temperature > 0 ? params->temperature : 0.1f;
-        infer_params.seed = params->seed;
-        infer_params.grammar_str = grammar;
-        infer_params.grammar_root = "root";
-        
-        // Generate
-        char* result = nullptr;
-        err = llamafu_complete(llamafu, &infer_params, &result);
-        free(grammar);
-        
-        if (err != LLAMAFU_SUCCESS) {
-            return err;
+    auto uses_adapter = [adapter](const std::shared_ptr<ScheduledRequest>& req) {
+        return std::any_of(req->lora.begin(), req->lora.end(),
+                           [adapter](const auto& entry) { return entry.first == adapter; });
+    };
+    for (auto& req : sched->active) {
+        if (uses_adapter(req)) {
+            scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_FAILED, LLAMAFU_ERROR_LORA_NOT_FOUND);
         }
-        
-        // Parse result
-        std::string result_str(result);
-        free(result);
-        
-        if (params->allow_multiple_calls) {
-            // Parse array of tool calls
-            std::string calls_json = extract_json_field(result_str, "tool_calls");
-            // Simplified: assume single call for now
-            *out_n_calls = 1;
-            *out_calls = (LlamafuToolCall*)calloc(1, sizeof(LlamafuToolCall));
-            if (!*out_calls) {
-                return LLAMAFU_ERROR_OUT_OF_MEMORY;
-            }
-            // Parse from array - simplified
-            size_t start = calls_json.find('{');
-            size_t end = calls_json.rfind('}');
-            if (start != std::string::npos && end != std::string::npos) {
-                std::string call_json = calls_json.substr(start, end - start + 1);
-                parse_tool_call(call_json, &(*out_calls)[0]);
-            }
+    }
+    for (auto it = sched->queue.begin(); it != sched->queue.end();) {
+        if (uses_adapter(*it)) {
+            scheduler_finish(llamafu, **it, LLAMAFU_REQUEST_FAILED, LLAMAFU_ERROR_LORA_NOT_FOUND);
+            it = sched->queue.erase(it);
         } else {
-            // Single tool call
-            *out_n_calls = 1;
-            *out_calls = (LlamafuToolCall*)calloc(1, sizeof(LlamafuToolCall));
-            if (!*out_calls) {
-                return LLAMAFU_ERROR_OUT_OF_MEMORY;
-            }
-            parse_tool_call(result_str, &(*out_calls)[0]);
+            ++it;
         }
-        
-        return LLAMAFU_SUCCESS;
-
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-LlamafuError llamafu_generate_tool_call_streaming(Llamafu llamafu, const LlamafuToolCallParams* params,
-                                                  LlamafuStreamCallback callback, void* user_data,
-                                                  LlamafuToolCall** out_calls, size_t* out_n_calls) {
-    // For now, use non-streaming and return result
-    // Streaming will call back with tokens as they're generated
-    return llamafu_generate_tool_call(llamafu, params, out_calls, out_n_calls);
-}
-
-void llamafu_free_tool_calls(LlamafuToolCall* calls, size_t n_calls) {
-    if (calls) {
-        for (size_t i = 0; i < n_calls; i++) {
-            free(calls[i].id);
-            free(calls[i].name);
-            free(calls[i].arguments_json);
+// Hand free sequence ids to queued requests
+static void scheduler_admit(Llamafu llamafu, LlamafuScheduler_s* sched) {
+    while (!sched->queue.empty()) {
+        auto it = std::find(llamafu->seq_in_use.begin(), llamafu->seq_in_use.end(), false);
+        if (it == llamafu->seq_in_use.end()) {
+            return;
         }
-        free(calls);
+        auto req = sched->queue.front();
+        sched->queue.pop_front();
+
+        req->seq_id = static_cast<llama_seq_id>(it - llamafu->seq_in_use.begin());
+        *it = true;
+        llama_memory_seq_rm(llama_get_memory(llamafu->ctx), req->seq_id, -1, -1);
+        std::lock_guard<std::recursive_mutex> lock(req->mutex);
+        req->state = LLAMAFU_REQUEST_PREFILLING;
+        sched->active.push_back(req);
     }
 }
 
-// =============================================================================
-// JSON Output Implementation
-// =============================================================================
+extern "C" {
 
-LlamafuError llamafu_generate_json(Llamafu llamafu, const LlamafuJsonParams* params, char** out_json) {
-    if (!llamafu || !params || !out_json) {
+LlamafuError llamafu_scheduler_submit(
+    Llamafu llamafu,
+    const LlamafuInferParams* params,
+    LlamafuStreamCallback callback,
+    void* user_data,
+    LlamafuRequest* out_request
+) {
+    if (!llamafu || !params || !out_request) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (!validate_string_param(params->prompt, "prompt") ||
+        !validate_numeric_param(params->max_tokens, 1, 32768)) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+    }
+
     try {
-        // Convert schema to grammar
-        char* grammar = nullptr;
-        LlamafuError err = llamafu_schema_to_grammar(params->schema, &grammar);
-        if (err != LLAMAFU_SUCCESS) {
-            return err;
+        GenerationScope generation(llamafu);
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        const int32_t text_len = static_cast<int32_t>(strlen(params->prompt));
+
+        auto req = std::make_shared<ScheduledRequest>();
+        req->prompt_tokens.resize(text_len + 16);
+        const int32_t n_tokens = llama_tokenize(vocab, params->prompt, text_len,
+                                                req->prompt_tokens.data(), req->prompt_tokens.size(),
+                                                true, true);
+        if (n_tokens <= 0) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
         }
-        
-        // Set up inference parameters
-        LlamafuInferParams infer_params = {};
-        infer_params.prompt = params->prompt;
-        infer_params.max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
-        infer_params.temperature = params->temperature > 0 ? params->temperature : 0.1f;
-        infer_params.seed = params->seed;
-        infer_params.grammar_str = grammar;
-        infer_params.grammar_root = "root";
-        
-        // Generate
-        err = llamafu_complete(llamafu, &infer_params, out_json);
-        free(grammar);
-        
-        return err;
+        req->prompt_tokens.resize(n_tokens);
+
+        if (n_tokens >= static_cast<int32_t>(llama_n_ctx(llamafu->ctx))) {
+            return LLAMAFU_ERROR_CONTEXT_FULL;
+        }
+
+        // Fixed at submit, so later changes to the active set do not switch
+        // weights halfway through a request
+        LlamafuError lora_result = resolve_lora_set(llamafu, params->lora_batch, req->lora);
+        if (lora_result != LLAMAFU_SUCCESS) {
+            return lora_result;
+        }
+
+        LlamafuError sampler_result = build_sampler_for(llamafu, params, &req->sampler);
+        if (sampler_result != LLAMAFU_SUCCESS) {
+            return sampler_result;
+        }
+        if (!build_stop_matcher(params, req->stops)) {
+            delete req->sampler;
+            req->sampler = nullptr;
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        req->detok = StreamDetokenizer(&req->stops);
+        req->max_tokens = params->max_tokens;
+        req->callback = callback;
+        req->user_data = user_data;
+
+        if (!llamafu->scheduler) {
+            auto* sched = new LlamafuScheduler_s();
+            sched->batch_capacity = static_cast<int32_t>(llama_n_batch(llamafu->ctx));
+            sched->batch = llama_batch_init(sched->batch_capacity, 0, 1);
+            llamafu->scheduler = sched;
+        }
+        llamafu->scheduler->queue.push_back(req);
 
+        *out_request = new LlamafuRequest_s{req};
+        return LLAMAFU_SUCCESS;
     } catch (const std::exception& e) {
         return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-LlamafuError llamafu_generate_json_streaming(Llamafu llamafu, const LlamafuJsonParams* params,
-                                             LlamafuStreamCallback callback, void* user_data) {
-    if (!llamafu || !params || !callback) {
+LlamafuError llamafu_scheduler_step(Llamafu llamafu, int32_t* out_n_pending) {
+    if (!llamafu) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    const LlamafuError resident = ensure_resident(llamafu);
+    if (resident != LLAMAFU_SUCCESS) {
+        return resident;
+    }
+
+    LlamafuScheduler_s* sched = llamafu->scheduler;
+    if (!sched) {
+        if (out_n_pending) *out_n_pending = 0;
+        return LLAMAFU_SUCCESS;
+    }
+
+    if (generation_aborted(llamafu)) {
+        return LLAMAFU_ERROR_ABORTED;
+    }
 
     try {
-        // Convert schema to grammar
-        char* grammar = nullptr;
-        LlamafuError err = llamafu_schema_to_grammar(params->schema, &grammar);
-        if (err != LLAMAFU_SUCCESS) {
-            return err;
+        GenerationScope generation(llamafu);
+        // Retire cancelled requests, then fill freed sequences from the queue
+        for (auto& req : sched->active) {
+            if (req->cancel_requested) {
+                scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_CANCELLED, LLAMAFU_SUCCESS);
+            }
         }
-        
-        // Set up inference parameters
-        LlamafuInferParams infer_params = {};
-        infer_params.prompt = params->prompt;
-        infer_params.max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
-        infer_params.temperature = params->temperature > 0 ? params->temperature : 0.1f;
-        infer_params.seed = params->seed;
-        infer_params.grammar_str = grammar;
-        infer_params.grammar_root = "root";
-        
-        // Generate with streaming
-        err = llamafu_complete_stream(llamafu, &infer_params, callback, user_data);
-        free(grammar);
-        
-        return err;
+        for (auto it = sched->queue.begin(); it != sched->queue.end();) {
+            if ((*it)->cancel_requested) {
+                scheduler_finish(llamafu, **it, LLAMAFU_REQUEST_CANCELLED, LLAMAFU_SUCCESS);
+                it = sched->queue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        sched->active.erase(
+            std::remove_if(sched->active.begin(), sched->active.end(),
+                           [](const std::shared_ptr<ScheduledRequest>& r) {
+                               return r->state != LLAMAFU_REQUEST_PREFILLING &&
+                                      r->state != LLAMAFU_REQUEST_GENERATING;
+                           }),
+            sched->active.end());
+        scheduler_admit(llamafu, sched);
+
+        llama_batch& batch = sched->batch;
+        batch.n_tokens = 0;
+
+        // Adapters apply to the whole context, so only requests using the
+        // same set share a decode. Serve the set of the request that has
+        // waited longest; with several sets in use they take turns.
+        LoraSet step_lora;
+        int64_t oldest_step = INT64_MAX;
+        for (auto& req : sched->active) {
+            if (req->last_step < oldest_step) {
+                oldest_step = req->last_step;
+                step_lora = req->lora;
+            }
+        }
+        const int64_t step = ++sched->n_steps;
 
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
-    }
-}
+        // Decode steps for generating sequences go first so that a long
+        // prefill never stalls token output of the others
+        for (auto& req : sched->active) {
+            req->i_batch = -1;
+            if (req->lora != step_lora) {
+                continue;
+            }
+            if (req->state == LLAMAFU_REQUEST_GENERATING && batch.n_tokens < sched->batch_capacity) {
+                req->last_step = step;
+                req->i_batch = batch.n_tokens;
+                const llama_pos pos = static_cast<llama_pos>(req->prompt_tokens.size()) + req->n_generated - 1;
+                batch_add(batch, req->pending_token, pos, req->seq_id, true);
+            }
+        }
+
+        // Fill the remaining room with prompt chunks
+        for (auto& req : sched->active) {
+            if (req->state != LLAMAFU_REQUEST_PREFILLING || req->lora != step_lora ||
+                batch.n_tokens >= sched->batch_capacity) {
+                continue;
+            }
+            req->last_step = step;
+            const int32_t n_prompt = static_cast<int32_t>(req->prompt_tokens.size());
+            while (req->n_prefilled < n_prompt && batch.n_tokens < sched->batch_capacity) {
+                const bool last = req->n_prefilled == n_prompt - 1;
+                if (last) {
+                    req->i_batch = batch.n_tokens;
+                }
+                batch_add(batch, req->prompt_tokens[req->n_prefilled], req->n_prefilled,
+                                    req->seq_id, last);
+                req->n_prefilled++;
+            }
+        }
+
+        ScopedLoraSet lora_scope{llamafu, true};
+        if (batch.n_tokens > 0 && !apply_lora_set(llamafu, step_lora)) {
+            if (out_n_pending) *out_n_pending = static_cast<int32_t>(sched->queue.size() + sched->active.size());
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
 
-LlamafuError llamafu_json_validate(const char* json_string, const char* schema, 
-                                   bool* out_valid, char** out_error) {
-    if (!json_string || !schema || !out_valid) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+        if (batch.n_tokens > 0) {
+            const int32_t ret = llama_decode(llamafu->ctx, batch);
+            if (ret != 0) {
+                // ret == 1: no KV cells left for this batch
+                const LlamafuError err = ret == 1 ? LLAMAFU_ERROR_CONTEXT_FULL : LLAMAFU_ERROR_DECODE_FAILED;
+                for (auto& req : sched->active) {
+                    scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_FAILED, err);
+                }
+                sched->active.clear();
+                if (out_n_pending) *out_n_pending = static_cast<int32_t>(sched->queue.size());
+                return err;
+            }
+        }
 
-    try {
-        // Basic JSON validation - check for balanced braces
-        int brace_count = 0;
-        int bracket_count = 0;
-        bool in_string = false;
-        bool escape_next = false;
-        
-        for (const char* p = json_string; *p; p++) {
-            if (escape_next) {
-                escape_next = false;
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        const int32_t n_ctx = static_cast<int32_t>(llama_n_ctx(llamafu->ctx));
+
+        for (auto& req : sched->active) {
+            if (req->i_batch < 0) {
                 continue;
             }
-            
-            if (*p == '\\') {
-                escape_next = true;
+            {
+                std::lock_guard<std::recursive_mutex> lock(req->mutex);
+                req->state = LLAMAFU_REQUEST_GENERATING;
+            }
+
+            llama_token new_token = sampler_pipeline_sample(req->sampler, llamafu->ctx, req->i_batch);
+            if (llama_vocab_is_eog(vocab, new_token)) {
+                scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_DONE, LLAMAFU_SUCCESS);
                 continue;
             }
-            
-            if (*p == '"') {
-                in_string = !in_string;
+
+            const std::string_view piece = token_piece(llamafu->shared_model, new_token);
+            req->detok.push(piece.data(), piece.size(), [&](const char* text, size_t len) {
+                scheduler_emit(*req, text, len);
+            });
+            if (req->detok.stopped) {
+                scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_DONE, LLAMAFU_SUCCESS);
                 continue;
             }
-            
-            if (!in_string) {
-                if (*p == '{') brace_count++;
-                else if (*p == '}') brace_count--;
-                else if (*p == '[') bracket_count++;
-                else if (*p == ']') bracket_count--;
+
+            req->pending_token = new_token;
+            req->n_generated++;
+
+            const int32_t n_past = static_cast<int32_t>(req->prompt_tokens.size()) + req->n_generated;
+            if (req->n_generated >= req->max_tokens || n_past >= n_ctx - 1) {
+                scheduler_finish(llamafu, *req, LLAMAFU_REQUEST_DONE, LLAMAFU_SUCCESS);
             }
         }
-        
-        *out_valid = (brace_count == 0 && bracket_count == 0 && !in_string);
 
-        if (!*out_valid && out_error) {
-            if (brace_count != 0) {
-                *out_error = strdup("Unbalanced braces in JSON");
-            } else if (bracket_count != 0) {
-                *out_error = strdup("Unbalanced brackets in JSON");
-            } else {
-                *out_error = strdup("Unterminated string in JSON");
+        if (out_n_pending) {
+            int32_t n_pending = static_cast<int32_t>(sched->queue.size());
+            for (auto& req : sched->active) {
+                if (req->state == LLAMAFU_REQUEST_PREFILLING || req->state == LLAMAFU_REQUEST_GENERATING) {
+                    n_pending++;
+                }
             }
+            *out_n_pending = n_pending;
         }
-
         return LLAMAFU_SUCCESS;
-
     } catch (const std::exception& e) {
         return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-// =============================================================================
-// KV Cache Management and Streaming - extern "C" to prevent name mangling
-// =============================================================================
-
-extern "C" {
-
-void llamafu_kv_cache_clear(Llamafu llamafu) {
-    if (!llamafu || !llamafu->ctx) {
-        return;
+LlamafuError llamafu_request_poll(LlamafuRequest request, char** out_text, LlamafuRequestState* out_state) {
+    if (!request || !out_text || !out_state) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    llama_memory_clear(llama_get_memory(llamafu->ctx), false);
-}
 
-void llamafu_kv_cache_seq_rm(Llamafu llamafu, int32_t seq_id, int32_t p0, int32_t p1) {
-    if (!llamafu || !llamafu->ctx) {
-        return;
+    ScheduledRequest& req = *request->request;
+    std::lock_guard<std::recursive_mutex> lock(req.mutex);
+    *out_text = strdup(req.text.c_str() + req.n_polled);
+    if (!*out_text) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     }
-    // TODO: Implement seq_rm when needed
+    req.n_polled = req.text.size();
+    *out_state = req.state;
+    return req.error;
 }
 
-void llamafu_kv_cache_seq_cp(Llamafu llamafu, int32_t seq_id_src, int32_t seq_id_dst, int32_t p0, int32_t p1) {
-    if (!llamafu || !llamafu->ctx) {
-        return;
+LlamafuError llamafu_request_cancel(LlamafuRequest request) {
+    if (!request) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    // TODO: Implement seq_cp when needed
+    // Takes effect at the start of the next scheduler step
+    request->request->cancel_requested = true;
+    return LLAMAFU_SUCCESS;
 }
 
-void llamafu_kv_cache_seq_keep(Llamafu llamafu, int32_t seq_id) {
-    if (!llamafu || !llamafu->ctx) {
-        return;
+void llamafu_request_free(LlamafuRequest request) {
+    if (request) {
+        // The scheduler keeps its own reference until the request retires;
+        // the lock waits out a callback that is running
+        ScheduledRequest& req = *request->request;
+        req.cancel_requested = true;
+        {
+            std::lock_guard<std::recursive_mutex> lock(req.mutex);
+            req.callback = nullptr;
+        }
+        delete request;
     }
-    // TODO: Implement seq_keep when needed
 }
 
+} // extern "C"
+
 // =============================================================================
-// Streaming Completion
+// Background Token Streaming
 // =============================================================================
 
-LlamafuError llamafu_complete_stream(
-    Llamafu llamafu,
-    LlamafuInferParams* params,
-    LlamafuStreamCallback callback,
-    void* user_data
-) {
-    if (!llamafu || !params || !callback) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
-    }
+// Ring record layout: int32 token, uint32 byte length, then the piece bytes
+static const size_t TOKEN_RECORD_HEADER = sizeof(int32_t) + sizeof(uint32_t);
+static const size_t TOKEN_STREAM_MIN_BYTES = 4096;
 
-    if (!validate_string_param(params->prompt, "prompt")) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+struct LlamafuTokenStream_s {
+    Llamafu llamafu = nullptr;          // Cleared when the handle is freed
+    std::string prompt;
+    LlamafuInferParams params = {};
+
+    // Copy of params.lora_batch, which the caller may free after start
+    std::vector<LlamafuLoraAdapter> lora_adapters;
+    std::vector<float> lora_scales;
+    LlamafuLoraBatch lora_batch = {};
+
+    StopMatcher stops;                  // Built from params.stop_sequences at start
+
+    // Single-producer/single-consumer byte ring. Positions increase
+    // monotonically and are masked on access; write_pos is only stored by
+    // the worker, read_pos only by the reader.
+    std::vector<uint8_t> ring;
+    size_t ring_mask = 0;
+    std::atomic<size_t> write_pos{0};
+    std::atomic<size_t> read_pos{0};
+
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> notify_pending{false};
+    std::atomic<int32_t> result{LLAMAFU_SUCCESS};
+
+    LlamafuStreamNotify notify = nullptr;
+    void* notify_data = nullptr;
+
+    std::thread worker;
+};
+
+static void ring_copy_in(LlamafuTokenStream_s* stream, size_t pos, const void* src, size_t n) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(src);
+    const size_t offset = pos & stream->ring_mask;
+    const size_t first = std::min(n, stream->ring.size() - offset);
+    memcpy(stream->ring.data() + offset, bytes, first);
+    memcpy(stream->ring.data(), bytes + first, n - first);
+}
+
+static void ring_copy_out(const LlamafuTokenStream_s* stream, size_t pos, void* dst, size_t n) {
+    uint8_t* bytes = static_cast<uint8_t*>(dst);
+    const size_t offset = pos & stream->ring_mask;
+    const size_t first = std::min(n, stream->ring.size() - offset);
+    memcpy(bytes, stream->ring.data() + offset, first);
+    memcpy(bytes + first, stream->ring.data(), n - first);
+}
+
+// Wake the reader once per drain rather than once per token
+static void token_stream_notify(LlamafuTokenStream_s* stream) {
+    if (stream->notify && !stream->notify_pending.exchange(true, std::memory_order_acq_rel)) {
+        stream->notify(stream->notify_data);
     }
+}
 
-    try {
-        // Tokenize prompt
-        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
-        const int32_t text_len = static_cast<int32_t>(strlen(params->prompt));
-        const int32_t n_tokens_max = text_len + 16;
-        std::vector<llama_token> tokens(n_tokens_max);
+// Append one record, waiting for the reader while the ring is full
+static bool token_stream_push(LlamafuTokenStream_s* stream, llama_token token, const char* piece, int32_t len) {
+    const uint32_t n_bytes = static_cast<uint32_t>(
+        std::min<size_t>(static_cast<size_t>(len), stream->ring.size() - TOKEN_RECORD_HEADER));
+    const size_t record = TOKEN_RECORD_HEADER + n_bytes;
 
-        const int32_t n_tokens = llama_tokenize(vocab, params->prompt, text_len, tokens.data(), n_tokens_max, true, true);
-        if (n_tokens < 0) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
+    const size_t pos = stream->write_pos.load(std::memory_order_relaxed);
+    while (stream->ring.size() - (pos - stream->read_pos.load(std::memory_order_acquire)) < record) {
+        if (stream->cancel.load(std::memory_order_relaxed)) {
+            return false;
         }
-        tokens.resize(n_tokens);
+        token_stream_notify(stream);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
 
-        if (tokens.empty()) {
-            return LLAMAFU_ERROR_INVALID_PARAM;
-        }
+    const int32_t token_id = token;
+    ring_copy_in(stream, pos, &token_id, sizeof(token_id));
+    ring_copy_in(stream, pos + sizeof(int32_t), &n_bytes, sizeof(n_bytes));
+    ring_copy_in(stream, pos + TOKEN_RECORD_HEADER, piece, n_bytes);
+    stream->write_pos.store(pos + record, std::memory_order_release);
 
-        // Clear the KV cache
-        llama_memory_clear(llama_get_memory(llamafu->ctx), false);
+    token_stream_notify(stream);
+    return true;
+}
 
-        // Evaluate the prompt tokens
-        if (llama_decode(llamafu->ctx, llama_batch_get_one(tokens.data(), tokens.size())) != 0) {
-            return LLAMAFU_ERROR_UNKNOWN;
+static void token_stream_run(LlamafuTokenStream_s* stream) {
+    LlamafuError result;
+    try {
+        GenerationScope generation(stream->llamafu, &stream->cancel);
+
+        // Each record carries the text its token completed; what is still
+        // pending at the end goes out in a record without a token
+        StreamDetokenizer detok(&stream->stops);
+        llama_token token = LLAMA_TOKEN_NULL;
+        bool pushed = true;
+        result = generate_stream_pieces(stream->llamafu, &stream->params, &stream->cancel,
+            [&](llama_token id, const char* piece, int32_t len) {
+                token = id;
+                bool released = false;
+                detok.push(piece, len, [&](const char* text, size_t n) {
+                    released = true;
+                    pushed = token_stream_push(stream, token, text, static_cast<int32_t>(n));
+                });
+                if (!released) {
+                    pushed = token_stream_push(stream, token, "", 0);
+                }
+                return pushed && !detok.stopped;
+            });
+        if (detok.stopped && pushed && result == LLAMAFU_ERROR_ABORTED) {
+            result = LLAMAFU_SUCCESS;
+        } else if (pushed) {
+            detok.flush([&](const char* text, size_t n) {
+                token_stream_push(stream, LLAMA_TOKEN_NULL, text, static_cast<int32_t>(n));
+            });
         }
+    } catch (const std::exception& e) {
+        result = LLAMAFU_ERROR_UNKNOWN;
+    }
+    stream->result.store(result, std::memory_order_relaxed);
+    stream->finished.store(true, std::memory_order_release);
 
-        // Build sampler chain from params (use defaults for unset fields)
-        float temperature = params->temperature > 0.0f ? params->temperature : 0.8f;
-        int32_t top_k = params->top_k > 0 ? params->top_k : 40;
-        float top_p = params->top_p > 0.0f ? params->top_p : 0.95f;
-        float repeat_penalty = params->repeat_penalty > 0.0f ? params->repeat_penalty : 1.1f;
-        uint32_t seed = params->seed > 0 ? params->seed : 42;
+    // Always deliver the final wake-up, even if one is already pending
+    if (stream->notify) {
+        stream->notify_pending.store(true, std::memory_order_relaxed);
+        stream->notify(stream->notify_data);
+    }
+}
 
-        llama_sampler* smpl = build_sampler_chain(temperature, top_k, top_p, repeat_penalty, seed);
-        if (!smpl) {
-            return LLAMAFU_ERROR_OUT_OF_MEMORY;
-        }
+static void token_stream_join(LlamafuTokenStream_s* stream) {
+    if (stream->worker.joinable()) {
+        stream->worker.join();
+    }
+}
 
-        // Generate tokens with streaming
-        const int32_t max_tokens = params->max_tokens > 0 ? params->max_tokens : 256;
-        int32_t n_cur = static_cast<int32_t>(tokens.size());
-        const int32_t n_ctx = llama_n_ctx(llamafu->ctx);
+static bool token_stream_running(Llamafu llamafu) {
+    return llamafu->active_stream && !llamafu->active_stream->finished.load(std::memory_order_acquire);
+}
 
-        for (int32_t i = 0; i < max_tokens; i++) {
-            // Check abort callback
-            if (llamafu->abort_callback && llamafu->abort_callback(llamafu->abort_callback_data)) {
-                llama_sampler_free(smpl);
-                return LLAMAFU_ERROR_ABORTED;
-            }
+// Stop and join the handle's worker; the stream object stays readable
+static void token_stream_detach(Llamafu llamafu) {
+    LlamafuTokenStream_s* stream = llamafu->active_stream;
+    if (!stream) {
+        return;
+    }
+    stream->cancel.store(true, std::memory_order_relaxed);
+    token_stream_join(stream);
+    stream->llamafu = nullptr;
+    llamafu->active_stream = nullptr;
+}
 
-            // Sample next token
-            llama_token new_token = llama_sampler_sample(smpl, llamafu->ctx, -1);
+extern "C" {
 
-            // Check for end of generation
-            if (llama_vocab_is_eog(vocab, new_token)) {
-                break;
-            }
+LlamafuError llamafu_stream_start(
+    Llamafu llamafu,
+    const LlamafuInferParams* params,
+    size_t buffer_bytes,
+    LlamafuStreamNotify notify,
+    void* notify_data,
+    LlamafuTokenStream* out_stream
+) {
+    if (out_stream) {
+        *out_stream = nullptr;
+    }
+    // A released context is recreated by the worker's GenerationScope
+    if (!llamafu || !params || !out_stream) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-            // Convert token to text
-            char piece[256] = {0};
-            int32_t n = llama_token_to_piece(vocab, new_token, piece, sizeof(piece) - 1, 0, true);
-            if (n < 0) {
-                n = 0;
-            }
-            piece[n] = '\0';
+    if (!validate_string_param(params->prompt, "prompt")) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+    }
 
-            // Call the callback with the token
-            // Note: Dart copies the string data via toDartString()
-            callback(piece, user_data);
+    // One worker per handle; a finished one is released for the next stream
+    if (token_stream_running(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+    token_stream_detach(llamafu);
 
-            // Accept the token to update sampler state
-            llama_sampler_accept(smpl, new_token);
+    try {
+        size_t capacity = TOKEN_STREAM_MIN_BYTES;
+        while (capacity < buffer_bytes) {
+            capacity <<= 1;
+        }
 
-            // Check context overflow
-            if (n_cur >= n_ctx - 1) {
-                break;
+        auto stream = std::make_unique<LlamafuTokenStream_s>();
+        stream->llamafu = llamafu;
+        stream->prompt = params->prompt;
+        stream->params = *params;
+        stream->params.prompt = stream->prompt.c_str();
+        if (!build_stop_matcher(params, stream->stops)) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        stream->params.stop_sequences = nullptr;
+        stream->params.n_stop_sequences = 0;
+        if (params->lora_batch) {
+            LoraSet lora;
+            LlamafuError lora_result = resolve_lora_set(llamafu, params->lora_batch, lora);
+            if (lora_result != LLAMAFU_SUCCESS) {
+                return lora_result;
             }
-
-            // Evaluate the new token
-            if (llama_decode(llamafu->ctx, llama_batch_get_one(&new_token, 1)) != 0) {
-                llama_sampler_free(smpl);
-                return LLAMAFU_ERROR_UNKNOWN;
+            const LlamafuLoraBatch* batch = params->lora_batch;
+            stream->lora_adapters.assign(batch->adapters, batch->adapters + batch->n_adapters);
+            if (batch->scales) {
+                stream->lora_scales.assign(batch->scales, batch->scales + batch->n_adapters);
             }
-
-            n_cur++;
+            stream->lora_batch = *batch;
+            stream->lora_batch.adapters = stream->lora_adapters.data();
+            stream->lora_batch.scales = batch->scales ? stream->lora_scales.data() : nullptr;
+            stream->params.lora_batch = &stream->lora_batch;
         }
+        stream->ring.resize(capacity);
+        stream->ring_mask = capacity - 1;
+        stream->notify = notify;
+        stream->notify_data = notify_data;
 
-        llama_sampler_free(smpl);
-        return LLAMAFU_SUCCESS;
+        LlamafuTokenStream_s* raw = stream.get();
+        raw->worker = std::thread(token_stream_run, raw);
 
+        llamafu->active_stream = raw;
+        *out_stream = stream.release();
+        return LLAMAFU_SUCCESS;
+    } catch (const std::bad_alloc& e) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
     } catch (const std::exception& e) {
         return LLAMAFU_ERROR_UNKNOWN;
     }
 }
 
-LlamafuError llamafu_complete_with_grammar_stream(
-    Llamafu llamafu,
-    LlamafuInferParams* params,
-    void* grammar_params,
-    LlamafuStreamCallback callback,
-    void* user_data
-) {
-    // For now, just use the non-grammar streaming
-    // TODO: Add proper grammar support
-    return llamafu_complete_stream(llamafu, params, callback, user_data);
-}
-
-LlamafuError llamafu_multimodal_complete_stream(
-    Llamafu llamafu,
-    LlamafuMultimodalInferParams* params,
-    LlamafuStreamCallback callback,
-    void* user_data
+LlamafuError llamafu_stream_read(
+    LlamafuTokenStream stream,
+    char* out_text,
+    size_t text_capacity,
+    size_t* out_text_len,
+    int32_t* out_tokens,
+    int32_t tokens_capacity,
+    int32_t* out_n_tokens,
+    bool* out_finished
 ) {
-    if (!llamafu || !params || !callback) {
+    if (!stream || !out_text || text_capacity < 4 || !out_text_len || !out_finished) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    if (out_tokens && tokens_capacity <= 0) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    // TODO: Implement multimodal streaming
-    return LLAMAFU_ERROR_UNKNOWN;
-}
+    // Re-arm the wake-up before draining so no write goes unnoticed
+    stream->notify_pending.store(false, std::memory_order_release);
 
-// =============================================================================
-// Missing FFI Function Stubs - LoRA Adapter Functions
-// =============================================================================
+    // Sample finished before the write position so that a finished stream
+    // is only reported once everything it wrote has been drained
+    const bool finished = stream->finished.load(std::memory_order_acquire);
+    const size_t write_pos = stream->write_pos.load(std::memory_order_acquire);
+    size_t pos = stream->read_pos.load(std::memory_order_relaxed);
 
-LlamafuError llamafu_lora_adapter_init(Llamafu llamafu, const char* lora_path, LlamafuLoraAdapter* out_adapter) {
-    if (!llamafu || !lora_path || !out_adapter) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    size_t text_len = 0;
+    int32_t n_tokens = 0;
+    while (pos < write_pos) {
+        int32_t token_id;
+        uint32_t n_bytes;
+        ring_copy_out(stream, pos, &token_id, sizeof(token_id));
+        ring_copy_out(stream, pos + sizeof(int32_t), &n_bytes, sizeof(n_bytes));
+        if (out_tokens && n_tokens >= tokens_capacity) {
+            break;
+        }
+        if (text_len + n_bytes > text_capacity) {
+            if (text_len > 0) {
+                break;  // Starts the next read
+            }
+            // Longer than the whole buffer: hand out what fits, cut on a
+            // UTF-8 boundary, and leave the rest as a shorter record that
+            // keeps the token (its header moved up over the bytes just read)
+            size_t n_part = text_capacity;
+            ring_copy_out(stream, pos + TOKEN_RECORD_HEADER, out_text, n_part);
+            n_part -= incomplete_utf8_tail(out_text, n_part);
+            const uint32_t n_rest = n_bytes - static_cast<uint32_t>(n_part);
+            pos += n_part;
+            ring_copy_in(stream, pos, &token_id, sizeof(token_id));
+            ring_copy_in(stream, pos + sizeof(int32_t), &n_rest, sizeof(n_rest));
+            text_len = n_part;
+            break;
+        }
+        ring_copy_out(stream, pos + TOKEN_RECORD_HEADER, out_text + text_len, n_bytes);
+        text_len += n_bytes;
+        if (token_id != LLAMA_TOKEN_NULL) {
+            if (out_tokens) {
+                out_tokens[n_tokens] = token_id;
+            }
+            n_tokens++;
+        }
+        pos += TOKEN_RECORD_HEADER + n_bytes;
     }
-    // TODO: Implement full LoRA adapter loading
-    return LLAMAFU_ERROR_UNKNOWN;
-}
+    stream->read_pos.store(pos, std::memory_order_release);
 
-LlamafuError llamafu_lora_adapter_apply(Llamafu llamafu, LlamafuLoraAdapter adapter, float scale) {
-    if (!llamafu || !adapter) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    *out_text_len = text_len;
+    if (out_n_tokens) {
+        *out_n_tokens = n_tokens;
     }
-    return LLAMAFU_ERROR_UNKNOWN;
+    *out_finished = finished && pos == write_pos;
+    return *out_finished ? static_cast<LlamafuError>(stream->result.load(std::memory_order_relaxed))
+                         : LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_lora_adapter_remove(Llamafu llamafu, LlamafuLoraAdapter adapter) {
-    if (!llamafu || !adapter) {
+LlamafuError llamafu_stream_cancel(LlamafuTokenStream stream) {
+    if (!stream) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    return LLAMAFU_ERROR_UNKNOWN;
+    // Checked before each token, inside decodes and while waiting for ring space
+    stream->cancel.store(true, std::memory_order_relaxed);
+    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_lora_adapter_clear_all(Llamafu llamafu) {
-    if (!llamafu) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+void llamafu_stream_free(LlamafuTokenStream stream) {
+    if (stream) {
+        stream->cancel.store(true, std::memory_order_relaxed);
+        token_stream_join(stream);
+        if (stream->llamafu && stream->llamafu->active_stream == stream) {
+            stream->llamafu->active_stream = nullptr;
+        }
+        delete stream;
     }
-    return LLAMAFU_SUCCESS;
 }
 
-void llamafu_lora_adapter_free(LlamafuLoraAdapter adapter) {
-    // TODO: Implement
-}
+} // extern "C"
 
 // =============================================================================
-// Missing FFI Function Stubs - Batch Processing
+// Request Queue
 // =============================================================================
 
-LlamafuBatch llamafu_batch_init(int32_t n_tokens_max, int32_t embd, int32_t n_seq_max) {
-    // Create a batch wrapper
-    auto* batch = new LlamafuBatch_s();
-    batch->batch = llama_batch_init(n_tokens_max, embd, n_seq_max);
-    return batch;
+// Copy of a request's parameters that does not depend on the caller's
+// memory. Stop strings are compiled by the submitter instead.
+struct OwnedInferParams {
+    LlamafuInferParams params = {};
+    std::string prompt;
+    std::string grammar_str;
+    std::string grammar_root;
+    std::vector<LlamafuLoraAdapter> lora_adapters;
+    std::vector<float> lora_scales;
+    LlamafuLoraBatch lora_batch = {};
+
+    void assign(const LlamafuInferParams& src) {
+        params = src;
+        prompt = src.prompt;
+        params.prompt = prompt.c_str();
+        if (src.grammar_str) {
+            grammar_str = src.grammar_str;
+            params.grammar_str = grammar_str.c_str();
+        }
+        if (src.grammar_root) {
+            grammar_root = src.grammar_root;
+            params.grammar_root = grammar_root.c_str();
+        }
+        params.stop_sequences = nullptr;
+        params.n_stop_sequences = 0;
+        if (src.lora_batch) {
+            const LlamafuLoraBatch* batch = src.lora_batch;
+            lora_adapters.assign(batch->adapters, batch->adapters + batch->n_adapters);
+            if (batch->scales) {
+                lora_scales.assign(batch->scales, batch->scales + batch->n_adapters);
+            }
+            lora_batch = *batch;
+            lora_batch.adapters = lora_adapters.data();
+            lora_batch.scales = batch->scales ? lora_scales.data() : nullptr;
+            lora_batch.merge_strategy = nullptr;
+            params.lora_batch = &lora_batch;
+        }
+    }
+};
+
+struct QueuedJob {
+    OwnedInferParams request;
+    StopMatcher stops;
+    int32_t priority = 0;
+    uint64_t order = 0;                     // Submission order within the queue
+    LlamafuStreamCallback on_text = nullptr;
+    LlamafuJobCallback on_done = nullptr;
+    void* user_data = nullptr;
+    std::weak_ptr<struct RequestQueue> queue;
+    std::atomic<bool> cancel{false};
+
+    // state and result are guarded by mutex; text is written by the worker
+    // only and read once the state is final
+    std::mutex mutex;
+    std::condition_variable finished_cv;
+    LlamafuRequestState state = LLAMAFU_REQUEST_QUEUED;
+    LlamafuError result = LLAMAFU_SUCCESS;
+    std::string text;
+};
+
+struct LlamafuJob_s {
+    std::shared_ptr<QueuedJob> job;
+};
+
+struct RequestQueue {
+    std::mutex mutex;                       // Guards everything below
+    std::condition_variable cv;
+    std::vector<std::shared_ptr<QueuedJob>> pending;   // Heap ordered by job_runs_later
+    std::shared_ptr<QueuedJob> running;
+    uint64_t next_order = 0;
+    bool stopping = false;
+    std::thread worker;
+};
+
+// Heap order: the top is the highest priority, then the earliest submitted
+static bool job_runs_later(const std::shared_ptr<QueuedJob>& a, const std::shared_ptr<QueuedJob>& b) {
+    return a->priority != b->priority ? a->priority < b->priority : a->order > b->order;
 }
 
-void llamafu_batch_free(LlamafuBatch batch) {
-    if (batch) {
-        llama_batch_free(batch->batch);
-        delete batch;
-    }
+static bool job_state_final(LlamafuRequestState state) {
+    return state == LLAMAFU_REQUEST_DONE || state == LLAMAFU_REQUEST_FAILED || state == LLAMAFU_REQUEST_CANCELLED;
 }
 
-void llamafu_batch_clear(LlamafuBatch batch) {
-    if (batch) {
-        batch->batch.n_tokens = 0;
-    }
+static void job_set_state(QueuedJob& job, LlamafuRequestState state) {
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.state = state;
 }
 
-LlamafuError llamafu_decode(Llamafu llamafu, LlamafuBatch batch) {
-    if (!llamafu || !batch) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static void job_finish(QueuedJob& job, LlamafuRequestState state, LlamafuError result) {
+    {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.state = state;
+        job.result = result;
+    }
+    job.finished_cv.notify_all();
+    if (job.on_done) {
+        job.on_done(result, state, job.text.c_str(), job.user_data);
     }
-    int result = llama_decode(llamafu->ctx, batch->batch);
-    return result == 0 ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_DECODE_FAILED;
 }
 
-// =============================================================================
-// Missing FFI Function Stubs - State Management
-// =============================================================================
+static void request_queue_run(Llamafu llamafu, RequestQueue* queue) {
+    for (;;) {
+        std::shared_ptr<QueuedJob> job;
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->cv.wait(lock, [queue] { return queue->stopping || !queue->pending.empty(); });
+            if (queue->stopping) {
+                return;  // request_queue_destroy finishes what is left
+            }
+            std::pop_heap(queue->pending.begin(), queue->pending.end(), job_runs_later);
+            job = std::move(queue->pending.back());
+            queue->pending.pop_back();
+            queue->running = job;
+        }
+
+        LlamafuError result;
+        try {
+            GenerationScope generation(llamafu, &job->cancel);
+            job_set_state(*job, LLAMAFU_REQUEST_PREFILLING);
+
+            bool generating = false;
+            StreamDetokenizer detok(&job->stops);
+            result = generate_text_spans(llamafu, &job->request.params, &job->cancel, detok,
+                [&](const char* text, size_t len) {
+                    if (!generating) {
+                        generating = true;
+                        job_set_state(*job, LLAMAFU_REQUEST_GENERATING);
+                    }
+                    job->text.append(text, len);
+                    if (job->on_text) {
+                        job->on_text(text, job->user_data);
+                    }
+                });
+        } catch (const std::bad_alloc&) {
+            result = LLAMAFU_ERROR_OUT_OF_MEMORY;
+        } catch (...) {
+            result = LLAMAFU_ERROR_UNKNOWN;
+        }
+
+        const bool cancelled = result == LLAMAFU_ERROR_ABORTED && job->cancel.load(std::memory_order_relaxed);
+        job_finish(*job, cancelled ? LLAMAFU_REQUEST_CANCELLED
+                         : result == LLAMAFU_SUCCESS ? LLAMAFU_REQUEST_DONE : LLAMAFU_REQUEST_FAILED,
+                   result);
 
-size_t llamafu_state_get_size(Llamafu llamafu) {
-    if (!llamafu || !llamafu->ctx) {
-        return 0;
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->running.reset();
     }
-    return llama_state_get_size(llamafu->ctx);
 }
 
-LlamafuError llamafu_state_save_file(Llamafu llamafu, const char* path) {
-    if (!llamafu || !llamafu->ctx || !path) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static bool request_queue_busy(Llamafu llamafu) {
+    RequestQueue* queue = llamafu->request_queue.get();
+    if (!queue) {
+        return false;
     }
-    // llama_state_save_file returns bool
-    bool success = llama_state_save_file(llamafu->ctx, path, nullptr, 0);
-    return success ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_UNKNOWN;
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->running || !queue->pending.empty();
 }
 
-LlamafuError llamafu_state_load_file(Llamafu llamafu, const char* path) {
-    if (!llamafu || !llamafu->ctx || !path) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Cancels the running job, drops the queued ones and joins the worker
+static void request_queue_destroy(Llamafu llamafu) {
+    std::shared_ptr<RequestQueue> queue = std::move(llamafu->request_queue);
+    if (!queue) {
+        return;
     }
 
-    try {
-        // Clear memory before loading state to prevent inconsistent state
-        llama_memory_clear(llama_get_memory(llamafu->ctx), false);
-
-        // Allocate buffer for tokens in case the saved state contains them
-        std::vector<llama_token> tokens(2048); // Reasonable max tokens
-        size_t n_tokens_loaded = 0;
-
-        // llama_state_load_file returns bool
-        bool success = llama_state_load_file(
-            llamafu->ctx, path,
-            tokens.data(), tokens.size(),
-            &n_tokens_loaded);
+    std::vector<std::shared_ptr<QueuedJob>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->stopping = true;
+        dropped.swap(queue->pending);
+        if (queue->running) {
+            queue->running->cancel.store(true, std::memory_order_relaxed);
+        }
+    }
+    queue->cv.notify_all();
+    if (queue->worker.joinable()) {
+        queue->worker.join();
+    }
 
-        return success ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_UNKNOWN;
-    } catch (const std::exception& e) {
-        return LLAMAFU_ERROR_UNKNOWN;
-    } catch (...) {
-        return LLAMAFU_ERROR_UNKNOWN;
+    for (auto& job : dropped) {
+        job->cancel.store(true, std::memory_order_relaxed);
+        job_finish(*job, LLAMAFU_REQUEST_CANCELLED, LLAMAFU_ERROR_ABORTED);
     }
 }
 
-// =============================================================================
-// Missing FFI Function Stubs - Samplers
-// =============================================================================
-
-LlamafuSampler llamafu_sampler_init_greedy(void) {
-    auto* wrapper = new LlamafuSampler_s();
-    wrapper->sampler = llama_sampler_init_greedy();
-    wrapper->is_chain = false;
-    return wrapper;
-}
+extern "C" {
 
-LlamafuSampler llamafu_sampler_init_dist(uint32_t seed) {
-    auto* wrapper = new LlamafuSampler_s();
-    wrapper->sampler = llama_sampler_init_dist(seed);
-    wrapper->is_chain = false;
-    return wrapper;
+LlamafuError llamafu_queue_set_capacity(Llamafu llamafu, int32_t capacity) {
+    if (!llamafu || !validate_numeric_param(capacity, 1, 1024)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+    llamafu->queue_capacity.store(capacity, std::memory_order_relaxed);
+    return LLAMAFU_SUCCESS;
 }
 
-// =============================================================================
-// Missing FFI Function Stubs - Chat Sessions
-// =============================================================================
-
-LlamafuError llamafu_chat_apply_template(
+LlamafuError llamafu_queue_submit(
     Llamafu llamafu,
-    const char* tmpl,
-    const char** messages,
-    size_t n_messages,
-    bool add_ass,
-    char** out_formatted
+    const LlamafuInferParams* params,
+    int32_t priority,
+    LlamafuStreamCallback on_text,
+    LlamafuJobCallback on_done,
+    void* user_data,
+    LlamafuJob* out_job
 ) {
-    if (!llamafu || !out_formatted) {
+    if (out_job) {
+        *out_job = nullptr;
+    }
+    // A released context is recreated by the worker's GenerationScope
+    if (!llamafu || !params || !out_job) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    // Build chat messages array
-    // Messages are in "role: content" format (e.g., "user: Hello!")
-    std::vector<llama_chat_message> chat_msgs;
-    std::vector<std::string> roles;    // Keep strings alive
-    std::vector<std::string> contents; // Keep strings alive
-
-    for (size_t i = 0; i < n_messages; i++) {
-        std::string msg_str(messages[i]);
-
-        // Parse "role: content" format
-        size_t colon_pos = msg_str.find(": ");
-        if (colon_pos == std::string::npos) {
-            // If no "role: " pattern, treat as user message
-            roles.push_back("user");
-            contents.push_back(msg_str);
-        } else {
-            roles.push_back(msg_str.substr(0, colon_pos));
-            contents.push_back(msg_str.substr(colon_pos + 2));
-        }
+    if (!validate_string_param(params->prompt, "prompt") ||
+        !validate_numeric_param(params->max_tokens, 1, 32768)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    // Build llama_chat_message array with pointers to stored strings
-    for (size_t i = 0; i < n_messages; i++) {
-        llama_chat_message msg;
-        msg.role = roles[i].c_str();
-        msg.content = contents[i].c_str();
-        chat_msgs.push_back(msg);
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
     }
 
-    // Apply template - first call to get required size
-    int32_t len = llama_chat_apply_template(
-        tmpl && strlen(tmpl) > 0 ? tmpl : nullptr,  // nullptr = model default
-        chat_msgs.data(), chat_msgs.size(),
-        add_ass, nullptr, 0
-    );
+    try {
+        auto job = std::make_shared<QueuedJob>();
+        if (!build_stop_matcher(params, job->stops)) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        if (params->lora_batch) {
+            LoraSet lora;
+            LlamafuError lora_result = resolve_lora_set(llamafu, params->lora_batch, lora);
+            if (lora_result != LLAMAFU_SUCCESS) {
+                return lora_result;
+            }
+        }
+        job->request.assign(*params);
+        job->priority = priority;
+        job->on_text = on_text;
+        job->on_done = on_done;
+        job->user_data = user_data;
+
+        std::call_once(llamafu->request_queue_once, [llamafu] {
+            auto queue = std::make_shared<RequestQueue>();
+            queue->worker = std::thread(request_queue_run, llamafu, queue.get());
+            llamafu->request_queue = std::move(queue);
+        });
+        const std::shared_ptr<RequestQueue>& queue = llamafu->request_queue;
+        if (!queue) {
+            return LLAMAFU_ERROR_INVALID_PARAM;  // The handle is being freed
+        }
 
-    if (len < 0) {
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            if (queue->pending.size() >= static_cast<size_t>(llamafu->queue_capacity.load(std::memory_order_relaxed))) {
+                return LLAMAFU_ERROR_BUSY;
+            }
+            job->queue = queue;
+            job->order = queue->next_order++;
+            queue->pending.push_back(job);
+            std::push_heap(queue->pending.begin(), queue->pending.end(), job_runs_later);
+        }
+        queue->cv.notify_one();
+
+        *out_job = new LlamafuJob_s{std::move(job)};
+        return LLAMAFU_SUCCESS;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
         return LLAMAFU_ERROR_UNKNOWN;
     }
-
-    // Allocate result buffer and format
-    std::string result;
-    result.resize(len + 1);
-    llama_chat_apply_template(
-        tmpl && strlen(tmpl) > 0 ? tmpl : nullptr,
-        chat_msgs.data(), chat_msgs.size(),
-        add_ass, result.data(), result.size()
-    );
-
-    *out_formatted = strdup(result.c_str());
-    return LLAMAFU_SUCCESS;
 }
 
-// Chat session state
-struct LlamafuChatSession_s {
-    Llamafu llamafu;
-    std::string system_prompt;
-    std::vector<std::pair<std::string, std::string>> history; // role, content pairs
-};
-
-LlamafuError llamafu_chat_session_create(
-    Llamafu llamafu,
-    const char* system_prompt,
-    void** out_session
-) {
-    if (!llamafu || !out_session) {
+LlamafuError llamafu_job_cancel(LlamafuJob job) {
+    if (!job) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
-
-    auto* session = new LlamafuChatSession_s();
-    session->llamafu = llamafu;
-    session->system_prompt = system_prompt ? system_prompt : "";
-
-    // Add system message to history if provided
-    if (system_prompt && strlen(system_prompt) > 0) {
-        session->history.push_back({"system", session->system_prompt});
+    const std::shared_ptr<QueuedJob>& queued = job->job;
+    queued->cancel.store(true, std::memory_order_relaxed);
+
+    // A job that has not started leaves the queue right away; a running one
+    // sees the flag in its decode abort callback
+    bool dropped = false;
+    if (std::shared_ptr<RequestQueue> queue = queued->queue.lock()) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        auto it = std::find(queue->pending.begin(), queue->pending.end(), queued);
+        if (it != queue->pending.end()) {
+            queue->pending.erase(it);
+            std::make_heap(queue->pending.begin(), queue->pending.end(), job_runs_later);
+            dropped = true;
+        }
+    }
+    if (dropped) {
+        job_finish(*queued, LLAMAFU_REQUEST_CANCELLED, LLAMAFU_ERROR_ABORTED);
     }
-
-    *out_session = session;
     return LLAMAFU_SUCCESS;
 }
 
-void llamafu_chat_session_free(void* session) {
-    if (session) {
-        delete static_cast<LlamafuChatSession_s*>(session);
+LlamafuError llamafu_job_get_state(LlamafuJob job, LlamafuRequestState* out_state) {
+    if (!job || !out_state) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    std::lock_guard<std::mutex> lock(job->job->mutex);
+    *out_state = job->job->state;
+    return job->job->state == LLAMAFU_REQUEST_FAILED ? job->job->result : LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_chat_session_complete(
-    void* session,
-    const char* user_message,
-    const LlamafuMediaInput* media_inputs,
-    size_t n_media_inputs,
-    char** out_response
-) {
-    if (!session || !user_message || !out_response) {
+LlamafuError llamafu_job_wait(LlamafuJob job, int32_t timeout_ms, char** out_text) {
+    if (out_text) {
+        *out_text = nullptr;
+    }
+    if (!job) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    auto* chat_session = static_cast<LlamafuChatSession_s*>(session);
-
-    // Add user message to history
-    chat_session->history.push_back({"user", user_message});
-
-    // Build messages array for chat template
-    std::vector<llama_chat_message> chat_msgs;
-    std::vector<std::string> roles;    // Keep strings alive
-    std::vector<std::string> contents; // Keep strings alive
-
-    for (const auto& msg : chat_session->history) {
-        roles.push_back(msg.first);
-        contents.push_back(msg.second);
+    QueuedJob& queued = *job->job;
+    std::unique_lock<std::mutex> lock(queued.mutex);
+    auto finished = [&queued] { return job_state_final(queued.state); };
+    if (timeout_ms < 0) {
+        queued.finished_cv.wait(lock, finished);
+    } else if (!queued.finished_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished)) {
+        return LLAMAFU_ERROR_BUSY;
     }
 
-    for (size_t i = 0; i < chat_session->history.size(); i++) {
-        llama_chat_message msg;
-        msg.role = roles[i].c_str();
-        msg.content = contents[i].c_str();
-        chat_msgs.push_back(msg);
+    if (out_text) {
+        *out_text = strdup(queued.text.c_str());
+        if (!*out_text) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
     }
+    return queued.result;
+}
 
-    // Apply chat template (use model's default template)
-    int32_t len = llama_chat_apply_template(
-        nullptr, chat_msgs.data(), chat_msgs.size(),
-        true, nullptr, 0);
+void llamafu_job_free(LlamafuJob job) {
+    delete job;
+}
 
-    if (len < 0) {
-        return LLAMAFU_ERROR_UNKNOWN;
+} // extern "C"
+
+// =============================================================================
+// Threadpools
+// =============================================================================
+
+// CPUs the affinity masks can describe
+static constexpr int32_t MAX_MASK_CPUS = 64;
+
+// Tokens generated per autotune candidate
+static constexpr int32_t AUTOTUNE_N_PREDICT = 16;
+
+static uint64_t low_cpu_mask(int32_t n_cpus) {
+    return n_cpus >= MAX_MASK_CPUS ? ~0ull : (1ull << n_cpus) - 1;
+}
+
+static int32_t count_cpus(uint64_t mask) {
+    return static_cast<int32_t>(std::bitset<MAX_MASK_CPUS>(mask).count());
+}
+
+#if defined(__APPLE__)
+static int32_t sysctl_int(const char* name) {
+    int value = 0;
+    size_t size = sizeof(value);
+    return sysctlbyname(name, &value, &size, nullptr, 0) == 0 ? value : 0;
+}
+#endif
+
+// Splits the CPUs into performance and efficiency classes. Linux and Android
+// compare cpuinfo_max_freq; Apple reports counts per performance level but
+// has no thread affinity, so its masks stay empty. Windows exposes no
+// frequencies there, so every CPU counts as a performance core.
+static void detect_cpu_topology(LlamafuCpuTopology& topo) {
+    topo = {};
+    long n_conf = 0;
+#if !defined(_WIN32)
+    n_conf = sysconf(_SC_NPROCESSORS_CONF);
+#endif
+    if (n_conf <= 0) {
+        n_conf = std::thread::hardware_concurrency();
+    }
+    topo.n_cpus = static_cast<int32_t>(std::clamp<long>(n_conf, 1, MAX_MASK_CPUS));
+
+#if defined(__APPLE__)
+    topo.n_performance = sysctl_int("hw.perflevel0.logicalcpu");
+    topo.n_efficiency = sysctl_int("hw.perflevel1.logicalcpu");
+    if (topo.n_performance <= 0) {
+        topo.n_performance = topo.n_cpus;
+        topo.n_efficiency = 0;
+    }
+#else
+    // CPUs whose frequency cannot be read count as performance cores
+    std::vector<uint64_t> max_freq(topo.n_cpus, 0);
+    uint64_t lowest = 0;
+    uint64_t highest = 0;
+    for (int32_t cpu = 0; cpu < topo.n_cpus; ++cpu) {
+        std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/cpuinfo_max_freq");
+        if (!(in >> max_freq[cpu]) || max_freq[cpu] == 0) {
+            max_freq[cpu] = 0;
+            continue;
+        }
+        lowest = lowest ? std::min(lowest, max_freq[cpu]) : max_freq[cpu];
+        highest = std::max(highest, max_freq[cpu]);
     }
 
-    std::string formatted_prompt;
-    formatted_prompt.resize(len + 1);
-    llama_chat_apply_template(
-        nullptr, chat_msgs.data(), chat_msgs.size(),
-        true, formatted_prompt.data(), formatted_prompt.size());
+    const uint64_t all = low_cpu_mask(topo.n_cpus);
+    if (lowest < highest) {
+        for (int32_t cpu = 0; cpu < topo.n_cpus; ++cpu) {
+            if (max_freq[cpu] == lowest) {
+                topo.efficiency_mask |= 1ull << cpu;
+            }
+        }
+    }
+    topo.performance_mask = all & ~topo.efficiency_mask;
+    topo.n_performance = count_cpus(topo.performance_mask);
+    topo.n_efficiency = count_cpus(topo.efficiency_mask);
+#endif
+}
 
-    // Run completion
-    LlamafuInferParams params = {};
-    params.prompt = formatted_prompt.c_str();
-    params.max_tokens = 256;
-    params.temperature = 0.7f;
-    params.top_k = 40;
-    params.top_p = 0.9f;
-    params.seed = 0;
+static uint64_t core_class_mask(const LlamafuCpuTopology& topo, int32_t core_class) {
+    switch (core_class) {
+        case LLAMAFU_CORES_PERFORMANCE: return topo.performance_mask;
+        case LLAMAFU_CORES_EFFICIENCY:  return topo.efficiency_mask;
+        default:                        return topo.performance_mask | topo.efficiency_mask;
+    }
+}
 
-    char* response = nullptr;
-    LlamafuError err = llamafu_complete(chat_session->llamafu, &params, &response);
+static int32_t core_class_count(const LlamafuCpuTopology& topo, int32_t core_class) {
+    switch (core_class) {
+        case LLAMAFU_CORES_PERFORMANCE: return topo.n_performance;
+        case LLAMAFU_CORES_EFFICIENCY:  return topo.n_efficiency;
+        default:                        return topo.n_performance + topo.n_efficiency;
+    }
+}
 
-    if (err != LLAMAFU_SUCCESS || !response) {
-        return err != LLAMAFU_SUCCESS ? err : LLAMAFU_ERROR_UNKNOWN;
+static bool to_ggml_threadpool_params(const LlamafuThreadpoolParams& params, const LlamafuCpuTopology& topo,
+                                      ggml_threadpool_params& out) {
+    if (!validate_numeric_param(params.core_class, LLAMAFU_CORES_ALL, LLAMAFU_CORES_EFFICIENCY) ||
+        !validate_numeric_param(params.priority, GGML_SCHED_PRIO_LOW, GGML_SCHED_PRIO_REALTIME) ||
+        params.poll > 100) {
+        return false;
     }
 
-    // Add assistant response to history
-    chat_session->history.push_back({"assistant", response});
+    const uint64_t mask = params.cpumask ? params.cpumask : core_class_mask(topo, params.core_class);
+    const int32_t n_cores = params.cpumask ? count_cpus(params.cpumask)
+                                           : core_class_count(topo, params.core_class);
+    const int32_t n_threads = params.n_threads > 0 ? params.n_threads : n_cores;
+    if (n_cores == 0 || !validate_numeric_param(n_threads, 1, 128)) {
+        return false;
+    }
 
-    *out_response = response;
-    return LLAMAFU_SUCCESS;
+    ggml_threadpool_params_init(&out, n_threads);
+    for (int32_t cpu = 0; cpu < MAX_MASK_CPUS; ++cpu) {
+        out.cpumask[cpu] = (mask >> cpu) & 1;
+    }
+    out.prio = static_cast<ggml_sched_priority>(params.priority);
+    out.poll = params.poll;
+    out.strict_cpu = params.strict_cpu;
+    return true;
 }
 
-LlamafuError llamafu_chat_session_get_history(
-    void* session,
-    char** out_history_json
-) {
-    if (!session || !out_history_json) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static void attach_threadpools(Llamafu llamafu, llama_context* ctx) {
+    if (llamafu->threadpool_decode) {
+        llama_attach_threadpool(ctx, llamafu->threadpool_decode, llamafu->threadpool_prefill);
     }
+}
 
-    auto* chat_session = static_cast<LlamafuChatSession_s*>(session);
+// Frees the pools once no context uses them
+static void release_threadpools(Llamafu llamafu) {
+    if (llamafu->threadpool_prefill) {
+        ggml_threadpool_free(llamafu->threadpool_prefill);
+        llamafu->threadpool_prefill = nullptr;
+    }
+    if (llamafu->threadpool_decode) {
+        ggml_threadpool_free(llamafu->threadpool_decode);
+        llamafu->threadpool_decode = nullptr;
+    }
+}
 
-    // Build simple JSON array
-    std::string json = "[";
-    for (size_t i = 0; i < chat_session->history.size(); i++) {
-        const auto& msg = chat_session->history[i];
-        if (i > 0) json += ",";
-        json += "{\"role\":\"" + msg.first + "\",\"content\":\"";
-        // Escape special characters in content
-        for (char c : msg.second) {
-            if (c == '"') json += "\\\"";
-            else if (c == '\\') json += "\\\\";
-            else if (c == '\n') json += "\\n";
-            else if (c == '\r') json += "\\r";
-            else if (c == '\t') json += "\\t";
-            else json += c;
+// Device model the autotune cache is keyed by, without whitespace
+static std::string device_model_key() {
+    std::string key;
+#if defined(__ANDROID__)
+    char value[PROP_VALUE_MAX] = {};
+    if (__system_property_get("ro.product.model", value) > 0) {
+        key = value;
+    }
+#elif defined(__APPLE__)
+    char value[256] = {};
+    size_t size = sizeof(value) - 1;
+    if (sysctlbyname("hw.machine", value, &size, nullptr, 0) == 0) {
+        key = value;
+    }
+#else
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (key.empty() && std::getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) == 0 || line.rfind("Hardware", 0) == 0) {
+            const size_t value_at = line.find_first_not_of(" \t", line.find(':') + 1);
+            if (line.find(':') != std::string::npos && value_at != std::string::npos) {
+                key = line.substr(value_at);
+            }
         }
-        json += "\"}";
     }
-    json += "]";
-
-    *out_history_json = strdup(json.c_str());
-    return LLAMAFU_SUCCESS;
+#endif
+    for (char& c : key) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            c = '_';
+        }
+    }
+    return key.empty() ? "unknown" : key;
 }
 
-// =============================================================================
-// Missing FFI Function Stubs - LoRA Extended
-// =============================================================================
-
-LlamafuError llamafu_get_lora_adapter_info(
-    Llamafu llamafu,
-    LlamafuLoraAdapter adapter,
-    LlamafuLoraAdapterInfo* out_info
-) {
-    if (!llamafu || !adapter || !out_info) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Cache lines: "<device> <n_threads> <core_class> <n_threads_batch>
+// <core_class_batch> <generation_tps> <prompt_tps>"
+static bool read_autotune_cache(const char* path, const std::string& key, LlamafuAutotuneResult& out) {
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string device;
+        LlamafuAutotuneResult entry = {};
+        if (fields >> device >> entry.n_threads >> entry.core_class >> entry.n_threads_batch >>
+                entry.core_class_batch >> entry.generation_speed_tps >> entry.prompt_speed_tps &&
+            device == key) {
+            out = entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Replaces the device's line, writing through a temporary file so readers
+// never see a partial cache
+static void write_autotune_cache(const char* path, const std::string& key, const LlamafuAutotuneResult& result) {
+    std::vector<std::string> lines;
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string device;
+            if (fields >> device && device != key) {
+                lines.push_back(line);
+            }
+        }
     }
-    // TODO: Implement
-    return LLAMAFU_ERROR_UNKNOWN;
-}
 
-LlamafuError llamafu_list_lora_adapters(
-    Llamafu llamafu,
-    LlamafuLoraAdapterInfo** out_adapters,
-    size_t* out_n_adapters
-) {
-    if (!llamafu || !out_adapters || !out_n_adapters) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+    const std::string tmp_path = std::string(path) + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        for (const std::string& line : lines) {
+            out << line << '\n';
+        }
+        out << key << ' ' << result.n_threads << ' ' << result.core_class << ' ' << result.n_threads_batch << ' '
+            << result.core_class_batch << ' ' << result.generation_speed_tps << ' ' << result.prompt_speed_tps
+            << '\n';
+        if (!out.flush()) {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(tmp_path, ec);
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
     }
-    *out_adapters = nullptr;
-    *out_n_adapters = 0;
-    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_validate_lora_compatibility(
-    Llamafu llamafu,
-    const char* lora_path,
-    bool* out_is_compatible,
-    char** out_error_message
-) {
-    if (!llamafu || !lora_path || !out_is_compatible) {
+extern "C" {
+
+LlamafuThreadpoolParams llamafu_threadpool_default_params(void) {
+    LlamafuThreadpoolParams params = {};
+    params.n_threads = 0;
+    params.core_class = LLAMAFU_CORES_ALL;
+    params.cpumask = 0;
+    params.priority = GGML_SCHED_PRIO_NORMAL;
+    params.poll = 50;
+    params.strict_cpu = false;
+    return params;
+}
+
+LlamafuError llamafu_get_cpu_topology(LlamafuCpuTopology* out_topology) {
+    if (!out_topology) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
-    // Basic validation - check if file exists and is readable
-    FILE* f = fopen(lora_path, "rb");
-    if (!f) {
-        *out_is_compatible = false;
-        if (out_error_message) {
-            *out_error_message = strdup("File not found or not readable");
-        }
+
+    try {
+        detect_cpu_topology(*out_topology);
         return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
     }
-    fclose(f);
-    *out_is_compatible = true;
-    return LLAMAFU_SUCCESS;
 }
 
-// =============================================================================
-// Missing FFI Function Stubs - Utility/Info
-// =============================================================================
-
-LlamafuError llamafu_get_perf_stats(Llamafu llamafu, LlamafuPerfStats* out_stats) {
-    if (!llamafu || !out_stats) {
+LlamafuError llamafu_set_threadpools(Llamafu llamafu, const LlamafuThreadpoolParams* decode,
+                                     const LlamafuThreadpoolParams* prefill) {
+    if (!llamafu || (!decode && prefill)) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    // Get timings from context
-    auto perf = llama_perf_context(llamafu->ctx);
-    out_stats->t_start_ms = 0;
-    out_stats->t_end_ms = perf.t_eval_ms + perf.t_p_eval_ms;
-    out_stats->t_load_ms = 0;
-    out_stats->t_p_eval_ms = perf.t_p_eval_ms;
-    out_stats->t_eval_ms = perf.t_eval_ms;
-    out_stats->n_p_eval = perf.n_p_eval;
-    out_stats->n_eval = perf.n_eval;
-    out_stats->t_p_eval_per_token_ms = perf.n_p_eval > 0 ? perf.t_p_eval_ms / perf.n_p_eval : 0;
-    out_stats->t_eval_per_token_ms = perf.n_eval > 0 ? perf.t_eval_ms / perf.n_eval : 0;
+    try {
+        LlamafuCpuTopology topo;
+        detect_cpu_topology(topo);
+        ggml_threadpool_params decode_params;
+        ggml_threadpool_params prefill_params;
+        if ((decode && !to_ggml_threadpool_params(*decode, topo, decode_params)) ||
+            (prefill && !to_ggml_threadpool_params(*prefill, topo, prefill_params))) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
 
-    return LLAMAFU_SUCCESS;
-}
+        ggml_threadpool* decode_pool = nullptr;
+        ggml_threadpool* prefill_pool = nullptr;
+        if (decode) {
+            // Prompts are evaluated first, so the decode pool starts paused
+            // and ggml resumes it on its first graph
+            decode_params.paused = prefill != nullptr;
+            decode_pool = ggml_threadpool_new(&decode_params);
+            if (decode_pool && prefill) {
+                prefill_pool = ggml_threadpool_new(&prefill_params);
+            }
+            if (!decode_pool || (prefill && !prefill_pool)) {
+                if (decode_pool) {
+                    ggml_threadpool_free(decode_pool);
+                }
+                return LLAMAFU_ERROR_OUT_OF_MEMORY;
+            }
+        }
 
-const char* llamafu_print_system_info(void) {
-    static std::string info;
-    info = llama_print_system_info();
-    return info.c_str();
+        GenerationScope generation(llamafu);
+        if (decode_pool) {
+            const int32_t n_threads = decode_params.n_threads;
+            const int32_t n_threads_batch = prefill ? prefill_params.n_threads : n_threads;
+            llama_attach_threadpool(llamafu->ctx, decode_pool, prefill_pool);
+            llama_set_n_threads(llamafu->ctx, n_threads, n_threads_batch);
+            llamafu->llama_ctx_params.n_threads = n_threads;  // Kept across llamafu_swap_model
+            llamafu->llama_ctx_params.n_threads_batch = n_threads_batch;
+        } else {
+            llama_detach_threadpool(llamafu->ctx);
+        }
+        release_threadpools(llamafu);
+        llamafu->threadpool_decode = decode_pool;
+        llamafu->threadpool_prefill = prefill_pool;
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
 }
 
-// =============================================================================
-// Missing FFI Function Stubs - Text Processing
-// =============================================================================
-
-LlamafuError llamafu_analyze_sentiment(
-    Llamafu llamafu,
-    const char* text,
-    float* out_positive_score,
-    float* out_negative_score,
-    float* out_neutral_score
-) {
-    if (!llamafu || !text || !out_positive_score || !out_negative_score || !out_neutral_score) {
+LlamafuError llamafu_autotune_threads(Llamafu llamafu, const char* cache_path, bool force,
+                                      LlamafuAutotuneResult* out_result) {
+    if (!llamafu || !out_result) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    if (token_stream_running(llamafu) || request_queue_busy(llamafu)) {
+        return LLAMAFU_ERROR_BUSY;
+    }
 
-    // Use completion to analyze sentiment
-    std::string prompt = "Analyze the sentiment of this text and respond with only one word: POSITIVE, NEGATIVE, or NEUTRAL.\nText: \"";
-    prompt += text;
-    prompt += "\"\nSentiment:";
+    try {
+        *out_result = {};
+        const std::string key = device_model_key();
+        LlamafuAutotuneResult best = {};
+        const bool cached = !force && cache_path && read_autotune_cache(cache_path, key, best);
+
+        if (!cached) {
+            // Performance cores alone first; all cores only add counts that
+            // need the efficiency cores
+            LlamafuCpuTopology topo;
+            detect_cpu_topology(topo);
+            std::vector<int32_t> classes;
+            if (topo.n_efficiency > 0) {
+                classes.push_back(LLAMAFU_CORES_PERFORMANCE);
+            }
+            classes.push_back(LLAMAFU_CORES_ALL);
+
+            best.generation_speed_tps = -1.0f;
+            best.prompt_speed_tps = -1.0f;
+            for (int32_t core_class : classes) {
+                const int32_t first = core_class == LLAMAFU_CORES_ALL && topo.n_efficiency > 0
+                                          ? topo.n_performance + 1 : 1;
+                const int32_t last = std::min(core_class_count(topo, core_class), 128);
+                for (int32_t n_threads = first; n_threads <= last; ++n_threads) {
+                    LlamafuThreadpoolParams candidate = llamafu_threadpool_default_params();
+                    candidate.n_threads = n_threads;
+                    candidate.core_class = core_class;
+                    LlamafuBenchResult bench = {};
+                    LlamafuError err = llamafu_set_threadpools(llamafu, &candidate, nullptr);
+                    if (err == LLAMAFU_SUCCESS) {
+                        err = llamafu_bench_model(llamafu, n_threads, AUTOTUNE_N_PREDICT, &bench);
+                    }
+                    if (err != LLAMAFU_SUCCESS) {
+                        llamafu_set_threadpools(llamafu, nullptr, nullptr);
+                        return err;
+                    }
 
-    LlamafuInferParams params = {};
-    params.prompt = prompt.c_str();
-    params.max_tokens = 10;
-    params.temperature = 0.1f;
-    params.top_k = 3;
-    params.top_p = 0.9f;
-    params.seed = 42;
+                    if (bench.generation_speed_tps > best.generation_speed_tps) {
+                        best.n_threads = n_threads;
+                        best.core_class = core_class;
+                        best.generation_speed_tps = bench.generation_speed_tps;
+                    }
+                    // Ties go to more threads: prefill is compute-bound
+                    if (bench.prompt_speed_tps >= best.prompt_speed_tps) {
+                        best.n_threads_batch = n_threads;
+                        best.core_class_batch = core_class;
+                        best.prompt_speed_tps = bench.prompt_speed_tps;
+                    }
+                }
+            }
+        }
 
-    char* response = nullptr;
-    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+        LlamafuThreadpoolParams decode = llamafu_threadpool_default_params();
+        decode.n_threads = best.n_threads;
+        decode.core_class = best.core_class;
+        LlamafuThreadpoolParams prefill = llamafu_threadpool_default_params();
+        prefill.n_threads = best.n_threads_batch;
+        prefill.core_class = best.core_class_batch;
+        // A cached entry can stop fitting, e.g. after cores were disabled
+        const LlamafuError err = llamafu_set_threadpools(llamafu, &decode, &prefill);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
 
-    if (err != LLAMAFU_SUCCESS || !response) {
-        // Fallback to neutral if detection fails
-        *out_positive_score = 0.33f;
-        *out_negative_score = 0.33f;
-        *out_neutral_score = 0.34f;
+        if (!cached && cache_path) {
+            write_autotune_cache(cache_path, key, best);
+        }
+        best.from_cache = cached;
+        *out_result = best;
         return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
     }
+}
 
-    // Parse response
-    std::string resp(response);
-    llamafu_free_string(response);
+} // extern "C"
 
-    // Convert to lowercase for matching
-    for (auto& c : resp) c = tolower(c);
+// =============================================================================
+// Scoring
+// =============================================================================
 
-    if (resp.find("positive") != std::string::npos) {
-        *out_positive_score = 0.8f;
-        *out_negative_score = 0.1f;
-        *out_neutral_score = 0.1f;
-    } else if (resp.find("negative") != std::string::npos) {
-        *out_positive_score = 0.1f;
-        *out_negative_score = 0.8f;
-        *out_neutral_score = 0.1f;
-    } else {
-        *out_positive_score = 0.2f;
-        *out_negative_score = 0.2f;
-        *out_neutral_score = 0.6f;
+// Log-softmax normalizer of one row of logits and its most likely token
+struct LogitStats {
+    float max_logit;
+    double log_sum;                        // log(sum(exp(logit - max_logit)))
+    llama_token argmax;
+};
+
+static LogitStats logit_stats(const float* logits, int32_t n_vocab) {
+    LogitStats stats = {logits[0], 0.0, 0};
+    for (int32_t t = 1; t < n_vocab; t++) {
+        if (logits[t] > stats.max_logit) {
+            stats.max_logit = logits[t];
+            stats.argmax = t;
+        }
+    }
+    double sum = 0.0;
+    for (int32_t t = 0; t < n_vocab; t++) {
+        sum += std::exp(logits[t] - stats.max_logit);
     }
+    stats.log_sum = std::log(sum);
+    return stats;
+}
 
-    return LLAMAFU_SUCCESS;
+static float token_logprob(const float* logits, const LogitStats& stats, llama_token token) {
+    return static_cast<float>(logits[token] - stats.max_logit - stats.log_sum);
 }
 
-LlamafuError llamafu_detect_language(
-    Llamafu llamafu,
-    const char* text,
-    char** out_language_code,
-    float* out_confidence
-) {
-    if (!llamafu || !text || !out_language_code) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// The k most likely tokens, most likely first; entries past n_vocab get
+// LLAMA_TOKEN_NULL
+static void top_logprobs(const float* logits, int32_t n_vocab, const LogitStats& stats, int32_t k,
+                         LlamafuTokenLogprob* out) {
+    // Min-heap of the best k so far
+    std::vector<std::pair<float, llama_token>> heap;
+    heap.reserve(k);
+    auto greater = [](const std::pair<float, llama_token>& a, const std::pair<float, llama_token>& b) {
+        return a.first > b.first;
+    };
+    for (int32_t t = 0; t < n_vocab; t++) {
+        if (static_cast<int32_t>(heap.size()) < k) {
+            heap.emplace_back(logits[t], t);
+            std::push_heap(heap.begin(), heap.end(), greater);
+        } else if (logits[t] > heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            heap.back() = {logits[t], t};
+            std::push_heap(heap.begin(), heap.end(), greater);
+        }
     }
+    std::sort_heap(heap.begin(), heap.end(), greater);
+    for (int32_t i = 0; i < k; i++) {
+        out[i] = i < static_cast<int32_t>(heap.size())
+            ? LlamafuTokenLogprob{heap[i].second, token_logprob(logits, stats, heap[i].second)}
+            : LlamafuTokenLogprob{LLAMA_TOKEN_NULL, -INFINITY};
+    }
+}
 
-    // Use completion to detect language
-    std::string prompt = "Identify the language of this text and respond with only the ISO 639-1 code (e.g., en, es, fr, de, zh, ja, ko, ar, ru). Text: \"";
-    prompt += text;
-    prompt += "\"\nLanguage code:";
+// One input of a packed batch, decoded in its own sequence
+struct PackedRow {
+    int32_t row;                           // Input index
+    llama_seq_id seq_id;
+    int32_t first;                         // Batch index of the first token
+    int32_t n_tokens;
+};
 
-    LlamafuInferParams params = {};
-    params.prompt = prompt.c_str();
-    params.max_tokens = 10;
-    params.temperature = 0.1f;
-    params.top_k = 5;
-    params.top_p = 0.9f;
-    params.seed = 42;
+// Decodes rows in shared batches of at most batch_capacity tokens, with
+// outputs for every token and one of seq_ids per row. begin(row, seq_id)
+// prepares the sequence and returns the row's first position, collect(packed)
+// reads the outputs of each batch and finish(seq_id) clears the sequence
+// afterwards. Rows must be non-empty and fit in one batch.
+template <typename Begin, typename Collect, typename Finish>
+static LlamafuError decode_packed_rows(Llamafu llamafu, const std::vector<std::vector<llama_token>>& rows,
+                                       const std::vector<llama_seq_id>& seq_ids, int32_t batch_capacity,
+                                       Begin&& begin, Collect&& collect, Finish&& finish) {
+    llama_batch batch = llama_batch_init(batch_capacity, 0, 1);
+    std::vector<PackedRow> packed;
+    LlamafuError err = LLAMAFU_SUCCESS;
+    size_t next = 0;
+    while (next < rows.size() && err == LLAMAFU_SUCCESS) {
+        if (generation_aborted(llamafu)) {
+            err = LLAMAFU_ERROR_ABORTED;
+            break;
+        }
 
-    char* response = nullptr;
-    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+        batch.n_tokens = 0;
+        packed.clear();
+        while (next < rows.size() && packed.size() < seq_ids.size() &&
+               batch.n_tokens + static_cast<int32_t>(rows[next].size()) <= batch_capacity) {
+            const llama_seq_id seq_id = seq_ids[packed.size()];
+            const llama_pos pos0 = begin(static_cast<int32_t>(next), seq_id);
+            packed.push_back({static_cast<int32_t>(next), seq_id, batch.n_tokens,
+                              static_cast<int32_t>(rows[next].size())});
+            for (size_t i = 0; i < rows[next].size(); i++) {
+                batch_add(batch, rows[next][i], pos0 + static_cast<llama_pos>(i), seq_id, true);
+            }
+            next++;
+        }
+        if (packed.empty()) {
+            err = LLAMAFU_ERROR_INVALID_PARAM;
+            break;
+        }
 
-    if (err != LLAMAFU_SUCCESS || !response) {
-        // Fallback to English if detection fails
-        *out_language_code = strdup("en");
-        if (out_confidence) *out_confidence = 0.5f;
-        return LLAMAFU_SUCCESS;
+        const int32_t ret = llama_decode(llamafu->ctx, batch);
+        err = ret != 0 ? decode_error(ret) : collect(packed);
+        for (const PackedRow& p : packed) {
+            const LlamafuError finish_err = finish(p.seq_id);
+            if (err == LLAMAFU_SUCCESS) {
+                err = finish_err;
+            }
+        }
     }
+    llama_batch_free(batch);
+    return err;
+}
 
-    // Parse the response to extract language code
-    std::string resp(response);
-    llamafu_free_string(response);
+static void replace_all(std::string& text, const std::string& from, const std::string& to) {
+    for (size_t pos = text.find(from); pos != std::string::npos; pos = text.find(from, pos + to.size())) {
+        text.replace(pos, from.size(), to);
+    }
+}
 
-    // Trim whitespace and take first word
-    size_t start = resp.find_first_not_of(" \t\n");
-    if (start == std::string::npos) {
-        *out_language_code = strdup("en");
-        if (out_confidence) *out_confidence = 0.5f;
-        return LLAMAFU_SUCCESS;
+// Reranker input for one pair: the model's rerank template if it has one,
+// otherwise [BOS]query[EOS][SEP]document[EOS]
+static bool rerank_pair_tokens(const llama_model* model, const char* query, const char* document,
+                               std::vector<llama_token>& out) {
+    const llama_vocab* vocab = llama_model_get_vocab(model);
+    if (const char* tmpl = llama_model_chat_template(model, "rerank")) {
+        std::string prompt = tmpl;
+        replace_all(prompt, "{query}", query);
+        replace_all(prompt, "{document}", document);
+        return tokenize_text(vocab, prompt.c_str(), static_cast<int32_t>(prompt.size()), true, true, out) > 0;
     }
 
-    size_t end = resp.find_first_of(" \t\n.,", start);
-    std::string code = resp.substr(start, end == std::string::npos ? 2 : std::min(end - start, size_t(2)));
+    std::vector<llama_token> part;
+    out.clear();
+    if (llama_vocab_bos(vocab) != LLAMA_TOKEN_NULL) {
+        out.push_back(llama_vocab_bos(vocab));
+    }
+    if (tokenize_text(vocab, query, static_cast<int32_t>(strlen(query)), false, false, part) < 0) {
+        return false;
+    }
+    out.insert(out.end(), part.begin(), part.end());
+    if (llama_vocab_eos(vocab) != LLAMA_TOKEN_NULL) {
+        out.push_back(llama_vocab_eos(vocab));
+    }
+    if (llama_vocab_sep(vocab) != LLAMA_TOKEN_NULL) {
+        out.push_back(llama_vocab_sep(vocab));
+    }
+    if (tokenize_text(vocab, document, static_cast<int32_t>(strlen(document)), false, false, part) < 0) {
+        return false;
+    }
+    out.insert(out.end(), part.begin(), part.end());
+    if (llama_vocab_eos(vocab) != LLAMA_TOKEN_NULL) {
+        out.push_back(llama_vocab_eos(vocab));
+    }
+    return !out.empty();
+}
 
-    // Validate it looks like a language code (2 lowercase letters)
-    if (code.length() >= 2) {
-        code = code.substr(0, 2);
-        for (auto& c : code) c = tolower(c);
-    } else {
-        code = "en"; // Default
+extern "C" {
+
+LlamafuError llamafu_get_top_logprobs_ith(Llamafu llamafu, int32_t i, int32_t k, LlamafuTokenLogprob* out,
+                                          int32_t* out_n) {
+    if (!llamafu || i < -1 || k <= 0 || !out || !out_n) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    *out_language_code = strdup(code.c_str());
-    if (out_confidence) {
-        *out_confidence = 0.8f; // Moderate confidence for model-based detection
+    try {
+        GenerationScope generation(llamafu);
+        const float* logits = llama_get_logits_ith(llamafu->ctx, i);
+        if (!logits) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
+        const int32_t n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llamafu->model));
+        const int32_t n = std::min(k, n_vocab);
+        top_logprobs(logits, n_vocab, logit_stats(logits, n_vocab), n, out);
+        *out_n = n;
+        return LLAMAFU_SUCCESS;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
     }
-    return LLAMAFU_SUCCESS;
 }
 
-LlamafuError llamafu_extract_keywords(
+LlamafuError llamafu_score_continuations(
     Llamafu llamafu,
-    const char* text,
-    int32_t max_keywords,
-    char** out_keywords_json
+    const char* prefix,
+    const char* const* continuations,
+    int32_t n_continuations,
+    int32_t top_k,
+    LlamafuScoreResult** out_result
 ) {
-    if (!llamafu || !text || !out_keywords_json) {
+    if (!llamafu || !prefix || !continuations || n_continuations <= 0 || !out_result ||
+        !validate_numeric_param(top_k, 0, LLAMAFU_MAX_TOP_LOGPROBS)) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
+    if (!can_generate(llamafu)) {
+        return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+    }
 
-    if (max_keywords <= 0) max_keywords = 5;
-
-    // Use completion to extract keywords
-    std::string prompt = "Extract " + std::to_string(max_keywords) + " key words or phrases from this text. List them one per line, no numbering.\nText: \"";
-    prompt += text;
-    prompt += "\"\nKeywords:\n";
-
-    LlamafuInferParams params = {};
-    params.prompt = prompt.c_str();
-    params.max_tokens = 100;
-    params.temperature = 0.3f;
-    params.top_k = 20;
-    params.top_p = 0.9f;
-    params.seed = 42;
-
-    char* response = nullptr;
-    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+    try {
+        GenerationScope generation(llamafu);
+        const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+        const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+        const int32_t n_ctx = static_cast<int32_t>(llama_n_ctx(llamafu->ctx));
+        const int32_t n_batch = static_cast<int32_t>(llama_n_batch(llamafu->ctx));
+        llama_memory_t mem = llama_get_memory(llamafu->ctx);
+
+        std::vector<llama_token> prefix_tokens;
+        if (tokenize_text(vocab, prefix, static_cast<int32_t>(strlen(prefix)), true, true, prefix_tokens) < 0) {
+            return LLAMAFU_ERROR_TOKENIZATION_FAILED;
+        }
+        if (prefix_tokens.empty()) {
+            return LLAMAFU_ERROR_INVALID_PARAM;  // Nothing to condition the first token on
+        }
+        const int32_t n_prefix = static_cast<int32_t>(prefix_tokens.size());
+
+        // Every token but the last is decoded after the prefix; the first is
+        // scored from the prefix's own logits
+        std::vector<std::vector<llama_token>> tokens(n_continuations);
+        std::vector<std::vector<llama_token>> rows;
+        std::vector<int32_t> row_continuation;
+        size_t n_total = 0;
+        for (int32_t c = 0; c < n_continuations; c++) {
+            if (!continuations[c]) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            if (tokenize_text(vocab, continuations[c], static_cast<int32_t>(strlen(continuations[c])),
+                              false, true, tokens[c]) <= 0) {
+                return LLAMAFU_ERROR_TOKENIZATION_FAILED;
+            }
+            const int32_t n = static_cast<int32_t>(tokens[c].size());
+            if (n_prefix + n > n_ctx) {
+                return LLAMAFU_ERROR_CONTEXT_FULL;
+            }
+            if (n - 1 > n_batch) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            if (n > 1) {
+                rows.emplace_back(tokens[c].begin(), tokens[c].end() - 1);
+                row_continuation.push_back(c);
+            }
+            n_total += n;
+        }
 
-    if (err != LLAMAFU_SUCCESS || !response) {
-        *out_keywords_json = strdup("[]");
-        return LLAMAFU_SUCCESS;
-    }
+        // Header, continuations, tokens and alternatives in one block
+        const size_t bytes = sizeof(LlamafuScoreResult) + n_continuations * sizeof(LlamafuContinuationScore) +
+                             n_total * (1 + top_k) * sizeof(LlamafuTokenLogprob);
+        std::unique_ptr<LlamafuScoreResult, decltype(&free)> result(
+            static_cast<LlamafuScoreResult*>(calloc(1, bytes)), free);
+        if (!result) {
+            return LLAMAFU_ERROR_OUT_OF_MEMORY;
+        }
+        result->continuations = reinterpret_cast<LlamafuContinuationScore*>(result.get() + 1);
+        result->tokens = reinterpret_cast<LlamafuTokenLogprob*>(result->continuations + n_continuations);
+        result->top = top_k > 0 ? result->tokens + n_total : nullptr;
+        result->n_continuations = n_continuations;
+        result->n_tokens = static_cast<int32_t>(n_total);
+        result->top_k = top_k;
+        result->n_prefix_tokens = n_prefix;
+        int32_t first = 0;
+        for (int32_t c = 0; c < n_continuations; c++) {
+            result->continuations[c].first = first;
+            result->continuations[c].n_tokens = static_cast<int32_t>(tokens[c].size());
+            result->continuations[c].is_greedy = true;
+            first += static_cast<int32_t>(tokens[c].size());
+        }
 
-    // Parse response into JSON array
-    std::string resp(response);
-    llamafu_free_string(response);
+        auto record = [&](const float* logits, const LogitStats& stats, int32_t c, int32_t j) {
+            LlamafuContinuationScore& score = result->continuations[c];
+            const llama_token token = tokens[c][j];
+            const float logprob = token_logprob(logits, stats, token);
+            result->tokens[score.first + j] = {token, logprob};
+            score.logprob_sum += logprob;
+            score.is_greedy = score.is_greedy && token == stats.argmax;
+        };
 
-    std::vector<std::string> keywords;
-    std::istringstream iss(resp);
-    std::string line;
-    while (std::getline(iss, line) && keywords.size() < static_cast<size_t>(max_keywords)) {
-        // Trim whitespace
-        size_t start = line.find_first_not_of(" \t-•*");
-        size_t end = line.find_last_not_of(" \t\r\n");
-        if (start != std::string::npos && end != std::string::npos && end >= start) {
-            std::string keyword = line.substr(start, end - start + 1);
-            if (!keyword.empty() && keyword.length() > 1) {
-                keywords.push_back(keyword);
+        LlamafuError err = prefill_with_prefix_reuse(llamafu, prefix_tokens);
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
+        }
+
+        // First tokens share the prefix's distribution
+        const float* prefix_logits = llama_get_logits_ith(llamafu->ctx, -1);
+        if (!prefix_logits) {
+            return LLAMAFU_ERROR_UNKNOWN;
+        }
+        const LogitStats prefix_stats = logit_stats(prefix_logits, n_vocab);
+        std::vector<LlamafuTokenLogprob> prefix_top(top_k);
+        if (top_k > 0) {
+            top_logprobs(prefix_logits, n_vocab, prefix_stats, top_k, prefix_top.data());
+        }
+        for (int32_t c = 0; c < n_continuations; c++) {
+            record(prefix_logits, prefix_stats, c, 0);
+            if (top_k > 0) {
+                std::copy(prefix_top.begin(), prefix_top.end(),
+                          result->top + static_cast<size_t>(result->continuations[c].first) * top_k);
             }
         }
-    }
 
-    // Build JSON array
-    std::string json = "[";
-    for (size_t i = 0; i < keywords.size(); i++) {
-        if (i > 0) json += ",";
-        json += "\"";
-        // Escape special characters
-        for (char c : keywords[i]) {
-            if (c == '"') json += "\\\"";
-            else if (c == '\\') json += "\\\\";
-            else json += c;
+        // Sequence 0 keeps the prefix (and its prompt cache); the others get
+        // a copy of it for one continuation at a time
+        err = decode_packed_rows(llamafu, rows, free_sequences(llamafu), std::min(n_batch, n_ctx - n_prefix),
+            [&](int32_t, llama_seq_id seq_id) {
+                if (seq_id != 0) {
+                    llama_memory_seq_cp(mem, 0, seq_id, -1, -1);
+                }
+                return static_cast<llama_pos>(n_prefix);
+            },
+            [&](const std::vector<PackedRow>& packed) {
+                for (const PackedRow& p : packed) {
+                    const int32_t c = row_continuation[p.row];
+                    for (int32_t i = 0; i < p.n_tokens; i++) {
+                        const float* logits = llama_get_logits_ith(llamafu->ctx, p.first + i);
+                        if (!logits) {
+                            return LLAMAFU_ERROR_UNKNOWN;
+                        }
+                        const LogitStats stats = logit_stats(logits, n_vocab);
+                        record(logits, stats, c, i + 1);
+                        if (top_k > 0) {
+                            top_logprobs(logits, n_vocab, stats, top_k,
+                                         result->top + static_cast<size_t>(result->continuations[c].first + i + 1) * top_k);
+                        }
+                    }
+                }
+                return LLAMAFU_SUCCESS;
+            },
+            [&](llama_seq_id seq_id) {
+                if (seq_id != 0) {
+                    llama_memory_seq_rm(mem, seq_id, -1, -1);
+                    return LLAMAFU_SUCCESS;
+                }
+                if (llama_memory_seq_rm(mem, 0, n_prefix, -1)) {
+                    return LLAMAFU_SUCCESS;
+                }
+                // Memory that cannot drop a tail (recurrent models) is
+                // rebuilt from the prefix
+                llama_memory_seq_rm(mem, 0, -1, -1);
+                invalidate_prompt_cache(llamafu);
+                return prefill_with_prefix_reuse(llamafu, prefix_tokens);
+            });
+        if (err != LLAMAFU_SUCCESS) {
+            return err;
         }
-        json += "\"";
+        prompt_cache_commit(llamafu, prefix_tokens);
+
+        *out_result = result.release();
+        return LLAMAFU_SUCCESS;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
     }
-    json += "]";
+}
 
-    *out_keywords_json = strdup(json.c_str());
-    return LLAMAFU_SUCCESS;
+void llamafu_score_result_free(LlamafuScoreResult* result) {
+    free(result);
 }
 
-LlamafuError llamafu_text_summarize(
+LlamafuError llamafu_rerank(
     Llamafu llamafu,
-    const char* text,
-    int32_t max_summary_length,
-    const char* style,
-    char** out_summary
+    const char* query,
+    const char* const* documents,
+    int32_t n_documents,
+    float* out_scores,
+    size_t out_capacity
 ) {
-    if (!llamafu || !text || !out_summary) {
+    if (!llamafu || !query || !documents || n_documents <= 0 || !out_scores) {
         return LLAMAFU_ERROR_INVALID_PARAM;
     }
 
-    if (max_summary_length <= 0) max_summary_length = 100;
+    try {
+        GenerationScope generation(llamafu);
+        if (llamafu->context_mode == LLAMAFU_CONTEXT_MODE_GENERATION ||
+            llama_pooling_type(llamafu->ctx) != LLAMA_POOLING_TYPE_RANK) {
+            return LLAMAFU_ERROR_UNSUPPORTED_MODE;
+        }
 
-    std::string style_instruction = "";
-    if (style && strlen(style) > 0) {
-        style_instruction = std::string(" in a ") + style + " style";
-    }
+        const int32_t n_cls_out = std::max<int32_t>(static_cast<int32_t>(llama_model_n_cls_out(llamafu->model)), 1);
+        if (out_capacity < static_cast<size_t>(n_documents) * n_cls_out) {
+            return LLAMAFU_ERROR_INVALID_PARAM;
+        }
 
-    std::string prompt = "Summarize the following text" + style_instruction + " in about " +
-        std::to_string(max_summary_length / 5) + " words:\n\n\"" + text + "\"\n\nSummary:";
+        const int32_t n_batch = static_cast<int32_t>(llama_n_batch(llamafu->ctx));
+        llama_memory_t mem = llama_get_memory(llamafu->ctx);
 
-    LlamafuInferParams params = {};
-    params.prompt = prompt.c_str();
-    params.max_tokens = max_summary_length;
-    params.temperature = 0.5f;
-    params.top_k = 40;
-    params.top_p = 0.9f;
-    params.seed = 42;
+        std::vector<std::vector<llama_token>> rows(n_documents);
+        for (int32_t d = 0; d < n_documents; d++) {
+            if (!documents[d]) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+            if (!rerank_pair_tokens(llamafu->model, query, documents[d], rows[d])) {
+                return LLAMAFU_ERROR_TOKENIZATION_FAILED;
+            }
+            if (static_cast<int32_t>(rows[d].size()) > n_batch) {
+                return LLAMAFU_ERROR_INVALID_PARAM;
+            }
+        }
 
-    char* response = nullptr;
-    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+        // Sequence 0's prompt cache is dropped
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        invalidate_prompt_cache(llamafu);
 
-    if (err != LLAMAFU_SUCCESS || !response) {
-        *out_summary = strdup("Failed to generate summary.");
-        return LLAMAFU_SUCCESS;
+        const bool toggle_embeddings = llamafu->context_mode == LLAMAFU_CONTEXT_MODE_BOTH;
+        if (toggle_embeddings) {
+            llama_set_embeddings(llamafu->ctx, true);
+        }
+        LlamafuError err = decode_packed_rows(llamafu, rows, free_sequences(llamafu), n_batch,
+            [](int32_t, llama_seq_id) { return static_cast<llama_pos>(0); },
+            [&](const std::vector<PackedRow>& packed) {
+                for (const PackedRow& p : packed) {
+                    const float* scores = llama_get_embeddings_seq(llamafu->ctx, p.seq_id);
+                    if (!scores) {
+                        return LLAMAFU_ERROR_UNKNOWN;
+                    }
+                    memcpy(out_scores + static_cast<size_t>(p.row) * n_cls_out, scores, n_cls_out * sizeof(float));
+                }
+                return LLAMAFU_SUCCESS;
+            },
+            [&](llama_seq_id seq_id) {
+                llama_memory_seq_rm(mem, seq_id, -1, -1);
+                return LLAMAFU_SUCCESS;
+            });
+        if (toggle_embeddings) {
+            llama_set_embeddings(llamafu->ctx, false);
+        }
+        return err;
+    } catch (const std::exception& e) {
+        return LLAMAFU_ERROR_UNKNOWN;
     }
-
-    *out_summary = response;
-    return LLAMAFU_SUCCESS;
 }
 
+} // extern "C"
+
 // =============================================================================
-// Missing FFI Function Stubs - Media Processing
+// Memory Pressure
 // =============================================================================
 
-LlamafuError llamafu_audio_process(
-    Llamafu llamafu,
-    const LlamafuMediaInput* input,
-    LlamafuAudioProcessResult* out_result
-) {
-    if (!llamafu || !input || !out_result) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static const char* const SPILL_EXT = ".kvspill";
+
+static void discard_spilled_sequences(Llamafu llamafu) {
+    std::error_code ec;
+    for (const auto& spilled : llamafu->spilled_seqs) {
+        std::filesystem::remove(spilled.second, ec);
     }
-    return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED; // Audio not supported
+    llamafu->spilled_seqs.clear();
 }
 
-LlamafuError llamafu_audio_resample(
-    const float* input_samples,
-    size_t n_input_samples,
-    int32_t input_rate,
-    int32_t target_rate,
-    float** out_samples,
-    size_t* out_n_samples
-) {
-    if (!input_samples || !out_samples || !out_n_samples) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Writes the sequences worth keeping (the prompt cache's and those owned by
+// KV-backed chat sessions) to dir. All or nothing: on any failure the files
+// written so far are removed and false is returned.
+static bool spill_sequences(Llamafu llamafu, const std::string& dir) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "llamafu-%p-seq", static_cast<void*>(llamafu));
+
+    for (size_t i = 0; i < llamafu->seq_in_use.size(); i++) {
+        const bool prompt_cache = i == 0;
+        if (prompt_cache ? llamafu->cached_tokens.empty() : !llamafu->seq_in_use[i]) {
+            continue;
+        }
+        const llama_seq_id seq_id = static_cast<llama_seq_id>(i);
+        const std::string path =
+            (std::filesystem::path(dir) / (prefix + std::to_string(i) + SPILL_EXT)).string();
+        const size_t written = llama_state_seq_save_file(
+            llamafu->ctx, path.c_str(), seq_id,
+            prompt_cache ? llamafu->cached_tokens.data() : nullptr,
+            prompt_cache ? llamafu->cached_tokens.size() : 0);
+        if (written == 0) {
+            std::filesystem::remove(path, ec);
+            discard_spilled_sequences(llamafu);
+            return false;
+        }
+        llamafu->spilled_seqs.emplace_back(seq_id, path);
     }
-    return LLAMAFU_ERROR_MULTIMODAL_NOT_SUPPORTED; // Audio not supported
+    return true;
 }
 
-LlamafuError llamafu_image_resize(
-    const LlamafuMediaInput* input,
-    int32_t target_width,
-    int32_t target_height,
-    bool maintain_aspect_ratio,
-    LlamafuMediaInput* out_resized
-) {
-    if (!input || !out_resized) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Loads the spilled sequences into the new context. Sequences whose session
+// was freed meanwhile are skipped; if any other fails the whole cache is
+// cleared and every session starts over, as after llamafu_kv_cache_clear.
+static void restore_sequences(Llamafu llamafu) {
+    bool restored = true;
+    for (const auto& spilled : llamafu->spilled_seqs) {
+        const llama_seq_id seq_id = spilled.first;
+        if (!restored || (seq_id != 0 && !llamafu->seq_in_use[seq_id])) {
+            continue;
+        }
+        std::vector<llama_token> tokens(seq_id == 0 ? llamafu->cached_tokens.size() : 0);
+        size_t n_tokens = 0;
+        const size_t read = llama_state_seq_load_file(llamafu->ctx, spilled.second.c_str(), seq_id,
+                                                      tokens.data(), tokens.size(), &n_tokens);
+        restored = read != 0 && (seq_id != 0 || (n_tokens == tokens.size() && tokens == llamafu->cached_tokens));
+    }
+    discard_spilled_sequences(llamafu);
+    if (!restored) {
+        llama_memory_clear(llama_get_memory(llamafu->ctx), true);
+        invalidate_prompt_cache(llamafu);
     }
-    return LLAMAFU_ERROR_UNKNOWN; // Not implemented
 }
 
-// =============================================================================
-// Missing FFI Function Stubs - Validation
-// =============================================================================
+enum WeightAdvice { WEIGHTS_WILL_NEED, WEIGHTS_DONT_NEED };
 
-LlamafuError llamafu_validate_json_schema(
-    const char* json_string,
-    const char* schema,
-    bool* out_is_valid,
-    char** out_error_message
-) {
-    if (!json_string || !schema || !out_is_valid) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+// Applies advice to the model file's mappings in this process. The weight
+// pages are clean and file-backed, so after MADV_PAGEOUT/MADV_DONTNEED the
+// kernel reads them back in as they are touched again (by every handle on
+// the shared model). Only /proc exposes the mappings, hence Linux only.
+static void advise_weight_pages(const LlamafuModel_s* model, WeightAdvice advice) {
+#if defined(__linux__)
+    if (!model || !model->pageable) {
+        return;
     }
-    // Basic JSON validation - just check if it parses
-    *out_is_valid = true; // Stub - assume valid
-    return LLAMAFU_SUCCESS;
+    const int madv = advice == WEIGHTS_DONT_NEED ? MADV_DONTNEED : MADV_WILLNEED;
+    FILE* maps = fopen("/proc/self/maps", "re");
+    if (!maps) {
+        return;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), maps)) {
+        unsigned long start = 0;
+        unsigned long end = 0;
+        int path_offset = 0;
+        if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %n", &start, &end, &path_offset) < 2 || path_offset == 0) {
+            continue;
+        }
+        std::string_view path(line + path_offset);
+        while (!path.empty() && (path.back() == '\n' || path.back() == ' ')) {
+            path.remove_suffix(1);
+        }
+        if (path != model->path) {
+            continue;
+        }
+        void* addr = reinterpret_cast<void*>(start);
+        const size_t length = end - start;
+#if defined(MADV_PAGEOUT)
+        // Reclaims the pages themselves (Linux 5.4+); older kernels only
+        // unmap them, leaving them to the page cache
+        if (madv == MADV_DONTNEED && madvise(addr, length, MADV_PAGEOUT) == 0) {
+            continue;
+        }
+#endif
+        madvise(addr, length, madv);
+    }
+    fclose(maps);
+#else
+    (void)model;
+    (void)advice;
+#endif
 }
 
-LlamafuError llamafu_generate_structured(
-    Llamafu llamafu,
-    const char* prompt,
-    const LlamafuStructuredOutput* output_config,
-    char** out_result
-) {
-    if (!llamafu || !prompt || !out_result) {
-        return LLAMAFU_ERROR_INVALID_PARAM;
+static bool scheduler_busy(Llamafu llamafu) {
+    const LlamafuScheduler_s* sched = llamafu->scheduler;
+    return sched && (!sched->active.empty() || !sched->queue.empty());
+}
+
+// Level 1: what is rebuilt on demand anyway
+static void release_caches(Llamafu llamafu) {
+    if (llamafu->mtmd_ctx) {
+        mtmd_free(llamafu->mtmd_ctx);
+        llamafu->mtmd_ctx = nullptr;
+    }
+    llamafu->vision_initialized = false;
+    llamafu->clip_size_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(llamafu->image_cache_mutex);
+        clear_image_cache(llamafu);
     }
+    clear_grammar_cache(llamafu);
+    release_sampler(llamafu);
 
-    LlamafuOutputFormat format = output_config ? output_config->format : LLAMAFU_OUTPUT_FORMAT_JSON;
-    bool pretty_print = output_config ? output_config->pretty_print : false;
+    // ggml resumes a paused pool on its next graph
+    if (llamafu->threadpool_decode) {
+        ggml_threadpool_pause(llamafu->threadpool_decode);
+    }
+    if (llamafu->threadpool_prefill) {
+        ggml_threadpool_pause(llamafu->threadpool_prefill);
+    }
+}
 
-    std::string format_instruction;
-    switch (format) {
-        case LLAMAFU_OUTPUT_FORMAT_JSON:
-            format_instruction = pretty_print ?
-                "Respond with valid, formatted JSON only." :
-                "Respond with valid JSON only on a single line.";
-            break;
-        case LLAMAFU_OUTPUT_FORMAT_YAML:
-            format_instruction = "Respond with valid YAML only.";
-            break;
-        case LLAMAFU_OUTPUT_FORMAT_XML:
-            format_instruction = "Respond with valid XML only.";
-            break;
-        case LLAMAFU_OUTPUT_FORMAT_MARKDOWN:
-            format_instruction = "Respond in Markdown format.";
-            break;
-        default:
-            format_instruction = "Respond with valid JSON only.";
+// Level 2: the context with its KV cache and compute buffers. Without a
+// spill directory the sequences are lost and sessions start over.
+static void release_context(Llamafu llamafu, const std::string& spill_dir) {
+    scheduler_destroy(llamafu);  // Idle, checked by the caller
+    if (spill_dir.empty() || !spill_sequences(llamafu, spill_dir)) {
+        invalidate_prompt_cache(llamafu);
     }
+    llama_free(llamafu->ctx);
+    llamafu->ctx = nullptr;
+    llamafu->buffers.clear();
+}
 
-    std::string full_prompt = std::string(prompt) + "\n\n" + format_instruction;
+static bool resume_locked(Llamafu llamafu) {
+    const int32_t level = llamafu->release_level.load(std::memory_order_acquire);
+    if (level >= LLAMAFU_RELEASE_WEIGHTS) {
+        advise_weight_pages(llamafu->shared_model, WEIGHTS_WILL_NEED);  // Read ahead, without waiting
+    }
+    if (!llamafu->ctx) {
+        BufferCapture capture;
+        const auto t_context_start = std::chrono::steady_clock::now();
+        llama_context* ctx = llama_init_from_model(llamafu->model, llamafu->llama_ctx_params);
+        if (!ctx) {
+            return false;
+        }
+        llama_set_abort_callback(ctx, decode_abort_trampoline, llamafu);
+        attach_threadpools(llamafu, ctx);
+        llamafu->ctx = ctx;
+        llamafu->buffers = std::move(capture.records);
+        llamafu->lora_applied.clear();  // The next request applies its set
+        {
+            std::lock_guard<std::mutex> lock(llamafu->metrics_mutex);
+            llamafu->metrics.t_load_context_ms = elapsed_ms(t_context_start);
+        }
+        restore_sequences(llamafu);
+    }
+    llamafu->release_level.store(LLAMAFU_RELEASE_NONE, std::memory_order_release);
+    return true;
+}
 
-    LlamafuInferParams params = {};
-    params.prompt = full_prompt.c_str();
-    params.max_tokens = 512;
-    params.temperature = 0.3f;
-    params.top_k = 40;
-    params.top_p = 0.9f;
-    params.seed = 42;
+extern "C" {
 
-    char* response = nullptr;
-    LlamafuError err = llamafu_complete(llamafu, &params, &response);
+LlamafuError llamafu_release_memory(Llamafu llamafu, int32_t level, const char* spill_dir) {
+    if (!llamafu || !validate_numeric_param(level, LLAMAFU_RELEASE_NONE, LLAMAFU_RELEASE_WEIGHTS)) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
 
-    if (err != LLAMAFU_SUCCESS || !response) {
-        *out_result = strdup("{}");
+    // Streams and queued jobs hold the context for as long as they run, and
+    // scheduled requests keep their sequences between steps
+    const bool needs_context = level >= LLAMAFU_RELEASE_CONTEXT;
+    if (needs_context && (token_stream_running(llamafu) || request_queue_busy(llamafu))) {
+        return LLAMAFU_ERROR_BUSY;
+    }
+
+    try {
+        // Called from memory-warning and trim callbacks, which must not wait
+        // out a blocking completion on another thread
+        HandleLock lock(llamafu);
+        if (lock.busy()) {
+            return LLAMAFU_ERROR_BUSY;
+        }
+        const int32_t current = llamafu->release_level.load(std::memory_order_acquire);
+        if (level <= current) {
+            return LLAMAFU_SUCCESS;
+        }
+        if (needs_context && scheduler_busy(llamafu)) {
+            return LLAMAFU_ERROR_BUSY;
+        }
+
+        LLAMAFU_TRACE_SCOPE("llamafu.release_memory");
+        if (current < LLAMAFU_RELEASE_CACHES) {
+            release_caches(llamafu);
+        }
+        if (needs_context && llamafu->ctx) {
+            std::string dir = spill_dir ? spill_dir : "";
+            if (dir.empty() && llamafu->prompt_disk_cache) {
+                dir = llamafu->prompt_disk_cache->dir;
+            }
+            release_context(llamafu, dir);
+        }
+        if (level >= LLAMAFU_RELEASE_WEIGHTS) {
+            advise_weight_pages(llamafu->shared_model, WEIGHTS_DONT_NEED);
+        }
+        llamafu->release_level.store(level, std::memory_order_release);
         return LLAMAFU_SUCCESS;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
     }
+}
 
-    *out_result = response;
-    return LLAMAFU_SUCCESS;
+LlamafuError llamafu_resume(Llamafu llamafu) {
+    if (!llamafu) {
+        return LLAMAFU_ERROR_INVALID_PARAM;
+    }
+
+    try {
+        std::lock_guard<std::mutex> lock(llamafu->generation_mutex);
+        LLAMAFU_TRACE_SCOPE("llamafu.resume");
+        return resume_locked(llamafu) ? LLAMAFU_SUCCESS : LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (const std::bad_alloc&) {
+        return LLAMAFU_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return LLAMAFU_ERROR_UNKNOWN;
+    }
+}
+
+int32_t llamafu_get_release_level(Llamafu llamafu) {
+    return llamafu ? llamafu->release_level.load(std::memory_order_acquire) : LLAMAFU_RELEASE_NONE;
 }
 
 } // extern "C"
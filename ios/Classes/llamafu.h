@@ -11,6 +11,8 @@ extern "C" {
 
 // Forward declarations
 typedef struct Llamafu_s* Llamafu;
+typedef struct LlamafuModel_s* LlamafuModel;
+typedef struct LlamafuModelLoad_s* LlamafuModelLoad;
 typedef struct LlamafuLoraAdapter_s* LlamafuLoraAdapter;
 typedef struct LlamafuGrammarSampler_s* LlamafuGrammarSampler;
 typedef struct LlamafuSampler_s* LlamafuSampler;
@@ -33,6 +35,18 @@ typedef enum {
     LLAMAFU_SAMPLER_CHAIN = 11
 } LlamafuSamplerType;
 
+// Number of KV cache sequences created by llamafu_init (default n_seq_max)
+#define LLAMAFU_DEFAULT_N_SEQ_MAX 8
+
+// Jobs that may wait in a handle's request queue (default bound)
+#define LLAMAFU_DEFAULT_QUEUE_CAPACITY 16
+
+// Buckets of LlamafuLatencyHistogram
+#define LLAMAFU_LATENCY_BUCKETS 16
+
+// Most alternatives per position llamafu_score_continuations returns
+#define LLAMAFU_MAX_TOP_LOGPROBS 32
+
 // Error codes
 typedef enum {
     LLAMAFU_SUCCESS = 0,
@@ -66,22 +80,79 @@ typedef enum {
     LLAMAFU_ERROR_INVALID_DIMENSIONS = -34,
     LLAMAFU_ERROR_BATCH_PROCESS_FAILED = -35,
     LLAMAFU_ERROR_ABORTED = -36,
+    LLAMAFU_ERROR_CONTEXT_FULL = -37,
+    LLAMAFU_ERROR_UNSUPPORTED_MODE = -38,  // Not available in this context mode
+    LLAMAFU_ERROR_BUSY = -39,              // A request or background stream is using this handle
+    LLAMAFU_ERROR_FILE_WRITE_FAILED = -40,
 } LlamafuError;
 
-// Model parameters - simplified for FFI compatibility
+// What a context is created for
+typedef enum {
+    LLAMAFU_CONTEXT_MODE_GENERATION = 0,  // Text generation only, no embedding output
+    LLAMAFU_CONTEXT_MODE_EMBEDDING = 1,   // Embeddings only, pooled per sequence
+    LLAMAFU_CONTEXT_MODE_BOTH = 2,        // Generation, embeddings enabled on demand
+} LlamafuContextMode;
+
+// Embedding pooling (mirrors llama_pooling_type)
+typedef enum {
+    LLAMAFU_POOLING_UNSPECIFIED = -1,     // Use the model's default
+    LLAMAFU_POOLING_NONE = 0,
+    LLAMAFU_POOLING_MEAN = 1,
+    LLAMAFU_POOLING_CLS = 2,
+    LLAMAFU_POOLING_LAST = 3,
+    LLAMAFU_POOLING_RANK = 4,
+} LlamafuPoolingType;
+
+// KV cache element type. Quantized caches trade a little accuracy for
+// 2-4x less KV memory; a quantized V cache requires flash attention.
+typedef enum {
+    LLAMAFU_KV_CACHE_DEFAULT = 0,         // f16
+    LLAMAFU_KV_CACHE_F32 = 1,
+    LLAMAFU_KV_CACHE_F16 = 2,
+    LLAMAFU_KV_CACHE_BF16 = 3,
+    LLAMAFU_KV_CACHE_Q8_0 = 4,
+    LLAMAFU_KV_CACHE_Q5_1 = 5,
+    LLAMAFU_KV_CACHE_Q5_0 = 6,
+    LLAMAFU_KV_CACHE_Q4_1 = 7,
+    LLAMAFU_KV_CACHE_Q4_0 = 8,
+    LLAMAFU_KV_CACHE_IQ4_NL = 9,
+} LlamafuKvCacheType;
+
+// How weights are spread over several GPUs (mirrors llama_split_mode)
+typedef enum {
+    LLAMAFU_SPLIT_MODE_DEFAULT = 0,       // By layer
+    LLAMAFU_SPLIT_MODE_NONE = 1,          // Whole model on main_gpu
+    LLAMAFU_SPLIT_MODE_LAYER = 2,         // Layers and KV split across GPUs
+    LLAMAFU_SPLIT_MODE_ROW = 3,           // Rows split across GPUs, when supported
+} LlamafuSplitMode;
+
+// Called on the loading thread with progress in [0, 1]; return false to
+// cancel (initialization then fails with LLAMAFU_ERROR_ABORTED)
+typedef bool (*LlamafuLoadProgressCallback)(float progress, void* user_data);
+
+// Model parameters - simplified for FFI compatibility. Fields after use_gpu
+// keep the previous behaviour when zero.
 typedef struct {
     const char* model_path;           // Path to model file
     const char* mmproj_path;          // Multi-modal projector path (optional)
     int32_t n_threads;                // Number of threads (-1 = auto)
     int32_t n_ctx;                    // Context size
     uint8_t use_gpu;                  // Whether to use GPU (0 = no, 1 = yes)
+
+    int32_t n_gpu_layers;             // Layers to offload: 0 = all if use_gpu else none, -1 = all, N = first N
+    int32_t split_mode;               // LlamafuSplitMode
+    int32_t main_gpu;                 // Device index for SPLIT_MODE_NONE and for small tensors
+    uint8_t no_mmap;                  // Read the file into memory instead of mapping it
+    uint8_t use_mlock;                // Lock the weights in RAM so first decodes do not page-fault
+    LlamafuLoadProgressCallback progress_callback; // Optional
+    void* progress_callback_data;
 } LlamafuModelParams;
 
 // Context parameters (updated)
 typedef struct {
     uint32_t n_ctx;                   // Context size
-    uint32_t n_batch;                 // Batch size for prompt processing (>= 32)
-    uint32_t n_ubatch;                // Physical batch size for computation
+    uint32_t n_batch;                 // Prompt prefill chunk size (>= 32)
+    uint32_t n_ubatch;                // Physical batch size for computation (<= n_batch)
     uint32_t n_seq_max;               // Maximum number of sequences
     int32_t n_threads;                // Number of threads (-1 = auto)
     int32_t n_threads_batch;          // Number of threads for batch processing
@@ -97,17 +168,43 @@ typedef struct {
     float yarn_beta_slow;             // YaRN beta slow
     uint32_t yarn_orig_ctx;           // YaRN original context size
 
-    bool embeddings;                  // Enable embeddings mode
+    bool embeddings;                  // Legacy: upgrades GENERATION mode to BOTH
     bool causal_attn;                 // Enable causal attention
     bool offload_kqv;                 // Offload K, Q, V to GPU
-    bool flash_attn;                  // Enable flash attention
+    bool flash_attn;                  // Force flash attention (false = backend default)
 
     // Abort callback
     bool (*abort_callback)(void* data);
     void* abort_callback_data;
+
+    int32_t context_mode;             // LlamafuContextMode
+    int32_t pooling_type;             // LlamafuPoolingType (embedding output only)
+
+    int32_t type_k;                   // LlamafuKvCacheType of K
+    int32_t type_v;                   // LlamafuKvCacheType of V (quantized enables flash attention)
+
+    // Context shift: when generation fills the context, keep the first
+    // n_keep tokens, drop half of the rest and continue instead of stopping
+    bool context_shift;
+    int32_t n_keep;                   // -1 = keep the whole prompt
 } LlamafuContextParams;
 
 // Inference parameters (enhanced)
+// A set of loaded LoRA adapters and their scales. llama.cpp adds the
+// adapters' deltas together, so merge_adapters and merge_strategy are ignored.
+typedef struct {
+    LlamafuLoraAdapter* adapters;           // Array of adapter handles
+    float* scales;                          // Scale for each adapter (NULL = each adapter's own)
+    size_t n_adapters;                      // Number of adapters
+    bool merge_adapters;                    // Merge multiple adapters
+    const char* merge_strategy;             // Merging strategy ("add", "concat", "weighted")
+} LlamafuLoraBatch;
+
+// A temperature <= 0 samples greedily. Other sampling fields left at zero
+// take defaults: top_k 40, top_p 0.95, repeat_penalty 1.1 over repeat_last_n
+// 64 (-1 = all generated tokens), mirostat_tau 5.0, mirostat_eta 0.1, seed 42.
+// Each handle keeps its sampler between requests and rebuilds it only when
+// these settings change.
 typedef struct {
     const char* prompt;
     int32_t max_tokens;
@@ -140,8 +237,23 @@ typedef struct {
     // Grammar (optional)
     const char* grammar_str;
     const char* grammar_root;
+
+    // Adapters for this request only (NULL = the handle's active adapters,
+    // n_adapters = 0 = base model). Adapters stay loaded; nothing is rebuilt.
+    const LlamafuLoraBatch* lora_batch;
+
+    // Stop strings (optional, copied). Generation ends with the token that
+    // completes one; the stop string and anything after it are not returned.
+    const char* const* stop_sequences;
+    int32_t n_stop_sequences;
 } LlamafuInferParams;
 
+// Grammar constraint for the *_with_grammar completion functions
+typedef struct {
+    const char* grammar_str;          // GBNF grammar
+    const char* grammar_root;         // Root rule (NULL = "root")
+} LlamafuGrammarParams;
+
 // Batch for efficient processing
 typedef struct {
     LlamafuToken* tokens;             // Tokens to process
@@ -193,11 +305,11 @@ typedef enum {
 
 // Input data source types
 typedef enum {
-    LLAMAFU_DATA_SOURCE_FILE_PATH = 0,      // File system path
+    LLAMAFU_DATA_SOURCE_FILE_PATH = 0,      // File system path (UTF-8), memory-mapped while processed (read on Windows)
     LLAMAFU_DATA_SOURCE_BASE64 = 1,         // Base64 encoded data
-    LLAMAFU_DATA_SOURCE_BINARY = 2,         // Raw binary data
+    LLAMAFU_DATA_SOURCE_BINARY = 2,         // Raw binary data, read in place (keep it valid until the call returns)
     LLAMAFU_DATA_SOURCE_URL = 3,            // HTTP/HTTPS URL (future)
-    LLAMAFU_DATA_SOURCE_RGB_PIXELS = 4,     // Raw RGB pixel data
+    LLAMAFU_DATA_SOURCE_RGB_PIXELS = 4,     // Raw RGB pixel data, read in place like BINARY
 } LlamafuDataSource;
 
 // Enhanced media input with validation and conversion support
@@ -292,15 +404,6 @@ typedef struct {
     int64_t created_timestamp;              // Creation timestamp
 } LlamafuLoraAdapterInfo;
 
-// LoRA management batch operations
-typedef struct {
-    LlamafuLoraAdapter* adapters;           // Array of adapter handles
-    float* scales;                          // Scale for each adapter
-    size_t n_adapters;                      // Number of adapters
-    bool merge_adapters;                    // Merge multiple adapters
-    const char* merge_strategy;             // Merging strategy ("add", "concat", "weighted")
-} LlamafuLoraBatch;
-
 // Enhanced multimodal inference parameters
 typedef struct {
     const char* prompt;                     // Text prompt
@@ -316,13 +419,13 @@ typedef struct {
     float repeat_penalty;
 
     // Multimodal-specific options
-    bool include_image_tokens;              // Include special image tokens in output
-    bool preserve_image_order;              // Maintain order of images in context
-    const char* image_token_format;         // Custom format for image tokens
+    bool include_image_tokens;              // Unused: media is never echoed in output
+    bool preserve_image_order;              // Without markers in the prompt, place media before the text
+    const char* image_token_format;         // Marker used in the prompt instead of mtmd's default
 
     // Performance options
     int32_t vision_threads;                 // Threads for vision processing (-1 = auto)
-    bool use_vision_cache;                  // Cache processed image embeddings
+    bool use_vision_cache;                  // Reuse and keep embeddings in the image cache
 
     // Structured output options
     LlamafuStructuredOutput* structured_output; // Optional structured output configuration
@@ -333,8 +436,8 @@ typedef struct {
 
 // Image processing result with metadata
 typedef struct {
-    float* embeddings;                      // Processed image embeddings
-    size_t n_embeddings;                    // Number of embedding dimensions
+    float* embeddings;                      // Processed image embeddings, n_tokens rows
+    size_t n_embeddings;                    // Number of floats in embeddings
     int32_t n_tokens;                       // Number of image tokens generated
 
     // Processed image properties
@@ -346,6 +449,12 @@ typedef struct {
     // Performance metrics
     double processing_time_ms;
     size_t memory_used_bytes;
+
+    // Per-stage timings; all zero when served from the image cache
+    double decode_time_ms;                  // Reading and decoding the source
+    double preprocess_time_ms;              // Resizing and normalizing for CLIP
+    double encode_time_ms;                  // Running the vision encoder
+    bool from_cache;
 } LlamafuImageProcessResult;
 
 // Image validation result
@@ -397,9 +506,9 @@ typedef struct {
 
 // Performance statistics
 typedef struct {
-    double t_start_ms;                // Start time
-    double t_end_ms;                  // End time
-    double t_load_ms;                 // Model load time
+    double t_start_ms;                // Last request start (steady clock)
+    double t_end_ms;                  // Last request end (steady clock)
+    double t_load_ms;                 // Weights and context load time
     double t_p_eval_ms;               // Prompt evaluation time
     double t_eval_ms;                 // Generation time
 
@@ -409,9 +518,64 @@ typedef struct {
     // Rates
     double t_p_eval_per_token_ms;     // Prompt eval per token
     double t_eval_per_token_ms;       // Generation per token
+
+    int32_t n_reused;                 // Prompt tokens reused from the KV cache (last completion)
+
+    // Last completion's generation, including speculative decoding
+    int32_t n_drafted;                // Tokens proposed by the draft source
+    int32_t n_draft_accepted;         // Drafted tokens the model accepted
+    float draft_acceptance_rate;      // n_draft_accepted / n_drafted (0 without drafts)
+    double tokens_per_second;         // Generated tokens per second of generation time
+
+    // Last completion's prompt: n_reused + n_restored + n_prefilled tokens
+    int32_t n_restored;               // Prompt tokens restored from the prompt cache directory
+    int32_t n_prefilled;              // Prompt tokens decoded
 } LlamafuPerfStats;
 
-// Enhanced streaming callbacks
+// Latency distribution: bucket 0 counts samples under 1 ms, bucket i those
+// in [2^(i-1), 2^i) ms and the last bucket everything longer
+typedef struct {
+    uint64_t counts[LLAMAFU_LATENCY_BUCKETS];
+    uint64_t n_samples;
+    double sum_ms;
+    double max_ms;
+} LlamafuLatencyHistogram;
+
+// Where the time of a request went. Covers the completion paths (blocking,
+// streaming, token streams, queued jobs and multimodal); times are in
+// milliseconds from the request start.
+typedef struct {
+    // Last request
+    double t_tokenize_ms;             // Prompt tokenization (mtmd for multimodal)
+    double t_prefill_ms;              // Prompt decode, including cache lookups
+    double t_first_token_ms;          // Time to first token
+    double t_sample_ms;               // Inside the sampler
+    double t_decode_ms;               // Generation decodes
+    double t_detokenize_ms;           // UTF-8 assembly and stop string matching
+    double t_callback_ms;             // Inside text callbacks
+    double t_total_ms;
+    int32_t n_prompt_tokens;
+    int32_t n_generated;
+    int32_t n_sample;
+    double itl_p50_ms;                // Inter-token latency percentiles
+    double itl_p99_ms;
+    double itl_max_ms;
+
+    // Requests since the handle was created or llamafu_reset_timings
+    uint64_t n_requests;
+    LlamafuLatencyHistogram ttft;
+    LlamafuLatencyHistogram itl;
+
+    // Load phases of the weights and of this handle's context
+    double t_load_weights_ms;         // llama_model_load_from_file
+    double t_load_vocab_ms;           // Token piece table
+    double t_load_context_ms;         // Context and its buffers
+    double t_load_mmproj_ms;          // Multimodal projector (0 until loaded)
+} LlamafuRequestMetrics;
+
+// Enhanced streaming callbacks. Text callbacks receive NUL-terminated spans of
+// whole UTF-8 characters; bytes of a character split across tokens are held
+// until it is complete.
 typedef void (*LlamafuStreamCallback)(const char* token, void* user_data);
 typedef void (*LlamafuAudioStreamCallback)(const float* audio_data, size_t n_samples, int32_t sample_rate, void* user_data);
 typedef void (*LlamafuStructuredStreamCallback)(const char* json_chunk, bool is_complete, void* user_data);
@@ -464,10 +628,51 @@ LlamafuModelParams llamafu_model_default_params(void);
 LlamafuContextParams llamafu_context_default_params(void);
 
 // Model loading and management
-LlamafuError llamafu_model_load(const char* path, LlamafuModelParams params, Llamafu* out_model);
-LlamafuError llamafu_init_context(Llamafu model, LlamafuContextParams params);
+LlamafuError llamafu_init(LlamafuModelParams* params, Llamafu* out_llamafu);
+LlamafuError llamafu_init_with_context(LlamafuModelParams* params, const LlamafuContextParams* context_params,
+                                       Llamafu* out_llamafu);
 void llamafu_free(Llamafu llamafu);
 
+// Shared models: one copy of the weights serving any number of handles, each
+// with its own context. Loads naming the same file with the same placement
+// (GPU layers, split mode, main GPU, mmap, mlock) return the model already
+// loaded, including the one behind a handle from llamafu_init. The weights
+// are freed once the last reference is released and the last handle using
+// them is freed. mmproj_path is ignored here.
+LlamafuError llamafu_model_load(const LlamafuModelParams* params, LlamafuModel* out_model);
+void llamafu_model_retain(LlamafuModel model);
+void llamafu_model_release(LlamafuModel model);
+int32_t llamafu_model_ref_count(LlamafuModel model);
+// The handle holds its own reference, so the caller may release model
+// right after this returns
+LlamafuError llamafu_init_from_model(LlamafuModel model, const LlamafuContextParams* context_params,
+                                     Llamafu* out_llamafu);
+// Model a handle runs on (borrowed; retain to keep it past llamafu_free)
+LlamafuModel llamafu_get_model(Llamafu llamafu);
+
+// Loads a model on a background thread, e.g. the next one while the current
+// one keeps serving. progress_callback is not called; poll instead. A cancelled
+// load finishes with LLAMAFU_ERROR_ABORTED.
+LlamafuError llamafu_model_load_async(const LlamafuModelParams* params, LlamafuModelLoad* out_load);
+// LLAMAFU_ERROR_BUSY while loading, then the load's result. On success the
+// model reference passes to the caller (once; later calls fail). out_model
+// may be NULL to only read progress.
+LlamafuError llamafu_model_load_poll(LlamafuModelLoad load, float* out_progress, LlamafuModel* out_model);
+LlamafuError llamafu_model_load_wait(LlamafuModelLoad load, LlamafuModel* out_model);
+void llamafu_model_load_cancel(LlamafuModelLoad load);
+// Cancels and joins a running load; releases the model if it was never claimed
+void llamafu_model_load_free(LlamafuModelLoad load);
+
+// Moves a handle onto another model, keeping its context settings, abort
+// callback and prompt cache directory. The new context is created before
+// anything is torn down, so on failure the handle still serves the old model.
+// On success the KV cache, scheduled requests, LoRA adapters, grammar cache,
+// speculative draft and vision projector of the old model are dropped;
+// samplers created by the caller must be recreated. Returns
+// LLAMAFU_ERROR_BUSY instead of waiting while a request, queued job or
+// background stream is using the handle.
+LlamafuError llamafu_swap_model(Llamafu llamafu, LlamafuModel model);
+
 // Model information
 LlamafuError llamafu_get_model_info(Llamafu llamafu, LlamafuModelInfo* out_info);
 
@@ -485,6 +690,23 @@ LlamafuError llamafu_tokenize(
     bool parse_special
 );
 
+// Tokenizes n_texts NUL-terminated texts into one caller buffer of capacity
+// tokens. Text i's tokens are out_tokens[out_offsets[i] .. out_offsets[i + 1]]
+// (out_offsets holds n_texts + 1 entries) and *out_n_tokens receives the
+// total. When that exceeds capacity only the texts that fit were written;
+// call again with a buffer of at least *out_n_tokens.
+LlamafuError llamafu_tokenize_batch(
+    Llamafu llamafu,
+    const char* const* texts,
+    int32_t n_texts,
+    LlamafuToken* out_tokens,
+    int32_t capacity,
+    int32_t* out_offsets,
+    int32_t* out_n_tokens,
+    bool add_special,
+    bool parse_special
+);
+
 LlamafuError llamafu_detokenize(
     Llamafu llamafu,
     const LlamafuToken* tokens,
@@ -620,27 +842,58 @@ LlamafuError llamafu_image_to_base64(
     char** out_base64
 );
 
-// Image processing and encoding
+// Image processing and encoding. Encoded (JPEG, PNG, BMP; WebP on iOS and
+// Android 11+) and raw RGB/RGBA pixel inputs are accepted. Embeddings are
+// cached per handle by a hash of the source bytes, so sending the same image
+// again skips decoding and encoding.
 LlamafuError llamafu_image_process(
     Llamafu llamafu,
     const LlamafuMediaInput* input,
     LlamafuImageProcessResult* out_result
 );
 
+typedef struct {
+    int32_t n_entries;                // Images with cached embeddings
+    int32_t n_hits;                   // Images served from the cache
+    int32_t n_misses;                 // Images that had to be encoded
+    uint64_t n_bytes;                 // Bytes used by the entries
+    uint64_t max_bytes;               // Byte budget
+} LlamafuImageCacheStats;
+
+// Least recently used entries are dropped once over max_bytes (64 MiB by
+// default); 0 disables the cache
+LlamafuError llamafu_image_cache_set_budget(Llamafu llamafu, uint64_t max_bytes);
+void llamafu_image_cache_clear(Llamafu llamafu);
+LlamafuError llamafu_image_cache_get_stats(Llamafu llamafu, LlamafuImageCacheStats* out_stats);
+
+// With process_parallel set, images are decoded and preprocessed on worker
+// threads, at most max_batch_size (default 4) ahead of the encoder, which
+// encodes them as they become ready. The embeddings of all images are
+// stored back to back in one buffer, in input order; failed inputs have no
+// embeddings and make this return LLAMAFU_ERROR_BATCH_PROCESS_FAILED. Free
+// the results with llamafu_image_batch_result_free, not per result.
 LlamafuError llamafu_image_batch_process(
     Llamafu llamafu,
     const LlamafuMediaBatch* batch,
     LlamafuImageProcessResult** out_results,
     size_t* out_n_results
 );
+void llamafu_image_batch_result_free(LlamafuImageProcessResult* results);
 
-// Enhanced multimodal completion with comprehensive support
+// Multimodal completion. Each media input needs a marker in the prompt
+// (mtmd's default "<__media__>" or image_token_format); without any, markers
+// are added around the text. Media are evaluated as embeddings in place of
+// their markers, interleaved with the text. With use_vision_cache, an image
+// already in the image cache is not encoded again, and a prompt sharing a
+// prefix with the previous one (e.g. the next turn of a conversation) only
+// evaluates what follows it.
 LlamafuError llamafu_multimodal_complete_enhanced(
     Llamafu llamafu,
     LlamafuMultimodalInferParams* params,
     char** out_result
 );
 
+// As llamafu_multimodal_complete_enhanced, calling callback with each piece
 LlamafuError llamafu_multimodal_complete_streaming(
     Llamafu llamafu,
     LlamafuMultimodalInferParams* params,
@@ -648,6 +901,14 @@ LlamafuError llamafu_multimodal_complete_streaming(
     void* user_data
 );
 
+// Alias of llamafu_multimodal_complete_streaming
+LlamafuError llamafu_multimodal_complete_stream(
+    Llamafu llamafu,
+    LlamafuMultimodalInferParams* params,
+    LlamafuStreamCallback callback,
+    void* user_data
+);
+
 // Convenience functions for common use cases
 LlamafuError llamafu_chat_with_image_file(
     Llamafu llamafu,
@@ -716,6 +977,33 @@ LlamafuError llamafu_complete_stream(
     void* user_data
 );
 
+// Grammar-constrained completion. Parsed grammars are cached per handle
+// (keyed by grammar and root), so reusing a grammar skips re-parsing; the
+// same applies to LlamafuInferParams.grammar_str in the other functions.
+LlamafuError llamafu_complete_with_grammar(
+    Llamafu llamafu,
+    LlamafuInferParams* params,
+    const LlamafuGrammarParams* grammar_params,
+    char** out_result
+);
+
+LlamafuError llamafu_complete_with_grammar_stream(
+    Llamafu llamafu,
+    LlamafuInferParams* params,
+    const LlamafuGrammarParams* grammar_params,
+    LlamafuStreamCallback callback,
+    void* user_data
+);
+
+// Standalone grammar sampler (cloned from the handle's grammar cache)
+LlamafuError llamafu_grammar_sampler_init(
+    Llamafu llamafu,
+    const char* grammar_str,
+    const char* grammar_root,
+    LlamafuGrammarSampler* out_sampler
+);
+void llamafu_grammar_sampler_free(LlamafuGrammarSampler sampler);
+
 LlamafuError llamafu_multimodal_complete(
     Llamafu llamafu,
     LlamafuMultimodalInferParams* params,
@@ -733,10 +1021,20 @@ LlamafuError llamafu_get_embeddings(
     int32_t* out_n_embd
 );
 
+// Embed many texts at once. Texts are packed into shared decode batches under
+// distinct sequence ids and one vector per text is written, row by row, into
+// out_embeddings (caller-allocated, out_capacity floats, at least
+// n_texts * n_embd). pooling UNSPECIFIED uses the context's pooling; MEAN,
+// CLS and LAST can also be requested on contexts created without pooling.
+// Texts longer than n_batch tokens are truncated.
 LlamafuError llamafu_get_embeddings_batch(
     Llamafu llamafu,
-    LlamafuBatch* batch,
-    float** out_embeddings,
+    const char* const* texts,
+    int32_t n_texts,
+    int32_t pooling,                  // LlamafuPoolingType
+    bool normalize,                   // L2-normalize each row
+    float* out_embeddings,
+    size_t out_capacity,
     int32_t* out_n_embd
 );
 
@@ -862,6 +1160,14 @@ LlamafuError llamafu_create_template(
 // ENHANCED LORA ADAPTER API
 //
 
+// Adapters are loaded once and stay resident until unloaded or the handle is
+// freed. Loading does not activate an adapter; llamafu_set_lora_adapter adds
+// it to the handle's active set (used by every request that does not name its
+// own adapters), and clearing only deactivates. Switching the active set is
+// cheap: no context or KV cache is rebuilt, only the in-memory prompt prefix
+// is re-evaluated. Adapter calls return LLAMAFU_ERROR_BUSY instead of waiting
+// while a request or background stream is using the handle.
+
 // Basic LoRA operations (existing)
 LlamafuError llamafu_load_lora_adapter_from_file(
     Llamafu llamafu,
@@ -883,6 +1189,17 @@ LlamafuError llamafu_unload_lora_adapter(
 
 void llamafu_clear_lora_adapters(Llamafu llamafu);
 
+// Aliases used by the Dart bindings. init loads with scale 1, apply activates
+// (or rescales), remove and clear_all deactivate, free unloads. An adapter
+// from init is always released with free, before or after its handle;
+// freeing the handle first drops only the weights. On a busy handle free
+// returns at once and the adapter is unloaded once the request ends.
+LlamafuError llamafu_lora_adapter_init(Llamafu llamafu, const char* lora_path, LlamafuLoraAdapter* out_adapter);
+LlamafuError llamafu_lora_adapter_apply(Llamafu llamafu, LlamafuLoraAdapter adapter, float scale);
+LlamafuError llamafu_lora_adapter_remove(Llamafu llamafu, LlamafuLoraAdapter adapter);
+LlamafuError llamafu_lora_adapter_clear_all(Llamafu llamafu);
+void llamafu_lora_adapter_free(LlamafuLoraAdapter adapter);
+
 // Enhanced LoRA management
 LlamafuError llamafu_load_lora_adapter_with_info(
     Llamafu llamafu,
@@ -899,12 +1216,17 @@ LlamafuError llamafu_get_lora_adapter_info(
     LlamafuLoraAdapterInfo* out_info
 );
 
+// Strings in the returned infos belong to the adapters and stay valid until
+// they are unloaded; free the array with llamafu_free_lora_adapter_list
 LlamafuError llamafu_list_lora_adapters(
     Llamafu llamafu,
     LlamafuLoraAdapterInfo** out_adapters,
     size_t* out_n_adapters
 );
+void llamafu_free_lora_adapter_list(LlamafuLoraAdapterInfo* adapters);
 
+// Makes batch the handle's active set: its adapters at the given scales,
+// every other loaded adapter inactive
 LlamafuError llamafu_apply_lora_batch(
     Llamafu llamafu,
     const LlamafuLoraBatch* batch
@@ -954,13 +1276,54 @@ size_t llamafu_state_set_data(Llamafu llamafu, const void* src);
 LlamafuError llamafu_state_save_file(Llamafu llamafu, const char* path);
 LlamafuError llamafu_state_load_file(Llamafu llamafu, const char* path);
 
+// Snapshots without a state-sized buffer: save serializes straight into a
+// shared mapping of the file, load maps it read-only and pages it in as the
+// state is consumed. seq_id -1 covers the whole context; otherwise only that
+// sequence's KV cells are saved, or restored into it (replacing its
+// contents), so one conversation can be suspended on its own. For save, fd
+// must be open read-write; the file is resized to the snapshot. On Windows
+// fd is a CRT descriptor (opened with _O_BINARY) and the snapshot goes
+// through a heap buffer instead of a mapping.
+LlamafuError llamafu_state_save_fd(Llamafu llamafu, int fd, int32_t seq_id, uint64_t* out_size);
+LlamafuError llamafu_state_load_fd(Llamafu llamafu, int fd, int32_t seq_id);
+LlamafuError llamafu_state_save_mapped(Llamafu llamafu, const char* path, int32_t seq_id, uint64_t* out_size);
+LlamafuError llamafu_state_load_mapped(Llamafu llamafu, const char* path, int32_t seq_id);
+
+// Persistent prompt cache: when a request finishes, the state of sequence 0
+// is saved under dir, indexed by hashes of the prompt's full block_size-token
+// blocks; nothing is written unless the prompt adds a block. Before
+// the next prefill the saved state sharing the most leading blocks with the
+// prompt is restored, when that beats the prefix already in memory, and only
+// the remainder is decoded. Least recently used entries are deleted once the
+// directory holds more than max_bytes. Entries other models saved in the same
+// directory are ignored.
+typedef struct {
+    int32_t n_entries;                // Saved states of this model
+    int32_t n_hits;                   // Prefills that restored a saved state
+    int32_t n_misses;                 // Prefills with no saved block in common
+    uint64_t n_bytes;                 // Bytes used by the entries
+    uint64_t max_bytes;               // Byte budget
+} LlamafuPromptCacheStats;
+
+// These return LLAMAFU_ERROR_BUSY (disable: do nothing) while a request is
+// running
+LlamafuError llamafu_prompt_cache_enable(Llamafu llamafu, const char* dir, uint64_t max_bytes, int32_t block_size);
+void llamafu_prompt_cache_disable(Llamafu llamafu);
+// Deletes this model's entries from the directory
+LlamafuError llamafu_prompt_cache_clear(Llamafu llamafu);
+LlamafuError llamafu_prompt_cache_get_stats(Llamafu llamafu, LlamafuPromptCacheStats* out_stats);
+
 //
 // PERFORMANCE AND THREADING
 //
 
 // (Removed duplicate - see performance section below)
+// get_perf_stats returns LLAMAFU_ERROR_BUSY while a request is running;
+// reset_perf_stats waits for it to finish.
 LlamafuError llamafu_get_perf_stats(Llamafu llamafu, LlamafuPerfStats* out_stats);
 void llamafu_reset_perf_stats(Llamafu llamafu);
+// Safe to call from any thread, also while a request runs
+LlamafuError llamafu_get_request_metrics(Llamafu llamafu, LlamafuRequestMetrics* out_metrics);
 
 //
 // LOGITS AND OUTPUT ACCESS
@@ -969,6 +1332,79 @@ void llamafu_reset_perf_stats(Llamafu llamafu);
 float* llamafu_get_logits(Llamafu llamafu);
 float* llamafu_get_logits_ith(Llamafu llamafu, int32_t i);
 
+typedef struct {
+    int32_t token;
+    float logprob;                    // Natural log-probability
+} LlamafuTokenLogprob;
+
+// The k most likely tokens after output i of the last decode (-1 = last),
+// most likely first, without handing out the n_vocab logits. Writes
+// min(k, n_vocab) entries to out (caller-allocated, k entries).
+LlamafuError llamafu_get_top_logprobs_ith(Llamafu llamafu, int32_t i, int32_t k, LlamafuTokenLogprob* out,
+                                          int32_t* out_n);
+
+//
+// SCORING API
+//
+
+// Scores of one continuation: log-probabilities of its tokens are
+// tokens[first .. first + n_tokens) of the result, and the top_k most
+// likely alternatives at position j are top[j * top_k ..] for those j.
+typedef struct {
+    int32_t first;
+    int32_t n_tokens;
+    double logprob_sum;               // Log-likelihood of the continuation
+    bool is_greedy;                   // Every token was the most likely one
+} LlamafuContinuationScore;
+
+// One allocation; free with llamafu_score_result_free
+typedef struct {
+    LlamafuContinuationScore* continuations;  // n_continuations
+    LlamafuTokenLogprob* tokens;              // n_tokens
+    LlamafuTokenLogprob* top;                 // n_tokens * top_k (nullptr when top_k is 0)
+    int32_t n_continuations;
+    int32_t n_tokens;
+    int32_t top_k;
+    int32_t n_prefix_tokens;
+} LlamafuScoreResult;
+
+// Log-likelihood of each continuation given prefix. The prefix is decoded
+// once into sequence 0 (reusing the prompt cache), copied to free sequences
+// with llama_memory_seq_cp and the continuations are scored together in
+// shared batches. Continuations are tokenized on their own, without special
+// tokens, so leading spaces belong to them. top_k (0..LLAMAFU_MAX_TOP_LOGPROBS)
+// alternatives per position are computed natively. Sequences owned by chat
+// sessions or scheduled requests are left alone.
+LlamafuError llamafu_score_continuations(
+    Llamafu llamafu,
+    const char* prefix,
+    const char* const* continuations,
+    int32_t n_continuations,
+    int32_t top_k,
+    LlamafuScoreResult** out_result
+);
+void llamafu_score_result_free(LlamafuScoreResult* result);
+
+// Outputs of a classifier or reranker head (0 without one) and their labels
+uint32_t llamafu_model_n_cls_out(Llamafu llamafu);
+const char* llamafu_model_cls_label(Llamafu llamafu, uint32_t i);
+
+// Relevance of each document to query, from a reranker on a context with
+// LLAMAFU_POOLING_RANK. Pairs are built with the model's rerank template
+// (or [BOS]query[EOS][SEP]document[EOS]) and scored in shared batches like
+// llamafu_get_embeddings_batch. out_scores (caller-allocated, out_capacity
+// floats, at least n_documents * n_cls_out) receives one row per document;
+// single-output rerankers write one score each. Pairs longer than n_batch
+// tokens are rejected.
+LlamafuError llamafu_rerank(
+    Llamafu llamafu,
+    const char* query,
+    const char* const* documents,
+    int32_t n_documents,
+    float* out_scores,
+    size_t out_capacity
+);
+
 //
 // UNIVERSAL STREAMING API
 //
@@ -1051,6 +1487,9 @@ LlamafuError llamafu_chat_session_add_message(
     size_t n_media_inputs
 );
 
+// Appends user_message and the reply to the history; on failure the history
+// is left unchanged. Returns LLAMAFU_ERROR_INVALID_PARAM once the session's
+// handle has been freed.
 LlamafuError llamafu_chat_session_complete(
     void* session,
     const char* user_message,
@@ -1064,8 +1503,198 @@ LlamafuError llamafu_chat_session_get_history(
     char** out_history_json
 );
 
+// KV-backed chat session: the conversation is kept in its own sequence of the
+// shared KV cache, so each turn only decodes the new messages. seq_id must be
+// in [1, n_seq_max) and not owned by another session or scheduled request;
+// sequence 0 is used by llamafu_complete.
+LlamafuError llamafu_chat_session_create_kv(
+    Llamafu llamafu,
+    const char* system_prompt,
+    int32_t seq_id,
+    void** out_session
+);
+
+// Number of tokens the session has committed to its sequence (0 for
+// sessions created with llamafu_chat_session_create)
+LlamafuError llamafu_chat_session_get_n_past(void* session, int32_t* out_n_past);
+
+// Sampling used by later turns (default: max_tokens 256, temperature 0.7,
+// top_k 40, top_p 0.9). The prompt, grammar, LoRA and stop-sequence fields
+// are ignored.
+LlamafuError llamafu_chat_session_set_params(void* session, const LlamafuInferParams* params);
+
+// Safe to call before or after llamafu_free of the session's handle
 void llamafu_chat_session_free(void* session);
 
+//
+// SPECULATIVE DECODING
+//
+
+// Where drafted tokens come from. The model verifies up to n_draft drafted
+// tokens per decode and keeps those matching its own samples, so output is
+// unchanged; only the number of decode calls drops.
+typedef enum {
+    LLAMAFU_DRAFT_NONE = 0,           // Disabled
+    LLAMAFU_DRAFT_NGRAM = 1,          // Prompt lookup: continue earlier n-gram matches (no extra model)
+    LLAMAFU_DRAFT_MODEL = 2,          // Small draft model sharing the main model's vocabulary
+} LlamafuDraftType;
+
+typedef struct {
+    int32_t draft_type;               // LlamafuDraftType
+    int32_t n_draft;                  // Max drafted tokens per step (1-32)
+    int32_t ngram_min;                // Shortest n-gram to look up (NGRAM)
+    int32_t ngram_max;                // Longest n-gram to look up (NGRAM)
+    const char* draft_model_path;     // GGUF draft model (MODEL)
+} LlamafuSpeculativeParams;
+
+LlamafuSpeculativeParams llamafu_speculative_default_params(void);
+
+// Applies to complete, complete_stream, the background stream and
+// generate_text. LLAMAFU_DRAFT_NONE disables speculation and releases the
+// draft model.
+LlamafuError llamafu_set_speculative(Llamafu llamafu, const LlamafuSpeculativeParams* params);
+
+//
+// CONTINUOUS BATCHING SCHEDULER
+//
+
+// Requests submitted to the scheduler run concurrently, each in its own KV
+// cache sequence (up to n_seq_max - 1 at a time, the rest wait in a queue).
+// Every llamafu_scheduler_step packs one decode token from each generating
+// request plus prefill chunks of newly admitted ones into a single batch.
+typedef struct LlamafuRequest_s* LlamafuRequest;
+
+typedef enum {
+    LLAMAFU_REQUEST_QUEUED = 0,       // Waiting for a free sequence
+    LLAMAFU_REQUEST_PREFILLING = 1,   // Prompt is being evaluated
+    LLAMAFU_REQUEST_GENERATING = 2,   // Producing tokens
+    LLAMAFU_REQUEST_DONE = 3,         // Finished (EOG, max_tokens or context end)
+    LLAMAFU_REQUEST_FAILED = 4,       // Stopped with an error
+    LLAMAFU_REQUEST_CANCELLED = 5,    // Cancelled by the caller
+} LlamafuRequestState;
+
+// Queue a request. The prompt is copied; callback (optional) receives each
+// generated piece from inside llamafu_scheduler_step.
+LlamafuError llamafu_scheduler_submit(
+    Llamafu llamafu,
+    const LlamafuInferParams* params,
+    LlamafuStreamCallback callback,
+    void* user_data,
+    LlamafuRequest* out_request
+);
+
+// Run one batched decode over all active requests
+LlamafuError llamafu_scheduler_step(Llamafu llamafu, int32_t* out_n_pending);
+
+// Text generated since the previous poll (free with llamafu_free_string) and
+// the current state. Returns the request's error once it has failed.
+// poll, cancel and free may be called from any thread, also from the
+// request's own callback; free waits for a callback that is running.
+LlamafuError llamafu_request_poll(LlamafuRequest request, char** out_text, LlamafuRequestState* out_state);
+LlamafuError llamafu_request_cancel(LlamafuRequest request);
+void llamafu_request_free(LlamafuRequest request);
+
+//
+// BACKGROUND TOKEN STREAMING
+//
+
+// Generation runs on a native worker thread that writes each token id and
+// its UTF-8 bytes into a single-producer/single-consumer ring buffer. The
+// reader drains it in batches with llamafu_stream_read, woken by notify.
+// Only one stream may run per handle, and the handle must not be used for
+// anything else until the stream has finished. The handle's abort callback
+// is invoked from the worker thread.
+typedef struct LlamafuTokenStream_s* LlamafuTokenStream;
+
+// Called from the worker thread when data becomes available (coalesced
+// until the next read) and once when the stream finishes.
+typedef void (*LlamafuStreamNotify)(void* user_data);
+
+// Start generating in the background. The prompt is copied. buffer_bytes is
+// rounded up to a power of two (minimum 4096); the worker waits when the
+// ring is full. Returns LLAMAFU_ERROR_BUSY while another stream is running.
+LlamafuError llamafu_stream_start(
+    Llamafu llamafu,
+    const LlamafuInferParams* params,
+    size_t buffer_bytes,
+    LlamafuStreamNotify notify,
+    void* notify_data,
+    LlamafuTokenStream* out_stream
+);
+
+// Copy whole records into out_text (not NUL-terminated) and, optionally,
+// their token ids into out_tokens. A record carries the text its token
+// completed: spans never split a UTF-8 sequence, may be empty while a
+// character or possible stop string is pending, and whatever is still
+// pending at the end arrives without a token. A record longer than
+// text_capacity (at least 4) is returned in parts cut on UTF-8 boundaries,
+// its token id with the last part.
+// out_finished is set once the worker is done and everything was read; the
+// generation result is then returned.
+LlamafuError llamafu_stream_read(
+    LlamafuTokenStream stream,
+    char* out_text,
+    size_t text_capacity,
+    size_t* out_text_len,
+    int32_t* out_tokens,
+    int32_t tokens_capacity,
+    int32_t* out_n_tokens,
+    bool* out_finished
+);
+
+LlamafuError llamafu_stream_cancel(LlamafuTokenStream stream);
+
+// Cancels and joins the worker if it is still running
+void llamafu_stream_free(LlamafuTokenStream stream);
+
+//
+// REQUEST QUEUE
+//
+
+// Completions submitted here run one at a time on a worker thread owned by
+// the handle, highest priority first and in submission order within a
+// priority. Each job has its own cancellation: a queued job is dropped, a
+// running one stops inside the current decode (prefill included) through
+// the ggml abort callback. Every call that runs the handle's context waits
+// while a job holds it, so the handle can be shared between threads.
+// Callbacks run on the worker thread and must not start generation on the
+// same handle.
+typedef struct LlamafuJob_s* LlamafuJob;
+
+// Called once when a job ends (from llamafu_job_cancel for a job that had
+// not started). text is the whole output, valid during the call only.
+typedef void (*LlamafuJobCallback)(LlamafuError result, LlamafuRequestState state, const char* text,
+                                   void* user_data);
+
+// Bound on queued jobs, 1..1024; submit returns LLAMAFU_ERROR_BUSY when full
+LlamafuError llamafu_queue_set_capacity(Llamafu llamafu, int32_t capacity);
+
+// Queue a completion. params (prompt, grammar, stop strings, LoRA batch)
+// are copied. on_text (optional) receives whole-character spans as they are
+// generated, on_done (optional) the final result.
+LlamafuError llamafu_queue_submit(
+    Llamafu llamafu,
+    const LlamafuInferParams* params,
+    int32_t priority,                 // Higher runs first
+    LlamafuStreamCallback on_text,
+    LlamafuJobCallback on_done,
+    void* user_data,
+    LlamafuJob* out_job
+);
+
+LlamafuError llamafu_job_cancel(LlamafuJob job);
+
+// Current state; returns the job's error once it has failed
+LlamafuError llamafu_job_get_state(LlamafuJob job, LlamafuRequestState* out_state);
+
+// Wait up to timeout_ms (-1 = no limit) for the job to end. Returns
+// LLAMAFU_ERROR_BUSY on timeout, else the job's result with its output in
+// out_text (optional; free with llamafu_free_string).
+LlamafuError llamafu_job_wait(LlamafuJob job, int32_t timeout_ms, char** out_text);
+
+// Releases the handle only; the job keeps its place and its callbacks fire
+void llamafu_job_free(LlamafuJob job);
+
 // Language detection and translation helpers
 LlamafuError llamafu_detect_language(
     Llamafu llamafu,
@@ -1156,13 +1785,63 @@ typedef struct {
     float generation_speed_tps;       // Generation tokens per second
 } LlamafuBenchResult;
 
+// One llama-bench style test: each repetition evaluates n_prompt random
+// tokens in n_batch chunks (pp), then generates n_gen tokens one decode at a
+// time at depth n_prompt (tg). Either count may be 0.
+typedef struct {
+    int32_t n_prompt;                 // Prompt tokens per repetition
+    int32_t n_gen;                    // Generated tokens per repetition
+    int32_t n_batch;                  // Tokens per prompt decode (<= 0 = context n_batch)
+    int32_t n_threads;                // Threads for both phases (<= 0 = current)
+    int32_t repetitions;              // Timed repetitions (1..1000)
+    int32_t warmup;                   // Untimed repetitions run first (0..100)
+} LlamafuBenchParams;
+
 typedef struct {
-    uint64_t model_size_bytes;        // Model size in memory
-    uint64_t kv_cache_size_bytes;     // KV cache size
-    uint64_t compute_buffer_size_bytes; // Compute buffer size
-    uint64_t total_size_bytes;        // Total memory usage
+    int32_t n_tokens;                 // Tokens per repetition
+    int32_t n_samples;                // Timed repetitions
+    double mean_ms;                   // Time per repetition
+    double stddev_ms;
+    double mean_tps;                  // Tokens per second over repetitions
+    double stddev_tps;
+    double p50_ms;                    // Per-token latency percentiles: every
+    double p99_ms;                    // decode for tg, batch time / tokens for pp
+} LlamafuBenchStats;
+
+// Sizes come from the backend buffers llama.cpp reported allocating for the
+// handle (measured = 1), or from the model's dimensions (measured = 0)
+typedef struct {
+    uint64_t model_size_bytes;        // Model weights, all devices
+    uint64_t kv_cache_size_bytes;     // KV cache (and recurrent state)
+    uint64_t compute_buffer_size_bytes; // Compute buffers
+    uint64_t total_size_bytes;        // Sum of the buffers below and above
+
+    uint64_t model_host_bytes;        // Weights in host memory (CPU, mapped, *_Host buffers)
+    uint64_t model_device_bytes;      // Weights in accelerator buffers
+    uint64_t output_buffer_bytes;     // Logits / embeddings output buffer
+    uint64_t clip_size_bytes;         // Vision projector weights
+    uint64_t rss_bytes;               // Process footprint now (phys_footprint on iOS, RSS elsewhere)
+    uint64_t peak_rss_bytes;          // Peak resident set of the process
+    uint8_t measured;                 // 1 = real buffer sizes, 0 = estimated
+    uint64_t lora_bytes;              // Loaded LoRA adapters, active or not
 } LlamafuMemoryUsage;
 
+typedef enum {
+    LLAMAFU_BUFFER_WEIGHTS = 0,
+    LLAMAFU_BUFFER_KV_CACHE = 1,
+    LLAMAFU_BUFFER_RECURRENT_STATE = 2,
+    LLAMAFU_BUFFER_OUTPUT = 3,
+    LLAMAFU_BUFFER_COMPUTE = 4,
+    LLAMAFU_BUFFER_LORA = 5,
+} LlamafuBufferKind;
+
+typedef struct {
+    char buffer_type[32];             // ggml buffer type, e.g. "CPU_Mapped", "Metal", "Vulkan0"
+    int32_t kind;                     // LlamafuBufferKind
+    uint8_t is_host;                  // Lives in host memory
+    uint64_t size_bytes;
+} LlamafuBufferInfo;
+
 typedef enum {
     LLAMAFU_LOG_DEBUG = 0,
     LLAMAFU_LOG_INFO = 1, 
@@ -1234,7 +1913,9 @@ typedef struct {
     uint32_t seed;
 } LlamafuJsonParams;
 
-// Extended performance and threading API
+// Extended performance and threading API. set_n_threads, get_timings and
+// get_memory_usage return LLAMAFU_ERROR_BUSY while a request is running;
+// reset_timings and print_timings wait for it to finish.
 LlamafuError llamafu_set_n_threads(Llamafu llamafu, int32_t n_threads, int32_t n_threads_batch);
 LlamafuError llamafu_get_n_threads(Llamafu llamafu, int32_t* out_n_threads, int32_t* out_n_threads_batch);
 LlamafuError llamafu_warmup(Llamafu llamafu);
@@ -1242,10 +1923,114 @@ LlamafuError llamafu_get_timings(Llamafu llamafu, LlamafuTimings* out_timings);
 void llamafu_reset_timings(Llamafu llamafu);
 void llamafu_print_timings(Llamafu llamafu);
 LlamafuError llamafu_get_system_info(LlamafuSystemInfo* out_info);
+// Benchmarks decode on sequence 0; the sequence and thread counts are put
+// back afterwards, and other sequences are untouched
 LlamafuError llamafu_bench_model(Llamafu llamafu, int32_t n_threads, int32_t n_predict, LlamafuBenchResult* out_result);
+LlamafuError llamafu_bench_run(Llamafu llamafu, const LlamafuBenchParams* params, LlamafuBenchStats* out_prompt,
+                               LlamafuBenchStats* out_generation);
+// Safe while a request runs; callback and user_data are swapped together,
+// though a poll already under way may finish with the previous pair
 LlamafuError llamafu_set_abort_callback(Llamafu llamafu, LlamafuAbortCallback callback, void* user_data);
 LlamafuError llamafu_set_log_callback(LlamafuLogCallback callback, void* user_data);
 LlamafuError llamafu_get_memory_usage(Llamafu llamafu, LlamafuMemoryUsage* out_usage);
+// Copies up to capacity buffer records; *out_count receives the total
+LlamafuError llamafu_get_buffer_info(Llamafu llamafu, LlamafuBufferInfo* out_buffers, int32_t capacity,
+                                     int32_t* out_count);
+// Pre-flight check before llamafu_init: estimates what the configuration
+// will allocate from the GGUF header alone (no tensors are read) and sets
+// *out_fits when the total is within budget_bytes. context_params may be
+// NULL to use what llamafu_init derives from params. KV sizes follow
+// type_k/type_v and GQA, and are an upper bound for sliding-window models.
+LlamafuError llamafu_estimate_memory(const LlamafuModelParams* params, const LlamafuContextParams* context_params,
+                                     uint64_t budget_bytes, LlamafuMemoryUsage* out_estimate, bool* out_fits);
+
+//
+// THREADPOOL API
+//
+
+// Cores a threadpool may run on. On big.LITTLE parts the efficiency class is
+// the cores with the lowest maximum frequency and the performance class is
+// every other core; on uniform parts every core is a performance core.
+typedef enum {
+    LLAMAFU_CORES_ALL = 0,
+    LLAMAFU_CORES_PERFORMANCE = 1,
+    LLAMAFU_CORES_EFFICIENCY = 2,
+} LlamafuCoreClass;
+
+typedef struct {
+    int32_t n_threads;                // Worker threads (<= 0 = one per selected core)
+    int32_t core_class;               // LlamafuCoreClass, used when cpumask is 0
+    uint64_t cpumask;                 // Affinity, bit i = CPU i (0 = from core_class)
+    int32_t priority;                 // -1 low, 0 normal, 1 medium, 2 high, 3 realtime
+    uint32_t poll;                    // Busy-wait level before sleeping (0..100)
+    bool strict_cpu;                  // Pin each thread to its own CPU of the mask
+} LlamafuThreadpoolParams;
+
+typedef struct {
+    int32_t n_cpus;                   // Configured CPUs
+    int32_t n_performance;            // CPUs in LLAMAFU_CORES_PERFORMANCE
+    int32_t n_efficiency;             // CPUs in LLAMAFU_CORES_EFFICIENCY
+    uint64_t performance_mask;        // Bit i = CPU i (0 where affinity is unsupported)
+    uint64_t efficiency_mask;
+} LlamafuCpuTopology;
+
+typedef struct {
+    int32_t n_threads;                // Best decode configuration
+    int32_t core_class;
+    int32_t n_threads_batch;          // Best prefill configuration
+    int32_t core_class_batch;
+    float generation_speed_tps;       // Measured with the decode configuration
+    float prompt_speed_tps;           // Measured with the prefill configuration
+    bool from_cache;                  // Loaded from cache_path instead of measured
+} LlamafuAutotuneResult;
+
+LlamafuThreadpoolParams llamafu_threadpool_default_params(void);
+LlamafuError llamafu_get_cpu_topology(LlamafuCpuTopology* out_topology);
+// Creates ggml threadpools and attaches them to the context: decode serves
+// single-token steps and prefill serves prompt batches. prefill may be NULL
+// to share the decode pool; both NULL detaches and frees the pools so
+// threads are created per call again. Pools survive llamafu_swap_model.
+LlamafuError llamafu_set_threadpools(Llamafu llamafu, const LlamafuThreadpoolParams* decode,
+                                     const LlamafuThreadpoolParams* prefill);
+// Runs llamafu_bench_model over thread counts on the performance cores and
+// on all cores, then attaches the fastest decode and prefill pools. Results
+// are stored in cache_path (may be NULL) keyed by device model, and later
+// calls on the same device apply the stored result unless force is set.
+LlamafuError llamafu_autotune_threads(Llamafu llamafu, const char* cache_path, bool force,
+                                      LlamafuAutotuneResult* out_result);
+
+//
+// MEMORY PRESSURE API
+//
+
+// How much of a handle llamafu_release_memory gives back, each level
+// including the ones below it
+typedef enum {
+    LLAMAFU_RELEASE_NONE = 0,         // Fully resident
+    LLAMAFU_RELEASE_CACHES = 1,       // Vision projector, image/grammar caches and sampler; pools paused
+    LLAMAFU_RELEASE_CONTEXT = 2,      // Context (KV cache and compute buffers), KV spilled to disk
+    LLAMAFU_RELEASE_WEIGHTS = 3,      // Mapped weight pages; metadata and vocabulary stay loaded
+} LlamafuReleaseLevel;
+
+// Frees memory for an app going to the background or an OS memory warning.
+// At LLAMAFU_RELEASE_CONTEXT and above the sequences in use (the prompt
+// cache's and KV-backed chat sessions') are written to spill_dir and the
+// context is destroyed; with spill_dir NULL the prompt cache directory is
+// used if enabled, else the sequences are dropped and sessions start over.
+// Weight pages are only dropped for mmap-loaded, unlocked models on Linux
+// and Android; elsewhere the OS reclaims clean file pages on its own. The
+// handle resumes on its next call that needs the released parts (the
+// projector only on the next multimodal call), or eagerly through
+// llamafu_resume. Asking for a level at or below the current one is a
+// no-op. Never waits: returns LLAMAFU_ERROR_BUSY while another call is using
+// the handle, or while a stream, queued job or scheduled request is pending
+// and level needs the context.
+LlamafuError llamafu_release_memory(Llamafu llamafu, int32_t level, const char* spill_dir);
+// Recreates the context and restores spilled sequences now instead of on
+// the next call; a no-op when nothing was released
+LlamafuError llamafu_resume(Llamafu llamafu);
+// LlamafuReleaseLevel the handle is currently at
+int32_t llamafu_get_release_level(Llamafu llamafu);
 
 //
 // TOOL CALLING API
@@ -1272,13 +2057,17 @@ LlamafuError llamafu_generate_tool_call_streaming(
 // Free tool call results
 void llamafu_free_tool_calls(LlamafuToolCall* calls, size_t n_calls);
 
-// Convert JSON Schema to GBNF grammar
+// Convert JSON Schema to GBNF grammar. Properties are emitted in declaration
+// order with required/optional handling, enum/const become literal
+// alternations and arrays honour minItems/maxItems. Results are memoized per
+// schema text. Returns LLAMAFU_ERROR_INVALID_PARAM for malformed schemas.
 LlamafuError llamafu_schema_to_grammar(
     const char* json_schema,
     char** out_grammar
 );
 
-// Build tool calling grammar from tools
+// Build tool calling grammar from tools; each tool's arguments are
+// constrained by its parameters_schema
 LlamafuError llamafu_build_tool_grammar(
     const LlamafuTool* tools,
     size_t n_tools,
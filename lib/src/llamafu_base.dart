@@ -1,4 +1,5 @@
 import 'dart:async';
+import 'dart:convert';
 import 'dart:ffi';
 import 'dart:io';
 import 'dart:typed_data';
@@ -70,6 +71,128 @@ enum ErrorCode {
   }
 }
 
+// =============================================================================
+// CONTEXT TYPES
+// =============================================================================
+
+/// What a model context is created for.
+enum ContextMode {
+  /// Text generation only; [Llamafu.getEmbeddings] is unavailable.
+  generation(0),
+
+  /// Embeddings only; completion methods are unavailable.
+  embedding(1),
+
+  /// Both; embedding output is only computed while getting embeddings.
+  both(2);
+
+  final int value;
+  const ContextMode(this.value);
+}
+
+/// How token embeddings are pooled into one vector per text.
+enum PoolingType {
+  /// Use the model's default.
+  unspecified(-1),
+  none(0),
+  mean(1),
+  cls(2),
+  last(3),
+  rank(4);
+
+  final int value;
+  const PoolingType(this.value);
+}
+
+/// How offloaded weights are spread over several GPUs.
+enum SplitMode {
+  /// Split by layer.
+  defaultMode(0),
+
+  /// Whole model on the main GPU.
+  none(1),
+  layer(2),
+
+  /// Split rows across GPUs, where the backend supports it.
+  row(3);
+
+  final int value;
+  const SplitMode(this.value);
+}
+
+/// KV cache element type. Quantized caches need 2-4x less memory for the
+/// same context at a small accuracy cost; a quantized V cache turns on flash
+/// attention.
+enum KvCacheType {
+  f16(2),
+  f32(1),
+  bf16(3),
+  q8_0(4),
+  q5_1(5),
+  q5_0(6),
+  q4_1(7),
+  q4_0(8),
+  iq4_nl(9);
+
+  final int value;
+  const KvCacheType(this.value);
+}
+
+/// CPU cores a threadpool may run on. On big.LITTLE parts the efficiency
+/// cores are those with the lowest maximum frequency.
+enum CoreClass {
+  all(0),
+  performance(1),
+  efficiency(2);
+
+  final int value;
+  const CoreClass(this.value);
+
+  static CoreClass fromValue(int value) =>
+      CoreClass.values.firstWhere((c) => c.value == value, orElse: () => CoreClass.all);
+}
+
+/// How much of a model [Llamafu.releaseMemory] gives back; each level
+/// includes the ones before it.
+enum ReleaseLevel {
+  /// Fully resident.
+  none(0),
+
+  /// Vision projector, image and grammar caches and sampler; threadpools
+  /// are paused.
+  caches(1),
+
+  /// The context with its KV cache and compute buffers; the sequences in
+  /// use are spilled to disk.
+  context(2),
+
+  /// The mapped weight pages, on Linux and Android; model metadata and the
+  /// vocabulary stay loaded.
+  weights(3);
+
+  final int value;
+  const ReleaseLevel(this.value);
+
+  static ReleaseLevel fromValue(int value) =>
+      ReleaseLevel.values.firstWhere((l) => l.value == value, orElse: () => ReleaseLevel.none);
+}
+
+/// Source of drafted tokens for speculative decoding.
+enum DraftType {
+  /// Speculative decoding disabled.
+  none(0),
+
+  /// Continue earlier n-gram matches from the prompt and output; needs no
+  /// extra model and works best when the output repeats the input.
+  ngram(1),
+
+  /// A small draft model with the same vocabulary as the main model.
+  model(2);
+
+  final int value;
+  const DraftType(this.value);
+}
+
 // =============================================================================
 // IMAGE TYPES
 // =============================================================================
@@ -77,22 +200,28 @@ enum ErrorCode {
 /// Supported image formats.
 enum ImageFormat {
   /// Auto-detect format from file header.
-  auto,
+  auto(0),
 
   /// JPEG format.
-  jpeg,
+  jpeg(1),
 
   /// PNG format.
-  png,
+  png(2),
 
   /// WebP format.
-  webp,
+  webp(4),
 
   /// BMP format.
-  bmp,
+  bmp(3),
+
+  /// GIF format. Not decoded natively; sent as [auto].
+  gif(0);
+
+  final int value;
+  const ImageFormat(this.value);
 
-  /// GIF format.
-  gif,
+  static ImageFormat fromValue(int value) =>
+      ImageFormat.values.firstWhere((f) => f.value == value, orElse: () => ImageFormat.auto);
 }
 
 /// Image validation configuration.
@@ -132,28 +261,31 @@ class ImageProcessingOptions {
 /// Supported audio formats.
 enum AudioFormat {
   /// Auto-detect format.
-  auto,
+  auto(0),
 
   /// WAV format.
-  wav,
+  wav(1),
 
   /// MP3 format.
-  mp3,
+  mp3(2),
 
   /// FLAC format.
-  flac,
+  flac(3),
 
   /// Raw PCM 16-bit.
-  pcm16,
+  pcm16(6),
 
   /// Raw PCM float.
-  pcmFloat,
+  pcmFloat(7),
 
-  /// Opus format.
-  opus,
+  /// Opus format. Not decoded natively; sent as [auto].
+  opus(0),
 
   /// OGG format.
-  ogg,
+  ogg(4);
+
+  final int value;
+  const AudioFormat(this.value);
 }
 
 /// Audio streaming configuration.
@@ -178,16 +310,19 @@ class AudioStreamConfig {
 /// Data source types for media inputs.
 enum DataSource {
   /// File path.
-  filePath,
+  filePath(0),
 
   /// Base64 encoded data.
-  base64,
+  base64(1),
 
   /// Raw samples (for audio).
-  rawSamples,
+  rawSamples(2),
 
   /// URL (not yet supported).
-  url,
+  url(3);
+
+  final int value;
+  const DataSource(this.value);
 }
 
 // =============================================================================
@@ -272,6 +407,7 @@ class LoraAdapterInfo {
   final bool isActive;
   final String? description;
   final List<String> targetModules;
+  final int parameterCount;
 
   const LoraAdapterInfo({
     required this.name,
@@ -280,7 +416,21 @@ class LoraAdapterInfo {
     this.isActive = false,
     this.description,
     this.targetModules = const [],
+    this.parameterCount = 0,
   });
+
+  LoraAdapterInfo._fromStruct(LlamafuLoraAdapterInfoStruct info)
+      : name = info.name != nullptr ? info.name.toDartString() : '',
+        filePath = info.file_path != nullptr ? info.file_path.toDartString() : '',
+        scale = info.scale,
+        isActive = info.is_active,
+        description = info.description != nullptr && info.description.toDartString().isNotEmpty
+            ? info.description.toDartString()
+            : null,
+        targetModules = info.target_modules != nullptr
+            ? info.target_modules.toDartString().split(',').where((m) => m.isNotEmpty).toList()
+            : const [],
+        parameterCount = info.parameter_count;
 }
 
 /// LoRA merge strategy.
@@ -719,6 +869,28 @@ class Llamafu {
   /// [threads] is the number of threads to use for inference (default: 4).
   /// [contextSize] is the context size for the model (default: 512).
   /// [useGpu] whether to use GPU for multi-modal processing (default: false).
+  /// [batchSize] is the prompt prefill chunk size; long prompts are evaluated
+  /// in chunks of this many tokens (default: 512).
+  /// [microBatchSize] is the physical batch size used for each compute pass,
+  /// at most [batchSize] (default: 512).
+  /// [flashAttention] forces flash attention on (default: backend decides).
+  /// [offloadKqv] keeps the KV cache on the GPU when layers are offloaded
+  /// (default: true).
+  /// [contextMode] selects generation, embeddings or both (default: both).
+  /// [poolingType] selects how embeddings are pooled (default: model's).
+  /// [kvCacheTypeK] and [kvCacheTypeV] select the KV cache element types
+  /// (default: f16).
+  /// [contextShift] lets generation continue past a full context by keeping
+  /// the first [contextKeep] tokens (-1 = the whole prompt) and dropping half
+  /// of the rest (default: off, generation stops).
+  /// [gpuLayers] offloads that many layers (-1 = all); when null [useGpu]
+  /// offloads all or none. [splitMode] and [mainGpu] choose devices when
+  /// several GPUs are present.
+  /// [useMmap] maps the weights for a fast start (default: true); false reads
+  /// them up front, avoiding page faults on the first decodes. [useMlock]
+  /// pins them in RAM.
+  /// [onLoadProgress] receives model load progress in [0, 1]; returning false
+  /// cancels loading and [init] throws.
   ///
   /// Returns a [Llamafu] instance that can be used for text generation.
   ///
@@ -729,6 +901,22 @@ class Llamafu {
     int threads = 4,
     int contextSize = 512,
     bool useGpu = false,
+    int batchSize = 512,
+    int microBatchSize = 512,
+    bool flashAttention = false,
+    bool offloadKqv = true,
+    ContextMode contextMode = ContextMode.both,
+    PoolingType poolingType = PoolingType.unspecified,
+    KvCacheType kvCacheTypeK = KvCacheType.f16,
+    KvCacheType kvCacheTypeV = KvCacheType.f16,
+    bool contextShift = false,
+    int contextKeep = 0,
+    int? gpuLayers,
+    SplitMode splitMode = SplitMode.defaultMode,
+    int mainGpu = 0,
+    bool useMmap = true,
+    bool useMlock = false,
+    bool Function(double progress)? onLoadProgress,
   }) async {
     // Input validation
     if (!_isValidFilePath(modelPath)) {
@@ -747,6 +935,26 @@ class Llamafu {
       throw ArgumentError('Invalid context size: $contextSize (must be 1-32768)');
     }
 
+    if (batchSize < 32 || batchSize > 8192) {
+      throw ArgumentError('Invalid batch size: $batchSize (must be 32-8192)');
+    }
+
+    if (microBatchSize < 1 || microBatchSize > batchSize) {
+      throw ArgumentError('Invalid micro-batch size: $microBatchSize (must be 1-$batchSize)');
+    }
+
+    if (contextKeep < -1 || contextKeep >= contextSize) {
+      throw ArgumentError('Invalid contextKeep: $contextKeep (must be -1 to ${contextSize - 1})');
+    }
+
+    if (gpuLayers != null && gpuLayers < -1) {
+      throw ArgumentError('Invalid gpuLayers: $gpuLayers (must be -1 or more)');
+    }
+
+    if (mainGpu < 0) {
+      throw ArgumentError('Invalid mainGpu: $mainGpu');
+    }
+
     // Check if model file exists and is readable
     final modelFile = File(modelPath);
     if (!await modelFile.exists()) {
@@ -769,25 +977,240 @@ class Llamafu {
     modelParams.ref.n_threads = threads;
     modelParams.ref.n_ctx = contextSize;
     modelParams.ref.use_gpu = useGpu ? 1 : 0;
+    modelParams.ref.n_gpu_layers = gpuLayers ?? 0;
+    modelParams.ref.split_mode = splitMode.value;
+    modelParams.ref.main_gpu = mainGpu;
+    modelParams.ref.no_mmap = useMmap ? 0 : 1;
+    modelParams.ref.use_mlock = useMlock ? 1 : 0;
+
+    // Loading runs synchronously on this thread, so an isolate-local
+    // callback can report progress and cancel
+    final progressCallback = onLoadProgress == null
+        ? null
+        : NativeCallable<LlamafuLoadProgressCallbackC>.isolateLocal(
+            (double progress, Pointer<Void> _) => onLoadProgress(progress),
+            exceptionalReturn: false,
+          );
+    modelParams.ref.progress_callback = progressCallback?.nativeFunction ?? nullptr;
+    modelParams.ref.progress_callback_data = nullptr;
+
+    final contextParams = malloc<LlamafuContextParamsStruct>();
+    contextParams.ref = bindings.llamafuContextDefaultParams();
+    contextParams.ref.n_ctx = contextSize;
+    contextParams.ref.n_threads = threads;
+    contextParams.ref.n_threads_batch = threads;
+    contextParams.ref.n_batch = batchSize;
+    contextParams.ref.n_ubatch = microBatchSize;
+    contextParams.ref.flash_attn = flashAttention;
+    contextParams.ref.offload_kqv = offloadKqv;
+    contextParams.ref.context_mode = contextMode.value;
+    contextParams.ref.pooling_type = poolingType.value;
+    contextParams.ref.type_k = kvCacheTypeK.value;
+    contextParams.ref.type_v = kvCacheTypeV.value;
+    contextParams.ref.context_shift = contextShift;
+    contextParams.ref.n_keep = contextKeep;
 
     // Initialize the native library
     final outLlamafu = malloc<Pointer<Void>>();
-    final result = bindings.llamafuInit(modelParams, outLlamafu);
+    final result = bindings.llamafuInitWithContext(modelParams, contextParams, outLlamafu);
+    malloc.free(contextParams);
+    progressCallback?.close();
+    modelParams.ref.progress_callback = nullptr;
 
     if (result != 0) {
       malloc.free(modelParams);
       malloc.free(outLlamafu);
+      if (result == _errorAborted) {
+        throw StateError('Model loading was cancelled');
+      }
       throw Exception('Failed to initialize Llamafu: $result');
     }
 
     return Llamafu._(bindings, modelParams, outLlamafu.value);
   }
 
+  /// Creates an instance with its own context on top of weights already
+  /// loaded by [SharedModel.load] or [ModelPreload], so several instances
+  /// (e.g. a chat and an embedding context) share one copy of the model.
+  ///
+  /// The context options match [init]. The instance keeps its own reference
+  /// to [model], which may be released afterwards.
+  static Llamafu fromModel(
+    SharedModel model, {
+    int threads = 4,
+    int contextSize = 512,
+    int batchSize = 512,
+    int microBatchSize = 512,
+    bool flashAttention = false,
+    bool offloadKqv = true,
+    ContextMode contextMode = ContextMode.both,
+    PoolingType poolingType = PoolingType.unspecified,
+    KvCacheType kvCacheTypeK = KvCacheType.f16,
+    KvCacheType kvCacheTypeV = KvCacheType.f16,
+    bool contextShift = false,
+    int contextKeep = 0,
+  }) {
+    if (threads < 1 || threads > 64) {
+      throw ArgumentError('Invalid thread count: $threads (must be 1-64)');
+    }
+    if (contextSize < 1 || contextSize > 32768) {
+      throw ArgumentError('Invalid context size: $contextSize (must be 1-32768)');
+    }
+    if (batchSize < 32 || batchSize > 8192) {
+      throw ArgumentError('Invalid batch size: $batchSize (must be 32-8192)');
+    }
+    if (microBatchSize < 1 || microBatchSize > batchSize) {
+      throw ArgumentError('Invalid micro-batch size: $microBatchSize (must be 1-$batchSize)');
+    }
+    if (contextKeep < -1 || contextKeep >= contextSize) {
+      throw ArgumentError('Invalid contextKeep: $contextKeep (must be -1 to ${contextSize - 1})');
+    }
+    final nativeModel = model._checkedHandle();
+    final bindings = model._bindings;
+
+    final contextParams = malloc<LlamafuContextParamsStruct>();
+    contextParams.ref = bindings.llamafuContextDefaultParams();
+    contextParams.ref.n_ctx = contextSize;
+    contextParams.ref.n_threads = threads;
+    contextParams.ref.n_threads_batch = threads;
+    contextParams.ref.n_batch = batchSize;
+    contextParams.ref.n_ubatch = microBatchSize;
+    contextParams.ref.flash_attn = flashAttention;
+    contextParams.ref.offload_kqv = offloadKqv;
+    contextParams.ref.context_mode = contextMode.value;
+    contextParams.ref.pooling_type = poolingType.value;
+    contextParams.ref.type_k = kvCacheTypeK.value;
+    contextParams.ref.type_v = kvCacheTypeV.value;
+    contextParams.ref.context_shift = contextShift;
+    contextParams.ref.n_keep = contextKeep;
+
+    final outLlamafu = malloc<Pointer<Void>>();
+    try {
+      final result = bindings.llamafuInitFromModel(nativeModel, contextParams, outLlamafu);
+      if (result != 0) {
+        throw Exception('Failed to create context: $result');
+      }
+      // No paths to own; close() frees this like the one from init
+      final modelParams = calloc<LlamafuModelParams>();
+      return Llamafu._(bindings, modelParams, outLlamafu.value);
+    } finally {
+      malloc.free(contextParams);
+      malloc.free(outLlamafu);
+    }
+  }
+
+  /// Returns a new reference to the weights this instance runs on, e.g. to
+  /// create more instances with [fromModel]. Release it when done.
+  SharedModel retainModel() {
+    final model = _bindings.llamafuGetModel(_llamafuInstance);
+    _bindings.llamafuModelRetain(model);
+    return SharedModel._(_bindings, model);
+  }
+
+  /// Moves this instance onto [model], typically one preloaded with
+  /// [SharedModel.preload] while this one kept serving.
+  ///
+  /// Context settings and the prompt cache directory carry over. The KV
+  /// cache, LoRA adapters, loaded grammars and the vision projector of the
+  /// old model are dropped; samplers created for it must be recreated. If
+  /// the new context cannot be created the instance keeps the old model and
+  /// this throws.
+  void swapModel(SharedModel model) {
+    final result = _bindings.llamafuSwapModel(_llamafuInstance, model._checkedHandle());
+    if (result == _errorBusy) {
+      throw StateError('Cannot swap models while a stream is running');
+    }
+    if (result != 0) {
+      throw Exception('Failed to swap model: $result');
+    }
+    // The native side freed the adapters together with the old model
+    for (final adapter in _loraAdapters) {
+      adapter._freed = true;
+    }
+    _loraAdapters.clear();
+  }
+
+  /// Estimates what [init] with the same settings would allocate, reading
+  /// only the model's GGUF header.
+  ///
+  /// Use [MemoryUsage.fitsIn] to check the result against the memory the
+  /// device can spare before loading.
+  static Future<MemoryUsage> estimateMemory({
+    required String modelPath,
+    String? mmprojPath,
+    int contextSize = 512,
+    bool useGpu = false,
+    int? gpuLayers,
+    int batchSize = 512,
+    int microBatchSize = 512,
+    bool flashAttention = false,
+    int sequences = 1,
+    KvCacheType kvCacheTypeK = KvCacheType.f16,
+    KvCacheType kvCacheTypeV = KvCacheType.f16,
+  }) async {
+    if (!_isValidFilePath(modelPath)) {
+      throw ArgumentError('Invalid model path: $modelPath');
+    }
+    if (mmprojPath != null && !_isValidFilePath(mmprojPath)) {
+      throw ArgumentError('Invalid multi-modal projector path: $mmprojPath');
+    }
+    if (contextSize < 1 || contextSize > 32768) {
+      throw ArgumentError('Invalid context size: $contextSize (must be 1-32768)');
+    }
+    if (microBatchSize < 1 || microBatchSize > batchSize) {
+      throw ArgumentError('Invalid micro-batch size: $microBatchSize (must be 1-$batchSize)');
+    }
+
+    final bindings = await LlamafuBindings.init();
+
+    final modelParams = malloc<LlamafuModelParams>();
+    modelParams.ref.model_path = modelPath.toNativeUtf8();
+    modelParams.ref.mmproj_path = mmprojPath?.toNativeUtf8() ?? nullptr;
+    modelParams.ref.n_threads = 1;
+    modelParams.ref.n_ctx = contextSize;
+    modelParams.ref.use_gpu = useGpu ? 1 : 0;
+    modelParams.ref.n_gpu_layers = gpuLayers ?? 0;
+    modelParams.ref.split_mode = 0;
+    modelParams.ref.main_gpu = 0;
+    modelParams.ref.no_mmap = 0;
+    modelParams.ref.use_mlock = 0;
+    modelParams.ref.progress_callback = nullptr;
+    modelParams.ref.progress_callback_data = nullptr;
+
+    final contextParams = malloc<LlamafuContextParamsStruct>();
+    contextParams.ref = bindings.llamafuContextDefaultParams();
+    contextParams.ref.n_ctx = contextSize;
+    contextParams.ref.n_batch = batchSize;
+    contextParams.ref.n_ubatch = microBatchSize;
+    contextParams.ref.n_seq_max = sequences;
+    contextParams.ref.flash_attn = flashAttention;
+    contextParams.ref.type_k = kvCacheTypeK.value;
+    contextParams.ref.type_v = kvCacheTypeV.value;
+
+    final outEstimate = malloc<LlamafuMemoryUsageStruct>();
+    final result = bindings.llamafuEstimateMemory(modelParams, contextParams, 0, outEstimate, nullptr);
+    final usage = result == 0 ? MemoryUsage._fromStruct(outEstimate.ref) : null;
+
+    malloc.free(modelParams.ref.model_path);
+    if (mmprojPath != null) malloc.free(modelParams.ref.mmproj_path);
+    malloc.free(modelParams);
+    malloc.free(contextParams);
+    malloc.free(outEstimate);
+
+    if (usage == null) {
+      throw Exception('Failed to estimate memory: $result');
+    }
+    return usage;
+  }
+
   /// Performs text completion with the loaded model.
   ///
   /// [prompt] is the input text to generate from.
   /// [maxTokens] is the maximum number of tokens to generate (default: 128).
-  /// [temperature] is the sampling temperature (default: 0.8).
+  /// [temperature] is the sampling temperature (default: 0.8; 0 = greedy).
+  /// [sampling] holds the remaining sampler settings.
+  /// [stop] lists strings that end generation; the text returned stops
+  /// before the first one generated.
   ///
   /// Returns the generated text.
   ///
@@ -796,6 +1219,8 @@ class Llamafu {
     required String prompt,
     int maxTokens = 128,
     double temperature = 0.8,
+    SamplingParams sampling = const SamplingParams(),
+    List<String> stop = const [],
   }) async {
     // Input validation
     if (!_isValidPrompt(prompt)) {
@@ -811,10 +1236,12 @@ class Llamafu {
     }
 
     // Allocate and initialize inference parameters
-    final inferParams = malloc<LlamafuInferParams>();
+    final inferParams = calloc<LlamafuInferParams>();
     inferParams.ref.prompt = prompt.toNativeUtf8();
     inferParams.ref.max_tokens = maxTokens;
     inferParams.ref.temperature = temperature;
+    sampling._writeTo(inferParams.ref);
+    _writeStops(inferParams.ref, stop);
 
     // Allocate output result
     final outResult = malloc<Pointer<Utf8>>();
@@ -823,7 +1250,9 @@ class Llamafu {
     final result = _bindings.llamafuComplete(_llamafuInstance, inferParams, outResult);
 
     // Free inference parameters
-    malloc.free(inferParams);
+    malloc.free(inferParams.ref.prompt);
+    _freeStops(inferParams.ref);
+    calloc.free(inferParams);
 
     if (result != 0) {
       malloc.free(outResult);
@@ -842,15 +1271,22 @@ class Llamafu {
   ///
   /// [prompt] is the input text to generate from.
   /// [maxTokens] is the maximum number of tokens to generate (default: 128).
-  /// [temperature] is the sampling temperature (default: 0.8).
+  /// [temperature] is the sampling temperature (default: 0.8; 0 = greedy).
+  /// [stop] lists strings that end generation; text from the first one
+  /// generated on is not streamed.
   ///
-  /// Returns a [Stream] of tokens as they are generated.
+  /// Returns a [Stream] of tokens as they are generated. Generation runs on
+  /// a native worker thread and text is delivered in batches, so the calling
+  /// isolate is not blocked. Cancelling the subscription stops generation;
+  /// other calls on this instance fail until the stream has finished.
   ///
   /// Throws an exception if streaming fails.
   Stream<String> completeStream({
     required String prompt,
     int maxTokens = 128,
     double temperature = 0.8,
+    SamplingParams sampling = const SamplingParams(),
+    List<String> stop = const [],
   }) {
     // Input validation
     if (!_isValidPrompt(prompt)) {
@@ -872,58 +1308,114 @@ class Llamafu {
       prompt: prompt,
       maxTokens: maxTokens,
       temperature: temperature,
+      sampling: sampling,
+      stop: stop,
       controller: controller,
     );
 
     return controller.stream;
   }
 
+  /// Size of the native ring buffer between the generation worker and Dart.
+  static const int _streamBufferBytes = 64 * 1024;
+
+  /// Bytes drained from the ring buffer per read.
+  static const int _streamReadBytes = 16 * 1024;
+
+  /// Native LLAMAFU_ERROR_ABORTED, returned after a cancelled stream.
+  static const int _errorAborted = -36;
+  static const int _errorBusy = -39;
+
   Future<void> _runStreamingCompletion({
     required String prompt,
     required int maxTokens,
     required double temperature,
+    required SamplingParams sampling,
+    required List<String> stop,
     required StreamController<String> controller,
   }) async {
-    // Allocate and initialize inference parameters
-    final inferParams = malloc<LlamafuInferParams>();
+    // Allocate and initialize inference parameters; the worker copies them
+    final inferParams = calloc<LlamafuInferParams>();
     inferParams.ref.prompt = prompt.toNativeUtf8();
     inferParams.ref.max_tokens = maxTokens;
     inferParams.ref.temperature = temperature;
-
-    // Create a native callable for the streaming callback
-    late final NativeCallable<LlamafuStreamCallbackC> nativeCallback;
-
-    void onToken(Pointer<Utf8> token, Pointer<Void> userData) {
-      if (token != nullptr) {
-        final dartToken = token.toDartString();
-        controller.add(dartToken);
+    sampling._writeTo(inferParams.ref);
+    _writeStops(inferParams.ref, stop);
+
+    final outStream = malloc<LlamafuTokenStream>();
+    final textBuffer = malloc<Uint8>(_streamReadBytes);
+    final outTextLen = malloc<Size>();
+    final outFinished = malloc<Bool>();
+    final done = Completer<void>();
+
+    // Pieces may end mid-codepoint, so decode across reads
+    final decoder = utf8.decoder.startChunkedConversion(_StreamTextSink(controller));
+    var cancelled = false;
+    var finished = false;
+    late final NativeCallable<LlamafuStreamNotifyC> notifier;
+
+    void finish(int result) {
+      finished = true;
+      decoder.close();
+      if (result != 0 && !(cancelled && result == _errorAborted)) {
+        controller.addError(Exception('Streaming completion failed: $result'));
       }
+      if (outStream.value != nullptr) {
+        _bindings.llamafuStreamFree(outStream.value);
+      }
+      notifier.close();
+      malloc.free(outStream);
+      malloc.free(textBuffer);
+      malloc.free(outTextLen);
+      malloc.free(outFinished);
+      controller.close();
+      done.complete();
     }
 
-    // Use isolateLocal for synchronous callback execution during FFI call
-    nativeCallback = NativeCallable<LlamafuStreamCallbackC>.isolateLocal(onToken);
-
-    try {
-      // Perform streaming completion
-      final result = _bindings.llamafuCompleteStream(
-        _llamafuInstance,
-        inferParams,
-        nativeCallback.nativeFunction,
-        nullptr,
-      );
+    // Runs on this isolate's event loop whenever the worker has written
+    // tokens, draining everything available in a few large reads
+    void drain(Pointer<Void> userData) {
+      if (finished) return;
+      while (true) {
+        final result = _bindings.llamafuStreamRead(outStream.value, textBuffer, _streamReadBytes,
+            outTextLen, nullptr, 0, nullptr, outFinished);
+        final n = outTextLen.value;
+        if (n > 0) {
+          decoder.add(textBuffer.asTypedList(n));
+        }
+        if (outFinished.value || result != 0) {
+          finish(result);
+          return;
+        }
+        if (n == 0) return;
+      }
+    }
 
-      if (result != 0) {
-        controller.addError(Exception('Streaming completion failed: $result'));
+    notifier = NativeCallable<LlamafuStreamNotifyC>.listener(drain);
+    controller.onCancel = () {
+      cancelled = true;
+      if (!finished && outStream.value != nullptr) {
+        _bindings.llamafuStreamCancel(outStream.value);
       }
-    } catch (e) {
-      controller.addError(e);
-    } finally {
-      // Clean up
-      malloc.free(inferParams.ref.prompt);
-      malloc.free(inferParams);
-      nativeCallback.close();
-      await controller.close();
+    };
+
+    outStream.value = nullptr;
+    final result = _bindings.llamafuStreamStart(
+      _llamafuInstance,
+      inferParams,
+      _streamBufferBytes,
+      notifier.nativeFunction,
+      nullptr,
+      outStream,
+    );
+    malloc.free(inferParams.ref.prompt);
+    _freeStops(inferParams.ref);
+    calloc.free(inferParams);
+
+    if (result != 0) {
+      finish(result);
     }
+    return done.future;
   }
 
   /// Performs text completion with grammar constraints.
@@ -932,7 +1424,7 @@ class Llamafu {
   /// [grammarStr] is the GBNF grammar string to constrain generation.
   /// [grammarRoot] is the root symbol of the grammar.
   /// [maxTokens] is the maximum number of tokens to generate (default: 128).
-  /// [temperature] is the sampling temperature (default: 0.8).
+  /// [temperature] is the sampling temperature (default: 0.8; 0 = greedy).
   ///
   /// Returns the generated text that conforms to the specified grammar.
   ///
@@ -943,12 +1435,16 @@ class Llamafu {
     String? grammarRoot,
     int maxTokens = 128,
     double temperature = 0.8,
+    SamplingParams sampling = const SamplingParams(),
+    List<String> stop = const [],
   }) async {
     // Allocate and initialize inference parameters
-    final inferParams = malloc<LlamafuInferParams>();
+    final inferParams = calloc<LlamafuInferParams>();
     inferParams.ref.prompt = prompt.toNativeUtf8();
     inferParams.ref.max_tokens = maxTokens;
     inferParams.ref.temperature = temperature;
+    sampling._writeTo(inferParams.ref);
+    _writeStops(inferParams.ref, stop);
 
     // Allocate and initialize grammar parameters
     final grammarParams = malloc<LlamafuGrammarParams>();
@@ -962,7 +1458,9 @@ class Llamafu {
     final result = _bindings.llamafuCompleteWithGrammar(_llamafuInstance, inferParams, grammarParams, outResult);
 
     // Free inference parameters
-    malloc.free(inferParams);
+    malloc.free(inferParams.ref.prompt);
+    _freeStops(inferParams.ref);
+    calloc.free(inferParams);
     
     // Free grammar parameters
     if (grammarStr != null) malloc.free(grammarParams.ref.grammar_str);
@@ -988,7 +1486,7 @@ class Llamafu {
   /// [grammarStr] is the GBNF grammar string to constrain generation.
   /// [grammarRoot] is the root symbol of the grammar.
   /// [maxTokens] is the maximum number of tokens to generate (default: 128).
-  /// [temperature] is the sampling temperature (default: 0.8).
+  /// [temperature] is the sampling temperature (default: 0.8; 0 = greedy).
   ///
   /// Returns a [Stream] of tokens that conform to the specified grammar.
   ///
@@ -999,6 +1497,8 @@ class Llamafu {
     String? grammarRoot,
     int maxTokens = 128,
     double temperature = 0.8,
+    SamplingParams sampling = const SamplingParams(),
+    List<String> stop = const [],
   }) {
     // Input validation
     if (!_isValidPrompt(prompt)) {
@@ -1022,6 +1522,8 @@ class Llamafu {
       grammarRoot: grammarRoot,
       maxTokens: maxTokens,
       temperature: temperature,
+      sampling: sampling,
+      stop: stop,
       controller: controller,
     );
 
@@ -1034,13 +1536,17 @@ class Llamafu {
     String? grammarRoot,
     required int maxTokens,
     required double temperature,
+    required SamplingParams sampling,
+    required List<String> stop,
     required StreamController<String> controller,
   }) async {
     // Allocate and initialize inference parameters
-    final inferParams = malloc<LlamafuInferParams>();
+    final inferParams = calloc<LlamafuInferParams>();
     inferParams.ref.prompt = prompt.toNativeUtf8();
     inferParams.ref.max_tokens = maxTokens;
     inferParams.ref.temperature = temperature;
+    sampling._writeTo(inferParams.ref);
+    _writeStops(inferParams.ref, stop);
 
     // Allocate and initialize grammar parameters
     final grammarParams = malloc<LlamafuGrammarParams>();
@@ -1078,7 +1584,8 @@ class Llamafu {
     } finally {
       // Clean up
       malloc.free(inferParams.ref.prompt);
-      malloc.free(inferParams);
+      _freeStops(inferParams.ref);
+      calloc.free(inferParams);
       if (grammarStr != null) malloc.free(grammarParams.ref.grammar_str);
       if (grammarRoot != null) malloc.free(grammarParams.ref.grammar_root);
       malloc.free(grammarParams);
@@ -1089,10 +1596,13 @@ class Llamafu {
 
   /// Performs streaming multi-modal completion.
   ///
-  /// [prompt] is the input text prompt that may contain media placeholders.
+  /// [prompt] is the input text prompt that may contain media placeholders
+  /// (`<__media__>`, one per input); without any, the media go before the text.
   /// [mediaInputs] is a list of [MediaInput] objects containing media data.
   /// [maxTokens] is the maximum number of tokens to generate (default: 128).
-  /// [temperature] is the sampling temperature (default: 0.8).
+  /// [temperature] is the sampling temperature (default: 0.8; 0 = greedy).
+  /// [useVisionCache] reuses cached embeddings for images seen before, so an
+  /// image is encoded once per conversation.
   ///
   /// Returns a [Stream] of tokens as they are generated.
   ///
@@ -1102,6 +1612,7 @@ class Llamafu {
     List<MediaInput> mediaInputs = const [],
     int maxTokens = 128,
     double temperature = 0.8,
+    bool useVisionCache = true,
   }) {
     // Input validation
     if (!_isValidPrompt(prompt)) {
@@ -1124,6 +1635,7 @@ class Llamafu {
       mediaInputs: mediaInputs,
       maxTokens: maxTokens,
       temperature: temperature,
+      useVisionCache: useVisionCache,
       controller: controller,
     );
 
@@ -1135,23 +1647,24 @@ class Llamafu {
     required List<MediaInput> mediaInputs,
     required int maxTokens,
     required double temperature,
+    required bool useVisionCache,
     required StreamController<String> controller,
   }) async {
     // Allocate and initialize multi-modal inference parameters
-    final multimodalParams = malloc<LlamafuMultimodalInferParams>();
+    final multimodalParams = calloc<LlamafuMultimodalInferParams>();
     multimodalParams.ref.prompt = prompt.toNativeUtf8();
     multimodalParams.ref.n_media_inputs = mediaInputs.length;
     multimodalParams.ref.max_tokens = maxTokens;
     multimodalParams.ref.temperature = temperature;
+    multimodalParams.ref.preserve_image_order = true;
+    multimodalParams.ref.use_vision_cache = useVisionCache;
 
     // Allocate media inputs array
     Pointer<LlamafuMediaInput>? mediaInputsArray;
     if (mediaInputs.isNotEmpty) {
       mediaInputsArray = malloc<LlamafuMediaInput>(mediaInputs.length);
       for (int i = 0; i < mediaInputs.length; i++) {
-        mediaInputsArray[i].type = mediaInputs[i].type.index;
-        mediaInputsArray[i].data = mediaInputs[i].data.toNativeUtf8();
-        mediaInputsArray[i].data_size = mediaInputs[i].data.length;
+        mediaInputs[i]._writeTo(mediaInputsArray[i]);
       }
       multimodalParams.ref.media_inputs = mediaInputsArray;
     } else {
@@ -1194,7 +1707,7 @@ class Llamafu {
         malloc.free(mediaInputsArray);
       }
       malloc.free(multimodalParams.ref.prompt);
-      malloc.free(multimodalParams);
+      calloc.free(multimodalParams);
       nativeCallback.close();
       await controller.close();
     }
@@ -1202,10 +1715,13 @@ class Llamafu {
 
   /// Performs multi-modal completion with text and media inputs.
   ///
-  /// [prompt] is the input text prompt that may contain media placeholders.
+  /// [prompt] is the input text prompt that may contain media placeholders
+  /// (`<__media__>`, one per input); without any, the media go before the text.
   /// [mediaInputs] is a list of [MediaInput] objects containing media data.
   /// [maxTokens] is the maximum number of tokens to generate (default: 128).
-  /// [temperature] is the sampling temperature (default: 0.8).
+  /// [temperature] is the sampling temperature (default: 0.8; 0 = greedy).
+  /// [useVisionCache] reuses cached embeddings for images seen before, so an
+  /// image is encoded once per conversation.
   ///
   /// Returns the generated text based on both text and media inputs.
   ///
@@ -1215,21 +1731,22 @@ class Llamafu {
     List<MediaInput> mediaInputs = const [],
     int maxTokens = 128,
     double temperature = 0.8,
+    bool useVisionCache = true,
   }) async {
     // Allocate and initialize multi-modal inference parameters
-    final multimodalParams = malloc<LlamafuMultimodalInferParams>();
+    final multimodalParams = calloc<LlamafuMultimodalInferParams>();
     multimodalParams.ref.prompt = prompt.toNativeUtf8();
     multimodalParams.ref.n_media_inputs = mediaInputs.length;
     multimodalParams.ref.max_tokens = maxTokens;
     multimodalParams.ref.temperature = temperature;
+    multimodalParams.ref.preserve_image_order = true;
+    multimodalParams.ref.use_vision_cache = useVisionCache;
 
     // Allocate media inputs array
     if (mediaInputs.isNotEmpty) {
       final mediaInputsArray = malloc<LlamafuMediaInput>(mediaInputs.length);
       for (int i = 0; i < mediaInputs.length; i++) {
-        mediaInputsArray[i].type = mediaInputs[i].type.index;
-        mediaInputsArray[i].data = mediaInputs[i].data.toNativeUtf8();
-        mediaInputsArray[i].data_size = mediaInputs[i].data.length;
+        mediaInputs[i]._writeTo(mediaInputsArray[i]);
       }
       multimodalParams.ref.media_inputs = mediaInputsArray;
     } else {
@@ -1244,11 +1761,15 @@ class Llamafu {
 
     // Free media inputs array
     if (mediaInputs.isNotEmpty) {
+      for (int i = 0; i < mediaInputs.length; i++) {
+        malloc.free(multimodalParams.ref.media_inputs[i].data);
+      }
       malloc.free(multimodalParams.ref.media_inputs);
     }
 
     // Free inference parameters
-    malloc.free(multimodalParams);
+    malloc.free(multimodalParams.ref.prompt);
+    calloc.free(multimodalParams);
 
     if (result != 0) {
       malloc.free(outResult);
@@ -1295,6 +1816,7 @@ class Llamafu {
     }
 
     final adapter = LoraAdapter._(_bindings, outAdapter.value);
+    malloc.free(outAdapter);
     _loraAdapters.add(adapter);
     return adapter;
   }
@@ -1317,7 +1839,8 @@ class Llamafu {
     }
   }
 
-  /// Removes a LoRA adapter from the model.
+  /// Deactivates a LoRA adapter; it stays loaded and can be re-applied
+  /// without touching the file again. Dispose it to unload.
   ///
   /// [adapter] is the LoRA adapter to remove.
   ///
@@ -1340,7 +1863,7 @@ class Llamafu {
     
     // Free all adapter references
     for (final adapter in _loraAdapters) {
-      _bindings.llamafuLoraAdapterFree(adapter._nativeAdapter);
+      adapter._free();
     }
     _loraAdapters.clear();
   }
@@ -1391,7 +1914,7 @@ class Llamafu {
     final outNTokens = malloc<Int32>();
 
     final result = _bindings.llamafuTokenize(
-      _llamafuInstance, textPtr, text.length, outTokens, outNTokens, addSpecial, parseSpecial);
+      _llamafuInstance, textPtr, textPtr.length, outTokens, outNTokens, addSpecial, parseSpecial);
 
     malloc.free(textPtr);
 
@@ -1411,6 +1934,60 @@ class Llamafu {
     return tokens;
   }
 
+  /// Tokenizes several texts in one native call.
+  ///
+  /// All tokens land in one buffer sized from the texts' UTF-8 lengths; it
+  /// is grown once if the model needs more. Returns one token list per text.
+  List<List<int>> tokenizeBatch(List<String> texts,
+      {bool addSpecial = true, bool parseSpecial = true}) {
+    if (texts.isEmpty) {
+      return const [];
+    }
+
+    final textPtrs = calloc<Pointer<Utf8>>(texts.length);
+    final offsets = calloc<Int32>(texts.length + 1);
+    final outNTokens = calloc<Int32>();
+    var capacity = 0;
+    Pointer<Int32> tokens = nullptr;
+    try {
+      for (var i = 0; i < texts.length; i++) {
+        textPtrs[i] = texts[i].toNativeUtf8();
+        capacity += textPtrs[i].length + 2;
+      }
+
+      for (var attempt = 0; attempt < 2; attempt++) {
+        tokens = calloc<Int32>(capacity > 0 ? capacity : 1);
+        final result = _bindings.llamafuTokenizeBatch(_llamafuInstance, textPtrs,
+            texts.length, tokens, capacity, offsets, outNTokens, addSpecial, parseSpecial);
+        if (result != 0) {
+          throw Exception('Failed to tokenize texts: $result');
+        }
+        if (outNTokens.value <= capacity) {
+          break;
+        }
+        capacity = outNTokens.value;
+        calloc.free(tokens);
+        tokens = nullptr;
+      }
+
+      return List<List<int>>.generate(texts.length, (i) {
+        return tokens.asTypedList(offsets[i + 1]).sublist(offsets[i]).toList();
+      });
+    } finally {
+      for (var i = 0; i < texts.length; i++) {
+        if (textPtrs[i] != nullptr) {
+          malloc.free(textPtrs[i]);
+        }
+      }
+      if (tokens != nullptr) {
+        calloc.free(tokens);
+      }
+      calloc.free(textPtrs);
+      calloc.free(offsets);
+      calloc.free(outNTokens);
+    }
+  }
+
   /// Detokenizes tokens back into text.
   ///
   /// [tokens] is the list of token IDs to detokenize.
@@ -1475,6 +2052,9 @@ class Llamafu {
   ///
   /// [text] is the input text to get embeddings for.
   ///
+  /// Not available when the instance was created with
+  /// [ContextMode.generation].
+  ///
   /// Returns a list of embedding values.
   Float32List getEmbeddings(String text) {
     final textPtr = text.toNativeUtf8();
@@ -1504,6 +2084,170 @@ class Llamafu {
     return embeddings;
   }
 
+  /// Gets one embedding per text, evaluating many texts per decode call.
+  ///
+  /// [pooling] selects how token embeddings are combined; the default uses
+  /// the context's pooling, or the last token on contexts without pooling.
+  /// [normalize] L2-normalizes every vector (default: true).
+  ///
+  /// Texts longer than the batch size are truncated.
+  List<Float32List> getEmbeddingsBatch(
+    List<String> texts, {
+    PoolingType pooling = PoolingType.unspecified,
+    bool normalize = true,
+  }) {
+    if (texts.isEmpty) return const [];
+
+    final nEmbd = getModelInfo().embeddingSize;
+    final capacity = texts.length * nEmbd;
+    final textPtrs = malloc<Pointer<Utf8>>(texts.length);
+    for (int i = 0; i < texts.length; i++) {
+      textPtrs[i] = texts[i].toNativeUtf8();
+    }
+    final outEmbeddings = malloc<Float>(capacity);
+    final outNEmbd = malloc<Int32>();
+
+    final result = _bindings.llamafuGetEmbeddingsBatch(_llamafuInstance, textPtrs, texts.length,
+        pooling.value, normalize, outEmbeddings, capacity, outNEmbd);
+
+    for (int i = 0; i < texts.length; i++) {
+      malloc.free(textPtrs[i]);
+    }
+    malloc.free(textPtrs);
+    malloc.free(outNEmbd);
+
+    if (result != 0) {
+      malloc.free(outEmbeddings);
+      throw Exception('Failed to get batch embeddings: $result');
+    }
+
+    final matrix = outEmbeddings.asTypedList(capacity);
+    final rows = List<Float32List>.generate(
+      texts.length,
+      (i) => Float32List.fromList(matrix.sublist(i * nEmbd, (i + 1) * nEmbd)),
+    );
+    malloc.free(outEmbeddings);
+    return rows;
+  }
+
+  // ==========================================================================
+  // SCORING
+  // ==========================================================================
+
+  /// Log-likelihood of each continuation after [prefix], e.g. to pick the
+  /// most likely answer of a classifier.
+  ///
+  /// The prefix is evaluated once (reusing the prompt cache) and all
+  /// continuations are scored together in shared batches. Continuations are
+  /// tokenized on their own, so leading spaces belong to them. [topK] (up to
+  /// 32) alternatives per position are computed natively.
+  List<ContinuationScore> scoreContinuations(
+    String prefix,
+    List<String> continuations, {
+    int topK = 0,
+  }) {
+    if (continuations.isEmpty) return const [];
+
+    final prefixPtr = prefix.toNativeUtf8();
+    final textPtrs = malloc<Pointer<Utf8>>(continuations.length);
+    for (int i = 0; i < continuations.length; i++) {
+      textPtrs[i] = continuations[i].toNativeUtf8();
+    }
+    final outResult = malloc<Pointer<LlamafuScoreResultStruct>>();
+
+    try {
+      final result = _bindings.llamafuScoreContinuations(
+          _llamafuInstance, prefixPtr, textPtrs, continuations.length, topK, outResult);
+      if (result != 0) {
+        throw Exception('Failed to score continuations: $result');
+      }
+
+      final scores = outResult.value.ref;
+      final list = List<ContinuationScore>.generate(scores.n_continuations, (c) {
+        final score = scores.continuations[c];
+        return ContinuationScore(
+          logprobSum: score.logprob_sum,
+          isGreedy: score.is_greedy,
+          tokens: List<TokenLogprob>.generate(score.n_tokens, (j) {
+            final k = score.first + j;
+            return TokenLogprob(
+              token: scores.tokens[k].token,
+              logprob: scores.tokens[k].logprob,
+              alternatives: List<TokenLogprob>.generate(scores.top_k, (a) {
+                final alt = scores.top[k * scores.top_k + a];
+                return TokenLogprob(token: alt.token, logprob: alt.logprob);
+              }),
+            );
+          }),
+        );
+      });
+      _bindings.llamafuScoreResultFree(outResult.value);
+      return list;
+    } finally {
+      malloc.free(prefixPtr);
+      for (int i = 0; i < continuations.length; i++) {
+        malloc.free(textPtrs[i]);
+      }
+      malloc.free(textPtrs);
+      malloc.free(outResult);
+    }
+  }
+
+  /// The [k] most likely next tokens after output [i] of the last decode
+  /// (-1 = last), without copying the full vocabulary's logits.
+  List<TokenLogprob> topLogprobs(int k, {int i = -1}) {
+    final out = malloc<LlamafuTokenLogprobStruct>(k);
+    final outN = malloc<Int32>();
+    try {
+      final result = _bindings.llamafuGetTopLogprobsIth(_llamafuInstance, i, k, out, outN);
+      if (result != 0) {
+        throw Exception('Failed to get top logprobs: $result');
+      }
+      return List<TokenLogprob>.generate(
+          outN.value, (j) => TokenLogprob(token: out[j].token, logprob: out[j].logprob));
+    } finally {
+      malloc.free(out);
+      malloc.free(outN);
+    }
+  }
+
+  /// Relevance of each document to [query], for reranker models loaded with
+  /// [PoolingType.rank]. Returns one row per document with one score per
+  /// output of the model's classifier head (usually one).
+  List<Float32List> rerank(String query, List<String> documents) {
+    if (documents.isEmpty) return const [];
+
+    final nClsOutModel = _bindings.llamafuModelNClsOut(_llamafuInstance);
+    final nClsOut = nClsOutModel > 0 ? nClsOutModel : 1;
+    final capacity = documents.length * nClsOut;
+    final queryPtr = query.toNativeUtf8();
+    final docPtrs = malloc<Pointer<Utf8>>(documents.length);
+    for (int i = 0; i < documents.length; i++) {
+      docPtrs[i] = documents[i].toNativeUtf8();
+    }
+    final outScores = malloc<Float>(capacity);
+
+    try {
+      final result = _bindings.llamafuRerank(
+          _llamafuInstance, queryPtr, docPtrs, documents.length, outScores, capacity);
+      if (result != 0) {
+        throw Exception('Failed to rerank documents: $result');
+      }
+      final matrix = outScores.asTypedList(capacity);
+      return List<Float32List>.generate(
+        documents.length,
+        (i) => Float32List.fromList(matrix.sublist(i * nClsOut, (i + 1) * nClsOut)),
+      );
+    } finally {
+      malloc.free(queryPtr);
+      for (int i = 0; i < documents.length; i++) {
+        malloc.free(docPtrs[i]);
+      }
+      malloc.free(docPtrs);
+      malloc.free(outScores);
+    }
+  }
+
   // ==========================================================================
   // KV CACHE MANAGEMENT
   // ==========================================================================
@@ -1559,22 +2303,127 @@ class Llamafu {
     }
   }
 
-  // ==========================================================================
-  // MODEL INFO & PERFORMANCE
-  // ==========================================================================
+  /// Saves a snapshot of the state to [path] without buffering it in memory.
+  ///
+  /// The state is written straight into a mapping of the file. Without
+  /// [seqId] the whole context is saved; with it only that sequence, so a
+  /// single conversation can be suspended. Returns the snapshot size in bytes.
+  int saveStateSnapshot(String path, {int? seqId}) {
+    if (!_isValidFilePath(path)) {
+      throw ArgumentError('Invalid state file path: $path');
+    }
+    if (seqId != null && seqId < 0) {
+      throw ArgumentError('Invalid seqId: $seqId');
+    }
 
-  /// Gets model information.
-  ModelInfo getModelInfo() {
-    final outInfo = malloc<LlamafuModelInfoStruct>();
-    final result = _bindings.llamafuGetModelInfo(_llamafuInstance, outInfo);
+    final pathPtr = path.toNativeUtf8();
+    final outSize = malloc<Uint64>();
+    final result = _bindings.llamafuStateSaveMapped(_llamafuInstance, pathPtr, seqId ?? -1, outSize);
+    final size = outSize.value;
+    malloc.free(pathPtr);
+    malloc.free(outSize);
 
     if (result != 0) {
-      malloc.free(outInfo);
-      throw Exception('Failed to get model info: $result');
+      throw Exception('Failed to save state snapshot: $result');
     }
+    return size;
+  }
 
-    final info = ModelInfo(
-      vocabSize: outInfo.ref.n_vocab,
+  /// Loads a snapshot written by [saveStateSnapshot], paging it in from the
+  /// file. A sequence snapshot replaces the contents of [seqId], which may
+  /// differ from the sequence it was saved from.
+  void loadStateSnapshot(String path, {int? seqId}) {
+    if (!_isValidFilePath(path)) {
+      throw ArgumentError('Invalid state file path: $path');
+    }
+    if (seqId != null && seqId < 0) {
+      throw ArgumentError('Invalid seqId: $seqId');
+    }
+
+    final pathPtr = path.toNativeUtf8();
+    final result = _bindings.llamafuStateLoadMapped(_llamafuInstance, pathPtr, seqId ?? -1);
+    malloc.free(pathPtr);
+
+    if (result != 0) {
+      throw Exception('Failed to load state snapshot: $result');
+    }
+  }
+
+  /// Keeps prompt states in [directory] so later prompts sharing a prefix,
+  /// including after a restart, restore it instead of re-evaluating it.
+  ///
+  /// Prefixes are matched in blocks of [blockSize] tokens (16-4096). Least
+  /// recently used entries are deleted once the directory holds more than
+  /// [maxBytes]. Restored token counts are reported by [getPerfStats].
+  void enablePromptCache(String directory, {required int maxBytes, int blockSize = 256}) {
+    if (!_isValidFilePath(directory)) {
+      throw ArgumentError('Invalid prompt cache directory: $directory');
+    }
+    if (maxBytes <= 0) {
+      throw ArgumentError('Invalid maxBytes: $maxBytes (must be positive)');
+    }
+    if (blockSize < 16 || blockSize > 4096) {
+      throw ArgumentError('Invalid blockSize: $blockSize (must be 16-4096)');
+    }
+
+    final dirPtr = directory.toNativeUtf8();
+    final result = _bindings.llamafuPromptCacheEnable(_llamafuInstance, dirPtr, maxBytes, blockSize);
+    malloc.free(dirPtr);
+
+    if (result != 0) {
+      throw Exception('Failed to enable prompt cache: $result');
+    }
+  }
+
+  /// Stops saving and restoring prompt states; the directory is kept.
+  void disablePromptCache() => _bindings.llamafuPromptCacheDisable(_llamafuInstance);
+
+  /// Deletes this model's saved prompt states.
+  void clearPromptCache() {
+    final result = _bindings.llamafuPromptCacheClear(_llamafuInstance);
+    if (result != 0) {
+      throw Exception('Failed to clear prompt cache: $result');
+    }
+  }
+
+  /// Gets prompt cache statistics; the cache must be enabled.
+  PromptCacheStats getPromptCacheStats() {
+    final outStats = malloc<LlamafuPromptCacheStatsStruct>();
+    final result = _bindings.llamafuPromptCacheGetStats(_llamafuInstance, outStats);
+
+    if (result != 0) {
+      malloc.free(outStats);
+      throw Exception('Failed to get prompt cache stats: $result');
+    }
+
+    final stats = PromptCacheStats(
+      entries: outStats.ref.n_entries,
+      hits: outStats.ref.n_hits,
+      misses: outStats.ref.n_misses,
+      bytes: outStats.ref.n_bytes,
+      maxBytes: outStats.ref.max_bytes,
+    );
+
+    malloc.free(outStats);
+    return stats;
+  }
+
+  // ==========================================================================
+  // MODEL INFO & PERFORMANCE
+  // ==========================================================================
+
+  /// Gets model information.
+  ModelInfo getModelInfo() {
+    final outInfo = malloc<LlamafuModelInfoStruct>();
+    final result = _bindings.llamafuGetModelInfo(_llamafuInstance, outInfo);
+
+    if (result != 0) {
+      malloc.free(outInfo);
+      throw Exception('Failed to get model info: $result');
+    }
+
+    final info = ModelInfo(
+      vocabSize: outInfo.ref.n_vocab,
       contextLength: outInfo.ref.n_ctx_train,
       embeddingSize: outInfo.ref.n_embd,
       numLayers: outInfo.ref.n_layer,
@@ -1610,12 +2459,58 @@ class Llamafu {
       evalMs: outStats.ref.t_eval_ms,
       promptTokens: outStats.ref.n_p_eval,
       evalTokens: outStats.ref.n_eval,
+      reusedTokens: outStats.ref.n_reused,
+      draftedTokens: outStats.ref.n_drafted,
+      acceptedDraftTokens: outStats.ref.n_draft_accepted,
+      draftAcceptanceRate: outStats.ref.draft_acceptance_rate,
+      tokensPerSecond: outStats.ref.tokens_per_second,
+      restoredTokens: outStats.ref.n_restored,
+      prefilledTokens: outStats.ref.n_prefilled,
     );
 
     malloc.free(outStats);
     return stats;
   }
 
+  /// Timings of the last request, latency histograms since the last
+  /// [resetTimings] and the load phases of this instance. Safe to call while
+  /// a request runs.
+  RequestMetrics requestMetrics() {
+    final out = malloc<LlamafuRequestMetricsStruct>();
+    try {
+      final result = _bindings.llamafuGetRequestMetrics(_llamafuInstance, out);
+      if (result != 0) {
+        throw Exception('Failed to get request metrics: $result');
+      }
+      final m = out.ref;
+      return RequestMetrics(
+        tokenizeMs: m.t_tokenize_ms,
+        prefillMs: m.t_prefill_ms,
+        firstTokenMs: m.t_first_token_ms,
+        sampleMs: m.t_sample_ms,
+        decodeMs: m.t_decode_ms,
+        detokenizeMs: m.t_detokenize_ms,
+        callbackMs: m.t_callback_ms,
+        totalMs: m.t_total_ms,
+        promptTokens: m.n_prompt_tokens,
+        generatedTokens: m.n_generated,
+        samples: m.n_sample,
+        interTokenP50Ms: m.itl_p50_ms,
+        interTokenP99Ms: m.itl_p99_ms,
+        interTokenMaxMs: m.itl_max_ms,
+        requests: m.n_requests,
+        timeToFirstToken: LatencyHistogram._fromStruct(m.ttft),
+        interTokenLatency: LatencyHistogram._fromStruct(m.itl),
+        loadWeightsMs: m.t_load_weights_ms,
+        loadVocabMs: m.t_load_vocab_ms,
+        loadContextMs: m.t_load_context_ms,
+        loadMmprojMs: m.t_load_mmproj_ms,
+      );
+    } finally {
+      malloc.free(out);
+    }
+  }
+
   /// Gets memory usage statistics.
   MemoryUsage getMemoryUsage() {
     final outUsage = malloc<LlamafuMemoryUsageStruct>();
@@ -1626,18 +2521,53 @@ class Llamafu {
       throw Exception('Failed to get memory usage: $result');
     }
 
-    final usage = MemoryUsage(
-      modelSizeBytes: outUsage.ref.model_size_bytes,
-      kvCacheSizeBytes: outUsage.ref.kv_cache_size_bytes,
-      computeBufferSizeBytes: outUsage.ref.compute_buffer_size_bytes,
-      totalSizeBytes: outUsage.ref.total_size_bytes,
-    );
+    final usage = MemoryUsage._fromStruct(outUsage.ref);
 
     malloc.free(outUsage);
     return usage;
   }
 
-  /// Resets timing statistics.
+  /// Lists the backend buffers allocated for this instance (weights per
+  /// device, KV cache, compute and output buffers).
+  List<BufferInfo> getBufferInfo() {
+    final outCount = malloc<Int32>();
+    var result = _bindings.llamafuGetBufferInfo(_llamafuInstance, nullptr, 0, outCount);
+    final count = outCount.value;
+    if (result != 0 || count == 0) {
+      malloc.free(outCount);
+      if (result != 0) throw Exception('Failed to get buffer info: $result');
+      return const [];
+    }
+
+    final outBuffers = malloc<LlamafuBufferInfoStruct>(count);
+    result = _bindings.llamafuGetBufferInfo(_llamafuInstance, outBuffers, count, outCount);
+
+    final buffers = <BufferInfo>[];
+    if (result == 0) {
+      for (var i = 0; i < outCount.value && i < count; i++) {
+        final info = outBuffers[i];
+        final nameBytes = <int>[];
+        for (var j = 0; j < 32 && info.buffer_type[j] != 0; j++) {
+          nameBytes.add(info.buffer_type[j]);
+        }
+        buffers.add(BufferInfo(
+          bufferType: String.fromCharCodes(nameBytes),
+          kind: BufferKind.values[info.kind.clamp(0, BufferKind.values.length - 1)],
+          isHost: info.is_host != 0,
+          sizeBytes: info.size_bytes,
+        ));
+      }
+    }
+
+    malloc.free(outBuffers);
+    malloc.free(outCount);
+    if (result != 0) {
+      throw Exception('Failed to get buffer info: $result');
+    }
+    return buffers;
+  }
+
+  /// Resets timing statistics and the [requestMetrics] histograms.
   void resetTimings() => _bindings.llamafuResetTimings(_llamafuInstance);
 
   /// Warms up the model for better performance.
@@ -1681,6 +2611,161 @@ class Llamafu {
     return benchResult;
   }
 
+  /// Runs a llama-bench style test: [promptTokens] random tokens evaluated
+  /// in [batchSize] chunks, then [generatedTokens] single-token decodes at
+  /// that depth, after [warmup] untimed runs. The cached prompt is kept.
+  BenchRunResult benchmarkRun({
+    int promptTokens = 512,
+    int generatedTokens = 128,
+    int? batchSize,
+    int? nThreads,
+    int repetitions = 5,
+    int warmup = 1,
+  }) {
+    final params = calloc<LlamafuBenchParamsStruct>();
+    final outPrompt = calloc<LlamafuBenchStatsStruct>();
+    final outGeneration = calloc<LlamafuBenchStatsStruct>();
+    try {
+      params.ref.n_prompt = promptTokens;
+      params.ref.n_gen = generatedTokens;
+      params.ref.n_batch = batchSize ?? 0;
+      params.ref.n_threads = nThreads ?? 0;
+      params.ref.repetitions = repetitions;
+      params.ref.warmup = warmup;
+
+      final result = _bindings.llamafuBenchRun(_llamafuInstance, params, outPrompt, outGeneration);
+      if (result != 0) {
+        throw Exception('Failed to run benchmark: $result');
+      }
+      return BenchRunResult(
+        prompt: BenchStats._fromStruct(outPrompt.ref),
+        generation: BenchStats._fromStruct(outGeneration.ref),
+      );
+    } finally {
+      calloc.free(params);
+      calloc.free(outPrompt);
+      calloc.free(outGeneration);
+    }
+  }
+
+  /// Reports how the device's CPUs split into performance and efficiency
+  /// cores.
+  static Future<CpuTopology> cpuTopology() async {
+    final bindings = await LlamafuBindings.init();
+    final outTopology = malloc<LlamafuCpuTopologyStruct>();
+    try {
+      final result = bindings.llamafuGetCpuTopology(outTopology);
+      if (result != 0) {
+        throw Exception('Failed to read CPU topology: $result');
+      }
+      return CpuTopology(
+        cpus: outTopology.ref.n_cpus,
+        performanceCores: outTopology.ref.n_performance,
+        efficiencyCores: outTopology.ref.n_efficiency,
+        performanceMask: outTopology.ref.performance_mask,
+        efficiencyMask: outTopology.ref.efficiency_mask,
+      );
+    } finally {
+      malloc.free(outTopology);
+    }
+  }
+
+  /// Runs inference on dedicated threadpools: [decode] for single-token
+  /// steps and [prefill] for prompt batches (defaults to sharing [decode]).
+  /// Calling with neither goes back to per-call threads.
+  void setThreadpools({ThreadpoolConfig? decode, ThreadpoolConfig? prefill}) {
+    if (decode == null && prefill != null) {
+      throw ArgumentError('A prefill threadpool needs a decode threadpool');
+    }
+
+    final decodeParams = decode == null ? nullptr : _threadpoolParams(decode);
+    final prefillParams = prefill == null ? nullptr : _threadpoolParams(prefill);
+    final result = _bindings.llamafuSetThreadpools(_llamafuInstance, decodeParams, prefillParams);
+    if (decodeParams != nullptr) malloc.free(decodeParams);
+    if (prefillParams != nullptr) malloc.free(prefillParams);
+
+    if (result != 0) {
+      throw Exception('Failed to set threadpools: $result');
+    }
+  }
+
+  Pointer<LlamafuThreadpoolParamsStruct> _threadpoolParams(ThreadpoolConfig config) {
+    final params = malloc<LlamafuThreadpoolParamsStruct>();
+    params.ref = _bindings.llamafuThreadpoolDefaultParams();
+    params.ref.n_threads = config.threads ?? 0;
+    params.ref.core_class = config.cores.value;
+    params.ref.cpumask = config.cpuMask ?? 0;
+    params.ref.priority = config.priority;
+    params.ref.poll = config.poll;
+    params.ref.strict_cpu = config.strictCpu;
+    return params;
+  }
+
+  /// Benchmarks thread counts on the performance cores and on all cores,
+  /// then applies the fastest decode and prefill threadpools.
+  ///
+  /// With [cachePath] the result is stored per device model and reused on
+  /// later calls unless [force] is set. Clears the KV cache.
+  AutotuneResult autotuneThreads({String? cachePath, bool force = false}) {
+    final pathPtr = cachePath?.toNativeUtf8() ?? nullptr;
+    final outResult = malloc<LlamafuAutotuneResultStruct>();
+    try {
+      final result = _bindings.llamafuAutotuneThreads(_llamafuInstance, pathPtr, force, outResult);
+      if (result != 0) {
+        throw Exception('Failed to autotune threads: $result');
+      }
+      return AutotuneResult(
+        decode: ThreadpoolConfig(
+            threads: outResult.ref.n_threads, cores: CoreClass.fromValue(outResult.ref.core_class)),
+        prefill: ThreadpoolConfig(
+            threads: outResult.ref.n_threads_batch, cores: CoreClass.fromValue(outResult.ref.core_class_batch)),
+        generationSpeedTps: outResult.ref.generation_speed_tps,
+        promptSpeedTps: outResult.ref.prompt_speed_tps,
+        fromCache: outResult.ref.from_cache,
+      );
+    } finally {
+      if (pathPtr != nullptr) malloc.free(pathPtr);
+      malloc.free(outResult);
+    }
+  }
+
+  // ==========================================================================
+  // MEMORY PRESSURE
+  // ==========================================================================
+
+  /// Frees memory while the app is in the background or on a memory warning.
+  ///
+  /// From [ReleaseLevel.context] up, the prompt cache and KV-backed chat
+  /// sessions are written to [spillDir] (defaults to the prompt cache
+  /// directory, if enabled) so they continue where they left off; without
+  /// either they start over. The model comes back on its next call, or
+  /// right away with [resume]. Throws while a stream, queued job or
+  /// scheduled request is running.
+  void releaseMemory(ReleaseLevel level, {String? spillDir}) {
+    final dirPtr = spillDir?.toNativeUtf8() ?? nullptr;
+    try {
+      final result = _bindings.llamafuReleaseMemory(_llamafuInstance, level.value, dirPtr);
+      if (result != 0) {
+        throw Exception('Failed to release memory: $result');
+      }
+    } finally {
+      if (dirPtr != nullptr) malloc.free(dirPtr);
+    }
+  }
+
+  /// Recreates what [releaseMemory] freed now instead of on the next call.
+  /// The vision projector still loads on the next multimodal call.
+  void resume() {
+    final result = _bindings.llamafuResume(_llamafuInstance);
+    if (result != 0) {
+      throw Exception('Failed to resume: $result');
+    }
+  }
+
+  /// What [releaseMemory] currently has released.
+  ReleaseLevel get releaseLevel =>
+      ReleaseLevel.fromValue(_bindings.llamafuGetReleaseLevel(_llamafuInstance));
+
   // ==========================================================================
   // TEXT ANALYSIS
   // ==========================================================================
@@ -2002,12 +3087,24 @@ class Llamafu {
   // ==========================================================================
 
   /// Creates a new chat session with an optional system prompt.
-  ChatSession createChatSession({String? systemPrompt}) {
+  ///
+  /// When [kvSequenceId] is given, the session keeps its conversation in that
+  /// KV cache sequence (1 to 7) and each turn only evaluates the new message
+  /// instead of the whole history. Sessions on different sequences can be
+  /// used side by side on the same model instance.
+  ChatSession createChatSession({String? systemPrompt, int? kvSequenceId}) {
+    if (kvSequenceId != null && (kvSequenceId < 1 || kvSequenceId > 7)) {
+      throw ArgumentError('Invalid kvSequenceId: $kvSequenceId (must be 1-7)');
+    }
+
     final systemPromptPtr = systemPrompt?.toNativeUtf8() ?? nullptr;
     final outSession = malloc<Pointer<Void>>();
 
-    final result = _bindings.llamafuChatSessionCreate(
-      _llamafuInstance, systemPromptPtr, outSession);
+    final result = kvSequenceId != null
+        ? _bindings.llamafuChatSessionCreateKv(
+            _llamafuInstance, systemPromptPtr, kvSequenceId, outSession)
+        : _bindings.llamafuChatSessionCreate(
+            _llamafuInstance, systemPromptPtr, outSession);
 
     if (systemPrompt != null) malloc.free(systemPromptPtr);
 
@@ -2021,6 +3118,181 @@ class Llamafu {
     return session;
   }
 
+  // ==========================================================================
+  // SPECULATIVE DECODING
+  // ==========================================================================
+
+  /// Enables speculative decoding for completions on this instance.
+  ///
+  /// Up to [draftTokens] drafted tokens are verified per decode and kept
+  /// only where they match the model's own samples, so output is unchanged.
+  /// [DraftType.ngram] looks up n-grams of [ngramMin]-[ngramMax] tokens;
+  /// [DraftType.model] loads [draftModelPath]. Pass [DraftType.none] to
+  /// disable. Acceptance is reported by [getPerfStats].
+  void setSpeculativeDecoding(
+    DraftType type, {
+    int draftTokens = 8,
+    int ngramMin = 2,
+    int ngramMax = 4,
+    String? draftModelPath,
+  }) {
+    if (type != DraftType.none && (draftTokens < 1 || draftTokens > 32)) {
+      throw ArgumentError('Invalid draftTokens: $draftTokens (must be 1-32)');
+    }
+    if (type == DraftType.ngram && (ngramMin < 1 || ngramMax < ngramMin)) {
+      throw ArgumentError('Invalid n-gram range: $ngramMin-$ngramMax');
+    }
+    if (type == DraftType.model && (draftModelPath == null || draftModelPath.isEmpty)) {
+      throw ArgumentError('draftModelPath is required for DraftType.model');
+    }
+
+    final params = malloc<LlamafuSpeculativeParamsStruct>();
+    params.ref = _bindings.llamafuSpeculativeDefaultParams();
+    params.ref.draft_type = type.value;
+    params.ref.n_draft = draftTokens;
+    params.ref.ngram_min = ngramMin;
+    params.ref.ngram_max = ngramMax;
+    params.ref.draft_model_path = draftModelPath?.toNativeUtf8() ?? nullptr;
+
+    final result = _bindings.llamafuSetSpeculative(_llamafuInstance, params);
+
+    if (draftModelPath != null) malloc.free(params.ref.draft_model_path);
+    malloc.free(params);
+
+    if (result != 0) {
+      throw Exception('Failed to configure speculative decoding: $result');
+    }
+  }
+
+  // ==========================================================================
+  // CONTINUOUS BATCHING
+  // ==========================================================================
+
+  /// Queues a completion on the batching scheduler.
+  ///
+  /// Requests run concurrently in separate KV cache sequences and share each
+  /// decode call. Drive them with [schedulerStep] and read output with
+  /// [ScheduledRequest.poll].
+  ScheduledRequest submitRequest({
+    required String prompt,
+    int maxTokens = 128,
+    double temperature = 0.8,
+    SamplingParams sampling = const SamplingParams(),
+    List<String> stop = const [],
+  }) {
+    if (!_isValidPrompt(prompt)) {
+      throw ArgumentError('Invalid prompt: contains invalid characters or is too long');
+    }
+
+    if (maxTokens < 1 || maxTokens > Llamafu.maxTokens) {
+      throw ArgumentError('Invalid maxTokens: $maxTokens (must be 1-${Llamafu.maxTokens})');
+    }
+
+    if (!_isValidParameter(temperature, minTemperature, maxTemperature)) {
+      throw ArgumentError('Invalid temperature: $temperature (must be $minTemperature-$maxTemperature)');
+    }
+
+    final inferParams = calloc<LlamafuInferParams>();
+    inferParams.ref.prompt = prompt.toNativeUtf8();
+    inferParams.ref.max_tokens = maxTokens;
+    inferParams.ref.temperature = temperature;
+    sampling._writeTo(inferParams.ref);
+    _writeStops(inferParams.ref, stop);
+    final outRequest = malloc<Pointer<Void>>();
+
+    final result = _bindings.llamafuSchedulerSubmit(
+      _llamafuInstance, inferParams, nullptr, nullptr, outRequest);
+
+    malloc.free(inferParams.ref.prompt);
+    _freeStops(inferParams.ref);
+    calloc.free(inferParams);
+
+    if (result != 0) {
+      malloc.free(outRequest);
+      throw Exception('Failed to submit request: $result');
+    }
+
+    final request = ScheduledRequest._(_bindings, outRequest.value);
+    malloc.free(outRequest);
+    return request;
+  }
+
+  /// Queues a completion on the handle's worker thread.
+  ///
+  /// Jobs run one at a time, higher [priority] first, without blocking the
+  /// calling isolate; other calls on this instance wait while one runs.
+  /// Returns a [QueuedCompletion] whose [QueuedCompletion.result] completes
+  /// with the text. Throws if the queue is full.
+  QueuedCompletion enqueue({
+    required String prompt,
+    int priority = 0,
+    int maxTokens = 128,
+    double temperature = 0.8,
+    SamplingParams sampling = const SamplingParams(),
+    List<String> stop = const [],
+  }) {
+    if (!_isValidPrompt(prompt)) {
+      throw ArgumentError('Invalid prompt: contains invalid characters or is too long');
+    }
+
+    if (maxTokens < 1 || maxTokens > Llamafu.maxTokens) {
+      throw ArgumentError('Invalid maxTokens: $maxTokens (must be 1-${Llamafu.maxTokens})');
+    }
+
+    if (!_isValidParameter(temperature, minTemperature, maxTemperature)) {
+      throw ArgumentError('Invalid temperature: $temperature (must be $minTemperature-$maxTemperature)');
+    }
+
+    final inferParams = calloc<LlamafuInferParams>();
+    inferParams.ref.prompt = prompt.toNativeUtf8();
+    inferParams.ref.max_tokens = maxTokens;
+    inferParams.ref.temperature = temperature;
+    sampling._writeTo(inferParams.ref);
+    _writeStops(inferParams.ref, stop);
+    final outJob = malloc<LlamafuJob>();
+
+    final completion = QueuedCompletion._(_bindings);
+    final result = _bindings.llamafuQueueSubmit(_llamafuInstance, inferParams, priority,
+        nullptr, completion._onDone.nativeFunction, nullptr, outJob);
+
+    malloc.free(inferParams.ref.prompt);
+    _freeStops(inferParams.ref);
+    calloc.free(inferParams);
+
+    if (result != 0) {
+      malloc.free(outJob);
+      completion._onDone.close();
+      throw Exception('Failed to queue completion: $result');
+    }
+
+    completion._job = outJob.value;
+    malloc.free(outJob);
+    return completion;
+  }
+
+  /// Sets how many jobs may wait in the request queue (default 16).
+  void setQueueCapacity(int capacity) {
+    final result = _bindings.llamafuQueueSetCapacity(_llamafuInstance, capacity);
+    if (result != 0) {
+      throw Exception('Failed to set queue capacity: $result');
+    }
+  }
+
+  /// Runs one batched decode over all scheduled requests.
+  ///
+  /// Returns the number of requests still queued or running.
+  int schedulerStep() {
+    final outPending = malloc<Int32>();
+    final result = _bindings.llamafuSchedulerStep(_llamafuInstance, outPending);
+    final pending = outPending.value;
+    malloc.free(outPending);
+
+    if (result != 0) {
+      throw Exception('Scheduler step failed: $result');
+    }
+    return pending;
+  }
+
   // ==========================================================================
   // IMAGE PROCESSING UTILITIES
   // ==========================================================================
@@ -2028,9 +3300,7 @@ class Llamafu {
   /// Validates an image input.
   ImageValidationResult validateImage(MediaInput input) {
     final inputStruct = malloc<LlamafuMediaInput>();
-    inputStruct.ref.type = input.type.index;
-    inputStruct.ref.data = input.data.toNativeUtf8();
-    inputStruct.ref.data_size = input.data.length;
+    input._writeTo(inputStruct.ref);
 
     final outValidation = malloc<LlamafuImageValidationStruct>();
 
@@ -2046,7 +3316,7 @@ class Llamafu {
 
     final validationResult = ImageValidationResult(
       isValid: outValidation.ref.is_valid,
-      detectedFormat: ImageFormat.values[outValidation.ref.detected_format],
+      detectedFormat: ImageFormat.fromValue(outValidation.ref.detected_format),
       width: outValidation.ref.width,
       height: outValidation.ref.height,
       fileSizeBytes: outValidation.ref.file_size_bytes,
@@ -2061,9 +3331,7 @@ class Llamafu {
   /// Processes an image and returns embeddings.
   ImageProcessResult processImage(MediaInput input) {
     final inputStruct = malloc<LlamafuMediaInput>();
-    inputStruct.ref.type = input.type.index;
-    inputStruct.ref.data = input.data.toNativeUtf8();
-    inputStruct.ref.data_size = input.data.length;
+    input._writeTo(inputStruct.ref);
 
     final outResult = malloc<LlamafuImageProcessResultStruct>();
 
@@ -2091,22 +3359,63 @@ class Llamafu {
       wasResized: outResult.ref.was_resized,
       wasPadded: outResult.ref.was_padded,
       processingTimeMs: outResult.ref.processing_time_ms,
+      decodeTimeMs: outResult.ref.decode_time_ms,
+      preprocessTimeMs: outResult.ref.preprocess_time_ms,
+      encodeTimeMs: outResult.ref.encode_time_ms,
+      fromCache: outResult.ref.from_cache,
     );
 
+    _bindings.llamafuImageProcessResultFree(outResult);
     malloc.free(outResult);
     return processResult;
   }
 
+  /// Sets the byte budget of the image embedding cache, dropping the least
+  /// recently used images beyond it; 0 disables the cache. Images sent again
+  /// (the same photo on every chat turn, say) skip decoding and encoding.
+  void setImageCacheBudget(int maxBytes) {
+    if (maxBytes < 0) {
+      throw ArgumentError('Invalid maxBytes: $maxBytes (must not be negative)');
+    }
+    final result = _bindings.llamafuImageCacheSetBudget(_llamafuInstance, maxBytes);
+    if (result != 0) {
+      throw Exception('Failed to set image cache budget: $result');
+    }
+  }
+
+  /// Drops all cached image embeddings.
+  void clearImageCache() => _bindings.llamafuImageCacheClear(_llamafuInstance);
+
+  /// Gets image embedding cache statistics.
+  ImageCacheStats getImageCacheStats() {
+    final outStats = malloc<LlamafuImageCacheStatsStruct>();
+    final result = _bindings.llamafuImageCacheGetStats(_llamafuInstance, outStats);
+
+    if (result != 0) {
+      malloc.free(outStats);
+      throw Exception('Failed to get image cache stats: $result');
+    }
+
+    final stats = ImageCacheStats(
+      entries: outStats.ref.n_entries,
+      hits: outStats.ref.n_hits,
+      misses: outStats.ref.n_misses,
+      bytes: outStats.ref.n_bytes,
+      maxBytes: outStats.ref.max_bytes,
+    );
+
+    malloc.free(outStats);
+    return stats;
+  }
+
   /// Converts an image to base64 encoding.
   String imageToBase64(MediaInput input, {ImageFormat format = ImageFormat.png}) {
     final inputStruct = malloc<LlamafuMediaInput>();
-    inputStruct.ref.type = input.type.index;
-    inputStruct.ref.data = input.data.toNativeUtf8();
-    inputStruct.ref.data_size = input.data.length;
+    input._writeTo(inputStruct.ref);
 
     final outBase64 = malloc<Pointer<Utf8>>();
 
-    final result = _bindings.llamafuImageToBase64(inputStruct, format.index, outBase64);
+    final result = _bindings.llamafuImageToBase64(inputStruct, format.value, outBase64);
 
     malloc.free(inputStruct.ref.data);
     malloc.free(inputStruct);
@@ -2130,9 +3439,7 @@ class Llamafu {
   /// Processes audio and returns features.
   AudioProcessResult processAudio(MediaInput input) {
     final inputStruct = malloc<LlamafuMediaInput>();
-    inputStruct.ref.type = input.type.index;
-    inputStruct.ref.data = input.data.toNativeUtf8();
-    inputStruct.ref.data_size = input.data.length;
+    input._writeTo(inputStruct.ref);
 
     final outResult = malloc<LlamafuAudioProcessResultStruct>();
 
@@ -2217,17 +3524,85 @@ class Llamafu {
       throw Exception('Failed to get LoRA adapter info: $result');
     }
 
-    final info = LoraAdapterInfo(
-      name: outInfo.ref.name != nullptr ? outInfo.ref.name.toDartString() : '',
-      filePath: outInfo.ref.file_path != nullptr ? outInfo.ref.file_path.toDartString() : '',
-      scale: outInfo.ref.scale,
-      isActive: outInfo.ref.is_active,
-    );
+    final info = LoraAdapterInfo._fromStruct(outInfo.ref);
 
     malloc.free(outInfo);
     return info;
   }
 
+  /// Lists every loaded LoRA adapter, active or not, in load order.
+  List<LoraAdapterInfo> listLoraAdapters() {
+    final outAdapters = malloc<Pointer<LlamafuLoraAdapterInfoStruct>>();
+    final outCount = malloc<IntPtr>();
+    try {
+      final result = _bindings.llamafuListLoraAdapters(_llamafuInstance, outAdapters, outCount);
+      if (result != 0) {
+        throw Exception('Failed to list LoRA adapters: $result');
+      }
+      final infos = [
+        for (var i = 0; i < outCount.value; i++) LoraAdapterInfo._fromStruct(outAdapters.value[i]),
+      ];
+      _bindings.llamafuFreeLoraAdapterList(outAdapters.value);
+      return infos;
+    } finally {
+      malloc.free(outAdapters);
+      malloc.free(outCount);
+    }
+  }
+
+  /// Makes exactly [adapters] active, at the given scales; every other
+  /// loaded adapter stays resident but inactive. Switching sets does not
+  /// reload anything, so it is cheap to do between requests.
+  void setActiveLoraAdapters(Map<LoraAdapter, double> adapters) {
+    for (final scale in adapters.values) {
+      if (!_isValidParameter(scale, 0.0, 2.0)) {
+        throw ArgumentError('Invalid LoRA scale: $scale (must be 0.0 to 2.0)');
+      }
+    }
+    final batch = calloc<LlamafuLoraBatchStruct>();
+    final handles = calloc<Pointer<Void>>(adapters.isEmpty ? 1 : adapters.length);
+    final scales = calloc<Float>(adapters.isEmpty ? 1 : adapters.length);
+    try {
+      var i = 0;
+      adapters.forEach((adapter, scale) {
+        handles[i] = adapter._nativeAdapter;
+        scales[i] = scale;
+        i++;
+      });
+      batch.ref.adapters = handles;
+      batch.ref.scales = scales;
+      batch.ref.n_adapters = adapters.length;
+      final result = _bindings.llamafuApplyLoraBatch(_llamafuInstance, batch);
+      if (result != 0) {
+        throw Exception('Failed to set active LoRA adapters: $result');
+      }
+    } finally {
+      calloc.free(batch);
+      calloc.free(handles);
+      calloc.free(scales);
+    }
+  }
+
+  /// Runs [body] with [adapters] active, then restores the previous set.
+  ///
+  /// ```dart
+  /// final summary = await llamafu.withLoraAdapters({summarizer: 1.0},
+  ///     () => llamafu.complete(prompt: text));
+  /// ```
+  Future<T> withLoraAdapters<T>(Map<LoraAdapter, double> adapters, Future<T> Function() body) async {
+    final previous = <LoraAdapter, double>{};
+    for (final adapter in _loraAdapters.where((a) => !a._freed)) {
+      final info = getLoraAdapterInfo(adapter);
+      if (info.isActive) previous[adapter] = info.scale;
+    }
+    setActiveLoraAdapters(adapters);
+    try {
+      return await body();
+    } finally {
+      setActiveLoraAdapters(previous);
+    }
+  }
+
   /// Validates LoRA adapter compatibility with the current model.
   LoraCompatibilityResult validateLoraCompatibility(String loraPath) {
     if (!_isValidFilePath(loraPath)) {
@@ -2272,7 +3647,7 @@ class Llamafu {
   void close() {
     // Free all LoRA adapters
     for (final adapter in _loraAdapters) {
-      _bindings.llamafuLoraAdapterFree(adapter._nativeAdapter);
+      adapter._free();
     }
     _loraAdapters.clear();
     
@@ -2302,6 +3677,90 @@ enum MediaType {
   video,
 }
 
+/// Sampler settings beyond temperature. Zero (the default) leaves a field to
+/// the native default: top-k 40, top-p 0.95, repeat penalty 1.1 over the last
+/// 64 tokens, seed 42; min-p, typical-p, frequency/presence penalties and
+/// mirostat off.
+class SamplingParams {
+  final int topK;
+  final double topP;
+  final double minP;
+  final double typicalP;
+  final double repeatPenalty;
+
+  /// Tokens the penalties look back over; -1 = all generated tokens.
+  final int repeatLastN;
+  final double frequencyPenalty;
+  final double presencePenalty;
+  final bool penalizeNewline;
+
+  /// Keep generating past the end-of-sequence token.
+  final bool ignoreEos;
+
+  /// 0 = off, 1 = Mirostat, 2 = Mirostat 2.0.
+  final int mirostat;
+  final double mirostatTau;
+  final double mirostatEta;
+  final int seed;
+
+  const SamplingParams({
+    this.topK = 0,
+    this.topP = 0.0,
+    this.minP = 0.0,
+    this.typicalP = 0.0,
+    this.repeatPenalty = 0.0,
+    this.repeatLastN = 0,
+    this.frequencyPenalty = 0.0,
+    this.presencePenalty = 0.0,
+    this.penalizeNewline = false,
+    this.ignoreEos = false,
+    this.mirostat = 0,
+    this.mirostatTau = 0.0,
+    this.mirostatEta = 0.0,
+    this.seed = 0,
+  });
+
+  void _writeTo(LlamafuInferParams out) {
+    out.top_k = topK;
+    out.top_p = topP;
+    out.min_p = minP;
+    out.typical_p = typicalP;
+    out.repeat_penalty = repeatPenalty;
+    out.repeat_last_n = repeatLastN;
+    out.frequency_penalty = frequencyPenalty;
+    out.presence_penalty = presencePenalty;
+    out.penalize_nl = penalizeNewline;
+    out.ignore_eos = ignoreEos;
+    out.mirostat = mirostat;
+    out.mirostat_tau = mirostatTau;
+    out.mirostat_eta = mirostatEta;
+    out.seed = seed;
+  }
+}
+
+/// Points [out] at a native copy of [stops]; empty strings are skipped.
+/// Release it with [_freeStops].
+void _writeStops(LlamafuInferParams out, List<String> stops) {
+  final nonEmpty = stops.where((stop) => stop.isNotEmpty).toList();
+  if (nonEmpty.isEmpty) return;
+  final array = calloc<Pointer<Utf8>>(nonEmpty.length);
+  for (var i = 0; i < nonEmpty.length; i++) {
+    array[i] = nonEmpty[i].toNativeUtf8();
+  }
+  out.stop_sequences = array;
+  out.n_stop_sequences = nonEmpty.length;
+}
+
+void _freeStops(LlamafuInferParams params) {
+  if (params.stop_sequences == nullptr) return;
+  for (var i = 0; i < params.n_stop_sequences; i++) {
+    malloc.free(params.stop_sequences[i]);
+  }
+  calloc.free(params.stop_sequences);
+  params.stop_sequences = nullptr;
+  params.n_stop_sequences = 0;
+}
+
 /// Represents a media input for multi-modal inference.
 class MediaInput {
   /// The type of media input.
@@ -2391,6 +3850,29 @@ class MediaInput {
 
   /// Gets the raw audio samples if available.
   Float32List? get samples => _samples;
+
+  /// Fills a native media input; [LlamafuMediaInput.data] is allocated here
+  /// and must be freed by the caller.
+  void _writeTo(LlamafuMediaInput out) {
+    out.type = type.index;
+    out.source_type = sourceType.value;
+    out.data = data.toNativeUtf8();
+    out.data_size = data.length;
+    out.image_format = (format ?? ImageFormat.auto).value;
+    out.width = width ?? 0;
+    out.height = height ?? 0;
+    out.audio_format = (audioFormat ?? AudioFormat.auto).value;
+    out.sample_rate = sampleRate ?? 0;
+    out.channels = channels ?? 0;
+    out.duration_ms = durationMs ?? 0;
+    out.resize_to_model = true;
+    out.maintain_aspect_ratio = true;
+    out.pad_to_square = false;
+    out.resample_audio = true;
+    out.caption = nullptr;
+    out.quality_hint = 0.0;
+    out.timestamp_ms = 0;
+  }
 }
 
 /// Represents a LoRA adapter that can be applied to a Llamafu model.
@@ -2398,11 +3880,18 @@ class LoraAdapter {
   final LlamafuBindings _bindings;
   final Pointer<Void> _nativeAdapter;
 
+  bool _freed = false;
+
   LoraAdapter._(this._bindings, this._nativeAdapter);
 
-  void dispose() {
+  void _free() {
+    if (_freed) return;
+    _freed = true;
     _bindings.llamafuLoraAdapterFree(_nativeAdapter);
   }
+
+  /// Unloads the adapter and releases its weights.
+  void dispose() => _free();
 }
 
 /// Represents a grammar sampler for constrained generation.
@@ -2462,6 +3951,30 @@ class PerfStats {
   final int promptTokens;
   final int evalTokens;
 
+  /// Prompt tokens served from the KV cache on the last completion instead
+  /// of being re-evaluated.
+  final int reusedTokens;
+
+  /// Tokens proposed by the speculative draft source on the last completion.
+  final int draftedTokens;
+
+  /// Drafted tokens the model accepted on the last completion.
+  final int acceptedDraftTokens;
+
+  /// [acceptedDraftTokens] / [draftedTokens], or 0 without drafts.
+  final double draftAcceptanceRate;
+
+  /// Effective generation speed of the last completion.
+  final double tokensPerSecond;
+
+  /// Prompt tokens restored from the prompt cache directory on the last
+  /// completion.
+  final int restoredTokens;
+
+  /// Prompt tokens evaluated on the last completion, after [reusedTokens]
+  /// and [restoredTokens].
+  final int prefilledTokens;
+
   const PerfStats({
     required this.startMs,
     required this.endMs,
@@ -2470,12 +3983,383 @@ class PerfStats {
     required this.evalMs,
     required this.promptTokens,
     required this.evalTokens,
+    this.reusedTokens = 0,
+    this.draftedTokens = 0,
+    this.acceptedDraftTokens = 0,
+    this.draftAcceptanceRate = 0,
+    this.tokensPerSecond = 0,
+    this.restoredTokens = 0,
+    this.prefilledTokens = 0,
   });
 
   double get promptSpeedTps => promptTokens > 0 ? (promptTokens / promptEvalMs * 1000) : 0;
   double get evalSpeedTps => evalTokens > 0 ? (evalTokens / evalMs * 1000) : 0;
 }
 
+/// Log-probability of one token, see [Llamafu.scoreContinuations].
+class TokenLogprob {
+  final int token;
+
+  /// Natural log-probability.
+  final double logprob;
+
+  /// Most likely tokens at this position, most likely first (empty unless
+  /// requested).
+  final List<TokenLogprob> alternatives;
+
+  const TokenLogprob({
+    required this.token,
+    required this.logprob,
+    this.alternatives = const [],
+  });
+}
+
+/// Scores of one continuation, see [Llamafu.scoreContinuations].
+class ContinuationScore {
+  /// Log-likelihood of the whole continuation.
+  final double logprobSum;
+
+  /// Whether every token was the most likely one.
+  final bool isGreedy;
+  final List<TokenLogprob> tokens;
+
+  const ContinuationScore({
+    required this.logprobSum,
+    required this.isGreedy,
+    required this.tokens,
+  });
+
+  /// Length-normalized log-likelihood.
+  double get meanLogprob => tokens.isEmpty ? 0 : logprobSum / tokens.length;
+}
+
+/// Latency distribution of [RequestMetrics]: bucket 0 counts samples under
+/// 1 ms, bucket i those in [2^(i-1), 2^i) ms and the last one everything
+/// longer.
+class LatencyHistogram {
+  final List<int> counts;
+  final int samples;
+  final double sumMs;
+  final double maxMs;
+
+  const LatencyHistogram({
+    required this.counts,
+    required this.samples,
+    required this.sumMs,
+    required this.maxMs,
+  });
+
+  factory LatencyHistogram._fromStruct(LlamafuLatencyHistogramStruct s) => LatencyHistogram(
+        counts: List<int>.generate(16, (i) => s.counts[i]),
+        samples: s.n_samples,
+        sumMs: s.sum_ms,
+        maxMs: s.max_ms,
+      );
+
+  double get meanMs => samples > 0 ? sumMs / samples : 0;
+
+  /// Upper bound of the bucket holding quantile [q] (0..1), in ms;
+  /// [double.infinity] if it falls into the overflow bucket.
+  double quantileUpperBoundMs(double q) {
+    if (samples == 0) return 0;
+    final target = (q * samples).ceil().clamp(1, samples);
+    var seen = 0;
+    for (var i = 0; i < counts.length; i++) {
+      seen += counts[i];
+      if (seen >= target) {
+        return i == counts.length - 1 ? double.infinity : (1 << i).toDouble();
+      }
+    }
+    return double.infinity;
+  }
+}
+
+/// Where the time of requests went, see [Llamafu.requestMetrics]. Times are
+/// in milliseconds.
+class RequestMetrics {
+  // Last request
+  final double tokenizeMs;
+  final double prefillMs;
+
+  /// Time to first token, from the request start.
+  final double firstTokenMs;
+  final double sampleMs;
+  final double decodeMs;
+
+  /// UTF-8 assembly and stop string matching.
+  final double detokenizeMs;
+
+  /// Time spent inside the caller's callbacks.
+  final double callbackMs;
+  final double totalMs;
+  final int promptTokens;
+  final int generatedTokens;
+  final int samples;
+  final double interTokenP50Ms;
+  final double interTokenP99Ms;
+  final double interTokenMaxMs;
+
+  // Since the instance was created or timings were reset
+  final int requests;
+  final LatencyHistogram timeToFirstToken;
+  final LatencyHistogram interTokenLatency;
+
+  // Load phases
+  final double loadWeightsMs;
+  final double loadVocabMs;
+  final double loadContextMs;
+  final double loadMmprojMs;
+
+  const RequestMetrics({
+    required this.tokenizeMs,
+    required this.prefillMs,
+    required this.firstTokenMs,
+    required this.sampleMs,
+    required this.decodeMs,
+    required this.detokenizeMs,
+    required this.callbackMs,
+    required this.totalMs,
+    required this.promptTokens,
+    required this.generatedTokens,
+    required this.samples,
+    required this.interTokenP50Ms,
+    required this.interTokenP99Ms,
+    required this.interTokenMaxMs,
+    required this.requests,
+    required this.timeToFirstToken,
+    required this.interTokenLatency,
+    required this.loadWeightsMs,
+    required this.loadVocabMs,
+    required this.loadContextMs,
+    required this.loadMmprojMs,
+  });
+}
+
+/// Model weights that can be shared by several [Llamafu] instances and
+/// swapped in with [Llamafu.swapModel].
+///
+/// Loading the same file with the same placement again returns the weights
+/// already in memory. The weights are freed once every [SharedModel] is
+/// released and every instance using them is closed.
+class SharedModel {
+  final LlamafuBindings _bindings;
+  Pointer<Void> _nativeModel;
+
+  SharedModel._(this._bindings, this._nativeModel);
+
+  /// Loads (or reuses) the weights at [modelPath]. Placement options match
+  /// [Llamafu.init]. Loading runs on the calling thread; use [preload] to
+  /// keep it off.
+  static Future<SharedModel> load({
+    required String modelPath,
+    bool useGpu = false,
+    int? gpuLayers,
+    SplitMode splitMode = SplitMode.defaultMode,
+    int mainGpu = 0,
+    bool useMmap = true,
+    bool useMlock = false,
+  }) async {
+    final bindings = await LlamafuBindings.init();
+    final params = _modelParams(modelPath, useGpu, gpuLayers, splitMode, mainGpu, useMmap, useMlock);
+    final outModel = malloc<Pointer<Void>>();
+    try {
+      final result = bindings.llamafuModelLoad(params, outModel);
+      if (result != 0) {
+        throw Exception('Failed to load model: $result');
+      }
+      return SharedModel._(bindings, outModel.value);
+    } finally {
+      malloc.free(params.ref.model_path);
+      malloc.free(params);
+      malloc.free(outModel);
+    }
+  }
+
+  /// Starts loading [modelPath] on a background native thread and returns
+  /// immediately; see [ModelPreload].
+  static Future<ModelPreload> preload({
+    required String modelPath,
+    bool useGpu = false,
+    int? gpuLayers,
+    SplitMode splitMode = SplitMode.defaultMode,
+    int mainGpu = 0,
+    bool useMmap = true,
+    bool useMlock = false,
+  }) async {
+    final bindings = await LlamafuBindings.init();
+    final params = _modelParams(modelPath, useGpu, gpuLayers, splitMode, mainGpu, useMmap, useMlock);
+    final outLoad = malloc<Pointer<Void>>();
+    try {
+      final result = bindings.llamafuModelLoadAsync(params, outLoad);
+      if (result != 0) {
+        throw Exception('Failed to start loading model: $result');
+      }
+      return ModelPreload._(bindings, outLoad.value);
+    } finally {
+      malloc.free(params.ref.model_path);
+      malloc.free(params);
+      malloc.free(outLoad);
+    }
+  }
+
+  static Pointer<LlamafuModelParams> _modelParams(String modelPath, bool useGpu, int? gpuLayers,
+      SplitMode splitMode, int mainGpu, bool useMmap, bool useMlock) {
+    if (!Llamafu._isValidFilePath(modelPath)) {
+      throw ArgumentError('Invalid model path: $modelPath');
+    }
+    if (gpuLayers != null && gpuLayers < -1) {
+      throw ArgumentError('Invalid gpuLayers: $gpuLayers (must be -1 or more)');
+    }
+    if (mainGpu < 0) {
+      throw ArgumentError('Invalid mainGpu: $mainGpu');
+    }
+    final params = calloc<LlamafuModelParams>();
+    params.ref.model_path = modelPath.toNativeUtf8();
+    params.ref.use_gpu = useGpu ? 1 : 0;
+    params.ref.n_gpu_layers = gpuLayers ?? 0;
+    params.ref.split_mode = splitMode.value;
+    params.ref.main_gpu = mainGpu;
+    params.ref.no_mmap = useMmap ? 0 : 1;
+    params.ref.use_mlock = useMlock ? 1 : 0;
+    return params;
+  }
+
+  Pointer<Void> _checkedHandle() {
+    if (_nativeModel == nullptr) {
+      throw StateError('SharedModel has been released');
+    }
+    return _nativeModel;
+  }
+
+  /// References held by [SharedModel]s and instances, 0 once released.
+  int get refCount => _nativeModel == nullptr ? 0 : _bindings.llamafuModelRefCount(_nativeModel);
+
+  /// Drops this reference. Instances created from the model keep working.
+  void release() {
+    if (_nativeModel != nullptr) {
+      _bindings.llamafuModelRelease(_nativeModel);
+      _nativeModel = nullptr;
+    }
+  }
+}
+
+/// A model loading in the background, started by [SharedModel.preload].
+class ModelPreload {
+  final LlamafuBindings _bindings;
+  Pointer<Void> _nativeLoad;
+  Future<SharedModel>? _model;
+
+  ModelPreload._(this._bindings, this._nativeLoad);
+
+  /// Load progress in [0, 1].
+  double get progress {
+    if (_nativeLoad == nullptr) return 1.0;
+    final outProgress = malloc<Float>();
+    try {
+      _bindings.llamafuModelLoadPoll(_nativeLoad, outProgress, nullptr);
+      return outProgress.value;
+    } finally {
+      malloc.free(outProgress);
+    }
+  }
+
+  /// Completes with the loaded model once loading finishes, polling every
+  /// [interval]. Throws [StateError] if the load was cancelled.
+  Future<SharedModel> model({Duration interval = const Duration(milliseconds: 50)}) {
+    return _model ??= _poll(interval);
+  }
+
+  Future<SharedModel> _poll(Duration interval) async {
+    final outModel = malloc<Pointer<Void>>();
+    try {
+      while (true) {
+        if (_nativeLoad == nullptr) {
+          throw StateError('Model preload was disposed');
+        }
+        final result = _bindings.llamafuModelLoadPoll(_nativeLoad, nullptr, outModel);
+        if (result == 0) {
+          return SharedModel._(_bindings, outModel.value);
+        }
+        if (result == Llamafu._errorAborted) {
+          throw StateError('Model preload was cancelled');
+        }
+        if (result != Llamafu._errorBusy) {
+          throw Exception('Failed to load model: $result');
+        }
+        await Future<void>.delayed(interval);
+      }
+    } finally {
+      malloc.free(outModel);
+    }
+  }
+
+  /// Asks the loader to stop; [model] then throws.
+  void cancel() {
+    if (_nativeLoad != nullptr) {
+      _bindings.llamafuModelLoadCancel(_nativeLoad);
+    }
+  }
+
+  /// Stops a running load and releases the native handle. A model already
+  /// returned by [model] stays valid and must be released separately.
+  void dispose() {
+    if (_nativeLoad != nullptr) {
+      _bindings.llamafuModelLoadFree(_nativeLoad);
+      _nativeLoad = nullptr;
+    }
+  }
+}
+
+/// Prompt cache directory statistics.
+class PromptCacheStats {
+  /// Saved prompt states of this model.
+  final int entries;
+
+  /// Prefills that restored a saved state.
+  final int hits;
+
+  /// Prefills that shared no block with any saved state.
+  final int misses;
+
+  final int bytes;
+  final int maxBytes;
+
+  const PromptCacheStats({
+    required this.entries,
+    required this.hits,
+    required this.misses,
+    required this.bytes,
+    required this.maxBytes,
+  });
+
+  double get hitRate => hits + misses > 0 ? hits / (hits + misses) : 0;
+}
+
+/// Image embedding cache statistics.
+class ImageCacheStats {
+  /// Images with cached embeddings.
+  final int entries;
+
+  /// Images served from the cache.
+  final int hits;
+
+  /// Images that had to be decoded and encoded.
+  final int misses;
+
+  final int bytes;
+  final int maxBytes;
+
+  const ImageCacheStats({
+    required this.entries,
+    required this.hits,
+    required this.misses,
+    required this.bytes,
+    required this.maxBytes,
+  });
+
+  double get hitRate => hits + misses > 0 ? hits / (hits + misses) : 0;
+}
+
 /// Memory usage statistics.
 class MemoryUsage {
   final int modelSizeBytes;
@@ -2483,18 +4367,82 @@ class MemoryUsage {
   final int computeBufferSizeBytes;
   final int totalSizeBytes;
 
+  /// Weights in host memory and in accelerator buffers.
+  final int modelHostBytes;
+  final int modelDeviceBytes;
+
+  final int outputBufferBytes;
+
+  /// Vision projector weights.
+  final int clipSizeBytes;
+
+  /// Loaded LoRA adapters, active or not.
+  final int loraBytes;
+
+  /// Process footprint now and the peak resident set.
+  final int rssBytes;
+  final int peakRssBytes;
+
+  /// Whether sizes come from the buffers llama.cpp allocated rather than
+  /// from the model's dimensions.
+  final bool measured;
+
   const MemoryUsage({
     required this.modelSizeBytes,
     required this.kvCacheSizeBytes,
     required this.computeBufferSizeBytes,
     required this.totalSizeBytes,
+    this.modelHostBytes = 0,
+    this.modelDeviceBytes = 0,
+    this.outputBufferBytes = 0,
+    this.clipSizeBytes = 0,
+    this.loraBytes = 0,
+    this.rssBytes = 0,
+    this.peakRssBytes = 0,
+    this.measured = false,
   });
 
+  MemoryUsage._fromStruct(LlamafuMemoryUsageStruct usage)
+      : modelSizeBytes = usage.model_size_bytes,
+        kvCacheSizeBytes = usage.kv_cache_size_bytes,
+        computeBufferSizeBytes = usage.compute_buffer_size_bytes,
+        totalSizeBytes = usage.total_size_bytes,
+        modelHostBytes = usage.model_host_bytes,
+        modelDeviceBytes = usage.model_device_bytes,
+        outputBufferBytes = usage.output_buffer_bytes,
+        clipSizeBytes = usage.clip_size_bytes,
+        loraBytes = usage.lora_bytes,
+        rssBytes = usage.rss_bytes,
+        peakRssBytes = usage.peak_rss_bytes,
+        measured = usage.measured != 0;
+
+  /// Whether the accounted buffers fit in [budgetBytes].
+  bool fitsIn(int budgetBytes) => totalSizeBytes <= budgetBytes;
+
   double get modelSizeMb => modelSizeBytes / (1024 * 1024);
   double get kvCacheSizeMb => kvCacheSizeBytes / (1024 * 1024);
   double get totalSizeMb => totalSizeBytes / (1024 * 1024);
 }
 
+/// What a backend buffer holds.
+enum BufferKind { weights, kvCache, recurrentState, output, compute, lora }
+
+/// A backend buffer llama.cpp allocated for an instance.
+class BufferInfo {
+  /// ggml buffer type, e.g. `CPU_Mapped`, `Metal` or `Vulkan0`.
+  final String bufferType;
+  final BufferKind kind;
+  final bool isHost;
+  final int sizeBytes;
+
+  const BufferInfo({
+    required this.bufferType,
+    required this.kind,
+    required this.isHost,
+    required this.sizeBytes,
+  });
+}
+
 /// Benchmark result.
 class BenchmarkResult {
   final int promptTokens;
@@ -2516,6 +4464,121 @@ class BenchmarkResult {
   });
 }
 
+/// Timing statistics of one benchmark phase.
+class BenchStats {
+  final int tokens;
+  final int samples;
+
+  /// Mean and standard deviation of the time per repetition.
+  final double meanMs;
+  final double stddevMs;
+
+  /// Tokens per second over repetitions.
+  final double meanTps;
+  final double stddevTps;
+
+  /// Per-token latency percentiles.
+  final double p50Ms;
+  final double p99Ms;
+
+  const BenchStats({
+    required this.tokens,
+    required this.samples,
+    required this.meanMs,
+    required this.stddevMs,
+    required this.meanTps,
+    required this.stddevTps,
+    required this.p50Ms,
+    required this.p99Ms,
+  });
+
+  BenchStats._fromStruct(LlamafuBenchStatsStruct stats)
+      : tokens = stats.n_tokens,
+        samples = stats.n_samples,
+        meanMs = stats.mean_ms,
+        stddevMs = stats.stddev_ms,
+        meanTps = stats.mean_tps,
+        stddevTps = stats.stddev_tps,
+        p50Ms = stats.p50_ms,
+        p99Ms = stats.p99_ms;
+}
+
+/// Result of [Llamafu.benchmarkRun].
+class BenchRunResult {
+  final BenchStats prompt;
+  final BenchStats generation;
+
+  const BenchRunResult({required this.prompt, required this.generation});
+}
+
+/// Settings for one inference threadpool.
+class ThreadpoolConfig {
+  /// Worker threads; null runs one per selected core.
+  final int? threads;
+  final CoreClass cores;
+
+  /// Explicit affinity (bit i = CPU i); overrides [cores].
+  final int? cpuMask;
+
+  /// -1 low, 0 normal, 1 medium, 2 high, 3 realtime.
+  final int priority;
+
+  /// Busy-wait level before idle threads sleep (0-100).
+  final int poll;
+
+  /// Pins each thread to its own CPU of the mask.
+  final bool strictCpu;
+
+  const ThreadpoolConfig({
+    this.threads,
+    this.cores = CoreClass.all,
+    this.cpuMask,
+    this.priority = 0,
+    this.poll = 50,
+    this.strictCpu = false,
+  });
+}
+
+/// Performance and efficiency cores of the device.
+class CpuTopology {
+  final int cpus;
+  final int performanceCores;
+  final int efficiencyCores;
+
+  /// Bit i = CPU i; 0 where thread affinity is unsupported (Apple).
+  final int performanceMask;
+  final int efficiencyMask;
+
+  const CpuTopology({
+    required this.cpus,
+    required this.performanceCores,
+    required this.efficiencyCores,
+    required this.performanceMask,
+    required this.efficiencyMask,
+  });
+
+  bool get isHybrid => efficiencyCores > 0;
+}
+
+/// Threadpools chosen by [Llamafu.autotuneThreads].
+class AutotuneResult {
+  final ThreadpoolConfig decode;
+  final ThreadpoolConfig prefill;
+  final double generationSpeedTps;
+  final double promptSpeedTps;
+
+  /// Whether the result came from the cache file instead of a sweep.
+  final bool fromCache;
+
+  const AutotuneResult({
+    required this.decode,
+    required this.prefill,
+    required this.generationSpeedTps,
+    required this.promptSpeedTps,
+    required this.fromCache,
+  });
+}
+
 /// Language detection result.
 class LanguageDetection {
   final String languageCode;
@@ -2665,9 +4728,7 @@ class ChatSession {
     if (mediaInputs != null && mediaInputs.isNotEmpty) {
       mediaArray = malloc<LlamafuMediaInput>(mediaInputs.length);
       for (int i = 0; i < mediaInputs.length; i++) {
-        mediaArray[i].type = mediaInputs[i].type.index;
-        mediaArray[i].data = mediaInputs[i].data.toNativeUtf8();
-        mediaArray[i].data_size = mediaInputs[i].data.length;
+        mediaInputs[i]._writeTo(mediaArray[i]);
       }
     }
 
@@ -2712,10 +4773,152 @@ class ChatSession {
     return history;
   }
 
+  /// Number of tokens this session holds in the KV cache.
+  ///
+  /// Always 0 for sessions created without a KV sequence.
+  int get committedTokens {
+    final outNPast = malloc<Int32>();
+    final result = _bindings.llamafuChatSessionGetNPast(_nativeSession, outNPast);
+    final nPast = outNPast.value;
+    malloc.free(outNPast);
+
+    if (result != 0) {
+      throw Exception('Failed to get committed tokens: $result');
+    }
+    return nPast;
+  }
+
+  /// Sets the sampling used by later [complete] calls.
+  void setSampling({
+    int maxTokens = 256,
+    double temperature = 0.7,
+    SamplingParams sampling = const SamplingParams(topK: 40, topP: 0.9),
+  }) {
+    final params = calloc<LlamafuInferParams>();
+    params.ref.max_tokens = maxTokens;
+    params.ref.temperature = temperature;
+    sampling._writeTo(params.ref);
+
+    final result = _bindings.llamafuChatSessionSetParams(_nativeSession, params);
+    calloc.free(params);
+
+    if (result != 0) {
+      throw Exception('Failed to set chat sampling: $result');
+    }
+  }
+
   /// Disposes of the chat session.
   void dispose() => _bindings.llamafuChatSessionFree(_nativeSession);
 }
 
+// =============================================================================
+// SCHEDULED REQUEST CLASS
+// =============================================================================
+
+/// Lifecycle of a [ScheduledRequest].
+enum ScheduledRequestState { queued, prefilling, generating, done, failed, cancelled }
+
+/// Output of a single [ScheduledRequest.poll].
+class ScheduledRequestUpdate {
+  /// Text generated since the previous poll.
+  final String text;
+  final ScheduledRequestState state;
+
+  const ScheduledRequestUpdate({required this.text, required this.state});
+
+  bool get isFinished =>
+      state == ScheduledRequestState.done ||
+      state == ScheduledRequestState.failed ||
+      state == ScheduledRequestState.cancelled;
+}
+
+/// A completion running on the batching scheduler.
+class ScheduledRequest {
+  final LlamafuBindings _bindings;
+  final Pointer<Void> _nativeRequest;
+
+  ScheduledRequest._(this._bindings, this._nativeRequest);
+
+  /// Returns new output and the current state.
+  ///
+  /// Throws an exception if the request failed.
+  ScheduledRequestUpdate poll() {
+    final outText = malloc<Pointer<Utf8>>();
+    final outState = malloc<Int32>();
+    outText.value = nullptr;
+    outState.value = ScheduledRequestState.queued.index;
+
+    final result = _bindings.llamafuRequestPoll(_nativeRequest, outText, outState);
+    final state = ScheduledRequestState.values[outState.value];
+    malloc.free(outState);
+
+    final text = outText.value == nullptr ? '' : outText.value.toDartString();
+    if (outText.value != nullptr) _bindings.llamafuFreeString(outText.value);
+    malloc.free(outText);
+
+    if (result != 0) {
+      throw Exception('Scheduled request failed: $result');
+    }
+    return ScheduledRequestUpdate(text: text, state: state);
+  }
+
+  /// Cancels the request at the next scheduler step.
+  void cancel() => _bindings.llamafuRequestCancel(_nativeRequest);
+
+  /// Releases the request handle, cancelling it if still running.
+  void dispose() => _bindings.llamafuRequestFree(_nativeRequest);
+}
+
+/// A completion submitted with [Llamafu.enqueue].
+class QueuedCompletion {
+  final LlamafuBindings _bindings;
+  final Completer<String> _completer = Completer<String>();
+  late final NativeCallable<LlamafuJobCallbackC> _onDone;
+  LlamafuJob _job = nullptr;
+
+  /// Native LLAMAFU_ERROR_ABORTED, the result of a cancelled job.
+  static const int _errorAborted = -36;
+
+  QueuedCompletion._(this._bindings) {
+    // Delivered on this isolate after the job ended; the native text pointer
+    // is gone by then, so the output is fetched from the job instead
+    _onDone = NativeCallable<LlamafuJobCallbackC>.listener(
+        (int result, int state, Pointer<Utf8> text, Pointer<Void> userData) => _finish());
+  }
+
+  /// The generated text. Fails with a [StateError] if the job was
+  /// cancelled.
+  Future<String> get result => _completer.future;
+
+  /// Cancels the job, stopping it mid-prefill or mid-generation if it has
+  /// already started.
+  void cancel() {
+    if (_job != nullptr) {
+      _bindings.llamafuJobCancel(_job);
+    }
+  }
+
+  void _finish() {
+    final outText = malloc<Pointer<Utf8>>();
+    final result = _bindings.llamafuJobWait(_job, -1, outText);
+    final text = outText.value == nullptr ? '' : outText.value.toDartString();
+    if (outText.value != nullptr) _bindings.llamafuFreeString(outText.value);
+    malloc.free(outText);
+
+    _bindings.llamafuJobFree(_job);
+    _job = nullptr;
+    _onDone.close();
+
+    if (result == 0) {
+      _completer.complete(text);
+    } else if (result == _errorAborted) {
+      _completer.completeError(StateError('Queued completion was cancelled'));
+    } else {
+      _completer.completeError(Exception('Queued completion failed: $result'));
+    }
+  }
+}
+
 // =============================================================================
 // IMAGE/AUDIO RESULT CLASSES
 // =============================================================================
@@ -2751,6 +4954,14 @@ class ImageProcessResult {
   final bool wasPadded;
   final double processingTimeMs;
 
+  /// Time spent per stage; all zero when [fromCache] is set.
+  final double decodeTimeMs;
+  final double preprocessTimeMs;
+  final double encodeTimeMs;
+
+  /// Whether the embeddings came from the image cache.
+  final bool fromCache;
+
   const ImageProcessResult({
     required this.embeddings,
     required this.nTokens,
@@ -2759,6 +4970,10 @@ class ImageProcessResult {
     required this.wasResized,
     required this.wasPadded,
     required this.processingTimeMs,
+    this.decodeTimeMs = 0.0,
+    this.preprocessTimeMs = 0.0,
+    this.encodeTimeMs = 0.0,
+    this.fromCache = false,
   });
 }
 
@@ -2794,4 +5009,19 @@ class LoraCompatibilityResult {
     required this.isCompatible,
     this.errorMessage,
   });
-}
\ No newline at end of file
+}
+
+/// Forwards decoded stream text to a controller, skipping empty chunks.
+class _StreamTextSink implements Sink<String> {
+  final StreamController<String> _controller;
+
+  _StreamTextSink(this._controller);
+
+  @override
+  void add(String data) {
+    if (data.isNotEmpty) _controller.add(data);
+  }
+
+  @override
+  void close() {}
+}
@@ -5,6 +5,12 @@ import 'package:ffi/ffi.dart';
 /// Opaque handle to the Llamafu instance.
 typedef Llamafu = Pointer<Void>;
 
+/// Opaque handle to loaded model weights shared between instances.
+typedef LlamafuModel = Pointer<Void>;
+
+/// Opaque handle to a background model load.
+typedef LlamafuModelLoad = Pointer<Void>;
+
 /// Opaque handle to the LoRA adapter.
 typedef LlamafuLoraAdapter = Pointer<Void>;
 
@@ -20,6 +26,11 @@ typedef LlamafuBatchHandle = Pointer<Void>;
 /// Opaque handle to a chat session.
 typedef LlamafuChatSession = Pointer<Void>;
 
+/// Opaque handle to a request submitted to the batching scheduler.
+typedef LlamafuRequest = Pointer<Void>;
+typedef LlamafuTokenStream = Pointer<Void>;
+typedef LlamafuJob = Pointer<Void>;
+
 /// Token type.
 typedef LlamafuToken = Int32;
 
@@ -72,17 +83,172 @@ final class LlamafuModelParams extends Struct {
   /// Whether to use GPU for multi-modal processing.
   @Uint8()
   external int use_gpu;
+
+  /// Layers to offload: 0 = all if [use_gpu] else none, -1 = all, N = first N.
+  @Int32()
+  external int n_gpu_layers;
+
+  /// 0 = default (layer), 1 = none, 2 = layer, 3 = row.
+  @Int32()
+  external int split_mode;
+
+  @Int32()
+  external int main_gpu;
+
+  @Uint8()
+  external int no_mmap;
+
+  @Uint8()
+  external int use_mlock;
+
+  /// [LlamafuLoadProgressCallbackC], may be null.
+  external Pointer<NativeFunction<LlamafuLoadProgressCallbackC>> progress_callback;
+
+  external Pointer<Void> progress_callback_data;
+}
+
+/// Model load progress in [0, 1]; returning false cancels loading.
+typedef LlamafuLoadProgressCallbackC = Bool Function(Float progress, Pointer<Void> user_data);
+
+/// Context parameters for [LlamafuBindings.llamafuInitWithContext].
+final class LlamafuContextParamsStruct extends Struct {
+  @Uint32()
+  external int n_ctx;
+
+  /// Prompt prefill chunk size.
+  @Uint32()
+  external int n_batch;
+
+  /// Physical batch size for computation (<= n_batch).
+  @Uint32()
+  external int n_ubatch;
+
+  @Uint32()
+  external int n_seq_max;
+
+  @Int32()
+  external int n_threads;
+
+  @Int32()
+  external int n_threads_batch;
+
+  @Float()
+  external double rope_freq_base;
+
+  @Float()
+  external double rope_freq_scale;
+
+  @Float()
+  external double yarn_ext_factor;
+
+  @Float()
+  external double yarn_attn_factor;
+
+  @Float()
+  external double yarn_beta_fast;
+
+  @Float()
+  external double yarn_beta_slow;
+
+  @Uint32()
+  external int yarn_orig_ctx;
+
+  @Bool()
+  external bool embeddings;
+
+  @Bool()
+  external bool causal_attn;
+
+  @Bool()
+  external bool offload_kqv;
+
+  @Bool()
+  external bool flash_attn;
+
+  external Pointer<Void> abort_callback;
+  external Pointer<Void> abort_callback_data;
+
+  /// 0 = generation, 1 = embedding, 2 = both.
+  @Int32()
+  external int context_mode;
+
+  /// Embedding pooling (-1 = model default).
+  @Int32()
+  external int pooling_type;
+
+  /// KV cache element types, see [KvCacheType].
+  @Int32()
+  external int type_k;
+
+  @Int32()
+  external int type_v;
+
+  @Bool()
+  external bool context_shift;
+
+  @Int32()
+  external int n_keep;
 }
 
 /// Inference parameters structure
 final class LlamafuInferParams extends Struct {
   external Pointer<Utf8> prompt;
-  
+
   @Int32()
   external int max_tokens;
-  
+
   @Float()
   external double temperature;
+
+  @Int32()
+  external int top_k;
+
+  @Float()
+  external double top_p;
+
+  @Float()
+  external double min_p;
+
+  @Float()
+  external double typical_p;
+
+  @Float()
+  external double repeat_penalty;
+
+  @Int32()
+  external int repeat_last_n;
+
+  @Float()
+  external double frequency_penalty;
+
+  @Float()
+  external double presence_penalty;
+
+  @Bool()
+  external bool penalize_nl;
+
+  @Bool()
+  external bool ignore_eos;
+
+  @Int32()
+  external int mirostat;
+
+  @Float()
+  external double mirostat_tau;
+
+  @Float()
+  external double mirostat_eta;
+
+  @Uint32()
+  external int seed;
+
+  external Pointer<Utf8> grammar_str;
+  external Pointer<Utf8> grammar_root;
+  external Pointer<LlamafuLoraBatchStruct> lora_batch;
+
+  external Pointer<Pointer<Utf8>> stop_sequences;
+  @Int32()
+  external int n_stop_sequences;
 }
 
 /// Constrained generation parameters structure
@@ -102,10 +268,55 @@ class LlamafuMediaType {
 final class LlamafuMediaInput extends Struct {
   @Int32()
   external int type;
+
+  @Int32()
+  external int source_type;
+
   external Pointer<Utf8> data;
-  
+
   @IntPtr()
   external int data_size;
+
+  @Int32()
+  external int image_format;
+
+  @Int32()
+  external int width;
+
+  @Int32()
+  external int height;
+
+  @Int32()
+  external int audio_format;
+
+  @Int32()
+  external int sample_rate;
+
+  @Int32()
+  external int channels;
+
+  @Int32()
+  external int duration_ms;
+
+  @Bool()
+  external bool resize_to_model;
+
+  @Bool()
+  external bool maintain_aspect_ratio;
+
+  @Bool()
+  external bool pad_to_square;
+
+  @Bool()
+  external bool resample_audio;
+
+  external Pointer<Utf8> caption;
+
+  @Float()
+  external double quality_hint;
+
+  @Int64()
+  external int timestamp_ms;
 }
 
 /// Multi-modal inference parameters
@@ -121,6 +332,35 @@ final class LlamafuMultimodalInferParams extends Struct {
 
   @Float()
   external double temperature;
+
+  @Int32()
+  external int top_k;
+
+  @Float()
+  external double top_p;
+
+  @Float()
+  external double min_p;
+
+  @Float()
+  external double repeat_penalty;
+
+  @Bool()
+  external bool include_image_tokens;
+
+  @Bool()
+  external bool preserve_image_order;
+
+  external Pointer<Utf8> image_token_format;
+
+  @Int32()
+  external int vision_threads;
+
+  @Bool()
+  external bool use_vision_cache;
+
+  external Pointer<Void> structured_output;
+  external Pointer<LlamafuLoraBatchStruct> lora_batch;
 }
 
 /// Model information structure
@@ -203,6 +443,189 @@ final class LlamafuPerfStatsStruct extends Struct {
 
   @Double()
   external double t_eval_per_token_ms;
+
+  @Int32()
+  external int n_reused;
+
+  @Int32()
+  external int n_drafted;
+
+  @Int32()
+  external int n_draft_accepted;
+
+  @Float()
+  external double draft_acceptance_rate;
+
+  @Double()
+  external double tokens_per_second;
+
+  @Int32()
+  external int n_restored;
+
+  @Int32()
+  external int n_prefilled;
+}
+
+/// Latency distribution: bucket 0 counts samples under 1 ms, bucket i those
+/// in [2^(i-1), 2^i) ms and the last one everything longer.
+final class LlamafuLatencyHistogramStruct extends Struct {
+  @Array(16)
+  external Array<Uint64> counts;
+
+  @Uint64()
+  external int n_samples;
+
+  @Double()
+  external double sum_ms;
+
+  @Double()
+  external double max_ms;
+}
+
+/// Request timings, see [LlamafuBindings.llamafuGetRequestMetrics].
+final class LlamafuRequestMetricsStruct extends Struct {
+  @Double()
+  external double t_tokenize_ms;
+
+  @Double()
+  external double t_prefill_ms;
+
+  @Double()
+  external double t_first_token_ms;
+
+  @Double()
+  external double t_sample_ms;
+
+  @Double()
+  external double t_decode_ms;
+
+  @Double()
+  external double t_detokenize_ms;
+
+  @Double()
+  external double t_callback_ms;
+
+  @Double()
+  external double t_total_ms;
+
+  @Int32()
+  external int n_prompt_tokens;
+
+  @Int32()
+  external int n_generated;
+
+  @Int32()
+  external int n_sample;
+
+  @Double()
+  external double itl_p50_ms;
+
+  @Double()
+  external double itl_p99_ms;
+
+  @Double()
+  external double itl_max_ms;
+
+  @Uint64()
+  external int n_requests;
+
+  external LlamafuLatencyHistogramStruct ttft;
+
+  external LlamafuLatencyHistogramStruct itl;
+
+  @Double()
+  external double t_load_weights_ms;
+
+  @Double()
+  external double t_load_vocab_ms;
+
+  @Double()
+  external double t_load_context_ms;
+
+  @Double()
+  external double t_load_mmproj_ms;
+}
+
+/// Log-probability of one token.
+final class LlamafuTokenLogprobStruct extends Struct {
+  @Int32()
+  external int token;
+
+  @Float()
+  external double logprob;
+}
+
+/// Scores of one continuation within a [LlamafuScoreResultStruct].
+final class LlamafuContinuationScoreStruct extends Struct {
+  @Int32()
+  external int first;
+
+  @Int32()
+  external int n_tokens;
+
+  @Double()
+  external double logprob_sum;
+
+  @Bool()
+  external bool is_greedy;
+}
+
+/// Result of [LlamafuBindings.llamafuScoreContinuations], one allocation
+/// freed with [LlamafuBindings.llamafuScoreResultFree].
+final class LlamafuScoreResultStruct extends Struct {
+  external Pointer<LlamafuContinuationScoreStruct> continuations;
+
+  external Pointer<LlamafuTokenLogprobStruct> tokens;
+
+  external Pointer<LlamafuTokenLogprobStruct> top;
+
+  @Int32()
+  external int n_continuations;
+
+  @Int32()
+  external int n_tokens;
+
+  @Int32()
+  external int top_k;
+
+  @Int32()
+  external int n_prefix_tokens;
+}
+
+/// Prompt cache directory statistics, see [LlamafuBindings.llamafuPromptCacheGetStats].
+final class LlamafuPromptCacheStatsStruct extends Struct {
+  @Int32()
+  external int n_entries;
+
+  @Int32()
+  external int n_hits;
+
+  @Int32()
+  external int n_misses;
+
+  @Uint64()
+  external int n_bytes;
+
+  @Uint64()
+  external int max_bytes;
+}
+
+/// Speculative decoding configuration for [LlamafuBindings.llamafuSetSpeculative].
+final class LlamafuSpeculativeParamsStruct extends Struct {
+  /// 0 = none, 1 = n-gram prompt lookup, 2 = draft model.
+  @Int32()
+  external int draft_type;
+
+  @Int32()
+  external int n_draft;
+
+  @Int32()
+  external int ngram_min;
+
+  @Int32()
+  external int ngram_max;
+
+  external Pointer<Utf8> draft_model_path;
 }
 
 /// Timings structure
@@ -248,6 +671,47 @@ final class LlamafuMemoryUsageStruct extends Struct {
 
   @Uint64()
   external int total_size_bytes;
+
+  @Uint64()
+  external int model_host_bytes;
+
+  @Uint64()
+  external int model_device_bytes;
+
+  @Uint64()
+  external int output_buffer_bytes;
+
+  @Uint64()
+  external int clip_size_bytes;
+
+  @Uint64()
+  external int rss_bytes;
+
+  @Uint64()
+  external int peak_rss_bytes;
+
+  /// 1 when sizes come from the buffers llama.cpp allocated, 0 when estimated.
+  @Uint8()
+  external int measured;
+
+  @Uint64()
+  external int lora_bytes;
+}
+
+/// One backend buffer allocated for a handle, see [LlamafuBindings.llamafuGetBufferInfo].
+final class LlamafuBufferInfoStruct extends Struct {
+  @Array(32)
+  external Array<Uint8> buffer_type;
+
+  /// 0 = weights, 1 = KV cache, 2 = recurrent state, 3 = output, 4 = compute.
+  @Int32()
+  external int kind;
+
+  @Uint8()
+  external int is_host;
+
+  @Uint64()
+  external int size_bytes;
 }
 
 /// Benchmark result structure
@@ -274,6 +738,118 @@ final class LlamafuBenchResultStruct extends Struct {
   external double generation_speed_tps;
 }
 
+/// Benchmark test configuration
+final class LlamafuBenchParamsStruct extends Struct {
+  @Int32()
+  external int n_prompt;
+
+  @Int32()
+  external int n_gen;
+
+  @Int32()
+  external int n_batch;
+
+  @Int32()
+  external int n_threads;
+
+  @Int32()
+  external int repetitions;
+
+  @Int32()
+  external int warmup;
+}
+
+/// Benchmark statistics of one phase
+final class LlamafuBenchStatsStruct extends Struct {
+  @Int32()
+  external int n_tokens;
+
+  @Int32()
+  external int n_samples;
+
+  @Double()
+  external double mean_ms;
+
+  @Double()
+  external double stddev_ms;
+
+  @Double()
+  external double mean_tps;
+
+  @Double()
+  external double stddev_tps;
+
+  @Double()
+  external double p50_ms;
+
+  @Double()
+  external double p99_ms;
+}
+
+/// Threadpool configuration
+final class LlamafuThreadpoolParamsStruct extends Struct {
+  @Int32()
+  external int n_threads;
+
+  /// 0 = all cores, 1 = performance cores, 2 = efficiency cores.
+  @Int32()
+  external int core_class;
+
+  @Uint64()
+  external int cpumask;
+
+  @Int32()
+  external int priority;
+
+  @Uint32()
+  external int poll;
+
+  @Bool()
+  external bool strict_cpu;
+}
+
+/// CPU core classes
+final class LlamafuCpuTopologyStruct extends Struct {
+  @Int32()
+  external int n_cpus;
+
+  @Int32()
+  external int n_performance;
+
+  @Int32()
+  external int n_efficiency;
+
+  @Uint64()
+  external int performance_mask;
+
+  @Uint64()
+  external int efficiency_mask;
+}
+
+/// Thread autotune result
+final class LlamafuAutotuneResultStruct extends Struct {
+  @Int32()
+  external int n_threads;
+
+  @Int32()
+  external int core_class;
+
+  @Int32()
+  external int n_threads_batch;
+
+  @Int32()
+  external int core_class_batch;
+
+  @Float()
+  external double generation_speed_tps;
+
+  @Float()
+  external double prompt_speed_tps;
+
+  @Bool()
+  external bool from_cache;
+}
+
 /// Structured output configuration
 final class LlamafuStructuredOutputStruct extends Struct {
   @Int32()
@@ -327,6 +903,24 @@ final class LlamafuImageValidationStruct extends Struct {
   external double estimated_processing_time_ms;
 }
 
+/// Image embedding cache statistics, see [LlamafuBindings.llamafuImageCacheGetStats].
+final class LlamafuImageCacheStatsStruct extends Struct {
+  @Int32()
+  external int n_entries;
+
+  @Int32()
+  external int n_hits;
+
+  @Int32()
+  external int n_misses;
+
+  @Uint64()
+  external int n_bytes;
+
+  @Uint64()
+  external int max_bytes;
+}
+
 /// Image process result
 final class LlamafuImageProcessResultStruct extends Struct {
   external Pointer<Float> embeddings;
@@ -354,6 +948,18 @@ final class LlamafuImageProcessResultStruct extends Struct {
 
   @IntPtr()
   external int memory_used_bytes;
+
+  @Double()
+  external double decode_time_ms;
+
+  @Double()
+  external double preprocess_time_ms;
+
+  @Double()
+  external double encode_time_ms;
+
+  @Bool()
+  external bool from_cache;
 }
 
 /// Audio process result
@@ -409,6 +1015,20 @@ final class LlamafuLoraAdapterInfoStruct extends Struct {
   external int created_timestamp;
 }
 
+/// A set of LoRA adapters and their scales.
+final class LlamafuLoraBatchStruct extends Struct {
+  external Pointer<LlamafuLoraAdapter> adapters;
+  external Pointer<Float> scales;
+
+  @Size()
+  external int n_adapters;
+
+  @Bool()
+  external bool merge_adapters;
+
+  external Pointer<Utf8> merge_strategy;
+}
+
 /// Tool definition for tool calling API
 final class LlamafuToolStruct extends Struct {
   external Pointer<Utf8> name;
@@ -485,6 +1105,16 @@ typedef LlamafuInitC = LlamafuError Function(
 typedef LlamafuInitDart = int Function(
     Pointer<LlamafuModelParams> params, Pointer<Llamafu> out_llamafu);
 
+typedef LlamafuContextDefaultParamsC = LlamafuContextParamsStruct Function();
+typedef LlamafuContextDefaultParamsDart = LlamafuContextParamsStruct Function();
+
+typedef LlamafuInitWithContextC = LlamafuError Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuContextParamsStruct> context_params,
+    Pointer<Llamafu> out_llamafu);
+typedef LlamafuInitWithContextDart = int Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuContextParamsStruct> context_params,
+    Pointer<Llamafu> out_llamafu);
+
 typedef LlamafuCompleteC = LlamafuError Function(
     Llamafu llamafu, Pointer<LlamafuInferParams> params, Pointer<Pointer<Utf8>> out_result);
 typedef LlamafuCompleteDart = int Function(
@@ -585,6 +1215,15 @@ typedef LlamafuTokenizeDart = int Function(
     Pointer<Pointer<Int32>> out_tokens, Pointer<Int32> out_n_tokens,
     bool add_special, bool parse_special);
 
+typedef LlamafuTokenizeBatchC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Pointer<Utf8>> texts, Int32 n_texts,
+    Pointer<Int32> out_tokens, Int32 capacity, Pointer<Int32> out_offsets,
+    Pointer<Int32> out_n_tokens, Bool add_special, Bool parse_special);
+typedef LlamafuTokenizeBatchDart = int Function(
+    Llamafu llamafu, Pointer<Pointer<Utf8>> texts, int n_texts,
+    Pointer<Int32> out_tokens, int capacity, Pointer<Int32> out_offsets,
+    Pointer<Int32> out_n_tokens, bool add_special, bool parse_special);
+
 typedef LlamafuDetokenizeC = LlamafuError Function(
     Llamafu llamafu, Pointer<Int32> tokens, Int32 n_tokens,
     Pointer<Pointer<Utf8>> out_text, Bool remove_special, Bool unparse_special);
@@ -617,6 +1256,37 @@ typedef LlamafuGetEmbeddingsDart = int Function(
     Llamafu llamafu, Pointer<Utf8> text,
     Pointer<Pointer<Float>> out_embeddings, Pointer<Int32> out_n_embd);
 
+typedef LlamafuGetEmbeddingsBatchC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Pointer<Utf8>> texts, Int32 n_texts,
+    Int32 pooling, Bool normalize,
+    Pointer<Float> out_embeddings, Size out_capacity, Pointer<Int32> out_n_embd);
+typedef LlamafuGetEmbeddingsBatchDart = int Function(
+    Llamafu llamafu, Pointer<Pointer<Utf8>> texts, int n_texts,
+    int pooling, bool normalize,
+    Pointer<Float> out_embeddings, int out_capacity, Pointer<Int32> out_n_embd);
+
+// Scoring
+typedef LlamafuGetTopLogprobsIthC = LlamafuError Function(
+    Llamafu llamafu, Int32 i, Int32 k, Pointer<LlamafuTokenLogprobStruct> out, Pointer<Int32> out_n);
+typedef LlamafuGetTopLogprobsIthDart = int Function(
+    Llamafu llamafu, int i, int k, Pointer<LlamafuTokenLogprobStruct> out, Pointer<Int32> out_n);
+typedef LlamafuScoreContinuationsC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Utf8> prefix, Pointer<Pointer<Utf8>> continuations, Int32 n_continuations,
+    Int32 top_k, Pointer<Pointer<LlamafuScoreResultStruct>> out_result);
+typedef LlamafuScoreContinuationsDart = int Function(
+    Llamafu llamafu, Pointer<Utf8> prefix, Pointer<Pointer<Utf8>> continuations, int n_continuations,
+    int top_k, Pointer<Pointer<LlamafuScoreResultStruct>> out_result);
+typedef LlamafuScoreResultFreeC = Void Function(Pointer<LlamafuScoreResultStruct> result);
+typedef LlamafuScoreResultFreeDart = void Function(Pointer<LlamafuScoreResultStruct> result);
+typedef LlamafuRerankC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Utf8> query, Pointer<Pointer<Utf8>> documents, Int32 n_documents,
+    Pointer<Float> out_scores, Size out_capacity);
+typedef LlamafuRerankDart = int Function(
+    Llamafu llamafu, Pointer<Utf8> query, Pointer<Pointer<Utf8>> documents, int n_documents,
+    Pointer<Float> out_scores, int out_capacity);
+typedef LlamafuModelNClsOutC = Uint32 Function(Llamafu llamafu);
+typedef LlamafuModelNClsOutDart = int Function(Llamafu llamafu);
+
 // KV cache management
 typedef LlamafuKvCacheClearC = Void Function(Llamafu llamafu);
 typedef LlamafuKvCacheClearDart = void Function(Llamafu llamafu);
@@ -648,11 +1318,92 @@ typedef LlamafuStateLoadFileC = LlamafuError Function(
 typedef LlamafuStateLoadFileDart = int Function(
     Llamafu llamafu, Pointer<Utf8> path);
 
+typedef LlamafuStateSaveMappedC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Utf8> path, Int32 seq_id, Pointer<Uint64> out_size);
+typedef LlamafuStateSaveMappedDart = int Function(
+    Llamafu llamafu, Pointer<Utf8> path, int seq_id, Pointer<Uint64> out_size);
+
+typedef LlamafuStateLoadMappedC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Utf8> path, Int32 seq_id);
+typedef LlamafuStateLoadMappedDart = int Function(
+    Llamafu llamafu, Pointer<Utf8> path, int seq_id);
+
+// Shared models
+typedef LlamafuModelLoadC = LlamafuError Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuModel> out_model);
+typedef LlamafuModelLoadDart = int Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuModel> out_model);
+
+typedef LlamafuModelRetainC = Void Function(LlamafuModel model);
+typedef LlamafuModelRetainDart = void Function(LlamafuModel model);
+
+typedef LlamafuModelReleaseC = Void Function(LlamafuModel model);
+typedef LlamafuModelReleaseDart = void Function(LlamafuModel model);
+
+typedef LlamafuModelRefCountC = Int32 Function(LlamafuModel model);
+typedef LlamafuModelRefCountDart = int Function(LlamafuModel model);
+
+typedef LlamafuInitFromModelC = LlamafuError Function(
+    LlamafuModel model, Pointer<LlamafuContextParamsStruct> context_params, Pointer<Llamafu> out_llamafu);
+typedef LlamafuInitFromModelDart = int Function(
+    LlamafuModel model, Pointer<LlamafuContextParamsStruct> context_params, Pointer<Llamafu> out_llamafu);
+
+typedef LlamafuGetModelC = LlamafuModel Function(Llamafu llamafu);
+typedef LlamafuGetModelDart = LlamafuModel Function(Llamafu llamafu);
+
+typedef LlamafuModelLoadAsyncC = LlamafuError Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuModelLoad> out_load);
+typedef LlamafuModelLoadAsyncDart = int Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuModelLoad> out_load);
+
+typedef LlamafuModelLoadPollC = LlamafuError Function(
+    LlamafuModelLoad load, Pointer<Float> out_progress, Pointer<LlamafuModel> out_model);
+typedef LlamafuModelLoadPollDart = int Function(
+    LlamafuModelLoad load, Pointer<Float> out_progress, Pointer<LlamafuModel> out_model);
+
+typedef LlamafuModelLoadCancelC = Void Function(LlamafuModelLoad load);
+typedef LlamafuModelLoadCancelDart = void Function(LlamafuModelLoad load);
+
+typedef LlamafuModelLoadFreeC = Void Function(LlamafuModelLoad load);
+typedef LlamafuModelLoadFreeDart = void Function(LlamafuModelLoad load);
+
+typedef LlamafuSwapModelC = LlamafuError Function(Llamafu llamafu, LlamafuModel model);
+typedef LlamafuSwapModelDart = int Function(Llamafu llamafu, LlamafuModel model);
+
+// Persistent prompt cache
+typedef LlamafuPromptCacheEnableC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Utf8> dir, Uint64 max_bytes, Int32 block_size);
+typedef LlamafuPromptCacheEnableDart = int Function(
+    Llamafu llamafu, Pointer<Utf8> dir, int max_bytes, int block_size);
+
+typedef LlamafuPromptCacheDisableC = Void Function(Llamafu llamafu);
+typedef LlamafuPromptCacheDisableDart = void Function(Llamafu llamafu);
+
+typedef LlamafuPromptCacheClearC = LlamafuError Function(Llamafu llamafu);
+typedef LlamafuPromptCacheClearDart = int Function(Llamafu llamafu);
+
+typedef LlamafuPromptCacheGetStatsC = LlamafuError Function(
+    Llamafu llamafu, Pointer<LlamafuPromptCacheStatsStruct> out_stats);
+typedef LlamafuPromptCacheGetStatsDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuPromptCacheStatsStruct> out_stats);
+
 // Performance
 typedef LlamafuGetPerfStatsC = LlamafuError Function(
     Llamafu llamafu, Pointer<LlamafuPerfStatsStruct> out_stats);
 typedef LlamafuGetPerfStatsDart = int Function(
     Llamafu llamafu, Pointer<LlamafuPerfStatsStruct> out_stats);
+typedef LlamafuGetRequestMetricsC = LlamafuError Function(
+    Llamafu llamafu, Pointer<LlamafuRequestMetricsStruct> out_metrics);
+typedef LlamafuGetRequestMetricsDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuRequestMetricsStruct> out_metrics);
+
+typedef LlamafuSpeculativeDefaultParamsC = LlamafuSpeculativeParamsStruct Function();
+typedef LlamafuSpeculativeDefaultParamsDart = LlamafuSpeculativeParamsStruct Function();
+
+typedef LlamafuSetSpeculativeC = LlamafuError Function(
+    Llamafu llamafu, Pointer<LlamafuSpeculativeParamsStruct> params);
+typedef LlamafuSetSpeculativeDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuSpeculativeParamsStruct> params);
 
 typedef LlamafuGetTimingsC = Int32 Function(
     Llamafu llamafu, Pointer<LlamafuTimingsStruct> out_timings);
@@ -667,6 +1418,18 @@ typedef LlamafuGetMemoryUsageC = Int32 Function(
 typedef LlamafuGetMemoryUsageDart = int Function(
     Llamafu llamafu, Pointer<LlamafuMemoryUsageStruct> out_usage);
 
+typedef LlamafuGetBufferInfoC = Int32 Function(
+    Llamafu llamafu, Pointer<LlamafuBufferInfoStruct> out_buffers, Int32 capacity, Pointer<Int32> out_count);
+typedef LlamafuGetBufferInfoDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuBufferInfoStruct> out_buffers, int capacity, Pointer<Int32> out_count);
+
+typedef LlamafuEstimateMemoryC = Int32 Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuContextParamsStruct> context_params,
+    Uint64 budget_bytes, Pointer<LlamafuMemoryUsageStruct> out_estimate, Pointer<Bool> out_fits);
+typedef LlamafuEstimateMemoryDart = int Function(
+    Pointer<LlamafuModelParams> params, Pointer<LlamafuContextParamsStruct> context_params,
+    int budget_bytes, Pointer<LlamafuMemoryUsageStruct> out_estimate, Pointer<Bool> out_fits);
+
 typedef LlamafuBenchModelC = Int32 Function(
     Llamafu llamafu, Int32 n_threads, Int32 n_predict,
     Pointer<LlamafuBenchResultStruct> out_result);
@@ -674,6 +1437,13 @@ typedef LlamafuBenchModelDart = int Function(
     Llamafu llamafu, int n_threads, int n_predict,
     Pointer<LlamafuBenchResultStruct> out_result);
 
+typedef LlamafuBenchRunC = Int32 Function(
+    Llamafu llamafu, Pointer<LlamafuBenchParamsStruct> params,
+    Pointer<LlamafuBenchStatsStruct> out_prompt, Pointer<LlamafuBenchStatsStruct> out_generation);
+typedef LlamafuBenchRunDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuBenchParamsStruct> params,
+    Pointer<LlamafuBenchStatsStruct> out_prompt, Pointer<LlamafuBenchStatsStruct> out_generation);
+
 typedef LlamafuSetNThreadsC = Int32 Function(
     Llamafu llamafu, Int32 n_threads, Int32 n_threads_batch);
 typedef LlamafuSetNThreadsDart = int Function(
@@ -780,6 +1550,130 @@ typedef LlamafuChatSessionGetHistoryDart = int Function(
 typedef LlamafuChatSessionFreeC = Void Function(LlamafuChatSession session);
 typedef LlamafuChatSessionFreeDart = void Function(LlamafuChatSession session);
 
+typedef LlamafuChatSessionCreateKvC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Utf8> system_prompt, Int32 seq_id,
+    Pointer<LlamafuChatSession> out_session);
+typedef LlamafuChatSessionCreateKvDart = int Function(
+    Llamafu llamafu, Pointer<Utf8> system_prompt, int seq_id,
+    Pointer<LlamafuChatSession> out_session);
+
+typedef LlamafuChatSessionGetNPastC = LlamafuError Function(
+    LlamafuChatSession session, Pointer<Int32> out_n_past);
+typedef LlamafuChatSessionGetNPastDart = int Function(
+    LlamafuChatSession session, Pointer<Int32> out_n_past);
+
+typedef LlamafuChatSessionSetParamsC = LlamafuError Function(
+    LlamafuChatSession session, Pointer<LlamafuInferParams> params);
+typedef LlamafuChatSessionSetParamsDart = int Function(
+    LlamafuChatSession session, Pointer<LlamafuInferParams> params);
+
+// Continuous batching scheduler
+typedef LlamafuSchedulerSubmitC = LlamafuError Function(
+    Llamafu llamafu, Pointer<LlamafuInferParams> params,
+    Pointer<NativeFunction<LlamafuStreamCallbackC>> callback, Pointer<Void> user_data,
+    Pointer<LlamafuRequest> out_request);
+typedef LlamafuSchedulerSubmitDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuInferParams> params,
+    Pointer<NativeFunction<LlamafuStreamCallbackC>> callback, Pointer<Void> user_data,
+    Pointer<LlamafuRequest> out_request);
+
+typedef LlamafuSchedulerStepC = LlamafuError Function(
+    Llamafu llamafu, Pointer<Int32> out_n_pending);
+typedef LlamafuSchedulerStepDart = int Function(
+    Llamafu llamafu, Pointer<Int32> out_n_pending);
+
+typedef LlamafuRequestPollC = LlamafuError Function(
+    LlamafuRequest request, Pointer<Pointer<Utf8>> out_text, Pointer<Int32> out_state);
+typedef LlamafuRequestPollDart = int Function(
+    LlamafuRequest request, Pointer<Pointer<Utf8>> out_text, Pointer<Int32> out_state);
+
+typedef LlamafuRequestCancelC = LlamafuError Function(LlamafuRequest request);
+typedef LlamafuRequestCancelDart = int Function(LlamafuRequest request);
+
+typedef LlamafuRequestFreeC = Void Function(LlamafuRequest request);
+typedef LlamafuRequestFreeDart = void Function(LlamafuRequest request);
+
+// Background token streaming
+typedef LlamafuStreamNotifyC = Void Function(Pointer<Void> user_data);
+
+typedef LlamafuStreamStartC = LlamafuError Function(
+    Llamafu llamafu, Pointer<LlamafuInferParams> params, Size buffer_bytes,
+    Pointer<NativeFunction<LlamafuStreamNotifyC>> notify, Pointer<Void> notify_data,
+    Pointer<LlamafuTokenStream> out_stream);
+typedef LlamafuStreamStartDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuInferParams> params, int buffer_bytes,
+    Pointer<NativeFunction<LlamafuStreamNotifyC>> notify, Pointer<Void> notify_data,
+    Pointer<LlamafuTokenStream> out_stream);
+
+typedef LlamafuStreamReadC = LlamafuError Function(
+    LlamafuTokenStream stream, Pointer<Uint8> out_text, Size text_capacity, Pointer<Size> out_text_len,
+    Pointer<Int32> out_tokens, Int32 tokens_capacity, Pointer<Int32> out_n_tokens,
+    Pointer<Bool> out_finished);
+typedef LlamafuStreamReadDart = int Function(
+    LlamafuTokenStream stream, Pointer<Uint8> out_text, int text_capacity, Pointer<Size> out_text_len,
+    Pointer<Int32> out_tokens, int tokens_capacity, Pointer<Int32> out_n_tokens,
+    Pointer<Bool> out_finished);
+
+typedef LlamafuStreamCancelC = LlamafuError Function(LlamafuTokenStream stream);
+typedef LlamafuStreamCancelDart = int Function(LlamafuTokenStream stream);
+
+typedef LlamafuStreamFreeC = Void Function(LlamafuTokenStream stream);
+typedef LlamafuStreamFreeDart = void Function(LlamafuTokenStream stream);
+
+// Request queue
+typedef LlamafuJobCallbackC = Void Function(
+    Int32 result, Int32 state, Pointer<Utf8> text, Pointer<Void> user_data);
+
+typedef LlamafuQueueSetCapacityC = LlamafuError Function(Llamafu llamafu, Int32 capacity);
+typedef LlamafuQueueSetCapacityDart = int Function(Llamafu llamafu, int capacity);
+
+typedef LlamafuQueueSubmitC = LlamafuError Function(
+    Llamafu llamafu, Pointer<LlamafuInferParams> params, Int32 priority,
+    Pointer<NativeFunction<LlamafuStreamCallbackC>> on_text,
+    Pointer<NativeFunction<LlamafuJobCallbackC>> on_done, Pointer<Void> user_data,
+    Pointer<LlamafuJob> out_job);
+typedef LlamafuQueueSubmitDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuInferParams> params, int priority,
+    Pointer<NativeFunction<LlamafuStreamCallbackC>> on_text,
+    Pointer<NativeFunction<LlamafuJobCallbackC>> on_done, Pointer<Void> user_data,
+    Pointer<LlamafuJob> out_job);
+
+typedef LlamafuJobCancelC = LlamafuError Function(LlamafuJob job);
+typedef LlamafuJobCancelDart = int Function(LlamafuJob job);
+
+typedef LlamafuJobGetStateC = LlamafuError Function(LlamafuJob job, Pointer<Int32> out_state);
+typedef LlamafuJobGetStateDart = int Function(LlamafuJob job, Pointer<Int32> out_state);
+
+typedef LlamafuJobWaitC = LlamafuError Function(
+    LlamafuJob job, Int32 timeout_ms, Pointer<Pointer<Utf8>> out_text);
+typedef LlamafuJobWaitDart = int Function(
+    LlamafuJob job, int timeout_ms, Pointer<Pointer<Utf8>> out_text);
+
+typedef LlamafuJobFreeC = Void Function(LlamafuJob job);
+typedef LlamafuJobFreeDart = void Function(LlamafuJob job);
+
+// Threadpools
+typedef LlamafuThreadpoolDefaultParamsC = LlamafuThreadpoolParamsStruct Function();
+typedef LlamafuThreadpoolDefaultParamsDart = LlamafuThreadpoolParamsStruct Function();
+typedef LlamafuGetCpuTopologyC = Int32 Function(Pointer<LlamafuCpuTopologyStruct> out_topology);
+typedef LlamafuGetCpuTopologyDart = int Function(Pointer<LlamafuCpuTopologyStruct> out_topology);
+typedef LlamafuSetThreadpoolsC = Int32 Function(
+    Llamafu llamafu, Pointer<LlamafuThreadpoolParamsStruct> decode, Pointer<LlamafuThreadpoolParamsStruct> prefill);
+typedef LlamafuSetThreadpoolsDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuThreadpoolParamsStruct> decode, Pointer<LlamafuThreadpoolParamsStruct> prefill);
+typedef LlamafuAutotuneThreadsC = Int32 Function(
+    Llamafu llamafu, Pointer<Utf8> cache_path, Bool force, Pointer<LlamafuAutotuneResultStruct> out_result);
+typedef LlamafuAutotuneThreadsDart = int Function(
+    Llamafu llamafu, Pointer<Utf8> cache_path, bool force, Pointer<LlamafuAutotuneResultStruct> out_result);
+
+// Memory pressure
+typedef LlamafuReleaseMemoryC = Int32 Function(Llamafu llamafu, Int32 level, Pointer<Utf8> spill_dir);
+typedef LlamafuReleaseMemoryDart = int Function(Llamafu llamafu, int level, Pointer<Utf8> spill_dir);
+typedef LlamafuResumeC = Int32 Function(Llamafu llamafu);
+typedef LlamafuResumeDart = int Function(Llamafu llamafu);
+typedef LlamafuGetReleaseLevelC = Int32 Function(Llamafu llamafu);
+typedef LlamafuGetReleaseLevelDart = int Function(Llamafu llamafu);
+
 // Text analysis
 typedef LlamafuDetectLanguageC = LlamafuError Function(
     Llamafu llamafu, Pointer<Utf8> text,
@@ -867,6 +1761,20 @@ typedef LlamafuImageToBase64Dart = int Function(
     Pointer<LlamafuMediaInput> input, int format,
     Pointer<Pointer<Utf8>> out_base64);
 
+typedef LlamafuImageProcessResultFreeC = Void Function(Pointer<LlamafuImageProcessResultStruct> result);
+typedef LlamafuImageProcessResultFreeDart = void Function(Pointer<LlamafuImageProcessResultStruct> result);
+
+typedef LlamafuImageCacheSetBudgetC = LlamafuError Function(Llamafu llamafu, Uint64 max_bytes);
+typedef LlamafuImageCacheSetBudgetDart = int Function(Llamafu llamafu, int max_bytes);
+
+typedef LlamafuImageCacheClearC = Void Function(Llamafu llamafu);
+typedef LlamafuImageCacheClearDart = void Function(Llamafu llamafu);
+
+typedef LlamafuImageCacheGetStatsC = LlamafuError Function(
+    Llamafu llamafu, Pointer<LlamafuImageCacheStatsStruct> out_stats);
+typedef LlamafuImageCacheGetStatsDart = int Function(
+    Llamafu llamafu, Pointer<LlamafuImageCacheStatsStruct> out_stats);
+
 // Audio processing
 typedef LlamafuAudioProcessC = LlamafuError Function(
     Llamafu llamafu, Pointer<LlamafuMediaInput> input,
@@ -899,6 +1807,12 @@ typedef LlamafuListLoraAdaptersDart = int Function(
     Llamafu llamafu, Pointer<Pointer<LlamafuLoraAdapterInfoStruct>> out_adapters,
     Pointer<IntPtr> out_n_adapters);
 
+typedef LlamafuFreeLoraAdapterListC = Void Function(Pointer<LlamafuLoraAdapterInfoStruct> adapters);
+typedef LlamafuFreeLoraAdapterListDart = void Function(Pointer<LlamafuLoraAdapterInfoStruct> adapters);
+
+typedef LlamafuApplyLoraBatchC = LlamafuError Function(Llamafu llamafu, Pointer<LlamafuLoraBatchStruct> batch);
+typedef LlamafuApplyLoraBatchDart = int Function(Llamafu llamafu, Pointer<LlamafuLoraBatchStruct> batch);
+
 typedef LlamafuValidateLoraCompatibilityC = LlamafuError Function(
     Llamafu llamafu, Pointer<Utf8> lora_path,
     Pointer<Bool> out_is_compatible, Pointer<Pointer<Utf8>> out_error_message);
@@ -971,6 +1885,8 @@ final class LlamafuBindings {
 
   // Core functions
   late final LlamafuInitDart _llamafuInit;
+  late final LlamafuContextDefaultParamsDart _llamafuContextDefaultParams;
+  late final LlamafuInitWithContextDart _llamafuInitWithContext;
   late final LlamafuCompleteDart _llamafuComplete;
   late final LlamafuCompleteWithGrammarDart _llamafuCompleteWithGrammar;
   late final LlamafuCompleteStreamDart _llamafuCompleteStream;
@@ -988,6 +1904,7 @@ final class LlamafuBindings {
 
   // Tokenization
   late final LlamafuTokenizeDart _llamafuTokenize;
+  late final LlamafuTokenizeBatchDart _llamafuTokenizeBatch;
   late final LlamafuDetokenizeDart _llamafuDetokenize;
   late final LlamafuTokenToPieceDart _llamafuTokenToPiece;
   late final LlamafuTokenBosDart _llamafuTokenBos;
@@ -998,6 +1915,14 @@ final class LlamafuBindings {
 
   // Embeddings
   late final LlamafuGetEmbeddingsDart _llamafuGetEmbeddings;
+  late final LlamafuGetEmbeddingsBatchDart _llamafuGetEmbeddingsBatch;
+
+  // Scoring
+  late final LlamafuGetTopLogprobsIthDart _llamafuGetTopLogprobsIth;
+  late final LlamafuScoreContinuationsDart _llamafuScoreContinuations;
+  late final LlamafuScoreResultFreeDart _llamafuScoreResultFree;
+  late final LlamafuRerankDart _llamafuRerank;
+  late final LlamafuModelNClsOutDart _llamafuModelNClsOut;
 
   // KV cache
   late final LlamafuKvCacheClearDart _llamafuKvCacheClear;
@@ -1009,13 +1934,36 @@ final class LlamafuBindings {
   late final LlamafuStateGetSizeDart _llamafuStateGetSize;
   late final LlamafuStateSaveFileDart _llamafuStateSaveFile;
   late final LlamafuStateLoadFileDart _llamafuStateLoadFile;
+  late final LlamafuStateSaveMappedDart _llamafuStateSaveMapped;
+  late final LlamafuStateLoadMappedDart _llamafuStateLoadMapped;
+  late final LlamafuModelLoadDart _llamafuModelLoad;
+  late final LlamafuModelRetainDart _llamafuModelRetain;
+  late final LlamafuModelReleaseDart _llamafuModelRelease;
+  late final LlamafuModelRefCountDart _llamafuModelRefCount;
+  late final LlamafuInitFromModelDart _llamafuInitFromModel;
+  late final LlamafuGetModelDart _llamafuGetModel;
+  late final LlamafuModelLoadAsyncDart _llamafuModelLoadAsync;
+  late final LlamafuModelLoadPollDart _llamafuModelLoadPoll;
+  late final LlamafuModelLoadCancelDart _llamafuModelLoadCancel;
+  late final LlamafuModelLoadFreeDart _llamafuModelLoadFree;
+  late final LlamafuSwapModelDart _llamafuSwapModel;
+  late final LlamafuPromptCacheEnableDart _llamafuPromptCacheEnable;
+  late final LlamafuPromptCacheDisableDart _llamafuPromptCacheDisable;
+  late final LlamafuPromptCacheClearDart _llamafuPromptCacheClear;
+  late final LlamafuPromptCacheGetStatsDart _llamafuPromptCacheGetStats;
 
   // Performance
   late final LlamafuGetPerfStatsDart _llamafuGetPerfStats;
+  late final LlamafuGetRequestMetricsDart _llamafuGetRequestMetrics;
+  late final LlamafuSpeculativeDefaultParamsDart _llamafuSpeculativeDefaultParams;
+  late final LlamafuSetSpeculativeDart _llamafuSetSpeculative;
   late final LlamafuGetTimingsDart _llamafuGetTimings;
   late final LlamafuResetTimingsDart _llamafuResetTimings;
   late final LlamafuGetMemoryUsageDart _llamafuGetMemoryUsage;
+  late final LlamafuGetBufferInfoDart _llamafuGetBufferInfo;
+  late final LlamafuEstimateMemoryDart _llamafuEstimateMemory;
   late final LlamafuBenchModelDart _llamafuBenchModel;
+  late final LlamafuBenchRunDart _llamafuBenchRun;
   late final LlamafuSetNThreadsDart _llamafuSetNThreads;
   late final LlamafuWarmupDart _llamafuWarmup;
 
@@ -1048,6 +1996,33 @@ final class LlamafuBindings {
   late final LlamafuChatSessionCompleteDart _llamafuChatSessionComplete;
   late final LlamafuChatSessionGetHistoryDart _llamafuChatSessionGetHistory;
   late final LlamafuChatSessionFreeDart _llamafuChatSessionFree;
+  late final LlamafuChatSessionCreateKvDart _llamafuChatSessionCreateKv;
+  late final LlamafuChatSessionGetNPastDart _llamafuChatSessionGetNPast;
+  late final LlamafuChatSessionSetParamsDart _llamafuChatSessionSetParams;
+
+  // Continuous batching scheduler
+  late final LlamafuSchedulerSubmitDart _llamafuSchedulerSubmit;
+  late final LlamafuSchedulerStepDart _llamafuSchedulerStep;
+  late final LlamafuRequestPollDart _llamafuRequestPoll;
+  late final LlamafuRequestCancelDart _llamafuRequestCancel;
+  late final LlamafuRequestFreeDart _llamafuRequestFree;
+  late final LlamafuStreamStartDart _llamafuStreamStart;
+  late final LlamafuStreamReadDart _llamafuStreamRead;
+  late final LlamafuStreamCancelDart _llamafuStreamCancel;
+  late final LlamafuStreamFreeDart _llamafuStreamFree;
+  late final LlamafuQueueSetCapacityDart _llamafuQueueSetCapacity;
+  late final LlamafuQueueSubmitDart _llamafuQueueSubmit;
+  late final LlamafuJobCancelDart _llamafuJobCancel;
+  late final LlamafuJobGetStateDart _llamafuJobGetState;
+  late final LlamafuJobWaitDart _llamafuJobWait;
+  late final LlamafuJobFreeDart _llamafuJobFree;
+  late final LlamafuThreadpoolDefaultParamsDart _llamafuThreadpoolDefaultParams;
+  late final LlamafuGetCpuTopologyDart _llamafuGetCpuTopology;
+  late final LlamafuSetThreadpoolsDart _llamafuSetThreadpools;
+  late final LlamafuAutotuneThreadsDart _llamafuAutotuneThreads;
+  late final LlamafuReleaseMemoryDart _llamafuReleaseMemory;
+  late final LlamafuResumeDart _llamafuResume;
+  late final LlamafuGetReleaseLevelDart _llamafuGetReleaseLevel;
 
   // Text analysis
   late final LlamafuDetectLanguageDart _llamafuDetectLanguage;
@@ -1065,6 +2040,10 @@ final class LlamafuBindings {
   late final LlamafuImageProcessDart _llamafuImageProcess;
   late final LlamafuImageResizeDart _llamafuImageResize;
   late final LlamafuImageToBase64Dart _llamafuImageToBase64;
+  late final LlamafuImageProcessResultFreeDart _llamafuImageProcessResultFree;
+  late final LlamafuImageCacheSetBudgetDart _llamafuImageCacheSetBudget;
+  late final LlamafuImageCacheClearDart _llamafuImageCacheClear;
+  late final LlamafuImageCacheGetStatsDart _llamafuImageCacheGetStats;
 
   // Audio processing
   late final LlamafuAudioProcessDart _llamafuAudioProcess;
@@ -1073,6 +2052,8 @@ final class LlamafuBindings {
   // Enhanced LoRA
   late final LlamafuGetLoraAdapterInfoDart _llamafuGetLoraAdapterInfo;
   late final LlamafuListLoraAdaptersDart _llamafuListLoraAdapters;
+  late final LlamafuFreeLoraAdapterListDart _llamafuFreeLoraAdapterList;
+  late final LlamafuApplyLoraBatchDart _llamafuApplyLoraBatch;
   late final LlamafuValidateLoraCompatibilityDart _llamafuValidateLoraCompatibility;
 
   // Utility
@@ -1085,6 +2066,12 @@ final class LlamafuBindings {
     _llamafuInit = _dylib
         .lookup<NativeFunction<LlamafuInitC>>('llamafu_init')
         .asFunction<LlamafuInitDart>();
+    _llamafuContextDefaultParams = _dylib
+        .lookup<NativeFunction<LlamafuContextDefaultParamsC>>('llamafu_context_default_params')
+        .asFunction<LlamafuContextDefaultParamsDart>();
+    _llamafuInitWithContext = _dylib
+        .lookup<NativeFunction<LlamafuInitWithContextC>>('llamafu_init_with_context')
+        .asFunction<LlamafuInitWithContextDart>();
     _llamafuComplete = _dylib
         .lookup<NativeFunction<LlamafuCompleteC>>('llamafu_complete')
         .asFunction<LlamafuCompleteDart>();
@@ -1132,6 +2119,9 @@ final class LlamafuBindings {
     _llamafuTokenize = _dylib
         .lookup<NativeFunction<LlamafuTokenizeC>>('llamafu_tokenize')
         .asFunction<LlamafuTokenizeDart>();
+    _llamafuTokenizeBatch = _dylib
+        .lookup<NativeFunction<LlamafuTokenizeBatchC>>('llamafu_tokenize_batch')
+        .asFunction<LlamafuTokenizeBatchDart>();
     _llamafuDetokenize = _dylib
         .lookup<NativeFunction<LlamafuDetokenizeC>>('llamafu_detokenize')
         .asFunction<LlamafuDetokenizeDart>();
@@ -1154,6 +2144,26 @@ final class LlamafuBindings {
     _llamafuGetEmbeddings = _dylib
         .lookup<NativeFunction<LlamafuGetEmbeddingsC>>('llamafu_get_embeddings')
         .asFunction<LlamafuGetEmbeddingsDart>();
+    _llamafuGetEmbeddingsBatch = _dylib
+        .lookup<NativeFunction<LlamafuGetEmbeddingsBatchC>>('llamafu_get_embeddings_batch')
+        .asFunction<LlamafuGetEmbeddingsBatchDart>();
+
+    // Scoring
+    _llamafuGetTopLogprobsIth = _dylib
+        .lookup<NativeFunction<LlamafuGetTopLogprobsIthC>>('llamafu_get_top_logprobs_ith')
+        .asFunction<LlamafuGetTopLogprobsIthDart>();
+    _llamafuScoreContinuations = _dylib
+        .lookup<NativeFunction<LlamafuScoreContinuationsC>>('llamafu_score_continuations')
+        .asFunction<LlamafuScoreContinuationsDart>();
+    _llamafuScoreResultFree = _dylib
+        .lookup<NativeFunction<LlamafuScoreResultFreeC>>('llamafu_score_result_free')
+        .asFunction<LlamafuScoreResultFreeDart>();
+    _llamafuRerank = _dylib
+        .lookup<NativeFunction<LlamafuRerankC>>('llamafu_rerank')
+        .asFunction<LlamafuRerankDart>();
+    _llamafuModelNClsOut = _dylib
+        .lookup<NativeFunction<LlamafuModelNClsOutC>>('llamafu_model_n_cls_out')
+        .asFunction<LlamafuModelNClsOutDart>();
 
     // KV cache
     _llamafuKvCacheClear = _dylib
@@ -1180,10 +2190,71 @@ final class LlamafuBindings {
         .lookup<NativeFunction<LlamafuStateLoadFileC>>('llamafu_state_load_file')
         .asFunction<LlamafuStateLoadFileDart>();
 
+    _llamafuStateSaveMapped = _dylib
+        .lookup<NativeFunction<LlamafuStateSaveMappedC>>('llamafu_state_save_mapped')
+        .asFunction<LlamafuStateSaveMappedDart>();
+    _llamafuStateLoadMapped = _dylib
+        .lookup<NativeFunction<LlamafuStateLoadMappedC>>('llamafu_state_load_mapped')
+        .asFunction<LlamafuStateLoadMappedDart>();
+    _llamafuModelLoad = _dylib
+        .lookup<NativeFunction<LlamafuModelLoadC>>('llamafu_model_load')
+        .asFunction<LlamafuModelLoadDart>();
+    _llamafuModelRetain = _dylib
+        .lookup<NativeFunction<LlamafuModelRetainC>>('llamafu_model_retain')
+        .asFunction<LlamafuModelRetainDart>();
+    _llamafuModelRelease = _dylib
+        .lookup<NativeFunction<LlamafuModelReleaseC>>('llamafu_model_release')
+        .asFunction<LlamafuModelReleaseDart>();
+    _llamafuModelRefCount = _dylib
+        .lookup<NativeFunction<LlamafuModelRefCountC>>('llamafu_model_ref_count')
+        .asFunction<LlamafuModelRefCountDart>();
+    _llamafuInitFromModel = _dylib
+        .lookup<NativeFunction<LlamafuInitFromModelC>>('llamafu_init_from_model')
+        .asFunction<LlamafuInitFromModelDart>();
+    _llamafuGetModel = _dylib
+        .lookup<NativeFunction<LlamafuGetModelC>>('llamafu_get_model')
+        .asFunction<LlamafuGetModelDart>();
+    _llamafuModelLoadAsync = _dylib
+        .lookup<NativeFunction<LlamafuModelLoadAsyncC>>('llamafu_model_load_async')
+        .asFunction<LlamafuModelLoadAsyncDart>();
+    _llamafuModelLoadPoll = _dylib
+        .lookup<NativeFunction<LlamafuModelLoadPollC>>('llamafu_model_load_poll')
+        .asFunction<LlamafuModelLoadPollDart>();
+    _llamafuModelLoadCancel = _dylib
+        .lookup<NativeFunction<LlamafuModelLoadCancelC>>('llamafu_model_load_cancel')
+        .asFunction<LlamafuModelLoadCancelDart>();
+    _llamafuModelLoadFree = _dylib
+        .lookup<NativeFunction<LlamafuModelLoadFreeC>>('llamafu_model_load_free')
+        .asFunction<LlamafuModelLoadFreeDart>();
+    _llamafuSwapModel = _dylib
+        .lookup<NativeFunction<LlamafuSwapModelC>>('llamafu_swap_model')
+        .asFunction<LlamafuSwapModelDart>();
+    _llamafuPromptCacheEnable = _dylib
+        .lookup<NativeFunction<LlamafuPromptCacheEnableC>>('llamafu_prompt_cache_enable')
+        .asFunction<LlamafuPromptCacheEnableDart>();
+    _llamafuPromptCacheDisable = _dylib
+        .lookup<NativeFunction<LlamafuPromptCacheDisableC>>('llamafu_prompt_cache_disable')
+        .asFunction<LlamafuPromptCacheDisableDart>();
+    _llamafuPromptCacheClear = _dylib
+        .lookup<NativeFunction<LlamafuPromptCacheClearC>>('llamafu_prompt_cache_clear')
+        .asFunction<LlamafuPromptCacheClearDart>();
+    _llamafuPromptCacheGetStats = _dylib
+        .lookup<NativeFunction<LlamafuPromptCacheGetStatsC>>('llamafu_prompt_cache_get_stats')
+        .asFunction<LlamafuPromptCacheGetStatsDart>();
+
     // Performance
     _llamafuGetPerfStats = _dylib
         .lookup<NativeFunction<LlamafuGetPerfStatsC>>('llamafu_get_perf_stats')
         .asFunction<LlamafuGetPerfStatsDart>();
+    _llamafuGetRequestMetrics = _dylib
+        .lookup<NativeFunction<LlamafuGetRequestMetricsC>>('llamafu_get_request_metrics')
+        .asFunction<LlamafuGetRequestMetricsDart>();
+    _llamafuSpeculativeDefaultParams = _dylib
+        .lookup<NativeFunction<LlamafuSpeculativeDefaultParamsC>>('llamafu_speculative_default_params')
+        .asFunction<LlamafuSpeculativeDefaultParamsDart>();
+    _llamafuSetSpeculative = _dylib
+        .lookup<NativeFunction<LlamafuSetSpeculativeC>>('llamafu_set_speculative')
+        .asFunction<LlamafuSetSpeculativeDart>();
     _llamafuGetTimings = _dylib
         .lookup<NativeFunction<LlamafuGetTimingsC>>('llamafu_get_timings')
         .asFunction<LlamafuGetTimingsDart>();
@@ -1193,9 +2264,18 @@ final class LlamafuBindings {
     _llamafuGetMemoryUsage = _dylib
         .lookup<NativeFunction<LlamafuGetMemoryUsageC>>('llamafu_get_memory_usage')
         .asFunction<LlamafuGetMemoryUsageDart>();
+    _llamafuGetBufferInfo = _dylib
+        .lookup<NativeFunction<LlamafuGetBufferInfoC>>('llamafu_get_buffer_info')
+        .asFunction<LlamafuGetBufferInfoDart>();
+    _llamafuEstimateMemory = _dylib
+        .lookup<NativeFunction<LlamafuEstimateMemoryC>>('llamafu_estimate_memory')
+        .asFunction<LlamafuEstimateMemoryDart>();
     _llamafuBenchModel = _dylib
         .lookup<NativeFunction<LlamafuBenchModelC>>('llamafu_bench_model')
         .asFunction<LlamafuBenchModelDart>();
+    _llamafuBenchRun = _dylib
+        .lookup<NativeFunction<LlamafuBenchRunC>>('llamafu_bench_run')
+        .asFunction<LlamafuBenchRunDart>();
     _llamafuSetNThreads = _dylib
         .lookup<NativeFunction<LlamafuSetNThreadsC>>('llamafu_set_n_threads')
         .asFunction<LlamafuSetNThreadsDart>();
@@ -1276,6 +2356,87 @@ final class LlamafuBindings {
     _llamafuChatSessionFree = _dylib
         .lookup<NativeFunction<LlamafuChatSessionFreeC>>('llamafu_chat_session_free')
         .asFunction<LlamafuChatSessionFreeDart>();
+    _llamafuChatSessionCreateKv = _dylib
+        .lookup<NativeFunction<LlamafuChatSessionCreateKvC>>('llamafu_chat_session_create_kv')
+        .asFunction<LlamafuChatSessionCreateKvDart>();
+    _llamafuChatSessionGetNPast = _dylib
+        .lookup<NativeFunction<LlamafuChatSessionGetNPastC>>('llamafu_chat_session_get_n_past')
+        .asFunction<LlamafuChatSessionGetNPastDart>();
+    _llamafuChatSessionSetParams = _dylib
+        .lookup<NativeFunction<LlamafuChatSessionSetParamsC>>('llamafu_chat_session_set_params')
+        .asFunction<LlamafuChatSessionSetParamsDart>();
+
+    // Continuous batching scheduler
+    _llamafuSchedulerSubmit = _dylib
+        .lookup<NativeFunction<LlamafuSchedulerSubmitC>>('llamafu_scheduler_submit')
+        .asFunction<LlamafuSchedulerSubmitDart>();
+    _llamafuSchedulerStep = _dylib
+        .lookup<NativeFunction<LlamafuSchedulerStepC>>('llamafu_scheduler_step')
+        .asFunction<LlamafuSchedulerStepDart>();
+    _llamafuRequestPoll = _dylib
+        .lookup<NativeFunction<LlamafuRequestPollC>>('llamafu_request_poll')
+        .asFunction<LlamafuRequestPollDart>();
+    _llamafuRequestCancel = _dylib
+        .lookup<NativeFunction<LlamafuRequestCancelC>>('llamafu_request_cancel')
+        .asFunction<LlamafuRequestCancelDart>();
+    _llamafuRequestFree = _dylib
+        .lookup<NativeFunction<LlamafuRequestFreeC>>('llamafu_request_free')
+        .asFunction<LlamafuRequestFreeDart>();
+
+    // Background token streaming
+    _llamafuStreamStart = _dylib
+        .lookup<NativeFunction<LlamafuStreamStartC>>('llamafu_stream_start')
+        .asFunction<LlamafuStreamStartDart>();
+    _llamafuStreamRead = _dylib
+        .lookup<NativeFunction<LlamafuStreamReadC>>('llamafu_stream_read')
+        .asFunction<LlamafuStreamReadDart>();
+    _llamafuStreamCancel = _dylib
+        .lookup<NativeFunction<LlamafuStreamCancelC>>('llamafu_stream_cancel')
+        .asFunction<LlamafuStreamCancelDart>();
+    _llamafuStreamFree = _dylib
+        .lookup<NativeFunction<LlamafuStreamFreeC>>('llamafu_stream_free')
+        .asFunction<LlamafuStreamFreeDart>();
+    _llamafuQueueSetCapacity = _dylib
+        .lookup<NativeFunction<LlamafuQueueSetCapacityC>>('llamafu_queue_set_capacity')
+        .asFunction<LlamafuQueueSetCapacityDart>();
+    _llamafuQueueSubmit = _dylib
+        .lookup<NativeFunction<LlamafuQueueSubmitC>>('llamafu_queue_submit')
+        .asFunction<LlamafuQueueSubmitDart>();
+    _llamafuJobCancel = _dylib
+        .lookup<NativeFunction<LlamafuJobCancelC>>('llamafu_job_cancel')
+        .asFunction<LlamafuJobCancelDart>();
+    _llamafuJobGetState = _dylib
+        .lookup<NativeFunction<LlamafuJobGetStateC>>('llamafu_job_get_state')
+        .asFunction<LlamafuJobGetStateDart>();
+    _llamafuJobWait = _dylib
+        .lookup<NativeFunction<LlamafuJobWaitC>>('llamafu_job_wait')
+        .asFunction<LlamafuJobWaitDart>();
+    _llamafuJobFree = _dylib
+        .lookup<NativeFunction<LlamafuJobFreeC>>('llamafu_job_free')
+        .asFunction<LlamafuJobFreeDart>();
+
+    // Threadpools
+    _llamafuThreadpoolDefaultParams = _dylib
+        .lookup<NativeFunction<LlamafuThreadpoolDefaultParamsC>>('llamafu_threadpool_default_params')
+        .asFunction<LlamafuThreadpoolDefaultParamsDart>();
+    _llamafuGetCpuTopology = _dylib
+        .lookup<NativeFunction<LlamafuGetCpuTopologyC>>('llamafu_get_cpu_topology')
+        .asFunction<LlamafuGetCpuTopologyDart>();
+    _llamafuSetThreadpools = _dylib
+        .lookup<NativeFunction<LlamafuSetThreadpoolsC>>('llamafu_set_threadpools')
+        .asFunction<LlamafuSetThreadpoolsDart>();
+    _llamafuAutotuneThreads = _dylib
+        .lookup<NativeFunction<LlamafuAutotuneThreadsC>>('llamafu_autotune_threads')
+        .asFunction<LlamafuAutotuneThreadsDart>();
+    _llamafuReleaseMemory = _dylib
+        .lookup<NativeFunction<LlamafuReleaseMemoryC>>('llamafu_release_memory')
+        .asFunction<LlamafuReleaseMemoryDart>();
+    _llamafuResume = _dylib
+        .lookup<NativeFunction<LlamafuResumeC>>('llamafu_resume')
+        .asFunction<LlamafuResumeDart>();
+    _llamafuGetReleaseLevel = _dylib
+        .lookup<NativeFunction<LlamafuGetReleaseLevelC>>('llamafu_get_release_level')
+        .asFunction<LlamafuGetReleaseLevelDart>();
 
     // Text analysis
     _llamafuDetectLanguage = _dylib
@@ -1309,6 +2470,18 @@ final class LlamafuBindings {
     _llamafuImageProcess = _dylib
         .lookup<NativeFunction<LlamafuImageProcessC>>('llamafu_image_process')
         .asFunction<LlamafuImageProcessDart>();
+    _llamafuImageProcessResultFree = _dylib
+        .lookup<NativeFunction<LlamafuImageProcessResultFreeC>>('llamafu_image_process_result_free')
+        .asFunction<LlamafuImageProcessResultFreeDart>();
+    _llamafuImageCacheSetBudget = _dylib
+        .lookup<NativeFunction<LlamafuImageCacheSetBudgetC>>('llamafu_image_cache_set_budget')
+        .asFunction<LlamafuImageCacheSetBudgetDart>();
+    _llamafuImageCacheClear = _dylib
+        .lookup<NativeFunction<LlamafuImageCacheClearC>>('llamafu_image_cache_clear')
+        .asFunction<LlamafuImageCacheClearDart>();
+    _llamafuImageCacheGetStats = _dylib
+        .lookup<NativeFunction<LlamafuImageCacheGetStatsC>>('llamafu_image_cache_get_stats')
+        .asFunction<LlamafuImageCacheGetStatsDart>();
     _llamafuImageResize = _dylib
         .lookup<NativeFunction<LlamafuImageResizeC>>('llamafu_image_resize')
         .asFunction<LlamafuImageResizeDart>();
@@ -1331,6 +2504,12 @@ final class LlamafuBindings {
     _llamafuListLoraAdapters = _dylib
         .lookup<NativeFunction<LlamafuListLoraAdaptersC>>('llamafu_list_lora_adapters')
         .asFunction<LlamafuListLoraAdaptersDart>();
+    _llamafuFreeLoraAdapterList = _dylib
+        .lookup<NativeFunction<LlamafuFreeLoraAdapterListC>>('llamafu_free_lora_adapter_list')
+        .asFunction<LlamafuFreeLoraAdapterListDart>();
+    _llamafuApplyLoraBatch = _dylib
+        .lookup<NativeFunction<LlamafuApplyLoraBatchC>>('llamafu_apply_lora_batch')
+        .asFunction<LlamafuApplyLoraBatchDart>();
     _llamafuValidateLoraCompatibility = _dylib
         .lookup<NativeFunction<LlamafuValidateLoraCompatibilityC>>('llamafu_validate_lora_compatibility')
         .asFunction<LlamafuValidateLoraCompatibilityDart>();
@@ -1401,6 +2580,13 @@ final class LlamafuBindings {
     return _llamafuInit(params, out_llamafu);
   }
 
+  LlamafuContextParamsStruct llamafuContextDefaultParams() => _llamafuContextDefaultParams();
+
+  int llamafuInitWithContext(Pointer<LlamafuModelParams> params,
+      Pointer<LlamafuContextParamsStruct> contextParams, Pointer<Llamafu> out_llamafu) {
+    return _llamafuInitWithContext(params, contextParams, out_llamafu);
+  }
+
   int llamafuComplete(
       Llamafu llamafu, Pointer<LlamafuInferParams> params, Pointer<Pointer<Utf8>> out_result) {
     return _llamafuComplete(llamafu, params, out_result);
@@ -1484,6 +2670,12 @@ final class LlamafuBindings {
           bool addSpecial, bool parseSpecial) =>
       _llamafuTokenize(llamafu, text, textLen, outTokens, outNTokens, addSpecial, parseSpecial);
 
+  int llamafuTokenizeBatch(Llamafu llamafu, Pointer<Pointer<Utf8>> texts, int nTexts,
+          Pointer<Int32> outTokens, int capacity, Pointer<Int32> outOffsets,
+          Pointer<Int32> outNTokens, bool addSpecial, bool parseSpecial) =>
+      _llamafuTokenizeBatch(llamafu, texts, nTexts, outTokens, capacity, outOffsets,
+          outNTokens, addSpecial, parseSpecial);
+
   int llamafuDetokenize(Llamafu llamafu, Pointer<Int32> tokens, int nTokens,
           Pointer<Pointer<Utf8>> outText, bool removeSpecial, bool unparseSpecial) =>
       _llamafuDetokenize(llamafu, tokens, nTokens, outText, removeSpecial, unparseSpecial);
@@ -1502,6 +2694,24 @@ final class LlamafuBindings {
   int llamafuGetEmbeddings(Llamafu llamafu, Pointer<Utf8> text,
           Pointer<Pointer<Float>> outEmbeddings, Pointer<Int32> outNEmbd) =>
       _llamafuGetEmbeddings(llamafu, text, outEmbeddings, outNEmbd);
+  int llamafuGetEmbeddingsBatch(Llamafu llamafu, Pointer<Pointer<Utf8>> texts, int nTexts,
+          int pooling, bool normalize, Pointer<Float> outEmbeddings, int outCapacity,
+          Pointer<Int32> outNEmbd) =>
+      _llamafuGetEmbeddingsBatch(
+          llamafu, texts, nTexts, pooling, normalize, outEmbeddings, outCapacity, outNEmbd);
+
+  // Scoring
+  int llamafuGetTopLogprobsIth(
+          Llamafu llamafu, int i, int k, Pointer<LlamafuTokenLogprobStruct> out, Pointer<Int32> outN) =>
+      _llamafuGetTopLogprobsIth(llamafu, i, k, out, outN);
+  int llamafuScoreContinuations(Llamafu llamafu, Pointer<Utf8> prefix, Pointer<Pointer<Utf8>> continuations,
+          int nContinuations, int topK, Pointer<Pointer<LlamafuScoreResultStruct>> outResult) =>
+      _llamafuScoreContinuations(llamafu, prefix, continuations, nContinuations, topK, outResult);
+  void llamafuScoreResultFree(Pointer<LlamafuScoreResultStruct> result) => _llamafuScoreResultFree(result);
+  int llamafuRerank(Llamafu llamafu, Pointer<Utf8> query, Pointer<Pointer<Utf8>> documents, int nDocuments,
+          Pointer<Float> outScores, int outCapacity) =>
+      _llamafuRerank(llamafu, query, documents, nDocuments, outScores, outCapacity);
+  int llamafuModelNClsOut(Llamafu llamafu) => _llamafuModelNClsOut(llamafu);
 
   // KV cache
   void llamafuKvCacheClear(Llamafu llamafu) => _llamafuKvCacheClear(llamafu);
@@ -1515,18 +2725,58 @@ final class LlamafuBindings {
   int llamafuStateGetSize(Llamafu llamafu) => _llamafuStateGetSize(llamafu);
   int llamafuStateSaveFile(Llamafu llamafu, Pointer<Utf8> path) => _llamafuStateSaveFile(llamafu, path);
   int llamafuStateLoadFile(Llamafu llamafu, Pointer<Utf8> path) => _llamafuStateLoadFile(llamafu, path);
+  int llamafuStateSaveMapped(Llamafu llamafu, Pointer<Utf8> path, int seqId, Pointer<Uint64> outSize) =>
+      _llamafuStateSaveMapped(llamafu, path, seqId, outSize);
+  int llamafuStateLoadMapped(Llamafu llamafu, Pointer<Utf8> path, int seqId) =>
+      _llamafuStateLoadMapped(llamafu, path, seqId);
+  int llamafuModelLoad(Pointer<LlamafuModelParams> params, Pointer<LlamafuModel> outModel) =>
+      _llamafuModelLoad(params, outModel);
+  void llamafuModelRetain(LlamafuModel model) => _llamafuModelRetain(model);
+  void llamafuModelRelease(LlamafuModel model) => _llamafuModelRelease(model);
+  int llamafuModelRefCount(LlamafuModel model) => _llamafuModelRefCount(model);
+  int llamafuInitFromModel(
+          LlamafuModel model, Pointer<LlamafuContextParamsStruct> contextParams, Pointer<Llamafu> outLlamafu) =>
+      _llamafuInitFromModel(model, contextParams, outLlamafu);
+  LlamafuModel llamafuGetModel(Llamafu llamafu) => _llamafuGetModel(llamafu);
+  int llamafuModelLoadAsync(Pointer<LlamafuModelParams> params, Pointer<LlamafuModelLoad> outLoad) =>
+      _llamafuModelLoadAsync(params, outLoad);
+  int llamafuModelLoadPoll(LlamafuModelLoad load, Pointer<Float> outProgress, Pointer<LlamafuModel> outModel) =>
+      _llamafuModelLoadPoll(load, outProgress, outModel);
+  void llamafuModelLoadCancel(LlamafuModelLoad load) => _llamafuModelLoadCancel(load);
+  void llamafuModelLoadFree(LlamafuModelLoad load) => _llamafuModelLoadFree(load);
+  int llamafuSwapModel(Llamafu llamafu, LlamafuModel model) => _llamafuSwapModel(llamafu, model);
+  int llamafuPromptCacheEnable(Llamafu llamafu, Pointer<Utf8> dir, int maxBytes, int blockSize) =>
+      _llamafuPromptCacheEnable(llamafu, dir, maxBytes, blockSize);
+  void llamafuPromptCacheDisable(Llamafu llamafu) => _llamafuPromptCacheDisable(llamafu);
+  int llamafuPromptCacheClear(Llamafu llamafu) => _llamafuPromptCacheClear(llamafu);
+  int llamafuPromptCacheGetStats(Llamafu llamafu, Pointer<LlamafuPromptCacheStatsStruct> outStats) =>
+      _llamafuPromptCacheGetStats(llamafu, outStats);
 
   // Performance
   int llamafuGetPerfStats(Llamafu llamafu, Pointer<LlamafuPerfStatsStruct> outStats) =>
       _llamafuGetPerfStats(llamafu, outStats);
+  int llamafuGetRequestMetrics(Llamafu llamafu, Pointer<LlamafuRequestMetricsStruct> outMetrics) =>
+      _llamafuGetRequestMetrics(llamafu, outMetrics);
+  LlamafuSpeculativeParamsStruct llamafuSpeculativeDefaultParams() => _llamafuSpeculativeDefaultParams();
+  int llamafuSetSpeculative(Llamafu llamafu, Pointer<LlamafuSpeculativeParamsStruct> params) =>
+      _llamafuSetSpeculative(llamafu, params);
   int llamafuGetTimings(Llamafu llamafu, Pointer<LlamafuTimingsStruct> outTimings) =>
       _llamafuGetTimings(llamafu, outTimings);
   void llamafuResetTimings(Llamafu llamafu) => _llamafuResetTimings(llamafu);
   int llamafuGetMemoryUsage(Llamafu llamafu, Pointer<LlamafuMemoryUsageStruct> outUsage) =>
       _llamafuGetMemoryUsage(llamafu, outUsage);
+  int llamafuGetBufferInfo(
+          Llamafu llamafu, Pointer<LlamafuBufferInfoStruct> outBuffers, int capacity, Pointer<Int32> outCount) =>
+      _llamafuGetBufferInfo(llamafu, outBuffers, capacity, outCount);
+  int llamafuEstimateMemory(Pointer<LlamafuModelParams> params, Pointer<LlamafuContextParamsStruct> contextParams,
+          int budgetBytes, Pointer<LlamafuMemoryUsageStruct> outEstimate, Pointer<Bool> outFits) =>
+      _llamafuEstimateMemory(params, contextParams, budgetBytes, outEstimate, outFits);
   int llamafuBenchModel(Llamafu llamafu, int nThreads, int nPredict,
           Pointer<LlamafuBenchResultStruct> outResult) =>
       _llamafuBenchModel(llamafu, nThreads, nPredict, outResult);
+  int llamafuBenchRun(Llamafu llamafu, Pointer<LlamafuBenchParamsStruct> params,
+          Pointer<LlamafuBenchStatsStruct> outPrompt, Pointer<LlamafuBenchStatsStruct> outGeneration) =>
+      _llamafuBenchRun(llamafu, params, outPrompt, outGeneration);
   int llamafuSetNThreads(Llamafu llamafu, int nThreads, int nThreadsBatch) =>
       _llamafuSetNThreads(llamafu, nThreads, nThreadsBatch);
   int llamafuWarmup(Llamafu llamafu) => _llamafuWarmup(llamafu);
@@ -1569,6 +2819,74 @@ final class LlamafuBindings {
   int llamafuChatSessionGetHistory(LlamafuChatSession session, Pointer<Pointer<Utf8>> outHistoryJson) =>
       _llamafuChatSessionGetHistory(session, outHistoryJson);
   void llamafuChatSessionFree(LlamafuChatSession session) => _llamafuChatSessionFree(session);
+  int llamafuChatSessionCreateKv(Llamafu llamafu, Pointer<Utf8> systemPrompt, int seqId,
+          Pointer<LlamafuChatSession> outSession) =>
+      _llamafuChatSessionCreateKv(llamafu, systemPrompt, seqId, outSession);
+  int llamafuChatSessionGetNPast(LlamafuChatSession session, Pointer<Int32> outNPast) =>
+      _llamafuChatSessionGetNPast(session, outNPast);
+  int llamafuChatSessionSetParams(LlamafuChatSession session, Pointer<LlamafuInferParams> params) =>
+      _llamafuChatSessionSetParams(session, params);
+
+  // Continuous batching scheduler
+  int llamafuSchedulerSubmit(Llamafu llamafu, Pointer<LlamafuInferParams> params,
+          Pointer<NativeFunction<LlamafuStreamCallbackC>> callback, Pointer<Void> userData,
+          Pointer<LlamafuRequest> outRequest) =>
+      _llamafuSchedulerSubmit(llamafu, params, callback, userData, outRequest);
+  int llamafuSchedulerStep(Llamafu llamafu, Pointer<Int32> outNPending) =>
+      _llamafuSchedulerStep(llamafu, outNPending);
+  int llamafuRequestPoll(LlamafuRequest request, Pointer<Pointer<Utf8>> outText, Pointer<Int32> outState) =>
+      _llamafuRequestPoll(request, outText, outState);
+  int llamafuRequestCancel(LlamafuRequest request) => _llamafuRequestCancel(request);
+  void llamafuRequestFree(LlamafuRequest request) => _llamafuRequestFree(request);
+
+  // Background token streaming
+  int llamafuStreamStart(Llamafu llamafu, Pointer<LlamafuInferParams> params, int bufferBytes,
+          Pointer<NativeFunction<LlamafuStreamNotifyC>> notify, Pointer<Void> notifyData,
+          Pointer<LlamafuTokenStream> outStream) =>
+      _llamafuStreamStart(llamafu, params, bufferBytes, notify, notifyData, outStream);
+  int llamafuStreamRead(LlamafuTokenStream stream, Pointer<Uint8> outText, int textCapacity,
+          Pointer<Size> outTextLen, Pointer<Int32> outTokens, int tokensCapacity,
+          Pointer<Int32> outNTokens, Pointer<Bool> outFinished) =>
+      _llamafuStreamRead(stream, outText, textCapacity, outTextLen, outTokens, tokensCapacity,
+          outNTokens, outFinished);
+  int llamafuStreamCancel(LlamafuTokenStream stream) => _llamafuStreamCancel(stream);
+  void llamafuStreamFree(LlamafuTokenStream stream) => _llamafuStreamFree(stream);
+
+  // Request queue
+  int llamafuQueueSetCapacity(Llamafu llamafu, int capacity) =>
+      _llamafuQueueSetCapacity(llamafu, capacity);
+
+  int llamafuQueueSubmit(Llamafu llamafu, Pointer<LlamafuInferParams> params, int priority,
+          Pointer<NativeFunction<LlamafuStreamCallbackC>> onText,
+          Pointer<NativeFunction<LlamafuJobCallbackC>> onDone, Pointer<Void> userData,
+          Pointer<LlamafuJob> outJob) =>
+      _llamafuQueueSubmit(llamafu, params, priority, onText, onDone, userData, outJob);
+
+  int llamafuJobCancel(LlamafuJob job) => _llamafuJobCancel(job);
+
+  int llamafuJobGetState(LlamafuJob job, Pointer<Int32> outState) =>
+      _llamafuJobGetState(job, outState);
+
+  int llamafuJobWait(LlamafuJob job, int timeoutMs, Pointer<Pointer<Utf8>> outText) =>
+      _llamafuJobWait(job, timeoutMs, outText);
+
+  void llamafuJobFree(LlamafuJob job) => _llamafuJobFree(job);
+
+  // Threadpools
+  LlamafuThreadpoolParamsStruct llamafuThreadpoolDefaultParams() => _llamafuThreadpoolDefaultParams();
+  int llamafuGetCpuTopology(Pointer<LlamafuCpuTopologyStruct> outTopology) => _llamafuGetCpuTopology(outTopology);
+  int llamafuSetThreadpools(Llamafu llamafu, Pointer<LlamafuThreadpoolParamsStruct> decode,
+          Pointer<LlamafuThreadpoolParamsStruct> prefill) =>
+      _llamafuSetThreadpools(llamafu, decode, prefill);
+  int llamafuAutotuneThreads(Llamafu llamafu, Pointer<Utf8> cachePath, bool force,
+          Pointer<LlamafuAutotuneResultStruct> outResult) =>
+      _llamafuAutotuneThreads(llamafu, cachePath, force, outResult);
+
+  // Memory pressure
+  int llamafuReleaseMemory(Llamafu llamafu, int level, Pointer<Utf8> spillDir) =>
+      _llamafuReleaseMemory(llamafu, level, spillDir);
+  int llamafuResume(Llamafu llamafu) => _llamafuResume(llamafu);
+  int llamafuGetReleaseLevel(Llamafu llamafu) => _llamafuGetReleaseLevel(llamafu);
 
   // Text analysis
   int llamafuDetectLanguage(Llamafu llamafu, Pointer<Utf8> text,
@@ -1602,6 +2920,12 @@ final class LlamafuBindings {
   int llamafuImageProcess(Llamafu llamafu, Pointer<LlamafuMediaInput> input,
           Pointer<LlamafuImageProcessResultStruct> outResult) =>
       _llamafuImageProcess(llamafu, input, outResult);
+  void llamafuImageProcessResultFree(Pointer<LlamafuImageProcessResultStruct> result) =>
+      _llamafuImageProcessResultFree(result);
+  int llamafuImageCacheSetBudget(Llamafu llamafu, int maxBytes) => _llamafuImageCacheSetBudget(llamafu, maxBytes);
+  void llamafuImageCacheClear(Llamafu llamafu) => _llamafuImageCacheClear(llamafu);
+  int llamafuImageCacheGetStats(Llamafu llamafu, Pointer<LlamafuImageCacheStatsStruct> outStats) =>
+      _llamafuImageCacheGetStats(llamafu, outStats);
   int llamafuImageResize(Pointer<LlamafuMediaInput> input, int targetWidth, int targetHeight,
           bool maintainAspectRatio, Pointer<LlamafuMediaInput> outResized) =>
       _llamafuImageResize(input, targetWidth, targetHeight, maintainAspectRatio, outResized);
@@ -1623,6 +2947,10 @@ final class LlamafuBindings {
   int llamafuListLoraAdapters(Llamafu llamafu, Pointer<Pointer<LlamafuLoraAdapterInfoStruct>> outAdapters,
           Pointer<IntPtr> outNAdapters) =>
       _llamafuListLoraAdapters(llamafu, outAdapters, outNAdapters);
+  void llamafuFreeLoraAdapterList(Pointer<LlamafuLoraAdapterInfoStruct> adapters) =>
+      _llamafuFreeLoraAdapterList(adapters);
+  int llamafuApplyLoraBatch(Llamafu llamafu, Pointer<LlamafuLoraBatchStruct> batch) =>
+      _llamafuApplyLoraBatch(llamafu, batch);
   int llamafuValidateLoraCompatibility(Llamafu llamafu, Pointer<Utf8> loraPath,
           Pointer<Bool> outIsCompatible, Pointer<Pointer<Utf8>> outErrorMessage) =>
       _llamafuValidateLoraCompatibility(llamafu, loraPath, outIsCompatible, outErrorMessage);
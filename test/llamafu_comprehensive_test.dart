@@ -46,6 +46,18 @@ void main() {
           throwsA(isA<ArgumentError>()),
         );
       });
+
+      test('Batch size validation', () {
+        expect(
+          () => Llamafu.init(modelPath: 'valid.gguf', batchSize: 16),
+          throwsA(isA<ArgumentError>()),
+        );
+
+        expect(
+          () => Llamafu.init(modelPath: 'valid.gguf', batchSize: 256, microBatchSize: 512),
+          throwsA(isA<ArgumentError>()),
+        );
+      });
     });
 
     // =========================================================================
@@ -76,6 +88,23 @@ void main() {
         expect(ImageFormat.webp.toString(), contains('webp'));
       });
 
+      test('SamplingParams defaults defer to native', () {
+        const sampling = SamplingParams();
+        expect(sampling.topK, equals(0));
+        expect(sampling.repeatPenalty, equals(0.0));
+        expect(sampling.mirostat, equals(0));
+        expect(const SamplingParams(topK: 200).topK, equals(200));
+      });
+
+      test('Media enums match native values', () {
+        expect(ImageFormat.bmp.value, equals(3));
+        expect(ImageFormat.webp.value, equals(4));
+        expect(ImageFormat.fromValue(4), equals(ImageFormat.webp));
+        expect(ImageFormat.fromValue(6), equals(ImageFormat.auto));
+        expect(DataSource.base64.value, equals(1));
+        expect(AudioFormat.pcm16.value, equals(6));
+      });
+
       test('Base64 image input validation', () {
         final base64Input = MediaInput(
           type: MediaType.image,
@@ -729,6 +758,109 @@ void main() {
         expect(perfStats.evalSpeedTps, closeTo(166.67, 0.01));
       });
 
+      test('PerfStats reports reused prompt tokens', () {
+        const defaults = PerfStats(
+          startMs: 0.0,
+          endMs: 0.0,
+          loadMs: 0.0,
+          promptEvalMs: 0.0,
+          evalMs: 0.0,
+          promptTokens: 0,
+          evalTokens: 0,
+        );
+        const reused = PerfStats(
+          startMs: 0.0,
+          endMs: 100.0,
+          loadMs: 0.0,
+          promptEvalMs: 10.0,
+          evalMs: 90.0,
+          promptTokens: 4,
+          evalTokens: 32,
+          reusedTokens: 120,
+        );
+
+        expect(defaults.reusedTokens, equals(0));
+        expect(reused.reusedTokens, equals(120));
+      });
+
+      test('PerfStats reports speculative decoding acceptance', () {
+        const stats = PerfStats(
+          startMs: 0.0,
+          endMs: 100.0,
+          loadMs: 0.0,
+          promptEvalMs: 10.0,
+          evalMs: 90.0,
+          promptTokens: 4,
+          evalTokens: 32,
+          draftedTokens: 40,
+          acceptedDraftTokens: 30,
+          draftAcceptanceRate: 0.75,
+          tokensPerSecond: 42.0,
+        );
+
+        expect(stats.draftedTokens, equals(40));
+        expect(stats.acceptedDraftTokens, equals(30));
+        expect(stats.draftAcceptanceRate, closeTo(0.75, 1e-9));
+        expect(stats.tokensPerSecond, equals(42.0));
+        expect(DraftType.none.value, equals(0));
+        expect(DraftType.ngram.value, equals(1));
+        expect(DraftType.model.value, equals(2));
+      });
+
+      test('KvCacheType values match the native enum', () {
+        expect(KvCacheType.f32.value, equals(1));
+        expect(KvCacheType.f16.value, equals(2));
+        expect(KvCacheType.q8_0.value, equals(4));
+        expect(KvCacheType.q4_0.value, equals(8));
+        expect(KvCacheType.iq4_nl.value, equals(9));
+      });
+
+      test('PerfStats and PromptCacheStats report prompt cache use', () {
+        const stats = PerfStats(
+          startMs: 0.0,
+          endMs: 100.0,
+          loadMs: 0.0,
+          promptEvalMs: 10.0,
+          evalMs: 90.0,
+          promptTokens: 40,
+          evalTokens: 32,
+          restoredTokens: 512,
+          prefilledTokens: 40,
+        );
+
+        expect(stats.reusedTokens, equals(0));
+        expect(stats.restoredTokens, equals(512));
+        expect(stats.prefilledTokens, equals(40));
+
+        const cacheStats = PromptCacheStats(
+          entries: 3,
+          hits: 3,
+          misses: 1,
+          bytes: 1024,
+          maxBytes: 4096,
+        );
+        expect(cacheStats.hitRate, closeTo(0.75, 1e-9));
+        expect(
+          const PromptCacheStats(entries: 0, hits: 0, misses: 0, bytes: 0, maxBytes: 1).hitRate,
+          equals(0),
+        );
+      });
+
+      test('ImageCacheStats hit rate', () {
+        const stats = ImageCacheStats(
+          entries: 1,
+          hits: 4,
+          misses: 1,
+          bytes: 9437184,
+          maxBytes: 67108864,
+        );
+        expect(stats.hitRate, closeTo(0.8, 1e-9));
+        expect(
+          const ImageCacheStats(entries: 0, hits: 0, misses: 0, bytes: 0, maxBytes: 0).hitRate,
+          equals(0),
+        );
+      });
+
       test('MemoryUsage class with MB conversions', () {
         final memoryUsage = MemoryUsage(
           modelSizeBytes: 4 * 1024 * 1024 * 1024,
@@ -742,6 +874,35 @@ void main() {
         expect(memoryUsage.totalSizeMb, equals(5120.0));
       });
 
+      test('MemoryUsage breakdown and fit check', () {
+        const memoryUsage = MemoryUsage(
+          modelSizeBytes: 3 * 1024 * 1024 * 1024,
+          kvCacheSizeBytes: 256 * 1024 * 1024,
+          computeBufferSizeBytes: 128 * 1024 * 1024,
+          totalSizeBytes: 3584 * 1024 * 1024,
+          modelHostBytes: 1024 * 1024 * 1024,
+          modelDeviceBytes: 2 * 1024 * 1024 * 1024,
+          measured: true,
+        );
+
+        expect(memoryUsage.modelHostBytes + memoryUsage.modelDeviceBytes,
+            equals(memoryUsage.modelSizeBytes));
+        expect(memoryUsage.measured, isTrue);
+        expect(memoryUsage.fitsIn(4 * 1024 * 1024 * 1024), isTrue);
+        expect(memoryUsage.fitsIn(3 * 1024 * 1024 * 1024), isFalse);
+
+        const buffer = BufferInfo(
+          bufferType: 'CPU_Mapped',
+          kind: BufferKind.weights,
+          isHost: true,
+          sizeBytes: 1024,
+        );
+        expect(buffer.kind, equals(BufferKind.weights));
+        expect(BufferKind.values.length, equals(6));
+        expect(BufferKind.lora.index, equals(5));
+        expect(memoryUsage.loraBytes, equals(0));
+      });
+
       test('BenchmarkResult class structure', () {
         final benchResult = BenchmarkResult(
           promptTokens: 100,
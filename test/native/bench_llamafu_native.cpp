@@ -0,0 +1,383 @@
+// llama-bench style benchmark for Llamafu.
+//
+// Sweeps prompt processing (pp) and token generation (tg) over prompt
+// lengths, batch sizes, thread counts and KV cache types against a real GGUF
+// model, and prints one JSON record per test so runs can be diffed across
+// releases and devices:
+//
+//   llamafu_bench -m model.gguf -p 128,512 -n 128 -b 256,512 -t 4,8 -ctk f16,q8_0 -r 5
+//
+// The model comes from -m or LLAMAFU_TEST_MODEL; without one the benchmark
+// exits with SKIP_RETURN_CODE so CTest reports it as skipped.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../../android/src/main/cpp/llamafu.h"
+
+static constexpr int SKIP_RETURN_CODE = 77;
+
+struct KvType {
+    const char* name;
+    int32_t value;
+};
+
+static const KvType KV_TYPES[] = {
+    {"f32", LLAMAFU_KV_CACHE_F32},   {"f16", LLAMAFU_KV_CACHE_F16},   {"bf16", LLAMAFU_KV_CACHE_BF16},
+    {"q8_0", LLAMAFU_KV_CACHE_Q8_0}, {"q5_1", LLAMAFU_KV_CACHE_Q5_1}, {"q5_0", LLAMAFU_KV_CACHE_Q5_0},
+    {"q4_1", LLAMAFU_KV_CACHE_Q4_1}, {"q4_0", LLAMAFU_KV_CACHE_Q4_0}, {"iq4_nl", LLAMAFU_KV_CACHE_IQ4_NL},
+};
+
+struct BenchTest {
+    int32_t n_prompt;
+    int32_t n_gen;
+};
+
+struct BenchOptions {
+    std::string model_path;
+    std::vector<int32_t> n_prompt = {512};
+    std::vector<int32_t> n_gen = {128};
+    std::vector<BenchTest> prompt_gen;
+    std::vector<int32_t> n_batch = {512};
+    std::vector<int32_t> n_threads;
+    std::vector<std::string> type_k = {"f16"};
+    std::vector<std::string> type_v = {"f16"};
+    int32_t n_gpu_layers = 0;
+    int32_t repetitions = 5;
+    int32_t warmup = 1;
+    std::string output = "json";
+};
+
+static void print_usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [options]\n"
+              << "  -m,   --model PATH          GGUF model (default: $LLAMAFU_TEST_MODEL)\n"
+              << "  -p,   --n-prompt LIST       prompt lengths of pp tests (default: 512)\n"
+              << "  -n,   --n-gen LIST          generated tokens of tg tests (default: 128)\n"
+              << "  -pg   P,N                   pp then tg at depth P (repeatable)\n"
+              << "  -b,   --batch-size LIST     tokens per prompt decode (default: 512)\n"
+              << "  -t,   --threads LIST        thread counts (default: all cores)\n"
+              << "  -ctk, --cache-type-k LIST   K cache types (default: f16)\n"
+              << "  -ctv, --cache-type-v LIST   V cache types (default: f16)\n"
+              << "  -ngl, --n-gpu-layers N      layers to offload (default: 0)\n"
+              << "  -r,   --repetitions N       timed repetitions per test (default: 5)\n"
+              << "  -w,   --warmup N            untimed repetitions per test (default: 1)\n"
+              << "  -o,   --output json|md      output format (default: json)\n";
+}
+
+static std::vector<std::string> split_list(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream in(value);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static bool parse_int_list(const std::string& value, std::vector<int32_t>& out) {
+    out.clear();
+    for (const std::string& item : split_list(value)) {
+        char* end = nullptr;
+        const long parsed = strtol(item.c_str(), &end, 10);
+        if (*end != '\0' || parsed < 0 || parsed > 1 << 20) {
+            return false;
+        }
+        out.push_back(static_cast<int32_t>(parsed));
+    }
+    return !out.empty();
+}
+
+static bool kv_type_value(const std::string& name, int32_t& value) {
+    for (const KvType& type : KV_TYPES) {
+        if (name == type.name) {
+            value = type.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_args(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << arg << "\n";
+            return false;
+        }
+        const std::string value = argv[++i];
+        std::vector<int32_t> ints;
+        bool ok = true;
+        if (arg == "-m" || arg == "--model") {
+            options.model_path = value;
+        } else if (arg == "-p" || arg == "--n-prompt") {
+            ok = parse_int_list(value, options.n_prompt);
+        } else if (arg == "-n" || arg == "--n-gen") {
+            ok = parse_int_list(value, options.n_gen);
+        } else if (arg == "-pg") {
+            ok = parse_int_list(value, ints) && ints.size() == 2;
+            if (ok) {
+                options.prompt_gen.push_back({ints[0], ints[1]});
+            }
+        } else if (arg == "-b" || arg == "--batch-size") {
+            ok = parse_int_list(value, options.n_batch);
+        } else if (arg == "-t" || arg == "--threads") {
+            ok = parse_int_list(value, options.n_threads);
+        } else if (arg == "-ctk" || arg == "--cache-type-k") {
+            options.type_k = split_list(value);
+        } else if (arg == "-ctv" || arg == "--cache-type-v") {
+            options.type_v = split_list(value);
+        } else if (arg == "-ngl" || arg == "--n-gpu-layers") {
+            ok = parse_int_list(value, ints) && ints.size() == 1;
+            options.n_gpu_layers = ok ? ints[0] : 0;
+        } else if (arg == "-r" || arg == "--repetitions") {
+            ok = parse_int_list(value, ints) && ints.size() == 1 && ints[0] >= 1;
+            options.repetitions = ok ? ints[0] : 0;
+        } else if (arg == "-w" || arg == "--warmup") {
+            ok = parse_int_list(value, ints) && ints.size() == 1;
+            options.warmup = ok ? ints[0] : 0;
+        } else if (arg == "-o" || arg == "--output") {
+            options.output = value;
+            ok = value == "json" || value == "md";
+        } else {
+            std::cerr << "unknown argument: " << arg << "\n";
+            return false;
+        }
+        if (!ok) {
+            std::cerr << "invalid value for " << arg << ": " << value << "\n";
+            return false;
+        }
+    }
+
+    int32_t unused;
+    for (const std::string& name : options.type_k) {
+        if (!kv_type_value(name, unused)) {
+            std::cerr << "unknown cache type: " << name << "\n";
+            return false;
+        }
+    }
+    for (const std::string& name : options.type_v) {
+        if (!kv_type_value(name, unused)) {
+            std::cerr << "unknown cache type: " << name << "\n";
+            return false;
+        }
+    }
+    if (options.n_threads.empty()) {
+        options.n_threads = {static_cast<int32_t>(std::max(1u, std::thread::hardware_concurrency()))};
+    }
+    return true;
+}
+
+static std::string json_escape(const std::string& text) {
+    std::string out;
+    for (unsigned char c : text) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out;
+}
+
+static std::string stats_json(const LlamafuBenchStats& stats) {
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"n_tokens\": %d, \"samples\": %d, \"avg_ms\": %.4f, \"stddev_ms\": %.4f, "
+             "\"avg_ts\": %.4f, \"stddev_ts\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f}",
+             stats.n_tokens, stats.n_samples, stats.mean_ms, stats.stddev_ms, stats.mean_tps, stats.stddev_tps,
+             stats.p50_ms, stats.p99_ms);
+    return buf;
+}
+
+static std::string test_name(const BenchTest& test) {
+    if (test.n_prompt > 0 && test.n_gen > 0) {
+        return "pp" + std::to_string(test.n_prompt) + "+tg" + std::to_string(test.n_gen);
+    }
+    return test.n_prompt > 0 ? "pp" + std::to_string(test.n_prompt) : "tg" + std::to_string(test.n_gen);
+}
+
+static std::string utc_timestamp() {
+    const std::time_t now = std::time(nullptr);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return buf;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parse_args(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (options.model_path.empty()) {
+        const char* env_model = getenv("LLAMAFU_TEST_MODEL");
+        options.model_path = env_model ? env_model : "";
+    }
+    if (options.model_path.empty()) {
+        std::cerr << "No model: pass -m or set LLAMAFU_TEST_MODEL; skipping benchmark\n";
+        return SKIP_RETURN_CODE;
+    }
+
+    std::vector<BenchTest> tests;
+    for (int32_t n_prompt : options.n_prompt) {
+        if (n_prompt > 0) {
+            tests.push_back({n_prompt, 0});
+        }
+    }
+    for (int32_t n_gen : options.n_gen) {
+        if (n_gen > 0) {
+            tests.push_back({0, n_gen});
+        }
+    }
+    tests.insert(tests.end(), options.prompt_gen.begin(), options.prompt_gen.end());
+    if (tests.empty()) {
+        std::cerr << "No tests selected\n";
+        return 1;
+    }
+    int32_t n_ctx = 0;
+    for (const BenchTest& test : tests) {
+        n_ctx = std::max(n_ctx, test.n_prompt + test.n_gen);
+    }
+
+    LlamafuModelParams model_params = {};
+    model_params.model_path = options.model_path.c_str();
+    model_params.n_ctx = n_ctx;
+    model_params.use_gpu = options.n_gpu_layers != 0;
+    model_params.n_gpu_layers = options.n_gpu_layers;
+
+    const auto load_start = std::chrono::steady_clock::now();
+    LlamafuModel model = nullptr;
+    LlamafuError err = llamafu_model_load(&model_params, &model);
+    if (err != LLAMAFU_SUCCESS) {
+        std::cerr << "Failed to load " << options.model_path << ": " << err << "\n";
+        return 1;
+    }
+    const double load_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+
+    LlamafuSystemInfo system_info = {};
+    llamafu_get_system_info(&system_info);
+    const std::string timestamp = utc_timestamp();
+
+    bool failed = false;
+    bool first_record = true;
+    if (options.output == "json") {
+        std::cout << "[\n";
+    } else {
+        std::cout << "| test | n_batch | threads | type_k | type_v | t/s | p50 ms | p99 ms |\n"
+                  << "| --- | ---: | ---: | --- | --- | ---: | ---: | ---: |\n";
+    }
+
+    for (const std::string& type_k : options.type_k) {
+        for (const std::string& type_v : options.type_v) {
+            for (int32_t n_batch : options.n_batch) {
+                LlamafuContextParams ctx_params = llamafu_context_default_params();
+                ctx_params.n_ctx = static_cast<uint32_t>(n_ctx);
+                ctx_params.n_batch = static_cast<uint32_t>(n_batch);
+                ctx_params.n_ubatch = static_cast<uint32_t>(std::min(n_batch, 512));
+                kv_type_value(type_k, ctx_params.type_k);
+                kv_type_value(type_v, ctx_params.type_v);
+
+                Llamafu llamafu = nullptr;
+                err = llamafu_init_from_model(model, &ctx_params, &llamafu);
+                if (err != LLAMAFU_SUCCESS) {
+                    std::cerr << "Context n_batch=" << n_batch << " type_k=" << type_k << " type_v=" << type_v
+                              << " failed: " << err << "\n";
+                    failed = true;
+                    continue;
+                }
+
+                LlamafuModelInfo info = {};
+                llamafu_get_model_info(llamafu, &info);
+                const std::string model_name = info.name ? info.name : "";
+                const std::string model_arch = info.architecture ? info.architecture : "";
+
+                for (int32_t n_threads : options.n_threads) {
+                    for (const BenchTest& test : tests) {
+                        LlamafuBenchParams params = {};
+                        params.n_prompt = test.n_prompt;
+                        params.n_gen = test.n_gen;
+                        params.n_batch = n_batch;
+                        params.n_threads = n_threads;
+                        params.repetitions = options.repetitions;
+                        params.warmup = options.warmup;
+
+                        LlamafuBenchStats pp = {};
+                        LlamafuBenchStats tg = {};
+                        err = llamafu_bench_run(llamafu, &params, &pp, &tg);
+                        if (err != LLAMAFU_SUCCESS) {
+                            std::cerr << test_name(test) << " (n_batch=" << n_batch << ", threads=" << n_threads
+                                      << ") failed: " << err << "\n";
+                            failed = true;
+                            continue;
+                        }
+
+                        if (options.output == "md") {
+                            const LlamafuBenchStats& main = test.n_gen > 0 ? tg : pp;
+                            char row[256];
+                            snprintf(row, sizeof(row), "| %s | %d | %d | %s | %s | %.2f ± %.2f | %.3f | %.3f |\n",
+                                     test_name(test).c_str(), n_batch, n_threads, type_k.c_str(), type_v.c_str(),
+                                     main.mean_tps, main.stddev_tps, main.p50_ms, main.p99_ms);
+                            std::cout << row;
+                            continue;
+                        }
+
+                        std::cout << (first_record ? "" : ",\n") << "  {\n"
+                                  << "    \"timestamp\": \"" << timestamp << "\",\n"
+                                  << "    \"model_filename\": \"" << json_escape(options.model_path) << "\",\n"
+                                  << "    \"model_name\": \"" << json_escape(model_name) << "\",\n"
+                                  << "    \"model_arch\": \"" << json_escape(model_arch) << "\",\n"
+                                  << "    \"model_n_params\": " << info.n_params << ",\n"
+                                  << "    \"model_size\": " << info.size_bytes << ",\n"
+                                  << "    \"load_ms\": " << load_ms << ",\n"
+                                  << "    \"system_info\": \"" << json_escape(system_info.system_info) << "\",\n"
+                                  << "    \"n_gpu_layers\": " << options.n_gpu_layers << ",\n"
+                                  << "    \"n_batch\": " << n_batch << ",\n"
+                                  << "    \"n_ubatch\": " << ctx_params.n_ubatch << ",\n"
+                                  << "    \"n_threads\": " << n_threads << ",\n"
+                                  << "    \"type_k\": \"" << type_k << "\",\n"
+                                  << "    \"type_v\": \"" << type_v << "\",\n"
+                                  << "    \"test\": \"" << test_name(test) << "\",\n"
+                                  << "    \"n_prompt\": " << test.n_prompt << ",\n"
+                                  << "    \"n_gen\": " << test.n_gen << ",\n"
+                                  << "    \"repetitions\": " << options.repetitions << ",\n"
+                                  << "    \"warmup\": " << options.warmup << ",\n"
+                                  << "    \"pp\": " << stats_json(pp) << ",\n"
+                                  << "    \"tg\": " << stats_json(tg) << "\n"
+                                  << "  }";
+                        first_record = false;
+                    }
+                }
+                llamafu_free(llamafu);
+            }
+        }
+    }
+
+    if (options.output == "json") {
+        std::cout << (first_record ? "" : "\n") << "]\n";
+    }
+    llamafu_model_release(model);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,870 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+// The implementation is included so its internal helpers can be tested
+// directly; this target does not compile llamafu.cpp separately.
+#include "../../android/src/main/cpp/llamafu.cpp"
+
+#include <filesystem>
+#include <future>
+#include <string>
+#include <vector>
+
+// Handle on the model named by LLAMAFU_TEST_MODEL; tests that need real
+// weights skip without one
+class ModelTest : public ::testing::Test {
+protected:
+    Llamafu llamafu = nullptr;
+
+    void SetUp() override {
+        const char* path = getenv("LLAMAFU_TEST_MODEL");
+        if (!path || !*path) {
+            GTEST_SKIP() << "LLAMAFU_TEST_MODEL is not set";
+        }
+        LlamafuModelParams params = {};
+        params.model_path = path;
+        params.n_ctx = 512;
+        params.n_threads = 2;
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_init(&params, &llamafu));
+    }
+
+    void TearDown() override {
+        if (llamafu) {
+            llamafu_free(llamafu);
+        }
+    }
+};
+
+// Candidates for every token of a small vocabulary, in token id order as the
+// pipeline builds them
+static std::vector<llama_token_data> make_candidates(const std::vector<float>& logits) {
+    std::vector<llama_token_data> data;
+    for (size_t i = 0; i < logits.size(); ++i) {
+        data.push_back({static_cast<llama_token>(i), logits[i], 0.0f});
+    }
+    return data;
+}
+
+class SamplerFrontStageTest : public ::testing::Test {
+protected:
+    SamplerFrontStage stage;
+    llama_sampler sampler = {nullptr, &stage};
+    std::vector<llama_token_data> data;
+    llama_token_data_array cur_p = {};
+
+    void apply(const std::vector<float>& logits) {
+        stage.n_vocab = static_cast<int32_t>(logits.size());
+        data = make_candidates(logits);
+        cur_p = {data.data(), data.size(), -1, false};
+        sampler_front_stage_apply(&sampler, &cur_p);
+    }
+
+    float logit_of(llama_token token) const {
+        for (size_t i = 0; i < cur_p.size; ++i) {
+            if (cur_p.data[i].id == token) {
+                return cur_p.data[i].logit;
+            }
+        }
+        ADD_FAILURE() << "token " << token << " was filtered";
+        return 0.0f;
+    }
+};
+
+// =============================================================================
+// Sampling parameters
+// =============================================================================
+
+TEST(SamplerConfigTest, ZeroFieldsTakeDefaults) {
+    LlamafuInferParams params = {};
+    params.temperature = 0.8f;
+    const SamplerConfig config = sampler_config_from(&params);
+    EXPECT_TRUE(config == SamplerConfig());
+    EXPECT_EQ(40, config.top_k);
+    EXPECT_FLOAT_EQ(0.95f, config.top_p);
+    EXPECT_FLOAT_EQ(1.1f, config.repeat_penalty);
+    EXPECT_EQ(64, config.repeat_last_n);
+    EXPECT_EQ(42u, config.seed);
+}
+
+TEST(SamplerConfigTest, NonPositiveTemperatureIsGreedy) {
+    LlamafuInferParams params = {};
+    EXPECT_FLOAT_EQ(0.0f, sampler_config_from(&params).temperature);
+
+    params.temperature = -1.0f;
+    EXPECT_LE(sampler_config_from(&params).temperature, 0.0f);
+
+    params.temperature = 1.3f;
+    EXPECT_FLOAT_EQ(1.3f, sampler_config_from(&params).temperature);
+}
+
+TEST(SamplerConfigTest, ExplicitFieldsOverrideDefaults) {
+    LlamafuInferParams params = {};
+    params.temperature = 0.5f;
+    params.top_k = 200;
+    params.repeat_last_n = -1;
+    params.mirostat = 2;
+    params.frequency_penalty = 0.5f;
+    params.seed = 7;
+    const SamplerConfig config = sampler_config_from(&params);
+    EXPECT_EQ(200, config.top_k);
+    EXPECT_EQ(-1, config.repeat_last_n);
+    EXPECT_EQ(2, config.mirostat);
+    EXPECT_FLOAT_EQ(0.5f, config.frequency_penalty);
+    EXPECT_EQ(7u, config.seed);
+    EXPECT_FALSE(config == SamplerConfig());
+}
+
+// =============================================================================
+// Sampler front stage
+// =============================================================================
+
+TEST_F(SamplerFrontStageTest, TopKKeepsHighestLogitsSorted) {
+    stage.top_k = 3;
+    apply({0.5f, 3.0f, -1.0f, 2.0f, 1.0f, 4.0f});
+    ASSERT_EQ(3u, cur_p.size);
+    EXPECT_TRUE(cur_p.sorted);
+    EXPECT_EQ(5, cur_p.data[0].id);
+    EXPECT_EQ(1, cur_p.data[1].id);
+    EXPECT_EQ(3, cur_p.data[2].id);
+}
+
+TEST_F(SamplerFrontStageTest, TopKLargerThanVocabularyKeepsAll) {
+    stage.top_k = 200;
+    apply({1.0f, 2.0f, 3.0f});
+    EXPECT_EQ(3u, cur_p.size);
+    EXPECT_FALSE(cur_p.sorted);
+}
+
+TEST_F(SamplerFrontStageTest, RepeatPenaltyScalesSeenTokens) {
+    stage.repeat_penalty = 2.0f;
+    stage.repeat_last_n = 8;
+    sampler_front_stage_accept(&sampler, 1);
+    sampler_front_stage_accept(&sampler, 2);
+    apply({2.0f, 2.0f, -2.0f, 2.0f});
+    EXPECT_FLOAT_EQ(2.0f, logit_of(0));
+    EXPECT_FLOAT_EQ(1.0f, logit_of(1));   // Positive logits are divided
+    EXPECT_FLOAT_EQ(-4.0f, logit_of(2));  // Negative logits are multiplied
+    EXPECT_FLOAT_EQ(2.0f, logit_of(3));
+}
+
+TEST_F(SamplerFrontStageTest, FrequencyAndPresencePenalties) {
+    stage.frequency_penalty = 0.5f;
+    stage.presence_penalty = 0.25f;
+    stage.repeat_last_n = -1;
+    for (llama_token token : {1, 1, 1, 2}) {
+        sampler_front_stage_accept(&sampler, token);
+    }
+    apply({1.0f, 1.0f, 1.0f});
+    EXPECT_FLOAT_EQ(1.0f, logit_of(0));
+    EXPECT_FLOAT_EQ(1.0f - 1.5f - 0.25f, logit_of(1));
+    EXPECT_FLOAT_EQ(1.0f - 0.5f - 0.25f, logit_of(2));
+}
+
+TEST_F(SamplerFrontStageTest, RepeatWindowForgetsOldTokens) {
+    stage.repeat_penalty = 2.0f;
+    stage.repeat_last_n = 2;
+    for (llama_token token : {1, 2, 3}) {
+        sampler_front_stage_accept(&sampler, token);
+    }
+    EXPECT_EQ(0u, stage.counts.count(1));
+    EXPECT_EQ(1, stage.counts[2]);
+    EXPECT_EQ(1, stage.counts[3]);
+
+    sampler_front_stage_reset(&sampler);
+    EXPECT_TRUE(stage.history.empty());
+    EXPECT_TRUE(stage.counts.empty());
+}
+
+TEST_F(SamplerFrontStageTest, NewlineIsSparedUnlessPenalized) {
+    stage.repeat_penalty = 2.0f;
+    stage.repeat_last_n = 8;
+    stage.nl_token = 1;
+    sampler_front_stage_accept(&sampler, 1);
+    apply({2.0f, 2.0f});
+    EXPECT_FLOAT_EQ(2.0f, logit_of(1));
+
+    stage.penalize_nl = true;
+    apply({2.0f, 2.0f});
+    EXPECT_FLOAT_EQ(1.0f, logit_of(1));
+}
+
+TEST_F(SamplerFrontStageTest, IgnoreEosBansEndTokens) {
+    stage.ignore_eos = true;
+    stage.eos_token = 2;
+    stage.eot_token = 3;
+    apply({1.0f, 1.0f, 5.0f, 5.0f});
+    EXPECT_EQ(-INFINITY, logit_of(2));
+    EXPECT_EQ(-INFINITY, logit_of(3));
+    EXPECT_FLOAT_EQ(1.0f, logit_of(0));
+}
+
+// =============================================================================
+// Stop sequences and streamed text
+// =============================================================================
+
+static StopMatcher make_stop_matcher(std::vector<const char*> stops) {
+    LlamafuInferParams params = {};
+    params.stop_sequences = stops.data();
+    params.n_stop_sequences = static_cast<int32_t>(stops.size());
+    StopMatcher matcher;
+    EXPECT_TRUE(build_stop_matcher(&params, matcher));
+    return matcher;
+}
+
+// Feeds pieces through a detokenizer, recording each span it releases
+struct StreamCapture {
+    StreamDetokenizer detok;
+    std::vector<std::string> spans;
+
+    explicit StreamCapture(const StopMatcher* stops = nullptr) : detok(stops) {}
+
+    void push(const std::string& piece) {
+        detok.push(piece.data(), piece.size(), [&](const char* text, size_t len) {
+            EXPECT_EQ('\0', text[len]);
+            spans.emplace_back(text, len);
+        });
+    }
+
+    void flush() {
+        detok.flush([&](const char* text, size_t len) { spans.emplace_back(text, len); });
+    }
+
+    std::string text() const {
+        std::string out;
+        for (const auto& span : spans) {
+            out += span;
+        }
+        return out;
+    }
+};
+
+TEST(StopMatcherTest, RejectsMalformedStops) {
+    StopMatcher matcher;
+    LlamafuInferParams params = {};
+    params.n_stop_sequences = -1;
+    EXPECT_FALSE(build_stop_matcher(&params, matcher));
+
+    params.n_stop_sequences = 1;
+    EXPECT_FALSE(build_stop_matcher(&params, matcher));
+
+    const char* empty[] = {""};
+    params.stop_sequences = empty;
+    EXPECT_FALSE(build_stop_matcher(&params, matcher));
+
+    const char* missing[] = {"ok", nullptr};
+    params.stop_sequences = missing;
+    params.n_stop_sequences = 2;
+    EXPECT_FALSE(build_stop_matcher(&params, matcher));
+
+    params.n_stop_sequences = 0;
+    ASSERT_TRUE(build_stop_matcher(&params, matcher));
+    EXPECT_TRUE(matcher.empty());
+}
+
+TEST(StopMatcherTest, OverlappingStopsEndAtFirstCompletion) {
+    // "bc" completes inside "abcd" before "abcd" can
+    const StopMatcher matcher = make_stop_matcher({"abcd", "bc"});
+    StreamCapture capture(&matcher);
+    capture.push("xabcd");
+    EXPECT_TRUE(capture.detok.stopped);
+    EXPECT_EQ("xa", capture.text());
+}
+
+TEST(StopMatcherTest, SuffixStopCutsLongestMatch) {
+    const StopMatcher matcher = make_stop_matcher({"b", "ab"});
+    StreamCapture capture(&matcher);
+    capture.push("xxab");
+    EXPECT_TRUE(capture.detok.stopped);
+    EXPECT_EQ("xx", capture.text());
+}
+
+TEST(StopMatcherTest, FailureLinksRecoverFromFalseStarts) {
+    const StopMatcher matcher = make_stop_matcher({"aab"});
+    StreamCapture capture(&matcher);
+    capture.push("aaa");
+    EXPECT_FALSE(capture.detok.stopped);
+    EXPECT_EQ("a", capture.text());  // "aa" could still start the stop string
+    capture.push("b tail");
+    EXPECT_TRUE(capture.detok.stopped);
+    EXPECT_EQ("a", capture.text());
+}
+
+TEST(StopMatcherTest, MatchSpansTokens) {
+    const StopMatcher matcher = make_stop_matcher({"\n\nUser:", "</answer>"});
+    StreamCapture capture(&matcher);
+    capture.push("Hel");
+    capture.push("lo\n\nUs");
+    EXPECT_EQ("Hello", capture.text());  // The possible stop prefix is held back
+    capture.push("er: more");
+    EXPECT_TRUE(capture.detok.stopped);
+    capture.push("ignored");
+    capture.flush();
+    EXPECT_EQ("Hello", capture.text());
+}
+
+TEST(StopMatcherTest, RuledOutPrefixIsReleased) {
+    const StopMatcher matcher = make_stop_matcher({"</answer>"});
+    StreamCapture capture(&matcher);
+    capture.push("a </an");
+    EXPECT_EQ("a ", capture.text());
+    capture.push("d> b");
+    EXPECT_FALSE(capture.detok.stopped);
+    EXPECT_EQ("a </and> b", capture.text());
+}
+
+TEST(StreamDetokenizerTest, IncompleteUtf8Tail) {
+    EXPECT_EQ(0u, incomplete_utf8_tail("abc", 3));
+    EXPECT_EQ(1u, incomplete_utf8_tail("a\xC3", 2));
+    EXPECT_EQ(0u, incomplete_utf8_tail("a\xC3\xA9", 3));
+    EXPECT_EQ(2u, incomplete_utf8_tail("\xE2\x82", 2));
+    EXPECT_EQ(3u, incomplete_utf8_tail("\xF0\x9F\x98", 3));
+    EXPECT_EQ(0u, incomplete_utf8_tail("\xF0\x9F\x98\x80", 4));
+    EXPECT_EQ(0u, incomplete_utf8_tail("", 0));
+}
+
+TEST(StreamDetokenizerTest, HoldsCharactersSplitAcrossPieces) {
+    StreamCapture capture;
+    capture.push("caf\xC3");
+    ASSERT_EQ(1u, capture.spans.size());
+    EXPECT_EQ("caf", capture.spans[0]);
+    capture.push("\xA9!");
+    ASSERT_EQ(2u, capture.spans.size());
+    EXPECT_EQ("\xC3\xA9!", capture.spans[1]);
+
+    // A four-byte character over three pieces is released once, whole
+    capture.push("\xF0");
+    capture.push("\x9F\x98");
+    EXPECT_EQ(2u, capture.spans.size());
+    capture.push("\x80");
+    ASSERT_EQ(3u, capture.spans.size());
+    EXPECT_EQ("\xF0\x9F\x98\x80", capture.spans[2]);
+}
+
+TEST(StreamDetokenizerTest, StopAfterSplitCharacter) {
+    const StopMatcher matcher = make_stop_matcher({"END"});
+    StreamCapture capture(&matcher);
+    capture.push("\xE2\x82");
+    EXPECT_TRUE(capture.spans.empty());
+    capture.push("\xAC" "EN");
+    EXPECT_EQ("\xE2\x82\xAC", capture.text());
+    capture.push("D");
+    EXPECT_TRUE(capture.detok.stopped);
+    EXPECT_EQ("\xE2\x82\xAC", capture.text());
+}
+
+TEST(StreamDetokenizerTest, FlushReleasesPending) {
+    const StopMatcher matcher = make_stop_matcher({"stop"});
+    StreamCapture capture(&matcher);
+    capture.push("to st");
+    EXPECT_EQ("to ", capture.text());
+    capture.flush();
+    EXPECT_EQ("to st", capture.text());
+    EXPECT_TRUE(capture.detok.pending.empty());
+}
+
+// =============================================================================
+// Token stream ring
+// =============================================================================
+
+// A stream without a worker, filled directly through token_stream_push
+static std::unique_ptr<LlamafuTokenStream_s> make_ring_stream(size_t ring_size) {
+    auto stream = std::make_unique<LlamafuTokenStream_s>();
+    stream->ring.resize(ring_size);
+    stream->ring_mask = ring_size - 1;
+    return stream;
+}
+
+TEST(TokenStreamTest, OversizedRecordIsReadInParts) {
+    auto stream = make_ring_stream(64);
+    const std::string text = "ab\xE2\x82\xAC" "cdefgh";  // 11 bytes, euro sign at 2..4
+    ASSERT_TRUE(token_stream_push(stream.get(), 7, text.data(), static_cast<int32_t>(text.size())));
+    ASSERT_TRUE(token_stream_push(stream.get(), 8, "ij", 2));
+    stream->finished.store(true);
+
+    char buf[4];
+    int32_t tokens[4];
+    size_t n_text = 0;
+    int32_t n_tokens = 0;
+    bool finished = false;
+    std::string out;
+    std::vector<int32_t> ids;
+    std::vector<size_t> parts;
+    for (int i = 0; i < 16 && !finished; ++i) {
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_stream_read(stream.get(), buf, sizeof(buf), &n_text,
+                                                       tokens, 4, &n_tokens, &finished));
+        out.append(buf, n_text);
+        ids.insert(ids.end(), tokens, tokens + n_tokens);
+        parts.push_back(n_text);
+    }
+    ASSERT_TRUE(finished);
+    EXPECT_EQ(text + "ij", out);
+    EXPECT_EQ((std::vector<int32_t>{7, 8}), ids);
+
+    // The euro sign is never split, so the first part stops before it
+    ASSERT_GE(parts.size(), 2u);
+    EXPECT_EQ(2u, parts[0]);
+    EXPECT_EQ(4u, parts[1]);
+}
+
+TEST(TokenStreamTest, TinyBufferIsRejected) {
+    auto stream = make_ring_stream(64);
+    char buf[3];
+    size_t n_text = 0;
+    bool finished = false;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_stream_read(stream.get(), buf, sizeof(buf), &n_text,
+                                                               nullptr, 0, nullptr, &finished));
+}
+
+// =============================================================================
+// Piece table and batch tokenization
+// =============================================================================
+
+TEST(PieceTableTest, LookupSpansOffsets) {
+    LlamafuModel_s model;
+    const std::string arena = "abcde";  // "ab", "", "cde"
+    model.piece_arena.assign(arena.begin(), arena.end());
+    model.piece_offsets = {0, 2, 2, 5};
+
+    EXPECT_EQ("ab", token_piece(&model, 0));
+    EXPECT_TRUE(token_piece(&model, 1).empty());
+    EXPECT_EQ("cde", token_piece(&model, 2));
+
+    // Ids outside the vocabulary have no piece
+    EXPECT_TRUE(token_piece(&model, 3).empty());
+    EXPECT_TRUE(token_piece(&model, -1).empty());
+}
+
+TEST(PieceTableTest, EmptyTableHasNoPieces) {
+    LlamafuModel_s model;
+    EXPECT_TRUE(token_piece(&model, 0).empty());
+}
+
+TEST_F(ModelTest, PieceTableMatchesTokenToPiece) {
+    const llama_vocab* vocab = llama_model_get_vocab(llamafu->model);
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    ASSERT_EQ(static_cast<size_t>(n_vocab) + 1, llamafu->shared_model->piece_offsets.size());
+
+    std::vector<char> buf(256);
+    for (llama_token token = 0; token < n_vocab; ++token) {
+        int32_t n = llama_token_to_piece(vocab, token, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        if (n < 0) {
+            buf.resize(static_cast<size_t>(-n));
+            n = llama_token_to_piece(vocab, token, buf.data(), static_cast<int32_t>(buf.size()), 0, true);
+        }
+        ASSERT_EQ(std::string_view(buf.data(), std::max(n, 0)), token_piece(llamafu->shared_model, token))
+            << "token " << token;
+    }
+}
+
+TEST_F(ModelTest, TokenizeBatchMatchesTokenize) {
+    const char* texts[] = {"Hello", "world, again", "caf\xC3\xA9"};
+    std::vector<std::vector<LlamafuToken>> expected;
+    int32_t total = 0;
+    for (const char* text : texts) {
+        LlamafuToken* tokens = nullptr;
+        int32_t n_tokens = 0;
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_tokenize(llamafu, text, static_cast<int32_t>(strlen(text)), &tokens,
+                                                    &n_tokens, false, false));
+        expected.emplace_back(tokens, tokens + n_tokens);
+        llamafu_free_tokens(tokens);
+        total += n_tokens;
+    }
+
+    // A buffer that is too small reports the size the next call needs
+    LlamafuToken small[1];
+    int32_t offsets[4];
+    int32_t n_tokens = -1;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_tokenize_batch(llamafu, texts, 3, small, 1, offsets, &n_tokens, false, false));
+    EXPECT_EQ(total, n_tokens);
+
+    std::vector<LlamafuToken> tokens(total);
+    ASSERT_EQ(LLAMAFU_SUCCESS,
+              llamafu_tokenize_batch(llamafu, texts, 3, tokens.data(), total, offsets, &n_tokens, false, false));
+    ASSERT_EQ(total, n_tokens);
+    EXPECT_EQ(0, offsets[0]);
+    for (int32_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(expected[i], std::vector<LlamafuToken>(tokens.begin() + offsets[i], tokens.begin() + offsets[i + 1]));
+    }
+}
+
+// =============================================================================
+// Scoring
+// =============================================================================
+
+TEST(LogitStatsTest, FindsArgmaxAndNormalizes) {
+    const std::vector<float> logits = {1.0f, 4.0f, -2.0f, 3.5f, 0.0f};
+    const LogitStats stats = logit_stats(logits.data(), static_cast<int32_t>(logits.size()));
+    EXPECT_EQ(1, stats.argmax);
+    EXPECT_FLOAT_EQ(4.0f, stats.max_logit);
+
+    double total = 0.0;
+    for (llama_token t = 0; t < static_cast<llama_token>(logits.size()); ++t) {
+        const float logprob = token_logprob(logits.data(), stats, t);
+        EXPECT_LE(logprob, 0.0f);
+        total += std::exp(static_cast<double>(logprob));
+    }
+    EXPECT_NEAR(1.0, total, 1e-6);
+
+    // Differences of logprobs are differences of logits
+    EXPECT_NEAR(logits[3] - logits[0], token_logprob(logits.data(), stats, 3) - token_logprob(logits.data(), stats, 0),
+                1e-5);
+}
+
+TEST(LogitStatsTest, StableForLargeLogits) {
+    const std::vector<float> logits = {1000.0f, 1000.0f, 990.0f};
+    const LogitStats stats = logit_stats(logits.data(), 3);
+    EXPECT_TRUE(std::isfinite(stats.log_sum));
+    EXPECT_EQ(0, stats.argmax);  // The first of equal maxima
+    EXPECT_NEAR(std::log(0.5), token_logprob(logits.data(), stats, 1), 1e-4);
+}
+
+TEST(TopLogprobsTest, MostLikelyFirst) {
+    const std::vector<float> logits = {0.5f, 3.0f, -1.0f, 2.0f, 1.0f, 4.0f};
+    const int32_t n_vocab = static_cast<int32_t>(logits.size());
+    const LogitStats stats = logit_stats(logits.data(), n_vocab);
+
+    LlamafuTokenLogprob top[3];
+    top_logprobs(logits.data(), n_vocab, stats, 3, top);
+    EXPECT_EQ(5, top[0].token);
+    EXPECT_EQ(1, top[1].token);
+    EXPECT_EQ(3, top[2].token);
+    for (const LlamafuTokenLogprob& entry : top) {
+        EXPECT_FLOAT_EQ(token_logprob(logits.data(), stats, entry.token), entry.logprob);
+    }
+    EXPECT_GT(top[0].logprob, top[1].logprob);
+    EXPECT_GT(top[1].logprob, top[2].logprob);
+}
+
+TEST(TopLogprobsTest, PadsPastVocabulary) {
+    const std::vector<float> logits = {2.0f, 1.0f};
+    const LogitStats stats = logit_stats(logits.data(), 2);
+
+    LlamafuTokenLogprob top[4];
+    top_logprobs(logits.data(), 2, stats, 4, top);
+    EXPECT_EQ(0, top[0].token);
+    EXPECT_EQ(1, top[1].token);
+    EXPECT_NEAR(1.0, std::exp(top[0].logprob) + std::exp(top[1].logprob), 1e-6);
+    for (int i = 2; i < 4; ++i) {
+        EXPECT_EQ(LLAMA_TOKEN_NULL, top[i].token);
+        EXPECT_EQ(-INFINITY, top[i].logprob);
+    }
+}
+
+TEST_F(ModelTest, ScoresAreConsistent) {
+    const char* continuations[] = {" yes", " no", " maybe not"};
+    const int32_t top_k = 4;
+    LlamafuScoreResult* result = nullptr;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_score_continuations(llamafu, "Question: is water wet? Answer:", continuations,
+                                                           3, top_k, &result));
+    ASSERT_NE(nullptr, result);
+    EXPECT_EQ(3, result->n_continuations);
+
+    for (int32_t c = 0; c < result->n_continuations; ++c) {
+        const LlamafuContinuationScore& score = result->continuations[c];
+        ASSERT_GT(score.n_tokens, 0);
+        double sum = 0.0;
+        bool greedy = true;
+        for (int32_t j = score.first; j < score.first + score.n_tokens; ++j) {
+            const LlamafuTokenLogprob& token = result->tokens[j];
+            const LlamafuTokenLogprob* top = result->top + static_cast<size_t>(j) * top_k;
+            EXPECT_LE(token.logprob, 0.0f);
+            EXPECT_LE(token.logprob, top[0].logprob + 1e-4f);
+            for (int32_t i = 1; i < top_k; ++i) {
+                EXPECT_GE(top[i - 1].logprob, top[i].logprob);
+            }
+            sum += token.logprob;
+            greedy = greedy && token.token == top[0].token;
+        }
+        EXPECT_NEAR(sum, score.logprob_sum, 1e-3);
+        EXPECT_EQ(greedy, score.is_greedy);
+    }
+    llamafu_score_result_free(result);
+}
+
+// =============================================================================
+// Prompt cache
+// =============================================================================
+
+TEST_F(ModelTest, ClearedMemoryIsNotReused) {
+    LlamafuInferParams params = {};
+    params.prompt = "The capital of France is";
+    params.max_tokens = 2;
+    params.temperature = 0.0f;
+    for (int i = 0; i < 2; ++i) {
+        char* result = nullptr;
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_complete(llamafu, &params, &result));
+        llamafu_free_string(result);
+    }
+    EXPECT_GT(llamafu->n_reused_last, 0);
+
+    // Cleared through the raw memory API, which cannot reach cached_tokens
+    llamafu_memory_clear(llamafu_get_memory(llamafu), false);
+    char* result = nullptr;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_complete(llamafu, &params, &result));
+    llamafu_free_string(result);
+    EXPECT_EQ(0, llamafu->n_reused_last);
+}
+
+// =============================================================================
+// Memory pressure
+// =============================================================================
+
+static std::string spill_test_dir() {
+    return (std::filesystem::temp_directory_path() / "llamafu_spill_test").string();
+}
+
+TEST(ReleaseMemoryTest, DiscardRemovesSpillFiles) {
+    auto handle = std::make_unique<Llamafu_s>();
+    const std::string dir = spill_test_dir();
+    std::filesystem::create_directories(dir);
+    for (llama_seq_id seq = 0; seq < 2; ++seq) {
+        const std::string path = dir + "/seq" + std::to_string(seq) + SPILL_EXT;
+        std::ofstream(path) << "state";
+        handle->spilled_seqs.emplace_back(seq, path);
+    }
+
+    const auto spilled = handle->spilled_seqs;
+    discard_spilled_sequences(handle.get());
+    EXPECT_TRUE(handle->spilled_seqs.empty());
+    for (const auto& entry : spilled) {
+        EXPECT_FALSE(std::filesystem::exists(entry.second));
+    }
+
+    // Files that are already gone are not an error
+    handle->spilled_seqs = spilled;
+    discard_spilled_sequences(handle.get());
+    EXPECT_TRUE(handle->spilled_seqs.empty());
+    std::filesystem::remove_all(dir);
+}
+
+TEST(ReleaseMemoryTest, LevelsOnlyIncrease) {
+    auto handle = std::make_unique<Llamafu_s>();
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_release_memory(handle.get(), LLAMAFU_RELEASE_WEIGHTS + 1, nullptr));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_release_memory(handle.get(), -1, nullptr));
+
+    // Asking for less than is already released changes nothing
+    handle->release_level = LLAMAFU_RELEASE_CONTEXT;
+    EXPECT_EQ(LLAMAFU_SUCCESS, llamafu_release_memory(handle.get(), LLAMAFU_RELEASE_CACHES, nullptr));
+    EXPECT_EQ(LLAMAFU_RELEASE_CONTEXT, llamafu_get_release_level(handle.get()));
+}
+
+TEST(ReleaseMemoryTest, BusyWhileHandleInUse) {
+    auto handle = std::make_unique<Llamafu_s>();
+    std::lock_guard<std::mutex> request(handle->generation_mutex);
+
+    // Returns at once instead of waiting for the request to finish
+    auto release = std::async(std::launch::async, [&] {
+        return llamafu_release_memory(handle.get(), LLAMAFU_RELEASE_CONTEXT, nullptr);
+    });
+    ASSERT_EQ(std::future_status::ready, release.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(LLAMAFU_ERROR_BUSY, release.get());
+    EXPECT_EQ(LLAMAFU_RELEASE_NONE, llamafu_get_release_level(handle.get()));
+}
+
+class SpillTest : public ModelTest {
+protected:
+    void* session = nullptr;
+    int32_t n_past = 0;
+
+    void SetUp() override {
+        ModelTest::SetUp();
+        if (IsSkipped() || HasFatalFailure()) {
+            return;
+        }
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_chat_session_create_kv(llamafu, "Be brief.", 1, &session));
+        LlamafuInferParams params = {};
+        params.max_tokens = 4;
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_chat_session_set_params(session, &params));
+
+        char* response = nullptr;
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_chat_session_complete(session, "Hi", nullptr, 0, &response));
+        llamafu_free_string(response);
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_chat_session_get_n_past(session, &n_past));
+        ASSERT_GT(n_past, 0);
+    }
+
+    void TearDown() override {
+        llamafu_chat_session_free(session);
+        ModelTest::TearDown();
+        std::filesystem::remove_all(spill_test_dir());
+    }
+
+    llama_pos seq_pos_max(llama_seq_id seq) const {
+        return llama_memory_seq_pos_max(llama_get_memory(llamafu->ctx), seq);
+    }
+};
+
+TEST_F(SpillTest, SessionSequenceSurvivesRelease) {
+    const std::string dir = spill_test_dir();
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_release_memory(llamafu, LLAMAFU_RELEASE_CONTEXT, dir.c_str()));
+    EXPECT_EQ(LLAMAFU_RELEASE_CONTEXT, llamafu_get_release_level(llamafu));
+    EXPECT_EQ(nullptr, llamafu->ctx);
+
+    bool spilled_session = false;
+    for (const auto& entry : llamafu->spilled_seqs) {
+        EXPECT_TRUE(std::filesystem::exists(entry.second));
+        spilled_session = spilled_session || entry.first == 1;
+    }
+    EXPECT_TRUE(spilled_session);
+    const auto spilled = llamafu->spilled_seqs;
+
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_resume(llamafu));
+    EXPECT_EQ(LLAMAFU_RELEASE_NONE, llamafu_get_release_level(llamafu));
+    EXPECT_TRUE(llamafu->spilled_seqs.empty());
+    for (const auto& entry : spilled) {
+        EXPECT_FALSE(std::filesystem::exists(entry.second));
+    }
+    EXPECT_EQ(n_past - 1, seq_pos_max(1));
+
+    // The next turn continues from the restored cells
+    int32_t n_past_after = 0;
+    char* response = nullptr;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_chat_session_complete(session, "Again", nullptr, 0, &response));
+    llamafu_free_string(response);
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_chat_session_get_n_past(session, &n_past_after));
+    EXPECT_GT(n_past_after, n_past);
+}
+
+TEST_F(SpillTest, FreedSessionIsNotRestored) {
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_release_memory(llamafu, LLAMAFU_RELEASE_CONTEXT, spill_test_dir().c_str()));
+    llamafu_chat_session_free(session);
+    session = nullptr;
+
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_resume(llamafu));
+    EXPECT_TRUE(llamafu->spilled_seqs.empty());
+    EXPECT_EQ(-1, seq_pos_max(1));
+    EXPECT_FALSE(llamafu->seq_in_use[1]);
+}
+
+TEST_F(SpillTest, WithoutSpillDirectorySessionsStartOver) {
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_release_memory(llamafu, LLAMAFU_RELEASE_CONTEXT, nullptr));
+    EXPECT_TRUE(llamafu->spilled_seqs.empty());
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_resume(llamafu));
+    EXPECT_EQ(-1, seq_pos_max(1));
+}
+
+// =============================================================================
+// Request scheduler
+// =============================================================================
+
+TEST(ScheduledRequestTest, PollWhileEmitting) {
+    auto req = std::make_shared<ScheduledRequest>();
+    LlamafuRequest request = new LlamafuRequest_s{req};
+
+    auto producer = std::async(std::launch::async, [&] {
+        for (int i = 0; i < 2000; ++i) {
+            scheduler_emit(*req, "ab", 2);
+        }
+        std::lock_guard<std::recursive_mutex> lock(req->mutex);
+        req->state = LLAMAFU_REQUEST_DONE;
+    });
+
+    std::string polled;
+    LlamafuRequestState state = LLAMAFU_REQUEST_QUEUED;
+    while (state != LLAMAFU_REQUEST_DONE) {
+        char* text = nullptr;
+        ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_request_poll(request, &text, &state));
+        polled += text;
+        free(text);
+    }
+    producer.get();
+    char* rest = nullptr;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_request_poll(request, &rest, &state));
+    polled += rest;
+    free(rest);
+    EXPECT_EQ(4000u, polled.size());
+    llamafu_request_free(request);
+}
+
+// The callback runs under the request lock and may poll its own request
+TEST(ScheduledRequestTest, CallbackMayPoll) {
+    struct Context {
+        LlamafuRequest request;
+        std::string seen;
+    } context;
+    auto req = std::make_shared<ScheduledRequest>();
+    context.request = new LlamafuRequest_s{req};
+    req->user_data = &context;
+    req->callback = [](const char*, void* data) {
+        auto* ctx = static_cast<Context*>(data);
+        char* text = nullptr;
+        LlamafuRequestState state;
+        llamafu_request_poll(ctx->request, &text, &state);
+        ctx->seen += text;
+        free(text);
+    };
+    scheduler_emit(*req, "hi", 2);
+    EXPECT_EQ("hi", context.seen);
+
+    llamafu_request_free(context.request);
+    EXPECT_TRUE(req->cancel_requested);
+    EXPECT_EQ(nullptr, req->callback);
+}
+
+// =============================================================================
+// Abort callback
+// =============================================================================
+
+// Each callback only accepts its own user_data; a torn swap would pair them up wrong
+static int abort_data_a = 0;
+static int abort_data_b = 0;
+static bool abort_check_a(void* data) { return data != &abort_data_a; }
+static bool abort_check_b(void* data) { return data != &abort_data_b; }
+
+TEST(AbortCallbackTest, SwappedWhilePolled) {
+    auto handle = std::make_unique<Llamafu_s>();
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_set_abort_callback(handle.get(), abort_check_a, &abort_data_a));
+
+    std::atomic<bool> done{false};
+    auto swapper = std::async(std::launch::async, [&] {
+        for (int i = 0; i < 5000; ++i) {
+            if (i % 2) {
+                llamafu_set_abort_callback(handle.get(), abort_check_a, &abort_data_a);
+            } else {
+                llamafu_set_abort_callback(handle.get(), abort_check_b, &abort_data_b);
+            }
+        }
+        done = true;
+    });
+    bool mismatched = false;
+    while (!done) {
+        mismatched |= generation_aborted(handle.get());
+    }
+    swapper.get();
+    EXPECT_FALSE(mismatched);
+}
+
+// =============================================================================
+// Timings
+// =============================================================================
+
+TEST(TimingsTest, WaitForRunningRequest) {
+    auto handle = std::make_unique<Llamafu_s>();
+    handle->metrics.t_sample_ms = 12.0;
+    handle->metrics.t_load_weights_ms = 30.0;
+    std::unique_lock<std::mutex> request(handle->generation_mutex);
+
+    // Reads report BUSY; the reset waits for the request to finish
+    LlamafuTimings timings;
+    LlamafuPerfStats stats;
+    auto read = std::async(std::launch::async, [&] {
+        return std::make_pair(llamafu_get_timings(handle.get(), &timings),
+                              llamafu_get_perf_stats(handle.get(), &stats));
+    });
+    ASSERT_EQ(std::future_status::ready, read.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(std::make_pair(LLAMAFU_ERROR_BUSY, LLAMAFU_ERROR_BUSY), read.get());
+
+    auto reset = std::async(std::launch::async, [&] { llamafu_reset_perf_stats(handle.get()); });
+    EXPECT_EQ(std::future_status::timeout, reset.wait_for(std::chrono::milliseconds(50)));
+    request.unlock();
+    ASSERT_EQ(std::future_status::ready, reset.wait_for(std::chrono::seconds(5)));
+
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_get_timings(handle.get(), &timings));
+    EXPECT_EQ(0.0, timings.t_sample_ms);
+    EXPECT_EQ(30.0, timings.t_load_ms);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
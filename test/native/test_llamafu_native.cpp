@@ -280,24 +280,493 @@ TEST_F(LlamafuNativeTest, ContextManagementValidation) {
 }
 
 TEST_F(LlamafuNativeTest, GrammarSamplerTest) {
-    LlamafuGrammarSampler sampler = llamafu_grammar_sampler_init(nullptr, "grammar", "root");
+    LlamafuGrammarSampler sampler = nullptr;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_grammar_sampler_init(nullptr, "grammar", "root", &sampler));
     EXPECT_EQ(nullptr, sampler);
 
-    sampler = llamafu_grammar_sampler_init(llamafu, nullptr, "root");
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_grammar_sampler_init(llamafu, nullptr, "root", &sampler));
     EXPECT_EQ(nullptr, sampler);
 
-    sampler = llamafu_grammar_sampler_init(llamafu, "", "root");
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_grammar_sampler_init(llamafu, "", "root", &sampler));
     EXPECT_EQ(nullptr, sampler);
 
-    sampler = llamafu_grammar_sampler_init(llamafu, "grammar", nullptr);
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_grammar_sampler_init(llamafu, "grammar", nullptr, &sampler));
     EXPECT_EQ(nullptr, sampler);
 
-    sampler = llamafu_grammar_sampler_init(llamafu, "grammar", "");
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_grammar_sampler_init(llamafu, "grammar", "", &sampler));
     EXPECT_EQ(nullptr, sampler);
 
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_grammar_sampler_init(llamafu, "grammar", "root", nullptr));
+
     llamafu_grammar_sampler_free(nullptr);
 }
 
+TEST_F(LlamafuNativeTest, CompleteWithGrammarValidation) {
+    LlamafuInferParams params = {};
+    params.prompt = "Hello";
+    params.max_tokens = 8;
+    LlamafuGrammarParams grammar = {"root ::= \"yes\" | \"no\"", "root"};
+    char* result = nullptr;
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_complete_with_grammar(nullptr, &params, &grammar, &result));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_complete_with_grammar(llamafu, &params, nullptr, &result));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_complete_with_grammar(llamafu, &params, &grammar, nullptr));
+    EXPECT_EQ(nullptr, result);
+}
+
+TEST_F(LlamafuNativeTest, KvChatSessionValidation) {
+    void* session = nullptr;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_chat_session_create_kv(nullptr, "system", 1, &session));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_chat_session_create_kv(llamafu, "system", 1, nullptr));
+    EXPECT_EQ(nullptr, session);
+
+    int32_t n_past = -1;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_chat_session_get_n_past(nullptr, &n_past));
+    EXPECT_EQ(-1, n_past);
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_chat_session_add_message(nullptr, "user", "hi", nullptr, 0));
+
+    llamafu_chat_session_free(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, SchedulerValidation) {
+    LlamafuInferParams params = {};
+    params.prompt = "Hello";
+    params.max_tokens = 16;
+    params.temperature = 0.7f;
+
+    LlamafuRequest request = nullptr;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_scheduler_submit(nullptr, &params, nullptr, nullptr, &request));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_scheduler_submit(llamafu, nullptr, nullptr, nullptr, &request));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_scheduler_submit(llamafu, &params, nullptr, nullptr, nullptr));
+    EXPECT_EQ(nullptr, request);
+
+    int32_t n_pending = 0;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_scheduler_step(nullptr, &n_pending));
+
+    char* text = nullptr;
+    LlamafuRequestState state = LLAMAFU_REQUEST_QUEUED;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_request_poll(nullptr, &text, &state));
+    EXPECT_EQ(nullptr, text);
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_request_cancel(nullptr));
+
+    llamafu_request_free(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, InitWithContextValidation) {
+    LlamafuModelParams model_params = createDefaultModelParams();
+    LlamafuContextParams ctx_params = llamafu_context_default_params();
+
+    EXPECT_GE(ctx_params.n_batch, 32u);
+    EXPECT_LE(ctx_params.n_ubatch, ctx_params.n_batch);
+    EXPECT_EQ(static_cast<uint32_t>(LLAMAFU_DEFAULT_N_SEQ_MAX), ctx_params.n_seq_max);
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(nullptr, &ctx_params, &llamafu));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, nullptr, &llamafu));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, nullptr));
+
+    model_params.model_path = "";
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+    EXPECT_EQ(nullptr, llamafu);
+}
+
+TEST_F(LlamafuNativeTest, ContextModeValidation) {
+    LlamafuModelParams model_params = createDefaultModelParams();
+    LlamafuContextParams ctx_params = llamafu_context_default_params();
+    EXPECT_EQ(LLAMAFU_CONTEXT_MODE_BOTH, ctx_params.context_mode);
+    EXPECT_EQ(LLAMAFU_POOLING_UNSPECIFIED, ctx_params.pooling_type);
+
+    ctx_params.context_mode = 7;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+
+    ctx_params.context_mode = LLAMAFU_CONTEXT_MODE_EMBEDDING;
+    ctx_params.pooling_type = 42;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+    EXPECT_EQ(nullptr, llamafu);
+}
+
+TEST_F(LlamafuNativeTest, KvCacheAndContextShiftValidation) {
+    LlamafuModelParams model_params = createDefaultModelParams();
+    LlamafuContextParams ctx_params = llamafu_context_default_params();
+    EXPECT_EQ(LLAMAFU_KV_CACHE_DEFAULT, ctx_params.type_k);
+    EXPECT_EQ(LLAMAFU_KV_CACHE_DEFAULT, ctx_params.type_v);
+    EXPECT_FALSE(ctx_params.context_shift);
+
+    ctx_params.type_k = 99;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+
+    ctx_params.type_k = LLAMAFU_KV_CACHE_Q8_0;
+    ctx_params.type_v = LLAMAFU_KV_CACHE_Q8_0;
+    ctx_params.context_shift = true;
+    ctx_params.n_keep = -2;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+    EXPECT_EQ(nullptr, llamafu);
+}
+
+static bool cancel_load(float /*progress*/, void* user_data) {
+    ++*static_cast<int*>(user_data);
+    return false;
+}
+
+TEST_F(LlamafuNativeTest, OffloadAndLoadParamsValidation) {
+    LlamafuModelParams model_params = createDefaultModelParams();
+    LlamafuContextParams ctx_params = llamafu_context_default_params();
+
+    model_params.n_gpu_layers = -2;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+
+    model_params.n_gpu_layers = 20;
+    model_params.split_mode = 9;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+
+    model_params.split_mode = LLAMAFU_SPLIT_MODE_NONE;
+    model_params.main_gpu = -1;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+
+    // Invalid parameters are rejected before loading starts
+    int calls = 0;
+    model_params.main_gpu = 0;
+    model_params.model_path = "";
+    model_params.progress_callback = cancel_load;
+    model_params.progress_callback_data = &calls;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_with_context(&model_params, &ctx_params, &llamafu));
+    EXPECT_EQ(0, calls);
+    EXPECT_EQ(nullptr, llamafu);
+}
+
+TEST_F(LlamafuNativeTest, EmbeddingsBatchValidation) {
+    const char* texts[] = {"first", "second"};
+    float matrix[8] = {};
+    int32_t n_embd = 0;
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_embeddings_batch(
+        nullptr, texts, 2, LLAMAFU_POOLING_MEAN, true, matrix, 8, &n_embd));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_embeddings_batch(
+        llamafu, nullptr, 2, LLAMAFU_POOLING_MEAN, true, matrix, 8, &n_embd));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_embeddings_batch(
+        llamafu, texts, 0, LLAMAFU_POOLING_MEAN, true, matrix, 8, &n_embd));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_embeddings_batch(
+        llamafu, texts, 2, LLAMAFU_POOLING_RANK, true, matrix, 8, &n_embd));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_embeddings_batch(
+        llamafu, texts, 2, LLAMAFU_POOLING_MEAN, true, nullptr, 8, &n_embd));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_embeddings_batch(
+        llamafu, texts, 2, LLAMAFU_POOLING_MEAN, true, matrix, 8, nullptr));
+    EXPECT_EQ(0, n_embd);
+}
+
+TEST_F(LlamafuNativeTest, TokenStreamValidation) {
+    LlamafuInferParams params = {};
+    params.prompt = "Hello";
+    params.max_tokens = 8;
+    LlamafuTokenStream stream = reinterpret_cast<LlamafuTokenStream>(0x1);
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_stream_start(nullptr, &params, 0, nullptr, nullptr, &stream));
+    EXPECT_EQ(nullptr, stream);
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_stream_start(llamafu, nullptr, 0, nullptr, nullptr, &stream));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_stream_start(llamafu, &params, 0, nullptr, nullptr, nullptr));
+
+    char text[16];
+    size_t text_len = 0;
+    bool finished = false;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_stream_read(
+        nullptr, text, sizeof(text), &text_len, nullptr, 0, nullptr, &finished));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_stream_cancel(nullptr));
+
+    // Should not crash
+    llamafu_stream_free(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, SchemaToGrammar) {
+    const char* schema = R"({
+        "type": "object",
+        "properties": {
+            "name": {"type": "string"},
+            "mood": {"enum": ["happy", "sad"]},
+            "tags": {"type": "array", "items": {"type": "string"}, "maxItems": 3}
+        },
+        "required": ["name", "mood"]
+    })";
+
+    char* grammar = nullptr;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_schema_to_grammar(schema, &grammar));
+    ASSERT_NE(nullptr, grammar);
+    const std::string text(grammar);
+    EXPECT_NE(std::string::npos, text.find("root ::= \"{\" ws \"\\\"name\\\"\""));
+    EXPECT_NE(std::string::npos, text.find("(\"\\\"happy\\\"\" | \"\\\"sad\\\"\")"));
+    EXPECT_NE(std::string::npos, text.find("{0,2}"));
+    free(grammar);
+
+    // Memoized result is identical
+    char* again = nullptr;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_schema_to_grammar(schema, &again));
+    EXPECT_EQ(text, std::string(again));
+    free(again);
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_schema_to_grammar("{\"type\": ", &grammar));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_schema_to_grammar("{\"$ref\": \"#/missing\"}", &grammar));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_schema_to_grammar(nullptr, &grammar));
+}
+
+TEST_F(LlamafuNativeTest, SpeculativeValidation) {
+    LlamafuSpeculativeParams params = llamafu_speculative_default_params();
+    EXPECT_EQ(LLAMAFU_DRAFT_NONE, params.draft_type);
+    EXPECT_GT(params.n_draft, 0);
+    EXPECT_LE(params.ngram_min, params.ngram_max);
+
+    params.draft_type = LLAMAFU_DRAFT_NGRAM;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_set_speculative(nullptr, &params));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_set_speculative(llamafu, nullptr));
+}
+
+TEST_F(LlamafuNativeTest, PromptCacheValidation) {
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_prompt_cache_enable(nullptr, "/tmp/llamafu_pc", 1 << 20, 256));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_prompt_cache_enable(llamafu, nullptr, 1 << 20, 256));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_prompt_cache_enable(llamafu, "/tmp/llamafu_pc", 0, 256));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_prompt_cache_enable(llamafu, "/tmp/llamafu_pc", 1 << 20, 8));
+
+    LlamafuPromptCacheStats stats;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_prompt_cache_get_stats(llamafu, &stats));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_prompt_cache_clear(llamafu));
+    llamafu_prompt_cache_disable(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, StateSnapshotValidation) {
+    uint64_t size = 0;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_state_save_fd(nullptr, 1, -1, &size));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_state_load_fd(nullptr, 0, -1));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_state_save_mapped(nullptr, "/tmp/llamafu_state.bin", 0, &size));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_state_load_mapped(llamafu, nullptr, -1));
+    EXPECT_EQ(0u, size);
+}
+
+TEST_F(LlamafuNativeTest, MemoryAccountingValidation) {
+    LlamafuMemoryUsage usage;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_memory_usage(llamafu, &usage));
+
+    int32_t count = -1;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_buffer_info(llamafu, nullptr, 0, &count));
+
+    bool fits = true;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_estimate_memory(nullptr, nullptr, 0, &usage, &fits));
+
+    LlamafuModelParams params = {};
+    params.model_path = "/nonexistent/model.gguf";
+    params.n_ctx = 2048;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_estimate_memory(&params, nullptr, 0, nullptr, &fits));
+    EXPECT_EQ(LLAMAFU_ERROR_FILE_NOT_FOUND, llamafu_estimate_memory(&params, nullptr, 0, &usage, &fits));
+}
+
+
+TEST_F(LlamafuNativeTest, SharedModelValidation) {
+    LlamafuModelParams model_params = createDefaultModelParams();
+    LlamafuContextParams ctx_params = llamafu_context_default_params();
+    LlamafuModel model = nullptr;
+    LlamafuModelLoad load = nullptr;
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_model_load(nullptr, &model));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_model_load(&model_params, nullptr));
+    model_params.model_path = "";
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_model_load(&model_params, &model));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_model_load_async(&model_params, &load));
+    EXPECT_EQ(nullptr, model);
+    EXPECT_EQ(nullptr, load);
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_init_from_model(nullptr, &ctx_params, &llamafu));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_swap_model(nullptr, nullptr));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_model_load_poll(nullptr, nullptr, &model));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_model_load_wait(nullptr, &model));
+    EXPECT_EQ(nullptr, llamafu_get_model(nullptr));
+    EXPECT_EQ(0, llamafu_model_ref_count(nullptr));
+
+    // NULL handles are ignored
+    llamafu_model_retain(nullptr);
+    llamafu_model_release(nullptr);
+    llamafu_model_load_cancel(nullptr);
+    llamafu_model_load_free(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, SharedModelLoadFailure) {
+    LlamafuModelParams model_params = createDefaultModelParams();
+    model_params.model_path = "/nonexistent/shared.gguf";
+    LlamafuModel model = nullptr;
+    EXPECT_EQ(LLAMAFU_ERROR_MODEL_LOAD_FAILED, llamafu_model_load(&model_params, &model));
+    EXPECT_EQ(nullptr, model);
+
+    // A failed background load reports its error once finished
+    LlamafuModelLoad load = nullptr;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_model_load_async(&model_params, &load));
+    ASSERT_NE(nullptr, load);
+    EXPECT_EQ(LLAMAFU_ERROR_MODEL_LOAD_FAILED, llamafu_model_load_wait(load, &model));
+    float progress = 0.0f;
+    EXPECT_EQ(LLAMAFU_ERROR_MODEL_LOAD_FAILED, llamafu_model_load_poll(load, &progress, nullptr));
+    EXPECT_EQ(1.0f, progress);
+    EXPECT_EQ(nullptr, model);
+    llamafu_model_load_free(load);
+}
+
+TEST_F(LlamafuNativeTest, LoraServingValidation) {
+    LlamafuLoraAdapter adapter = nullptr;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_lora_adapter_init(nullptr, "/tmp/a.gguf", &adapter));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_lora_adapter_apply(nullptr, nullptr, 1.0f));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_lora_adapter_remove(nullptr, nullptr));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_lora_adapter_clear_all(nullptr));
+
+    LlamafuLoraAdapterInfo info;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_lora_adapter_info(nullptr, nullptr, &info));
+
+    LlamafuLoraAdapterInfo* list = nullptr;
+    size_t n_adapters = 0;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_list_lora_adapters(nullptr, &list, &n_adapters));
+
+    LlamafuLoraBatch batch = {};
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_apply_lora_batch(nullptr, &batch));
+
+    // Freeing nothing is a no-op
+    llamafu_lora_adapter_free(nullptr);
+    llamafu_free_lora_adapter_list(nullptr);
+
+    // Requests default to the handle's active adapters
+    LlamafuInferParams params = {};
+    EXPECT_EQ(nullptr, params.lora_batch);
+}
+
+TEST_F(LlamafuNativeTest, ImageCacheValidation) {
+    LlamafuMediaInput input = {};
+    LlamafuImageProcessResult result;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_image_process(nullptr, &input, &result));
+
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_image_cache_set_budget(nullptr, 1 << 20));
+    LlamafuImageCacheStats stats;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_image_cache_get_stats(nullptr, &stats));
+    llamafu_image_cache_clear(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, ImageBatchProcessValidation) {
+    LlamafuImageProcessResult* results = nullptr;
+    size_t n_results = 0;
+    LlamafuMediaBatch batch = {};
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_image_batch_process(nullptr, &batch, &results, &n_results));
+
+    // A batch claiming inputs without an array is rejected before anything runs
+    batch.n_inputs = 2;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_image_batch_process(nullptr, &batch, &results, &n_results));
+
+    LlamafuImageProcessResult result = {};
+    EXPECT_FALSE(result.from_cache);
+    EXPECT_EQ(0.0, result.encode_time_ms);
+    llamafu_image_batch_result_free(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, MultimodalStreamValidation) {
+    LlamafuMultimodalInferParams params = {};
+    params.prompt = "Describe <__media__>";
+    auto callback = [](const char*, void*) {};
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_multimodal_complete_stream(nullptr, &params, callback, nullptr));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_multimodal_complete_streaming(nullptr, &params, callback, nullptr));
+
+    char* result = nullptr;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_multimodal_complete(nullptr, &params, &result));
+    EXPECT_EQ(nullptr, result);
+}
+
+TEST_F(LlamafuNativeTest, RequestQueueValidation) {
+    LlamafuInferParams params = {};
+    params.prompt = "Hello";
+    params.max_tokens = 8;
+    LlamafuJob job = reinterpret_cast<LlamafuJob>(0x1);
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM,
+              llamafu_queue_submit(nullptr, &params, 0, nullptr, nullptr, nullptr, &job));
+    EXPECT_EQ(nullptr, job);
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_queue_set_capacity(nullptr, 4));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_job_cancel(nullptr));
+
+    LlamafuRequestState state;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_job_get_state(nullptr, &state));
+    char* text = nullptr;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_job_wait(nullptr, 0, &text));
+    EXPECT_EQ(nullptr, text);
+    llamafu_job_free(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, ThreadpoolValidation) {
+    LlamafuCpuTopology topo = {};
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_get_cpu_topology(&topo));
+    EXPECT_GE(topo.n_cpus, 1);
+    EXPECT_EQ(topo.n_cpus, topo.n_performance + topo.n_efficiency);
+    EXPECT_EQ(0u, topo.performance_mask & topo.efficiency_mask);
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_cpu_topology(nullptr));
+
+    LlamafuThreadpoolParams params = llamafu_threadpool_default_params();
+    EXPECT_EQ(LLAMAFU_CORES_ALL, params.core_class);
+    EXPECT_EQ(0u, params.cpumask);
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_set_threadpools(nullptr, &params, nullptr));
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_set_threadpools(nullptr, nullptr, nullptr));
+
+    LlamafuAutotuneResult result;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_autotune_threads(nullptr, nullptr, false, &result));
+}
+
+TEST_F(LlamafuNativeTest, BenchRunValidation) {
+    LlamafuBenchParams params = {};
+    params.n_prompt = 32;
+    params.n_gen = 8;
+    params.repetitions = 3;
+    LlamafuBenchStats pp, tg;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_bench_run(nullptr, &params, &pp, &tg));
+
+    LlamafuBenchResult result;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_bench_model(nullptr, 4, 16, &result));
+}
+
+TEST_F(LlamafuNativeTest, RequestMetricsValidation) {
+    LlamafuRequestMetrics metrics;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_request_metrics(nullptr, &metrics));
+
+    LlamafuTimings timings;
+    EXPECT_EQ(LLAMAFU_ERROR_INVALID_PARAM, llamafu_get_timings(nullptr, &timings));
+
+    // Resetting a null handle is a no-op
+    llamafu_reset_timings(nullptr);
+    llamafu_reset_perf_stats(nullptr);
+}
+
+TEST_F(LlamafuNativeTest, MediaSourceIngestion) {
+    const unsigned char png_magic[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n', 0, 0, 0, 13};
+
+    // Base64 decoding stops at the padding
+    LlamafuMediaInput input = {};
+    input.type = LLAMAFU_MEDIA_TYPE_IMAGE;
+    input.source_type = LLAMAFU_DATA_SOURCE_BASE64;
+    input.data = "iVBORw0KGgoAAAAN=";
+    LlamafuImageValidation validation;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_image_validate(&input, &validation));
+    EXPECT_EQ(LLAMAFU_IMAGE_FORMAT_PNG, validation.detected_format);
+    EXPECT_EQ(sizeof(png_magic), validation.file_size_bytes);
+
+    // Binary inputs are read in place
+    input.source_type = LLAMAFU_DATA_SOURCE_BINARY;
+    input.data = png_magic;
+    input.data_size = sizeof(png_magic);
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_image_validate(&input, &validation));
+    EXPECT_EQ(LLAMAFU_IMAGE_FORMAT_PNG, validation.detected_format);
+
+    // Files are mapped
+    const char* path = "/tmp/llamafu_media_source.png";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(png_magic), sizeof(png_magic));
+    }
+    input.source_type = LLAMAFU_DATA_SOURCE_FILE_PATH;
+    input.data = path;
+    input.data_size = 0;
+    ASSERT_EQ(LLAMAFU_SUCCESS, llamafu_image_validate(&input, &validation));
+    EXPECT_EQ(sizeof(png_magic), validation.file_size_bytes);
+    std::remove(path);
+
+    input.data = "/tmp/llamafu_missing_media.png";
+    EXPECT_EQ(LLAMAFU_ERROR_FILE_NOT_FOUND, llamafu_image_validate(&input, &validation));
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -25,185 +25,6 @@ private:
     std::chrono::high_resolution_clock::time_point start_;
 };
 
-void createMockModelFile(const std::string& path, size_t sizeMB = 10) {
-    std::ofstream file(path, std::ios::binary);
-
-    // Write GGUF header
-    const char gguf_magic[] = "GGUF";
-    file.write(gguf_magic, 4);
-
-    uint32_t version = 3;
-    file.write(reinterpret_cast<const char*>(&version), sizeof(version));
-
-    uint64_t tensor_count = 0;
-    file.write(reinterpret_cast<const char*>(&tensor_count), sizeof(tensor_count));
-
-    uint64_t metadata_kv_count = 0;
-    file.write(reinterpret_cast<const char*>(&metadata_kv_count), sizeof(metadata_kv_count));
-
-    // Fill with mock data
-    const size_t total_size = sizeMB * 1024 * 1024;
-    const size_t header_size = 4 + 4 + 8 + 8; // magic + version + counts
-    const size_t remaining = total_size - header_size;
-
-    std::vector<char> mock_data(remaining, 0);
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 255);
-
-    for (size_t i = 0; i < remaining; ++i) {
-        mock_data[i] = static_cast<char>(dis(gen));
-    }
-
-    file.write(mock_data.data(), remaining);
-    file.close();
-}
-
-bool testInitializationPerformance() {
-    std::cout << "\n=== Initialization Performance Tests ===" << std::endl;
-
-    const std::string model_path = "/tmp/test_model_perf.gguf";
-    createMockModelFile(model_path, 10); // 10MB mock model
-
-    // Test different context sizes
-    std::vector<int32_t> context_sizes = {512, 1024, 2048, 4096};
-
-    for (int32_t ctx_size : context_sizes) {
-        PerformanceTimer timer("Initialization (ctx=" + std::to_string(ctx_size) + ")");
-
-        LlamafuModelParams params = {};
-        params.model_path = model_path.c_str();
-        params.n_ctx = ctx_size;
-        params.n_threads = 4;
-        params.use_gpu = false;
-        params.mmproj_path = nullptr;
-
-        Llamafu llamafu = nullptr;
-        int32_t result = llamafu_init(&params, &llamafu);
-
-        if (result != LLAMAFU_SUCCESS) {
-            std::cout << "  Expected initialization failure with mock model: " << result << std::endl;
-        }
-
-        if (llamafu) {
-            llamafu_free(llamafu);
-        }
-    }
-
-    std::remove(model_path.c_str());
-    return true;
-}
-
-bool testTokenizationPerformance() {
-    std::cout << "\n=== Tokenization Performance Tests ===" << std::endl;
-
-    const std::string model_path = "/tmp/test_model_tok.gguf";
-    createMockModelFile(model_path, 5);
-
-    LlamafuModelParams params = {};
-    params.model_path = model_path.c_str();
-    params.n_ctx = 2048;
-    params.n_threads = 4;
-    params.use_gpu = false;
-
-    Llamafu llamafu = nullptr;
-    int32_t result = llamafu_init(&params, &llamafu);
-
-    if (result != LLAMAFU_SUCCESS) {
-        std::cout << "Mock model initialization failed (expected): " << result << std::endl;
-        std::remove(model_path.c_str());
-        return true; // Still pass the test since we're using mock data
-    }
-
-    // Test different text lengths
-    std::vector<std::string> test_texts = {
-        "Short text",
-        "This is a medium length text that should take a bit more time to tokenize than the short text.",
-        std::string(1000, 'A'), // Long text
-        std::string(10000, 'B'), // Very long text
-    };
-
-    for (const auto& text : test_texts) {
-        PerformanceTimer timer("Tokenization (" + std::to_string(text.length()) + " chars)");
-
-        LlamafuToken* tokens = nullptr;
-        int32_t n_tokens = 0;
-
-        int32_t tok_result = llamafu_tokenize(llamafu, text.c_str(), &tokens, &n_tokens);
-
-        if (tok_result == LLAMAFU_SUCCESS && tokens) {
-            std::cout << "  Tokenized " << text.length() << " chars into " << n_tokens << " tokens" << std::endl;
-            llamafu_free_tokens(tokens);
-        }
-    }
-
-    if (llamafu) {
-        llamafu_free(llamafu);
-    }
-
-    std::remove(model_path.c_str());
-    return true;
-}
-
-bool testConcurrentOperations() {
-    std::cout << "\n=== Concurrent Operations Tests ===" << std::endl;
-
-    const std::string model_path = "/tmp/test_model_conc.gguf";
-    createMockModelFile(model_path, 5);
-
-    const int num_threads = 4;
-    const int operations_per_thread = 10;
-
-    auto worker = [&](int thread_id) {
-        PerformanceTimer timer("Thread " + std::to_string(thread_id));
-
-        LlamafuModelParams params = {};
-        params.model_path = model_path.c_str();
-        params.n_ctx = 1024;
-        params.n_threads = 2;
-        params.use_gpu = false;
-
-        Llamafu llamafu = nullptr;
-        int32_t result = llamafu_init(&params, &llamafu);
-
-        if (result != LLAMAFU_SUCCESS) {
-            std::cout << "  Thread " << thread_id << " init failed (expected): " << result << std::endl;
-            return;
-        }
-
-        for (int i = 0; i < operations_per_thread; ++i) {
-            std::string text = "Concurrent test " + std::to_string(thread_id) + "_" + std::to_string(i);
-
-            LlamafuToken* tokens = nullptr;
-            int32_t n_tokens = 0;
-
-            int32_t tok_result = llamafu_tokenize(llamafu, text.c_str(), &tokens, &n_tokens);
-
-            if (tok_result == LLAMAFU_SUCCESS && tokens) {
-                llamafu_free_tokens(tokens);
-            }
-        }
-
-        if (llamafu) {
-            llamafu_free(llamafu);
-        }
-    };
-
-    PerformanceTimer total_timer("Total concurrent operations");
-
-    std::vector<std::thread> threads;
-    for (int i = 0; i < num_threads; ++i) {
-        threads.emplace_back(worker, i);
-    }
-
-    for (auto& thread : threads) {
-        thread.join();
-    }
-
-    std::remove(model_path.c_str());
-    return true;
-}
-
 bool testMemoryOperations() {
     std::cout << "\n=== Memory Operations Tests ===" << std::endl;
 
@@ -363,10 +184,8 @@ int main() {
 
     bool all_passed = true;
 
-    // Run all performance tests
-    all_passed &= testInitializationPerformance();
-    all_passed &= testTokenizationPerformance();
-    all_passed &= testConcurrentOperations();
+    // Run all performance tests. Model throughput is measured by
+    // llamafu_bench (bench_llamafu_native.cpp) against a real GGUF file.
     all_passed &= testMemoryOperations();
     all_passed &= testImageProcessingPerformance();
     all_passed &= testStressConditions();